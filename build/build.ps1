@@ -8,7 +8,7 @@ It determines the number of CPU cores for parallel make jobs.
 It invokes ./build/gcc.ps1 to ensure the correct GCC toolchain is available
 and in the PATH, then executes the 'make' command.
 
-It passes standard arguments (AXIS=5 PAXIS=3 CNC=1) and any additional
+It passes standard arguments (AXIS=5 PAXIS=3 CNC=1 CARTESIAN=1) and any additional
 key=value pairs or make targets provided directly to the make command.
 
 .PARAMETER GccVersion
@@ -83,7 +83,7 @@ $GccScriptPath = Join-Path $ScriptDir "gcc.ps1"
 
 # --- Configuration ---
 $DefaultGccVersion = '14.2' # Match the default in gcc.ps1
-$BaseMakeArgs = "AXIS=5 PAXIS=3 CNC=1" # Standard args for this firmware
+$BaseMakeArgs = "AXIS=5 PAXIS=3 CNC=1 CARTESIAN=1" # Standard args for this firmware
 
 # --- Helper Functions ---
 
@@ -9,7 +9,7 @@ ORIGINAL_PWD="$PWD"
 
 # --- Configuration ---
 DEFAULT_GCC_VERSION="14.2" # Match the default in gcc.sh
-BASE_MAKE_ARGS="AXIS=5 PAXIS=3 CNC=1" # Standard args for this firmware
+BASE_MAKE_ARGS="AXIS=5 PAXIS=3 CNC=1 CARTESIAN=1" # Standard args for this firmware
 
 # --- Helper Functions ---
 
@@ -40,7 +40,7 @@ print_help() {
   echo "Usage: $0 [options] [make_variable=value...]"
   echo ""
   echo "Runs the firmware build process using the specified ARM GCC toolchain."
-  echo "Passes standard arguments (AXIS=5 PAXIS=3 CNC=1) and any additional"
+  echo "Passes standard arguments (AXIS=5 PAXIS=3 CNC=1 CARTESIAN=1) and any additional"
   echo "key=value pairs directly to make."
   echo ""
   echo "Options:"
@@ -116,11 +116,18 @@ else
 	CPPSRCS21 = $(filter-out $(SRC)/modules/utils/panel/screens/cnc/%,$(CPPSRCS2))
 endif
 
+# Cartesian only build leaves out all the other arm solutions, and the delta leveling strategies
+ifeq "$(CARTESIAN)" "1"
+	CPPSRCS22 = $(filter-out $(SRC)/modules/robot/arm_solutions/% $(SRC)/modules/tools/zprobe/Delta%Strategy.cpp,$(CPPSRCS21))
+else
+	CPPSRCS22 = $(CPPSRCS21)
+endif
+
 # Totally exclude any modules listed in EXCLUDE_MODULES
 # uppercase function
 uc = $(subst a,A,$(subst b,B,$(subst c,C,$(subst d,D,$(subst e,E,$(subst f,F,$(subst g,G,$(subst h,H,$(subst i,I,$(subst j,J,$(subst k,K,$(subst l,L,$(subst m,M,$(subst n,N,$(subst o,O,$(subst p,P,$(subst q,Q,$(subst r,R,$(subst s,S,$(subst t,T,$(subst u,U,$(subst v,V,$(subst w,W,$(subst x,X,$(subst y,Y,$(subst z,Z,$1))))))))))))))))))))))))))
 EXL = $(patsubst %,$(SRC)/modules/%/%,$(EXCLUDED_MODULES))
-CPPSRCS3 = $(filter-out $(EXL),$(CPPSRCS21))
+CPPSRCS3 = $(filter-out $(EXL),$(CPPSRCS22))
 DEFINES += $(call uc, $(subst /,_,$(patsubst %,-DNO_%,$(EXCLUDED_MODULES))))
 
 # do not compile the src/testframework as that can only be done with rake
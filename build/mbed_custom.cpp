@@ -202,6 +202,10 @@ extern "C" void __cxa_pure_virtual(void)
 }
 
 
+/* Counted by the malloc and realloc wrappers for the allocation rate in MemoryStats. */
+extern "C" volatile uint32_t g_heap_alloc_count;
+volatile uint32_t g_heap_alloc_count = 0;
+
 /* Trap calls to malloc/free/realloc in ISR. */
 extern "C" void __malloc_lock(void)
 {
@@ -270,6 +274,7 @@ extern "C" __attribute__((naked)) void __wrap_malloc(size_t size)
 
 extern "C" void *mallocWithTag(size_t size, unsigned int tag)
 {
+    g_heap_alloc_count++;
     void *p = __real_malloc(size + sizeof(tag));
     if (!p && __smoothieHeapBase)
         return p;
@@ -315,6 +320,7 @@ extern "C" __attribute__((naked)) void __wrap_realloc(void *ptr, size_t size)
 
 extern "C" void *reallocWithTag(void *ptr, size_t size, unsigned int tag)
 {
+    g_heap_alloc_count++;
     void *p = __real_realloc(ptr, size + sizeof(tag));
     if (!p)
         return p;
@@ -365,6 +371,7 @@ extern "C" void *__real_malloc(size_t size);
 extern "C" void *__wrap_malloc(size_t size)
 {
     breakOnHeapOpFromInterruptHandler();
+    g_heap_alloc_count++;
     return __real_malloc(size);
 }
 
@@ -373,6 +380,7 @@ extern "C" void *__real_realloc(void *ptr, size_t size);
 extern "C" void *__wrap_realloc(void *ptr, size_t size)
 {
     breakOnHeapOpFromInterruptHandler();
+    g_heap_alloc_count++;
     return __real_realloc(ptr, size);
 }
 
@@ -0,0 +1,68 @@
+#!/usr/bin/env python3
+"""
+PC Sample Profile Symbolizer
+
+Maps the slots the firmware's $R command prints to the functions they fall in, using the symbols
+of the .elf the running firmware was built from, and lists the functions by their share of samples.
+
+Usage:
+    ./pcprof.py ../LPC1768/main.elf samples.txt
+    ./pcprof.py --nm arm-none-eabi-nm ../LPC1768/main.elf < samples.txt
+"""
+
+import argparse
+import bisect
+import subprocess
+import sys
+from collections import defaultdict
+
+
+def load_symbols(nm, elf):
+    """Return the sorted start addresses and names of the functions in the elf."""
+    out = subprocess.run([nm, "-n", "-C", "--defined-only", elf], check=True, capture_output=True, text=True).stdout
+    addrs, names = [], []
+    for line in out.splitlines():
+        parts = line.split(None, 2)
+        if len(parts) < 3 or parts[1] not in "tTwW":
+            continue
+        # thumb function symbols have the low bit set
+        addrs.append(int(parts[0], 16) & ~1)
+        names.append(parts[2])
+    return addrs, names
+
+
+def parse_samples(lines):
+    """Yield (pc, count) from the $R output."""
+    for line in lines:
+        line = line.strip()
+        if not line or line.startswith('#') or line == 'ok':
+            continue
+        parts = line.split()
+        if len(parts) == 2:
+            yield int(parts[0], 16), int(parts[1])
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Map $R PC samples to functions")
+    parser.add_argument("elf", help="the .elf the firmware was built as")
+    parser.add_argument("samples", nargs="?", help="the $R output, stdin if omitted")
+    parser.add_argument("--nm", default="arm-none-eabi-nm", help="the nm to read the symbols with")
+    args = parser.parse_args()
+
+    addrs, names = load_symbols(args.nm, args.elf)
+    src = open(args.samples) if args.samples else sys.stdin
+    with src:
+        samples = list(parse_samples(src))
+
+    per_function = defaultdict(int)
+    for pc, count in samples:
+        i = bisect.bisect_right(addrs, pc) - 1
+        per_function[names[i] if i >= 0 else "0x%08x" % pc] += count
+
+    total = sum(per_function.values()) or 1
+    for name, count in sorted(per_function.items(), key=lambda kv: -kv[1]):
+        print("%6.2f%% %7d  %s" % (100.0 * count / total, count, name))
+
+
+if __name__ == "__main__":
+    main()
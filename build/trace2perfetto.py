@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+"""
+Event Trace to Chrome/Perfetto Converter
+
+Turns the output of the firmware's `trace dump` command into the Chrome trace event JSON that
+chrome://tracing and ui.perfetto.dev open. Each event gets its own track, begin and end pairs become
+spans and the rest instants. The microsecond timestamps wrap after 71 minutes, which is undone here.
+
+Usage:
+    ./trace2perfetto.py dump.txt > trace.json
+    ./trace2perfetto.py < dump.txt > trace.json
+"""
+
+import argparse
+import json
+import sys
+
+WRAP = 1 << 32
+
+
+def parse_dump(lines):
+    """Yield (us, event, phase, arg) from the dump, with the timestamps unwrapped."""
+    last = None
+    offset = 0
+    for line in lines:
+        line = line.strip()
+        if not line or line.startswith('#') or line == 'ok':
+            continue
+        parts = line.split()
+        if len(parts) != 4:
+            continue
+        us, event, phase, arg = int(parts[0]), parts[1], parts[2], int(parts[3])
+        if last is not None and us < last:
+            offset += WRAP
+        last = us
+        yield us + offset, event, phase, arg
+
+
+def convert(entries):
+    tracks = {}
+    events = []
+    open_spans = {}
+
+    def track(name):
+        if name not in tracks:
+            tracks[name] = len(tracks) + 1
+            events.append({"name": "thread_name", "ph": "M", "pid": 1, "tid": tracks[name], "args": {"name": name}})
+        return tracks[name]
+
+    for us, event, phase, arg in entries:
+        tid = track(event)
+        if phase == 'B':
+            open_spans.setdefault(event, []).append((us, arg))
+        elif phase == 'E':
+            stack = open_spans.get(event)
+            # an end whose begin was overwritten in the ring is dropped
+            if not stack:
+                continue
+            start, start_arg = stack.pop()
+            events.append({"name": event, "ph": "X", "ts": start, "dur": us - start, "pid": 1, "tid": tid,
+                           "args": {"arg": start_arg, "end_arg": arg}})
+        else:
+            events.append({"name": event, "ph": "i", "s": "t", "ts": us, "pid": 1, "tid": tid, "args": {"arg": arg}})
+
+    return {"traceEvents": events, "displayTimeUnit": "ms"}
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Convert a firmware trace dump to a Chrome/Perfetto trace")
+    parser.add_argument("dump", nargs="?", help="the trace dump text, stdin if omitted")
+    args = parser.parse_args()
+
+    src = open(args.dump) if args.dump else sys.stdin
+    with src:
+        json.dump(convert(parse_dump(src)), sys.stdout)
+
+
+if __name__ == "__main__":
+    main()
@@ -54,6 +54,7 @@ void serial_putc       (serial_t *obj, int c);
 int  serial_readable   (serial_t *obj);
 int  serial_writable   (serial_t *obj);
 void serial_clear      (serial_t *obj);
+void serial_rx_fifo_level(serial_t *obj, int level);
 
 void serial_pinout_tx(PinName tx);
 
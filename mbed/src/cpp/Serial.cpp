@@ -41,6 +41,10 @@ int Serial::writeable() {
     return serial_writable(&_serial);
 }
 
+void Serial::rx_fifo_level(int level) {
+    serial_rx_fifo_level(&_serial, level);
+}
+
 void Serial::attach(void (*fptr)(void), IrqType type) {
     if (fptr) {
         _irq[type].attach(fptr);
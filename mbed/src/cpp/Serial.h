@@ -100,6 +100,16 @@ public:
      */
     int writeable();
 
+    /** Set how full the receive FIFO gets before the RxIrq is called
+     *
+     *  @param level 0 = 1 char (default), 1 = 4 chars, 2 = 8 chars, 3 = 14 chars
+     *
+     *  @note
+     *    The RxIrq is also called when fewer chars have been waiting for a few char times,
+     *    so the handler should read while readable()
+     */
+    void rx_fifo_level(int level);
+
     /** Attach a function to call whenever a serial interrupt is generated
      *
      *  @param fptr A pointer to a void function, or 0 to set as none
@@ -31,6 +31,14 @@ static void sample_isr(int chan, uint32_t value)
 Adc::Adc()
 {
     instance = this;
+    memset(sample_buffers, 0, sizeof(sample_buffers));
+    memset(sample_index, 0, sizeof(sample_index));
+    memset((void *)sample_sets, 0, sizeof(sample_sets));
+    memset(filtered_set, 0, sizeof(filtered_set));
+    memset(filtered, 0, sizeof(filtered));
+#ifdef OVERSAMPLE
+    memset(ave_buf, 0, sizeof(ave_buf));
+#endif
     // ADC sample rate need to be fast enough to be able to read the enabled channels within the thermistor poll time
     // even though ther maybe 32 samples we only need one new one within the polling time
     const uint32_t sample_rate= 1000; // 1KHz sample rate
@@ -58,30 +66,48 @@ void Adc::enable_pin(Pin *pin)
     PinName pin_name = this->_pin_to_pinname(pin);
     int channel = adc->_pin_to_channel(pin_name);
     memset(sample_buffers[channel], 0, sizeof(sample_buffers[0]));
+    sample_index[channel] = 0;
 
     this->adc->burst(1);
     this->adc->setup(pin_name, 1);
     this->adc->interrupt_state(pin_name, 1);
 }
 
-// Keeps the last 8 values for each channel
+// Keeps the last num_samples values for each channel
 // This is called in an ISR, so sample_buffers needs to be accessed atomically
 void Adc::new_sample(int chan, uint32_t value)
 {
-    // Shuffle down and add new value to the end
+    // overwrite the oldest, the order does not matter to the filter
     if(chan < num_channels) {
-        memmove(&sample_buffers[chan][0], &sample_buffers[chan][1], sizeof(sample_buffers[0]) - sizeof(sample_buffers[0][0]));
-        sample_buffers[chan][num_samples - 1] = (value >> 4) & 0xFFF; // the 12 bit ADC reading
+        uint8_t i = sample_index[chan];
+        sample_buffers[chan][i] = (value >> 4) & 0xFFF; // the 12 bit ADC reading
+        if(++i >= num_samples) {
+            i = 0;
+            sample_sets[chan] = sample_sets[chan] + 1;
+        }
+        sample_index[chan] = i;
     }
 }
 
-//#define USE_MEDIAN_FILTER
 // Read the filtered value ( burst mode ) on a given pin
+// the samples are taken continuously in burst mode, this only filters them again when a whole new set has come in
 unsigned int Adc::read(Pin *pin)
 {
     PinName p = this->_pin_to_pinname(pin);
     int channel = adc->_pin_to_channel(p);
+    if(channel < 0 || channel >= num_channels) return 0;
 
+    uint16_t sets = sample_sets[channel];
+    if(sets != filtered_set[channel]) {
+        filtered_set[channel] = sets;
+        filtered[channel] = filter(channel);
+    }
+    return filtered[channel];
+}
+
+//#define USE_MEDIAN_FILTER
+unsigned int Adc::filter(int channel)
+{
     uint16_t median_buffer[num_samples];
     // needs atomic access TODO maybe be able to use std::atomic here or some lockless mutex
     __disable_irq();
@@ -96,7 +122,6 @@ unsigned int Adc::read(Pin *pin)
     // Oversample to get 2 extra bits of resolution
     // weed out top and bottom worst values then oversample the rest
     // put into a 4 element moving average and return the average of the last 4 oversampled readings
-    static uint16_t ave_buf[num_channels][4] =  { {0} };
     std::sort(median_buffer, median_buffer + num_samples);
     uint32_t sum = 0;
     for (int i = num_samples / 4; i < (num_samples - (num_samples / 4)); ++i) {
@@ -41,6 +41,7 @@ public:
 
 private:
     PinName _pin_to_pinname(Pin *pin);
+    unsigned int filter(int channel);
     mbed::ADC *adc;
 
     static const int num_channels= 6;
@@ -50,8 +51,18 @@ private:
 #else
     static const int num_samples= 8;
 #endif
-    // buffers storing the last num_samples readings for each channel
+    // buffers storing the last num_samples readings for each channel, written round robin by the ISR
     uint16_t sample_buffers[num_channels][num_samples];
+    uint8_t sample_index[num_channels];
+    // counts up each time a channel's buffer has been completely refilled
+    volatile uint16_t sample_sets[num_channels];
+
+    // the filtered value is only worked out again once there is a new set of samples to filter
+    uint16_t filtered_set[num_channels];
+    unsigned int filtered[num_channels];
+#ifdef OVERSAMPLE
+    uint16_t ave_buf[num_channels][4];
+#endif
 };
 
 #endif
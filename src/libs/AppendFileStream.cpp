@@ -1,12 +1,14 @@
 #include "AppendFileStream.h"
-#include <stdio.h>
+#include "WriteQueue.h"
 
+// the lines are batched by the write queue instead of opening the file for every one
 int AppendFileStream::puts(const char *str, int size)
 {
-    FILE *fd= fopen(this->fn, "a");
-    if(fd == NULL) return 0;
+    size_t n = (size > 0) ? size : strlen(str);
+    return WriteQueue::append(this->fn, str, n) ? n : 0;
+}
 
-    int n= fwrite(str, 1, strlen(str), fd);
-    fclose(fd);
-    return n;
+bool AppendFileStream::sync()
+{
+    return WriteQueue::sync(this->fn);
 }
@@ -10,6 +10,8 @@ class AppendFileStream : public StreamOutput {
         AppendFileStream(const char *filename) { fn= strdup(filename); }
         virtual ~AppendFileStream(){ free(fn); }
         int puts(const char*, int size = 0);
+        // the appends are queued, this is the barrier to know they are on the card
+        bool sync();
 
     private:
         char *fn;
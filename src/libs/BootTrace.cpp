@@ -0,0 +1,100 @@
+#include "BootTrace.h"
+
+#include "platform_memory.h"
+#include "StreamOutput.h"
+#include "us_ticker_api.h"
+
+// enough for the modules and switches of a full config
+#define BOOT_TRACE_ENTRIES 64
+
+namespace BootTrace {
+
+namespace {
+    struct entry_t {
+        const char *what;           // nullptr for a module
+        const void *module;
+        const void *vtable;
+        uint32_t start_us;
+        uint32_t us;
+        uint8_t depth;
+    };
+
+    entry_t *entries = nullptr;
+    uint8_t n_entries = 0;
+    uint8_t depth = 0;
+    uint16_t dropped = 0;
+    uint32_t first_us = 0;
+    uint32_t done_us = 0;
+    bool finished = false;
+
+    int add(const char *what, const void *module, const void *vtable)
+    {
+        if (finished) return -1;
+
+        uint32_t now = us_ticker_read();
+        if (entries == nullptr) {
+            entries = (entry_t *)AHB.alloc(sizeof(entry_t) * BOOT_TRACE_ENTRIES);
+            if (entries == nullptr) {
+                finished = true;
+                return -1;
+            }
+            first_us = now;
+        }
+        if (n_entries >= BOOT_TRACE_ENTRIES) {
+            dropped++;
+            return -1;
+        }
+
+        entries[n_entries] = {what, module, vtable, now - first_us, 0, depth++};
+        return n_entries++;
+    }
+}
+
+int begin(const char *what)
+{
+    return add(what, nullptr, nullptr);
+}
+
+int begin(Module *module)
+{
+    // the vtable is read now, the module may delete itself when it finds it is not enabled
+    return add(nullptr, module, *(void **)module);
+}
+
+void end(int id)
+{
+    if (finished || entries == nullptr) return;
+    if (depth > 0) depth--;
+    if (id < 0) return;
+    entries[id].us = us_ticker_read() - first_us - entries[id].start_us;
+}
+
+void done()
+{
+    if (finished) return;
+    finished = true;
+    done_us = us_ticker_read() - first_us;
+}
+
+void print(StreamOutput *stream)
+{
+    if (entries == nullptr) {
+        stream->printf("No boot trace\n");
+        return;
+    }
+
+    stream->printf("start_ms took_ms what (modules by address and vtable, see the map file)\n");
+    for (int i = 0; i < n_entries; i++) {
+        const entry_t &e = entries[i];
+        stream->printf("%5lu.%03lu %5lu.%03lu %*s", e.start_us / 1000, e.start_us % 1000, e.us / 1000, e.us % 1000, e.depth * 2, "");
+        if (e.what != nullptr) {
+            stream->printf("%s\n", e.what);
+        } else {
+            stream->printf("module %p %p\n", e.module, e.vtable);
+        }
+    }
+    if (dropped > 0) stream->printf("%u more not recorded\n", dropped);
+    if (finished) stream->printf("ready after %lu ms\n", done_us / 1000);
+}
+
+}
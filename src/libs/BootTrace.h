@@ -0,0 +1,27 @@
+#ifndef _BOOTTRACE_H
+#define _BOOTTRACE_H
+
+#include <cstdint>
+
+class Module;
+class StreamOutput;
+
+/*
+ * Where the time goes while booting. Each add_module() and each of the bigger phases of the kernel and main() set up
+ * is timed and kept in RAM until the boot command prints it. Modules have no names, they are listed by address and
+ * vtable which can be looked up in the map file, as the event profiler does. Phases can nest, a module loading
+ * others is shown above them.
+ */
+namespace BootTrace {
+    // starts timing a phase, what has to be a string literal, returns the id to end it with
+    int begin(const char *what);
+    int begin(Module *module);
+    void end(int id);
+
+    // the boot is over, anything started from now on is not recorded
+    void done();
+
+    void print(StreamOutput *stream);
+}
+
+#endif /* _BOOTTRACE_H */
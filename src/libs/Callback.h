@@ -0,0 +1,47 @@
+#ifndef _CALLBACK_H
+#define _CALLBACK_H
+
+#include <cstddef>
+
+/*
+ * A function pointer and the object it is called for, for the hooks that are called on every move or from an ISR
+ * where a std::function would be a heap allocated copy behind a virtual call. Testing one for being set is a pointer
+ * compare, calling it is one indirect call.
+ *
+ * Set with a member function of the object it is called for:
+ *
+ *     THEROBOT->compensationTransform = Callback<void(float*, bool, bool)>::bind<CartGridStrategy, &CartGridStrategy::doCompensation>(this);
+ *
+ * and cleared by assigning nullptr. It only ever holds a pointer to the object, not a copy, so the object has to
+ * clear it before it goes away.
+ */
+template<typename Signature> class Callback;
+
+template<typename R, typename... Args>
+class Callback<R(Args...)> {
+    public:
+        typedef R (*fnc_t)(void *context, Args... args);
+
+        // constexpr so tables of them are set up before any constructor runs
+        constexpr Callback() : fnc(nullptr), context(nullptr) {}
+        constexpr Callback(std::nullptr_t) : fnc(nullptr), context(nullptr) {}
+        constexpr Callback(fnc_t fnc, void *context) : fnc(fnc), context(context) {}
+
+        template<typename T, R (T::*M)(Args...)>
+        static Callback bind(T *object) { return Callback(&call<T, M>, object); }
+
+        explicit operator bool() const { return fnc != nullptr; }
+        bool operator==(std::nullptr_t) const { return fnc == nullptr; }
+        bool operator!=(std::nullptr_t) const { return fnc != nullptr; }
+
+        R operator()(Args... args) const { return fnc(context, args...); }
+
+    private:
+        template<typename T, R (T::*M)(Args...)>
+        static R call(void *object, Args... args) { return (static_cast<T*>(object)->*M)(args...); }
+
+        fnc_t fnc;
+        void *context;
+};
+
+#endif /* _CALLBACK_H */
@@ -8,6 +8,12 @@
 #include <stdlib.h>
 #include "ff.h"
 #include "FATFileSystem.h"
+#include "platform_memory.h"
+
+// files smaller than this many clusters seek fast enough by following the chain
+#define LINK_MAP_MIN_CLUSTERS 8
+// enough for a file in up to 7 fragments, anything more gets a table of the size f_lseek() asks for
+#define LINK_MAP_FIRST_SIZE 16
 
 namespace mbed {
 
@@ -32,11 +38,48 @@ static const char *FR_ERRORS[] = {
 
 FATFileHandle::FATFileHandle(FIL_t fh) {
     _fh = fh;
+    _cltbl = NULL;
+    _cltbl_in_ahb = false;
+    build_link_map();
+}
+
+// a job being played, resumed or downloaded is only read, give it a cluster link map in AHB ram
+// sized to its fragments, then f_lseek() and f_read() find any cluster without reading the FAT
+void FATFileHandle::build_link_map() {
+    if ((_fh.flag & FA_WRITE) || _fh.sclust == 0) return;
+
+    DWORD cluster_size = (DWORD)_fh.fs->csize * _MAX_SS;
+    if (_fh.fsize / cluster_size < LINK_MAP_MIN_CLUSTERS) return;
+
+    DWORD size = LINK_MAP_FIRST_SIZE;
+    for (int tries = 0; tries < 2; tries++) {
+        _cltbl = (DWORD *)AHB.alloc(size * sizeof(DWORD));
+        _cltbl_in_ahb = (_cltbl != NULL);
+        if (_cltbl == NULL) _cltbl = (DWORD *)malloc(size * sizeof(DWORD));
+        if (_cltbl == NULL) return;
+
+        _cltbl[0] = size;
+        _fh.cltbl = _cltbl;
+        FRESULT res = f_lseek(&_fh, CREATE_LINKMAP);
+        if (res == FR_OK) return;
+
+        // on FR_NOT_ENOUGH_CORE the first item is the size that is needed
+        size = _cltbl[0];
+        _fh.cltbl = NULL;
+        if (_cltbl_in_ahb) AHB.dealloc(_cltbl);
+        else free(_cltbl);
+        _cltbl = NULL;
+        if (res != FR_NOT_ENOUGH_CORE) return;
+    }
 }
     
 int FATFileHandle::close() {
     FFSDEBUG("close\n");
     int retval = f_close(&_fh);
+    if (_cltbl != NULL) {
+        if (_cltbl_in_ahb) AHB.dealloc(_cltbl);
+        else free(_cltbl);
+    }
     delete this;
     return retval;
 }
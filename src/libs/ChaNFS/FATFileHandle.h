@@ -24,7 +24,12 @@ public:
 
 protected:
 
+    void build_link_map();
+
     FIL_t _fh;
+    // cluster link map of a file opened for reading, so a seek does not follow the FAT chain
+    DWORD *_cltbl;
+    bool _cltbl_in_ahb;
 
 };
 
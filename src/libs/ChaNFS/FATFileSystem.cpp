@@ -14,6 +14,8 @@
 //#include "Debug.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 DWORD get_fattime (void) {
     // return 999;
@@ -54,6 +56,51 @@ static const char *FR_ERRORS[] = {
 #endif
 
 FATFileSystem *FATFileSystem::_ffs[_DRIVES] = {0};
+uint16_t FATFileSystem::_dir_gen[DIR_GEN_SLOTS] = {0};
+uint32_t FATFileSystem::_dir_gen_base = 0;
+
+// case does not matter on FAT and neither does a trailing /
+static uint32_t hash_path(uint32_t h, const char *s, size_t n) {
+    while (n > 0 && s[n - 1] == '/') n--;
+    for (size_t i = 0; i < n; i++) {
+        char c = s[i];
+        if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+        h = (h ^ (uint8_t)c) * 16777619U;
+    }
+    return h;
+}
+
+uint32_t FATFileSystem::dir_generation(const char *path) {
+    while (*path == '/') path++;
+    uint32_t slot = hash_path(2166136261U, path, strlen(path)) % DIR_GEN_SLOTS;
+    return (_dir_gen_base << 16) + _dir_gen[slot];
+}
+
+void FATFileSystem::dirs_changed() {
+    // the base also changes every boot, a listing from before can not look current after one
+    if (_dir_gen_base == 0) _dir_gen_base = time(NULL);
+    _dir_gen_base++;
+}
+
+// name is within this file system, its directory changed and if itself then so did it as a directory
+void FATFileSystem::dir_changed(const char *name, bool itself) {
+    char path[128];
+    while (*name == '/') name++;
+    int n = snprintf(path, sizeof(path), "%s/%s", _name, name);
+    if (n < 0 || n >= (int)sizeof(path)) {
+        // too long to hash, just treat everything as changed
+        dirs_changed();
+        return;
+    }
+    while (n > 0 && path[n - 1] == '/') path[--n] = '\0';
+    if (itself) {
+        _dir_gen[hash_path(2166136261U, path, n) % DIR_GEN_SLOTS]++;
+    }
+    char *slash = strrchr(path, '/');
+    if (slash != NULL) {
+        _dir_gen[hash_path(2166136261U, path, slash - path) % DIR_GEN_SLOTS]++;
+    }
+}
 
 FATFileSystem::FATFileSystem(const char* n) : FileSystemLike(n) {
     FFSDEBUG("FATFileSystem(%s)\n", n);
@@ -109,6 +156,9 @@ FileHandle *FATFileSystem::open(const char* name, int flags) {
     if(flags & O_APPEND) {
         f_lseek(&fh, fh.fsize);
     }
+    if(openmode & FA_WRITE) {
+        dir_changed(name, false);
+    }
     return new FATFileHandle(fh);
 }
 
@@ -118,6 +168,7 @@ int FATFileSystem::remove(const char *filename) {
         FFSDEBUG("f_unlink() failed (%d, %s)\n", res, FR_ERRORS[res]);
         return -1;
     }
+    dir_changed(filename, true);
     return 0;
 }
 
@@ -127,6 +178,9 @@ int FATFileSystem::rename(const char *filename1, const char *filename2) {
         FFSDEBUG("f_rename() failed (%d, %s)\n", res, FR_ERRORS[res]);
         return -1;
     }
+    // a directory that moved takes its contents with it, only its old and new parents know
+    dir_changed(filename1, true);
+    dir_changed(filename2, true);
     return 0;
 }
 
@@ -137,6 +191,7 @@ int FATFileSystem::format() {
         FFSDEBUG("f_mkfs() failed (%d, %s)\n", res, FR_ERRORS[res]);
         return -1;
     }
+    dirs_changed();
     return 0;
 }
 
@@ -153,7 +208,9 @@ DirHandle *FATFileSystem::opendir(const char *name) {
 
 int FATFileSystem::mkdir(const char *name, mode_t mode) {
     FRESULT res = f_mkdir(name);
-    return res == 0 ? 0 : -1;
+    if(res != 0) return -1;
+    dir_changed(name, true);
+    return 0;
 }
 
 } // namespace mbed
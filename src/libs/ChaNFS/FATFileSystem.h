@@ -44,6 +44,14 @@ public:
     virtual DirHandle *opendir(const char *name);
     virtual int mkdir(const char *name, mode_t mode);
 
+    /* Function: dir_generation
+     * changes whenever something in the directory is created, written, removed or renamed through
+     * the file system, so a listing of it can tell if it is still current. path is absolute, like /sd/gcodes
+     */
+    static uint32_t dir_generation(const char *path);
+    // after a remount nothing listed before can be trusted
+    static void dirs_changed();
+
     FATFS _fs;                                // Work area (file system object) for logical drive
     static FATFileSystem *_ffs[_DRIVES];    // FATFileSystem objects, as parallel to FatFs drives array
     int _fsid;
@@ -55,6 +63,13 @@ public:
     virtual int disk_sync() { return 0; }
     virtual int disk_sectors() = 0;
 
+protected:
+    void dir_changed(const char *name, bool itself);
+
+    // hashed by directory, a collision only makes a listing look changed when it is not
+    static const int DIR_GEN_SLOTS = 32;
+    static uint16_t _dir_gen[DIR_GEN_SLOTS];
+    static uint32_t _dir_gen_base;
 };
 
 }
@@ -21,6 +21,19 @@ using namespace std;
 #include "libs/ConfigSources/FirmConfigSource.h"
 #include "StreamOutputPool.h"
 
+#include <stdio.h>
+#include <string.h>
+
+// the parsed values of all the sources, used instead of parsing them again until one of them changes
+#define CONFIG_SNAPSHOT_FILE "/sd/config.cache"
+
+struct config_snapshot_header_t {
+    char magic[4];              // "CFG" and the version
+    uint16_t fingerprint_crc;   // of everything the values were read from
+    uint16_t count;             // values that follow, then the crc of them
+    uint32_t fingerprint_len;
+};
+
 // Add various config sources. Config can be fetched from several places.
 // All values are read into a cache, that is then used by modules to read their configuration
 Config::Config()
@@ -76,13 +89,80 @@ void Config::config_cache_load(bool parse)
 
     this->config_cache= new ConfigCache;
     if(parse) {
+        uint16_t crc = 0;
+        uint32_t len = 0;
+        bool can_snapshot = fingerprint(crc, len);
+        if(can_snapshot && load_snapshot(crc, len)) {
+            this->config_cache->compact();
+            return;
+        }
+
         // For each ConfigSource in our stack
         for( ConfigSource *source : this->config_sources ) {
             source->transfer_values_to_cache(this->config_cache);
         }
+
+        // included files are only found by parsing, and are not covered by the fingerprint
+        uint16_t crc2 = 0;
+        uint32_t len2 = 0;
+        if(can_snapshot && fingerprint(crc2, len2)) save_snapshot(crc, len);
+        this->config_cache->compact();
     }
 }
 
+bool Config::fingerprint(uint16_t &crc, uint32_t &len)
+{
+    for( ConfigSource *source : this->config_sources ) {
+        if(!source->fingerprint(crc, len)) return false;
+    }
+    return true;
+}
+
+bool Config::load_snapshot(uint16_t crc, uint32_t len)
+{
+    FILE *fp = fopen(CONFIG_SNAPSHOT_FILE, "rb");
+    if(fp == NULL) return false;
+
+    config_snapshot_header_t hdr;
+    uint16_t values_crc = 0;
+    uint8_t sum[2];
+    bool ok = fread(&hdr, 1, sizeof(hdr), fp) == sizeof(hdr) && memcmp(hdr.magic, "CFG\x01", 4) == 0 &&
+              hdr.fingerprint_crc == crc && hdr.fingerprint_len == len &&
+              this->config_cache->load(fp, hdr.count, values_crc) &&
+              fread(sum, 1, sizeof(sum), fp) == sizeof(sum) && values_crc == (sum[0] | (sum[1] << 8));
+    fclose(fp);
+
+    if(!ok && this->config_cache->size() > 0) {
+        // it went wrong part way through, start again with an empty cache
+        delete this->config_cache;
+        this->config_cache = new ConfigCache;
+    }
+    return ok;
+}
+
+void Config::save_snapshot(uint16_t crc, uint32_t len)
+{
+    if(this->config_cache->size() > 0xFFFF) return;
+
+    FILE *fp = fopen(CONFIG_SNAPSHOT_FILE, "wb");
+    if(fp == NULL) return;
+
+    config_snapshot_header_t hdr;
+    memcpy(hdr.magic, "CFG\x01", 4);
+    hdr.fingerprint_crc = crc;
+    hdr.fingerprint_len = len;
+    hdr.count = this->config_cache->size();
+
+    uint16_t values_crc = 0;
+    bool ok = fwrite(&hdr, 1, sizeof(hdr), fp) == sizeof(hdr) && this->config_cache->save(fp, values_crc);
+    uint8_t sum[2] = {(uint8_t)(values_crc & 0xFF), (uint8_t)(values_crc >> 8)};
+    ok = ok && fwrite(sum, 1, sizeof(sum), fp) == sizeof(sum);
+    ok = (fclose(fp) == 0) && ok;
+
+    // a partly written one would fail its crc anyway, but do not leave it lying around
+    if(!ok) remove(CONFIG_SNAPSHOT_FILE);
+}
+
 // Command to clear the config cache after init
 void Config::config_cache_clear()
 {
@@ -37,6 +37,9 @@ class Config  {
 
     private:
         bool   has_characters(uint16_t check_sum, string str );
+        bool   fingerprint(uint16_t &crc, uint32_t &len);
+        bool   load_snapshot(uint16_t crc, uint32_t len);
+        void   save_snapshot(uint16_t crc, uint32_t len);
 
         ConfigCache* config_cache;            // A cache in which ConfigValues are kept
         vector<ConfigSource*> config_sources; // A list of all possible coniguration sources
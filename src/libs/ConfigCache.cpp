@@ -2,9 +2,47 @@
 #include "ConfigValue.h"
 
 #include "libs/StreamOutput.h"
+#include "crc16.h"
+
+#include <algorithm>
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEXT_CHUNK_SIZE 512
+
+static bool check_sums_less(const uint16_t *a, const uint16_t *b)
+{
+    if(a[0] != b[0]) return a[0] < b[0];
+    if(a[1] != b[1]) return a[1] < b[1];
+    return a[2] < b[2];
+}
+
+bool ConfigCache::value_less(const ConfigValue *a, const uint16_t *check_sums)
+{
+    return check_sums_less(a->check_sums, check_sums);
+}
+
+bool ConfigCache::less_value(const uint16_t *check_sums, const ConfigValue *a)
+{
+    return check_sums_less(check_sums, a->check_sums);
+}
+
+bool ConfigCache::values_less(const ConfigValue *a, const ConfigValue *b)
+{
+    return check_sums_less(a->check_sums, b->check_sums);
+}
+
+bool ConfigCache::text_less(const ConfigValue *a, const ConfigValue *b)
+{
+    return strcmp(a->value, b->value) < 0;
+}
 
 ConfigCache::ConfigCache()
 {
+    chunk_used = TEXT_CHUNK_SIZE;
+    packed = nullptr;
+    packed_bytes = 0;
 }
 
 ConfigCache::~ConfigCache()
@@ -15,51 +53,158 @@ ConfigCache::~ConfigCache()
 void ConfigCache::clear()
 {
     for (auto &kv : store)  {
-        delete kv;
+        drop(kv);
     }
     store.clear();
     storage_t().swap(store);   //  makes sure the vector releases its memory
+    storage_t().swap(index);
+    free_chunks();
+    free(packed);
+    packed = nullptr;
+    packed_bytes = 0;
+}
+
+// the packed values go with the block they are in
+void ConfigCache::drop(ConfigValue *v)
+{
+    if((char *)v >= packed && (char *)v < packed + packed_bytes) return;
+    delete v;
+}
+
+void ConfigCache::free_chunks()
+{
+    for (char *c : chunks) {
+        free(c);
+    }
+    vector<char*>().swap(chunks);
+    chunk_used = TEXT_CHUNK_SIZE;
+}
+
+const char *ConfigCache::keep(const char *text, size_t len)
+{
+    char *s;
+    if(len + 1 > TEXT_CHUNK_SIZE) {
+        // longer than a chunk, it gets one of its own and the current one carries on
+        s = (char *)malloc(len + 1);
+        if(s == nullptr) return "";
+        chunks.insert(chunks.end() - (chunks.empty() ? 0 : 1), s);
+    } else {
+        if(chunk_used + len + 1 > TEXT_CHUNK_SIZE) {
+            char *c = (char *)malloc(TEXT_CHUNK_SIZE);
+            if(c == nullptr) return "";
+            chunks.push_back(c);
+            chunk_used = 0;
+        }
+        s = chunks.back() + chunk_used;
+        chunk_used += len + 1;
+    }
+    memcpy(s, text, len);
+    s[len] = '\0';
+    return s;
+}
+
+bool ConfigCache::compact()
+{
+    if(packed != nullptr) return false;
+    size_t n = store.size();
+
+    // sorted by text so equal ones are next to each other and each is kept once
+    storage_t by_text(store);
+    std::sort(by_text.begin(), by_text.end(), text_less);
+    size_t text_bytes = 0;
+    for (size_t i = 0; i < n; i++) {
+        if(i == 0 || strcmp(by_text[i - 1]->value, by_text[i]->value) != 0) text_bytes += strlen(by_text[i]->value) + 1;
+    }
+
+    size_t bytes = n * sizeof(ConfigValue) + text_bytes;
+    char *block = (char *)malloc(bytes);
+    if(block == nullptr) return false;
+
+    char *t = block + n * sizeof(ConfigValue);
+    for (size_t i = 0; i < n; i++) {
+        if(i == 0 || strcmp(by_text[i - 1]->value, by_text[i]->value) != 0) {
+            size_t len = strlen(by_text[i]->value) + 1;
+            memcpy(t, by_text[i]->value, len);
+            by_text[i]->value = t;
+            t += len;
+        } else {
+            by_text[i]->value = by_text[i - 1]->value;
+        }
+    }
+    storage_t().swap(by_text);
+
+    // the index is the same values in check sum order, the stable sort keeps equal ones in the order they were added
+    ConfigValue *values = (ConfigValue *)block;
+    for (size_t i = 0; i < n; i++) {
+        new (&values[i]) ConfigValue(*store[i]);
+        delete store[i];
+        store[i] = &values[i];
+    }
+    storage_t(store).swap(store);
+    storage_t(store).swap(index);
+    std::stable_sort(index.begin(), index.end(), values_less);
+
+    free_chunks();
+    packed = block;
+    packed_bytes = bytes;
+    return true;
 }
 
 void ConfigCache::add(ConfigValue *v)
 {
     store.push_back(v);
+    index.insert(std::upper_bound(index.begin(), index.end(), v->check_sums, less_value), v);
 }
 
 void ConfigCache::pop()
 {
     auto cv= store.back();
     store.pop_back();
-    delete cv;
+    index_remove(cv);
+    drop(cv);
 }
 
-// If we find an existing value, replace it, otherwise, push it at the back of the list
-void ConfigCache::replace_or_push_back(ConfigValue *new_value)
+// the first value with these check sums, or index.end()
+ConfigCache::storage_t::const_iterator ConfigCache::find(const uint16_t *check_sums) const
+{
+    auto i = std::lower_bound(index.begin(), index.end(), check_sums, value_less);
+    if(i != index.end() && memcmp(check_sums, (*i)->check_sums, sizeof((*i)->check_sums)) == 0) return i;
+    return index.end();
+}
+
+void ConfigCache::index_remove(ConfigValue *v)
 {
-    // For each already existing element
-    for(auto &cv : store) {
-        // If this configvalue matches the checksum
-        if(memcmp(new_value->check_sums, cv->check_sums, sizeof(cv->check_sums)) == 0) {
-            // Replace with the provided value
-            delete cv; // free up old one
-            cv =  new_value;
-            // printf("WARNING: duplicate config line replaced\n");
+    auto i = std::lower_bound(index.begin(), index.end(), v->check_sums, value_less);
+    for (; i != index.end(); ++i) {
+        if(*i == v) {
+            index.erase(i);
             return;
         }
     }
+}
+
+// If we find an existing value, replace it, otherwise, push it at the back of the list
+void ConfigCache::replace_or_push_back(ConfigValue *new_value)
+{
+    auto i = find(new_value->check_sums);
+    if(i != index.end()) {
+        // Replace with the provided value, in the same place in both lists
+        ConfigValue *old = *i;
+        *std::find(store.begin(), store.end(), old) = new_value;
+        index[i - index.begin()] = new_value;
+        drop(old); // free up old one
+        // printf("WARNING: duplicate config line replaced\n");
+        return;
+    }
 
     // Value does not already exists, add to the list
-    store.push_back(new_value);
+    add(new_value);
 }
 
 ConfigValue *ConfigCache::lookup(const uint16_t *check_sums) const
 {
-    for( auto &cv : store) {
-        if(memcmp(check_sums, cv->check_sums, sizeof(cv->check_sums)) == 0)
-            return cv;
-    }
-
-    return NULL;
+    auto i = find(check_sums);
+    return i == index.end() ? NULL : *i;
 }
 
 void ConfigCache::collect(uint16_t family, uint16_t cs, vector<uint16_t> *list)
@@ -78,6 +223,48 @@ void ConfigCache::dump(StreamOutput *stream)
     for( auto &kv : store ) {
         ConfigValue *v = kv;
         stream->printf("%3d - %04X %04X %04X : '%s' - found: %d, default: %d, default-double: %f, default-int: %d\n",
-                       l++, v->check_sums[0], v->check_sums[1], v->check_sums[2], v->value.c_str(), v->found, v->default_set, v->default_double, v->default_int );
+                       l++, v->check_sums[0], v->check_sums[1], v->check_sums[2], v->value, v->found, v->default_set, v->default_double, v->default_int );
+    }
+    if(packed != nullptr) stream->printf("%u values packed in %u bytes\n", (unsigned)store.size(), (unsigned)packed_bytes);
+}
+
+// each value is its three check sums then the length and characters of the value
+bool ConfigCache::save(FILE *fp, uint16_t &crc) const
+{
+    for( auto &v : store ) {
+        size_t len = strlen(v->value);
+        if(len > 255) return false;
+        uint8_t rec[7];
+        for (int i = 0; i < 3; i++) {
+            rec[i * 2] = v->check_sums[i] & 0xFF;
+            rec[i * 2 + 1] = v->check_sums[i] >> 8;
+        }
+        rec[6] = len;
+        crc = crc16_ccitt(rec, sizeof(rec), crc);
+        crc = crc16_ccitt(v->value, len, crc);
+        if(fwrite(rec, 1, sizeof(rec), fp) != sizeof(rec) ||
+           fwrite(v->value, 1, len, fp) != len) return false;
+    }
+    return true;
+}
+
+bool ConfigCache::load(FILE *fp, uint16_t count, uint16_t &crc)
+{
+    char buf[256];
+    for (uint16_t n = 0; n < count; n++) {
+        uint8_t rec[7];
+        if(fread(rec, 1, sizeof(rec), fp) != sizeof(rec) || fread(buf, 1, rec[6], fp) != rec[6]) return false;
+        crc = crc16_ccitt(rec, sizeof(rec), crc);
+        crc = crc16_ccitt(buf, rec[6], crc);
+
+        uint16_t check_sums[3];
+        for (int i = 0; i < 3; i++) {
+            check_sums[i] = rec[i * 2] | (rec[i * 2 + 1] << 8);
+        }
+        ConfigValue *v = new ConfigValue(check_sums);
+        v->value = keep(buf, rec[6]);
+        v->found = true;
+        add(v);
     }
+    return true;
 }
@@ -12,6 +12,7 @@ using namespace std;
 #include <vector>
 #include <stdint.h>
 #include <map>
+#include <stdio.h>
 
 class ConfigValue;
 class StreamOutput;
@@ -37,9 +38,44 @@ class ConfigCache {
         // used for debugging, dumps the cache to a stream
         void dump(StreamOutput *stream);
 
+        // write all the values to fp, adding what was written to crc, see Config::config_cache_load
+        bool save(FILE *fp, uint16_t &crc) const;
+        // read count values written by save(), adding what was read to crc
+        bool load(FILE *fp, uint16_t count, uint16_t &crc);
+        size_t size() const { return store.size(); }
+
+        // a copy of a value's text for as long as the cache is loaded
+        const char *keep(const char *text, size_t len);
+        // once everything is loaded, moves the values and their texts into one block with each distinct text
+        // kept once, and frees the many small pieces loading left on the heap before the modules allocate
+        // theirs among them. False, and left as it was, if the block can not be had
+        bool compact();
+        // the size of that block, 0 before compact()
+        size_t packed_size() const { return packed_bytes; }
+
     private:
         typedef vector<ConfigValue*> storage_t;
+        // in the order they were read, which is the order modules are made in
         storage_t store;
+        // the same values sorted by the check sums so lookups can binary search,
+        // values with the same check sums are in the order they were added
+        storage_t index;
+
+        // the texts while loading, in chunks that are freed once compact() has copied what is still used
+        vector<char*> chunks;
+        size_t chunk_used;
+        // the values and texts after compact(), values added after that are allocated on their own
+        char *packed;
+        size_t packed_bytes;
+
+        static bool value_less(const ConfigValue *a, const uint16_t *check_sums);
+        static bool less_value(const uint16_t *check_sums, const ConfigValue *a);
+        static bool values_less(const ConfigValue *a, const ConfigValue *b);
+        static bool text_less(const ConfigValue *a, const ConfigValue *b);
+        storage_t::const_iterator find(const uint16_t *check_sums) const;
+        void index_remove(ConfigValue *v);
+        void drop(ConfigValue *v);
+        void free_chunks();
 };
 
 
@@ -9,6 +9,7 @@
 #define CONFIGSOURCE_H
 
 #include <string>
+#include <stdint.h>
 
 class ConfigValue;
 class ConfigCache;
@@ -23,6 +24,9 @@ class ConfigSource {
         virtual bool is_named( uint16_t check_sum ) = 0;
         virtual bool write( std::string setting, std::string value ) = 0;
         virtual std::string read( uint16_t check_sums[3] ) = 0;
+        // add what the values will be read from to the crc and length, false if it can not tell
+        // in which case the values are always parsed
+        virtual bool fingerprint( uint16_t &crc, uint32_t &len ) { return false; }
 
     protected:
         virtual ConfigValue* process_line_from_ascii_config(const std::string& line, ConfigCache* cache);
@@ -30,7 +34,7 @@ class ConfigSource {
         uint16_t name_checksum;
 
     private:
-        ConfigValue* process_line(const std::string &buffer);
+        bool process_line(const std::string &buffer, uint16_t check_sums[3], size_t &begin_value, size_t &vsize);
 };
 
 
@@ -11,6 +11,7 @@
 #include "ConfigCache.h"
 #include "checksumm.h"
 #include "utils.h"
+#include "crc16.h"
 #include <malloc.h>
 
 using namespace std;
@@ -24,6 +25,7 @@ FileConfigSource::FileConfigSource(string config_file, const char *name)
     this->name_checksum = get_checksum(name);
     this->config_file = config_file;
     this->config_file_found = false;
+    this->has_includes = false;
 }
 
 bool FileConfigSource::readLine(string& line, int lineno, FILE *fp)
@@ -55,6 +57,7 @@ void FileConfigSource::transfer_values_to_cache( ConfigCache *cache )
     if( !this->has_config_file() ) {
         return;
     }
+    this->has_includes = false;
     transfer_values_to_cache( cache, this->get_config_file().c_str());
 }
 
@@ -79,8 +82,9 @@ void FileConfigSource::transfer_values_to_cache( ConfigCache *cache, const char
 
             // if this line is an include directive then attempt to read the included file
             if(cv->check_sums[0] == include_checksum) {
-                string inc_file_name = cv->value.c_str();
+                string inc_file_name = cv->value;
                 cache->pop(); // we do not need to keep this around or leave it on the list
+                this->has_includes = true;
 
                 if(!file_exists(inc_file_name)) {
                     // if the file is not found at the location entered then look around for it a bit
@@ -120,6 +124,25 @@ void FileConfigSource::transfer_values_to_cache( ConfigCache *cache, const char
     fclose(lp);
 }
 
+// the whole file goes through the crc, which is still much quicker than parsing it
+bool FileConfigSource::fingerprint( uint16_t &crc, uint32_t &len )
+{
+    if( this->has_includes ) return false;
+    if( !this->has_config_file() ) return true;
+
+    FILE *lp = fopen(this->get_config_file().c_str(), "r");
+    if(lp == NULL) return true;
+
+    char buf[512];
+    size_t n;
+    while((n = fread(buf, 1, sizeof(buf), lp)) > 0) {
+        crc = crc16_ccitt(buf, n, crc);
+        len += n;
+    }
+    fclose(lp);
+    return true;
+}
+
 // Return true if the check_sums match
 bool FileConfigSource::is_named( uint16_t check_sum )
 {
@@ -142,10 +165,10 @@ bool FileConfigSource::write( string setting, string value )
     // search each line for a match
     while(!feof(lp)) {
         string line;
-        fpos_t bol, eol;
-        fgetpos( lp, &bol ); // get start of line
+        long bol, eol;
+        bol = ftell(lp); // get start of line
         if(readLine(line, 0, lp)) {
-            fgetpos( lp, &eol ); // get end of line
+            eol = ftell(lp); // get end of line
             if(!process_line_from_ascii_config(line, setting_checksums).empty()) {
                 // found it
                 unsigned int free_space = eol - bol - 4; // length of line
@@ -11,6 +11,7 @@
 #include "ConfigCache.h"
 #include <malloc.h>
 #include "utils.h"
+#include "crc16.h"
 
 using namespace std;
 #include <string>
@@ -66,6 +67,13 @@ void FirmConfigSource::transfer_values_to_cache( ConfigCache* cache ){
     }
 }
 
+// the compiled in config changes with the firmware
+bool FirmConfigSource::fingerprint( uint16_t &crc, uint32_t &len ){
+    crc = crc16_ccitt(this->start, this->end - this->start, crc);
+    len += this->end - this->start;
+    return true;
+}
+
 // Return true if the check_sums match
 bool FirmConfigSource::is_named( uint16_t check_sum ){
     return check_sum == this->name_checksum;
@@ -11,6 +11,11 @@
 
 #include <vector>
 #include <stdio.h>
+#include <string.h>
+
+// the text given to by_default(string), it only ever lands on a value that was not found which is the one
+// shared dummy value, so there is only ever one of them in use
+static string default_string;
 
 ConfigValue::ConfigValue()
 {
@@ -26,6 +31,8 @@ void ConfigValue:: clear()
     this->check_sums[2] = 0x0000;
     this->default_double= 0.0F;
     this->default_int= 0;
+    this->number_parsed = false;
+    this->integer_parsed = false;
     this->value= "";
 }
 
@@ -33,15 +40,14 @@ ConfigValue::ConfigValue(uint16_t *cs) {
     memcpy(this->check_sums, cs, sizeof(this->check_sums));
     this->found = false;
     this->default_set = false;
+    this->number_parsed = false;
+    this->integer_parsed = false;
     this->value= "";
 }
 
 ConfigValue::ConfigValue(const ConfigValue& to_copy)
 {
-    this->found = to_copy.found;
-    this->default_set = to_copy.default_set;
-    memcpy(this->check_sums, to_copy.check_sums, sizeof(this->check_sums));
-    this->value.assign(to_copy.value);
+    *this = to_copy;
 }
 
 ConfigValue& ConfigValue::operator= (const ConfigValue& to_copy)
@@ -49,8 +55,14 @@ ConfigValue& ConfigValue::operator= (const ConfigValue& to_copy)
     if( this != &to_copy ){
         this->found = to_copy.found;
         this->default_set = to_copy.default_set;
+        this->default_double = to_copy.default_double;
+        this->default_int = to_copy.default_int;
+        this->number_parsed = to_copy.number_parsed;
+        this->number = to_copy.number;
+        this->integer_parsed = to_copy.integer_parsed;
+        this->integer = to_copy.integer;
         memcpy(this->check_sums, to_copy.check_sums, sizeof(this->check_sums));
-        this->value.assign(to_copy.value);
+        this->value = to_copy.value;
     }
     return *this;
 }
@@ -67,13 +79,19 @@ float ConfigValue::as_number()
 {
     if( this->found == false && this->default_set == true ) {
         return this->default_double;
+    } else if( this->number_parsed ) {
+        return this->number;
     } else {
         char *endptr = NULL;
         string str = remove_non_number(this->value);
         const char *cp= str.c_str();
         float result = strtof(cp, &endptr);
         if( endptr <= cp ) {
-            printErrorandExit("config setting with value '%s' and checksums[%04X,%04X,%04X] is not a valid number, please see http://smoothieware.org/configuring-smoothie\r\n", this->value.c_str(), this->check_sums[0], this->check_sums[1], this->check_sums[2] );
+            printErrorandExit("config setting with value '%s' and checksums[%04X,%04X,%04X] is not a valid number, please see http://smoothieware.org/configuring-smoothie\r\n", this->value, this->check_sums[0], this->check_sums[1], this->check_sums[2] );
+        } else if( this->found ) {
+            // value only ever changes by replacing the whole ConfigValue
+            this->number = result;
+            this->number_parsed = true;
         }
         return result;
     }
@@ -83,13 +101,18 @@ int ConfigValue::as_int()
 {
     if( this->found == false && this->default_set == true ) {
         return this->default_int;
+    } else if( this->integer_parsed ) {
+        return this->integer;
     } else {
         char *endptr = NULL;
         string str = remove_non_number(this->value);
         const char *cp= str.c_str();
         int result = strtol(cp, &endptr, 10);
         if( endptr <= cp ) {
-            printErrorandExit("config setting with value '%s' and checksums[%04X,%04X,%04X] is not a valid int, please see http://smoothieware.org/configuring-smoothie\r\n", this->value.c_str(), this->check_sums[0], this->check_sums[1], this->check_sums[2] );
+            printErrorandExit("config setting with value '%s' and checksums[%04X,%04X,%04X] is not a valid int, please see http://smoothieware.org/configuring-smoothie\r\n", this->value, this->check_sums[0], this->check_sums[1], this->check_sums[2] );
+        } else if( this->found ) {
+            this->integer = result;
+            this->integer_parsed = true;
         }
         return result;
     }
@@ -105,7 +128,7 @@ bool ConfigValue::as_bool()
     if( this->found == false && this->default_set == true ) {
         return this->default_int;
     } else {
-        return this->value.find_first_of("ty1") != string::npos;
+        return strpbrk(this->value, "ty1") != NULL;
     }
 }
 
@@ -130,13 +153,14 @@ ConfigValue *ConfigValue::by_default(string val)
         return this;
     }
     this->default_set = true;
-    this->value = val;
+    default_string = val;
+    this->value = default_string.c_str();
     return this;
 }
 
 bool ConfigValue::has_characters( const char *mask )
 {
-    if( this->value.find_first_of(mask) != string::npos ) {
+    if( strpbrk(this->value, mask) != NULL ) {
         return true;
     } else {
         return false;
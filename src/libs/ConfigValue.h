@@ -39,12 +39,21 @@ class ConfigValue{
 
     private:
         bool has_characters( const char* mask );
-        string value;
+        // never null, the text is kept by the cache the value is in, see ConfigCache::keep()
+        const char *value;
         int default_int;
         float default_double;
+        // the value converted the first time as_number() or as_int() is called, as modules often read
+        // the same setting more than once
+        float number;
+        int integer;
         uint16_t check_sums[3];
-        bool found;
-        bool default_set;
+        struct {
+            bool found:1;
+            bool default_set:1;
+            bool number_parsed:1;
+            bool integer_parsed:1;
+        };
 };
 
 
@@ -0,0 +1,67 @@
+#include "Counters.h"
+
+#include "StreamOutput.h"
+
+#include <cstring>
+
+// enough for every module that counts something
+#define MAX_COUNTERS 32
+
+namespace Counters {
+
+namespace {
+    struct entry_t {
+        const char *name;
+        volatile uint32_t *value;     // or nullptr for one read through the callbacks
+        Callback<uint32_t()> read;
+        Callback<void()> reset;
+    };
+
+    entry_t table[MAX_COUNTERS];
+    uint8_t n_entries = 0;
+
+    entry_t *slot(const char *name)
+    {
+        for (int i = 0; i < n_entries; i++) {
+            if (strcmp(table[i].name, name) == 0) return &table[i];
+        }
+        return n_entries < MAX_COUNTERS ? &table[n_entries++] : nullptr;
+    }
+}
+
+void add(const char *name, volatile uint32_t *value)
+{
+    entry_t *e = slot(name);
+    if (e != nullptr) *e = {name, value, nullptr, nullptr};
+}
+
+void add(const char *name, Callback<uint32_t()> read, Callback<void()> reset)
+{
+    entry_t *e = slot(name);
+    if (e != nullptr) *e = {name, nullptr, read, reset};
+}
+
+void reset()
+{
+    for (int i = 0; i < n_entries; i++) {
+        entry_t &e = table[i];
+        if (e.value != nullptr) {
+            *e.value = 0;
+        } else if (e.reset) {
+            e.reset();
+        }
+    }
+}
+
+void print_json(StreamOutput *stream)
+{
+    stream->printf("{");
+    for (int i = 0; i < n_entries; i++) {
+        const entry_t &e = table[i];
+        uint32_t v = e.value != nullptr ? *e.value : e.read();
+        stream->printf("%s\"%s\":%lu", i == 0 ? "" : ",", e.name, (unsigned long)v);
+    }
+    stream->printf("}\n");
+}
+
+}
@@ -0,0 +1,29 @@
+#ifndef _COUNTERS_H
+#define _COUNTERS_H
+
+#include "Callback.h"
+
+#include <cstdint>
+
+class StreamOutput;
+
+/*
+ * The one place the firmware's running counts can be read from, for tools that poll many machines. A module keeps
+ * its count in a member it increments itself, and registers it here once by name, or registers a function for a
+ * value it works out when asked. counters prints them all as one line of JSON, counters reset zeroes them.
+ *
+ *     Counters::add("gcode_lines", &lines_parsed);
+ *
+ * The names have to be string literals, the registry keeps the pointer. Registering a name again replaces it.
+ */
+namespace Counters {
+    // a count the registry zeroes on reset
+    void add(const char *name, volatile uint32_t *value);
+    // a value read through a function, with the function that clears it, if it can be
+    void add(const char *name, Callback<uint32_t()> read, Callback<void()> reset = nullptr);
+
+    void reset();
+    void print_json(StreamOutput *stream);
+}
+
+#endif /* _COUNTERS_H */
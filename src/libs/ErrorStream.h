@@ -0,0 +1,35 @@
+#ifndef _ERRORSTREAM_H_
+#define _ERRORSTREAM_H_
+
+#include "StreamOutput.h"
+
+#include <cstring>
+
+// Passes on only what reads as an error, alarm or warning, so a job played quietly still shows what went wrong
+class ErrorStream : public StreamOutput {
+    public:
+        ErrorStream() : out(nullptr) {}
+        void set_output(StreamOutput *stream) { out = stream; }
+
+        int puts(const char *str, int size = 0)
+        {
+            if (size == 0) size = strlen(str);
+            if (out == nullptr || !is_error(str)) return size;
+            return out->puts(str, size);
+        }
+
+    private:
+        static bool is_error(const char *str)
+        {
+            while (*str == '\r' || *str == '\n' || *str == ' ') ++str;
+            static const char *const prefixes[] = {"error", "Error", "ERROR", "ALARM", "Alarm", "!!", "Warning", "WARNING"};
+            for (const char *p : prefixes) {
+                if (strncmp(str, p, strlen(p)) == 0) return true;
+            }
+            return false;
+        }
+
+        StreamOutput *out;
+};
+
+#endif
@@ -0,0 +1,93 @@
+#include "EventTrace.h"
+
+#include "platform_memory.h"
+#include "StreamOutput.h"
+#include "us_ticker_api.h"
+#include "LPC17xx.h"
+
+namespace EventTrace {
+
+entry_t *ring = nullptr;
+
+namespace {
+    uint16_t size = 0;
+    uint16_t head = 0;              // where the next entry goes
+    bool wrapped = false;
+    volatile bool paused = false;
+    uint32_t dropped = 0;           // recorded while paused
+
+    const char *const names[NUMBER_OF_EVENTS] = {
+        "block", "player_line", "public_data_get", "public_data_set", "wifi_rx", "sd_read", "wait_for_idle"
+    };
+}
+
+bool start(uint16_t entries)
+{
+    stop();
+    if (entries == 0) return false;
+
+    entry_t *r = (entry_t *)AHB.alloc(sizeof(entry_t) * entries);
+    if (r == nullptr) return false;
+
+    size = entries;
+    head = 0;
+    wrapped = false;
+    dropped = 0;
+    paused = false;
+    ring = r;
+    return true;
+}
+
+void stop()
+{
+    if (ring == nullptr) return;
+
+    // nothing can be part way through add() once interrupts have been masked and it is cleared
+    __disable_irq();
+    entry_t *r = ring;
+    ring = nullptr;
+    __enable_irq();
+    AHB.dealloc(r);
+}
+
+void add(uint8_t event, uint8_t phase, uint16_t arg)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (ring != nullptr) {
+        if (paused) {
+            dropped++;
+        } else {
+            ring[head] = {us_ticker_read(), event, phase, arg};
+            if (++head == size) {
+                head = 0;
+                wrapped = true;
+            }
+        }
+    }
+    __set_PRIMASK(primask);
+}
+
+void print(StreamOutput *stream)
+{
+    if (ring == nullptr) {
+        stream->printf("Trace is off\n");
+        return;
+    }
+
+    paused = true;
+    uint16_t n = wrapped ? size : head;
+    uint16_t first = wrapped ? head : 0;
+    stream->printf("# us event phase arg, %u entries\n", n);
+    for (uint16_t i = 0; i < n; i++) {
+        const entry_t &e = ring[(first + i) % size];
+        stream->printf("%lu %s %c %u\n", (unsigned long)e.us, e.event < NUMBER_OF_EVENTS ? names[e.event] : "?",
+                       "IBE"[e.phase < 3 ? e.phase : 0], e.arg);
+    }
+    if (dropped > 0) stream->printf("# %lu not recorded while printing\n", (unsigned long)dropped);
+
+    dropped = 0;
+    paused = false;
+}
+
+}
@@ -0,0 +1,53 @@
+#ifndef _EVENTTRACE_H
+#define _EVENTTRACE_H
+
+#include <cstdint>
+
+class StreamOutput;
+
+/*
+ * When things happen relative to each other, for finding what a stutter lined up with. Off until turned on with
+ * trace on, then each record() puts a microsecond timestamp, the event and a 16 bit argument into a ring in AHB RAM,
+ * overwriting the oldest. Recording is a pointer test when off and a few instructions with interrupts masked when on,
+ * so it can be called from the step ISR. trace dump prints the ring oldest first, build/trace2perfetto.py turns
+ * that into a Chrome/Perfetto trace.
+ */
+namespace EventTrace {
+    // the events, BEGIN and END pair up into a span on the timeline, the rest are instants
+    enum event_t : uint8_t {
+        BLOCK,              // a block running in the step ticker, the arg is the low 16 bits of its line number
+        PLAYER_LINE,        // a line the player sends, round its dispatch, the arg is the low 16 bits of its line number
+        PUBLIC_DATA_GET,    // PublicData calls, the arg is the first checksum
+        PUBLIC_DATA_SET,
+        WIFI_RX,            // a read of the wifi module, the arg is the bytes received
+        SD_READ,            // an SD card read, the arg is the sector count
+        WAIT_FOR_IDLE,      // the conveyor waiting for the queue to empty
+        NUMBER_OF_EVENTS
+    };
+
+    enum phase_t : uint8_t { INSTANT, BEGIN, END };
+
+    struct entry_t {
+        uint32_t us;
+        uint8_t event;
+        uint8_t phase;
+        uint16_t arg;
+    };
+
+    // allocates the ring and starts recording, from empty
+    bool start(uint16_t entries);
+    // stops recording and frees the ring
+    void stop();
+
+    extern entry_t *ring;
+    void add(uint8_t event, uint8_t phase, uint16_t arg);
+
+    inline void record(event_t event, phase_t phase = INSTANT, uint16_t arg = 0) { if (ring != nullptr) add(event, phase, arg); }
+    inline void begin(event_t event, uint16_t arg = 0) { record(event, BEGIN, arg); }
+    inline void end(event_t event, uint16_t arg = 0) { record(event, END, arg); }
+
+    // the recorded entries oldest first, one a line, recording pauses while it prints
+    void print(StreamOutput *stream);
+}
+
+#endif /* _EVENTTRACE_H */
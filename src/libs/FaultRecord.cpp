@@ -0,0 +1,179 @@
+#include "FaultRecord.h"
+
+#include "libs/Kernel.h"
+#include "Conveyor.h"
+#include "StreamOutput.h"
+#include "platform_memory.h"
+#include "version.h"
+#include "us_ticker_api.h"
+#include "LPC17xx.h"
+
+#include <stdio.h>
+#include <stddef.h>
+
+// "FLT1", changed whenever the record is
+#define FAULT_MAGIC 0x31544C46
+#define FAULT_STACK_WORDS 30
+
+extern "C" uint32_t _sbrk(int size);
+extern "C" volatile uint32_t g_heap_alloc_count;
+
+struct fault_record_t {
+    uint32_t r4_r11[8];         // first, the handler stores them before anything else can clobber them
+    uint32_t magic;
+    uint32_t size;
+    uint32_t exc_return;
+    uint32_t sp;                // where the exception frame is
+    uint32_t cfsr;
+    uint32_t hfsr;
+    uint32_t mmfar;
+    uint32_t bfar;
+    uint32_t frame[8];          // r0-r3, r12, lr, pc, xpsr as the fault stacked them
+    uint32_t uptime_us;
+    uint32_t running_line;
+    uint32_t queued_line;
+    uint32_t queue_pending;
+    uint32_t heap_top;
+    uint32_t heap_allocs;
+    uint32_t ahb_allocs;
+    uint32_t halted;
+    uint32_t n_stack;
+    uint32_t stack[FAULT_STACK_WORDS];
+};
+static_assert(sizeof(fault_record_t) <= 256, "the fault record has to fit the FAULT_RAM region in the linker script");
+
+namespace {
+    const char *const cfsr_bits[32] = {
+        "IACCVIOL", "DACCVIOL", nullptr, "MUNSTKERR", "MSTKERR", nullptr, nullptr, "MMARVALID",
+        "IBUSERR", "PRECISERR", "IMPRECISERR", "UNSTKERR", "STKERR", nullptr, nullptr, "BFARVALID",
+        "UNDEFINSTR", "INVSTATE", "INVPC", "NOCP", nullptr, nullptr, nullptr, nullptr,
+        "UNALIGNED", "DIVBYZERO", nullptr, nullptr, nullptr, nullptr, nullptr, nullptr,
+    };
+
+    // the main RAM and the AHB banks, anything else the record will not follow a pointer into
+    bool in_ram(const void *p, size_t n)
+    {
+        uint32_t a = (uint32_t)p;
+        return (a >= 0x10000000 && a + n <= 0x10008000) || (a >= 0x2007C000 && a + n <= 0x20084000);
+    }
+}
+
+// kept over a reset, the startup code neither zeroes nor fills it
+extern "C" fault_record_t g_fault_record __attribute__((section(".noinit")));
+fault_record_t g_fault_record;
+
+// called by the handlers below with the exception frame, r4-r11 are already in the record
+extern "C" __attribute__((used, noreturn)) void fault_save(uint32_t *frame, uint32_t exc_return)
+{
+    fault_record_t &r = g_fault_record;
+    r.exc_return = exc_return;
+    r.sp = (uint32_t)frame;
+    r.cfsr = SCB->CFSR;
+    r.hfsr = SCB->HFSR;
+    r.mmfar = SCB->MMFAR;
+    r.bfar = SCB->BFAR;
+
+    // an overflowed stack may have the frame somewhere it cannot be read
+    bool frame_ok = in_ram(frame, sizeof(r.frame));
+    for (int i = 0; i < 8; ++i) r.frame[i] = frame_ok ? frame[i] : 0;
+
+    r.n_stack = 0;
+    if (frame_ok) {
+        const uint32_t *s = frame + 8;
+        while (r.n_stack < FAULT_STACK_WORDS && in_ram(s, sizeof(uint32_t))) r.stack[r.n_stack++] = *s++;
+    }
+
+    r.uptime_us = us_ticker_read();
+    r.heap_top = _sbrk(0);
+    r.heap_allocs = g_heap_alloc_count;
+    r.ahb_allocs = in_ram(_ahb, sizeof(MemoryPool)) ? AHB.get_alloc_count() : 0;
+
+    r.running_line = r.queued_line = r.queue_pending = r.halted = 0;
+    Kernel *k = THEKERNEL;
+    if (in_ram(k, sizeof(Kernel))) {
+        r.halted = k->is_halted();
+        if (in_ram(k->conveyor, sizeof(Conveyor))) {
+            unsigned int running, queued;
+            k->conveyor->queue_lines(running, queued);
+            r.running_line = running;
+            r.queued_line = queued;
+            r.queue_pending = k->conveyor->queue_pending();
+        }
+    }
+
+    r.size = sizeof(fault_record_t);
+    r.magic = FAULT_MAGIC;
+    NVIC_SystemReset();
+    for (;;);
+}
+
+#if !MRI_ENABLE
+// MRI has its own handlers for these when it is built in
+extern "C" __attribute__((naked)) void HardFault_Handler(void)
+{
+    __asm (
+        ".syntax unified\n"
+        ".thumb\n"
+        // the frame is on whichever stack was in use when the fault hit
+        " tst   lr, #4\n"
+        " ite   eq\n"
+        " mrseq r0, msp\n"
+        " mrsne r0, psp\n"
+        " mov   r1, lr\n"
+        " ldr   r2, =g_fault_record\n"
+        " stmia r2, {r4-r11}\n"
+        " b     fault_save\n"
+    );
+}
+
+// not enabled in SHCSR they escalate to a hard fault, should anything enable them they are handled the same
+extern "C" void MemManage_Handler(void) __attribute__((alias("HardFault_Handler")));
+extern "C" void BusFault_Handler(void) __attribute__((alias("HardFault_Handler")));
+extern "C" void UsageFault_Handler(void) __attribute__((alias("HardFault_Handler")));
+#endif
+
+bool FaultRecord::pending()
+{
+    return g_fault_record.magic == FAULT_MAGIC && g_fault_record.size == sizeof(fault_record_t);
+}
+
+bool FaultRecord::save(const char *filename, StreamOutput *stream)
+{
+    if (!pending()) return false;
+
+    const fault_record_t &r = g_fault_record;
+    FILE *fp = fopen(filename, "a");
+    if (fp == NULL) {
+        stream->printf("Could not open %s to save the fault record, it is kept for the next boot\r\n", filename);
+        return false;
+    }
+
+    Version vers;
+    fprintf(fp, "Fault in build %s after %lu ms\n", vers.get_build(), r.uptime_us / 1000);
+    fprintf(fp, "pc %08lX lr %08lX xpsr %08lX sp %08lX exc_return %08lX\n", r.frame[6], r.frame[5], r.frame[7], r.sp, r.exc_return);
+    fprintf(fp, "r0 %08lX r1 %08lX r2 %08lX r3 %08lX r12 %08lX\n", r.frame[0], r.frame[1], r.frame[2], r.frame[3], r.frame[4]);
+    for (int i = 0; i < 8; ++i) fprintf(fp, "r%d %08lX%s", i + 4, r.r4_r11[i], i == 7 ? "\n" : " ");
+    fprintf(fp, "cfsr %08lX hfsr %08lX mmfar %08lX bfar %08lX", r.cfsr, r.hfsr, r.mmfar, r.bfar);
+    for (int i = 0; i < 32; ++i) {
+        if ((r.cfsr & (1UL << i)) && cfsr_bits[i] != nullptr) fprintf(fp, " %s", cfsr_bits[i]);
+    }
+    if (r.hfsr & (1UL << 30)) fprintf(fp, " FORCED");
+    if (r.hfsr & (1UL << 1)) fprintf(fp, " VECTTBL");
+    fprintf(fp, "\nline running %lu, last queued %lu, %lu blocks pending%s\n", r.running_line, r.queued_line, r.queue_pending,
+            r.halted ? ", halted" : "");
+    fprintf(fp, "heap top %08lX, %lu heap and %lu AHB allocations\n", r.heap_top, r.heap_allocs, r.ahb_allocs);
+    fprintf(fp, "stack above the frame:");
+    for (uint32_t i = 0; i < r.n_stack && i < FAULT_STACK_WORDS; ++i) fprintf(fp, "%s%08lX", i % 8 == 0 ? "\n  " : " ", r.stack[i]);
+    fprintf(fp, "\n\n");
+    bool ok = ferror(fp) == 0;
+    fclose(fp);
+
+    if (!ok) {
+        stream->printf("Could not write the fault record to %s, it is kept for the next boot\r\n", filename);
+        return false;
+    }
+
+    stream->printf("The last reset was a fault at pc %08lX, line %lu, the record was saved to %s\r\n", r.frame[6], r.running_line, filename);
+    g_fault_record.magic = 0;
+    return true;
+}
@@ -0,0 +1,24 @@
+#ifndef _FAULTRECORD_H
+#define _FAULTRECORD_H
+
+class StreamOutput;
+
+/*
+ * What was going on when the last hard fault hit. The fault handlers fill a record in a small RAM region the startup
+ * code leaves alone and reset the board, the next boot appends it as text to a file on the SD card and clears it.
+ * The record holds the registers stacked by the fault, the fault status registers, a slice of the stack above the
+ * frame, the lines being run and queued, and where the heap and the allocation counts were.
+ *
+ * Nothing is done until a fault, so it costs nothing while running. With MRI built in the debugger owns the fault
+ * vectors and no record is made.
+ */
+namespace FaultRecord {
+    // true if the last reset was a fault that left a record
+    bool pending();
+
+    // appends the record to the file and clears it, says on the stream what was saved, false if there was nothing to
+    // save or the file could not be written, in which case the record is kept for the next boot
+    bool save(const char *filename, StreamOutput *stream);
+}
+
+#endif /* _FAULTRECORD_H */
@@ -0,0 +1,74 @@
+#include "FixedFormat.h"
+
+#include <cmath>
+#include <stdio.h>
+
+namespace {
+    const uint32_t pow10[] = {1, 10, 100, 1000, 10000, 100000, 1000000};
+
+    // digits of n backwards from end, returns where they start
+    char *put_digits(char *end, unsigned long n, int min_digits)
+    {
+        int count = 0;
+        do {
+            *--end = '0' + n % 10;
+            n /= 10;
+            ++count;
+        } while (n != 0 || count < min_digits);
+        return end;
+    }
+
+    size_t copy_out(char *buf, size_t size, const char *from, const char *to)
+    {
+        if(size == 0) return 0;
+        size_t n = to - from;
+        if(n > size - 1) n = size - 1;
+        for (size_t i = 0; i < n; ++i) buf[i] = from[i];
+        buf[n] = '\0';
+        return n;
+    }
+}
+
+size_t format_fixed(char *buf, size_t size, float value, int decimals)
+{
+    if(decimals < 0) decimals = 0;
+    // the whole part has to fit 32 bits for the cheap division
+    if(decimals > 6 || !(fabsf(value) < 4.0e9F)) {
+        int n = snprintf(buf, size, "%1.*f", decimals, value);
+        if(n < 0) return 0;
+        return (size_t)n < size ? n : (size ? size - 1 : 0);
+    }
+
+    bool negative = value < 0;
+    // a float times a power of ten up to a million is exact in a double, so this rounds the way printf does,
+    // halves to even
+    double scaled = fabs((double)value) * pow10[decimals];
+    double whole_part = floor(scaled / pow10[decimals]);
+    double rest = scaled - whole_part * pow10[decimals];
+    uint32_t whole = (uint32_t)whole_part;
+    uint32_t frac = (uint32_t)rest;
+    double half = rest - frac;
+    if(half > 0.5 || (half == 0.5 && ((decimals ? frac : whole) & 1))) ++frac;
+    if(frac >= pow10[decimals]) { ++whole; frac -= pow10[decimals]; }
+
+    char tmp[24];
+    char *end = tmp + sizeof(tmp);
+    char *p = end;
+    if(decimals > 0) {
+        p = put_digits(p, frac, decimals);
+        *--p = '.';
+    }
+    p = put_digits(p, whole, 1);
+    if(negative) *--p = '-';
+    return copy_out(buf, size, p, end);
+}
+
+size_t format_int(char *buf, size_t size, long value)
+{
+    char tmp[24];
+    char *end = tmp + sizeof(tmp);
+    unsigned long n = value < 0 ? 0UL - (unsigned long)value : (unsigned long)value;
+    char *p = put_digits(end, n, 1);
+    if(value < 0) *--p = '-';
+    return copy_out(buf, size, p, end);
+}
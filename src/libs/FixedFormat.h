@@ -0,0 +1,14 @@
+#ifndef _FIXEDFORMAT_H_
+#define _FIXEDFORMAT_H_
+
+#include <cstddef>
+#include <cstdint>
+
+// The numbers in status reports and position replies, without going through vsnprintf which is slow and needs a lot
+// of stack with soft float. Both write what printf would for "%1.<decimals>f" and "%ld", stopping at size - 1
+// characters, and return how many they wrote not counting the terminating 0.
+// decimals is at most 6, anything too big for that falls back to snprintf
+size_t format_fixed(char *buf, size_t size, float value, int decimals);
+size_t format_int(char *buf, size_t size, long value);
+
+#endif
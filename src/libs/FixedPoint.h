@@ -0,0 +1,36 @@
+#ifndef _FIXEDPOINT_H
+#define _FIXEDPOINT_H
+
+#include <cstdint>
+
+/*
+ * Q16.16 fixed point for the maths done on every segment. The LPC1768 has no FPU, so a float multiply is a library
+ * call where a Q16.16 one is a single long multiply and a shift. Values are mm or grid cells, which fit 16 bits of
+ * whole part with room to spare, to 1/65536 of a unit. Scale factors that can be much smaller than 1, like cells per
+ * mm, are kept as Q8.24 and applied with q16_scale.
+ *
+ * Only the arithmetic is in here, each user converts its inputs once and its result back with q16_to_float.
+ */
+typedef int32_t q16_t;
+
+#define Q16_ONE (1L << 16)
+
+inline q16_t q16_from_float(float v) { return (q16_t)(v * 65536.0F + (v < 0 ? -0.5F : 0.5F)); }
+inline float q16_to_float(q16_t q) { return q * (1.0F / 65536.0F); }
+inline int32_t q24_from_float(float v) { return (int32_t)(v * 16777216.0F + (v < 0 ? -0.5F : 0.5F)); }
+
+// rounded to nearest
+inline q16_t q16_mul(q16_t a, q16_t b) { return (q16_t)(((int64_t)a * b + (1 << 15)) >> 16); }
+// a times a Q8.24 factor, a Q16.16 result
+inline q16_t q16_scale(q16_t a, int32_t q24) { return (q16_t)(((int64_t)a * q24 + (1 << 23)) >> 24); }
+
+inline int q16_floor(q16_t q) { return q >> 16; }
+inline q16_t q16_frac(q16_t q) { return q & (Q16_ONE - 1); }
+
+// a + b x + (c + d x) y, the bilinear patch over a cell with x and y the fractions across it
+inline q16_t q16_bilerp(q16_t a, q16_t b, q16_t c, q16_t d, q16_t x, q16_t y)
+{
+    return a + q16_mul(b, x) + q16_mul(c + q16_mul(d, x), y);
+}
+
+#endif /* _FIXEDPOINT_H */
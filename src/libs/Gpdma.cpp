@@ -0,0 +1,51 @@
+#include "Gpdma.h"
+
+#include "LPC17xx.h"
+
+namespace Gpdma {
+
+namespace {
+    uint8_t owned = 0;
+
+    LPC_GPDMACH_TypeDef *channel(int n)
+    {
+        return (LPC_GPDMACH_TypeDef *)(LPC_GPDMACH0_BASE + n * 0x20);
+    }
+}
+
+bool claim(uint8_t mask)
+{
+    if (owned & mask) return false;
+
+    if (owned == 0) {
+        LPC_SC->PCONP |= (1 << 29);
+        LPC_GPDMA->DMACConfig |= 1;
+    }
+    owned |= mask;
+
+    // the clear registers are write one to clear, so only ours are touched
+    for (int n = 0; n < 8; ++n) {
+        if (mask & (1 << n)) channel(n)->DMACCConfig = 0;
+    }
+    LPC_GPDMA->DMACIntTCClear = mask;
+    LPC_GPDMA->DMACIntErrClr = mask;
+    return true;
+}
+
+void release(uint8_t mask)
+{
+    mask &= owned;
+    for (int n = 0; n < 8; ++n) {
+        if (mask & (1 << n)) channel(n)->DMACCConfig = 0;
+    }
+    LPC_GPDMA->DMACIntTCClear = mask;
+    LPC_GPDMA->DMACIntErrClr = mask;
+    owned &= ~mask;
+}
+
+uint8_t claimed()
+{
+    return owned;
+}
+
+}
@@ -0,0 +1,24 @@
+#ifndef _GPDMA_H
+#define _GPDMA_H
+
+#include <cstdint>
+
+/*
+ * Who owns which of the eight GPDMA channels. The SD card and the wifi module sit on different SSPs, so the only
+ * hardware they share is the DMA controller: its enable, its power bit and the channel status and clear registers
+ * that cover all channels at once. A driver claims the channels it is going to program before touching them and
+ * falls back to programmed I/O if someone else has them, rather than each driver picking fixed channels and hoping.
+ *
+ * The transfers themselves are started and waited for from the main loop by whoever owns the channels, so two of
+ * them can never be setting up at the same moment and no queueing is needed on top of the claim.
+ */
+namespace Gpdma {
+    // claims the channels in mask, powers up and enables the controller on the first claim. False, and nothing
+    // claimed, if any of them is taken already
+    bool claim(uint8_t mask);
+    // gives them back, stops them and clears their status, the controller is left on for anyone else
+    void release(uint8_t mask);
+    uint8_t claimed();
+}
+
+#endif /* _GPDMA_H */
@@ -0,0 +1,75 @@
+#include "HomeRecord.h"
+
+#include "libs/Kernel.h"
+#include "Robot.h"
+#include "StepperMotor.h"
+#include "crc16.h"
+#include "LPC17xx.h"
+
+#include <stdint.h>
+
+// "HOM1", changed whenever the record is
+#define HOME_MAGIC 0x314D4F48
+#define HOME_ACTUATORS 6
+
+// RSID bits, power on and brown out both mean the RAM may not have held
+#define RSID_POR  (1 << 0)
+#define RSID_BODR (1 << 3)
+
+struct home_record_t {
+    uint32_t magic;
+    uint32_t n;
+    float pos[HOME_ACTUATORS];
+    uint16_t crc;               // over n and pos
+};
+static_assert(sizeof(home_record_t) <= 256, "with the fault record it has to fit the FAULT_RAM region in the linker script");
+
+// kept over a reset along with the fault record, the startup code neither zeroes nor fills it
+extern "C" home_record_t g_home_record __attribute__((section(".noinit")));
+home_record_t g_home_record;
+
+static bool is_armed = false;
+
+static uint16_t record_crc(const home_record_t &r)
+{
+    return crc16_ccitt(&r.n, sizeof(r.n) + sizeof(r.pos));
+}
+
+void HomeRecord::arm(bool on)
+{
+    is_armed = on;
+}
+
+bool HomeRecord::armed()
+{
+    return is_armed;
+}
+
+void HomeRecord::save()
+{
+    home_record_t &r = g_home_record;
+    r.magic = 0;
+    if (!is_armed || THEKERNEL == nullptr || THEROBOT == nullptr) return;
+
+    size_t n = THEROBOT->get_number_registered_motors();
+    if (n > HOME_ACTUATORS) n = HOME_ACTUATORS;
+    r.n = n;
+    for (size_t i = 0; i < HOME_ACTUATORS; ++i) r.pos[i] = i < n ? THEROBOT->actuators[i]->get_current_position() : 0;
+    r.crc = record_crc(r);
+    r.magic = HOME_MAGIC;
+}
+
+bool HomeRecord::take(float *pos, size_t n)
+{
+    home_record_t &r = g_home_record;
+    uint32_t rsid = LPC_SC->RSID;
+    // the bits stay set until cleared, so the next reset says only what happened since this boot
+    LPC_SC->RSID = rsid;
+
+    bool ok = r.magic == HOME_MAGIC && r.n == n && n <= HOME_ACTUATORS && r.crc == record_crc(r) &&
+              (rsid & (RSID_POR | RSID_BODR)) == 0;
+    r.magic = 0;
+    if (!ok) return false;
+    for (size_t i = 0; i < n; ++i) pos[i] = r.pos[i];
+    return true;
+}
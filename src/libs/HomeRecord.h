@@ -0,0 +1,28 @@
+#ifndef _HOMERECORD_H
+#define _HOMERECORD_H
+
+#include <stddef.h>
+
+/*
+ * Where the actuators were when the firmware reset itself, so a reset after a halt can take the position back
+ * instead of homing again. The record is written to the RAM region the startup code leaves alone just before a
+ * software reset, and only while it is armed: the machine has been homed and nothing has happened since that may
+ * have lost steps, the motors were not turned off with M18/M84 and no halt stopped them in the middle of a move.
+ *
+ * It is taken once on the next boot and only if the board has not been without power since, the RAM is not kept
+ * over a power cycle or a brown out and the reset status register says if one happened. A halt still turns the
+ * drivers off, so what it gives back are positions to be checked with a touch on one endstop, not a homed machine.
+ */
+namespace HomeRecord {
+    // the positions may be kept over the next software reset, false forgets them
+    void arm(bool on);
+    bool armed();
+
+    // called just before a software reset, saves the actuator positions if armed
+    void save();
+
+    // fills in the actuator positions in mm saved by the last reset, false if there are none or the power went since
+    bool take(float *pos, size_t n);
+}
+
+#endif /* _HOMERECORD_H */
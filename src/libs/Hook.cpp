@@ -5,4 +5,9 @@ extern "C"{
 
 // Hook is just a glorified FPointer
 
-Hook::Hook(){}
+Hook::Hook(){
+    enabled = true;
+    calls = 0;
+    max_cycles = 0;
+    total_cycles = 0;
+}
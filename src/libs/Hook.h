@@ -7,8 +7,17 @@
 class Hook : public FPointer {
     public:
         Hook();
+        // the object the callback is called on, to tell the hooks apart in a report
+        void   *object() const { return (void *)obj_callback; }
+
         int     interval;
         int     countdown;
+        bool    enabled;
+
+        // cycles spent in the callback
+        uint32_t calls;
+        uint32_t max_cycles;
+        uint64_t total_cycles;
 };
 
 #endif
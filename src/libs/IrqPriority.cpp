@@ -0,0 +1,109 @@
+#include "IrqPriority.h"
+
+#include "libs/Kernel.h"
+#include "Config.h"
+#include "ConfigValue.h"
+#include "checksumm.h"
+#include "StreamOutput.h"
+
+#define irq_priority_checksum CHECKSUM("irq_priority")
+
+// 5 priority bits on the LPC17xx
+#define LOWEST_PRIORITY 31
+
+namespace IrqPriority {
+
+namespace {
+    struct entry_t {
+        const char *name;
+        uint16_t checksum;
+        IRQn_Type irq;
+        uint8_t priority;
+    };
+
+    // in the order they preempt each other by default
+    const entry_t table[] = {
+        {"unstep",      CHECKSUM("unstep"),      TIMER1_IRQn, 1},   // ends the step pulses the step tick started
+        {"watchdog",    CHECKSUM("watchdog"),    WDT_IRQn,    1},   // only fires when something hangs, in an ISR too
+        {"step",        CHECKSUM("step"),        TIMER0_IRQn, 2},
+        {"block",       CHECKSUM("block"),       PendSV_IRQn, 3},   // the step ticker taking the next block
+        {"slow_ticker", CHECKSUM("slow_ticker"), TIMER2_IRQn, 4},
+        {"us_ticker",   CHECKSUM("us_ticker"),   TIMER3_IRQn, 4},
+        {"adc",         CHECKSUM("adc"),         ADC_IRQn,    5},
+        {"usb",         CHECKSUM("usb"),         USB_IRQn,    5},   // the serial device and the USB stick host
+        {"uart0",       CHECKSUM("uart0"),       UART0_IRQn,  5},
+        {"uart1",       CHECKSUM("uart1"),       UART1_IRQn,  5},
+        {"uart2",       CHECKSUM("uart2"),       UART2_IRQn,  5},
+        {"uart3",       CHECKSUM("uart3"),       UART3_IRQn,  5},
+        {"gpio",        CHECKSUM("gpio"),        EINT3_IRQn,  16},  // pin change, endstops, probe, switch inputs, spindle feedback and wifi
+        {"sampler",     CHECKSUM("sampler"),     RIT_IRQn,    31},  // the $R profiler, below everything so it samples the main loop
+    };
+    const int n_entries = sizeof(table) / sizeof(table[0]);
+
+    uint8_t priorities[n_entries];
+    bool loaded = false;
+
+    int find(IRQn_Type irq)
+    {
+        for (int i = 0; i < n_entries; ++i) {
+            if (table[i].irq == irq) return i;
+        }
+        return -1;
+    }
+
+    uint8_t priority(int i)
+    {
+        return loaded ? priorities[i] : table[i].priority;
+    }
+
+    bool is_uart(IRQn_Type irq)
+    {
+        return irq == UART0_IRQn || irq == UART1_IRQn || irq == UART2_IRQn || irq == UART3_IRQn;
+    }
+
+    void set(int i)
+    {
+        IRQn_Type irq = table[i].irq;
+        // MRI runs its uart at 0 to be able to break in anywhere, leave that one alone
+        if (MRI_ENABLE && is_uart(irq) && NVIC_GetPriority(irq) == 0) return;
+        NVIC_SetPriority(irq, priority(i));
+    }
+}
+
+void load()
+{
+    for (int i = 0; i < n_entries; ++i) {
+        int p = THEKERNEL->config->value(irq_priority_checksum, table[i].checksum)->by_default(table[i].priority)->as_int();
+        if (p < 0) p = 0;
+        if (p > LOWEST_PRIORITY) p = LOWEST_PRIORITY;
+        priorities[i] = p;
+    }
+    loaded = true;
+
+    NVIC_SetPriorityGrouping(0);
+    for (int i = 0; i < n_entries; ++i) set(i);
+}
+
+void apply(IRQn_Type irq)
+{
+    int i = find(irq);
+    if (i >= 0) set(i);
+}
+
+void print(StreamOutput *stream)
+{
+    uint8_t step = priority(find(TIMER0_IRQn));
+    stream->printf("%-12s %4s %7s %7s %s\r\n", "name", "irq", "table", "nvic", "enabled");
+    for (int i = 0; i < n_entries; ++i) {
+        IRQn_Type irq = table[i].irq;
+        uint32_t now = NVIC_GetPriority(irq);
+        // the system handlers have no enable bit in the NVIC
+        const char *enabled = irq < 0 ? "-" : (NVIC->ISER[irq >> 5] & (1UL << (irq & 0x1F))) ? "yes" : "no";
+        // anything other than the step pulses and the watchdog that can hold up the step tick
+        bool exempt = irq == TIMER0_IRQn || irq == TIMER1_IRQn || irq == WDT_IRQn;
+        const char *warn = (!exempt && now <= step) ? " holds up step" : "";
+        stream->printf("%-12s %4d %7u %7lu %s%s\r\n", table[i].name, irq, priority(i), now, enabled, warn);
+    }
+}
+
+}
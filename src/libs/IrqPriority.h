@@ -0,0 +1,25 @@
+#ifndef _IRQPRIORITY_H
+#define _IRQPRIORITY_H
+
+#include "LPC17xx.h"
+
+class StreamOutput;
+
+/*
+ * The one place interrupt priorities are decided. Every interrupt the firmware uses has an entry with its default,
+ * which can be changed in config with irq_priority.<name> 0-31, lower numbers preempt higher ones. Step generation
+ * comes first, then the tickers, then comms and storage, then the pin change interrupt.
+ *
+ * load() reads the config and sets them all once the kernel is up. Drivers that enable their interrupt later call
+ * apply() for it rather than picking a number of their own, so no driver can end up above the step ticker.
+ */
+namespace IrqPriority {
+    void load();
+    // sets the priority the table has for irq, leaves it alone if the table has none
+    void apply(IRQn_Type irq);
+
+    // the table next to what the NVIC really has
+    void print(StreamOutput *stream);
+}
+
+#endif /* _IRQPRIORITY_H */
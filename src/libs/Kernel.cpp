@@ -18,6 +18,7 @@
 
 #include "libs/StepTicker.h"
 #include "libs/PublicData.h"
+#include "PublicDataRequest.h"
 #include "modules/communication/SerialConsole.h"
 #include "modules/communication/GcodeDispatch.h"
 #include "modules/robot/Planner.h"
@@ -44,10 +45,18 @@
 #endif
 
 #include "platform_memory.h"
+#include "MemoryStats.h"
+#include "BootTrace.h"
+#include "IrqPriority.h"
+#include "Task.h"
+#include "crc16.h"
+#include "FixedFormat.h"
 
 #include <malloc.h>
+#include <algorithm>
 #include <array>
 #include <string>
+#include <stdarg.h>
 
 #define laser_checksum CHECKSUM("laser")
 #define baud_rate_setting_checksum CHECKSUM("baud_rate")
@@ -55,21 +64,36 @@
 
 #define base_stepping_frequency_checksum            CHECKSUM("base_stepping_frequency")
 #define microseconds_per_step_pulse_checksum        CHECKSUM("microseconds_per_step_pulse")
+#define precise_step_timing_checksum                CHECKSUM("precise_step_timing")
+#define step_coast_max_us_checksum                  CHECKSUM("step_coast_max_us")
 #define disable_leds_checksum                       CHECKSUM("leds_disable")
 #define grbl_mode_checksum                          CHECKSUM("grbl_mode")
 #define feed_hold_enable_checksum                   CHECKSUM("enable_feed_hold")
 #define ok_per_line_checksum                        CHECKSUM("ok_per_line")
 #define disable_serial_console_checksum             CHECKSUM("disable_serial_console")
+#define background_queue_min_checksum               CHECKSUM("background_queue_min")
+#define background_max_delay_checksum               CHECKSUM("background_max_delay")
 #define halt_on_error_debug_checksum                CHECKSUM("halt_on_error_debug")
 Kernel* Kernel::instance;
 
 #define	EEP_MAX_PAGE_SIZE	32
 #define EEPROM_DATA_STARTPAGE	1
 #define EEPROM_FACTORYSET_PAGE	16
+// a page must not be addressed again until its write cycle is over
+#define EEPROM_WRITE_CYCLE_US	10000
+
+// DWT cycle counter, enabled by the StepTicker
+#ifndef DWT_CYCCNT
+#define DWT_CYCCNT  (*(volatile uint32_t *)0xE0001004)
+#endif
 // The kernel is the central point in Smoothie : it stores modules, and handles event calls
 Kernel::Kernel()
 {
+    frozen_hooks = nullptr;
     halted = false;
+    query_static_count = 0;
+    memset(diag_fields, 0, sizeof(diag_fields));
+    diag_seq = 0;
     feed_hold = false;
     enable_feed_hold = false;
     bad_mcu= true;
@@ -90,9 +114,16 @@ Kernel::Kernel()
     probe_addr = 0;
     checkled = false;
     spindleon = false;
+    homing = false;
+    state = notified_state = IDLE;
     cachewait = false;
     disable_serial_console = false;
     keep_alive_request = false;
+    event_profiling = false;
+    eeprom_pending = false;
+    eeprom_last_write_us = 0;
+    n_public_data_owners.fill(0);
+    robot = nullptr; // the consoles can get realtime override codes before it is made
 
     instance = this; // setup the Singleton instance of the kernel    
     
@@ -100,18 +131,22 @@ Kernel::Kernel()
     this->i2c = new mbed::I2C(P0_27, P0_28);
     this->i2c->frequency(200000);
     
+    int trace = BootTrace::begin("factory data");
     this->factory_set = new(AHB) FACTORY_SET();
     // read Factory setting data from eeprom
     this->read_Factory_data();
     // read Factory settings data from sd
     this->read_Factroy_SD();
+    BootTrace::end(trace);
 
 
     // Config next, but does not load cache yet
     this->config = new(AHB) Config();
 
     // Pre-load the config cache
+    trace = BootTrace::begin("config cache load");
     this->config->config_cache_load();
+    BootTrace::end(trace);
 
     this->streams = new(AHB) StreamOutputPool();
 
@@ -140,6 +175,10 @@ Kernel::Kernel()
     // Check if we should break into the debugger on halt
     this->halt_on_error_debug = this->config->value( halt_on_error_debug_checksum )->by_default(false)->as_bool();
 
+    // background tasks wait while fewer blocks than this are queued and it is moving, but not longer than the max delay
+    this->background_queue_min = this->config->value( background_queue_min_checksum )->by_default(16)->as_number();
+    this->background_max_us = this->config->value( background_max_delay_checksum )->by_default(100)->as_number() * 1000;
+
     if (!this->disable_serial_console) {
         this->serial = new(AHB) SerialConsole(P2_8, P2_9, 115200);
         this->add_module( this->serial );
@@ -151,31 +190,8 @@ Kernel::Kernel()
     this->step_ticker = new(AHB) StepTicker();
     this->adc = new(AHB) Adc();
 
-    // TODO : These should go into platform-specific files
-    // LPC17xx-specific
-    NVIC_SetPriorityGrouping(0);
-    NVIC_SetPriority(TIMER0_IRQn, 2);
-    NVIC_SetPriority(TIMER1_IRQn, 1);
-    NVIC_SetPriority(TIMER2_IRQn, 4);
-    NVIC_SetPriority(TIMER3_IRQn, 4);
-    NVIC_SetPriority(PendSV_IRQn, 3);
-
-    // Set other priorities lower than the timers
-    NVIC_SetPriority(ADC_IRQn, 5);
-    NVIC_SetPriority(USB_IRQn, 5);
-
-    // If MRI is enabled
-    if( MRI_ENABLE ) {
-        if( NVIC_GetPriority(UART0_IRQn) > 0 ) { NVIC_SetPriority(UART0_IRQn, 5); }
-        if( NVIC_GetPriority(UART1_IRQn) > 0 ) { NVIC_SetPriority(UART1_IRQn, 5); }
-        if( NVIC_GetPriority(UART2_IRQn) > 0 ) { NVIC_SetPriority(UART2_IRQn, 5); }
-        if( NVIC_GetPriority(UART3_IRQn) > 0 ) { NVIC_SetPriority(UART3_IRQn, 5); }
-    } else {
-        NVIC_SetPriority(UART0_IRQn, 5);
-        NVIC_SetPriority(UART1_IRQn, 5);
-        NVIC_SetPriority(UART2_IRQn, 5);
-        NVIC_SetPriority(UART3_IRQn, 5);
-    }
+    // step generation first, then the tickers, then comms and storage, see IrqPriority.cpp
+    IrqPriority::load();
 
     // Configure the step ticker
     this->base_stepping_frequency = this->config->value(base_stepping_frequency_checksum)->by_default(100000)->as_number();
@@ -184,12 +200,17 @@ Kernel::Kernel()
     // Configure the step ticker
     this->step_ticker->set_frequency( this->base_stepping_frequency );
     this->step_ticker->set_unstep_time( microseconds_per_step_pulse );
+    this->step_ticker->set_precise_steps( this->config->value(precise_step_timing_checksum)->by_default(false)->as_bool() );
+    this->step_ticker->set_coast_time( this->config->value(step_coast_max_us_checksum)->by_default(1000)->as_number() );
 
     this->eeprom_data = new(AHB) EEPROM_data();
+    this->eeprom_written = new(AHB) EEPROM_data();
+    trace = BootTrace::begin("eeprom data");
     // read eeprom data
     this->read_eeprom_data();
     // check eeprom data
     this->check_eeprom_data();
+    BootTrace::end(trace);
 
     // Core modules
     this->add_module( this->simpleshell    = new(AHB) SimpleShell()   );
@@ -202,211 +223,241 @@ Kernel::Kernel()
 }
 
 // get current state
-uint8_t Kernel::get_state()
+// called by the setters of the flags, which may be in an interrupt, and from the main loop for the queue going idle or busy
+void Kernel::refresh_state()
 {
-    bool homing;
-    bool ok = PublicData::get_value(endstops_checksum, get_homing_status_checksum, 0, &homing);
-    if(!ok) homing = false;
+    uint8_t s;
     if (sleeping) {
-    	return SLEEP;
+    	s = SLEEP;
     } else if (suspending) {
-    	return SUSPEND;
+    	s = SUSPEND;
     } else if (waiting) {
-    	return WAIT;
+    	s = WAIT;
     } else if (tool_waiting) {
-    	return TOOL;
+    	s = TOOL;
     } else if(halted) {
-    	return ALARM;
+    	s = ALARM;
     } else if (homing) {
-    	return HOME;
+    	s = HOME;
     } else if (feed_hold) {
-    	return HOLD;
-    } else if (this->conveyor->is_idle() && (this->spindleon == false)) {
-    	return IDLE;
+    	s = HOLD;
+    } else if ((this->conveyor == nullptr || this->conveyor->is_idle()) && (this->spindleon == false)) {
+    	s = IDLE;
     } else {
-    	return RUN;
+    	s = RUN;
     }
+    state = s;
 }
 
 // return a GRBL-like query string for serial ?
-std::string Kernel::get_query_string()
+// the report is built in place here rather than in a std::string, multiple times a second while the controller polls
+static char query_buf[512] __attribute__((section("AHBSRAM")));
+
+// the fields that hardly ever change are only sent when they did, and every so many reports in case a client missed it
+#define QUERY_STATIC_REFRESH 10
+
+namespace {
+    // appends to a fixed size buffer, what does not fit is dropped
+    struct ReportWriter {
+        char *buf;
+        size_t size;
+        size_t len;
+
+        ReportWriter(char *b, size_t s) : buf(b), size(s), len(0) { buf[0] = '\0'; }
+
+        void append(const char *s)
+        {
+            size_t n = strlen(s);
+            if(n > size - 1 - len) n = size - 1 - len;
+            memcpy(buf + len, s, n);
+            len += n;
+            buf[len] = '\0';
+        }
+
+        void printf(const char *format, ...) __attribute__ ((format(printf, 2, 3)))
+        {
+            va_list args;
+            va_start(args, format);
+            int n = vsnprintf(buf + len, size - len, format, args);
+            va_end(args);
+            if(n < 0) return;
+            len += ((size_t)n < size - len) ? n : size - 1 - len;
+        }
+
+        // the numbers go through FixedFormat rather than vsnprintf, a report is mostly numbers
+        void fixed(float v, int decimals) { len += format_fixed(buf + len, size - len, v, decimals); }
+        void integer(long v) { len += format_int(buf + len, size - len, v); }
+
+        // s then each value, comma separated
+        void fixed_list(const char *s, const float *v, int n, int decimals)
+        {
+            append(s);
+            for (int i = 0; i < n; ++i) {
+                if(i > 0) append(",");
+                fixed(v[i], decimals);
+            }
+        }
+    };
+}
+
+// X, Y and Z in the units the host works in, then A and B
+static void append_position(ReportWriter &w, Robot *robot, const char *prefix, const Robot::wcs_t &pos)
 {
+    float v[5] = {robot->from_millimeters(std::get<X_AXIS>(pos)), robot->from_millimeters(std::get<Y_AXIS>(pos)), robot->from_millimeters(std::get<Z_AXIS>(pos)),
+                  std::get<A_AXIS>(pos), std::get<B_AXIS>(pos)};
+    w.fixed_list(prefix, v, 5, 4);
+}
 
-    std::string str;
+const char *Kernel::get_query_string(StreamOutput *stream)
+{
+    ReportWriter w(query_buf, sizeof(query_buf));
     bool running = false;
     bool ok = false;
 
     uint8_t state = this->get_state();
 
-    str.append("<");
+    w.append("<");
     if (state == SLEEP) {
-    	str.append("Sleep");
+    	w.append("Sleep");
     } else if (state == SUSPEND) {
-    	str.append("Pause");
+    	w.append("Pause");
     } else if (state == WAIT) {
-        str.append("Wait");
+        w.append("Wait");
     } else if (state == TOOL) {
-		str.append("Tool");
+		w.append("Tool");
     } else if (state == ALARM) {
-        str.append("Alarm");
+        w.append("Alarm");
     } else if (state == HOME) {
         running = true;
-        str.append("Home");
+        w.append("Home");
     } else if (state == HOLD) {
-        str.append("Hold");
+        w.append("Hold");
     } else if (state == IDLE) {
-        str.append("Idle");
+        w.append("Idle");
     } else if (state == RUN) {
         running = true;
-        str.append("Run");
+        w.append("Run");
     }
 
-    size_t n;
-    char buf[128];
     if(running) {
+        // the same snapshot for every stream polling, see Robot::get_status_position()
         float mpos[5];
-        robot->get_current_machine_position(mpos);
-        // current_position/mpos includes the compensation transform so we need to get the inverse to get actual position
-        if(robot->compensationTransform) robot->compensationTransform(mpos, true, false); // get inverse compensation transform
+        robot->get_status_position(mpos);
 
         // machine position
-        n = snprintf(buf, sizeof(buf), "%1.4f,%1.4f,%1.4f", robot->from_millimeters(mpos[0]), robot->from_millimeters(mpos[1]), robot->from_millimeters(mpos[2]));
-        if(n > sizeof(buf)) n= sizeof(buf);
-
-        str.append("|MPos:").append(buf, n);
+        float xyz[3] = {robot->from_millimeters(mpos[0]), robot->from_millimeters(mpos[1]), robot->from_millimeters(mpos[2])};
+        w.fixed_list("|MPos:", xyz, 3, 4);
 
 #if MAX_ROBOT_ACTUATORS > 3
         // deal with the ABC axis (E will be A)
         for (int i = A_AXIS; i < robot->get_number_registered_motors(); ++i) {
             // current actuator position
-            n = snprintf(buf, sizeof(buf), ",%1.4f", robot->actuators[i]->get_current_position());
-            if(n > sizeof(buf)) n= sizeof(buf);
-            str.append(buf, n);
+            w.append(",");
+            w.fixed(i <= B_AXIS ? mpos[i] : robot->actuators[i]->get_current_position(), 4);
         }
 #endif
 
         // work space position
-        mpos[A_AXIS] = robot->actuators[A_AXIS]->get_current_position();
-        mpos[B_AXIS] = robot->actuators[B_AXIS]->get_current_position();
-        
         Robot::wcs_t pos = robot->mcs2wcs(mpos);
-        n = snprintf(buf, sizeof(buf), "%1.4f,%1.4f,%1.4f", robot->from_millimeters(std::get<X_AXIS>(pos)), robot->from_millimeters(std::get<Y_AXIS>(pos)), robot->from_millimeters(std::get<Z_AXIS>(pos)));
-        if(n > sizeof(buf)) n= sizeof(buf);
-        str.append("|WPos:").append(buf, n);
-        
-        //n = snprintf(buf, sizeof(buf), ",%1.4f,%1.4f", robot->from_millimeters(std::get<A_AXIS>(pos)), robot->from_millimeters(std::get<B_AXIS>(pos)));
-        n = snprintf(buf, sizeof(buf), ",%1.4f,%1.4f", std::get<A_AXIS>(pos), std::get<B_AXIS>(pos));
-        if(n > sizeof(buf)) n= sizeof(buf);
-        str.append(buf, n);
+        append_position(w, robot, "|WPos:", pos);
 
     } else {
         // return the last milestone if idle
         // machine position
         Robot::wcs_t mpos = robot->get_axis_position();
-        size_t n = snprintf(buf, sizeof(buf), "%1.4f,%1.4f,%1.4f", robot->from_millimeters(std::get<X_AXIS>(mpos)), robot->from_millimeters(std::get<Y_AXIS>(mpos)), robot->from_millimeters(std::get<Z_AXIS>(mpos)));
-        if(n > sizeof(buf)) n= sizeof(buf);
-
-        str.append("|MPos:").append(buf, n);
-        
-        //n = snprintf(buf, sizeof(buf), ",%1.4f,%1.4f", robot->from_millimeters(std::get<A_AXIS>(mpos)), robot->from_millimeters(std::get<B_AXIS>(mpos)));
-        n = snprintf(buf, sizeof(buf), ",%1.4f,%1.4f", std::get<A_AXIS>(mpos), std::get<B_AXIS>(mpos));
-        if(n > sizeof(buf)) n= sizeof(buf);
-        str.append(buf, n);
-/*
-#if MAX_ROBOT_ACTUATORS > 3
-        // deal with the ABC axis (E will be A)
-        for (int i = A_AXIS; i < robot->get_number_registered_motors(); ++i) {
-            // current actuator position
-            n = snprintf(buf, sizeof(buf), ",%1.4f", robot->actuators[i]->get_current_position());
-            if(n > sizeof(buf)) n= sizeof(buf);
-            str.append(buf, n);
-        }
-#endif
-*/
+        append_position(w, robot, "|MPos:", mpos);
+
         // work space position
         Robot::wcs_t pos = robot->mcs2wcs(mpos);
-        n = snprintf(buf, sizeof(buf), "%1.4f,%1.4f,%1.4f", robot->from_millimeters(std::get<X_AXIS>(pos)), robot->from_millimeters(std::get<Y_AXIS>(pos)), robot->from_millimeters(std::get<Z_AXIS>(pos)));
-        if(n > sizeof(buf)) n= sizeof(buf);
-        str.append("|WPos:").append(buf, n);
-        
-        //n = snprintf(buf, sizeof(buf), ",%1.4f,%1.4f", robot->from_millimeters(std::get<A_AXIS>(pos)), robot->from_millimeters(std::get<B_AXIS>(pos)));
-        n = snprintf(buf, sizeof(buf), ",%1.4f,%1.4f", std::get<A_AXIS>(pos), std::get<B_AXIS>(pos));
-        if(n > sizeof(buf)) n= sizeof(buf);
-        str.append(buf, n);
+        append_position(w, robot, "|WPos:", pos);
     }
 
-    n = snprintf(buf, sizeof(buf), "|R:%1.4f", robot->r[robot->get_current_wcs()]);
-    if(n > sizeof(buf)) n= sizeof(buf);
-    str.append(buf, n);
-    n = snprintf(buf, sizeof(buf), "|G:%d", robot->get_current_wcs());
-    if(n > sizeof(buf)) n= sizeof(buf);
-    str.append(buf, n);
-    
+    // the WCS, its rotation and the machine state only when one changed
+    float r = robot->r[robot->get_current_wcs()];
+    uint8_t wcs = robot->get_current_wcs();
+    uint32_t machine_state = ((uint8_t)THEKERNEL->factory_set->MachineModel << 16) | ((uint8_t)THEKERNEL->factory_set->FuncSetting << 2) | (THEROBOT->inch_mode << 1) | THEROBOT->absolute_mode;
+    bool send_static = query_static_count == 0 || r != query_last_r || wcs != query_last_wcs || machine_state != query_last_machine_state;
+    if (send_static) {
+        query_last_r = r;
+        query_last_wcs = wcs;
+        query_last_machine_state = machine_state;
+        query_static_count = QUERY_STATIC_REFRESH;
+        w.append("|R:");
+        w.fixed(r, 4);
+        w.append("|G:");
+        w.integer(wcs);
+    }
+    --query_static_count;
+
     // current feedrate and requested fr and override
     float fr= running ? robot->from_millimeters(conveyor->get_current_feedrate()*60.0F) : 0;
     float frr= robot->from_millimeters(robot->get_feed_rate());
     float fro= 6000.0F / robot->get_seconds_per_minute();
-    n = snprintf(buf, sizeof(buf), "|F:%1.1f,%1.1f,%1.1f", fr, frr, fro);
-    if(n > sizeof(buf)) n= sizeof(buf);
-    str.append(buf, n);
+    float feeds[3] = {fr, frr, fro};
+    w.fixed_list("|F:", feeds, 3, 1);
+
+    // free planner blocks and bytes free in the receive buffer of the stream asking, so a host can keep the buffers
+    // full by counting what it sent instead of waiting for an ok per line
+    int rx = stream != nullptr ? stream->rx_free() : -1;
+    w.append("|Bf:");
+    w.integer(conveyor->queue_free());
+    if (rx >= 0) {
+        w.append(",");
+        w.integer(rx);
+    }
 
     // current spindle rpm and request rpm and override
     struct spindle_status ss;
     ok = PublicData::get_value(pwm_spindle_control_checksum, get_spindle_status_checksum, &ss);
     if (ok) {
-        n= snprintf(buf, sizeof(buf), "|S:%1.1f,%1.1f,%1.1f,%d", ss.current_rpm, ss.target_rpm, ss.factor, int(this->get_vacuum_mode()));
-        if(n > sizeof(buf)) n= sizeof(buf);
-        str.append(buf, n);
+        float spindle[3] = {ss.current_rpm, ss.target_rpm, ss.factor};
+        w.fixed_list("|S:", spindle, 3, 1);
+        w.append(",");
+        w.integer(this->get_vacuum_mode());
     }
 
     // get spindle temperature
     struct pad_temperature temp;
     ok = PublicData::get_value( temperature_control_checksum, current_temperature_checksum, spindle_temperature_checksum, &temp );
 	if (ok) {
-        n= snprintf(buf, sizeof(buf), ",%1.1f", temp.current_temperature);
-        if(n > sizeof(buf)) n= sizeof(buf);
-        str.append(buf, n);
-	}	
-	
+        w.append(",");
+        w.fixed(temp.current_temperature, 1);
+	}
+
     // get power temperature
     ok = PublicData::get_value( temperature_control_checksum, current_temperature_checksum, power_temperature_checksum, &temp );
 	if (ok) {
-        n= snprintf(buf, sizeof(buf), ",%1.1f", temp.current_temperature);
-        if(n > sizeof(buf)) n= sizeof(buf);
-        str.append(buf, n);
+        w.append(",");
+        w.fixed(temp.current_temperature, 1);
 	}
 
     // current tool number and tool offset
     struct tool_status tool;
     ok = PublicData::get_value( atc_handler_checksum, get_tool_status_checksum, &tool );
     if (ok) {
-    	if(THEKERNEL->factory_set->FuncSetting & (1<<2))	//ATC 
+        w.append("|T:");
+        w.integer(tool.active_tool);
+        w.append(",");
+        w.fixed(tool.tool_offset, 3);
+    	if(!(THEKERNEL->factory_set->FuncSetting & (1<<2)))	//Manual Tool Change
 	    {
-	        n= snprintf(buf, sizeof(buf), "|T:%d,%1.3f", tool.active_tool, tool.tool_offset);
+	        w.append(",");
+	        w.integer(tool.target_tool);
 	    }
-	    else	//Manual Tool Change
-	    {
-	    	n= snprintf(buf, sizeof(buf), "|T:%d,%1.3f,%d", tool.active_tool, tool.tool_offset, tool.target_tool);
-	    }
-        if(n > sizeof(buf)) n= sizeof(buf);
-        str.append(buf, n);
     }
 
     // wireless probe current voltage
     float wp_voltage;
     ok = PublicData::get_value( atc_handler_checksum, get_wp_voltage_checksum, &wp_voltage );
     if (ok) {
-        n= snprintf(buf, sizeof(buf), "|W:%1.2f", wp_voltage);
-        if(n > sizeof(buf)) n= sizeof(buf);
-        str.append(buf, n);
+        w.append("|W:");
+        w.fixed(wp_voltage, 2);
     }
 
     // current Laser power and override
     struct laser_status ls;
 	if(PublicData::get_value(laser_checksum, get_laser_status_checksum, &ls)) {
-		n = snprintf(buf, sizeof(buf), "|L:%d, %d, %d, %1.1f,%1.1f", int(ls.mode), int(ls.state), int(ls.testing), ls.power, ls.scale);
-		if(n > sizeof(buf)) n= sizeof(buf);
-		str.append(buf, n);
+		w.printf("|L:%d, %d, %d, %1.1f,%1.1f", int(ls.mode), int(ls.state), int(ls.testing), ls.power, ls.scale);
 	}
 
     // current running file info
@@ -414,92 +465,150 @@ std::string Kernel::get_query_string()
 	ok = PublicData::get_value( player_checksum, get_progress_checksum, &returned_data );
 	if (ok) {
 		struct pad_progress p =  *static_cast<struct pad_progress *>(returned_data);
-		n= snprintf(buf, sizeof(buf), "|P:%lu,%d,%lu", p.played_lines, p.percent_complete, p.elapsed_secs);
-		if(n > sizeof(buf)) n= sizeof(buf);
-		str.append(buf, n);
+		w.append("|P:");
+		w.integer(p.played_lines);
+		w.append(",");
+		w.integer(p.percent_complete);
+		w.append(",");
+		w.integer(p.elapsed_secs);
 	}
 
     // if not grbl mode get temperatures
     if(!is_grbl_mode()) {
-        struct pad_temperature temp;
         // scan all temperature controls
         std::vector<struct pad_temperature> controllers;
         bool ok = PublicData::get_value(temperature_control_checksum, poll_controls_checksum, &controllers);
         if (ok) {
-            char buf[32];
             for (auto &c : controllers) {
-                size_t n= snprintf(buf, sizeof(buf), "|%s:%1.1f,%1.1f", c.designator.c_str(), c.current_temperature, c.target_temperature);
-                if(n > sizeof(buf)) n= sizeof(buf);
-                str.append(buf, n);
+                float t[2] = {c.current_temperature, c.target_temperature};
+                w.append("|");
+                w.append(c.designator.c_str());
+                w.fixed_list(":", t, 2, 1);
             }
         }
     }
-	
-	if(THEKERNEL->factory_set->FuncSetting & (1<<2))	//ATC 
+
+	if(THEKERNEL->factory_set->FuncSetting & (1<<2))	//ATC
 	{
 	    // if doing atc
 	    if (atc_state != ATC_NONE) {
-	        n = snprintf(buf, sizeof(buf), "|A:%d", atc_state);
-	        if(n > sizeof(buf)) n = sizeof(buf);
-	        str.append(buf, n);
+	        w.printf("|A:%d", atc_state);
 	    }
 	}
 
     // if auto leveling is active
     if (robot->compensationTransform != nullptr) {
-        n = snprintf(buf, sizeof(buf), "|O:%1.3f", robot->get_max_delta());
-        if(n > sizeof(buf)) n = sizeof(buf);
-        str.append(buf, n);
+        w.append("|O:");
+        w.fixed(robot->get_max_delta(), 3);
     }
 
     // if halted
     if (halted) {
-        n = snprintf(buf, sizeof(buf), "|H:%d", halt_reason);
-        if(n > sizeof(buf)) n = sizeof(buf);
-        str.append(buf, n);
+        w.printf("|H:%d", halt_reason);
     }
-    
+
     // machine state
-    n = snprintf(buf, sizeof(buf), "|C:%d,%d,%d,%d", THEKERNEL->factory_set->MachineModel,THEKERNEL->factory_set->FuncSetting,THEROBOT->inch_mode,THEROBOT->absolute_mode);
-    if(n > sizeof(buf)) n = sizeof(buf);
-    str.append(buf, n);
+    if (send_static) {
+        w.printf("|C:%d,%d,%d,%d", THEKERNEL->factory_set->MachineModel,THEKERNEL->factory_set->FuncSetting,THEROBOT->inch_mode,THEROBOT->absolute_mode);
+    }
 
-    str.append(">\n");
-    return str;
+    w.append(">\n");
+    return query_buf;
 }
 
 
-// return a Diagnose string
-std::string Kernel::get_diagnose_string()
+// the diagnose report, in place like the status report, with only the fields that changed since the seq a client
+// passes, 0 for all of them
+static char diag_buf[256] __attribute__((section("AHBSRAM")));
+
+namespace {
+    // a report of fields each with a hash of what it was last time and the report it changed in
+    struct DiagWriter : ReportWriter {
+        Kernel::diag_field_t *fields;
+        uint32_t since;
+        uint32_t seq;               // of this report, if anything changed
+        bool changed;
+        int field;
+        size_t start;
+
+        DiagWriter(char *b, size_t s, Kernel::diag_field_t *f, uint32_t since, uint32_t seq)
+            : ReportWriter(b, s), fields(f), since(since), seq(seq), changed(false), field(0), start(0) {}
+
+        void begin(const char *key)
+        {
+            start = len;
+            if(len > 1) append("|");
+            append(key);
+        }
+
+        // forgets what has been written since begin() if the client already has it
+        void end(int i)
+        {
+            // FNV-1a of the field without its separator, which depends on what came before it
+            uint32_t h = 2166136261U;
+            for (size_t j = buf[start] == '|' ? start + 1 : start; j < len; ++j) h = (h ^ (uint8_t)buf[j]) * 16777619U;
+            Kernel::diag_field_t &f = fields[i];
+            if(h != f.hash) {
+                f.hash = h;
+                f.seq = seq;
+                changed = true;
+            }
+            if(f.seq <= since) {
+                len = start;
+                buf[len] = '\0';
+            }
+        }
+
+        void pad(const char *key, int i, const struct pad_switch &p, bool value)
+        {
+            begin(key);
+            integer(p.state);
+            if(value) {
+                append(",");
+                integer((long)p.value);
+            }
+            end(i);
+        }
+    };
+
+    enum { DIAG_S, DIAG_L, DIAG_V, DIAG_F, DIAG_G, DIAG_T, DIAG_R, DIAG_C, DIAG_E, DIAG_P, DIAG_A, DIAG_I, DIAG_Q, DIAG_K, DIAG_M, DIAG_COUNT };
+}
+
+const char *Kernel::get_diagnose_string(uint32_t since)
 {
-	std::string str;
-    size_t n;
-    char buf[128];
+    static_assert(DIAG_COUNT == DIAG_FIELDS, "a diagnose field without a slot");
+    // a seq from before a reset gets everything
+    if(since > diag_seq) since = 0;
+    DiagWriter w(diag_buf, sizeof(diag_buf), diag_fields, since, diag_seq + 1);
     bool ok = false;
 
-    str.append("{");
+    w.append("{");
 
     // get spindle state
     struct spindle_status ss;
     ok = PublicData::get_value(pwm_spindle_control_checksum, get_spindle_status_checksum, &ss);
     if (ok) {
-        n = snprintf(buf, sizeof(buf), "S:%d,%d", (int)ss.state, (int)ss.target_rpm);
-        if(n > sizeof(buf)) n= sizeof(buf);
-        str.append(buf, n);
+        w.begin("S:");
+        w.integer(ss.state);
+        w.append(",");
+        w.integer((long)ss.target_rpm);
+        w.end(DIAG_S);
     }
 
     // get laser state
     struct laser_status ls;
     ok = PublicData::get_value(laser_checksum, get_laser_status_checksum, &ls);
     if (ok) {
-        n = snprintf(buf, sizeof(buf), "|L:%d,%d", (int)ls.state, (int)ls.power);
-        if(n > sizeof(buf)) n= sizeof(buf);
-        str.append(buf, n);
+        w.begin("L:");
+        w.integer(ls.state);
+        w.append(",");
+        w.integer((long)ls.power);
+        w.end(DIAG_L);
     }
 
     // get switchs state
     struct pad_switch pad;
-    if(THEKERNEL->factory_set->FuncSetting & (1<<2))	//ATC 
+    if(THEKERNEL->factory_set->FuncSetting & (1<<2))	//ATC
     {
     	ok = PublicData::get_value(switch_checksum, get_checksum("vacuum"), 0, &pad);
     }
@@ -507,117 +616,167 @@ std::string Kernel::get_diagnose_string()
     {
     	ok = PublicData::get_value(switch_checksum, get_checksum("powerfan"), 0, &pad);
     }
-    	
-    if (ok) {
-        n = snprintf(buf, sizeof(buf), "|V:%d,%d", (int)pad.state, (int)pad.value);
-        if(n > sizeof(buf)) n = sizeof(buf);
-        str.append(buf, n);
-    }
+    if (ok) w.pad("V:", DIAG_V, pad, true);
     ok = PublicData::get_value(switch_checksum, get_checksum("spindlefan"), 0, &pad);
-    if (ok) {
-        n = snprintf(buf, sizeof(buf), "|F:%d,%d", (int)pad.state, (int)pad.value);
-        if(n > sizeof(buf)) n = sizeof(buf);
-        str.append(buf, n);
-    }
+    if (ok) w.pad("F:", DIAG_F, pad, true);
     ok = PublicData::get_value(switch_checksum, get_checksum("light"), 0, &pad);
     if (ok) {
-        n = snprintf(buf, sizeof(buf), "|G:%d", (int)pad.state);
-        if(n > sizeof(buf)) n = sizeof(buf);
-        str.append(buf, n);
+        w.begin("G:");
+        w.integer(pad.state);
+        if(CARVERA_AIR == THEKERNEL->factory_set->MachineModel) {
+            struct pad_switch pad2, pad3;
+            bool ok1 = PublicData::get_value(switch_checksum, get_checksum("beep"), 0, &pad);
+            bool ok2 = PublicData::get_value(switch_checksum, get_checksum("extendin"), 0, &pad2);
+            bool ok3 = PublicData::get_value(switch_checksum, get_checksum("extendout"), 0, &pad3);
+            if (ok1 && ok2 && ok3) {
+                int v[4] = {(int)pad.state, (int)pad2.state, (int)pad3.state, (int)pad3.value};
+                for (int i = 0; i < 4; i++) {
+                    w.append(",");
+                    w.integer(v[i]);
+                }
+            }
+        }
+        w.end(DIAG_G);
     }
-    if(CARVERA_AIR == THEKERNEL->factory_set->MachineModel)
-	{	
-    	bool ok2 = false;
-    	bool ok3 = false;
-    	struct pad_switch pad2,pad3;
-	    ok = PublicData::get_value(switch_checksum, get_checksum("beep"), 0, &pad);
-	    ok2 = PublicData::get_value(switch_checksum, get_checksum("extendin"), 0, &pad2);
-	   	ok3 = PublicData::get_value(switch_checksum, get_checksum("extendout"), 0, &pad3);
-	    if (ok&&ok2&&ok3) {
-	        n = snprintf(buf, sizeof(buf), ",%d,%d,%d,%d", (int)pad.state, (int)pad2.state, (int)pad3.state, (int)pad3.value);
-	        if(n > sizeof(buf)) n = sizeof(buf);
-	        str.append(buf, n);
-	    }
-	    
-	}
     ok = PublicData::get_value(switch_checksum, get_checksum("toolsensor"), 0, &pad);
-    if (ok) {
-        n = snprintf(buf, sizeof(buf), "|T:%d", (int)pad.state);
-        if(n > sizeof(buf)) n = sizeof(buf);
-        str.append(buf, n);
-    }
+    if (ok) w.pad("T:", DIAG_T, pad, false);
     ok = PublicData::get_value(switch_checksum, get_checksum("air"), 0, &pad);
-    if (ok) {
-        n = snprintf(buf, sizeof(buf), "|R:%d", (int)pad.state);
-        if(n > sizeof(buf)) n = sizeof(buf);
-        str.append(buf, n);
-    }
+    if (ok) w.pad("R:", DIAG_R, pad, false);
     ok = PublicData::get_value(switch_checksum, get_checksum("probecharger"), 0, &pad);
-    if (ok) {
-        n = snprintf(buf, sizeof(buf), "|C:%d", (int)pad.state);
-        if(n > sizeof(buf)) n = sizeof(buf);
-        str.append(buf, n);
-    }
+    if (ok) w.pad("C:", DIAG_C, pad, false);
 
     // get states
     char data[11];
     ok = PublicData::get_value(endstops_checksum, get_endstop_states_checksum, 0, data);
     if (ok) {
-        n = snprintf(buf, sizeof(buf), "|E:%d,%d,%d,%d,%d,%d", data[0], data[1], data[2], data[3], data[4], data[5]);
-        if(n > sizeof(buf)) n = sizeof(buf);
-        str.append(buf, n);
-    }
-    if(THEKERNEL->factory_set->FuncSetting & ((1<<0)|(1<<1)) )
-    {
-    	ok = PublicData::get_value(endstops_checksum, get_endstopAB_states_checksum, 0, data);
-	    if (ok) {
-	        n = snprintf(buf, sizeof(buf), ",%d,%d", data[0],data[1]);
-	        if(n > sizeof(buf)) n = sizeof(buf);
-	        str.append(buf, n);
-	    }
+        w.begin("E:");
+        int n = 6;
+        if((THEKERNEL->factory_set->FuncSetting & ((1<<0)|(1<<1))) && PublicData::get_value(endstops_checksum, get_endstopAB_states_checksum, 0, &data[6])) n = 8;
+        for (int i = 0; i < n; i++) {
+            if(i > 0) w.append(",");
+            w.integer(data[i]);
+        }
+        w.end(DIAG_E);
     }
 
     // get probe and calibrate states
     ok = PublicData::get_value(zprobe_checksum, get_zprobe_pin_states_checksum, 0, &data[6]);
     if (ok) {
-        n = snprintf(buf, sizeof(buf), "|P:%d,%d", data[6], data[7]);
-        if(n > sizeof(buf)) n = sizeof(buf);
-        str.append(buf, n);
+        w.begin("P:");
+        w.integer(data[6]);
+        w.append(",");
+        w.integer(data[7]);
+        w.end(DIAG_P);
     }
-	
-	if(THEKERNEL->factory_set->FuncSetting & (1<<2))	//ATC 
+
+	if(THEKERNEL->factory_set->FuncSetting & (1<<2))	//ATC
 	{
 	    // get atc endstop and tool senser states
 	    ok = PublicData::get_value(atc_handler_checksum, get_atc_pin_status_checksum, 0, &data[8]);
 	    if (ok) {
-	        n = snprintf(buf, sizeof(buf), "|A:%d,%d", data[8], data[9]);
-	        if(n > sizeof(buf)) n = sizeof(buf);
-	        str.append(buf, n);
+	        w.begin("A:");
+	        w.integer(data[8]);
+	        w.append(",");
+	        w.integer(data[9]);
+	        w.end(DIAG_A);
 	    }
 	}
 
     // get e-stop states
     ok = PublicData::get_value(main_button_checksum, get_e_stop_state_checksum, 0, &data[10]);
     if (ok) {
-        n = snprintf(buf, sizeof(buf), "|I:%d", data[10]);
-        if(n > sizeof(buf)) n = sizeof(buf);
-        str.append(buf, n);
+        w.begin("I:");
+        w.integer(data[10]);
+        w.end(DIAG_I);
     }
 
-    str.append("}\n");
-    return str;
+    // how often the planner queue ran dry in the job, for how long, and the worst of it
+    const Conveyor::queue_stats_t &qs = this->conveyor->get_queue_stats();
+    w.begin("Q:");
+    w.integer(qs.starve_count);
+    w.append(",");
+    w.integer(qs.starve_ms);
+    w.append(",");
+    w.integer(qs.worst[0].us / 1000);
+    w.append(",");
+    w.integer(qs.worst[0].line);
+    w.end(DIAG_Q);
+
+    // step ticker max and average cycles and overruns
+    const StepTicker::isr_stats_t &ts = this->step_ticker->get_step_stats();
+    w.begin("K:");
+    w.integer(ts.max);
+    w.append(",");
+    w.integer(ts.avg());
+    w.append(",");
+    w.integer(this->step_ticker->get_overruns());
+    w.end(DIAG_K);
+
+    // stack high water and size
+    MemoryStats::stack_t st;
+    MemoryStats::stack_usage(st);
+    w.begin("M:");
+    w.integer(st.high_water);
+    w.append(",");
+    w.integer(st.size);
+    w.end(DIAG_M);
+
+    // the seq to pass next time
+    if(w.changed) diag_seq = w.seq;
+    w.begin("N:");
+    w.integer(diag_seq);
+
+    w.append("}\n");
+    return diag_buf;
 }
 
 // Add a module to Kernel. We don't actually hold a list of modules we just call its on_module_loaded
 void Kernel::add_module(Module* module)
 {
+    int trace = BootTrace::begin(module);
     module->on_module_loaded();
+    BootTrace::end(trace);
 }
 
 // Adds a hook for a given module and event
 void Kernel::register_for_event(_EVENT_ENUM id_event, Module *mod)
 {
-    this->hooks[id_event].push_back(mod);
+    EventHandler fnc = event_handler(mod, id_event);
+    if(fnc == nullptr) return;
+
+    bool frozen = frozen_hooks != nullptr;
+    if(frozen) thaw_hooks();
+    this->hooks[id_event].push_back({mod, fnc});
+    if(frozen) freeze_hooks();
+}
+
+void Kernel::freeze_hooks()
+{
+    if(frozen_hooks != nullptr) return;
+
+    size_t n = 0;
+    for (auto &h : hooks) n += h.size();
+    hook_t *table = (hook_t *)malloc(n * sizeof(hook_t));
+    if(table == nullptr) return;
+
+    n = 0;
+    for (int e = 0; e < NUMBER_OF_DEFINED_EVENTS; e++) {
+        frozen_start[e] = n;
+        for (auto &h : hooks[e]) table[n++] = h;
+        std::vector<hook_t>().swap(hooks[e]);
+    }
+    frozen_start[NUMBER_OF_DEFINED_EVENTS] = n;
+    frozen_hooks = table;
+}
+
+// back into the lists to change them
+void Kernel::thaw_hooks()
+{
+    for (int e = 0; e < NUMBER_OF_DEFINED_EVENTS; e++) {
+        hooks[e].assign(&frozen_hooks[frozen_start[e]], &frozen_hooks[frozen_start[e + 1]]);
+    }
+    free(frozen_hooks);
+    frozen_hooks = nullptr;
 }
 
 // Call a specific event with an argument
@@ -627,15 +786,79 @@ void Kernel::call_event(_EVENT_ENUM id_event, void * argument)
     if(id_event == ON_HALT) {
         this->halted = (argument == nullptr);
         if(!this->halted && this->feed_hold) this->feed_hold= false; // also clear feed hold
+        refresh_state();
         was_idle = conveyor->is_idle(); // see if we were doing anything like printing
     }
 
+    // the main loop and idle handlers that asked for it only run when they are due
+    std::vector<schedule_t> *sched = nullptr;
+    uint32_t now = 0;
+    bool feed_low = false;
+    if(id_event == ON_MAIN_LOOP || id_event == ON_IDLE) {
+        sched = &schedules[id_event == ON_IDLE ? 1 : 0];
+        if(sched->empty()) {
+            sched = nullptr;
+        } else {
+            now = us_ticker_read();
+            feed_low = conveyor != nullptr && !conveyor->is_idle() && conveyor->queue_used() < background_queue_min;
+        }
+    }
+
     // send to all registered modules
-    for (auto m : hooks[id_event]) {
-        (m->*kernel_callback_functions[id_event])(argument);
+    if(sched != nullptr || this->event_profiling) {
+        auto &stats = event_stats[id_event];
+        if(this->event_profiling && stats.size() < hooks_count(id_event)) stats.resize(hooks_count(id_event), {nullptr, 0, 0, 0});
+        // the table is looked up again for each one as a handler may register or unregister something
+        for (size_t i = 0; i < hooks_count(id_event); i++) {
+            hook_t h = hooks_begin(id_event)[i];
+            Module *m = h.module;
+            if(sched != nullptr) {
+                auto s = std::find_if(sched->begin(), sched->end(), [m](const schedule_t &e) { return e.module == m; });
+                if(s != sched->end() && !is_due(*s, now, feed_low)) continue;
+            }
+            if(!this->event_profiling) {
+                h.fnc(m, argument);
+                continue;
+            }
+
+            uint32_t start = DWT_CYCCNT;
+            h.fnc(m, argument);
+            uint32_t cycles = DWT_CYCCNT - start;
+            if(i >= stats.size()) continue; // a nested event registered a module for this event
+            event_stats_t &s = stats[i];
+            if(s.module != m) s = {m, 0, 0, 0}; // a module registered or unregistered, start again for this slot
+            s.count++;
+            s.total += cycles;
+            if(cycles > s.max) s.max = cycles;
+        }
+
+    } else {
+        for (size_t i = 0; i < hooks_count(id_event); i++) {
+            hook_t h = hooks_begin(id_event)[i];
+            h.fnc(h.module, argument);
+        }
+    }
+
+    if(id_event == ON_MAIN_LOOP) {
+        if(this->eeprom_pending) this->flush_eeprom_page();
+        // the long operations that have been made tasks, a step each
+        Task::run_all();
+    }
+
+    if(id_event == ON_MAIN_LOOP || id_event == ON_IDLE) {
+        // the queue going idle or busy is not flagged anywhere, the rest was already seen by the setters
+        refresh_state();
+        if(state != notified_state) {
+            uint8_t was = notified_state;
+            notified_state = state;
+            call_event(ON_STATE_CHANGE, (void *)(uintptr_t)was);
+        }
     }
 
     if(id_event == ON_HALT) {
+        // anything still waiting to go to the eeprom is written now, before the machine is power cycled
+        if(this->halted && this->eeprom_pending) this->write_eeprom_data();
+
         // If we just entered a halt state AND the debug flag is enabled, break into the debugger.
         // This happens after ON_HALT handlers have run, presumably stopping motion planners etc.
         if (this->halted && this->halt_on_error_debug) {
@@ -651,23 +874,149 @@ void Kernel::call_event(_EVENT_ENUM id_event, void * argument)
     }
 }
 
+/*
+ * PublicData requests used to go to every module registered for the event, which each compared the checksums.
+ * Nearly every first checksum belongs to one module, so the first time a request is made everyone is asked and
+ * the module that took it is remembered, after that requests starting with that checksum go straight to it.
+ * If it does not take one, or more than one module took it, everyone is asked again and that checksum is
+ * always sent to everyone from then on, as it is a legacy key more than one module answers to (like switch).
+ * Requests nobody takes are always sent to everyone.
+ */
+void Kernel::call_public_data_event(_EVENT_ENUM id_event, PublicDataRequest *pdr)
+{
+    int e = (id_event == ON_GET_PUBLIC_DATA) ? 0 : 1;
+    auto &owners = public_data_owners[e];
+    uint16_t cs = pdr->first_element();
+
+    public_data_owner_t *entry = nullptr;
+    for (uint8_t i = 0; i < n_public_data_owners[e]; i++) {
+        if(owners[i].checksum == cs) {
+            entry = &owners[i];
+            break;
+        }
+    }
+
+    if(entry != nullptr && entry->owner != nullptr) {
+        (entry->owner->*kernel_callback_functions[id_event])(pdr);
+        if(pdr->is_taken()) return;
+    }
+
+    // ask everyone and see who takes it
+    Module *taker = nullptr;
+    bool shared = false;
+    for (size_t i = 0; i < hooks_count(id_event); i++) {
+        hook_t h = hooks_begin(id_event)[i];
+        Module *m = h.module;
+        uint8_t taken = pdr->get_taken_count();
+        h.fnc(m, pdr);
+        if(pdr->get_taken_count() != taken) {
+            if(taker != nullptr && taker != m) shared = true;
+            taker = m;
+        }
+    }
+
+    if(taker == nullptr) return;
+
+    if(entry == nullptr) {
+        if(n_public_data_owners[e] >= k_public_data_owners) return;
+        entry = &owners[n_public_data_owners[e]++];
+        entry->checksum = cs;
+        entry->owner = shared ? nullptr : taker;
+    } else {
+        // the owner did not take it so someone else did
+        entry->owner = nullptr;
+    }
+}
+
+void Kernel::set_event_schedule(_EVENT_ENUM id_event, Module *mod, uint16_t period_ms, bool background)
+{
+    if(id_event != ON_MAIN_LOOP && id_event != ON_IDLE) return;
+
+    auto &sched = schedules[id_event == ON_IDLE ? 1 : 0];
+    for (auto &s : sched) {
+        if(s.module == mod) {
+            s.period_us = period_ms * 1000;
+            s.background = background;
+            return;
+        }
+    }
+    sched.push_back({mod, us_ticker_read(), period_ms * 1000UL, background});
+}
+
+bool Kernel::is_due(schedule_t &s, uint32_t now, bool feed_low)
+{
+    uint32_t elapsed = now - s.last_us;
+    if(elapsed < s.period_us) return false;
+    if(s.background && feed_low && elapsed < background_max_us) return false;
+    s.last_us = now;
+    return true;
+}
+
+void Kernel::set_event_profiling(bool on)
+{
+    this->event_profiling = false;
+    for (auto &s : event_stats) {
+        // free it, not just clear it, as it is only wanted while profiling
+        std::vector<event_stats_t>().swap(s);
+    }
+    this->event_profiling = on;
+}
+
+// modules have no names, the vtable address can be looked up in the map file to see which class it is
+void Kernel::print_event_profile(StreamOutput *stream) const
+{
+    static const char *event_names[NUMBER_OF_DEFINED_EVENTS] = {
+        "main_loop", "console_line", "gcode", "idle", "second_tick", "get_data", "set_data", "halt", "enable", "state_change"
+    };
+
+    if(!this->event_profiling) {
+        stream->printf("event profiling is off, $P1 to start\n");
+        return;
+    }
+
+    stream->printf("event module vtable count max avg total (cycles, including nested events)\n");
+    for (int e = 0; e < NUMBER_OF_DEFINED_EVENTS; e++) {
+        for (auto &s : event_stats[e]) {
+            if(s.module == nullptr || s.count == 0) continue;
+            stream->printf("%s %p %p %lu %lu %lu %llu\n", event_names[e], s.module, *(void **)s.module,
+                           s.count, s.max, (uint32_t)(s.total / s.count), s.total);
+        }
+    }
+}
+
 // These are used by tests to test for various things. basically mocks
 bool Kernel::kernel_has_event(_EVENT_ENUM id_event, Module *mod)
 {
-    for (auto m : hooks[id_event]) {
-        if(m == mod) return true;
+    for (size_t i = 0; i < hooks_count(id_event); i++) {
+        if(hooks_begin(id_event)[i].module == mod) return true;
     }
     return false;
 }
 
 void Kernel::unregister_for_event(_EVENT_ENUM id_event, Module *mod)
 {
+    if(id_event == ON_MAIN_LOOP || id_event == ON_IDLE) {
+        auto &sched = schedules[id_event == ON_IDLE ? 1 : 0];
+        sched.erase(std::remove_if(sched.begin(), sched.end(), [mod](const schedule_t &e) { return e.module == mod; }), sched.end());
+    }
+
+    if(id_event == ON_GET_PUBLIC_DATA || id_event == ON_SET_PUBLIC_DATA) {
+        // its requests go to everyone from now on
+        int e = (id_event == ON_GET_PUBLIC_DATA) ? 0 : 1;
+        for (uint8_t i = 0; i < n_public_data_owners[e]; i++) {
+            if(public_data_owners[e][i].owner == mod) public_data_owners[e][i].owner = nullptr;
+        }
+    }
+
+    bool frozen = frozen_hooks != nullptr;
+    if(frozen) thaw_hooks();
     for (auto i = hooks[id_event].begin(); i != hooks[id_event].end(); ++i) {
-        if(*i == mod) {
+        if(i->module == mod) {
             hooks[id_event].erase(i);
-            return;
+            break;
         }
     }
+    if(frozen) freeze_hooks();
 }
 
 void Kernel::read_eeprom_data()
@@ -696,37 +1045,51 @@ void Kernel::read_eeprom_data()
     wait(0.05);
 
     memcpy(this->eeprom_data, i2c_buffer, size);
+    memcpy(this->eeprom_written, i2c_buffer, size);
 }
 
-void Kernel::write_eeprom_data()
+// the first page of eeprom_data that is not what was last written, -1 when they are the same
+int Kernel::dirty_eeprom_page() const
 {
-	size_t size = sizeof(EEPROM_data);
-	char Data_buffer[size];
-	unsigned int writenum = 0;
-	unsigned int result = 0;
-	unsigned int pagenum = 0;
-	unsigned int bytenum =0;
-	unsigned char * writeptr = 0;
-	unsigned int u8Pagebegin=EEPROM_DATA_STARTPAGE;
+	const size_t size = sizeof(EEPROM_data);
+	const unsigned char *data = (const unsigned char *)this->eeprom_data;
+	const unsigned char *written = (const unsigned char *)this->eeprom_written;
 
-	memcpy(Data_buffer, this->eeprom_data, size);
+	for (size_t offset = 0; offset < size; offset += EEP_MAX_PAGE_SIZE) {
+		size_t n = std::min(size - offset, (size_t)EEP_MAX_PAGE_SIZE);
+		if (memcmp(data + offset, written + offset, n) != 0) return offset / EEP_MAX_PAGE_SIZE;
+	}
+	return -1;
+}
 
-	writeptr = (unsigned char *)Data_buffer;
-	while(writenum < size)
-	{
-		bytenum = (size-pagenum*EEP_MAX_PAGE_SIZE) >= EEP_MAX_PAGE_SIZE ? EEP_MAX_PAGE_SIZE : size-pagenum*EEP_MAX_PAGE_SIZE;
-		result = iic_page_write(u8Pagebegin+pagenum, bytenum, (unsigned char *)writeptr);
+int Kernel::write_eeprom_page(int pagenum)
+{
+	const size_t size = sizeof(EEPROM_data);
+	size_t offset = pagenum * EEP_MAX_PAGE_SIZE;
+	size_t bytenum = std::min(size - offset, (size_t)EEP_MAX_PAGE_SIZE);
+	unsigned char Data_buffer[EEP_MAX_PAGE_SIZE];
+
+	memcpy(Data_buffer, (const unsigned char *)this->eeprom_data + offset, bytenum);
+	int result = iic_page_write(EEPROM_DATA_STARTPAGE + pagenum, bytenum, Data_buffer);
+	if (result == 0) {
+		memcpy((unsigned char *)this->eeprom_written + offset, Data_buffer, bytenum);
+	}
+	this->eeprom_last_write_us = us_ticker_read();
+	return result;
+}
+
+// writes the pages that changed since they were last written, waiting for each one
+void Kernel::write_eeprom_data()
+{
+	this->eeprom_pending = false;
+
+	int pagenum;
+	unsigned int result = 0;
+	while ((pagenum = dirty_eeprom_page()) >= 0) {
+		if (us_ticker_read() - this->eeprom_last_write_us < EEPROM_WRITE_CYCLE_US) wait_us(EEPROM_WRITE_CYCLE_US);
+		result = write_eeprom_page(pagenum);
 		wait(0.1);
-		if(result == 0)
-		{
-			pagenum ++;
-			writenum += bytenum;
-			writeptr += bytenum;
-		}
-		else
-		{
-			break;
-		}
+		if (result != 0) break;
 	}
 	if (result != 0) {
 		this->streams->printf("ALARM: EEPROM data write error:%d\n",pagenum);
@@ -735,6 +1098,29 @@ void Kernel::write_eeprom_data()
 	}
 }
 
+// the changed pages are written from the main loop one at a time, so a macro setting variables in a loop does not wait
+// for the eeprom, several changes to a page before it gets its turn go in one write
+void Kernel::defer_eeprom_write()
+{
+	this->eeprom_pending = true;
+}
+
+// called from the main loop while a deferred write is pending, writes at most one page and does not wait
+void Kernel::flush_eeprom_page()
+{
+	if (us_ticker_read() - this->eeprom_last_write_us < EEPROM_WRITE_CYCLE_US) return;
+
+	int pagenum = dirty_eeprom_page();
+	if (pagenum < 0) {
+		this->eeprom_pending = false;
+		return;
+	}
+	if (write_eeprom_page(pagenum) != 0) {
+		this->eeprom_pending = false;
+		this->streams->printf("ALARM: EEPROM data write error:%d\n",pagenum);
+	}
+}
+
 void Kernel::erase_eeprom_data()
 {
 	size_t size = sizeof(EEPROM_data);
@@ -766,6 +1152,8 @@ void Kernel::erase_eeprom_data()
 			break;
 		}
 	}
+	// eeprom_data is left as it was, the next write puts it all back
+	memset(this->eeprom_written, 0, sizeof(EEPROM_data));
 	if (result != 0) {
 		this->streams->printf("ALARM: EEPROM data erase error.\n");
 	} else {
@@ -1117,55 +1505,6 @@ bool Kernel::Check_Factory_Data(unsigned char *data, unsigned int len)
 	}
 }
 
-unsigned int Kernel::crc16_ccitt(unsigned char *data, unsigned int len)
-{
-	static const unsigned short crc_table[] = {
-		0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
-		0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
-		0x1231, 0x0210, 0x3273, 0x2252, 0x52b5, 0x4294, 0x72f7, 0x62d6,
-		0x9339, 0x8318, 0xb37b, 0xa35a, 0xd3bd, 0xc39c, 0xf3ff, 0xe3de,
-		0x2462, 0x3443, 0x0420, 0x1401, 0x64e6, 0x74c7, 0x44a4, 0x5485,
-		0xa56a, 0xb54b, 0x8528, 0x9509, 0xe5ee, 0xf5cf, 0xc5ac, 0xd58d,
-		0x3653, 0x2672, 0x1611, 0x0630, 0x76d7, 0x66f6, 0x5695, 0x46b4,
-		0xb75b, 0xa77a, 0x9719, 0x8738, 0xf7df, 0xe7fe, 0xd79d, 0xc7bc,
-		0x48c4, 0x58e5, 0x6886, 0x78a7, 0x0840, 0x1861, 0x2802, 0x3823,
-		0xc9cc, 0xd9ed, 0xe98e, 0xf9af, 0x8948, 0x9969, 0xa90a, 0xb92b,
-		0x5af5, 0x4ad4, 0x7ab7, 0x6a96, 0x1a71, 0x0a50, 0x3a33, 0x2a12,
-		0xdbfd, 0xcbdc, 0xfbbf, 0xeb9e, 0x9b79, 0x8b58, 0xbb3b, 0xab1a,
-		0x6ca6, 0x7c87, 0x4ce4, 0x5cc5, 0x2c22, 0x3c03, 0x0c60, 0x1c41,
-		0xedae, 0xfd8f, 0xcdec, 0xddcd, 0xad2a, 0xbd0b, 0x8d68, 0x9d49,
-		0x7e97, 0x6eb6, 0x5ed5, 0x4ef4, 0x3e13, 0x2e32, 0x1e51, 0x0e70,
-		0xff9f, 0xefbe, 0xdfdd, 0xcffc, 0xbf1b, 0xaf3a, 0x9f59, 0x8f78,
-		0x9188, 0x81a9, 0xb1ca, 0xa1eb, 0xd10c, 0xc12d, 0xf14e, 0xe16f,
-		0x1080, 0x00a1, 0x30c2, 0x20e3, 0x5004, 0x4025, 0x7046, 0x6067,
-		0x83b9, 0x9398, 0xa3fb, 0xb3da, 0xc33d, 0xd31c, 0xe37f, 0xf35e,
-		0x02b1, 0x1290, 0x22f3, 0x32d2, 0x4235, 0x5214, 0x6277, 0x7256,
-		0xb5ea, 0xa5cb, 0x95a8, 0x8589, 0xf56e, 0xe54f, 0xd52c, 0xc50d,
-		0x34e2, 0x24c3, 0x14a0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
-		0xa7db, 0xb7fa, 0x8799, 0x97b8, 0xe75f, 0xf77e, 0xc71d, 0xd73c,
-		0x26d3, 0x36f2, 0x0691, 0x16b0, 0x6657, 0x7676, 0x4615, 0x5634,
-		0xd94c, 0xc96d, 0xf90e, 0xe92f, 0x99c8, 0x89e9, 0xb98a, 0xa9ab,
-		0x5844, 0x4865, 0x7806, 0x6827, 0x18c0, 0x08e1, 0x3882, 0x28a3,
-		0xcb7d, 0xdb5c, 0xeb3f, 0xfb1e, 0x8bf9, 0x9bd8, 0xabbb, 0xbb9a,
-		0x4a75, 0x5a54, 0x6a37, 0x7a16, 0x0af1, 0x1ad0, 0x2ab3, 0x3a92,
-		0xfd2e, 0xed0f, 0xdd6c, 0xcd4d, 0xbdaa, 0xad8b, 0x9de8, 0x8dc9,
-		0x7c26, 0x6c07, 0x5c64, 0x4c45, 0x3ca2, 0x2c83, 0x1ce0, 0x0cc1,
-		0xef1f, 0xff3e, 0xcf5d, 0xdf7c, 0xaf9b, 0xbfba, 0x8fd9, 0x9ff8,
-		0x6e17, 0x7e36, 0x4e55, 0x5e74, 0x2e93, 0x3eb2, 0x0ed1, 0x1ef0,
-	};
-
-	unsigned char tmp;
-	unsigned short crc = 0;
-
-	for (unsigned int i = 0; i < len; i ++) {
-        tmp = ((crc >> 8) ^ data[i]) & 0xff;
-        crc = ((crc << 8) ^ crc_table[tmp]) & 0xffff;
-	}
-
-	return crc & 0xffff;
-}
-
-
 int Kernel::iic_page_write(unsigned char u8PageNum, unsigned char u8len, unsigned char *pu8Array)
 {
 	unsigned char   i;
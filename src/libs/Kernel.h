@@ -37,6 +37,7 @@ class Planner;
 class StepTicker;
 class Adc;
 class PublicData;
+class PublicDataRequest;
 class SimpleShell;
 class Configurator;
 
@@ -121,6 +122,7 @@ class Kernel {
         ~Kernel() {
             delete this->i2c;
             delete this->eeprom_data;
+            delete this->eeprom_written;
             delete this->factory_set;
         }
 
@@ -129,7 +131,20 @@ class Kernel {
 
         void add_module(Module* module);
         void register_for_event(_EVENT_ENUM id_event, Module *module);
+        // once every module is loaded, packs the hooks of all the events into one table and frees the lists they
+        // were collected in. Registering or unregistering after that still works, it rebuilds the table
+        void freeze_hooks();
         void call_event(_EVENT_ENUM id_event, void * argument= nullptr);
+        // ON_GET_PUBLIC_DATA or ON_SET_PUBLIC_DATA, straight to the module that owns the request's first checksum once it is known
+        void call_public_data_event(_EVENT_ENUM id_event, PublicDataRequest *pdr);
+
+        // see Module::schedule_event
+        void set_event_schedule(_EVENT_ENUM id_event, Module *mod, uint16_t period_ms, bool background);
+
+        // cycles spent in each module's handler for each event, off unless turned on with $P1
+        void set_event_profiling(bool on);
+        bool is_event_profiling() const { return event_profiling; }
+        void print_event_profile(StreamOutput *stream) const;
 
         bool kernel_has_event(_EVENT_ENUM id_event, Module *module);
         void unregister_for_event(_EVENT_ENUM id_event, Module *module);
@@ -141,7 +156,7 @@ class Kernel {
         bool is_grbl_mode() const { return grbl_mode; }
         bool is_ok_per_line() const { return ok_per_line; }
 
-        void set_feed_hold(bool f) { feed_hold= f; }
+        void set_feed_hold(bool f) { feed_hold= f; refresh_state(); }
         bool get_feed_hold() const { return feed_hold; }
         bool is_feed_hold_enabled() const { return enable_feed_hold; }
         void set_bad_mcu(bool b) { bad_mcu= b; }
@@ -173,16 +188,16 @@ class Kernel {
         void set_line_by_line_exec_mode(bool f) { line_by_line_exec_mode = f; }
         bool get_line_by_line_exec_mode() const { return line_by_line_exec_mode; }
 
-        void set_sleeping(bool f) { sleeping = f; }
+        void set_sleeping(bool f) { sleeping = f; refresh_state(); }
         bool is_sleeping() const { return sleeping; }
 
-        void set_suspending(bool f) { suspending = f; }
+        void set_suspending(bool f) { suspending = f; refresh_state(); }
         bool is_suspending() const { return suspending; }
 
-        void set_waiting(bool f) { waiting = f; }
+        void set_waiting(bool f) { waiting = f; refresh_state(); }
         bool is_waiting() const { return waiting; }
         
-        void set_tool_waiting(bool f) { tool_waiting = f; }
+        void set_tool_waiting(bool f) { tool_waiting = f; refresh_state(); }
         bool is_tool_waiting() const { return tool_waiting; }
 
         void set_aborted(bool f) { aborted = f; }
@@ -199,7 +214,14 @@ class Kernel {
 
         void set_halt_reason(uint8_t reason) { halt_reason = reason; }
         uint8_t get_halt_reason() const { return halt_reason; }
-        void set_halted(bool h) { halted = h; }
+        void set_halted(bool h) { halted = h; refresh_state(); }
+
+        // set by the endstops for as long as they are homing or a limit is triggered
+        void set_homing(bool h) { homing = h; refresh_state(); }
+        bool is_homing() const { return homing; }
+
+        void set_spindle_on(bool f) { spindleon = f; refresh_state(); }
+        bool is_spindle_on() const { return spindleon; }
 
         void set_atc_state(uint8_t state) { atc_state = state; }
         uint8_t get_atc_state() const { return atc_state; }        
@@ -209,6 +231,7 @@ class Kernel {
 
         void read_eeprom_data();
         void write_eeprom_data();
+        void defer_eeprom_write();
         void erase_eeprom_data();
         void check_eeprom_data();
         
@@ -219,11 +242,17 @@ class Kernel {
         bool Check_Factory_Data(unsigned char *data, unsigned int len);
         bool Factroy_readLine(std::string& line, int lineno, FILE *fp);
         bool process_line(const std::string &buffer, uint16_t *check_sum, unsigned char *value);
-        unsigned int crc16_ccitt(unsigned char *data, unsigned int len);
 
-        std::string get_query_string();
+        const char *get_query_string(StreamOutput *stream = nullptr);
+
+        // since is the N: of the report a client got last, it is sent only what changed after it, 0 for everything
+        const char *get_diagnose_string(uint32_t since = 0);
 
-        std::string get_diagnose_string();
+        struct diag_field_t {
+            uint32_t hash;          // of what it was in the last report
+            uint32_t seq;           // of the report it changed in
+        };
+        static const int DIAG_FIELDS = 15;
 
         // These modules are available to all other modules
         SerialConsole*    serial;
@@ -242,7 +271,10 @@ class Kernel {
         std::string       current_path;
         uint32_t          base_stepping_frequency;
 
-        uint8_t get_state();
+        // what the machine is doing, one of STATE, kept up to date as the flags it comes from change rather
+        // than worked out each time, a change is sent out as ON_STATE_CHANGE with the previous state from the main loop
+        uint8_t get_state() const { return state; }
+        void refresh_state();
         uint8_t halt_reason;
         uint8_t atc_state;
         EEPROM_data *eeprom_data;
@@ -252,7 +284,6 @@ class Kernel {
         uint32_t Spindle_period_us;
         uint16_t probe_addr;
         bool checkled;
-        bool spindleon;
         float local_vars[20];
         float probe_outputs[6];
         float probe_tip_diameter = 1.6;
@@ -261,7 +292,46 @@ class Kernel {
     private:
         // When a module asks to be called for a specific event ( a hook ), this is where that request is remembered
         mbed::I2C* i2c;
-        std::array<std::vector<Module*>, NUMBER_OF_DEFINED_EVENTS> hooks;
+        // modules whose handler for the event is the empty one in Module are left out
+        struct hook_t {
+            Module *module;
+            EventHandler fnc;
+        };
+        std::array<std::vector<hook_t>, NUMBER_OF_DEFINED_EVENTS> hooks;
+        // after freeze_hooks() every event's hooks one after the other, event e from frozen_start[e] to frozen_start[e + 1]
+        hook_t *frozen_hooks;
+        std::array<uint16_t, NUMBER_OF_DEFINED_EVENTS + 1> frozen_start;
+        void thaw_hooks();
+        hook_t *hooks_begin(_EVENT_ENUM e) const { return frozen_hooks != nullptr ? &frozen_hooks[frozen_start[e]] : const_cast<hook_t *>(hooks[e].data()); }
+        size_t hooks_count(_EVENT_ENUM e) const { return frozen_hooks != nullptr ? frozen_start[e + 1] - frozen_start[e] : hooks[e].size(); }
+        // the module that took the public data requests for each first checksum, for get and for set,
+        // owner is nullptr once more than one module has taken requests for it
+        struct public_data_owner_t {
+            uint16_t checksum;
+            Module *owner;
+        };
+        static const uint8_t k_public_data_owners = 32;
+        std::array<std::array<public_data_owner_t, k_public_data_owners>, 2> public_data_owners;
+        std::array<uint8_t, 2> n_public_data_owners;
+        // ON_MAIN_LOOP and ON_IDLE handlers that do not run every time round the loop
+        struct schedule_t {
+            Module *module;
+            uint32_t last_us;
+            uint32_t period_us;
+            bool background;
+        };
+        std::array<std::vector<schedule_t>, 2> schedules;
+        bool is_due(schedule_t &s, uint32_t now, bool feed_low);
+        uint32_t background_max_us;
+        uint16_t background_queue_min;
+        // indexed the same as hooks, only allocated while profiling
+        struct event_stats_t {
+            Module *module;
+            uint32_t count;
+            uint32_t max;
+            uint64_t total;
+        };
+        std::array<std::vector<event_stats_t>, NUMBER_OF_DEFINED_EVENTS> event_stats;
         uint32_t stop_request_time;
         struct {
             bool use_leds:1;
@@ -290,8 +360,30 @@ class Kernel {
             bool disable_serial_console:1;
             bool halt_on_error_debug:1;
             bool flex_compensation_active:1;
+            bool event_profiling:1;
+            bool eeprom_pending:1;
+            bool homing:1;
+            bool spindleon:1;
         };
+        volatile uint8_t state;
+        uint8_t notified_state;
         int iic_page_write(unsigned char u8PageNum, unsigned char u8len, unsigned char *pu8Array);
+        int dirty_eeprom_page() const;
+        int write_eeprom_page(int pagenum);
+        void flush_eeprom_page();
+        // what the eeprom holds, so only the pages of eeprom_data that changed are written
+        EEPROM_data *eeprom_written;
+        uint32_t eeprom_last_write_us;
+
+        // what the last status report sent of the fields that are only sent when they change
+        float query_last_r;
+        uint32_t query_last_machine_state;
+        uint8_t query_last_wcs;
+        uint8_t query_static_count;
+
+        // the diagnose fields as they were last time, and the seq of the last report that changed any
+        diag_field_t diag_fields[DIAG_FIELDS];
+        uint32_t diag_seq;
 
 };
 
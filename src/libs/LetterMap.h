@@ -0,0 +1,96 @@
+#ifndef _LETTERMAP_H_
+#define _LETTERMAP_H_
+
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * A value for each of the letters A-Z and a mask of which are set, in place of a std::map<char, T> for gcode
+ * arguments. Nothing is allocated, and it is used the way the map was: m['R']= 1, find(), erase() and iterating
+ * in letter order over .first and .second.
+ */
+template<typename T>
+class LetterMap {
+    public:
+        struct entry_t {
+            char first;
+            T second;
+        };
+
+        class iterator {
+            public:
+                iterator(LetterMap *owner, int i) : owner(owner), i(i) {}
+                entry_t& operator*() const { return owner->slots[i]; }
+                entry_t* operator->() const { return &owner->slots[i]; }
+                iterator& operator++() { i = owner->next(i + 1); return *this; }
+                bool operator==(const iterator &o) const { return i == o.i; }
+                bool operator!=(const iterator &o) const { return i != o.i; }
+
+            private:
+                LetterMap *owner;
+                int i;
+        };
+
+        class const_iterator {
+            public:
+                const_iterator() : owner(nullptr), i(26) {}
+                const_iterator(const LetterMap *owner, int i) : owner(owner), i(i) {}
+                const entry_t& operator*() const { return owner->slots[i]; }
+                const entry_t* operator->() const { return &owner->slots[i]; }
+                const_iterator& operator++() { i = owner->next(i + 1); return *this; }
+                bool operator==(const const_iterator &o) const { return i == o.i; }
+                bool operator!=(const const_iterator &o) const { return i != o.i; }
+
+            private:
+                const LetterMap *owner;
+                int i;
+        };
+
+        LetterMap() : mask(0)
+        {
+            for (int i = 0; i < 27; ++i) {
+                slots[i].first = i < 26 ? 'A' + i : 0;
+                slots[i].second = T();
+            }
+        }
+
+        // anything other than A-Z goes in the slot past Z, which is never set
+        T& operator[](char c)
+        {
+            int i = index(c);
+            if(i < 26 && !(mask & (1UL << i))) {
+                mask |= (1UL << i);
+                slots[i].second = T();
+            }
+            return slots[i].second;
+        }
+
+        iterator find(char c) { int i = index(c); return iterator(this, has(i) ? i : 26); }
+        const_iterator find(char c) const { int i = index(c); return const_iterator(this, has(i) ? i : 26); }
+        size_t count(char c) const { return has(index(c)) ? 1 : 0; }
+        size_t erase(char c) { size_t n = count(c); if(n) mask &= ~(1UL << index(c)); return n; }
+
+        size_t size() const { return __builtin_popcount(mask); }
+        bool empty() const { return mask == 0; }
+        void clear() { mask = 0; }
+        uint32_t letters() const { return mask; }
+
+        iterator begin() { return iterator(this, next(0)); }
+        iterator end() { return iterator(this, 26); }
+        const_iterator begin() const { return const_iterator(this, next(0)); }
+        const_iterator end() const { return const_iterator(this, 26); }
+
+    private:
+        static int index(char c) { return (c >= 'A' && c <= 'Z') ? c - 'A' : 26; }
+        bool has(int i) const { return i < 26 && (mask & (1UL << i)); }
+        int next(int i) const
+        {
+            uint32_t rest = i < 26 ? mask >> i : 0;
+            return rest == 0 ? 26 : i + __builtin_ctz(rest);
+        }
+
+        entry_t slots[27];
+        uint32_t mask;
+};
+
+#endif
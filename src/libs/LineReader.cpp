@@ -0,0 +1,341 @@
+#include "LineReader.h"
+
+#include "platform_memory.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+LineReader::LineReader()
+{
+    fp = nullptr;
+    buffer = nullptr;
+    in_ahb = false;
+    cur = 0;
+    pos = 0;
+    next_offset = 0;
+    file_eof = false;
+    at_eof = false;
+    halves[0] = halves[1] = {0, 0, false};
+    lz_buf = nullptr;
+    lz_in_ahb = false;
+    lz_pos = 0;
+    lz_end = 0;
+    lz_sum = 0;
+    lz = false;
+    lz_bad = false;
+}
+
+LineReader::~LineReader()
+{
+    detach();
+}
+
+bool LineReader::allocate()
+{
+    if(buffer != nullptr) return true;
+
+    // prefer AHB as main memory is scarce, fall back to the heap
+    buffer = (char *)AHB.alloc(CHUNK_SIZE * 2);
+    in_ahb = (buffer != nullptr);
+    if(buffer == nullptr) {
+        buffer = (char *)malloc(CHUNK_SIZE * 2);
+    }
+
+    return buffer != nullptr;
+}
+
+void LineReader::attach(FILE *f, bool read_ahead)
+{
+    fp = f;
+    lz = false;
+    lz_bad = false;
+    if(fp == nullptr) return;
+
+    // if we can not get a buffer we just use fgets() directly
+    if(read_ahead && allocate()) {
+        // the chunks are whole sectors at sector offsets, unbuffered they go from f_read() straight into
+        // the halves as multi sector reads instead of through the stdio buffer a piece at a time
+        setvbuf(fp, NULL, _IONBF, 0);
+    }
+
+    if(detect_lz()) {
+        lz = true;
+        // compressed files can only be read through the buffers
+        if(buffer == nullptr) {
+            lz_bad = true;
+            return;
+        }
+        lz_buf = (char *)AHB.alloc(LZ_BLOCK_MAX);
+        lz_in_ahb = (lz_buf != nullptr);
+        if(lz_buf == nullptr) {
+            lz_buf = (char *)malloc(LZ_BLOCK_MAX);
+        }
+        if(lz_buf == nullptr) {
+            lz_bad = true;
+            return;
+        }
+        seek(0);
+        return;
+    }
+
+    seek(ftell(fp));
+}
+
+// a compressed file starts with the length of the first block, text never starts with a nul
+bool LineReader::detect_lz()
+{
+    long start = ftell(fp);
+    uint8_t hdr[BLOCK_HEADER_SIZE];
+    size_t n = fread(hdr, 1, sizeof(hdr), fp);
+    bool is_lz = false;
+    if(n == sizeof(hdr) && hdr[0] == 0 && hdr[1] == 0) {
+        uint32_t len = (hdr[2] << 8) | hdr[3];
+        is_lz = len > 0 && len <= LZ_BLOCK_MAX;
+    }
+
+    if(is_lz && fseek(fp, 0, SEEK_END) == 0) {
+        lz_end = ftell(fp) - 2;
+    }
+    fseek(fp, start, SEEK_SET);
+    return is_lz;
+}
+
+void LineReader::detach()
+{
+    fp = nullptr;
+    halves[0].valid = halves[1].valid = false;
+    at_eof = false;
+
+    if(buffer != nullptr) {
+        if(in_ahb) AHB.dealloc(buffer);
+        else free(buffer);
+        buffer = nullptr;
+    }
+    if(lz_buf != nullptr) {
+        if(lz_in_ahb) AHB.dealloc(lz_buf);
+        else free(lz_buf);
+        lz_buf = nullptr;
+    }
+}
+
+bool LineReader::seek(long offset)
+{
+    if(fp == nullptr) return false;
+
+    at_eof = false;
+    if(buffer != nullptr) {
+        // a loop jumping back a few lines is usually still in the buffer, as is a jump into the half read ahead
+        for (int i = 0; i < 2; i++) {
+            int h = cur ^ i;
+            if(halves[h].valid && offset >= halves[h].offset && offset <= halves[h].offset + (long)halves[h].len) {
+                if(h != cur) {
+                    halves[cur].valid = false;
+                    cur = h;
+                }
+                pos = offset - halves[h].offset;
+                return true;
+            }
+        }
+    }
+
+    if(lz) {
+        // blocks can only be decompressed in order, so start again and decompress up to the offset
+        if(lz_bad || fseek(fp, 0, SEEK_SET) != 0) return false;
+        halves[0].valid = halves[1].valid = false;
+        lz_pos = 0;
+        lz_sum = 0;
+        next_offset = 0;
+        file_eof = false;
+        cur = 0;
+        while(fill(cur) && !file_eof && offset >= halves[cur].offset + (long)halves[cur].len) ;
+        pos = offset - halves[cur].offset;
+        if(pos > halves[cur].len) pos = halves[cur].len;
+        return true;
+    }
+
+    if(buffer == nullptr) {
+        return fseek(fp, offset, SEEK_SET) == 0;
+    }
+
+    // keep the reads sector aligned, skip up to the requested offset in the buffer
+    long aligned = offset & ~(long)(SECTOR_SIZE - 1);
+    if(fseek(fp, aligned, SEEK_SET) != 0) return false;
+
+    halves[0].valid = halves[1].valid = false;
+    next_offset = aligned;
+    file_eof = false;
+    cur = 0;
+    fill(cur);
+    pos = offset - aligned;
+    return true;
+}
+
+long LineReader::tell() const
+{
+    if(fp == nullptr) return 0;
+    if(buffer == nullptr) return ftell(fp);
+    return halves[cur].offset + pos;
+}
+
+long LineReader::source_tell() const
+{
+    return lz ? lz_pos : tell();
+}
+
+bool LineReader::fill(int h)
+{
+    size_t n;
+    if(lz) {
+        // blocks do not have to decompress to a full chunk, the end is where the blocks run out
+        n = read_block(buffer + (h * CHUNK_SIZE));
+        if(n == 0) file_eof = true;
+    } else {
+        n = fread(buffer + (h * CHUNK_SIZE), 1, CHUNK_SIZE, fp);
+        if(n < CHUNK_SIZE) file_eof = true;
+    }
+    halves[h].offset = next_offset;
+    halves[h].len = n;
+    halves[h].valid = true;
+    next_offset += n;
+
+    return n > 0;
+}
+
+// decompress the next block into dst, returns its length or 0 at the end of the blocks or on an error
+size_t LineReader::read_block(char *dst)
+{
+    if(lz_bad) return 0;
+
+    if(lz_pos + (long)BLOCK_HEADER_SIZE > lz_end) {
+        // check the sum of all the decompressed data
+        uint8_t sum[2];
+        if(fread(sum, 1, sizeof(sum), fp) != sizeof(sum) || lz_sum != ((sum[0] << 8) | sum[1])) {
+            lz_bad = true;
+        }
+        return 0;
+    }
+
+    uint8_t hdr[BLOCK_HEADER_SIZE];
+    if(fread(hdr, 1, sizeof(hdr), fp) != sizeof(hdr)) {
+        lz_bad = true;
+        return 0;
+    }
+    uint32_t len = (hdr[0] << 24) | (hdr[1] << 16) | (hdr[2] << 8) | hdr[3];
+    if(len == 0 || len > LZ_BLOCK_MAX || fread(lz_buf, 1, len, fp) != len ||
+       qlz_size_compressed(lz_buf) != len || qlz_size_decompressed(lz_buf) > CHUNK_SIZE) {
+        lz_bad = true;
+        return 0;
+    }
+
+    size_t n = qlz_decompress(lz_buf, dst, &lz_state);
+    if(n == 0) {
+        lz_bad = true;
+        return 0;
+    }
+
+    lz_pos += BLOCK_HEADER_SIZE + len;
+    for (size_t i = 0; i < n; i++) {
+        lz_sum += (uint8_t)dst[i];
+    }
+
+    return n;
+}
+
+bool LineReader::next_half()
+{
+    int other = cur ^ 1;
+    if(!halves[other].valid) {
+        if(file_eof || !fill(other)) return false;
+    }
+
+    halves[cur].valid = false;
+    cur = other;
+    pos = 0;
+    return true;
+}
+
+bool LineReader::needs_prefetch() const
+{
+    return buffer != nullptr && fp != nullptr && !file_eof && !halves[cur ^ 1].valid;
+}
+
+bool LineReader::prefetch()
+{
+    if(!needs_prefetch()) return false;
+    return fill(cur ^ 1);
+}
+
+char *LineReader::gets(char *s, int size)
+{
+    if(fp == nullptr || size <= 0) return nullptr;
+    if(lz && buffer == nullptr) {
+        at_eof = true;
+        return nullptr;
+    }
+
+    if(buffer == nullptr) {
+        char *r = fgets(s, size, fp);
+        at_eof = feof(fp);
+        return r;
+    }
+
+    int n = 0;
+    while(n < size - 1) {
+        if(!halves[cur].valid || pos >= halves[cur].len) {
+            if(!next_half()) {
+                at_eof = true;
+                break;
+            }
+            continue;
+        }
+
+        // copy up to and including the next newline from the current half
+        const char *p = buffer + (cur * CHUNK_SIZE) + pos;
+        size_t avail = halves[cur].len - pos;
+        if(avail > (size_t)(size - 1 - n)) avail = size - 1 - n;
+        const char *nl = (const char *)memchr(p, '\n', avail);
+        size_t cnt = (nl != nullptr) ? (nl - p) + 1 : avail;
+        memcpy(s + n, p, cnt);
+        n += cnt;
+        pos += cnt;
+        if(nl != nullptr) break;
+    }
+
+    s[n] = '\0';
+    return n > 0 ? s : nullptr;
+}
+
+size_t LineReader::read(void *dst, size_t n)
+{
+    if(fp == nullptr) return 0;
+    if(lz && buffer == nullptr) {
+        at_eof = true;
+        return 0;
+    }
+
+    if(buffer == nullptr) {
+        size_t r = fread(dst, 1, n, fp);
+        at_eof = feof(fp);
+        return r;
+    }
+
+    char *d = (char *)dst;
+    size_t got = 0;
+    while(got < n) {
+        if(!halves[cur].valid || pos >= halves[cur].len) {
+            if(!next_half()) {
+                at_eof = true;
+                break;
+            }
+            continue;
+        }
+
+        size_t cnt = halves[cur].len - pos;
+        if(cnt > n - got) cnt = n - got;
+        memcpy(d + got, buffer + (cur * CHUNK_SIZE) + pos, cnt);
+        got += cnt;
+        pos += cnt;
+    }
+
+    return got;
+}
@@ -0,0 +1,99 @@
+#ifndef _LINEREADER_H_
+#define _LINEREADER_H_
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "quicklz.h"
+
+/*
+ * Double buffered read ahead for playing files off the SD card.
+ *
+ * The file is read in large sector aligned chunks into two halves of a buffer
+ * and lines are parsed directly out of it, rather than going through newlib stdio
+ * for every line. While one half is being consumed the other can be filled
+ * by calling prefetch(), typically from on_idle while the planner queue is full,
+ * so the SD latency is hidden behind motion that is already queued.
+ *
+ * If the buffer cannot be allocated it falls back to plain fgets() on the FILE.
+ *
+ * Files uploaded quicklz compressed (a 4 byte big endian block length then the block,
+ * repeated, then a 16 bit sum of the data) are recognised on attach and decompressed a
+ * block at a time into the halves, offsets are then those of the decompressed data.
+ */
+class LineReader {
+    public:
+        LineReader();
+        ~LineReader();
+
+        // attach to an open file, starting at the current file position, the file is made unbuffered
+        // when the read ahead buffer can be allocated. Without read_ahead it is read through stdio,
+        // which can not read a compressed file
+        void attach(FILE *fp, bool read_ahead = true);
+        void detach();
+        bool is_attached() const { return fp != nullptr; }
+
+        // same semantics as fgets(), returns NULL at end of file
+        char *gets(char *s, int size);
+        // same semantics as fread() of n single bytes, returns the number of bytes copied
+        size_t read(void *dst, size_t n);
+        // true when the last gets() or read() hit end of file
+        bool eof() const { return at_eof; }
+
+        // seek to an absolute offset in the file, anything not already in the buffer is read again
+        bool seek(long offset);
+        // the file offset of the next byte gets() will return
+        long tell() const;
+
+        // fill the idle half if the current half is being consumed, returns true if it read from the file
+        bool prefetch();
+        bool needs_prefetch() const;
+
+        // true if the file is quicklz compressed
+        bool compressed() const { return lz; }
+        // a compressed file failed to decompress or its checksum did not match
+        bool corrupt() const { return lz_bad; }
+        // how far into the file itself we have read, for progress on compressed files
+        long source_tell() const;
+
+    private:
+        static const size_t SECTOR_SIZE = 512;
+        static const size_t CHUNK_SIZE = 4096;
+
+        struct half_t {
+            long offset;        // file offset of buf[0]
+            size_t len;         // number of valid bytes
+            bool valid;
+        };
+
+        static const size_t LZ_BLOCK_MAX = COMPRESS_BUFFER_SIZE + BUFFER_PADDING;
+
+        bool allocate();
+        bool fill(int h);
+        bool next_half();
+        bool detect_lz();
+        size_t read_block(char *dst);
+
+        FILE *fp;
+        char *buffer;
+        bool in_ahb;
+        half_t halves[2];
+        int cur;                // half we are reading from
+        size_t pos;             // read position in the current half
+        long next_offset;       // file offset of the next chunk to read
+        bool file_eof;          // no more data in the file after next_offset
+        bool at_eof;
+
+        // quicklz decompression
+        char *lz_buf;           // one compressed block
+        bool lz_in_ahb;
+        long lz_pos;            // file offset of the next compressed block
+        long lz_end;            // file offset of the trailing sum
+        uint16_t lz_sum;
+        qlz_state_decompress lz_state;
+        bool lz;
+        bool lz_bad;
+};
+
+#endif
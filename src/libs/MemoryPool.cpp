@@ -137,6 +137,7 @@ MemoryPool::MemoryPool(void *base, uint16_t size)
 {
     this->base = base;
     this->size = size;
+    this->alloc_count = 0;
 
     // Basic sanity check on pool size
     if (size < sizeof(_poolregion) * 2) { // Need space for at least one header and minimal data
@@ -252,6 +253,7 @@ void *MemoryPool::alloc(size_t nbytes)
             memcpy(p, &p_final_header, sizeof(uint32_t));
 
             void *__alloc_ret_ptr = &p->data; // preserve pointer for asm & return
+            alloc_count++;
 
             // Fill the payload based on the ACTUAL size written in the final header
             size_t fill_size = (p_final_header & 0x7FFFFFFF) - sizeof(_poolregion);
@@ -259,6 +261,7 @@ void *MemoryPool::alloc(size_t nbytes)
 
             // Instructions to allow GDB to capture memory allocation
             // Added "memory" clobber to prevent compiler reordering around asm
+#ifdef __arm__
             asm volatile("mov  r1,%0\n"
                          "mov  r0,%1\n"
                          ".global memorypool_alloc_return_point\n"
@@ -266,6 +269,7 @@ void *MemoryPool::alloc(size_t nbytes)
                          :
                          : "r"(nbytes), "r"(__alloc_ret_ptr)
                          : "r0", "r1", "memory");
+#endif
 
             // then return the data region for the block
             return __alloc_ret_ptr;
@@ -339,6 +343,7 @@ void MemoryPool::dealloc(void *d)
     size_t payload_size = p_block_size - sizeof(_poolregion);
 
     // Instructions to allow GDB to capture memory deallocation
+#ifdef __arm__
     asm volatile("mov  r0,%0\n"
                  "mov  r1,%1\n"
                  ".global memorypool_free_hook\n"
@@ -347,6 +352,7 @@ void MemoryPool::dealloc(void *d)
                  : "r"(d),
                    "r"(payload_size) // Use calculated payload size
                  : "r0", "r1");
+#endif
 
     // Fill the payload with the free pattern *before* marking as free and coalescing
     pool_fill(&p->data, POOL_FREE_PATTERN, payload_size);
@@ -536,9 +542,10 @@ bool MemoryPool::has(void *p)
 }
 
 // Calculates total free space by walking the list
-uint32_t MemoryPool::free()
+uint32_t MemoryPool::free(uint32_t *largest)
 {
     uint32_t free_bytes = 0;
+    if (largest != nullptr) *largest = 0;
     _poolregion *p = (_poolregion *)base;
     uint32_t current_offset = 0;
 
@@ -579,6 +586,7 @@ uint32_t MemoryPool::free()
 
         if (p_is_used == 0) {
             free_bytes += p_block_size; // Add the size of the free block
+            if (largest != nullptr && p_block_size - sizeof(_poolregion) > *largest) *largest = p_block_size - sizeof(_poolregion);
         }
 
         current_offset += p_block_size;
@@ -26,7 +26,10 @@ public:
 
     bool  has(void*);
 
-    uint32_t free(void);
+    // total free bytes, and the biggest single free block if largest is given
+    uint32_t free(uint32_t *largest = nullptr);
+    // number of successful allocs since boot
+    uint32_t get_alloc_count() const { return alloc_count; }
 
     // Getters for internal state (used by debug validation)
     void* getBase() const { return base; }
@@ -42,6 +45,7 @@ public:
 private:
     void* base;
     uint16_t size;
+    uint32_t alloc_count;
 
     #if POOL_DEBUG_ENABLED == 1
     // Friend function for validation (defined in cpp)
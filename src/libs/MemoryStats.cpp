@@ -0,0 +1,185 @@
+#include "MemoryStats.h"
+
+#include "platform_memory.h"
+#include "StreamOutput.h"
+#include "LPC17xx.h"
+
+extern unsigned int g_maximumHeapAddress;
+extern "C" uint32_t  __end__;
+extern "C" uint32_t  __StackTop;
+extern "C" uint32_t  __malloc_free_list;
+extern "C" uint32_t  _sbrk(int size);
+extern "C" volatile uint32_t g_heap_alloc_count;
+
+namespace MemoryStats {
+
+namespace {
+    // what fillUnusedRAM() in mbed_custom.cpp paints with
+    const uint32_t STACK_PAINT = 0xDEADBEEF;
+    // left alone under the stack pointer when repainting, for the frames of the repaint itself
+    const uint32_t REPAINT_MARGIN = 64;
+
+    struct peaks_t {
+        uint32_t samples;
+        uint32_t heap_used_max;
+        uint32_t heap_largest_min;
+        uint32_t ahb_free_min;
+        uint32_t ahb_largest_min;
+        uint32_t heap_rate_max;     // allocs in a second
+        uint32_t ahb_rate_max;
+        uint32_t heap_allocs;       // counts at the last sample
+        uint32_t ahb_allocs;
+        uint32_t heap_rate;         // in the last second
+        uint32_t ahb_rate;
+    };
+    peaks_t peaks;
+}
+
+// Adam Greens heap walk from http://mbed.org/forum/mbed/topic/2701/?page=4#comment-22556
+void heap_walk(heap_t &h, StreamOutput *verbose)
+{
+    uint32_t chunkNumber = 1;
+    // The __end__ linker symbol points to the beginning of the heap.
+    uint32_t chunkCurr = (uint32_t)&__end__;
+    // __malloc_free_list is the head pointer to newlib-nano's link list of free chunks.
+    uint32_t freeCurr = __malloc_free_list;
+    // Calling _sbrk() with 0 reserves no more memory but it returns the current top of heap.
+    uint32_t heapEnd = _sbrk(0);
+
+    h.used = 0;
+    h.free = 0;
+    h.largest_free = 0;
+    h.top_free = (g_maximumHeapAddress != 0 && g_maximumHeapAddress > heapEnd) ? g_maximumHeapAddress - heapEnd : 0;
+
+    // Walk through the chunks until we hit the end of the heap.
+    while (chunkCurr < heapEnd) {
+        // Assume the chunk is in use.  Will update later.
+        int      isChunkFree = 0;
+        // The first 32-bit word in a chunk is the size of the allocation.  newlib-nano over allocates by 8 bytes.
+        // 4 bytes for this 32-bit chunk size and another 4 bytes to allow for 8 byte-alignment of returned pointer.
+        uint32_t chunkSize = *(uint32_t *)chunkCurr;
+        // The start of the next chunk is right after the end of this one.
+        uint32_t chunkNext = chunkCurr + chunkSize;
+
+        // The free list is sorted by address.
+        // Check to see if we have found the next free chunk in the heap.
+        if (chunkCurr == freeCurr) {
+            // Chunk is free so flag it as such.
+            isChunkFree = 1;
+            // The second 32-bit word in a free chunk is a pointer to the next free chunk (again sorted by address).
+            freeCurr = *(uint32_t *)(freeCurr + 4);
+        }
+
+        // Skip past the 32-bit size field in the chunk header.
+        chunkCurr += 4;
+        // 8-byte align the data pointer.
+        chunkCurr = (chunkCurr + 7) & ~7;
+        // newlib-nano over allocates by 8 bytes, 4 bytes for the 32-bit chunk size and another 4 bytes to allow for 8
+        // byte-alignment of the returned pointer.
+        chunkSize -= 8;
+        if (verbose)
+            verbose->printf("  Chunk: %lu  Address: 0x%08lX  Size: %lu  %s\n", chunkNumber, chunkCurr, chunkSize, isChunkFree ? "CHUNK FREE" : "");
+
+        if (isChunkFree) {
+            h.free += chunkSize;
+            if (chunkSize > h.largest_free) h.largest_free = chunkSize;
+        } else {
+            h.used += chunkSize;
+        }
+
+        chunkCurr = chunkNext;
+        chunkNumber++;
+    }
+
+    if (h.top_free > h.largest_free) h.largest_free = h.top_free;
+}
+
+// the guard the MPU keeps above the heap is 32 bytes, without a stack limit there is only the heap top
+static uint32_t *stack_bottom()
+{
+    uint32_t bottom = g_maximumHeapAddress != 0 ? g_maximumHeapAddress + 32 : _sbrk(0);
+    return (uint32_t *)((bottom + 3) & ~3);
+}
+
+void stack_usage(stack_t &s)
+{
+    uint32_t top = (uint32_t)&__StackTop;
+    uint32_t *bottom = stack_bottom();
+    uint32_t sp = __get_MSP();
+    uint32_t *p = bottom;
+
+    while ((uint32_t)p < sp && *p == STACK_PAINT) p++;
+    s.size = top - (uint32_t)bottom;
+    s.used = top - sp;
+    s.high_water = top - (uint32_t)p;
+}
+
+// an ISR coming in while painting only writes what is under us and is gone by the time it is painted
+void stack_repaint()
+{
+    uint32_t sp = __get_MSP() - REPAINT_MARGIN;
+    for (volatile uint32_t *p = stack_bottom(); (uint32_t)p < sp; p++) *p = STACK_PAINT;
+}
+
+void start()
+{
+    peaks.samples = 0;
+    peaks.heap_used_max = 0;
+    peaks.heap_largest_min = UINT32_MAX;
+    peaks.ahb_free_min = UINT32_MAX;
+    peaks.ahb_largest_min = UINT32_MAX;
+    peaks.heap_rate_max = 0;
+    peaks.ahb_rate_max = 0;
+    peaks.heap_rate = 0;
+    peaks.ahb_rate = 0;
+    peaks.heap_allocs = g_heap_alloc_count;
+    peaks.ahb_allocs = AHB.get_alloc_count();
+    stack_repaint();
+}
+
+void sample()
+{
+    heap_t h;
+    heap_walk(h);
+    uint32_t ahb_largest;
+    uint32_t ahb_free = AHB.free(&ahb_largest);
+
+    if (h.used > peaks.heap_used_max) peaks.heap_used_max = h.used;
+    if (h.largest_free < peaks.heap_largest_min) peaks.heap_largest_min = h.largest_free;
+    if (ahb_free < peaks.ahb_free_min) peaks.ahb_free_min = ahb_free;
+    if (ahb_largest < peaks.ahb_largest_min) peaks.ahb_largest_min = ahb_largest;
+
+    uint32_t heap_allocs = g_heap_alloc_count;
+    uint32_t ahb_allocs = AHB.get_alloc_count();
+    peaks.heap_rate = heap_allocs - peaks.heap_allocs;
+    peaks.ahb_rate = ahb_allocs - peaks.ahb_allocs;
+    peaks.heap_allocs = heap_allocs;
+    peaks.ahb_allocs = ahb_allocs;
+    if (peaks.heap_rate > peaks.heap_rate_max) peaks.heap_rate_max = peaks.heap_rate;
+    if (peaks.ahb_rate > peaks.ahb_rate_max) peaks.ahb_rate_max = peaks.ahb_rate;
+
+    peaks.samples++;
+}
+
+uint32_t peak_heap_used()
+{
+    return peaks.heap_used_max;
+}
+
+void print_peaks(StreamOutput *stream, const char *prefix)
+{
+    if (peaks.samples == 0) {
+        stream->printf("%sNo job memory samples\n", prefix);
+        return;
+    }
+
+    stream->printf("%sJob memory over %lu s: heap used max %lu, heap largest free min %lu, AHB free min %lu, AHB largest free min %lu\n",
+                   prefix, peaks.samples, peaks.heap_used_max, peaks.heap_largest_min, peaks.ahb_free_min, peaks.ahb_largest_min);
+    stream->printf("%sAllocs/s: heap %lu (max %lu), AHB %lu (max %lu)\n",
+                   prefix, peaks.heap_rate, peaks.heap_rate_max, peaks.ahb_rate, peaks.ahb_rate_max);
+    stack_t s;
+    stack_usage(s);
+    stream->printf("%sStack high water %lu of %lu\n", prefix, s.high_water, s.size);
+}
+
+}
@@ -0,0 +1,51 @@
+#ifndef _MEMORYSTATS_H
+#define _MEMORYSTATS_H
+
+#include <cstdint>
+
+class StreamOutput;
+
+/*
+ * Free memory and fragmentation of the newlib heap and the AHB pool, and the worst of them seen
+ * while playing a job. The player samples once a second from start() until it finishes, mem shows
+ * the current values and the worst ones, and they are printed when the job ends.
+ *
+ * The stack is measured by the paint _start puts on the unused RAM at boot: the deepest it has been is
+ * where the first word from the bottom that is not the paint any more is. The ISRs run on the same stack
+ * as the main loop, there is no process stack, so that includes the deepest nesting of them too. A
+ * buffer on the stack that was never written leaves its paint, so it is a little under, not over.
+ */
+namespace MemoryStats {
+    struct heap_t {
+        uint32_t used;              // in allocated chunks
+        uint32_t free;              // in free chunks below the top of the heap
+        uint32_t largest_free;      // biggest of those, or the space above the top if that is bigger
+        uint32_t top_free;          // not yet taken from sbrk, up to the stack limit
+    };
+
+    struct stack_t {
+        uint32_t size;              // from the top of RAM down to the guard above the heap
+        uint32_t used;              // by the call chain asking
+        uint32_t high_water;        // the deepest since boot or the last repaint
+    };
+
+    // walks the heap chunks, listing each one to verbose if given
+    void heap_walk(heap_t &h, StreamOutput *verbose = nullptr);
+
+    void stack_usage(stack_t &s);
+    // paints the stack below the caller again, so the high water is from here on
+    void stack_repaint();
+
+    // clears the worst values at the start of a job, the stack high water too
+    void start();
+    // once a second while playing
+    void sample();
+
+    // the most the heap had allocated since start()
+    uint32_t peak_heap_used();
+
+    // the worst values since start(), and the allocation rates, each line starting with prefix
+    void print_peaks(StreamOutput *stream, const char *prefix = "");
+}
+
+#endif /* _MEMORYSTATS_H */
@@ -22,13 +22,26 @@ const ModuleCallback kernel_callback_functions[NUMBER_OF_DEFINED_EVENTS] = {
     &Module::on_get_public_data,
     &Module::on_set_public_data,
     &Module::on_halt,
-    &Module::on_enable
-
+    &Module::on_enable,
+    &Module::on_state_change
 };
 
+// g++ turns a bound pointer to member function into the address of the function it resolves to for that object
+#pragma GCC diagnostic ignored "-Wpmf-conversions"
+
+EventHandler event_handler(Module *module, _EVENT_ENUM event_id)
+{
+    static Module base;
+    EventHandler fnc = (EventHandler)(module->*kernel_callback_functions[event_id]);
+    return fnc == (EventHandler)(base.*kernel_callback_functions[event_id]) ? nullptr : fnc;
+}
 
 void Module::register_for_event(_EVENT_ENUM event_id){
     // Events are the basic building blocks of Smoothie. They register for events, and then do stuff when those events are called.
     // You add things to Smoothie by making a new class that inherits the Module class. See http://smoothieware.org/moduleexample for a crude introduction
     THEKERNEL->register_for_event(event_id, this);
 }
+
+void Module::schedule_event(_EVENT_ENUM event_id, uint16_t period_ms, bool background){
+    THEKERNEL->set_event_schedule(event_id, this, period_ms, background);
+}
@@ -8,6 +8,8 @@
 #ifndef MODULE_H
 #define MODULE_H
 
+#include <stdint.h>
+
 // See : http://smoothieware.org/listofevents
 // When adding a new event the virtual method needs to be defined in class Module and the method pointer need to be defined in
 // Module.cpp:16 in the same order
@@ -21,6 +23,7 @@ enum _EVENT_ENUM {
     ON_SET_PUBLIC_DATA,
     ON_HALT,
     ON_ENABLE,
+    ON_STATE_CHANGE,
     NUMBER_OF_DEFINED_EVENTS
 };
 
@@ -28,6 +31,11 @@ class Module;
 typedef void (Module::*ModuleCallback)(void *argument);
 extern const ModuleCallback kernel_callback_functions[NUMBER_OF_DEFINED_EVENTS];
 
+// a module's handler for an event as the plain function its virtual resolves to, so calling it needs no vtable lookup
+typedef void (*EventHandler)(Module *module, void *argument);
+// nullptr if the module leaves it as the empty one in Module, it need not be called at all
+EventHandler event_handler(Module *module, _EVENT_ENUM event_id);
+
 // Module base class
 // All modules must extend this class, see http://smoothieware.org/moduleexample
 class Module
@@ -38,6 +46,9 @@ public:
     virtual void on_module_loaded() {};
 
     void register_for_event(_EVENT_ENUM event_id);
+    // only call this module's ON_MAIN_LOOP or ON_IDLE handler every period_ms, and if background
+    // hold it back while the planner queue is running low so the feed gets the time
+    void schedule_event(_EVENT_ENUM event_id, uint16_t period_ms, bool background= false);
 
     // event callbacks, not every module will implement all of these
     // there should be one for each _EVENT_ENUM
@@ -50,6 +61,7 @@ public:
     virtual void on_set_public_data(void *) {};
     virtual void on_halt(void *) {};
     virtual void on_enable(void *) {};
+    virtual void on_state_change(void *) {};
 
 };
 
@@ -0,0 +1,158 @@
+#include "PcSampler.h"
+
+#include "platform_memory.h"
+#include "StreamOutput.h"
+#include "IrqPriority.h"
+#include "LPC17xx.h"
+
+#include <algorithm>
+#include <cstring>
+
+// 4k of AHB, the slot is many more than the few hundred functions one job goes through
+#define PC_SAMPLER_SLOTS_LOG2 9
+#define PC_SAMPLER_SLOTS (1 << PC_SAMPLER_SLOTS_LOG2)
+#define PC_SAMPLER_PROBES 8
+// as many as are printed, the rest are summed
+#define PC_SAMPLER_TOP 40
+
+namespace PcSampler {
+
+namespace {
+    struct slot_t {
+        uint32_t pc;        // 16 byte aligned, 0 for a free slot
+        uint32_t count;
+    };
+
+    slot_t *slots = nullptr;
+    volatile uint32_t total = 0;
+    volatile uint32_t missed = 0;   // in no slot, the table around their hash was full
+
+    uint32_t hash(uint32_t pc)
+    {
+        return ((pc >> 4) * 2654435761UL) >> (32 - PC_SAMPLER_SLOTS_LOG2);
+    }
+
+    uint32_t rit_pclk()
+    {
+        // PCLKSEL1 bits 26-27, the divider CCLK is divided by
+        static const uint8_t div[4] = {4, 1, 2, 8};
+        return SystemCoreClock / div[(LPC_SC->PCLKSEL1 >> 26) & 3];
+    }
+}
+
+extern "C" void PcSampler_sample(uint32_t *frame)
+{
+    LPC_RIT->RICTRL |= 1; // clears the interrupt
+    if (slots == nullptr) return;
+
+    // r0 r1 r2 r3 r12 lr pc xpsr
+    uint32_t pc = frame[6] & ~0xFUL;
+    total++;
+    uint32_t h = hash(pc);
+    for (int i = 0; i < PC_SAMPLER_PROBES; i++) {
+        slot_t &s = slots[(h + i) & (PC_SAMPLER_SLOTS - 1)];
+        if (s.pc == pc) {
+            s.count++;
+            return;
+        }
+        if (s.pc == 0) {
+            s.pc = pc;
+            s.count = 1;
+            return;
+        }
+    }
+    missed++;
+}
+
+// the stacked frame is on whichever stack was in use when it was taken
+extern "C" __attribute__((naked)) void RIT_IRQHandler(void)
+{
+    __asm volatile(
+        "tst lr, #4         \n"
+        "ite eq             \n"
+        "mrseq r0, msp      \n"
+        "mrsne r0, psp      \n"
+        "b PcSampler_sample \n"
+    );
+}
+
+bool start(uint32_t hz)
+{
+    stop();
+    // past that the samples are eating the time they measure
+    if (hz == 0 || hz > 10000) return false;
+
+    slot_t *s = (slot_t *)AHB.alloc(sizeof(slot_t) * PC_SAMPLER_SLOTS);
+    if (s == nullptr) return false;
+    memset(s, 0, sizeof(slot_t) * PC_SAMPLER_SLOTS);
+    total = 0;
+    missed = 0;
+    slots = s;
+
+    LPC_SC->PCONP |= (1 << 16);
+    LPC_RIT->RICTRL = 0;
+    LPC_RIT->RICOUNTER = 0;
+    LPC_RIT->RIMASK = 0;
+    LPC_RIT->RICOMPVAL = rit_pclk() / hz;
+    // clear on match, so it counts round at the rate, and clear any interrupt left over
+    LPC_RIT->RICTRL = (1 << 0) | (1 << 1) | (1 << 3);
+    IrqPriority::apply(RIT_IRQn);
+    NVIC_ClearPendingIRQ(RIT_IRQn);
+    NVIC_EnableIRQ(RIT_IRQn);
+    return true;
+}
+
+void stop()
+{
+    if (slots == nullptr) return;
+
+    NVIC_DisableIRQ(RIT_IRQn);
+    LPC_RIT->RICTRL = 0;
+    LPC_SC->PCONP &= ~(1 << 16);
+
+    slot_t *s = slots;
+    slots = nullptr;
+    AHB.dealloc(s);
+}
+
+bool is_running()
+{
+    return slots != nullptr;
+}
+
+void print(StreamOutput *stream)
+{
+    if (slots == nullptr) {
+        stream->printf("Not sampling, $R1 starts it\n");
+        return;
+    }
+
+    // a copy of the busiest ones, so the table can keep filling while they print, it is not
+    // masked as that would hold the step tick up for the whole scan, a sample or two out is fine
+    slot_t top[PC_SAMPLER_TOP];
+    int n = 0;
+    uint32_t t = total, m = missed;
+    for (int i = 0; i < PC_SAMPLER_SLOTS; i++) {
+        const slot_t &s = slots[i];
+        if (s.pc == 0) continue;
+        if (n < PC_SAMPLER_TOP) {
+            top[n++] = s;
+        } else if (s.count > top[n - 1].count) {
+            top[n - 1] = s;
+        } else {
+            continue;
+        }
+        // the smallest kept last
+        for (int j = n - 1; j > 0 && top[j].count > top[j - 1].count; j--) std::swap(top[j], top[j - 1]);
+    }
+
+    stream->printf("# pc count, %lu samples, %lu not in the table\n", t, m);
+    uint32_t shown = 0;
+    for (int i = 0; i < n; i++) {
+        stream->printf("%08lx %lu\n", top[i].pc, top[i].count);
+        shown += top[i].count;
+    }
+    if (t > m + shown) stream->printf("# %lu in other slots\n", t - m - shown);
+}
+
+}
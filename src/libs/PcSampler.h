@@ -0,0 +1,23 @@
+#ifndef _PCSAMPLER_H
+#define _PCSAMPLER_H
+
+#include <cstdint>
+
+class StreamOutput;
+
+/*
+ * Where the main loop spends its time, without a debugger. Started with $R1 the repetitive interrupt timer samples
+ * the PC the interrupt stacked, at the lowest priority so it lands in the main loop rather than the other handlers,
+ * and counts it into a table in AHB RAM by 16 byte slot. $R prints the busiest slots, build/pcprof.py looks them up
+ * in the .elf src/makefile builds. $R0 stops and frees the table.
+ */
+namespace PcSampler {
+    // starts sampling hz times a second, up to 10kHz, from an empty table
+    bool start(uint32_t hz);
+    void stop();
+    bool is_running();
+
+    void print(StreamOutput *stream);
+}
+
+#endif /* _PCSAMPLER_H */
@@ -1,13 +1,16 @@
 #include "libs/Kernel.h"
 #include "PublicData.h"
 #include "PublicDataRequest.h"
+#include "EventTrace.h"
 
 bool PublicData::get_value(uint16_t csa, uint16_t csb, uint16_t csc, void *data) {
     PublicDataRequest pdr(csa, csb, csc);
     // the caller may have created the storage for the returned data so we clear the flag,
     // if it gets set by the callee setting the data ptr that means the data is a pointer to a pointer and is set to a pointer to the returned data
     pdr.set_data_ptr(data, false);
-    THEKERNEL->call_event(ON_GET_PUBLIC_DATA, &pdr );
+    EventTrace::begin(EventTrace::PUBLIC_DATA_GET, csa);
+    THEKERNEL->call_public_data_event(ON_GET_PUBLIC_DATA, &pdr );
+    EventTrace::end(EventTrace::PUBLIC_DATA_GET, csa);
     if(pdr.is_taken() && pdr.has_returned_data()) {
         // the callee set the returned data pointer
         *(void**)data= pdr.get_data_ptr();
@@ -18,6 +21,8 @@ bool PublicData::get_value(uint16_t csa, uint16_t csb, uint16_t csc, void *data)
 bool PublicData::set_value(uint16_t csa, uint16_t csb, uint16_t csc, void *data) {
     PublicDataRequest pdr(csa, csb, csc);
     pdr.set_data_ptr(data);
-    THEKERNEL->call_event(ON_SET_PUBLIC_DATA, &pdr );
+    EventTrace::begin(EventTrace::PUBLIC_DATA_SET, csa);
+    THEKERNEL->call_public_data_event(ON_SET_PUBLIC_DATA, &pdr );
+    EventTrace::end(EventTrace::PUBLIC_DATA_SET, csa);
     return pdr.is_taken();
 }
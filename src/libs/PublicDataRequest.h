@@ -10,18 +10,21 @@
 
 class PublicDataRequest {
     public:
-        PublicDataRequest(uint16_t addrcs1){ target[0]= addrcs1; target[1]= 0; target[2]= 0; data_taken= false; data= NULL; returned_data= true; }
-        PublicDataRequest(uint16_t addrcs1, uint16_t addrcs2){ target[0]= addrcs1; target[1]= addrcs2; target[2]= 0; data_taken= false; data= NULL; returned_data= true; }
-        PublicDataRequest(uint16_t addrcs1, uint16_t addrcs2, uint16_t addrcs3){ target[0]= addrcs1; target[1]= addrcs2; target[2]= addrcs3; data_taken= false; data= NULL; returned_data= true; }
+        PublicDataRequest(uint16_t addrcs1){ target[0]= addrcs1; target[1]= 0; target[2]= 0; data_taken= false; data= NULL; returned_data= true; taken_count= 0; }
+        PublicDataRequest(uint16_t addrcs1, uint16_t addrcs2){ target[0]= addrcs1; target[1]= addrcs2; target[2]= 0; data_taken= false; data= NULL; returned_data= true; taken_count= 0; }
+        PublicDataRequest(uint16_t addrcs1, uint16_t addrcs2, uint16_t addrcs3){ target[0]= addrcs1; target[1]= addrcs2; target[2]= addrcs3; data_taken= false; data= NULL; returned_data= true; taken_count= 0; }
 
         virtual ~PublicDataRequest() { data= nullptr; }
 
         bool starts_with(uint16_t addr) const { return addr == this->target[0]; }
+        uint16_t first_element() const { return this->target[0]; }
         bool second_element_is(uint16_t addr) const { return addr == this->target[1]; }
         bool third_element_is(uint16_t addr) const { return addr == this->target[2]; }
 
         bool is_taken() const { return this->data_taken; }
-        void set_taken() { this->data_taken= true; }
+        void set_taken() { this->data_taken= true; this->taken_count++; }
+        // how many times it has been taken, so the kernel can tell which modules took it
+        uint8_t get_taken_count() const { return this->taken_count; }
         bool has_returned_data() const { return this->returned_data; }
         void set_data_ptr(void *d, bool flag= true) { this->data= d; returned_data= flag; }
         void* get_data_ptr(void) const { return this->data; }
@@ -29,6 +32,7 @@ class PublicDataRequest {
     private:
         uint16_t target[3];
         void* data;
+        uint8_t taken_count;
         struct {
             bool data_taken:1;
             bool returned_data:1; // this is set if the callee returns the data, it is false if the caller supplied the storage for the return
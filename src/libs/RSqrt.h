@@ -0,0 +1,58 @@
+#ifndef _RSQRT_H
+#define _RSQRT_H
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <cfloat>
+
+/*
+ * Square roots for the planner, which takes several for every block it queues and every time it replans one. The
+ * LPC1768 has no FPU and newlib's sqrtf is a long software loop, this seeds 1/sqrt(x) from a table on the exponent
+ * and the top mantissa bits and refines it with two Newton steps, a handful of multiplies. The seed is within 1/64
+ * so the result is good to float precision.
+ *
+ * Zero, negatives, denormals, infinity and NaN go to sqrtf rather than being special cased here.
+ */
+namespace rsqrt_detail {
+    // 1/sqrt(m) for m in sixteenths of [1, 2), then of [2, 4) for the odd exponents
+    const float seed[32] = {
+        0.9848450F, 0.9562805F, 0.9300661F, 0.9058961F,
+        0.8835179F, 0.8627205F, 0.8433261F, 0.8251837F,
+        0.8081641F, 0.7921561F, 0.7770633F, 0.7628016F,
+        0.7492975F, 0.7364861F, 0.7243103F, 0.7127191F,
+        0.6963906F, 0.6761924F, 0.6576560F, 0.6405653F,
+        0.6247415F, 0.6100355F, 0.5963216F, 0.5834930F,
+        0.5714583F, 0.5601390F, 0.5494667F, 0.5393822F,
+        0.5298333F, 0.5207743F, 0.5121647F, 0.5039685F,
+    };
+}
+
+inline float rsqrtf_fast(float x)
+{
+    uint32_t bits;
+    memcpy(&bits, &x, sizeof bits);
+    int e = (int)((bits >> 23) & 0xFF) - 127;
+    int odd = e & 1;
+    int half = (e - odd) / 2;
+
+    // x = m * 2^(e - odd), so 1/sqrt(x) = seed(m) * 2^-half
+    float y = rsqrt_detail::seed[(odd << 4) | ((bits >> 19) & 0x0F)];
+    uint32_t ybits;
+    memcpy(&ybits, &y, sizeof ybits);
+    ybits -= (uint32_t)half << 23;
+    memcpy(&y, &ybits, sizeof y);
+
+    float hx = 0.5F * x;
+    y = y * (1.5F - hx * y * y);
+    y = y * (1.5F - hx * y * y);
+    return y;
+}
+
+inline float sqrtf_fast(float x)
+{
+    if (!(x >= FLT_MIN) || x == INFINITY) return sqrtf(x);
+    return x * rsqrtf_fast(x);
+}
+
+#endif /* _RSQRT_H */
@@ -37,6 +37,8 @@ int SDFAT::disk_sectors()
 int SDFAT::remount() {
     f_mount(_fsid, NULL);
     f_mount(_fsid, &_fs);
-    
+    // the card may have been changed or written elsewhere
+    dirs_changed();
+
 	return 0;
 }
\ No newline at end of file
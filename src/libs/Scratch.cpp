@@ -0,0 +1,61 @@
+#include "Scratch.h"
+
+#include "StreamOutput.h"
+
+namespace Scratch {
+
+namespace {
+    unsigned char transfer[8200] __attribute__((section("AHBSRAM")));
+    unsigned char block[4096] __attribute__((section("AHBSRAM")));
+
+    struct slot_t {
+        const char *name;
+        unsigned char *buf;
+        size_t size;
+        const char *owner;
+        unsigned long claims;
+        unsigned long refused;
+    };
+
+    slot_t slots[NUMBER_OF_BUFFERS] = {
+        {"transfer", transfer, sizeof(transfer), nullptr, 0, 0},
+        {"block",    block,    sizeof(block),    nullptr, 0, 0},
+    };
+}
+
+unsigned char *claim(buffer_t b, const char *owner)
+{
+    slot_t &s = slots[b];
+    if (s.owner != nullptr) {
+        ++s.refused;
+        return nullptr;
+    }
+    s.owner = owner;
+    ++s.claims;
+    return s.buf;
+}
+
+void release(buffer_t b)
+{
+    slots[b].owner = nullptr;
+}
+
+size_t size(buffer_t b)
+{
+    return slots[b].size;
+}
+
+const char *owner(buffer_t b)
+{
+    return slots[b].owner;
+}
+
+void print(StreamOutput *stream)
+{
+    for (const slot_t &s : slots) {
+        stream->printf("Scratch %s: %u bytes, %s, claimed %lu refused %lu\r\n", s.name, (unsigned)s.size,
+                       s.owner != nullptr ? s.owner : "free", s.claims, s.refused);
+    }
+}
+
+}
@@ -0,0 +1,51 @@
+#ifndef _SCRATCH_H
+#define _SCRATCH_H
+
+#include <cstddef>
+
+class StreamOutput;
+
+/*
+ * The big scratch buffers in AHB RAM and who has them. The file transfers, the decompressor and the directory
+ * listing each need several k for a short while, rather than each keeping its own or quietly sharing a global
+ * one, they claim a named buffer for as long as they use it and give it back. A claim that finds the buffer taken
+ * gets nullptr, so the caller can fall back to something smaller instead of two of them writing over each other.
+ *
+ * Claims are made and released from the main loop only, never from an ISR.
+ */
+namespace Scratch {
+    enum buffer_t {
+        TRANSFER,       // 8200 bytes, an 8k XModem packet with its header, length and crc
+        BLOCK,          // 4096 bytes, a decompressed block or a file's stdio buffer
+        NUMBER_OF_BUFFERS
+    };
+
+    // the buffer if it is free, nullptr if someone else has it. owner is kept for the report so it has to be a literal
+    unsigned char *claim(buffer_t b, const char *owner);
+    void release(buffer_t b);
+    size_t size(buffer_t b);
+    // who has it, nullptr when it is free
+    const char *owner(buffer_t b);
+    // one line per buffer: its size, who has it and how often it was claimed and refused
+    void print(StreamOutput *stream);
+
+    // claims a buffer for the scope it is declared in, for the functions with several ways out
+    class Lease {
+        public:
+            Lease(buffer_t b, const char *owner) : b(b), buf(claim(b, owner)) {}
+            ~Lease() { give_back(); }
+            Lease(const Lease &) = delete;
+            Lease &operator=(const Lease &) = delete;
+
+            unsigned char *get() const { return buf; }
+            size_t size() const { return buf != nullptr ? Scratch::size(b) : 0; }
+            // lets it go before the end of the scope, when the caller hands over to something that claims it itself
+            void give_back() { if (buf != nullptr) { release(b); buf = nullptr; } }
+
+        private:
+            buffer_t b;
+            unsigned char *buf;
+    };
+}
+
+#endif /* _SCRATCH_H */
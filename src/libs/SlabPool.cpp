@@ -0,0 +1,77 @@
+#include "SlabPool.h"
+
+#include "platform_memory.h"
+#include "StreamOutput.h"
+
+SlabPool SLAB;
+
+SlabPool::SlabPool()
+{
+    for (auto &c : classes) {
+        c = {nullptr, 0, 0, 0, 0, 0};
+    }
+}
+
+int SlabPool::class_of(size_t nbytes)
+{
+    if(nbytes <= 16) return 0;
+    if(nbytes <= 32) return 1;
+    if(nbytes <= 64) return 2;
+    if(nbytes <= 128) return 3;
+    return -1;
+}
+
+// take another page from AHB and thread its slots onto the free list
+bool SlabPool::grow(int c)
+{
+    uint8_t *page = (uint8_t *)AHB.alloc(PAGE_SIZE);
+    if(page == nullptr) return false;
+
+    size_t sz = class_size(c);
+    for (size_t off = 0; off + sz <= PAGE_SIZE; off += sz) {
+        *(void **)(page + off) = classes[c].free_list;
+        classes[c].free_list = page + off;
+    }
+    classes[c].pages++;
+    return true;
+}
+
+void *SlabPool::alloc(size_t nbytes)
+{
+    int c = class_of(nbytes);
+    if(c < 0) return nullptr;
+
+    slab_class_t &sc = classes[c];
+    if(sc.free_list == nullptr && !grow(c)) {
+        sc.failed++;
+        return nullptr;
+    }
+
+    void *p = sc.free_list;
+    sc.free_list = *(void **)p;
+    sc.allocs++;
+    if(++sc.in_use > sc.peak) sc.peak = sc.in_use;
+    return p;
+}
+
+void SlabPool::dealloc(void *p, size_t nbytes)
+{
+    if(p == nullptr) return;
+
+    int c = class_of(nbytes);
+    if(c < 0) return;
+
+    slab_class_t &sc = classes[c];
+    *(void **)p = sc.free_list;
+    sc.free_list = p;
+    sc.in_use--;
+}
+
+void SlabPool::debug(StreamOutput *stream) const
+{
+    for (int c = 0; c < NUM_CLASSES; c++) {
+        const slab_class_t &sc = classes[c];
+        stream->printf("Slab %3u: in use %u, peak %u, pages %u, allocs %lu, failed %lu\n", class_size(c),
+                       sc.in_use, sc.peak, sc.pages, sc.allocs, sc.failed);
+    }
+}
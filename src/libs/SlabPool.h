@@ -0,0 +1,51 @@
+#ifndef _SLABPOOL_H
+#define _SLABPOOL_H
+
+#include <cstdint>
+#include <cstddef>
+
+class StreamOutput;
+
+/*
+ * Fixed size classes of 16, 32, 64 and 128 bytes carved out of pages taken from the AHB pool,
+ * for small allocations that are made and freed all the time and would otherwise fragment it.
+ *
+ * Each class has a free list so alloc and dealloc are O(1), the caller passes the size back to
+ * dealloc so the class is known without looking it up. Pages are never given back to the AHB pool.
+ * alloc returns nullptr if the size is too big or there is no memory for another page, the caller
+ * is expected to fall back to the heap.
+ */
+class SlabPool
+{
+public:
+    static const int NUM_CLASSES = 4;
+    static const size_t MAX_SIZE = 128;
+    static const size_t PAGE_SIZE = 512;
+
+    SlabPool();
+
+    void *alloc(size_t nbytes);
+    void dealloc(void *p, size_t nbytes);
+
+    void debug(StreamOutput *stream) const;
+
+private:
+    struct slab_class_t {
+        void *free_list;
+        uint16_t in_use;
+        uint16_t peak;
+        uint16_t pages;
+        uint32_t allocs;
+        uint32_t failed;
+    };
+
+    static int class_of(size_t nbytes);
+    static size_t class_size(int c) { return 16 << c; }
+    bool grow(int c);
+
+    slab_class_t classes[NUM_CLASSES];
+};
+
+extern SlabPool SLAB;
+
+#endif /* _SLABPOOL_H */
@@ -13,9 +13,15 @@
 #include "libs/Hook.h"
 #include "modules/robot/Conveyor.h"
 #include "Gcode.h"
+#include "StreamOutput.h"
 
 #include <mri.h>
 
+// DWT cycle counter, enabled by the StepTicker
+#ifndef DWT_CYCCNT
+#define DWT_CYCCNT  (*(volatile uint32_t *)0xE0001004)
+#endif
+
 // This module uses a Timer to periodically call hooks
 // Modules register with a function ( callback ) and a frequency, and we then call that function at the given frequency.
 
@@ -65,7 +71,14 @@ void SlowTicker::tick(){
         if (hook->countdown < 0)
         {
             hook->countdown += hook->interval;
+            if (!hook->enabled) continue;
+
+            uint32_t start = DWT_CYCCNT;
             hook->call();
+            uint32_t cycles = DWT_CYCCNT - start;
+            hook->calls++;
+            hook->total_cycles += cycles;
+            if (cycles > hook->max_cycles) hook->max_cycles = cycles;
         }
     }
 
@@ -87,6 +100,30 @@ void SlowTicker::tick(){
 
 }
 
+// hooks have no names, the object and its vtable can be looked up in the map file
+void SlowTicker::print_stats(StreamOutput *stream) const
+{
+    stream->printf("tick %luHz, hook object vtable hz on calls max avg (cycles)\n", max_frequency);
+    for (Hook *hook : this->hooks) {
+        void *obj = hook->object();
+        uint32_t calls = hook->calls;
+        stream->printf("tick %p %p %lu %d %lu %lu %lu\n", obj, obj != nullptr ? *(void **)obj : nullptr,
+                       (SystemCoreClock >> 2) / hook->interval, hook->enabled, calls, hook->max_cycles,
+                       calls > 0 ? (uint32_t)(hook->total_cycles / calls) : 0);
+    }
+}
+
+void SlowTicker::reset_stats()
+{
+    __disable_irq();
+    for (Hook *hook : this->hooks) {
+        hook->calls = 0;
+        hook->max_cycles = 0;
+        hook->total_cycles = 0;
+    }
+    __enable_irq();
+}
+
 bool SlowTicker::flag_1s(){
     // atomic flag check routine
     // first disable interrupts
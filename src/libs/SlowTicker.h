@@ -14,6 +14,8 @@
 #include "libs/Hook.h"
 #include "libs/Pin.h"
 
+class StreamOutput;
+
 #include "system_LPC17xx.h" // for SystemCoreClock
 #include <math.h>
 
@@ -45,6 +47,13 @@ class SlowTicker : public Module{
             return hook;
         }
 
+        // a disabled hook keeps its place and timing but is not called, for polls only needed some of the time
+        void set_enabled(Hook *hook, bool enabled) { if(hook != nullptr) hook->enabled = enabled; }
+
+        // time spent in each hook, includes any higher priority interrupts that ran meanwhile
+        void print_stats(StreamOutput *stream) const;
+        void reset_stats();
+
     private:
         bool flag_1s();
 
@@ -15,6 +15,9 @@
 #include "StreamOutputPool.h"
 #include "Block.h"
 #include "Conveyor.h"
+#include "platform_memory.h"
+#include "EventTrace.h"
+#include "Counters.h"
 
 #include "system_LPC17xx.h" // mbed.h lib
 #include <math.h>
@@ -29,6 +32,13 @@ GPIO stepticker_debug_pin(STEPTICKER_DEBUG_PIN);
 #define SET_STEPTICKER_DEBUG_PIN(n)
 #endif
 
+// DWT cycle counter, not in the cmsis headers we have
+#ifndef DWT_CYCCNT
+#define DEMCR       (*(volatile uint32_t *)0xE000EDFC)
+#define DWT_CTRL    (*(volatile uint32_t *)0xE0001000)
+#define DWT_CYCCNT  (*(volatile uint32_t *)0xE0001004)
+#endif
+
 StepTicker *StepTicker::instance;
 
 StepTicker::StepTicker()
@@ -49,11 +59,29 @@ StepTicker::StepTicker()
     this->set_frequency(100000);
     this->set_unstep_time(100);
 
-    this->unstep.reset();
     this->num_motors = 0;
+    this->num_step_ports = 0;
+    this->stepped_ports = 0;
+    this->unstep_ports = 0;
 
     this->running = false;
     this->current_block = nullptr;
+    this->precise_steps = false;
+    this->precise_pending = false;
+    this->precise_motor = 0xFF;
+    this->pending_motor = 0;
+    this->coast_max = 0;
+    this->coast_ticks = 0;
+    this->stop_record.valid = false;
+
+    // enable the cycle counter for the ISR stats
+    DEMCR |= CoreDebug_DEMCR_TRCENA;
+    DWT_CYCCNT = 0;
+    DWT_CTRL |= 1;
+    reset_stats();
+    Counters::add("step_isr_max_cycles", Callback<uint32_t()>::bind<StepTicker, &StepTicker::step_max_cycles>(this),
+                  Callback<void()>::bind<StepTicker, &StepTicker::reset_stats>(this));
+    Counters::add("step_overruns", &overruns);
 
     #ifdef STEPTICKER_DEBUG_PIN
     // setup debug pin if defined
@@ -90,121 +118,352 @@ void StepTicker::set_unstep_time( float microseconds )
     uint32_t delay = floorf((SystemCoreClock / 4.0F) * (microseconds / 1000000.0F)); // SystemCoreClock/4 = Timer increments in a second
     LPC_TIM1->MR0 = delay;
 
+    // about 2us to get out of the step tick and into the match interrupt
+    this->precise_margin = floorf((SystemCoreClock / 4.0F) * 2.0F / 1000000.0F);
+
     // TODO check that the unstep time is less than the step period, if not slow down step ticker
 }
 
+void StepTicker::set_coast_time( float microseconds )
+{
+    this->coast_max = floorf(frequency * (microseconds / 1000000.0F));
+}
+
+void StepTicker::reset_stats()
+{
+    __disable_irq();
+    step_stats= {UINT32_MAX, 0, 0, 0};
+    unstep_stats= {UINT32_MAX, 0, 0, 0};
+    overruns= 0;
+    __enable_irq();
+}
+
+RAMFUNC void StepTicker::add_stats(isr_stats_t &stats, uint32_t start)
+{
+    uint32_t cycles= DWT_CYCCNT - start;
+    if(cycles < stats.min) stats.min= cycles;
+    if(cycles > stats.max) stats.max= cycles;
+    ++stats.count;
+    stats.total += cycles;
+}
+
 // Reset step pins on any motor that was stepped
-void StepTicker::unstep_tick()
+RAMFUNC void StepTicker::unstep_tick()
 {
-    for (int i = 0; i < num_motors; i++) {
-        if(this->unstep[i]) {
-            this->motor[i]->unstep();
+    uint32_t start= DWT_CYCCNT;
+    uint8_t ports= this->unstep_ports;
+    for (uint8_t i = 0; i < num_step_ports; i++) {
+        if(ports & (1 << i)) {
+            step_port_t &sp= step_ports[i];
+            sp.port->FIOCLR = sp.unstep_set_mask;
+            sp.port->FIOSET = sp.unstep_clr_mask;
+            sp.unstep_set_mask= sp.unstep_clr_mask= 0;
         }
     }
-    this->unstep.reset();
+    this->unstep_ports= 0;
+    add_stats(unstep_stats, start);
 }
 
-extern "C" void TIMER1_IRQHandler (void)
+// set the step pins of all the motors that stepped this tick, one write per port
+RAMFUNC void StepTicker::write_step_ports()
+{
+    for (uint8_t i = 0; i < num_step_ports; i++) {
+        if(stepped_ports & (1 << i)) {
+            step_port_t &sp= step_ports[i];
+            if(sp.set_mask != 0) sp.port->FIOSET = sp.set_mask;
+            if(sp.clr_mask != 0) sp.port->FIOCLR = sp.clr_mask;
+            sp.unstep_set_mask |= sp.set_mask;
+            sp.unstep_clr_mask |= sp.clr_mask;
+            sp.set_mask= sp.clr_mask= 0;
+        }
+    }
+    unstep_ports |= stepped_ports;
+    stepped_ports= 0;
+}
+
+// MR1 match, set the step pin of the dominant motor that became due during the last tick
+RAMFUNC void StepTicker::precise_step()
+{
+    LPC_TIM0->MCR &= ~(1 << 3); // no more MR1 interrupts until the next one is scheduled
+    if(!precise_pending) return;
+    precise_pending= false;
+
+    *step_mask[pending_motor] |= step_bit[pending_motor];
+    stepped_ports |= step_port_bit[pending_motor];
+    write_step_ports();
+    LPC_TIM1->TCR = 3;
+    LPC_TIM1->TCR = 1;
+}
+
+extern "C" RAMFUNC void TIMER1_IRQHandler (void)
 {
     LPC_TIM1->IR |= 1 << 0;
     StepTicker::getInstance()->unstep_tick();
 }
 
 // The actual interrupt handler where we do all the work
-extern "C" void TIMER0_IRQHandler (void)
+extern "C" RAMFUNC void TIMER0_IRQHandler (void)
 {
-    // Reset interrupt register
-    LPC_TIM0->IR |= 1 << 0;
-    StepTicker::getInstance()->step_tick();
+    uint32_t ir= LPC_TIM0->IR;
+    // a pending precise step is always due before the next tick
+    if(ir & (1 << 1)) {
+        LPC_TIM0->IR = 1 << 1;
+        StepTicker::getInstance()->precise_step();
+    }
+    if(ir & (1 << 0)) {
+        // Reset interrupt register
+        LPC_TIM0->IR = 1 << 0;
+        StepTicker::getInstance()->step_tick();
+    }
 }
 
-extern "C" void PendSV_Handler(void)
+extern "C" RAMFUNC void PendSV_Handler(void)
 {
     StepTicker::getInstance()->handle_finish();
 }
 
 // slightly lower priority than TIMER0, the whole end of block/start of block is done here allowing the timer to continue ticking
-void StepTicker::handle_finish (void)
+RAMFUNC void StepTicker::handle_finish (void)
 {
     // all moves finished signal block is finished
     if(finished_fnc) finished_fnc();
 }
 
-// step clock
-void StepTicker::step_tick (void)
+// the fixed point the current block uses for its rates and step accumulators
+template<typename FP> static FP &fp_of(StepTicker::tickinfo_t &ti);
+template<> inline StepTicker::tickfp64_t &fp_of(StepTicker::tickinfo_t &ti) { return ti.fp64; }
+template<> inline StepTicker::tickfp32_t &fp_of(StepTicker::tickinfo_t &ti) { return ti.fp32; }
+
+// scale a rate of the dominant motor by a motor's 1.31 step ratio
+static inline int32_t scale_rate(int32_t v, uint32_t ratio)
 {
-    //SET_STEPTICKER_DEBUG_PIN(running ? 1 : 0);
+    return (int32_t)(((int64_t)v * ratio) >> 31);
+}
 
-    // if nothing has been setup we ignore the ticks
-    if(!running){
-        // check if anything new available
-        if(THECONVEYOR->get_next_block(&current_block)) { // returns false if no new block is available
-            running= start_next_block(); // returns true if there is at least one motor with steps to issue
-            if(!running) return;
-        }else{
-            return;
+static inline int64_t scale_rate(int64_t v, uint32_t ratio)
+{
+    // split so it is two 32x32 multiplies rather than needing 96 bits
+    int64_t hi= (int64_t)(int32_t)(v >> 32) * ratio;
+    uint64_t lo= (uint64_t)(uint32_t)v * ratio;
+    return (hi << 1) + (int64_t)(lo >> 31);
+}
+
+template<typename FP, typename R>
+static inline void start_rates(FP &fp, const R &rates, uint32_t ratio)
+{
+    fp.steps_per_tick= scale_rate(rates.steps_per_tick, ratio);
+    fp.counter= 0;
+    fp.acceleration_change= scale_rate(rates.acceleration_change, ratio);
+    fp.deceleration_change= scale_rate(rates.deceleration_change, ratio);
+    fp.plateau_rate= scale_rate(rates.plateau_rate, ratio);
+    fp.jerk= scale_rate(rates.jerk, ratio);
+    fp.accel_jerk= scale_rate(rates.accel_jerk, ratio);
+    fp.decel_jerk= scale_rate(rates.decel_jerk, ratio);
+}
+
+float StepTicker::get_trapezoid_rate(int m) const
+{
+    // convert steps per tick from fixed point to float and convert to steps/sec
+    // FIXME steps_per_tick can change at any time, potential race condition if it changes while being read here
+    const Block *b= current_block;
+    if(b != nullptr && b->is_fp32) return STEPTICKER_FROMFP32(tick_info[m].fp32.steps_per_tick) * frequency;
+    return STEPTICKER_FROMFP(tick_info[m].fp64.steps_per_tick) * frequency;
+}
+
+// the step of motor m became due during the last tick, instead of setting its pin now place it the same
+// fraction of a period into this tick with the MR1 match, returns false if it has to be stepped now
+template<typename FP>
+RAMFUNC bool StepTicker::schedule_step(uint8_t m, FP &fp)
+{
+    // it has to be unstepped again before the next step, and it needs a step pin
+    if(precise_pending || step_port_bit[m] == 0 || fp.steps_per_tick >= (decltype(fp.steps_per_tick))(FP::one / 2)) return false;
+
+    // use the top 15 bits of the counter, the divide is then a 32 bit one
+    const int shift= sizeof(typename FP::counter_t) == 8 ? 47 : 16;
+    uint32_t rate= (uint32_t)(fp.steps_per_tick >> shift);
+    if(rate == 0) return false;
+    uint32_t excess= (uint32_t)(fp.counter >> shift); // how far past 1.0 the counter went
+    if(excess > rate) excess= rate;
+
+    uint32_t match= period - 1 - ((excess * (period - 1)) / rate);
+    if(match <= LPC_TIM0->TC + precise_margin) return false; // too late, just step it now
+
+    pending_motor= m;
+    precise_pending= true;
+    LPC_TIM0->MR1 = match;
+    LPC_TIM0->MCR |= (1 << 3); // interrupt on MR1
+    return true;
+}
+
+// an S-curve block changes the jerk at each of its phases, see Block::next_scurve_event
+template<typename FP>
+RAMFUNC void StepTicker::scurve_event(tickinfo_t &ti, FP &fp)
+{
+    const Block *b= current_block;
+    if(b->accelerate_until != 0) {
+        if(current_tick == b->accel_jerk_ticks) fp.jerk= 0; // constant acceleration
+        if(current_tick == b->accelerate_until - b->accel_jerk_ticks) fp.jerk= -fp.accel_jerk;
+        if(current_tick == b->accelerate_until) { // We are done accelerating
+            fp.acceleration_change= 0;
+            fp.jerk= 0;
+            if(b->decelerate_after < b->total_move_ticks && current_tick != b->decelerate_after) { // We are plateauing
+                fp.steps_per_tick= fp.plateau_rate;
+            }
         }
     }
 
-    if(THEKERNEL->is_halted()) {
-        running= false;
-        current_tick = 0;
-        current_block= nullptr;
-        return;
+    if(b->decelerate_after < b->total_move_ticks) {
+        if(current_tick == b->decelerate_after) { // We start decelerating
+            fp.acceleration_change= 0;
+            fp.jerk= -fp.decel_jerk;
+        }
+        if(current_tick == b->decelerate_after + b->decel_jerk_ticks) fp.jerk= 0; // constant deceleration
+        if(current_tick == b->total_move_ticks - b->decel_jerk_ticks) fp.jerk= fp.decel_jerk;
     }
 
-    bool still_moving= false;
-    // foreach motor, if it is active see if time to issue a step to that motor
-    for (uint8_t m = 0; m < num_motors; m++) {
-        if(current_block->tick_info[m].steps_to_move == 0) continue; // not active
+    ti.next_accel_event= b->next_scurve_event(current_tick);
+}
 
-        current_block->tick_info[m].steps_per_tick += current_block->tick_info[m].acceleration_change;
+// with no rate change before then, the ticks until the motor's next step would only add to its counter, so they are
+// added here in one go and the step ISR next runs on the tick it steps. Returns the number of ticks skipped
+template<typename FP>
+RAMFUNC uint32_t StepTicker::coast(tickinfo_t &ti, FP &fp)
+{
+    if(fp.acceleration_change != 0 || fp.jerk != 0 || fp.steps_per_tick <= 0) return 0;
+
+    // the counter passes 1.0 on the k'th tick from now, the ones before it are skipped
+    auto k= (FP::one - fp.counter + fp.steps_per_tick - 1) / fp.steps_per_tick;
+    if(k <= 1) return 0;
+    uint32_t skip= k - 1 > coast_max ? coast_max : k - 1;
+    // the tick of the next rate change has to be run
+    if(ti.next_accel_event > current_tick && skip > ti.next_accel_event - current_tick) skip= ti.next_accel_event - current_tick;
+
+    fp.counter += fp.steps_per_tick * skip;
+    current_tick += skip;
+    return skip;
+}
 
-        if(current_tick == current_block->tick_info[m].next_accel_event) {
+// the next match comes skip ticks later than it would, or back to every period with 0
+RAMFUNC void StepTicker::set_coast(uint32_t skip)
+{
+    if(skip == coast_ticks) return;
+    coast_ticks= skip;
+    LPC_TIM0->MR0 = period * (skip + 1);
+    // only if this tick ran for more than a period, restart it rather than count all the way round
+    if(LPC_TIM0->TC >= LPC_TIM0->MR0) {
+        LPC_TIM0->TCR = 3;
+        LPC_TIM0->TCR = 1;
+    }
+}
+
+// issue the steps due for each active motor this tick, returns true if any motor is still moving
+template<typename FP, bool SCURVE>
+RAMFUNC bool StepTicker::tick_motors()
+{
+    // foreach active motor see if time to issue a step to that motor
+    for (uint32_t active= ticking_mask; active != 0; active &= active - 1) {
+        uint8_t m= __builtin_ctz(active);
+        FP &fp= fp_of<FP>(tick_info[m]);
+
+        fp.steps_per_tick += fp.acceleration_change;
+
+        if(SCURVE) {
+            if(current_tick == tick_info[m].next_accel_event) scurve_event<FP>(tick_info[m], fp);
+            fp.acceleration_change += fp.jerk;
+
+        } else if(current_tick == tick_info[m].next_accel_event) {
             if(current_tick == current_block->accelerate_until) { // We are done accelerating, deceleration becomes 0 : plateau
-                current_block->tick_info[m].acceleration_change = 0;
+                fp.acceleration_change = 0;
                 if(current_block->decelerate_after < current_block->total_move_ticks) {
-                    current_block->tick_info[m].next_accel_event = current_block->decelerate_after;
+                    tick_info[m].next_accel_event = current_block->decelerate_after;
                     if(current_tick != current_block->decelerate_after) { // We are plateauing
                         // steps/sec / tick frequency to get steps per tick
-                        current_block->tick_info[m].steps_per_tick = current_block->tick_info[m].plateau_rate;
+                        fp.steps_per_tick = fp.plateau_rate;
                     }
                 }
             }
 
             if(current_tick == current_block->decelerate_after) { // We start decelerating
-                current_block->tick_info[m].acceleration_change = current_block->tick_info[m].deceleration_change;
+                fp.acceleration_change = fp.deceleration_change;
             }
         }
 
         // protect against rounding errors and such
-        if(current_block->tick_info[m].steps_per_tick <= 0) {
-            current_block->tick_info[m].counter = STEPTICKER_FPSCALE; // we force completion this step by setting to 1.0
-            current_block->tick_info[m].steps_per_tick = 0;
+        if(fp.steps_per_tick <= 0) {
+            fp.counter = FP::one; // we force completion this step by setting to 1.0
+            fp.steps_per_tick = 0;
         }
 
-        current_block->tick_info[m].counter += current_block->tick_info[m].steps_per_tick;
+        fp.counter += fp.steps_per_tick;
 
-        if(current_block->tick_info[m].counter >= STEPTICKER_FPSCALE) { // >= 1.0 step time
-            current_block->tick_info[m].counter -= STEPTICKER_FPSCALE; // -= 1.0F;
-            ++current_block->tick_info[m].step_count;
+        if(fp.counter >= FP::one) { // >= 1.0 step time
+            fp.counter -= FP::one; // -= 1.0F;
+            ++tick_info[m].step_count;
 
-            // step the motor
-            bool ismoving= motor[m]->step(); // returns false if the moving flag was set to false externally (probes, endstops etc)
-            // we stepped so schedule an unstep
-            unstep.set(m);
+            // step the motor, the pin is set with the rest of its port after all the motors are ticked
+            bool ismoving= motor[m]->count_step(); // returns false if the moving flag was set to false externally (probes, endstops etc)
+            if(m != precise_motor || !schedule_step<FP>(m, fp)) {
+                *step_mask[m] |= step_bit[m];
+                stepped_ports |= step_port_bit[m];
+            }
 
-            if(!ismoving || current_block->tick_info[m].step_count == current_block->tick_info[m].steps_to_move) {
+            if(!ismoving || tick_info[m].step_count == tick_info[m].steps_to_move) {
                 // done
-                current_block->tick_info[m].steps_to_move = 0;
-                motor[m]->stop_moving(); // let motor know it is no longer moving
+                tick_info[m].steps_to_move = 0;
+                ticking_mask &= ~(1UL << m);
+                motor[m]->stop_moving(); // let motor know it is no longer moving, clears it in moving_mask
             }
         }
+    }
+
+    // see if any motors are still moving after this tick, motors stopped externally are cleared too
+    return moving_mask.load() != 0;
+}
+
+// step clock
+RAMFUNC void StepTicker::step_tick (void)
+{
+    uint32_t start= DWT_CYCCNT;
+    //SET_STEPTICKER_DEBUG_PIN(running ? 1 : 0);
+
+    // if nothing has been setup we ignore the ticks
+    if(!running){
+        // check if anything new available
+        if(THECONVEYOR->get_next_block(&current_block)) { // returns false if no new block is available
+            running= start_next_block(); // returns true if there is at least one motor with steps to issue
+            if(!running) return;
+        }else{
+            return;
+        }
+    }
 
-        // see if any motors are still moving after this tick
-        if(motor[m]->is_moving()) still_moving= true;
+    if(THEKERNEL->is_halted()) {
+        EventTrace::end(EventTrace::BLOCK, current_block->line);
+        stop_record.line= current_block->line;
+        stop_record.dominant_motor= current_block->dominant_motor;
+        for (uint8_t m = 0; m < num_motors; m++) {
+            bool active= current_block->active_mask & (1UL << m);
+            stop_record.step_count[m]= active ? tick_info[m].step_count : 0;
+            stop_record.steps[m]= active ? current_block->steps[m] : 0;
+        }
+        stop_record.valid= true;
+        running= false;
+        moving_mask= 0;
+        precise_pending= false;
+        current_tick = 0;
+        current_block= nullptr;
+        set_coast(0);
+        if(block_tick_interval != 0) block_tick_fnc();
+        return;
     }
 
+    // short blocks use 32 bit fixed point which is much cheaper on the cortex-m3
+    // and only S-curve blocks pay for the jerk. A motor stopped while the timer coasted to its step does not get it
+    bool still_moving= (coast_ticks != 0 && moving_mask.load() == 0) ? false :
+                       current_block->is_dwell ? current_tick + 1 < current_block->total_move_ticks :
+                       current_block->is_fp32 ? tick_motors<tickfp32_t, false>() :
+                       current_block->is_scurve ? tick_motors<tickfp64_t, true>() : tick_motors<tickfp64_t, false>();
+
     // do this after so we start at tick 0
     current_tick++; // count number of ticks
 
@@ -212,11 +471,18 @@ void StepTicker::step_tick (void)
     // Note there could be a race here if we run another tick before the unsteps have happened,
     // right now it takes about 3-4us but if the unstep were near 10uS or greater it would be an issue
     // also it takes at least 2us to get here so even when set to 1us pulse width it will still be about 3us
-    if( unstep.any()) {
+    if(stepped_ports != 0) {
+        write_step_ports();
         LPC_TIM1->TCR = 3;
         LPC_TIM1->TCR = 1;
     }
 
+    // after the steps are out so it does not delay them
+    if(block_tick_interval != 0 && --block_tick_countdown == 0) {
+        block_tick_countdown= block_tick_interval;
+        block_tick_fnc();
+    }
+
 
     // see if any motors are still moving
     if(!still_moving) {
@@ -224,6 +490,7 @@ void StepTicker::step_tick (void)
 
         // all moves finished
         current_tick = 0;
+        EventTrace::end(EventTrace::BLOCK, current_block->line);
 
         // get next block
         // do it here so there is no delay in ticks
@@ -235,6 +502,7 @@ void StepTicker::step_tick (void)
         }else{
             current_block= nullptr;
             running= false;
+            if(block_tick_interval != 0) block_tick_fnc();
         }
 
         // all moves finished
@@ -242,30 +510,67 @@ void StepTicker::step_tick (void)
         //NVIC_SetPendingIRQ(PendSV_IRQn); this doesn't work
         //SCB->ICSR = 0x10000000; // SCB_ICSR_PENDSVSET_Msk;
     }
+
+    // a block with one motor left ticking, like a long A rotation or a Z plunge, coasts between its steps on the
+    // plateau, not when something follows the ticks
+    uint32_t skip= 0;
+    if(coast_max != 0 && running && block_tick_interval == 0 && !current_block->is_dwell &&
+       ticking_mask != 0 && (ticking_mask & (ticking_mask - 1)) == 0) {
+        tickinfo_t &ti= tick_info[__builtin_ctz(ticking_mask)];
+        skip= current_block->is_fp32 ? coast<tickfp32_t>(ti, ti.fp32) : coast<tickfp64_t>(ti, ti.fp64);
+    }
+    set_coast(skip);
+
+    // the next match came while we were still in here, so a tick was lost
+    if(LPC_TIM0->IR & (1 << 0)) ++overruns;
+    add_stats(step_stats, start);
+}
+
+void StepTicker::set_block_tick_fnc(Callback<void()> fnc, uint32_t interval)
+{
+    __disable_irq();
+    block_tick_fnc= fnc;
+    block_tick_interval= fnc ? (interval > 0 ? interval : 1) : 0;
+    block_tick_countdown= 1;
+    __enable_irq();
 }
 
 // only called from the step tick ISR (single consumer)
-bool StepTicker::start_next_block()
+RAMFUNC bool StepTicker::start_next_block()
 {
     if(current_block == nullptr) return false;
 
-    bool ok= false;
+    uint32_t active= current_block->active_mask;
+    bool ok= active != 0 || current_block->is_dwell; // at least one motor is moving, or it is a dwell
     // need to prepare each active motor
-    for (uint8_t m = 0; m < num_motors; m++) {
-        if(current_block->tick_info[m].steps_to_move == 0) continue;
+    for (uint32_t a= active; a != 0; a &= a - 1) {
+        uint8_t m= __builtin_ctz(a);
+
+        // start the motor's accumulator from the block's rates
+        tickinfo_t &ti= tick_info[m];
+        uint32_t ratio= current_block->axis_ratio[m];
+        if(current_block->is_fp32) start_rates(ti.fp32, current_block->rates.fp32, ratio);
+        else start_rates(ti.fp64, current_block->rates.fp64, ratio);
+        ti.steps_to_move= current_block->steps[m];
+        ti.step_count= 0;
+        ti.next_accel_event= current_block->next_accel_event;
 
-        ok= true; // mark at least one motor is moving
         // set direction bit here
         // NOTE this would be at least 10us before first step pulse.
         // TODO does this need to be done sooner, if so how without delaying next tick
         motor[m]->set_direction(current_block->direction_bits[m]);
         motor[m]->start_moving(); // also let motor know it is moving now
     }
+    moving_mask= active;
+    ticking_mask= active;
+    precise_motor= precise_steps ? current_block->dominant_motor : 0xFF;
 
     current_tick= 0;
+    block_tick_countdown= 1;
 
     if(ok) {
         //SET_STEPTICKER_DEBUG_PIN(1);
+        EventTrace::begin(EventTrace::BLOCK, current_block->line);
         return true;
 
     }else{
@@ -281,6 +586,30 @@ bool StepTicker::start_next_block()
 // returns index of the stepper motor in the array and bitset
 int StepTicker::register_motor(StepperMotor* m)
 {
+    uint8_t n= num_motors;
     motor[num_motors++] = m;
-    return num_motors - 1;
+
+    // find or add the port group for the step pin
+    Pin &pin= m->get_step_pin();
+    step_mask[n]= &no_step_mask;
+    step_bit[n]= 0;
+    step_port_bit[n]= 0;
+    if(pin.connected()) {
+        uint8_t i;
+        for (i = 0; i < num_step_ports; i++) {
+            if(step_ports[i].port == pin.port) break;
+        }
+        if(i == num_step_ports && num_step_ports < k_max_step_ports) {
+            step_ports[i]= {pin.port, 0, 0, 0, 0};
+            num_step_ports++;
+        }
+        if(i < num_step_ports) {
+            // an inverted step pin is set by clearing it
+            step_mask[n]= pin.is_inverting() ? &step_ports[i].clr_mask : &step_ports[i].set_mask;
+            step_bit[n]= 1UL << pin.pin;
+            step_port_bit[n]= 1 << i;
+        }
+    }
+
+    return n;
 }
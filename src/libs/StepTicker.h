@@ -12,11 +12,12 @@
 #include <stdint.h>
 #include <array>
 #include <bitset>
-#include <functional>
 #include <atomic>
 
 #include "ActuatorCoordinates.h"
+#include "Callback.h"
 #include "TSRingBuffer.h"
+#include "libs/LPC17xx/sLPC17xx.h"
 
 class StepperMotor;
 class Block;
@@ -24,42 +25,172 @@ class Block;
 // handle 2.62 Fixed point
 #define STEPTICKER_FPSCALE (1LL<<62)
 #define STEPTICKER_FROMFP(x) ((float)(x)/STEPTICKER_FPSCALE)
+// and 1.31 for the 32 bit fast path
+#define STEPTICKER_FPSCALE32 (1UL<<31)
+#define STEPTICKER_FROMFP32(x) ((float)(x)/STEPTICKER_FPSCALE32)
 
 class StepTicker{
     public:
+        // cycles spent in an ISR, measured with the DWT cycle counter
+        struct isr_stats_t {
+            uint32_t min;
+            uint32_t max;
+            uint32_t count;
+            uint64_t total;
+            uint32_t avg() const { return count == 0 ? 0 : total / count; }
+        };
+
         StepTicker();
         ~StepTicker();
         void set_frequency( float frequency );
         void set_unstep_time( float microseconds );
+        void set_precise_steps(bool f) { precise_steps= f; }
+        // the longest the timer may be stretched over ticks where nothing steps, 0 ticks every period, after set_frequency
+        void set_coast_time(float microseconds);
+        // how many periods until the next step tick, more than one while it coasts
+        uint32_t get_tick_span() const { return coast_ticks + 1; }
         int register_motor(StepperMotor* motor);
         float get_frequency() const { return frequency; }
         void unstep_tick();
+        void precise_step();
         const Block *get_current_block() const { return current_block; }
+        // how far motor m is through the current block
+        uint32_t get_step_count(uint8_t m) const { return tick_info[m].step_count; }
+        uint32_t get_steps_to_move(uint8_t m) const { return tick_info[m].steps_to_move; }
+        // called when a motor is stopped, possibly from outside the ISR (probes, endstops etc)
+        void motor_stopped(uint8_t m) { moving_mask.fetch_and(~(1UL << m)); }
 
         void step_tick (void);
         void handle_finish (void);
         void start();
 
         // whatever setup the block should register this to know when it is done
-        std::function<void()> finished_fnc{nullptr};
+        Callback<void()> finished_fnc;
+
+        // called from the step ISR on the first tick of each block, then every interval ticks while it runs
+        // and once more when the queue runs dry, for outputs that have to follow the motion like the laser power
+        void set_block_tick_fnc(Callback<void()> fnc, uint32_t interval);
 
         static StepTicker *getInstance() { return instance; }
 
+        // current rate (steps/sec) of a motor of the executing block
+        float get_trapezoid_rate(int m) const;
+
+        // the rates and step accumulator of a motor, in 2.62 fixed point or when the block is short enough in 1.31 fixed point
+        // so the cortex-m3 step ticker can use 32 bit adds and compares
+        template<typename T, typename C, C ONE>
+        struct tickfp_t {
+            using counter_t= C;
+            static constexpr C one= ONE;
+            T steps_per_tick;
+            C counter;
+            T acceleration_change; // signed
+            T deceleration_change;
+            T plateau_rate;
+            T jerk; // S-curve blocks only
+            T accel_jerk;
+            T decel_jerk;
+        };
+        using tickfp64_t= tickfp_t<int64_t, int64_t, STEPTICKER_FPSCALE>;
+        using tickfp32_t= tickfp_t<int32_t, uint32_t, STEPTICKER_FPSCALE32>;
+
+        // this is the data needed to determine when each motor needs to be issued a step
+        using tickinfo_t= struct {
+            union {
+                tickfp64_t fp64;
+                tickfp32_t fp32; // used when the block is_fp32
+            };
+            uint32_t steps_to_move;
+            uint32_t step_count;
+            uint32_t next_accel_event;
+        };
+
+        // how far the block being stepped when the machine halted got, so a job can carry on from there rather
+        // than from the start of the line. Written by the step tick that sees the halt
+        struct stop_record_t {
+            unsigned int line;      // of the block, 0 if none was being stepped
+            uint8_t dominant_motor;
+            std::array<uint32_t, k_max_actuators> step_count;
+            std::array<uint32_t, k_max_actuators> steps;
+            volatile bool valid;
+        };
+        const stop_record_t& get_stop_record() const { return stop_record; }
+        void clear_stop_record() { stop_record.valid= false; }
+
+        // step_tick is only measured while it is ticking a block, overruns are ticks that took longer than the period
+        const isr_stats_t& get_step_stats() const { return step_stats; }
+        const isr_stats_t& get_unstep_stats() const { return unstep_stats; }
+        uint32_t get_overruns() const { return overruns; }
+        void reset_stats();
+        // for the counters
+        uint32_t step_max_cycles() { return step_stats.max; }
+
     private:
         static StepTicker *instance;
 
         bool start_next_block();
+        template<typename FP, bool SCURVE> bool tick_motors();
+        template<typename FP> void scurve_event(tickinfo_t &ti, FP &fp);
+        template<typename FP> uint32_t coast(tickinfo_t &ti, FP &fp);
+        void set_coast(uint32_t ticks);
 
         float frequency;
         uint32_t period;
         std::array<StepperMotor*, k_max_actuators> motor;
-        std::bitset<k_max_actuators> unstep;
+
+        // step pins are written a GPIO port at a time, so all the motors on a port step with one FIOSET/FIOCLR
+        struct step_port_t {
+            LPC_GPIO_TypeDef *port;
+            uint32_t set_mask;          // step pins to FIOSET this tick
+            uint32_t clr_mask;          // inverted step pins to FIOCLR this tick
+            uint32_t unstep_set_mask;   // the pins stepped, still to be reset by unstep_tick
+            uint32_t unstep_clr_mask;
+        };
+        static const uint8_t k_max_step_ports= 5;
+        std::array<step_port_t, k_max_step_ports> step_ports;
+        // for each motor where its step pin goes in step_ports, which is precomputed at register_motor
+        std::array<uint32_t*, k_max_actuators> step_mask;
+        std::array<uint32_t, k_max_actuators> step_bit;
+        std::array<uint8_t, k_max_actuators> step_port_bit;
+        uint32_t no_step_mask; // where motors without a step pin step to
+        uint8_t stepped_ports; // ports with step pins set this tick
+        volatile uint8_t unstep_ports; // ports with step pins waiting to be reset
+        uint8_t num_step_ports;
+
+        void write_step_ports();
+
+        // in precise mode the dominant motor's step is set by a TIMER0 MR1 match at its exact time within the tick
+        template<typename FP> bool schedule_step(uint8_t m, FP &fp);
+        uint32_t precise_margin; // timer counts needed to set up a match before it is due
+        uint8_t precise_motor;   // dominant motor of the current block or 0xFF
+        uint8_t pending_motor;   // motor waiting for the MR1 match
+
+        // when one motor is left moving at a constant rate the ticks until its next step are skipped with a longer MR0
+        uint32_t coast_max;      // ticks, 0 never coasts
+        uint32_t coast_ticks;    // skipped by the current timer interval
+
+        static void add_stats(isr_stats_t &stats, uint32_t start);
+        isr_stats_t step_stats;
+        isr_stats_t unstep_stats;
+        volatile uint32_t overruns;
+        std::atomic<uint32_t> moving_mask{0}; // bit set for each motor of the current block that is still moving
+
+        // only the executing block is ticked, so only it has tick info, set up from its rates by start_next_block
+        std::array<tickinfo_t, k_max_actuators> tick_info;
+        uint32_t ticking_mask; // motors of the current block that still have steps to issue
 
         Block *current_block;
         uint32_t current_tick{0};
+        stop_record_t stop_record;
+
+        Callback<void()> block_tick_fnc;
+        uint32_t block_tick_interval{0};
+        uint32_t block_tick_countdown{0};
 
         struct {
             volatile bool running:1;
             uint8_t num_motors:4;
+            bool precise_steps:1;
+            volatile bool precise_pending:1;
         };
 };
@@ -27,6 +27,8 @@ StepperMotor::StepperMotor(Pin &step, Pin &dir, Pin &en) : step_pin(step), dir_p
     current_position_steps= 0;
     moving= false;
     acceleration= NAN;
+    jerk= NAN;
+    shaper_time= 0;
     selected= true;
     extruder= false;
 
@@ -52,11 +54,18 @@ void StepperMotor::on_halt(void *argument)
     }
 }
 
+void StepperMotor::stop_moving()
+{
+    moving= false;
+    // let the step ticker know this motor is done so the block can finish
+    StepTicker::getInstance()->motor_stopped(motor_id);
+}
+
 void StepperMotor::on_enable(void *argument)
 {
     // argument is a uin32_t where bit0 is on or off, and bit 1:X, 2:Y, 3:Z, 4:A, 5:B, 6:C etc
     // for now if bit0 is 1 we turn all on, if 0 we turn all off otherwise we turn selected axis off
-    uint32_t bm= (uint32_t)argument;
+    uint32_t bm= (uint32_t)(uintptr_t)argument;
     if(bm == 0x01) {
         enable(true);
 
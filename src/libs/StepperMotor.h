@@ -20,16 +20,20 @@ class StepperMotor  : public Module {
 
         // called from step ticker ISR
         inline bool step() { step_pin.set(1); current_position_steps += (direction?-1:1); return moving; }
+        // called from step ticker ISR when the step pin is written along with the rest of its port
+        inline bool count_step() { current_position_steps += (direction?-1:1); return moving; }
         // called from unstep ISR
         inline void unstep() { step_pin.set(0); }
+        Pin& get_step_pin() { return step_pin; }
         // called from step ticker ISR
         inline void set_direction(bool f) { dir_pin.set(f); direction= f; }
 
         void enable(bool state) { en_pin.set(!state); };
         bool is_enabled() const { return !en_pin.get(); };
         bool is_moving() const { return moving; };
+        // only the step ticker starts a motor, it tracks the moving motors of the block as a mask
         void start_moving() { moving= true; }
-        void stop_moving() { moving= false; }
+        void stop_moving();
 
         void manual_step(bool dir);
 
@@ -49,6 +53,10 @@ class StepperMotor  : public Module {
         void set_max_rate(float mr) { max_rate= mr; }
         void set_acceleration(float a) { acceleration= a; }
         float get_acceleration() const { return acceleration; }
+        void set_jerk(float j) { jerk= j; }
+        float get_jerk() const { return jerk; }
+        void set_shaper_time(float t) { shaper_time= t; }
+        float get_shaper_time() const { return shaper_time; }
         bool is_selected() const { return selected; }
         void set_selected(bool b) { selected= b; }
         bool is_extruder() const { return extruder; }
@@ -69,6 +77,8 @@ class StepperMotor  : public Module {
         float steps_per_mm;
         float max_rate; // this is not really rate it is in mm/sec, misnamed used in Robot and Extruder
         float acceleration;
+        float jerk; // mm/sec³, NAN uses the default jerk
+        float shaper_time; // secs, the shortest jerk phase of a block this axis moves in, 0 for none
 
         volatile int32_t current_position_steps;
         int32_t last_milestone_steps;
@@ -7,8 +7,10 @@ int StreamOutput::printf(const char *format, ...)
     char b[64];
     char *buffer;
     // Make the message
-    va_list args;
+    va_list args, again;
     va_start(args, format);
+    // the first pass uses the arguments up where va_list is an array, as it is on the host
+    va_copy(again, args);
 
     int size = vsnprintf(b, 64, format, args) + 1; // we add one to take into account space for the terminating \0
 
@@ -16,8 +18,9 @@ int StreamOutput::printf(const char *format, ...)
         buffer = b;
     } else {
         buffer = new char[size];
-        vsnprintf(buffer, size, format, args);
+        vsnprintf(buffer, size, format, again);
     }
+    va_end(again);
     va_end(args);
 
     puts(buffer, strlen(buffer));
@@ -30,6 +30,7 @@ class StreamOutput {
         virtual int puts(const char* buf, int size = 0) = 0;
         virtual bool ready() { return true; };
         virtual int type() {return 0; }; // 0: serial, 1: wifi
+        virtual int rx_free() { return -1; }; // bytes free in the receive buffer for hosts that count characters, -1 if not buffered
 
         static NullStreamOutput NullStream;
 };
@@ -22,12 +22,14 @@ public:
     StreamOutputPool(){
     }
 
+    // the message is formatted once by printf and its length worked out once here, for all the streams
     int puts(const char* s, int size)
     {
+        if (size == 0) size = strlen(s);
         int r = 0;
         for(set<StreamOutput*>::iterator i = this->streams.begin(); i != this->streams.end(); i++)
         {
-            int k = (*i)->puts(s);
+            int k = (*i)->puts(s, size);
             if (k > r)
                 r = k;
         }
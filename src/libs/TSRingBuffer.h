@@ -4,25 +4,27 @@
 //  Thread safe for single Producer and single Consumer.
 //  By Dennis Lang http://home.comcast.net/~lang.dennis/code/ring/ring.html
 //  Slightly modified for naming
+//
+//  The size must be a power of two so the indexes wrap with a mask instead of a divide,
+//  the producer only ever writes m_wIndex and the consumer only m_rIndex.
 
 #pragma once
 
+#include <stddef.h>
+
 template <class T, size_t RingSize>
 class TSRingBuffer
 {
+    static_assert(RingSize >= 2 && (RingSize & (RingSize - 1)) == 0, "TSRingBuffer size must be a power of two");
+
 public:
     TSRingBuffer()
-        : m_size(RingSize), m_buffer(new T[RingSize]), m_rIndex(0), m_wIndex(0)
+        : m_rIndex(0), m_wIndex(0)
     { }
 
-    ~TSRingBuffer()
-    {
-        delete [] m_buffer;
-    };
-
     size_t next(size_t n) const
     {
-        return (n + 1) % m_size;
+        return (n + 1) & (RingSize - 1);
     }
 
     bool empty() const
@@ -35,30 +37,119 @@ public:
         return (next(m_wIndex) == m_rIndex);
     }
 
+    size_t size() const
+    {
+        return (m_wIndex - m_rIndex) & (RingSize - 1);
+    }
+
+    size_t capacity() const
+    {
+        return RingSize - 1;
+    }
+
+    // producer side
     bool put(const T &value)
     {
-        if (full())
+        size_t w = m_wIndex;
+        if (next(w) == m_rIndex)
             return false;
-        m_buffer[m_wIndex] = value;
-        m_wIndex = next(m_wIndex);
+        m_buffer[w] = value;
+        barrier(); // the value must be in the buffer before the consumer can see the new index
+        m_wIndex = next(w);
         return true;
     }
 
+    // consumer side
     bool get(T &value)
     {
-        if (empty())
+        size_t r = m_rIndex;
+        if (r == m_wIndex)
             return false;
-        value = m_buffer[m_rIndex];
-        m_rIndex = next(m_rIndex);
+        value = m_buffer[r];
+        barrier(); // and read out before the producer can reuse the slot
+        m_rIndex = next(r);
         return true;
     }
 
+    // consumer side, drops everything that has been put so far
+    void flush()
+    {
+        m_rIndex = m_wIndex;
+    }
+
 private:
-    size_t          m_size;
-    T              *m_buffer;
+    // on a single core the hardware does not reorder what the other side sees, only the compiler can
+    static inline void barrier() { __asm__ __volatile__ ("" ::: "memory"); }
+
+    T               m_buffer[RingSize];
 
     // volatile is only used to keep compiler from placing values in registers.
     // volatile does NOT make the index thread safe.
     volatile size_t m_rIndex;
     volatile size_t m_wIndex;
 };
+
+//  Receive buffer for the consoles, the producer (the receive interrupt) counts the newlines it puts
+//  and the consumer the ones it gets, so a complete line waiting is known without scanning for it.
+template <size_t RingSize>
+class TSLineBuffer : public TSRingBuffer<char, RingSize>
+{
+public:
+    TSLineBuffer()
+        : m_linesIn(0), m_linesOut(0)
+    { }
+
+    // producer side
+    bool put(char c)
+    {
+        if (!TSRingBuffer<char, RingSize>::put(c))
+            return false;
+        if (c == '\n')
+            m_linesIn = m_linesIn + 1;
+        return true;
+    }
+
+    // consumer side
+    bool get(char &c)
+    {
+        if (!TSRingBuffer<char, RingSize>::get(c))
+            return false;
+        if (c == '\n')
+            m_linesOut = m_linesOut + 1;
+        return true;
+    }
+
+    bool has_line() const
+    {
+        return m_linesIn != m_linesOut;
+    }
+
+    // consumer side, a full buffer with no newline in it can never complete a line so throw it away
+    bool overflowed() const
+    {
+        return !has_line() && this->full();
+    }
+
+    // consumer side, gets what is there now so the newline counts stay right if more comes in meanwhile
+    void flush()
+    {
+        char c;
+        for (size_t n = this->size(); n > 0 && get(c); --n) ;
+    }
+
+    // reads the next line into s without the newline, returns false if there is no complete line yet
+    template <class S>
+    bool get_line(S &s)
+    {
+        if (!has_line())
+            return false;
+        char c;
+        while (get(c) && c != '\n')
+            s += c;
+        return true;
+    }
+
+private:
+    volatile unsigned int m_linesIn;
+    volatile unsigned int m_linesOut;
+};
@@ -0,0 +1,38 @@
+#include "Task.h"
+
+#include <vector>
+
+namespace {
+    std::vector<Task *> tasks;
+    bool stepping = false;
+}
+
+void Task::start(Task *task)
+{
+    tasks.push_back(task);
+}
+
+void Task::run_all()
+{
+    // a task waiting on something that runs the main loop itself would otherwise be stepped inside its own step
+    if (stepping) return;
+    stepping = true;
+
+    // tasks started by a step are appended and get their first step this pass too
+    for (size_t i = 0; i < tasks.size(); ) {
+        Task *t = tasks[i];
+        if (t->step()) {
+            ++i;
+        } else {
+            tasks.erase(tasks.begin() + i);
+            delete t;
+        }
+    }
+
+    stepping = false;
+}
+
+size_t Task::running()
+{
+    return tasks.size();
+}
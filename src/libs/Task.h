@@ -0,0 +1,51 @@
+#ifndef _TASK_H
+#define _TASK_H
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Long operations as tasks that give the main loop back, rather than calling ON_IDLE from inside their loops which
+ * runs every idle handler nested inside whatever called them. A task is started and then stepped once every main
+ * loop pass until it ends, a step does a bounded piece of the work and yields.
+ *
+ * step() is written as one function that carries on where it yielded, protothread style:
+ *
+ *     bool step()
+ *     {
+ *         TASK_BEGIN();
+ *         while (more()) {
+ *             do_some();
+ *             TASK_YIELD();
+ *         }
+ *         TASK_WAIT_UNTIL(THECONVEYOR->is_idle());
+ *         TASK_END();
+ *     }
+ *
+ * Locals do not survive a yield, anything kept from one step to the next has to be a member. A switch cannot be
+ * used around a yield either, as the macros are its cases.
+ */
+class Task {
+    public:
+        virtual ~Task() {}
+
+        // takes the task over and steps it from the main loop until it ends, then deletes it
+        static void start(Task *task);
+        // one step of every task, the kernel calls it at the end of each main loop pass
+        static void run_all();
+        static size_t running();
+
+    protected:
+        Task() : resume_at(0) {}
+        // runs up to the next yield and returns true, or up to TASK_END() and returns false
+        virtual bool step() = 0;
+
+        uint16_t resume_at;
+};
+
+#define TASK_BEGIN() switch (resume_at) { case 0:
+#define TASK_YIELD() do { resume_at = __LINE__; return true; case __LINE__:; } while (0)
+#define TASK_WAIT_UNTIL(cond) do { resume_at = __LINE__; case __LINE__: if (!(cond)) return true; } while (0)
+#define TASK_END() } resume_at = 0; return false
+
+#endif /* _TASK_H */
@@ -21,6 +21,9 @@
 #include "PublicDataRequest.h"
 #include "MSCFileSystemPublicAccess.h"
 #include "libs/Pin.h"
+#include "platform_memory.h"
+
+#include <string.h>
 
 #define usb_en_pin_checksum              			CHECKSUM("usb_en_pin")
 #define usb_in_pin_checksum              			CHECKSUM("usb_in_pin")
@@ -30,6 +33,9 @@
 MSCFileSystem::MSCFileSystem(const char* name) :
   FATFileSystem(name)
 {
+    _cache = NULL;
+    _cache_block = 0;
+    _cache_count = 0;
 }
 
 void print_inquiry(USB_INT08U *inqReply)
@@ -108,24 +114,67 @@ int MSCFileSystem::initialise_msc()
 
 int MSCFileSystem::disk_initialize()
 {
+    // whatever is plugged in now is not what was read ahead before
+    _cache_count = 0;
     if ( initialise_msc() != OK )
         return 1;
-        
+
+    if ( _cache == NULL )
+        _cache = (char *)AHB.alloc(READ_AHEAD_BLOCKS * 512);
+
     return 0;
 }
 
 int MSCFileSystem::disk_write(const char *buffer, uint32_t block_number, uint32_t count)
 {
-    if ( OK == MS_BulkSend(block_number, 1, (USB_INT08U *)buffer) )
-        return 0;
-    return 1;
+    if ( _cache_count != 0 && block_number < _cache_block + _cache_count && _cache_block < block_number + count )
+        _cache_count = 0;
+
+    while ( count > 0 ) {
+        uint32_t n = count < MS_MAX_TRANSFER_BLOCKS ? count : MS_MAX_TRANSFER_BLOCKS;
+        if ( OK != MS_BulkSend(block_number, n, (USB_INT08U *)buffer) )
+            return 1;
+        buffer += n * 512;
+        block_number += n;
+        count -= n;
+    }
+    return 0;
+}
+
+int MSCFileSystem::read_blocks(char *buffer, uint32_t block_number, uint32_t count)
+{
+    while ( count > 0 ) {
+        uint32_t n = count < MS_MAX_TRANSFER_BLOCKS ? count : MS_MAX_TRANSFER_BLOCKS;
+        if ( OK != MS_BulkRecv(block_number, n, (USB_INT08U *)buffer) )
+            return 1;
+        buffer += n * 512;
+        block_number += n;
+        count -= n;
+    }
+    return 0;
 }
 
 int MSCFileSystem::disk_read(char *buffer, uint32_t block_number, uint32_t count)
 {
-    if ( OK == MS_BulkRecv(block_number, 1, (USB_INT08U *)buffer) )
-        return 0;
-    return 1;
+    // multi sector reads already come in whole transfers, only short ones gain from the read ahead
+    if ( _cache == NULL || count >= READ_AHEAD_BLOCKS )
+        return read_blocks(buffer, block_number, count);
+
+    if ( _cache_count == 0 || block_number < _cache_block || block_number + count > _cache_block + _cache_count ) {
+        uint32_t n = READ_AHEAD_BLOCKS;
+        if ( block_number + n > _numBlks )
+            n = _numBlks - block_number;
+        if ( n < count )
+            return read_blocks(buffer, block_number, count);
+        _cache_count = 0;
+        if ( read_blocks(_cache, block_number, n) != 0 )
+            return 1;
+        _cache_block = block_number;
+        _cache_count = n;
+    }
+
+    memcpy(buffer, _cache + (block_number - _cache_block) * 512, count * 512);
+    return 0;
 }
 
 
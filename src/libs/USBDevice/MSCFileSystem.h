@@ -11,6 +11,7 @@
 #include "usbhost_cpu.h"
 #include "FATFileSystem.h"
 #include "Module.h"
+#include "usbhost_ms.h"
 
 /* Class: MSCFileSystem
  *  Access the filesystem on an attached USB mass storage device (e.g. a memory stick)
@@ -51,8 +52,16 @@ public:
 protected:
 
     int initialise_msc();
+    int read_blocks(char *buffer, uint32_t block_number, uint32_t count);
     USB_INT32U _numBlks;
     USB_INT32U _blkSize;
+
+    // a single sector read fetches the sectors after it too, as every transfer costs a command and status
+    // round trip whatever its size. it has to be in AHB RAM for the USB DMA, without it there is no read ahead
+    static const uint32_t READ_AHEAD_BLOCKS = MS_MAX_TRANSFER_BLOCKS;
+    char *_cache;
+    uint32_t _cache_block;
+    uint32_t _cache_count;
 };
 
 #endif
@@ -18,6 +18,16 @@
 #include "diskio.h"
 #include "pinmap.h"
 #include "SDCRC.h"
+#include "Gpdma.h"
+#include "EventTrace.h"
+#include "Counters.h"
+
+//GPDMA channels used for the data phase, RX has the higher priority so the SSP RX FIFO does not overrun
+#define SD_DMA_RX_CHANNEL       6
+#define SD_DMA_TX_CHANNEL       7
+#define SD_DMA_RX               LPC_GPDMACH6
+#define SD_DMA_TX               LPC_GPDMACH7
+#define SD_DMA_CHANNEL_MASK     ((1 << SD_DMA_RX_CHANNEL) | (1 << SD_DMA_TX_CHANNEL))
 
 SDFileSystem::SDFileSystem(PinName mosi, PinName miso, PinName sclk, PinName cs, int hz) : 
 	  m_Spi(mosi, miso, sclk),
@@ -33,7 +43,12 @@ SDFileSystem::SDFileSystem(PinName mosi, PinName miso, PinName sclk, PinName cs,
     m_Crc = false;
     m_LargeFrames = false;
     m_WriteValidation = true;
+    m_Dma = false;
     m_Status = STA_NOINIT;
+    m_BytesRead = 0;
+    m_BytesWritten = 0;
+    Counters::add("sd_read_bytes", &m_BytesRead);
+    Counters::add("sd_write_bytes", &m_BytesWritten);
 
     //Enable the internal pull-up resistor on MISO
     pin_mode(miso, PullUp);
@@ -134,6 +149,23 @@ void SDFileSystem::write_validation(bool enabled)
     m_WriteValidation = enabled;
 }
 
+bool SDFileSystem::dma()
+{
+    //Return whether or not DMA is enabled
+    return m_Dma;
+}
+
+void SDFileSystem::dma(bool enabled)
+{
+    //Claim our channels, staying on programmed I/O if something else has them
+    if (enabled && !m_Dma)
+        m_Dma = Gpdma::claim(SD_DMA_CHANNEL_MASK);
+    else if (!enabled && m_Dma) {
+        Gpdma::release(SD_DMA_CHANNEL_MASK);
+        m_Dma = false;
+    }
+}
+
 int SDFileSystem::unmount()
 {
     //Unmount the filesystem
@@ -349,11 +381,12 @@ int SDFileSystem::disk_read(char *buffer, uint32_t sector, uint32_t count)
         return RES_NOTRDY;
 
     //Read a single block, or multiple blocks
-    if (count > 1) {
-        return readBlocks((char*)buffer, sector, count) ? RES_OK : RES_ERROR;
-    } else {
-        return readBlock((char*)buffer, sector) ? RES_OK : RES_ERROR;
-    }
+    EventTrace::begin(EventTrace::SD_READ, count);
+    bool ok = count > 1 ? readBlocks((char*)buffer, sector, count) : readBlock((char*)buffer, sector);
+    EventTrace::end(EventTrace::SD_READ, count);
+    if (ok)
+        m_BytesRead += count * 512;
+    return ok ? RES_OK : RES_ERROR;
 }
 
 int SDFileSystem::disk_write(const char *buffer, uint32_t sector, uint32_t count)
@@ -367,11 +400,10 @@ int SDFileSystem::disk_write(const char *buffer, uint32_t sector, uint32_t count
         return RES_WRPRT;
 
     //Write a single block, or multiple blocks
-    if (count > 1) {
-        return writeBlocks((const char*)buffer, sector, count) ? RES_OK : RES_ERROR;
-    } else {
-        return writeBlock((const char*)buffer, sector) ? RES_OK : RES_ERROR;
-    }
+    bool ok = count > 1 ? writeBlocks((const char*)buffer, sector, count) : writeBlock((const char*)buffer, sector);
+    if (ok)
+        m_BytesWritten += count * 512;
+    return ok ? RES_OK : RES_ERROR;
 }
 
 int SDFileSystem::disk_sync()
@@ -429,7 +461,7 @@ uint32_t SDFileSystem::disk_sectors()
 }
 uint64_t SDFileSystem::disk_size() { return ((uint64_t)disk_sectors() << 9); }
 uint32_t SDFileSystem::disk_blocksize() { return (1<<9); }
-bool SDFileSystem::disk_canDMA() { return false; }
+bool SDFileSystem::disk_canDMA() { return m_Dma; }
 	
 bool SDFileSystem::busy()
 {
@@ -634,6 +666,14 @@ bool SDFileSystem::readData(char* buffer, int length)
 
         //Switch back to 8-bit frames
         m_Spi.format(8, 0);
+    } else if (m_Dma && length == 512) {
+        //Let the GPDMA clock the data block into the buffer
+        if (!dmaTransfer(buffer, NULL, length))
+            return false;
+
+        //Read the CRC16 checksum for the data block
+        crc = (m_Spi.write(0xFF) << 8);
+        crc |= m_Spi.write(0xFF);
     } else {
         //Read the data into the buffer
         for (int i = 0; i < length; i++)
@@ -674,6 +714,14 @@ char SDFileSystem::writeData(const char* buffer, char token)
 
         //Switch back to 8-bit frames
         m_Spi.format(8, 0);
+    } else if (m_Dma) {
+        //Let the GPDMA clock the data block out, a partial block can not be recovered so report a write error
+        if (!dmaTransfer(NULL, buffer, 512))
+            return 0x0C;
+
+        //Send the CRC16 checksum for the data block
+        m_Spi.write(crc >> 8);
+        m_Spi.write(crc);
     } else {
         //Write the data block from the buffer
         for (int i = 0; i < 512; i++)
@@ -688,6 +736,54 @@ char SDFileSystem::writeData(const char* buffer, char token)
     return (m_Spi.write(0xFF) & 0x1F);
 }
 
+bool SDFileSystem::dmaTransfer(char* rxBuffer, const char* txBuffer, int length)
+{
+    //Clock out 0xFF when reading, and throw away the received bytes when writing
+    static const char fill = 0xFF;
+    static char sink;
+
+    LPC_SSP_TypeDef* ssp = m_Spi.ssp();
+    int txRequest = (ssp == LPC_SSP0) ? 0 : 2;
+    int rxRequest = txRequest + 1;
+
+    //Clear any stale status on our channels
+    LPC_GPDMA->DMACIntTCClear = SD_DMA_CHANNEL_MASK;
+    LPC_GPDMA->DMACIntErrClr = SD_DMA_CHANNEL_MASK;
+
+    //Peripheral to memory, single byte transfers, increment the destination only when there is a buffer
+    SD_DMA_RX->DMACCSrcAddr = (uint32_t)&ssp->DR;
+    SD_DMA_RX->DMACCDestAddr = (uint32_t)(rxBuffer ? rxBuffer : &sink);
+    SD_DMA_RX->DMACCLLI = 0;
+    SD_DMA_RX->DMACCControl = (length & 0xFFF) | (rxBuffer ? (1UL << 27) : 0);
+    SD_DMA_RX->DMACCConfig = 1 | (rxRequest << 1) | (2 << 11);
+
+    //Memory to peripheral, increment the source only when there is a buffer
+    SD_DMA_TX->DMACCSrcAddr = (uint32_t)(txBuffer ? txBuffer : &fill);
+    SD_DMA_TX->DMACCDestAddr = (uint32_t)&ssp->DR;
+    SD_DMA_TX->DMACCLLI = 0;
+    SD_DMA_TX->DMACCControl = (length & 0xFFF) | (txBuffer ? (1UL << 26) : 0);
+    SD_DMA_TX->DMACCConfig = 1 | (txRequest << 6) | (1 << 11);
+
+    //Start the transfer, the core is free to service interrupts without stalling the bus while we wait
+    ssp->DMACR = 0x03;
+    m_Timer.start();
+    while ((SD_DMA_RX->DMACCConfig & 1) && m_Timer.read_ms() < 500);
+    m_Timer.stop();
+    m_Timer.reset();
+    ssp->DMACR = 0;
+
+    bool ok = !(SD_DMA_RX->DMACCConfig & 1) && !(LPC_GPDMA->DMACRawIntErrStat & SD_DMA_CHANNEL_MASK);
+    if (!ok) {
+        //Something went wrong, stop the channels and fall back to programmed I/O from now on
+        Gpdma::release(SD_DMA_CHANNEL_MASK);
+        while (ssp->SR & (1 << 2))
+            (void)ssp->DR;
+        m_Dma = false;
+    }
+
+    return ok;
+}
+
 inline bool SDFileSystem::readBlock(char* buffer, unsigned int lba)
 {
     //Try to read the block up to 3 times
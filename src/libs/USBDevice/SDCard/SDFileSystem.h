@@ -162,6 +162,22 @@ public:
      */
     void write_validation(bool enabled);
 
+    /** Get whether or not GPDMA is used for the data phase of block read/write operations
+     *
+     * @returns
+     *   'true' if data blocks are transferred by GPDMA,
+     *   'false' if data blocks are transferred by programmed I/O.
+     */
+    bool dma();
+
+    /** Set whether or not GPDMA is used for the data phase of block read/write operations
+     *
+     * @param enabled Whether or not to use GPDMA for data blocks.
+     *
+     * @note Only used with 8-bit frames, large frames always use programmed I/O.
+     */
+    void dma(bool enabled);
+
     virtual int unmount();
     virtual int disk_initialize();
     virtual int disk_write(const char *buffer, uint32_t sector, uint32_t count);
@@ -198,9 +214,17 @@ private:
         CMD59 = (0x40 | 59)     /**< CRC_ON_OFF */
     };
 
+    //SPI with access to the underlying SSP peripheral so the data phase can be done by GPDMA
+    class DmaSPI : public mbed::SPI
+    {
+    public:
+        DmaSPI(PinName mosi, PinName miso, PinName sclk) : mbed::SPI(mosi, miso, sclk) {}
+        LPC_SSP_TypeDef* ssp() { return _spi.spi; }
+    };
+
     //Member variables
     Timer m_Timer;
-    mbed::SPI m_Spi;
+    DmaSPI m_Spi;
     GPIO m_Cs;
     InterruptIn m_Cd;
     int m_CdAssert;
@@ -209,7 +233,10 @@ private:
     bool m_Crc;
     bool m_LargeFrames;
     bool m_WriteValidation;
+    bool m_Dma;
     int m_Status;
+    uint32_t m_BytesRead;
+    uint32_t m_BytesWritten;
 
     //Internal methods
     void onCardRemoval();
@@ -220,6 +247,7 @@ private:
     char commandTransaction(char cmd, unsigned int arg, unsigned int* resp = NULL);
     char writeCommand(char cmd, unsigned int arg, unsigned int* resp = NULL);
     bool readData(char* buffer, int length);
+    bool dmaTransfer(char* rxBuffer, const char* txBuffer, int length);
     char writeData(const char* buffer, char token);
     bool readBlock(char* buffer, unsigned int lba);
     bool readBlocks(char* buffer, unsigned int lba, unsigned int count);
@@ -23,6 +23,7 @@
 */
 
 #include  "usbhost_lpc17xx.h"
+#include  "IrqPriority.h"
 
 /*
 **************************************************************************************************************
@@ -200,7 +201,7 @@ void  Host_Init (void)
                          OR_INTR_ENABLE_WDH |
                          OR_INTR_ENABLE_RHSC;
 
-    NVIC_SetPriority(USB_IRQn, 0);       /* highest priority */
+    IrqPriority::apply(USB_IRQn);        /* below the step ticker, a stick transfer must not delay steps */
     /* Enable the USB Interrupt */
     NVIC_EnableIRQ(USB_IRQn);
     PRINT_Log("Host Initialized\n");
@@ -327,6 +328,7 @@ USB_INT32S  Host_ProcessTD (volatile  HCED       *ed,
     TDHead->BufEnd       = (USB_INT32U)(buffer + (buffer_len - 1));
     TDTail->BufEnd       = 0;
 
+    HOST_WdhIntr = 0;
     ed->HeadTd  = (USB_INT32U)TDHead | ((ed->HeadTd) & 0x00000002);
     ed->TailTd  = (USB_INT32U)TDTail;
     ed->Next    = 0;
@@ -341,8 +343,11 @@ USB_INT32S  Host_ProcessTD (volatile  HCED       *ed,
         LPC_USB->HcControl       = LPC_USB->HcControl       | OR_CONTROL_BLE;
     }    
 
-    // Host_WDHWait();
-    Host_DelayMS(100);
+    // wait for the writeback done head instead of a fixed 100ms per TD, which was most of the time of
+    // every transfer, but not forever as Host_WDHWait() would when the device has gone
+    if (!Host_WDHWaitMS(TD_TIMEOUT_MS)) {
+        return (ERR_TD_FAIL);
+    }
 
 //    if (!(TDHead->Control & 0xF0000000)) {
     if (!HOST_TDControlStatus) {
@@ -629,6 +634,34 @@ void  Host_WDHWait (void)
   HOST_WdhIntr = 0;
 }
 
+/*
+**************************************************************************************************************
+*                                         WAIT FOR WDH INTERRUPT WITH TIMEOUT
+*
+* Description: This function waits for a WDH interrupt for at most the given time
+*
+* Arguments  : delay    The longest wait in milli seconds
+*
+* Returns    : 1 if the interrupt came, 0 on a timeout
+*
+**************************************************************************************************************
+*/
+
+USB_INT32S  Host_WDHWaitMS (USB_INT32U  delay)
+{
+    USB_INT32U  i;
+
+
+    for (i = 0; i < delay * 100; i++) {
+        if (HOST_WdhIntr) {
+            HOST_WdhIntr = 0;
+            return (1);
+        }
+        Host_DelayUS(10);
+    }
+    return (0);
+}
+
 /*
 **************************************************************************************************************
 *                                         READ LE 32U
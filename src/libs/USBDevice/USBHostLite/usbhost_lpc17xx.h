@@ -126,6 +126,7 @@
 #define  TD_TOGGLE_0        (USB_INT32U)(0x02000000)         /* Toggle 0                                    */
 #define  TD_TOGGLE_1        (USB_INT32U)(0x03000000)         /* Toggle 1                                    */
 #define  TD_CC              (USB_INT32U)(0xF0000000)         /* Completion Code                             */
+#define  TD_TIMEOUT_MS      1000                             /* Longest wait for a TD to be retired         */
 
 /*
 **************************************************************************************************************
@@ -236,6 +237,7 @@ void        Host_FillSetup(          USB_INT08U   bm_request_type,
 
 
 void        Host_WDHWait  (void);
+USB_INT32S  Host_WDHWaitMS(          USB_INT32U    delay);
 
 
 USB_INT32U  ReadLE32U     (volatile  USB_INT08U  *pmem);
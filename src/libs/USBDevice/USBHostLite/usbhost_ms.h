@@ -49,6 +49,7 @@
 #define  CSW_SIGNATURE               0x53425355
 #define  CBW_SIZE                      31
 #define  CSW_SIZE                      13
+#define  MS_MAX_TRANSFER_BLOCKS         8              /* 4K, one TD buffer can only span two 4K pages */
 #define  CSW_CMD_PASSED              0x00
 #define  SCSI_CMD_REQUEST_SENSE      0x03
 #define  SCSI_CMD_TEST_UNIT_READY    0x00
@@ -1,5 +1,6 @@
 #include "Watchdog.h"
 #include "Kernel.h"
+#include "IrqPriority.h"
 
 #include <lpc17xx_wdt.h>
 
@@ -19,7 +20,7 @@ Watchdog::Watchdog(uint32_t timeout, WDT_ACTION action)
     if(action == WDT_MRI) {
         // enable the interrupt
         NVIC_EnableIRQ(WDT_IRQn);
-        NVIC_SetPriority(WDT_IRQn, 1);
+        IrqPriority::apply(WDT_IRQn);
     }
 }
 
@@ -0,0 +1,171 @@
+/*
+      This file is part of Smoothie (http://smoothieware.org/). The motion control part is heavily based on Grbl (https://github.com/simen/grbl).
+      Smoothie is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+      Smoothie is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+      You should have received a copy of the GNU General Public License along with Smoothie. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "WriteQueue.h"
+
+#include "libs/Kernel.h"
+#include "mbed.h" // for us_ticker_read()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+WriteQueue *WriteQueue::instance = nullptr;
+
+WriteQueue::WriteQueue()
+{
+    memset(entries, 0, sizeof(entries));
+    busy = false;
+    instance = this;
+}
+
+WriteQueue::~WriteQueue()
+{
+    sync();
+    if(instance == this) instance = nullptr;
+}
+
+void WriteQueue::on_module_loaded()
+{
+    this->register_for_event(ON_IDLE);
+}
+
+void WriteQueue::on_idle(void *)
+{
+    // on_idle also runs from wait loops, which may be inside one of our own writes
+    if(busy) return;
+
+    // one file per call keeps each idle short
+    uint32_t now = us_ticker_read();
+    for(int i = 0; i < MAX_ENTRIES; i++) {
+        entry_t &e = entries[i];
+        if(e.name != nullptr && now - e.last >= FLUSH_DELAY_US) {
+            flush(e);
+            return;
+        }
+    }
+}
+
+bool WriteQueue::append(const char *filename, const void *data, size_t len)
+{
+    if(instance == nullptr || !instance->queue(filename, data, len, false)) {
+        return write_file(filename, data, len, false);
+    }
+    return true;
+}
+
+bool WriteQueue::replace(const char *filename, const void *data, size_t len)
+{
+    if(instance == nullptr || !instance->queue(filename, data, len, true)) {
+        return write_file(filename, data, len, true);
+    }
+    return true;
+}
+
+bool WriteQueue::sync(const char *filename)
+{
+    if(instance == nullptr) return true;
+
+    bool ok = true;
+    for(int i = 0; i < MAX_ENTRIES; i++) {
+        entry_t &e = instance->entries[i];
+        if(e.name != nullptr && (filename == nullptr || strcasecmp(e.name, filename) == 0)) {
+            ok &= instance->flush(e);
+        }
+    }
+    return ok;
+}
+
+WriteQueue::entry_t *WriteQueue::find(const char *filename)
+{
+    for(int i = 0; i < MAX_ENTRIES; i++) {
+        if(entries[i].name != nullptr && strcasecmp(entries[i].name, filename) == 0) return &entries[i];
+    }
+    return nullptr;
+}
+
+// returns false if the data could not be held, in which case anything queued for the file has been written
+bool WriteQueue::queue(const char *filename, const void *data, size_t len, bool truncate)
+{
+    entry_t *e = find(filename);
+    if(len > MAX_PENDING) {
+        // too big to hold, what is queued goes first so the file stays in order
+        if(e != nullptr) {
+            if(truncate) drop(*e);
+            else flush(*e);
+        }
+        return false;
+    }
+
+    if(e == nullptr) {
+        for(int i = 0; i < MAX_ENTRIES && e == nullptr; i++) {
+            if(entries[i].name == nullptr) e = &entries[i];
+        }
+        if(e == nullptr) return false;
+        e->name = strdup(filename);
+        if(e->name == nullptr) return false;
+        e->len = 0;
+        e->truncate = false;
+    }
+
+    if(truncate) {
+        e->len = 0;
+        e->truncate = true;
+    }
+
+    if(e->len + len > e->cap) {
+        if(e->len + len > MAX_PENDING) {
+            // too much to hold, write what there is and start again with this
+            if(!flush(*e)) return false;
+            return queue(filename, data, len, truncate);
+        }
+        // grow in steps so a log of short lines does not realloc every line
+        size_t cap = (e->len + len + 255) & ~255;
+        char *d = (char *)realloc(e->data, cap);
+        if(d == nullptr) {
+            flush(*e);
+            return false;
+        }
+        e->data = d;
+        e->cap = cap;
+    }
+
+    memcpy(e->data + e->len, data, len);
+    e->len += len;
+    e->last = us_ticker_read();
+    return true;
+}
+
+bool WriteQueue::flush(entry_t &e)
+{
+    busy = true;
+    bool ok = write_file(e.name, e.data, e.len, e.truncate);
+    busy = false;
+
+    drop(e);
+    return ok;
+}
+
+void WriteQueue::drop(entry_t &e)
+{
+    free(e.name);
+    free(e.data);
+    memset(&e, 0, sizeof(e));
+}
+
+bool WriteQueue::write_file(const char *filename, const void *data, size_t len, bool truncate)
+{
+    if(len == 0 && !truncate) return true;
+
+    FILE *fp = fopen(filename, truncate ? "w" : "a");
+    if(fp == NULL) return false;
+
+    bool ok = fwrite(data, 1, len, fp) == len;
+    ok &= fclose(fp) == 0;
+    return ok;
+}
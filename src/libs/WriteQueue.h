@@ -0,0 +1,68 @@
+/*
+      This file is part of Smoothie (http://smoothieware.org/). The motion control part is heavily based on Grbl (https://github.com/simen/grbl).
+      Smoothie is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+      Smoothie is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+      You should have received a copy of the GNU General Public License along with Smoothie. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef WRITEQUEUE_H
+#define WRITEQUEUE_H
+
+#include "Module.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Small files written from the main loop are held in RAM and written out from on_idle,
+ * so a slow SD card does not stall whatever asked for the write.
+ *
+ * Appends to the same file are batched into one write, a replace drops anything still
+ * queued for the file and writes the whole new contents. A file is written once nothing
+ * has been added to it for a little while, or straight away when it can not be held.
+ *
+ * sync() is the barrier for callers that have to know the data is on the card, and
+ * anything that reads a file that may be queued should sync() it first.
+ *
+ * Without the module loaded, or when there is no room, writes are done synchronously.
+ */
+class WriteQueue : public Module {
+    public:
+        WriteQueue();
+        virtual ~WriteQueue();
+
+        void on_module_loaded();
+        void on_idle(void *);
+
+        static bool append(const char *filename, const void *data, size_t len);
+        static bool replace(const char *filename, const void *data, size_t len);
+        // write out what is queued for filename, or for every file if it is null, false if a write failed
+        static bool sync(const char *filename = nullptr);
+
+    private:
+        struct entry_t {
+            char *name;
+            char *data;
+            size_t len;
+            size_t cap;
+            uint32_t last;      // us_ticker_read() of the last change
+            bool truncate;      // the file is rewritten rather than appended to
+        };
+
+        static const int MAX_ENTRIES = 4;
+        static const size_t MAX_PENDING = 8192;
+        static const uint32_t FLUSH_DELAY_US = 500000;
+
+        bool queue(const char *filename, const void *data, size_t len, bool truncate);
+        entry_t *find(const char *filename);
+        bool flush(entry_t &e);
+        void drop(entry_t &e);
+        static bool write_file(const char *filename, const void *data, size_t len, bool truncate);
+
+        static WriteQueue *instance;
+
+        entry_t entries[MAX_ENTRIES];
+        bool busy;
+};
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef _CRC16_H_
+#define _CRC16_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+// CRC16-CCITT (polynomial 0x1021, initial value 0) as used by XMODEM and the eeprom settings,
+// pass the previous result as crc to continue over data that arrives in pieces
+uint16_t crc16_ccitt(const void *data, size_t len, uint16_t crc = 0);
+
+#endif
@@ -7,4 +7,12 @@
 
 extern MemoryPool* _ahb;
 
+// code the step interrupts run, placed with .data so the reset handler copies it to the local SRAM where it runs
+// without flash wait states or accelerator misses. Calls between it and flash go through linker veneers
+#if defined(__arm__) && !defined(NO_RAMFUNC)
+#define RAMFUNC __attribute__((section(".ramfunc"), noinline))
+#else
+#define RAMFUNC
+#endif
+
 #endif /* _PLATFORM_MEMORY_H */
@@ -10,6 +10,8 @@
 #include "system_LPC17xx.h"
 #include "LPC17xx.h"
 #include "utils.h"
+#include "FixedFormat.h"
+#include "HomeRecord.h"
 
 #include <string>
 #include <cstring>
@@ -191,6 +193,8 @@ void system_reset( bool dfu )
         LPC_WDT->WDFEED = 0xAA;                 // Kick the dog!
         LPC_WDT->WDFEED = 0x55;
     } else {
+        // the position is only worth keeping if the same firmware comes back up
+        HomeRecord::save();
         NVIC_SystemReset();
     }
 }
@@ -274,6 +278,81 @@ std::string change_to_lz_path( std::string origin )
 	return "/sd/gcodes/.lz/" + filename;
 }
 
+// The md5 of a file as it was written, kept next to the md5 the host sent so md5sum does not have to read the file again
+std::string change_to_digest_path( std::string origin )
+{
+	return change_to_md5_path(origin) + ".sum";
+}
+
+// decodes up to max bytes, stopping at the padding or the first character that is not base64, returns how many
+size_t base64_decode(const char *in, uint8_t *out, size_t max)
+{
+    uint32_t acc = 0;
+    int bits = 0;
+    size_t n = 0;
+    for (; *in != '\0' && n < max; in++) {
+        char c = *in;
+        int v;
+        if (c >= 'A' && c <= 'Z') v = c - 'A';
+        else if (c >= 'a' && c <= 'z') v = c - 'a' + 26;
+        else if (c >= '0' && c <= '9') v = c - '0' + 52;
+        else if (c == '+') v = 62;
+        else if (c == '/') v = 63;
+        else break;
+        acc = (acc << 6) | v;
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            out[n++] = (acc >> bits) & 0xFF;
+        }
+    }
+    return n;
+}
+
+std::string change_to_scan_path( std::string origin )
+{
+	return change_to_md5_path(origin) + ".scan";
+}
+
+// the size is saved with the digest so a file that has been rewritten some other way is not trusted
+bool save_file_digest( const std::string &filename, const std::string &digest )
+{
+	if (filename.find("gcodes/") == string::npos) return false;
+	FILE *fp = fopen(filename.c_str(), "rb");
+	if (fp == NULL) return false;
+	fseek(fp, 0, SEEK_END);
+	long size = ftell(fp);
+	fclose(fp);
+
+	fp = fopen(change_to_digest_path(filename).c_str(), "w");
+	if (fp == NULL) return false;
+	fprintf(fp, "%s %ld\n", digest.c_str(), size);
+	fclose(fp);
+	return true;
+}
+
+bool load_file_digest( const std::string &filename, std::string &digest )
+{
+	if (filename.find("gcodes/") == string::npos) return false;
+	FILE *fp = fopen(change_to_digest_path(filename).c_str(), "r");
+	if (fp == NULL) return false;
+	char hex[33];
+	long size = -1;
+	int n = fscanf(fp, "%32s %ld", hex, &size);
+	fclose(fp);
+	if (n != 2) return false;
+
+	fp = fopen(filename.c_str(), "rb");
+	if (fp == NULL) return false;
+	fseek(fp, 0, SEEK_END);
+	long actual = ftell(fp);
+	fclose(fp);
+	if (actual != size) return false;
+
+	digest = hex;
+	return true;
+}
+
 
 // Check the quicklz/md5 file path
 #define	FR_OK 0
@@ -338,9 +417,13 @@ int append_parameters(char *buf, std::vector<std::pair<char,float>> params, size
 {
     size_t n= 0;
     for(auto &i : params) {
-        if(n >= bufsize) break;
+        if(n + 1 >= bufsize) break;
         buf[n++]= i.first;
-        n += snprintf(&buf[n], bufsize-n, "%1.4f ", i.second);
+        n += format_fixed(&buf[n], bufsize-n, i.second, 4);
+        if(n + 1 < bufsize) {
+            buf[n++]= ' ';
+            buf[n]= '\0';
+        }
     }
     return n;
 }
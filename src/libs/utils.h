@@ -19,6 +19,8 @@ std::vector<uint32_t> parse_number_list(const char *str, uint8_t radix);
 
 std::string remove_non_number( std::string str );
 
+size_t base64_decode(const char *in, uint8_t *out, size_t max);
+
 uint16_t get_checksum(const std::string& to_check);
 uint16_t get_checksum(const char* to_check);
 
@@ -35,6 +37,10 @@ void system_reset( bool dfu= false );
 std::string absolute_from_relative( std::string path );
 std::string change_to_md5_path( std::string origin );
 std::string change_to_lz_path( std::string origin );
+std::string change_to_digest_path( std::string origin );
+std::string change_to_scan_path( std::string origin );
+bool save_file_digest( const std::string &filename, const std::string &digest );
+bool load_file_digest( const std::string &filename, std::string &digest );
 void check_and_make_path( std::string origin );
 
 int append_parameters(char *buf, std::vector<std::pair<char,float>> params, size_t bufsize);
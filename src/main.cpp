@@ -45,6 +45,7 @@
 // #include "libs/USBDevice/USBSerial/USBSerial.h"
 // #include "libs/USBDevice/DFU.h"
 #include "libs/SDFAT.h"
+#include "libs/WriteQueue.h"
 #include "StreamOutputPool.h"
 #include "ToolManager.h"
 
@@ -53,6 +54,8 @@
 #include "version.h"
 #include "system_LPC17xx.h"
 #include "platform_memory.h"
+#include "BootTrace.h"
+#include "FaultRecord.h"
 
 #include "mbed.h"
 
@@ -62,6 +65,12 @@
 // #define disable_msd_checksum  CHECKSUM("msd_disable")
 // #define dfu_enable_checksum  CHECKSUM("dfu_enable")
 #define watchdog_timeout_checksum  CHECKSUM("watchdog_timeout")
+#define sd_dma_enable_checksum  CHECKSUM("sd_dma_enable")
+// modules that are turned off are not made at all, rather than made to delete themselves when loaded
+#define enable_checksum  CHECKSUM("enable")
+#define wifi_checksum  CHECKSUM("wifi")
+#define laser_module_enable_checksum  CHECKSUM("laser_module_enable")
+#define drillingcycles_checksum  CHECKSUM("drillingcycles")
 
 // USB Stuff
 //SDCard sd  __attribute__ ((section ("AHBSRAM"))) (P0_18, P0_17, P0_15, P0_16);      // this selects SPI1 as the sdcard as it is on Smoothieboard
@@ -119,13 +128,21 @@ void init() {
     vCharge = 1;
     */
 
+    int trace = BootTrace::begin("kernel");
     Kernel* kernel = new Kernel();
+    BootTrace::end(trace);
 
     // kernel->streams->printf("Smoothie Running @%ldMHz\r\n", SystemCoreClock / 1000000);
     SimpleShell::version_command("", kernel->streams);
 
+    // use GPDMA for the SD card data blocks so interrupts do not stall the SPI transfers
+    sd.dma(kernel->config->value( sd_dma_enable_checksum )->by_default(true)->as_bool());
+
+    trace = BootTrace::begin("sd card");
     bool sdok = (sd.disk_initialize() == 0);
+    BootTrace::end(trace);
     if(!sdok) kernel->streams->printf("SDCard failed to initialize\r\n");
+    else if(FaultRecord::pending()) FaultRecord::save("/sd/fault.txt", kernel->streams);
 
     #ifdef NONETWORK
         kernel->streams->printf("NETWORK is disabled\r\n");
@@ -151,6 +168,9 @@ void init() {
 #endif
 
     // Create and add main modules
+    // small file writes from the main loop are done from idle
+    kernel->add_module( new(AHB) WriteQueue() );
+
     kernel->add_module( new(AHB) Player() );
 
     // ATC Handler
@@ -165,13 +185,17 @@ void init() {
     kernel->add_module( new(AHB) MainButton() );
 
     // Wifi Provider
-    kernel->add_module( new(AHB) WifiProvider);
+    if (kernel->config->value( wifi_checksum, enable_checksum )->by_default(true)->as_bool()) {
+        kernel->add_module( new(AHB) WifiProvider);
+    }
 
     // these modules can be completely disabled in the Makefile by adding to EXCLUDE_MODULES
     #ifndef NO_TOOLS_SWITCH
+    trace = BootTrace::begin("switches");
     SwitchPool *sp= new SwitchPool();
     sp->load_tools();
     delete sp;
+    BootTrace::end(trace);
     #endif
 
     // #ifndef NO_TOOLS_EXTRUDER
@@ -183,29 +207,37 @@ void init() {
 
     // #ifndef NO_TOOLS_TEMPERATURECONTROL
     // Note order is important here must be after extruder so Tn as a parameter will get executed first
+    trace = BootTrace::begin("temperature controls");
     TemperatureControlPool *tp= new(AHB) TemperatureControlPool();
     tp->load_tools();
     delete tp;
+    BootTrace::end(trace);
 
     // #endif
     #ifndef NO_TOOLS_ENDSTOPS
     kernel->add_module( new(AHB) Endstops() );
     #endif
     #ifndef NO_TOOLS_LASER
-    kernel->add_module( new(AHB) Laser() );
+    if (kernel->config->value( laser_module_enable_checksum )->by_default(true)->as_bool()) {
+        kernel->add_module( new(AHB) Laser() );
+    }
     #endif
 
     #ifndef NO_TOOLS_SPINDLE
+    trace = BootTrace::begin("spindle");
     SpindleMaker *sm = new(AHB) SpindleMaker();
     sm->load_spindle();
     delete sm;
+    BootTrace::end(trace);
     //kernel->add_module( new(AHB) Spindle() );
     #endif
     #ifndef NO_UTILS_PANEL
     // kernel->add_module( new(AHB) Panel() );
     #endif
     #ifndef NO_TOOLS_ZPROBE
-    kernel->add_module( new(AHB) ZProbe() );
+    if (kernel->config->value( zprobe_checksum, enable_checksum )->by_default(true)->as_bool()) {
+        kernel->add_module( new(AHB) ZProbe() );
+    }
     #endif
     #ifndef NO_TOOLS_SCARACAL
     kernel->add_module( new(AHB) SCARAcal() );
@@ -221,7 +253,9 @@ void init() {
     kernel->add_module( new(AHB) TemperatureSwitch() );
     #endif
     #ifndef NO_TOOLS_DRILLINGCYCLES
-    kernel->add_module( new(AHB) Drillingcycles() );
+    if (kernel->config->value( drillingcycles_checksum, enable_checksum )->by_default(false)->as_bool()) {
+        kernel->add_module( new(AHB) Drillingcycles() );
+    }
     #endif
     // Create and initialize USB stuff
     // u.init();
@@ -269,6 +303,8 @@ void init() {
 
     // clear up the config cache to save some memory
     kernel->config->config_cache_clear();
+    // every module has registered what it wants by now
+    kernel->freeze_hooks();
 
     if(kernel->is_using_leds()) {
         // set some leds to indicate status... led0 init done, led1 mainloop running, led2 idle loop running, led3 sdcard ok
@@ -281,6 +317,7 @@ void init() {
         // NOTE only Mxxx commands that set values should be put in this file. The file is generated by M500
         FILE *fp= fopen(kernel->config_override_filename(), "r");
         if(fp != NULL) {
+            trace = BootTrace::begin("config override");
             char buf[132];
             kernel->streams->printf("Loading config override file: %s...\n", kernel->config_override_filename());
             while(fgets(buf, sizeof buf, fp) != NULL) {
@@ -291,6 +328,7 @@ void init() {
             }
             kernel->streams->printf("config override file executed\n");
             fclose(fp);
+            BootTrace::end(trace);
         }
     }
 
@@ -298,6 +336,7 @@ void init() {
     THEKERNEL->conveyor->start(THEROBOT->get_number_registered_motors());
     THEKERNEL->step_ticker->start();
     THEKERNEL->slow_ticker->start();
+    BootTrace::done();
 }
 
 int main()
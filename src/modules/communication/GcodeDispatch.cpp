@@ -17,12 +17,15 @@
 #include "libs/StreamOutputPool.h"
 #include "libs/FileStream.h"
 #include "libs/AppendFileStream.h"
+#include "libs/WriteQueue.h"
+#include "libs/Counters.h"
 #include "Config.h"
 #include "checksumm.h"
 #include "ConfigValue.h"
 #include "PublicDataRequest.h"
 #include "PublicData.h"
 #include "SimpleShell.h"
+#include "LaserPublicAccess.h"
 #include "utils.h"
 #include "LPC17xx.h"
 #include "version.h"
@@ -39,22 +42,42 @@ static bool is_allowed_mcode(int m) {
     return false;
 }
 
+// true for a line with just one G0-G3 and its own words, which is most of the lines of a job, these need no G90/G91
+// reordering, comment stripping or splitting into several commands so all of that can be skipped
+static bool is_simple_motion(const string &line)
+{
+    const char *p = line.c_str();
+    if(p[0] != 'G') return false;
+    ++p;
+    if(*p == '0' && isdigit(p[1])) ++p; // G00 - G03
+    if(*p < '0' || *p > '3' || isdigit(p[1]) || p[1] == '.') return false;
+
+    for (++p; *p != '\0'; ++p) {
+        char c = *p;
+        if(isdigit(c) || c == '.' || c == '-' || c == '+' || c == ' ' || c == '\t') continue;
+        if(strchr("XYZABCIJKRFSEPL", c) == nullptr) return false; // anything else goes the long way
+    }
+    return true;
+}
+
 GcodeDispatch::GcodeDispatch()
 {
     uploading = false;
     modal_group_1= 0;
+    lines_parsed= 0;
 }
 
 // Called when the module has just been loaded
 void GcodeDispatch::on_module_loaded()
 {
     this->register_for_event(ON_CONSOLE_LINE_RECEIVED);
+    Counters::add("gcode_lines", &lines_parsed);
 }
 
 // When a command is received, if it is a Gcode, dispatch it as an object via an event
 void GcodeDispatch::on_console_line_received(void *line)
 {
-    SerialMessage new_message = *static_cast<SerialMessage *>(line);
+    SerialMessage& new_message = *static_cast<SerialMessage *>(line);
     string possible_command = new_message.message;
 
     // just reply ok to empty lines
@@ -81,6 +104,7 @@ try_again:
     }
 
     if ( first_char == 'G' || first_char == 'M' || first_char == 'T' || first_char == 'S' || first_char == 'N' || first_char == '#') {
+        ++lines_parsed;
 
         //Get linenumber
         if ( first_char == 'N' ) {
@@ -94,28 +118,26 @@ try_again:
 			}
         }
 
-        if ( first_char == 'G'){
+        bool simple = first_char == 'G' && is_simple_motion(possible_command);
+
+        if ( first_char == 'G' && !simple){
 			//check if has G90/G91
-			std::string g90_g91_command;
-			std::string modified_command = possible_command;
-			size_t g90_pos = modified_command.find("G90");
-			size_t g91_pos = modified_command.find("G91");
-			// if we have G90 or G91，then we move G90/G91 to the beginning
-			if (g90_pos != std::string::npos) {
-				g90_g91_command = "G90";
-				modified_command.erase(g90_pos, 3); // delete "G90"
-				possible_command = g90_g91_command + modified_command;
-			} else if (g91_pos != std::string::npos) {
-				g90_g91_command = "G91";
-				modified_command.erase(g91_pos, 3); // delete "G91"
-				possible_command = g90_g91_command + modified_command;
+			size_t g90_pos = possible_command.find("G90");
+			size_t g91_pos = (g90_pos == std::string::npos) ? possible_command.find("G91") : std::string::npos;
+			// if we have G90 or G91，then we move G90/G91 to the beginning, done in place to avoid temporaries
+			if (g90_pos != std::string::npos && g90_pos != 0) {
+				possible_command.erase(g90_pos, 3); // delete "G90"
+				possible_command.insert(0, "G90");
+			} else if (g91_pos != std::string::npos && g91_pos != 0) {
+				possible_command.erase(g91_pos, 3); // delete "G91"
+				possible_command.insert(0, "G91");
 			}
 		}
 
         //Remove comments
-        size_t comment = possible_command.find_first_of(";(");
+        size_t comment = simple ? string::npos : possible_command.find_first_of(";(");
         if( comment != string::npos ) {
-            possible_command = possible_command.substr(0, comment);
+            possible_command.erase(comment);
         }
 
 		bool sent_ok= false; // used for G1 optimization
@@ -126,7 +148,10 @@ try_again:
 			// -> G or M are in the line but not always the first char
 			// -> S or T could be in front of or after M
 			first_char = possible_command[0];
-			if (first_char == 'G') {
+			if (simple) {
+				// the whole line is the one command
+				cmd_pos = string::npos;
+			} else if (first_char == 'G') {
 				// find next G/M/S/T
 				if (possible_command.find_first_of("S", 2) != string::npos
 						&& possible_command.find_first_of("M", 2) != string::npos) {
@@ -150,8 +175,8 @@ try_again:
 			}
 
 			if (cmd_pos == string::npos) {
-				single_command = possible_command;
-				possible_command = "";
+				single_command.swap(possible_command);
+				possible_command.clear();
 			} else {
 				single_command = possible_command.substr(0, cmd_pos);
 				possible_command = possible_command.substr(cmd_pos);
@@ -242,6 +267,10 @@ try_again:
 							this->upload_filename = "/sd/" + single_command.substr(4); // rest of line is filename
 							// open file
 							upload_fd = fopen(this->upload_filename.c_str(), "w");
+							if(this->upload_filename.find("gcodes/") != string::npos) {
+								// any digest saved by a previous upload no longer matches
+								remove(change_to_digest_path(this->upload_filename).c_str());
+							}
 							if(upload_fd != NULL) {
 								this->uploading = true;
 								new_message.stream->printf("Writing to file: %s\r\nok\r\n", this->upload_filename.c_str());
@@ -327,6 +356,20 @@ try_again:
 							return;
 						}
 
+						case 327: // M327 is a special non compliant Gcode, the base64 raster row after the : can hold any letter
+						{    // so it is put back together and the words before it parsed on their own
+							string str= single_command + possible_command;
+							size_t colon= str.find(':');
+							Gcode head(str.substr(0, colon), new_message.stream, false, new_message.line);
+							pad_raster_row r{&head, colon == string::npos ? "" : str.c_str() + colon + 1};
+							delete gcode;
+							if(!PublicData::set_value(laser_checksum, raster_row_checksum, &r)) {
+								new_message.stream->printf("error:no laser\n");
+							}
+							new_message.stream->printf("ok\r\n");
+							return;
+						}
+
 						case 1000: // M1000 is a special command that will pass thru the raw lowercased command to the simpleshell (for hosts that do not allow such things)
 						{
 							// reconstruct entire command line again
@@ -356,9 +399,9 @@ try_again:
 							//remove(THEKERNEL->config_override_filename()); // seems to cause a hang every now and then
 							__disable_irq();
 							{
-								FileStream fs(THEKERNEL->config_override_filename());
-								fs.printf("; DO NOT EDIT THIS FILE\n");
 								// this also will truncate the existing file instead of deleting it
+								static const char header[] = "; DO NOT EDIT THIS FILE\n";
+								WriteQueue::replace(THEKERNEL->config_override_filename(), header, sizeof(header) - 1);
 							}
 							// replace stream with one that writes to config-override file
 							gcode->stream = new AppendFileStream(THEKERNEL->config_override_filename());
@@ -367,6 +410,11 @@ try_again:
 							delete gcode->stream;
 							delete gcode;
 							__enable_irq();
+							// the settings were only queued, write them now with interrupts on
+							if(!WriteQueue::sync(THEKERNEL->config_override_filename())) {
+								new_message.stream->printf("error:Failed to write %s\r\n", THEKERNEL->config_override_filename());
+								continue;
+							}
 							new_message.stream->printf("Settings Stored to %s\r\nok\r\n", THEKERNEL->config_override_filename());
 							continue;
 
@@ -377,7 +425,7 @@ try_again:
 								if(arg.empty()) arg= "/sd/config-override";
 								else arg= "/sd/config-override." + arg;
 								//new_message.stream->printf("args: <%s>\n", arg.c_str());
-								SimpleShell::parse_command((gcode->m == 501) ? "load_command" : "save_command", arg, new_message.stream);
+								SimpleShell::parse_command((gcode->m == 501) ? "load" : "save", arg, new_message.stream);
 							}
 							delete gcode;
 							new_message.stream->printf("ok\r\n");
@@ -24,11 +24,14 @@ public:
     virtual void on_console_line_received(void *line);
 
     uint8_t get_modal_command() const { return modal_group_1<4 ? modal_group_1 : 0; }
+    // for motion that is dispatched without coming through here (eg compact binary files from the player)
+    void set_modal_command(uint8_t g) { modal_group_1= g; }
 private:
     std::string upload_filename;
     FILE *upload_fd;
     StreamOutput* upload_stream{nullptr};
     uint8_t modal_group_1;
+    uint32_t lines_parsed;
     struct {
         bool uploading: 1;
     };
@@ -13,13 +13,13 @@ using std::string;
 #include "libs/Kernel.h"
 #include "libs/nuts_bolts.h"
 #include "SerialConsole.h"
-#include "libs/RingBuffer.h"
 #include "libs/SerialMessage.h"
 #include "libs/StreamOutput.h"
 #include "libs/StreamOutputPool.h"
 #include "ATCHandlerPublicAccess.h"
 #include "PublicDataRequest.h"
 #include "PublicData.h"
+#include "Robot.h"
 
 
 // Serial reading module
@@ -28,6 +28,9 @@ using std::string;
 SerialConsole::SerialConsole( PinName rx_pin, PinName tx_pin, int baud_rate ){
     this->serial = new mbed::Serial( rx_pin, tx_pin );
     this->serial->baud(baud_rate);
+    // interrupt once 8 chars are in the FIFO (or they stop coming), not for every char, that still leaves 8 chars
+    // of time to get to the interrupt before it overruns
+    this->serial->rx_fifo_level(2);
     this->previous_char = 0;
 }
 
@@ -77,6 +80,10 @@ void SerialConsole::on_serial_char_received() {
 		if(THEKERNEL->is_cachewait()) {
 			continue;
 		}
+
+		if((uint8_t)received >= 0x90 && THEROBOT != nullptr && THEROBOT->realtime_override(received)) {
+			continue;
+		}
 		
 		if (received == '?') {
 			query_flag = true;
@@ -126,7 +133,7 @@ void SerialConsole::on_serial_char_received() {
         }
 		// convert CR to NL (for host OSs that don't send NL)
 		if ( received == '\r' ) { received = '\n'; }
-		this->buffer.push_back(received);
+		this->buffer.put(received);
     }
 }
 
@@ -136,12 +143,12 @@ void SerialConsole::on_idle(void * argument)
 
     if (query_flag ) {
         query_flag = false;
-        puts(THEKERNEL->get_query_string().c_str(), 0);
+        puts(THEKERNEL->get_query_string(this), 0);
     }
 
     if (diagnose_flag) {
     	diagnose_flag = false;
-    	puts(THEKERNEL->get_diagnose_string().c_str(), 0);
+    	puts(THEKERNEL->get_diagnose_string(), 0);
     }
 
     if (halt_flag) {
@@ -158,36 +165,69 @@ void SerialConsole::on_idle(void * argument)
 
 // Actual event calling must happen in the main loop because if it happens in the interrupt we will loose data
 void SerialConsole::on_main_loop(void * argument){
-    if ( this->has_char('\n') ){
+    if ( this->buffer.has_line() ){
         string received;
         received.reserve(20);
-        while(1){
-           char c;
-           this->buffer.pop_front(c);
-           if( c == '\n' ){
-                struct SerialMessage message;
-                message.message = received;
-                message.stream = this;
-                message.line = 0;
-                THEKERNEL->call_event(ON_CONSOLE_LINE_RECEIVED, &message );
-                // this->puts(received.c_str());
-                return;
-            }else{
-                received += c;
-            }
-        }
+        this->buffer.get_line(received);
+        struct SerialMessage message;
+        message.message = received;
+        message.stream = this;
+        message.line = 0;
+        THEKERNEL->call_event(ON_CONSOLE_LINE_RECEIVED, &message );
+        // this->puts(received.c_str());
+    }else if( this->buffer.overflowed() ){
+        // the line is longer than the buffer, it would never complete
+        this->buffer.flush();
     }
 }
 
 int SerialConsole::puts(const char* s, int size)
 {
     size_t n = size == 0 ? strlen(s) : size;
+
+    // an interrupt could be in the middle of queuing or sending, it waits on the uart itself as it always has
+    if (SCB->ICSR & SCB_ICSR_VECTACTIVE_Msk) {
+        for (size_t i = 0; i < n; ++i) {
+            this->_putc(s[i]);
+        }
+        return n;
+    }
+
+    // queued and sent by the tx interrupt, only a reply bigger than the buffer waits for the uart to catch up
     for (size_t i = 0; i < n; ++i) {
-        this->_putc(s[i]);
+        while (!this->tx_buffer.put(s[i])) {
+            prime_tx();
+        }
     }
+    prime_tx();
     return n;
 }
 
+// Called on Serial::TxIrq interrupt, the uart fifo has room
+void SerialConsole::on_serial_tx_empty()
+{
+    char c;
+    while (this->serial->writeable()) {
+        if (!this->tx_buffer.get(c)) {
+            // nothing left, no more interrupts until there is
+            this->serial->attach(nullptr, mbed::Serial::TxIrq);
+            return;
+        }
+        this->serial->putc(c);
+    }
+}
+
+// fills the uart fifo from here and leaves the interrupt to send the rest, this also works with interrupts disabled
+// as the fifo is filled directly while it has room
+void SerialConsole::prime_tx()
+{
+    this->serial->attach(nullptr, mbed::Serial::TxIrq); // only one of us takes from the buffer at a time
+    on_serial_tx_empty();
+    if (!this->tx_buffer.empty()) {
+        this->serial->attach(this, &SerialConsole::on_serial_tx_empty, mbed::Serial::TxIrq);
+    }
+}
+
 int SerialConsole::gets(char** buf, int size)
 {
 	getc_result = this->_getc();
@@ -210,14 +250,3 @@ bool SerialConsole::ready()
     return this->serial->readable();
 }
 
-// Does the queue have a given char ?
-bool SerialConsole::has_char(char letter){
-    int index = this->buffer.tail;
-    while( index != this->buffer.head ){
-        if( this->buffer.buffer[index] == letter ){
-            return true;
-        }
-        index = this->buffer.next_block_index(index);
-    }
-    return false;
-}
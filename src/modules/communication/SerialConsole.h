@@ -14,7 +14,7 @@
 #include <vector>
 #include <string>
 using std::string;
-#include "libs/RingBuffer.h"
+#include "libs/TSRingBuffer.h"
 #include "libs/StreamOutput.h"
 
 
@@ -26,10 +26,10 @@ class SerialConsole : public Module, public StreamOutput {
 
         void on_module_loaded();
         void on_serial_char_received();
+        void on_serial_tx_empty();
         void on_main_loop(void * argument);
         void on_idle(void * argument);
         void on_set_public_data(void *argument);
-        bool has_char(char letter);
         void attach_irq(bool enable_irq);
 
         int _putc(int c);
@@ -37,11 +37,14 @@ class SerialConsole : public Module, public StreamOutput {
         int puts(const char*, int size = 0);
         int gets(char** buf, int size = 0);
         bool ready();
+        int rx_free() { return buffer.capacity() - buffer.size(); }
+        void prime_tx();
         char getc_result;
 
         //string receive_buffer;                 // Received chars are stored here until a newline character is received
         //vector<std::string> received_lines;    // Received lines are stored here until they are requested
-        RingBuffer<char,256> buffer;             // Receive buffer
+        TSLineBuffer<256> buffer;                // Receive buffer, filled by the rx interrupt
+        TSRingBuffer<char, 512> tx_buffer;       // Send buffer, emptied by the tx interrupt so a reply does not wait for the uart
         mbed::Serial* serial;
         char previous_char;                       // Track previous character for ?1 detection
         struct {
@@ -7,6 +7,7 @@
 
 
 #include "Gcode.h"
+#include "GcodeExpression.h"
 #include "libs/StreamOutput.h"
 #include "libs/StreamOutputPool.h"
 #include "utils.h"
@@ -21,34 +22,177 @@
 #include "PublicData.h"
 #include "SpindlePublicAccess.h"
 #include "StepperMotor.h"
+#include "platform_memory.h"
+#include "SlabPool.h"
+
+#include <string.h>
+
+// A Gcode is created and deleted for every line dispatched, so new and delete recycle a few fixed
+// slots allocated once from AHB, only when they are all in use do we fall back to the heap
+#define GCODE_POOL_SLOTS 8
+
+namespace {
+    union GcodePoolSlot {
+        GcodePoolSlot *next;
+        char storage[sizeof(Gcode)] __attribute__((aligned(8)));
+    };
+
+    GcodePoolSlot *gcode_pool= nullptr;
+    GcodePoolSlot *gcode_pool_free= nullptr;
+}
+
+void *Gcode::operator new(size_t size)
+{
+    if(gcode_pool == nullptr) {
+        gcode_pool= (GcodePoolSlot *)AHB.alloc(sizeof(GcodePoolSlot) * GCODE_POOL_SLOTS);
+        if(gcode_pool != nullptr) {
+            for (int i = 0; i < GCODE_POOL_SLOTS; ++i) {
+                gcode_pool[i].next= (i < GCODE_POOL_SLOTS - 1) ? &gcode_pool[i + 1] : nullptr;
+            }
+            gcode_pool_free= gcode_pool;
+        }
+    }
+
+    if(size <= sizeof(GcodePoolSlot) && gcode_pool_free != nullptr) {
+        GcodePoolSlot *slot= gcode_pool_free;
+        gcode_pool_free= slot->next;
+        return slot;
+    }
+
+    return ::operator new(size);
+}
+
+void Gcode::operator delete(void *p)
+{
+    if(p == nullptr) return;
+
+    if(gcode_pool != nullptr && p >= (void *)gcode_pool && p < (void *)(gcode_pool + GCODE_POOL_SLOTS)) {
+        GcodePoolSlot *slot= static_cast<GcodePoolSlot *>(p);
+        slot->next= gcode_pool_free;
+        gcode_pool_free= slot;
+        return;
+    }
+
+    ::operator delete(p);
+}
 
 // This is a gcode object. It represents a GCode string/command, and caches some important values about that command for the sake of performance.
 // It gets passed around in events, and attached to the queue ( that'll change )
-Gcode::Gcode(const string &command, StreamOutput *stream, bool strip, unsigned int line)
+Gcode::Gcode(const string &command, StreamOutput *stream, bool strip, unsigned int line) : Gcode(command.c_str(), stream, strip, line)
+{
+}
+
+Gcode::Gcode(const char *command, StreamOutput *stream, bool strip, unsigned int line)
 {
-    this->command= strdup(command.c_str());
+    this->command= nullptr;
+    set_command(command);
     this->m= 0;
     this->g= 0;
     this->subcode= 0;
     this->add_nl= false;
     this->is_error= false;
+    this->from_words= false;
     this->stream= stream;
     prepare_cached_values(strip);
     this->stripped= strip;
     this->line = line;
 }
 
+// A motion command that was never text (eg a compact binary record from the player), the words go straight into
+// the value cache so nothing is parsed, the command text is empty as if it had been stripped
+Gcode::Gcode(unsigned int g, uint32_t letters, const float *values, StreamOutput *stream, unsigned int line)
+{
+    this->command= nullptr;
+    set_command("");
+    this->m= 0;
+    this->g= g;
+    this->subcode= 0;
+    this->has_g= true;
+    this->has_m= false;
+    this->add_nl= false;
+    this->is_error= false;
+    this->stripped= true;
+    this->from_words= true;
+    this->stream= stream;
+    this->line = line;
+
+    letter_mask= letters & 0x03FFFFFFUL;
+    value_mask= letter_mask;
+    for (int i = 0; i < 26; ++i) {
+        if(letter_mask & (1UL << i)) {
+            word_values[i]= values[i];
+            word_ends[i]= 0;
+        }
+    }
+}
+
 Gcode::~Gcode()
 {
-    if(command != nullptr) {
-        // TODO we can reference count this so we share copies, may save more ram than the extra count we need to store
-        free(command);
+    release_command();
+}
+
+// short commands are copied into inline_command, longer ones go on the heap
+void Gcode::set_command(const char *cmd)
+{
+    size_t len= strlen(cmd);
+    command_slab_size= 0;
+    if(len < sizeof(inline_command)) {
+        memcpy(inline_command, cmd, len + 1);
+        command= inline_command;
+    } else {
+        // longer ones are still short enough for the slabs, which do not fragment AHB like the heap does
+        command= (char *)SLAB.alloc(len + 1);
+        if(command != nullptr) {
+            memcpy(command, cmd, len + 1);
+            command_slab_size= len + 1; // stripping shortens it in place so remember what was allocated
+        } else {
+            command= strdup(cmd);
+        }
+    }
+    index_letters();
+}
+
+// one pass over the command to note which letters are present, this also invalidates any cached values
+void Gcode::index_letters()
+{
+    letter_mask= 0;
+    value_mask= 0;
+    for (const char *cs = command; *cs; cs++) {
+        if(*cs >= 'A' && *cs <= 'Z') letter_mask |= (1UL << (*cs - 'A'));
+    }
+}
+
+void Gcode::release_command()
+{
+    if(command != nullptr && command != inline_command) {
+        if(command_slab_size > 0) SLAB.dealloc(command, command_slab_size);
+        else free(command);
+    }
+    command= nullptr;
+    command_slab_size= 0;
+}
+
+// the copy has the same text so the letter index and any values already evaluated are still valid,
+// for a Gcode built from words they are the only copy of the words
+void Gcode::copy_words(const Gcode &to_copy)
+{
+    this->from_words= to_copy.from_words;
+    this->letter_mask= to_copy.letter_mask;
+    this->value_mask= to_copy.value_mask;
+    for (int i = 0; i < 26; ++i) {
+        if(value_mask & (1UL << i)) {
+            word_values[i]= to_copy.word_values[i];
+            word_ends[i]= to_copy.word_ends[i];
+        }
     }
 }
 
 Gcode::Gcode(const Gcode &to_copy)
 {
-    this->command               = strdup(to_copy.command); // TODO we can reference count this so we share copies, may save more ram than the extra count we need to store
+    this->command= nullptr;
+    set_command(to_copy.command);
+    this->line                  = to_copy.line;
+    this->stripped              = to_copy.stripped;
     this->has_m                 = to_copy.has_m;
     this->has_g                 = to_copy.has_g;
     this->m                     = to_copy.m;
@@ -58,12 +202,16 @@ Gcode::Gcode(const Gcode &to_copy)
     this->is_error              = to_copy.is_error;
     this->stream                = to_copy.stream;
     this->txt_after_ok.assign( to_copy.txt_after_ok );
+    copy_words(to_copy);
 }
 
 Gcode &Gcode::operator= (const Gcode &to_copy)
 {
     if( this != &to_copy ) {
-        this->command               = strdup(to_copy.command); // TODO we can reference count this so we share copies, may save more ram than the extra count we need to store
+        release_command();
+        set_command(to_copy.command);
+        this->line                  = to_copy.line;
+        this->stripped              = to_copy.stripped;
         this->has_m                 = to_copy.has_m;
         this->has_g                 = to_copy.has_g;
         this->m                     = to_copy.m;
@@ -73,6 +221,7 @@ Gcode &Gcode::operator= (const Gcode &to_copy)
         this->is_error              = to_copy.is_error;
         this->stream                = to_copy.stream;
         this->txt_after_ok.assign( to_copy.txt_after_ok );
+        copy_words(to_copy);
     }
     return *this;
 }
@@ -81,6 +230,10 @@ Gcode &Gcode::operator= (const Gcode &to_copy)
 // Whether or not a Gcode has a letter
 bool Gcode::has_letter( char letter ) const
 {
+    if(letter >= 'A' && letter <= 'Z') {
+        return (letter_mask & (1UL << (letter - 'A'))) != 0;
+    }
+
     for (size_t i = 0; i < strlen(this->command); ++i) {
         if( command[i] == letter ) {
             return true;
@@ -158,7 +311,7 @@ float Gcode::set_variable_value() const {
             }
         } else if (var_num >= 501 && var_num <= 520) {
             THEKERNEL->eeprom_data->perm_vars[var_num - 501] = value; // Set permanent variable
-            THEKERNEL->write_eeprom_data(); // Save to EEPROM
+            THEKERNEL->defer_eeprom_write(); // Saved to EEPROM from the main loop
             this->stream->printf("Variable %d set %.4f \n", var_num, value);
             return value;
         } else {
@@ -178,130 +331,136 @@ float Gcode::set_variable_value() const {
 float Gcode::get_variable_value(const char* expr, char** endptr) const{
     // Expecting a number after the `#` from 1-20, like #12
     if (*expr == '#') {
-        int var_num = strtol(expr + 1, endptr, 10);         
-        if (var_num >= 101 && var_num <= 120) {
-            if (THEKERNEL->local_vars[var_num -101] > -100000)
-            {
-                return THEKERNEL->local_vars[var_num -101];
-            }
-            THEKERNEL->set_halt_reason(MANUAL);
-            THEKERNEL->call_event(ON_HALT, nullptr);
-            THEKERNEL->streams->printf("Variable %d not set \n", var_num);
-            return NAN;
-        
-        } else if(var_num == 150)
-        {
-            return THEKERNEL->probe_tip_diameter;
-        } else if(var_num >= 151 && var_num <= 156)
-        {
-            if (THEKERNEL->probe_outputs[var_num - 151] > -100000)
-            {
-                return THEKERNEL->probe_outputs[var_num - 151];
-            }
-            THEKERNEL->set_halt_reason(MANUAL);
-            THEKERNEL->call_event(ON_HALT, nullptr);
-            THEKERNEL->streams->printf("Variable %d not set \n", var_num);
-            return NAN;
+        int var_num = strtol(expr + 1, endptr, 10);
+        return get_variable(var_num);
+    }
+    return 0;
+}
 
-        } else if(var_num >= 501 && var_num <= 520)
+// the value of variable var_num, halts if it is not set or there is no such variable
+float Gcode::get_variable(int var_num)
+{
+    if (var_num >= 101 && var_num <= 120) {
+        if (THEKERNEL->local_vars[var_num -101] > -100000)
         {
-            if (THEKERNEL->eeprom_data->perm_vars[var_num - 501] > -100000)
-            {
-                return THEKERNEL->eeprom_data->perm_vars[var_num - 501]; // return permanent variables
-            }
-            
-            THEKERNEL->set_halt_reason(MANUAL);
-            THEKERNEL->call_event(ON_HALT, nullptr);
-            THEKERNEL->streams->printf("Variable %d not set \n", var_num);
-            return NAN;
-        }else //system variables
+            return THEKERNEL->local_vars[var_num -101];
+        }
+        THEKERNEL->set_halt_reason(MANUAL);
+        THEKERNEL->call_event(ON_HALT, nullptr);
+        THEKERNEL->streams->printf("Variable %d not set \n", var_num);
+        return NAN;
+    
+    } else if(var_num == 150)
+    {
+        return THEKERNEL->probe_tip_diameter;
+    } else if(var_num >= 151 && var_num <= 156)
+    {
+        if (THEKERNEL->probe_outputs[var_num - 151] > -100000)
         {
-            float mpos[3];
-            bool ok;
-            Robot::wcs_t pos;
-            switch (var_num){
-                case 2000: //stored tool length offset
-                    return THEKERNEL->eeprom_data->TLO;
-                    break;
-                case 3026: //tool in spindle
-                    return THEKERNEL->eeprom_data->TOOL;
-                    break;
-                case 3027: //current spindle RPM
-                    struct spindle_status ss;
-                    ok = PublicData::get_value(pwm_spindle_control_checksum, get_spindle_status_checksum, &ss);
-                    if (ok) {
-                        return ss.current_rpm;
-                        break;
-                    }
-                    return 0;
-                    break;
-                case 3033: //Op Stop Enabled
-                    return THEKERNEL->get_optional_stop_mode();
-                    break;
-                case 5021: //current machine X position
-                    THEROBOT->get_current_machine_position(mpos);
-                    // current_position/mpos includes the compensation transform so we need to get the inverse to get actual position
-                    if(THEROBOT->compensationTransform) THEROBOT->compensationTransform(mpos, true, false); // get inverse compensation transform
-                    return mpos[X_AXIS];
-                    break;
-                case 5022: //current machine Y position
-                    THEROBOT->get_current_machine_position(mpos);
-                    // current_position/mpos includes the compensation transform so we need to get the inverse to get actual position
-                    if(THEROBOT->compensationTransform) THEROBOT->compensationTransform(mpos, true, false); // get inverse compensation transform
-                    return mpos[Y_AXIS];
-                    break;
-                case 5023: //current machine Z position
-                    THEROBOT->get_current_machine_position(mpos);
-                    // current_position/mpos includes the compensation transform so we need to get the inverse to get actual position
-                    if(THEROBOT->compensationTransform) THEROBOT->compensationTransform(mpos, true, false); // get inverse compensation transform
-                    return mpos[Z_AXIS];
-                    break;
-
-                #if MAX_ROBOT_ACTUATORS > 3
-                case 5024: //current machine A position
-                    return THEROBOT->actuators[A_AXIS]->get_current_position();
-                    break;
-                #endif
-                case 5041: //current WCS X position
-                     THEROBOT->get_current_machine_position(mpos);
-                    // current_position/mpos includes the compensation transform so we need to get the inverse to get actual position
-                    if(THEROBOT->compensationTransform) THEROBOT->compensationTransform(mpos, true, false); // get inverse compensation transform
-                    pos= THEROBOT->mcs2wcs(mpos);
-                    return THEROBOT->from_millimeters(std::get<X_AXIS>(pos));
-                    return 0;
-                    break;
-                case 5042: //current WCS Y position
-                     THEROBOT->get_current_machine_position(mpos);
-                    // current_position/mpos includes the compensation transform so we need to get the inverse to get actual position
-                    if(THEROBOT->compensationTransform) THEROBOT->compensationTransform(mpos, true, false); // get inverse compensation transform
-                    pos= THEROBOT->mcs2wcs(mpos);
-                    return THEROBOT->from_millimeters(std::get<Y_AXIS>(pos));
-                    return 0;
-                    break;
-                case 5043: //current WCS A position
-                     THEROBOT->get_current_machine_position(mpos);
-                    // current_position/mpos includes the compensation transform so we need to get the inverse to get actual position
-                    if(THEROBOT->compensationTransform) THEROBOT->compensationTransform(mpos, true, false); // get inverse compensation transform
-                    pos= THEROBOT->mcs2wcs(mpos);
-                    return THEROBOT->from_millimeters(std::get<Z_AXIS>(pos));
-                    return 0;
-                    break;
-                #if MAX_ROBOT_ACTUATORS > 3
-                case 5044: //current machine A position
-                    return THEROBOT->actuators[A_AXIS]->get_current_position();
-                    break;
-                #endif
+            return THEKERNEL->probe_outputs[var_num - 151];
+        }
+        THEKERNEL->set_halt_reason(MANUAL);
+        THEKERNEL->call_event(ON_HALT, nullptr);
+        THEKERNEL->streams->printf("Variable %d not set \n", var_num);
+        return NAN;
 
-                default:
-                    THEKERNEL->set_halt_reason(MANUAL);
-                    THEKERNEL->call_event(ON_HALT, nullptr);
-                    THEKERNEL->streams->printf("Variable %d not found \n", var_num);
-                    return NAN;
+    } else if(var_num >= 501 && var_num <= 520)
+    {
+        if (THEKERNEL->eeprom_data->perm_vars[var_num - 501] > -100000)
+        {
+            return THEKERNEL->eeprom_data->perm_vars[var_num - 501]; // return permanent variables
+        }
+        
+        THEKERNEL->set_halt_reason(MANUAL);
+        THEKERNEL->call_event(ON_HALT, nullptr);
+        THEKERNEL->streams->printf("Variable %d not set \n", var_num);
+        return NAN;
+    }else //system variables
+    {
+        float mpos[3];
+        bool ok;
+        Robot::wcs_t pos;
+        switch (var_num){
+            case 2000: //stored tool length offset
+                return THEKERNEL->eeprom_data->TLO;
+                break;
+            case 3026: //tool in spindle
+                return THEKERNEL->eeprom_data->TOOL;
+                break;
+            case 3027: //current spindle RPM
+                struct spindle_status ss;
+                ok = PublicData::get_value(pwm_spindle_control_checksum, get_spindle_status_checksum, &ss);
+                if (ok) {
+                    return ss.current_rpm;
                     break;
-            }
+                }
+                return 0;
+                break;
+            case 3033: //Op Stop Enabled
+                return THEKERNEL->get_optional_stop_mode();
+                break;
+            case 5021: //current machine X position
+                THEROBOT->get_current_machine_position(mpos);
+                // current_position/mpos includes the compensation transform so we need to get the inverse to get actual position
+                if(THEROBOT->compensationTransform) THEROBOT->compensationTransform(mpos, true, false); // get inverse compensation transform
+                return mpos[X_AXIS];
+                break;
+            case 5022: //current machine Y position
+                THEROBOT->get_current_machine_position(mpos);
+                // current_position/mpos includes the compensation transform so we need to get the inverse to get actual position
+                if(THEROBOT->compensationTransform) THEROBOT->compensationTransform(mpos, true, false); // get inverse compensation transform
+                return mpos[Y_AXIS];
+                break;
+            case 5023: //current machine Z position
+                THEROBOT->get_current_machine_position(mpos);
+                // current_position/mpos includes the compensation transform so we need to get the inverse to get actual position
+                if(THEROBOT->compensationTransform) THEROBOT->compensationTransform(mpos, true, false); // get inverse compensation transform
+                return mpos[Z_AXIS];
+                break;
+
+            #if MAX_ROBOT_ACTUATORS > 3
+            case 5024: //current machine A position
+                return THEROBOT->actuators[A_AXIS]->get_current_position();
+                break;
+            #endif
+            case 5041: //current WCS X position
+                 THEROBOT->get_current_machine_position(mpos);
+                // current_position/mpos includes the compensation transform so we need to get the inverse to get actual position
+                if(THEROBOT->compensationTransform) THEROBOT->compensationTransform(mpos, true, false); // get inverse compensation transform
+                pos= THEROBOT->mcs2wcs(mpos);
+                return THEROBOT->from_millimeters(std::get<X_AXIS>(pos));
+                return 0;
+                break;
+            case 5042: //current WCS Y position
+                 THEROBOT->get_current_machine_position(mpos);
+                // current_position/mpos includes the compensation transform so we need to get the inverse to get actual position
+                if(THEROBOT->compensationTransform) THEROBOT->compensationTransform(mpos, true, false); // get inverse compensation transform
+                pos= THEROBOT->mcs2wcs(mpos);
+                return THEROBOT->from_millimeters(std::get<Y_AXIS>(pos));
+                return 0;
+                break;
+            case 5043: //current WCS A position
+                 THEROBOT->get_current_machine_position(mpos);
+                // current_position/mpos includes the compensation transform so we need to get the inverse to get actual position
+                if(THEROBOT->compensationTransform) THEROBOT->compensationTransform(mpos, true, false); // get inverse compensation transform
+                pos= THEROBOT->mcs2wcs(mpos);
+                return THEROBOT->from_millimeters(std::get<Z_AXIS>(pos));
+                return 0;
+                break;
+            #if MAX_ROBOT_ACTUATORS > 3
+            case 5044: //current machine A position
+                return THEROBOT->actuators[A_AXIS]->get_current_position();
+                break;
+            #endif
+
+            default:
+                THEKERNEL->set_halt_reason(MANUAL);
+                THEKERNEL->call_event(ON_HALT, nullptr);
+                THEKERNEL->streams->printf("Variable %d not found \n", var_num);
+                return NAN;
+                break;
         }
     }
-    return 0;
 }
 
 float Gcode::parse_expression(const char*& expr) const {
@@ -559,6 +718,16 @@ float Gcode::parse_factor(const char*& expr) const {
 float Gcode::evaluate_expression(const char* expr, char** endptr) const {
     while (isspace(*expr)) expr++; // Skip leading whitespace
 
+    // anything with variables or brackets is compiled once and run from the cache after that
+    if (*expr == '[' || *expr == '#') {
+        float result;
+        char *end;
+        if (GcodeExpression::evaluate(expr, &end, result)) {
+            if (endptr) *endptr = end;
+            return result;
+        }
+    }
+
     // Check for unexpected closing bracket at the beginning
     if (*expr == ']') {
         THEKERNEL->set_halt_reason(MANUAL);
@@ -586,6 +755,21 @@ float Gcode::evaluate_expression(const char* expr, char** endptr) const {
 // Retrieve the value for a given letter
 float Gcode::get_value( char letter, char **ptr ) const
 {
+    // the words A-Z are only parsed and evaluated the first time they are asked for
+    int idx = letter - 'A';
+    bool cacheable = (letter >= 'A' && letter <= 'Z');
+    if(cacheable) {
+        uint32_t bit = 1UL << idx;
+        if((letter_mask & bit) == 0) {
+            if(ptr != nullptr) *ptr = nullptr;
+            return 0;
+        }
+        if(value_mask & bit) {
+            if(ptr != nullptr) *ptr = word_ends[idx] ? command + word_ends[idx] : nullptr;
+            return word_values[idx];
+        }
+    }
+
     const char *cs = command;
     char *cn = NULL;
     for (; *cs; cs++) {
@@ -595,11 +779,22 @@ float Gcode::get_value( char letter, char **ptr ) const
             if(ptr != nullptr) *ptr = cn;
             
             // If a valid expression was found, return the result
-            if (cn > cs)
+            if (cn > cs) {
+                if(cacheable) {
+                    word_values[idx] = result;
+                    word_ends[idx] = cn - command;
+                    value_mask |= (1UL << idx);
+                }
                 return result;
+            }
         }
     }
     // If no valid number or expression is found, return 0
+    if(cacheable) {
+        word_values[idx] = 0;
+        word_ends[idx] = 0;
+        value_mask |= (1UL << idx);
+    }
     if (ptr != nullptr) *ptr = nullptr;
     return 0;
 }
@@ -620,6 +815,12 @@ float Gcode::get_value_at_index( int index ) const
 
 int Gcode::get_int( char letter, char **ptr ) const
 {
+    if(!has_letter(letter)) {
+        if(ptr != nullptr) *ptr= nullptr;
+        return 0;
+    }
+    if(from_words) return (int)get_value(letter, ptr);
+
     const char *cs = command;
     char *cn = NULL;
     for (; *cs; cs++) {
@@ -637,6 +838,12 @@ int Gcode::get_int( char letter, char **ptr ) const
 
 uint32_t Gcode::get_uint( char letter, char **ptr ) const
 {
+    if(!has_letter(letter)) {
+        if(ptr != nullptr) *ptr= nullptr;
+        return 0;
+    }
+    if(from_words) return (uint32_t)get_value(letter, ptr);
+
     const char *cs = command;
     char *cn = NULL;
     for (; *cs; cs++) {
@@ -654,6 +861,10 @@ uint32_t Gcode::get_uint( char letter, char **ptr ) const
 
 int Gcode::get_num_args() const
 {
+    if(from_words) {
+        return __builtin_popcount(letter_mask & ~(1UL << ('T' - 'A')));
+    }
+
     int count = 0;
     for(size_t i = stripped?0:1; i < strlen(command); i++) {
         if( this->command[i] >= 'A' && this->command[i] <= 'Z' ) {
@@ -664,9 +875,15 @@ int Gcode::get_num_args() const
     return count;
 }
 
-std::map<char,float> Gcode::get_args() const
+LetterMap<float> Gcode::get_args() const
 {
-    std::map<char,float> m;
+    LetterMap<float> m;
+    if(from_words) {
+        for (int i = 0; i < 26; ++i) {
+            if(i != 'T' - 'A' && (letter_mask & (1UL << i))) m['A' + i]= word_values[i];
+        }
+        return m;
+    }
     for(size_t i = stripped?0:1; i < strlen(command); i++) {
         char c= this->command[i];
         if( c >= 'A' && c <= 'Z' ) {
@@ -677,9 +894,15 @@ std::map<char,float> Gcode::get_args() const
     return m;
 }
 
-std::map<char,int> Gcode::get_args_int() const
+LetterMap<int> Gcode::get_args_int() const
 {
-    std::map<char,int> m;
+    LetterMap<int> m;
+    if(from_words) {
+        for (int i = 0; i < 26; ++i) {
+            if(i != 'T' - 'A' && (letter_mask & (1UL << i))) m['A' + i]= (int)word_values[i];
+        }
+        return m;
+    }
     for(size_t i = stripped?0:1; i < strlen(command); i++) {
         char c= this->command[i];
         if( c >= 'A' && c <= 'Z' ) {
@@ -724,17 +947,26 @@ void Gcode::prepare_cached_values(bool strip)
 
     if(!strip || this->has_letter('T')) return;
 
-    // remove the Gxxx or Mxxx from string
+    // remove the Gxxx or Mxxx from string, shifting the rest down in place
     if (p != nullptr) {
-        char *n= strdup(p); // create new string starting at end of the numeric value
-        free(command);
-        command= n;
+        memmove(command, p, strlen(p) + 1);
+        index_letters();
     }
 }
 
 // strip off X Y Z I J K parameters if G0/1/2/3
 void Gcode::strip_parameters()
 {
+    if(from_words) {
+        if(has_g && g < 4) {
+            uint32_t xyzijk= 0;
+            for (const char *c = "XYZIJK"; *c; c++) xyzijk |= (1UL << (*c - 'A'));
+            letter_mask &= ~xyzijk;
+            value_mask &= ~xyzijk;
+        }
+        return;
+    }
+
     if(has_g && g < 4){
         // strip the command of the XYZIJK parameters
         string newcmd;
@@ -758,9 +990,8 @@ void Gcode::strip_parameters()
         // strip whitespace to save even more, this causes problems so don't do it
         //newcmd.erase(std::remove_if(newcmd.begin(), newcmd.end(), ::isspace), newcmd.end());
 
-        // release the old one
-        free(command);
-        // copy the new shortened one
-        command= strdup(newcmd.c_str());
+        // release the old one and copy the new shortened one
+        release_command();
+        set_command(newcmd.c_str());
     }
 }
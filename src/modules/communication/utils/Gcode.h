@@ -9,29 +9,41 @@
 #ifndef GCODE_H
 #define GCODE_H
 #include <string>
-#include <map>
 #include <cstdint>
 
+#include "LetterMap.h"
+
 using std::string;
 
 class StreamOutput;
 
+// commands shorter than this are stored in the Gcode itself rather than strdup'd
+#define GCODE_INLINE_SIZE 48
+
 // Object to represent a Gcode command
 class Gcode {
     public:
         using wcs_t= std::tuple<float, float, float>;
 
         Gcode(const string&, StreamOutput*, bool strip = true, unsigned int line = 0);
+        Gcode(const char*, StreamOutput*, bool strip = true, unsigned int line = 0);
+        // G0-G3 built from already parsed words, values[] is indexed by letter - 'A'
+        Gcode(unsigned int g, uint32_t letters, const float *values, StreamOutput*, unsigned int line = 0);
         Gcode(const Gcode& to_copy);
         Gcode& operator= (const Gcode& to_copy);
         ~Gcode();
 
+        // new/delete recycle a small pool of Gcodes so per line dispatch does not use the heap
+        static void* operator new(size_t size);
+        static void operator delete(void* p);
+
         const char* get_command() const { return command; }
         bool has_letter ( char letter ) const;
         // 2024
 
 // 2024
         float get_variable_value(const char * expr, char ** endptr) const;
+        static float get_variable(int var_num);
         float set_variable_value() const;
 
         float evaluate_expression(const char * expr, char ** endptr) const;
@@ -42,8 +54,8 @@ class Gcode {
         int get_int ( char letter, char **ptr= nullptr ) const;
         uint32_t get_uint ( char letter, char **ptr= nullptr ) const;
         int get_num_args() const;
-        std::map<char,float> get_args() const;
-        std::map<char,int> get_args_int() const;
+        LetterMap<float> get_args() const;
+        LetterMap<int> get_args_int() const;
         void strip_parameters();
 
         // FIXME these should be private
@@ -59,6 +71,7 @@ class Gcode {
             bool stripped:1;
             bool is_error:1;
             uint8_t subcode:3;
+            bool from_words:1;  // no command text, the words only live in the value cache
         };
 
         StreamOutput* stream;
@@ -66,7 +79,20 @@ class Gcode {
 
     private:
         void prepare_cached_values(bool strip=true);
+        void set_command(const char *cmd);
+        void release_command();
+        void index_letters();
+        void copy_words(const Gcode& to_copy);
         char *command;
+        char inline_command[GCODE_INLINE_SIZE];
+        uint8_t command_slab_size; // non zero if command came from the slabs
+
+        // which letters A-Z appear in command, built once when the command is set
+        uint32_t letter_mask;
+        // get_value() results are evaluated once per letter and cached here
+        mutable uint32_t value_mask;
+        mutable float word_values[26];
+        mutable uint16_t word_ends[26]; // offset past the value in command, 0 if no value was found
         float parse_expression(const char*& expr) const;
         float parse_term(const char*& expr) const;
         float parse_factor(const char*& expr) const;
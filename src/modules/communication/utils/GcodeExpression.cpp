@@ -0,0 +1,351 @@
+/*
+      This file is part of Smoothie (http://smoothieware.org/). The motion control part is heavily based on Grbl (https://github.com/simen/grbl).
+      Smoothie is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+      Smoothie is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+      You should have received a copy of the GNU General Public License along with Smoothie. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "GcodeExpression.h"
+#include "Gcode.h"
+#include "libs/Kernel.h"
+#include "libs/StreamOutputPool.h"
+#include "platform_memory.h"
+
+#include <ctype.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// the cache holds this many programs, replaced in turn
+#define EXPRESSION_CACHE_SLOTS 8
+// the key is the text the expression was compiled from plus the few characters the parser looked at past it
+#define EXPRESSION_KEY_SIZE 48
+#define LOOKAHEAD 3
+
+namespace {
+    enum OPCODE {
+        OP_PUSH, OP_VAR,
+        OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_MOD, OP_POW,
+        OP_EQ, OP_NE, OP_GT, OP_GE, OP_LT, OP_LE,
+        OP_AND, OP_OR, OP_XOR, OP_NOR,
+        OP_SIN, OP_COS, OP_TAN, OP_ASIN, OP_ACOS, OP_ATAN, OP_SQRT, OP_ABS, OP_ROUND, OP_FIX, OP_FUP, OP_LN, OP_EXP,
+    };
+
+    struct name_t {
+        const char *name;
+        uint8_t len;
+        uint8_t code;
+    };
+
+    // in the order parse_factor() would find them
+    const name_t functions[] = {
+        {"asin", 4, OP_ASIN}, {"acos", 4, OP_ACOS}, {"atan", 4, OP_ATAN}, {"sqrt", 4, OP_SQRT},
+        {"round", 5, OP_ROUND}, {"ln", 2, OP_LN},
+        {"sin", 3, OP_SIN}, {"cos", 3, OP_COS}, {"tan", 3, OP_TAN}, {"abs", 3, OP_ABS},
+        {"fix", 3, OP_FIX}, {"fup", 3, OP_FUP}, {"exp", 3, OP_EXP},
+    };
+    const name_t comparisons[] = {
+        {"eq", 2, OP_EQ}, {"ne", 2, OP_NE}, {"gt", 2, OP_GT}, {"ge", 2, OP_GE}, {"lt", 2, OP_LT}, {"le", 2, OP_LE},
+    };
+    const name_t booleans[] = {
+        {"and", 3, OP_AND}, {"or", 2, OP_OR}, {"xor", 3, OP_XOR}, {"nor", 3, OP_NOR},
+    };
+
+    template<int N>
+    const name_t *match(const name_t (&names)[N], const char *p)
+    {
+        for (int i = 0; i < N; ++i) {
+            if (strncmp(p, names[i].name, names[i].len) == 0) return &names[i];
+        }
+        return nullptr;
+    }
+
+    // recursive descent over the same grammar as Gcode::parse_expression(), emitting instead of evaluating
+    struct Compiler {
+        const char *p;
+        GcodeExpression::program_t &prog;
+        bool ok;
+
+        Compiler(const char *text, GcodeExpression::program_t &pr) : p(text), prog(pr), ok(true) { prog.n_ops = 0; }
+
+        void skip() { while (isspace(*p)) p++; }
+
+        void emit(uint8_t code, float arg = 0)
+        {
+            if (prog.n_ops >= GcodeExpression::MAX_OPS) {
+                ok = false;
+                return;
+            }
+            prog.code[prog.n_ops] = code;
+            prog.arg[prog.n_ops] = arg;
+            prog.n_ops++;
+        }
+
+        void expression()
+        {
+            if (*p == ']') ok = false;
+            if (!ok) return;
+
+            term();
+            skip();
+            while (ok && (*p == '+' || *p == '-')) {
+                uint8_t op = *p == '+' ? OP_ADD : OP_SUB;
+                p++;
+                term();
+                emit(op);
+                skip();
+            }
+
+            const name_t *n = match(comparisons, p);
+            if (ok && n != nullptr) {
+                p += n->len;
+                skip();
+                expression();
+                emit(n->code);
+            }
+
+            n = match(booleans, p);
+            if (ok && n != nullptr) {
+                p += n->len;
+                skip();
+                expression();
+                emit(n->code);
+            }
+        }
+
+        void term()
+        {
+            factor();
+            skip();
+            while (ok && (*p == '*' || *p == '/' || strncmp(p, "mod", 3) == 0)) {
+                if (*p == '*' || *p == '/') {
+                    uint8_t op = *p == '*' ? OP_MUL : OP_DIV;
+                    p++;
+                    factor();
+                    emit(op);
+                } else {
+                    p += 3;
+                    skip();
+                    factor();
+                    emit(OP_MOD);
+                }
+                skip();
+            }
+        }
+
+        void factor()
+        {
+            if (!ok) return;
+            skip();
+
+            const name_t *f = match(functions, p);
+            if (f != nullptr) {
+                p += f->len;
+                if (*p != '[') {
+                    ok = false;
+                    return;
+                }
+                p++;
+                expression();
+                if (!ok || *p != ']') {
+                    ok = false;
+                    return;
+                }
+                p++;
+                emit(f->code);
+
+            } else if (*p == '[') {
+                p++;
+                expression();
+                if (!ok || *p != ']') {
+                    ok = false;
+                    return;
+                }
+                p++;
+
+            } else if (*p == '#') {
+                char *end;
+                long var = strtol(p + 1, &end, 10);
+                p = end;
+                emit(OP_VAR, var);
+
+            } else {
+                // the interpreter hides everything from the first E on, as an E is an axis word not an exponent
+                const char *e = p;
+                while (*e != '\0' && *e != 'E' && *e != 'e') e++;
+                char buf[32];
+                size_t n = e - p;
+                if (n >= sizeof(buf)) n = sizeof(buf) - 1;
+                memcpy(buf, p, n);
+                buf[n] = '\0';
+
+                char *end;
+                float v = strtof(buf, &end);
+                // a number as long as the copy might have been cut short
+                if (end == buf || (size_t)(end - buf) >= sizeof(buf) - 1) {
+                    ok = false;
+                    return;
+                }
+                p += end - buf;
+                emit(OP_PUSH, v);
+            }
+
+            while (ok && *p == '^') {
+                p++;
+                factor();
+                emit(OP_POW);
+            }
+        }
+    };
+
+    struct entry_t {
+        char key[EXPRESSION_KEY_SIZE];
+        uint8_t key_len;    // includes the nul when the text ended inside the key
+        uint8_t end;        // offset where evaluation stops
+        GcodeExpression::program_t prog;
+    };
+
+    entry_t *cache = nullptr;
+    uint8_t cache_used = 0;
+    uint8_t cache_next = 0;
+
+    void halt(const char *msg)
+    {
+        THEKERNEL->set_halt_reason(MANUAL);
+        THEKERNEL->call_event(ON_HALT, nullptr);
+        THEKERNEL->streams->printf("%s\n", msg);
+    }
+}
+
+bool GcodeExpression::compile(const char *text, const char **end, program_t &prog)
+{
+    Compiler c(text, prog);
+    c.skip();
+    c.expression();
+    if (!c.ok || *c.p == ']' || prog.n_ops == 0) return false;
+
+    *end = c.p;
+    return true;
+}
+
+float GcodeExpression::run(const program_t &prog)
+{
+    const float DEG_TO_RAD = 3.141592653589793238463 / 180.0;
+    const float equal_tolerance = 1e-6;
+    float stack[MAX_OPS];
+    int sp = 0;
+
+    for (int i = 0; i < prog.n_ops; ++i) {
+        uint8_t code = prog.code[i];
+        if (code == OP_PUSH) {
+            stack[sp++] = prog.arg[i];
+            continue;
+        }
+        if (code == OP_VAR) {
+            stack[sp++] = Gcode::get_variable((int)prog.arg[i]);
+            continue;
+        }
+
+        if (code >= OP_SIN) {
+            float &a = stack[sp - 1];
+            switch (code) {
+                case OP_SIN: a = sin(a * DEG_TO_RAD); break;
+                case OP_COS: a = cos(a * DEG_TO_RAD); break;
+                case OP_TAN: a = (fmod(a - 90, 180) == 0) ? NAN : tan(a * DEG_TO_RAD); break;
+                case OP_ASIN: a = asin(a) / DEG_TO_RAD; break;
+                case OP_ACOS: a = acos(a) / DEG_TO_RAD; break;
+                case OP_ATAN: a = atan(a) / DEG_TO_RAD; break;
+                case OP_SQRT: a = sqrt(a); break;
+                case OP_ABS: a = fabs(a); break;
+                case OP_ROUND: a = round(a); break;
+                case OP_FIX: a = floor(a); break;
+                case OP_FUP: a = ceil(a); break;
+                case OP_LN: a = log(a); break;
+                case OP_EXP: a = exp(a); break;
+            }
+            continue;
+        }
+
+        float b = stack[--sp];
+        float &a = stack[sp - 1];
+        switch (code) {
+            case OP_ADD: a += b; break;
+            case OP_SUB: a -= b; break;
+            case OP_MUL: a *= b; break;
+            case OP_DIV:
+                if (b != 0) {
+                    a /= b;
+                } else {
+                    halt("Division by zero");
+                    a = NAN;
+                }
+                break;
+            case OP_MOD:
+                if (b != 0) {
+                    a = fmod(a, b);
+                } else {
+                    halt("Modulo by zero");
+                    a = NAN;
+                }
+                break;
+            case OP_POW: a = pow(a, b); break;
+            case OP_EQ: a = (fabs(a - b) < equal_tolerance) ? 1.0f : 0.0f; break;
+            case OP_NE: a = (fabs(a - b) < equal_tolerance) ? 0.0f : 1.0f; break;
+            case OP_GT: a = (a > b) ? 1.0f : 0.0f; break;
+            case OP_GE: a = (a >= b) ? 1.0f : 0.0f; break;
+            case OP_LT: a = (a < b) ? 1.0f : 0.0f; break;
+            case OP_LE: a = (a <= b) ? 1.0f : 0.0f; break;
+            case OP_AND: a = (a != 0 && b != 0) ? 1.0f : 0.0f; break;
+            case OP_OR: a = (a != 0 || b != 0) ? 1.0f : 0.0f; break;
+            case OP_XOR: a = ((a != 0) != (b != 0)) ? 1.0f : 0.0f; break;
+            case OP_NOR: a = (a == 0 && b == 0) ? 1.0f : 0.0f; break;
+        }
+    }
+
+    return stack[0];
+}
+
+bool GcodeExpression::evaluate(const char *text, char **end, float &result)
+{
+    if (cache == nullptr) {
+        cache = (entry_t *)AHB.alloc(sizeof(entry_t) * EXPRESSION_CACHE_SLOTS);
+        if (cache == nullptr) cache = (entry_t *)malloc(sizeof(entry_t) * EXPRESSION_CACHE_SLOTS);
+    }
+
+    if (cache != nullptr) {
+        for (int i = 0; i < cache_used; ++i) {
+            const entry_t &e = cache[i];
+            int n = 0;
+            while (n < e.key_len && text[n] == e.key[n]) n++;
+            if (n == e.key_len) {
+                result = run(e.prog);
+                *end = const_cast<char *>(text) + e.end;
+                return true;
+            }
+        }
+    }
+
+    program_t prog;
+    const char *stop;
+    if (!compile(text, &stop, prog)) return false;
+
+    // what the parser could have looked at decides the key, so a longer expression sharing the text is not taken for this one
+    size_t len = stop - text;
+    size_t key_len = len;
+    while (key_len < len + LOOKAHEAD && text[key_len] != '\0') key_len++;
+    if (key_len < len + LOOKAHEAD) key_len++;   // the nul
+
+    if (cache != nullptr && key_len <= EXPRESSION_KEY_SIZE) {
+        entry_t &e = cache[cache_next];
+        memcpy(e.key, text, key_len);
+        e.key_len = key_len;
+        e.end = len;
+        e.prog = prog;
+        cache_next = (cache_next + 1) % EXPRESSION_CACHE_SLOTS;
+        if (cache_used < EXPRESSION_CACHE_SLOTS) cache_used++;
+    }
+
+    result = run(prog);
+    *end = const_cast<char *>(stop);
+    return true;
+}
@@ -0,0 +1,40 @@
+/*
+      This file is part of Smoothie (http://smoothieware.org/). The motion control part is heavily based on Grbl (https://github.com/simen/grbl).
+      Smoothie is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+      Smoothie is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+      You should have received a copy of the GNU General Public License along with Smoothie. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Macro expressions compiled to a short RPN program.
+ *
+ * The compiler follows the grammar of Gcode::parse_expression() exactly, including where it stops,
+ * but only parses: variables are resolved to their number once and read when the program is run.
+ * Anything that will not compile, because it is malformed or too long, is left to the interpreter
+ * in Gcode, which reports the error the way it always has.
+ *
+ * Compiled programs are kept in a small cache keyed by their text, so a macro evaluating the same
+ * expression in a loop only parses it the first time.
+ */
+class GcodeExpression {
+    public:
+        static const int MAX_OPS = 24;
+
+        struct program_t {
+            uint8_t n_ops;
+            uint8_t code[MAX_OPS];
+            float arg[MAX_OPS];     // the constant pushed, or the variable number read
+        };
+
+        // compiles the expression at text, end is set to where the interpreter would have stopped
+        static bool compile(const char *text, const char **end, program_t &prog);
+        // runs a compiled program, errors halt just as the interpreter's do and give NAN
+        static float run(const program_t &prog);
+
+        // evaluates the expression at text from the cache, compiling it on a miss, false if it will not compile
+        static bool evaluate(const char *text, char **end, float &result);
+};
@@ -17,6 +17,7 @@
 #include "libs/StreamOutputPool.h"
 #include "StepTicker.h"
 #include "platform_memory.h"
+#include "RSqrt.h"
 
 #include "mri.h"
 #include <inttypes.h>
@@ -27,6 +28,7 @@ using std::string;
 
 uint8_t Block::n_actuators= 0;
 double Block::fp_scale= 0;
+bool Block::fast_fixed_point= true;
 
 // A block represents a movement, it's length for each stepper motor, and the corresponding acceleration curves.
 // It's stacked on a queue, and that queue is then executed in order, to move the motors.
@@ -39,9 +41,10 @@ Block::Block()
     clear();
 }
 
-void Block::init(uint8_t n)
+void Block::init(uint8_t n, bool fast_fp)
 {
     n_actuators= n;
+    fast_fixed_point= fast_fp;
     fp_scale= (double)STEPTICKER_FPSCALE / pow((double)STEP_TICKER_FREQUENCY, 2.0); // we scale up by fixed point offset first to avoid tiny values
 }
 
@@ -58,6 +61,10 @@ void Block::clear()
     entry_speed         = 0.0F;
     exit_speed          = 0.0F;
     acceleration        = 100.0F; // we don't want to get divide by zeroes if this is not set
+    acceleration_per_second = 0.0F;
+    inv_acceleration_per_second = 0.0F;
+    jerk                = 0.0F;
+    shaper_time         = 0.0F;
     initial_rate        = 0.0F;
     accelerate_until    = 0;
     decelerate_after    = 0;
@@ -65,46 +72,29 @@ void Block::clear()
     recalculate_flag    = false;
     nominal_length_flag = false;
     max_entry_speed     = 0.0F;
+    max_junction_speed  = 0.0F;
+    programmed_speed    = 0.0F;
+    max_speed           = 0.0F;
+    trapezoid_entry_speed = -1.0F;
     is_ticking          = false;
     is_g123             = false;
-    locked              = false;
+    is_fp32             = false;
+    is_scurve           = false;
+    junction_nominal    = false;
+    is_dwell            = false;
+    n_events            = 0;
 
 	s_value             = 0.0F;
-    // 2024
-    /*
-	move_axis           = 0;
-    s_values[0]         = 0.0F;
-    s_values[1]         = 0.0F;
-    s_values[2]         = 0.0F;
-    s_values[3]         = 0.0F;
-    s_values[4]         = 0.0F;
-    s_values[5]         = 0.0F;
-    s_values[6]         = 0.0F;
-    s_values[7]         = 0.0F;
-    s_count 			= 1;
-    */
+    s_count             = 0;
 
     total_move_ticks= 0;
-
-    for(int i = 0; i < n_actuators; ++i) {
-        tick_info[i].steps_per_tick= 0;
-        tick_info[i].counter= 0;
-        tick_info[i].acceleration_change= 0;
-        tick_info[i].deceleration_change= 0;
-        tick_info[i].plateau_rate= 0;
-        tick_info[i].steps_to_move= 0;
-        tick_info[i].step_count= 0;
-        tick_info[i].next_accel_event= 0;
-    }
-}
-
-// Only used for continuous mode to reuse the same block over and over
-void Block::reset(tickinfo_t *saved)
-{
-    for(int i = 0; i < n_actuators; ++i) {
-        if(saved[i].steps_to_move == 0) continue;
-        tick_info[i]= saved[i];
-    }
+    next_accel_event= 0;
+    accel_jerk_ticks= 0;
+    decel_jerk_ticks= 0;
+    active_mask= 0;
+    dominant_motor= 0;
+    rates.fp64= {0, 0, 0, 0, 0, 0, 0};
+    axis_ratio.fill(0);
 }
 
 void Block::debug() const
@@ -113,12 +103,13 @@ void Block::debug() const
     for (size_t i = E_AXIS; i < n_actuators; ++i) {
         THEKERNEL->streams->printf("%c:%lu ", 'A' + i-E_AXIS, this->steps[i]);
     }
-    THEKERNEL->streams->printf("(max:%lu) nominal:r%1.4f/s%1.4f mm:%1.4f acc:%1.2f accu:%lu decu:%lu ticks:%lu rates:%1.4f/%1.4f entry/max:%1.4f/%1.4f exit:%1.4f primary:%d ready:%d locked:%d ticking:%d recalc:%d nomlen:%d time:%f\r\n",
+    THEKERNEL->streams->printf("(max:%lu) nominal:r%1.4f/s%1.4f mm:%1.4f acc:%1.2f jerk:%1.2f accu:%lu decu:%lu ticks:%lu rates:%1.4f/%1.4f entry/max:%1.4f/%1.4f exit:%1.4f primary:%d ready:%d ticking:%d recalc:%d nomlen:%d time:%f\r\n",
                                this->steps_event_count,
                                this->nominal_rate,
                                this->nominal_speed,
                                this->millimeters,
                                this->acceleration,
+                               this->jerk,
                                this->accelerate_until,
                                this->decelerate_after,
                                this->total_move_ticks,
@@ -129,7 +120,6 @@ void Block::debug() const
                                this->exit_speed,
                                this->primary_axis,
                                this->is_ready,
-                               this->locked,
                                this->is_ticking,
                                recalculate_flag ? 1 : 0,
                                nominal_length_flag ? 1 : 0,
@@ -149,30 +139,31 @@ void Block::debug() const
 */
 void Block::calculate_trapezoid( float entryspeed, float exitspeed )
 {
-    // if block is currently executing, don't touch anything!
-    if (is_ticking) return;
+    // if block is currently executing, don't touch anything! A dwell has no trapezoid
+    if (is_ticking || is_dwell) return;
 
     float initial_rate = this->nominal_rate * (entryspeed / this->nominal_speed); // steps/sec
     float final_rate = this->nominal_rate * (exitspeed / this->nominal_speed);
     //printf("Initial rate: %f, final_rate: %f\n", initial_rate, final_rate);
     // How many steps ( can be fractions of steps, we need very precise values ) to accelerate and decelerate
-    // This is a simplification to get rid of rate_delta and get the steps/s² accel directly from the mm/s² accel
-    float acceleration_per_second = (this->acceleration * this->steps_event_count) / this->millimeters;
+    // The steps/s² accel was worked out from the mm/s² accel by Planner::append_block(), along with its inverse so the
+    // times below are multiplies rather than divides
+    float acceleration_per_second = this->acceleration_per_second;
 
-    float maximum_possible_rate = sqrtf( ( this->steps_event_count * acceleration_per_second ) + ( ( powf(initial_rate, 2) + powf(final_rate, 2) ) / 2.0F ) );
+    float maximum_possible_rate = sqrtf_fast( ( this->steps_event_count * acceleration_per_second ) + ( ( initial_rate * initial_rate + final_rate * final_rate ) / 2.0F ) );
 
     //printf("id %d: acceleration_per_second: %f, maximum_possible_rate: %f steps/sec, %f mm/sec\n", this->id, acceleration_per_second, maximum_possible_rate, maximum_possible_rate/100);
 
     // Now this is the maximum rate we'll achieve this move, either because
     // it's the higher we can achieve, or because it's the higher we are
     // allowed to achieve
-    this->maximum_rate = std::min(maximum_possible_rate, this->nominal_rate);
+    float maximum_rate = std::min(maximum_possible_rate, this->nominal_rate);
 
     // Now figure out how long it takes to accelerate in seconds
-    float time_to_accelerate = ( this->maximum_rate - initial_rate ) / acceleration_per_second;
+    float time_to_accelerate = ( maximum_rate - initial_rate ) * this->inv_acceleration_per_second;
 
     // Now figure out how long it takes to decelerate
-    float time_to_decelerate = ( final_rate -  this->maximum_rate ) / -acceleration_per_second;
+    float time_to_decelerate = ( maximum_rate - final_rate ) * this->inv_acceleration_per_second;
 
     // Now we know how long it takes to accelerate and decelerate, but we must
     // also know how long the entire move takes so we can figure out how long
@@ -182,14 +173,14 @@ void Block::calculate_trapezoid( float entryspeed, float exitspeed )
     // Only if there is actually a plateau ( we are limited by nominal_rate )
     if(maximum_possible_rate > this->nominal_rate) {
         // Figure out the acceleration and deceleration distances ( in steps )
-        float acceleration_distance = ( ( initial_rate + this->maximum_rate ) / 2.0F ) * time_to_accelerate;
-        float deceleration_distance = ( ( this->maximum_rate + final_rate ) / 2.0F ) * time_to_decelerate;
+        float acceleration_distance = ( ( initial_rate + maximum_rate ) / 2.0F ) * time_to_accelerate;
+        float deceleration_distance = ( ( maximum_rate + final_rate ) / 2.0F ) * time_to_decelerate;
 
         // Figure out the plateau steps
         float plateau_distance = this->steps_event_count - acceleration_distance - deceleration_distance;
 
         // Figure out the plateau time in seconds
-        plateau_time = plateau_distance / this->maximum_rate;
+        plateau_time = plateau_distance / maximum_rate;
     }
 
     // Figure out how long the move takes total ( in seconds )
@@ -205,9 +196,10 @@ void Block::calculate_trapezoid( float entryspeed, float exitspeed )
     // the exact rate we want
 
     // First off round total time, acceleration time and deceleration time in ticks
-    uint32_t acceleration_ticks = floorf( time_to_accelerate * STEP_TICKER_FREQUENCY );
-    uint32_t deceleration_ticks = floorf( time_to_decelerate * STEP_TICKER_FREQUENCY );
-    uint32_t total_move_ticks   = floorf( total_move_time    * STEP_TICKER_FREQUENCY );
+    // a time that is a whole number of ticks but for float rounding gets that number rather than one less
+    uint32_t acceleration_ticks = floorf( time_to_accelerate * STEP_TICKER_FREQUENCY + 0.001F );
+    uint32_t deceleration_ticks = floorf( time_to_decelerate * STEP_TICKER_FREQUENCY + 0.001F );
+    uint32_t total_move_ticks   = floorf( total_move_time    * STEP_TICKER_FREQUENCY + 0.001F );
 
     // Now deduce the plateau time for those new values expressed in tick
     //uint32_t plateau_ticks = total_move_ticks - acceleration_ticks - deceleration_ticks;
@@ -216,34 +208,95 @@ void Block::calculate_trapezoid( float entryspeed, float exitspeed )
     float acceleration_time = acceleration_ticks / STEP_TICKER_FREQUENCY;  // This can be moved into the operation below, separated for clarity, note we need to do this instead of using time_to_accelerate(seconds) directly because time_to_accelerate(seconds) and acceleration_ticks(seconds) do not have the same value anymore due to the rounding
     float deceleration_time = deceleration_ticks / STEP_TICKER_FREQUENCY;
 
-    float acceleration_in_steps = (acceleration_time > 0.0F ) ? ( this->maximum_rate - initial_rate ) / acceleration_time : 0;
-    float deceleration_in_steps =  (deceleration_time > 0.0F ) ? ( this->maximum_rate - final_rate ) / deceleration_time : 0;
+    float acceleration_in_steps = (acceleration_time > 0.0F ) ? ( maximum_rate - initial_rate ) / acceleration_time : 0;
+    float deceleration_in_steps =  (deceleration_time > 0.0F ) ? ( maximum_rate - final_rate ) / deceleration_time : 0;
+
+    // everything the stepticker uses is worked out in a staging copy first and only then published, so the stepticker
+    // never has to skip a tick because it sees a half updated block
+    trapezoid_t tr;
+    tr.accelerate_until = acceleration_ticks;
+    tr.decelerate_after = total_move_ticks - deceleration_ticks;
+    tr.total_move_ticks = total_move_ticks;
+    tr.initial_rate = initial_rate;
+    tr.maximum_rate = maximum_rate;
+
+    // a jerk limited ramp takes the same ticks as the trapezoid's ramp and covers the same distance, so all the planning
+    // still holds, it just eases the acceleration in and out at each end
+    float accel_jerk_in_steps = 0, decel_jerk_in_steps = 0;
+    tr.is_scurve = this->jerk > 0.0F || this->shaper_time > 0.0F;
+    tr.accel_jerk_ticks = 0;
+    tr.decel_jerk_ticks = 0;
+    if(tr.is_scurve) {
+        float jerk_per_second = (this->jerk * this->steps_event_count) / this->millimeters; // steps/sec³
+        tr.accel_jerk_ticks = jerk_ticks(maximum_rate - initial_rate, acceleration_ticks, jerk_per_second, shaper_time, accel_jerk_in_steps);
+        tr.decel_jerk_ticks = jerk_ticks(maximum_rate - final_rate, deceleration_ticks, jerk_per_second, shaper_time, decel_jerk_in_steps);
+    }
+
+    // prepare the block for stepticker
+    this->prepare(tr, acceleration_in_steps, deceleration_in_steps, accel_jerk_in_steps, decel_jerk_in_steps);
 
-    // we have a potential race condition here as we could get interrupted anywhere in the middle of this call, we need to lock
-    // the updates to the blocks to get around it
-    this->locked= true;
-    // Now figure out the two acceleration ramp change events in ticks
-    this->accelerate_until = acceleration_ticks;
-    this->decelerate_after = total_move_ticks - deceleration_ticks;
+    this->publish(tr, entryspeed, exitspeed);
+}
 
-    // We now have everything we need for this block to call a Steppermotor->move method !!!!
-    // Theorically, if accel is done per tick, the speed curve should be perfect.
-    this->total_move_ticks = total_move_ticks;
+// Works out the jerk phase at each end of a ramp of ramp_ticks that changes the rate by rate_change (steps/sec).
+// The rate changes by jerk * tj * (ramp_time - tj) so tj is as short as the jerk_per_second limit (steps/sec³) allows,
+// ramp_jerk is set to the jerk that reaches the rate exactly in the rounded ticks.
+// A jerk phase of min_time secs shapes the acceleration: easing it in over one period of a resonance puts no energy
+// at that frequency into the machine, so the ramps ring no more than a slow move does. jerk_per_second 0 is no limit.
+// NOTE the peak acceleration is higher than the trapezoid's to make up for the eased ends, up to twice as high when
+// the ramp is too short for the jerk limit and it has no constant acceleration part
+uint32_t Block::jerk_ticks(float rate_change, uint32_t ramp_ticks, float jerk_per_second, float min_time, float &ramp_jerk)
+{
+    ramp_jerk = 0;
+    if(ramp_ticks < 2 || rate_change <= 0.0F) return 0;
+
+    float ramp_time = ramp_ticks / STEP_TICKER_FREQUENCY;
+    float tj = 0;
+    if(jerk_per_second > 0.0F) {
+        float d = (ramp_time * ramp_time) - (4.0F * rate_change / jerk_per_second);
+        tj = (d > 0.0F) ? (ramp_time - sqrtf(d)) / 2.0F : ramp_time / 2.0F;
+    }
+    if(tj < min_time) tj = min_time;
 
-    this->initial_rate = initial_rate;
-    this->exit_speed = exitspeed;
+    uint32_t ticks = roundf(tj * STEP_TICKER_FREQUENCY);
+    if(ticks < 1) ticks = 1;
+    if(ticks > ramp_ticks / 2) ticks = ramp_ticks / 2;
 
-    // prepare the block for stepticker
-    this->prepare(acceleration_in_steps, deceleration_in_steps);
+    float jerk_time = ticks / STEP_TICKER_FREQUENCY;
+    ramp_jerk = rate_change / (jerk_time * (ramp_time - jerk_time));
+    return ticks;
+}
 
-    this->locked= false;
+// the next tick after tick where the jerk of an S-curve block changes, past the end of the block if there are no more
+//   0..ja        jerk up             D..D+jd         jerk down
+//   ja..A-ja     constant accel      D+jd..T-jd      constant decel
+//   A-ja..A      jerk down           T-jd..T         jerk up
+uint32_t Block::next_scurve_event(uint32_t tick) const
+{
+    uint32_t next = total_move_ticks + 1;
+    uint32_t events[6];
+    int n = 0;
+    if(accelerate_until != 0) {
+        events[n++] = accel_jerk_ticks;
+        events[n++] = accelerate_until - accel_jerk_ticks;
+        events[n++] = accelerate_until;
+    }
+    if(decelerate_after < total_move_ticks) {
+        events[n++] = decelerate_after;
+        events[n++] = decelerate_after + decel_jerk_ticks;
+        events[n++] = total_move_ticks - decel_jerk_ticks;
+    }
+    for (int i = 0; i < n; i++) {
+        if(events[i] > tick && events[i] < next) next = events[i];
+    }
+    return next;
 }
 
 // Calculates the maximum allowable speed at this point when you must be able to reach target_velocity using the
 // acceleration within the allotted distance.
 float Block::max_allowable_speed(float acceleration, float target_velocity, float distance)
 {
-    return sqrtf(target_velocity * target_velocity - 2.0F * acceleration * distance);
+    return sqrtf_fast(target_velocity * target_velocity - 2.0F * acceleration * distance);
 }
 
 // Called by Planner::recalculate() when scanning the plan from last to first entry.
@@ -316,13 +369,25 @@ float Block::max_exit_speed()
     return min(max, nominal_speed);
 }
 
+// work out which motors move and the ratio of their steps to the dominant motor's, these never change once the block has its steps
+void Block::prepare_motors()
+{
+    this->active_mask = 0;
+    this->dominant_motor = 0;
+    for (uint8_t m = 0; m < n_actuators; m++) {
+        uint32_t steps = this->steps[m];
+        this->axis_ratio[m] = (uint32_t)(((uint64_t)steps << 31) / this->steps_event_count); // 1.31 fixed point
+        if(steps == 0) continue;
+        this->active_mask |= (1UL << m);
+        if(steps > this->steps[this->dominant_motor]) this->dominant_motor = m;
+    }
+}
+
 // prepare block for the step ticker, called everytime the block changes
 // this is done during planning so does not delay tick generation and step ticker can simply grab the next block during the interrupt
-void Block::prepare(float acceleration_in_steps, float deceleration_in_steps)
+// only the rates of the dominant motor are kept, the step ticker scales them by axis_ratio for each motor when it starts the block
+void Block::prepare(trapezoid_t &tr, float acceleration_in_steps, float deceleration_in_steps, float accel_jerk_in_steps, float decel_jerk_in_steps) const
 {
-
-    float inv = 1.0F / this->steps_event_count;
-
     // Now figure out the acceleration PER TICK, this should ideally be held as a double as it's very critical to the block timing
     // steps/tick^2
     // was....
@@ -331,57 +396,93 @@ void Block::prepare(float acceleration_in_steps, float deceleration_in_steps)
     double acceleration_per_tick = acceleration_in_steps * fp_scale; // this is now scaled to fit a 2.30 fixed point number
     double deceleration_per_tick = deceleration_in_steps * fp_scale;
 
-    for (uint8_t m = 0; m < n_actuators; m++) {
-        uint32_t steps = this->steps[m];
-        this->tick_info[m].steps_to_move = steps;
-        if(steps == 0) continue;
+    // short blocks can use 1.31 fixed point, the rates are kept well below one step per tick so a small overshoot can not overflow
+    // jerk per tick is far too small for 1.31 so S-curves always use 2.62
+    tr.is_fp32 = !tr.is_scurve && fast_fixed_point && tr.total_move_ticks < STEPTICKER_FP32_MAX_TICKS &&
+                 std::max(tr.initial_rate, tr.maximum_rate) < STEP_TICKER_FREQUENCY / 2;
 
-        float aratio = inv * steps;
+    tr.next_accel_event = tr.total_move_ticks + 1;
 
-        this->tick_info[m].steps_per_tick = (int64_t)round((((double)this->initial_rate * aratio) / STEP_TICKER_FREQUENCY) * STEPTICKER_FPSCALE); // steps/sec / tick frequency to get steps per tick in 2.62 fixed point
-        this->tick_info[m].counter = 0; // 2.62 fixed point
-        this->tick_info[m].step_count = 0;
-        this->tick_info[m].next_accel_event = this->total_move_ticks + 1;
+    double acceleration_change = 0;
+    if(tr.accelerate_until != 0) { // If the next accel event is the end of accel
+        tr.next_accel_event = tr.accelerate_until;
+        acceleration_change = acceleration_per_tick;
 
-        double acceleration_change = 0;
-        if(this->accelerate_until != 0) { // If the next accel event is the end of accel
-            this->tick_info[m].next_accel_event = this->accelerate_until;
-            acceleration_change = acceleration_per_tick;
+    } else if(tr.decelerate_after == 0 /*&& tr.accelerate_until == 0*/) {
+        // we start off decelerating
+        acceleration_change = -deceleration_per_tick;
 
-        } else if(this->decelerate_after == 0 /*&& this->accelerate_until == 0*/) {
-            // we start off decelerating
-            acceleration_change = -deceleration_per_tick;
+    } else if(tr.decelerate_after != tr.total_move_ticks /*&& tr.accelerate_until == 0*/) {
+        // If the next event is the start of decel ( don't set this if the next accel event is accel end )
+        tr.next_accel_event = tr.decelerate_after;
+    }
 
-        } else if(this->decelerate_after != this->total_move_ticks /*&& this->accelerate_until == 0*/) {
-            // If the next event is the start of decel ( don't set this if the next accel event is accel end )
-            this->tick_info[m].next_accel_event = this->decelerate_after;
+    // already converted to fixed point just needs scaling by ratio
+    //#define STEPTICKER_TOFP(x) ((int64_t)round((double)(x)*STEPTICKER_FPSCALE))
+    if(tr.is_fp32) {
+        // same values scaled down to 1.31, the rates in steps per tick are all less than 1.0
+        const double scale32 = (double)STEPTICKER_FPSCALE32 / STEPTICKER_FPSCALE;
+        tr.rates.fp32.steps_per_tick= (int32_t)round(((double)tr.initial_rate / STEP_TICKER_FREQUENCY) * STEPTICKER_FPSCALE32);
+        tr.rates.fp32.acceleration_change= (int32_t)round(acceleration_change * scale32);
+        tr.rates.fp32.deceleration_change= -(int32_t)round(deceleration_per_tick * scale32);
+        tr.rates.fp32.plateau_rate= (int32_t)round(((double)tr.maximum_rate / STEP_TICKER_FREQUENCY) * STEPTICKER_FPSCALE32);
+        tr.rates.fp32.jerk= 0;
+        tr.rates.fp32.accel_jerk= 0;
+        tr.rates.fp32.decel_jerk= 0;
+        return;
+    }
+
+    tr.rates.fp64.steps_per_tick = (int64_t)round(((double)tr.initial_rate / STEP_TICKER_FREQUENCY) * STEPTICKER_FPSCALE); // steps/sec / tick frequency to get steps per tick in 2.62 fixed point
+    tr.rates.fp64.acceleration_change= (int64_t)round(acceleration_change);
+    tr.rates.fp64.deceleration_change= -(int64_t)round(deceleration_per_tick);
+    tr.rates.fp64.plateau_rate= (int64_t)round(((double)tr.maximum_rate / STEP_TICKER_FREQUENCY) * STEPTICKER_FPSCALE);
+    tr.rates.fp64.jerk= 0;
+    tr.rates.fp64.accel_jerk= 0;
+    tr.rates.fp64.decel_jerk= 0;
+
+    if(tr.is_scurve) {
+        // the acceleration starts from 0 and the jerk ramps it up, steps/tick³
+        tr.rates.fp64.accel_jerk= (int64_t)round(accel_jerk_in_steps * fp_scale / STEP_TICKER_FREQUENCY);
+        tr.rates.fp64.decel_jerk= (int64_t)round(decel_jerk_in_steps * fp_scale / STEP_TICKER_FREQUENCY);
+        tr.rates.fp64.acceleration_change= 0;
+        tr.rates.fp64.deceleration_change= 0;
+        if(tr.accelerate_until != 0) {
+            tr.rates.fp64.jerk= tr.rates.fp64.accel_jerk;
+            tr.next_accel_event= tr.accel_jerk_ticks != 0 ? tr.accel_jerk_ticks : tr.accelerate_until;
+        } else if(tr.decelerate_after == 0) {
+            tr.rates.fp64.jerk= -tr.rates.fp64.decel_jerk;
+            tr.next_accel_event= tr.decel_jerk_ticks != 0 ? tr.decel_jerk_ticks : tr.total_move_ticks + 1;
         }
+    }
+}
 
-        // already converted to fixed point just needs scaling by ratio
-        //#define STEPTICKER_TOFP(x) ((int64_t)round((double)(x)*STEPTICKER_FPSCALE))
-        this->tick_info[m].acceleration_change= (int64_t)round(acceleration_change * aratio);
-        this->tick_info[m].deceleration_change= -(int64_t)round(deceleration_per_tick * aratio);
-        this->tick_info[m].plateau_rate= (int64_t)round(((this->maximum_rate * aratio) / STEP_TICKER_FREQUENCY) * STEPTICKER_FPSCALE);
-
-        #if 0
-        THEKERNEL->streams->printf("spt: %08lX %08lX, ac: %08lX %08lX, dc: %08lX %08lX, pr: %08lX %08lX\n",
-            (uint32_t)(this->tick_info[m].steps_per_tick>>32), // 2.62 fixed point
-            (uint32_t)(this->tick_info[m].steps_per_tick&0xFFFFFFFF), // 2.62 fixed point
-            (uint32_t)(this->tick_info[m].acceleration_change>>32), // 2.62 fixed point signed
-            (uint32_t)(this->tick_info[m].acceleration_change&0xFFFFFFFF), // 2.62 fixed point signed
-            (uint32_t)(this->tick_info[m].deceleration_change>>32), // 2.62 fixed point
-            (uint32_t)(this->tick_info[m].deceleration_change&0xFFFFFFFF), // 2.62 fixed point
-            (uint32_t)(this->tick_info[m].plateau_rate>>32), // 2.62 fixed point
-            (uint32_t)(this->tick_info[m].plateau_rate&0xFFFFFFFF) // 2.62 fixed point
-        );
-        #endif
+// copy a staged trapezoid into the block, unless the stepticker has already started on it
+// the stepticker only takes blocks from its own interrupt so it can not see the copy half done
+void Block::publish(const trapezoid_t &tr, float entryspeed, float exitspeed)
+{
+    __disable_irq();
+    if(!is_ticking) {
+        this->accelerate_until = tr.accelerate_until;
+        this->decelerate_after = tr.decelerate_after;
+        this->total_move_ticks = tr.total_move_ticks;
+        this->next_accel_event = tr.next_accel_event;
+        this->initial_rate = tr.initial_rate;
+        this->maximum_rate = tr.maximum_rate;
+        this->exit_speed = exitspeed;
+        this->trapezoid_entry_speed = entryspeed;
+        this->is_fp32 = tr.is_fp32;
+        this->is_scurve = tr.is_scurve;
+        this->accel_jerk_ticks = tr.accel_jerk_ticks;
+        this->decel_jerk_ticks = tr.decel_jerk_ticks;
+        this->rates = tr.rates;
     }
+    __enable_irq();
 }
 
 // returns current rate (steps/sec) for the given actuator
 float Block::get_trapezoid_rate(int i) const
 {
-    // convert steps per tick from fixed point to float and convert to steps/sec
-    // FIXME steps_per_tick can change at any time, potential race condition if it changes while being read here
-    return STEPTICKER_FROMFP(tick_info[i].steps_per_tick) * STEP_TICKER_FREQUENCY;
+    // only the executing block has per motor rates, the step ticker keeps them
+    if(is_ticking) return StepTicker::getInstance()->get_trapezoid_rate(i);
+    return this->initial_rate * STEPTICKER_FROMFP32(this->axis_ratio[i]);
 }
@@ -9,13 +9,17 @@
 
 #include <bitset>
 #include "ActuatorCoordinates.h"
+#include "StepTicker.h"
 #include <cstdint>
 
+// with 1.31 the accumulated rounding of the per tick acceleration stays under half a step for blocks up to this many ticks
+#define STEPTICKER_FP32_MAX_TICKS 65536
+
 class Block {
     public:
         Block();
 
-        static void init(uint8_t);
+        static void init(uint8_t, bool fast_fixed_point = true);
 
         void calculate_trapezoid( float entry_speed, float exit_speed );
 
@@ -25,13 +29,51 @@ class Block {
         void debug() const;
         void ready() { is_ready= true; }
         void clear();
+        void prepare_motors();
         float get_trapezoid_rate(int i) const;
+        uint32_t next_scurve_event(uint32_t tick) const;
 
     private:
         float max_allowable_speed( float acceleration, float target_velocity, float distance);
-        void prepare(float acceleration_in_steps, float deceleration_in_steps);
+        static uint32_t jerk_ticks(float rate_change, uint32_t ramp_ticks, float jerk_per_second, float min_time, float &ramp_jerk);
+
+    public:
+        // the rates of the dominant motor, in 2.62 fixed point or when the block is short enough in 1.31 fixed point
+        // so the cortex-m3 step ticker can use 32 bit adds and compares
+        template<typename T>
+        struct rates_t {
+            T steps_per_tick;
+            T acceleration_change; // signed
+            T deceleration_change;
+            T plateau_rate;
+            // S-curve blocks ramp acceleration_change by jerk every tick, it is accel_jerk or decel_jerk in the jerk phases
+            T jerk;
+            T accel_jerk;
+            T decel_jerk;
+        };
+        union block_rates_t {
+            rates_t<int64_t> fp64;
+            rates_t<int32_t> fp32; // used when is_fp32 is set
+        };
+
+    private:
+        // the parts of the block the stepticker uses, staged by calculate_trapezoid
+        struct trapezoid_t {
+            uint32_t accelerate_until;
+            uint32_t decelerate_after;
+            uint32_t total_move_ticks;
+            uint32_t next_accel_event;
+            uint32_t accel_jerk_ticks;
+            uint32_t decel_jerk_ticks;
+            float initial_rate;
+            float maximum_rate;
+            block_rates_t rates;
+            bool is_fp32;
+            bool is_scurve;
+        };
 
         static double fp_scale; // optimize to store this as it does not change
+        static bool fast_fixed_point; // allow short blocks to use the 32 bit fast path
 
     public:
         std::array<uint32_t, k_max_actuators> steps; // Number of steps for each axis for this block
@@ -42,38 +84,48 @@ class Block {
         float entry_speed;
         float exit_speed;
         float acceleration;       // the acceleration for this block
+        float acceleration_per_second;     // the acceleration in steps/sec² of the dominant motor, and its inverse,
+        float inv_acceleration_per_second; // these never change once the block has its steps
+        float jerk;               // the jerk for this block in mm/sec³, 0 for a constant acceleration trapezoid
+        float shaper_time;        // the jerk phases last at least this many seconds, 0 for no minimum
         float initial_rate;       // Initial rate in steps per second
         float maximum_rate;
 
         float max_entry_speed;
+        float max_junction_speed;   // what junction deviation allowed for max_entry_speed before the nominal speeds either side
+        float programmed_speed;     // nominal_speed at 100% realtime override, 0 if the overrides do not apply to this move
+        float max_speed;            // the fastest the actuators and axis limits allow, a realtime override can not go past it
+        float trapezoid_entry_speed; // the entry speed the current trapezoid was calculated for
         unsigned int line;
 
         // this is tick info needed for this block. applies to all motors
         uint32_t accelerate_until;
         uint32_t decelerate_after;
         uint32_t total_move_ticks;
+        uint32_t next_accel_event; // the first acceleration change, the same for every motor
+        // an S-curve ramp has a jerk phase this long at each end, in between it accelerates at a constant rate
+        uint32_t accel_jerk_ticks;
+        uint32_t decel_jerk_ticks;
         std::bitset<k_max_actuators> direction_bits;     // Direction for each axis in bit form, relative to the direction port's mask
 
-        // this is the data needed to determine when each motor needs to be issued a step
-        using tickinfo_t= struct {
-            int64_t steps_per_tick; // 2.62 fixed point
-            int64_t counter; // 2.62 fixed point
-            int64_t acceleration_change; // 2.62 fixed point signed
-            int64_t deceleration_change; // 2.62 fixed point
-            int64_t plateau_rate; // 2.62 fixed point
-            uint32_t steps_to_move;
-            uint32_t step_count;
-            uint32_t next_accel_event;
-        };
-        void reset(tickinfo_t *saved);
+        // only the executing block needs per motor step accumulators, the step ticker keeps those and starts them from
+        // the dominant motor's rates scaled by each motor's ratio, so a block is a fraction of the size it would be
+        block_rates_t rates;
+        std::array<uint32_t, k_max_actuators> axis_ratio; // steps of each motor over steps_event_count in 1.31 fixed point
+        // bit set for each motor with steps, so the step ticker only looks at the motors that move
+        uint32_t active_mask;
+        uint8_t dominant_motor; // the motor with the most steps
 
-        // need info for each active motor
-        std::array<tickinfo_t, k_max_actuators> tick_info;
+    private:
+        void prepare(trapezoid_t &tr, float acceleration_in_steps, float deceleration_in_steps, float accel_jerk_in_steps, float decel_jerk_in_steps) const;
+        void publish(const trapezoid_t &tr, float entryspeed, float exitspeed);
 
+    public:
         static uint8_t n_actuators;
 
-        // 2024
-        // uint16_t s_values[8];
+        // a raster line can carry several laser powers, spread evenly along it (G1 X10 S0.1:0.5:1)
+        static const uint8_t k_max_s_values = 8;
+        uint16_t s_values[k_max_s_values];   // 1.11 Fixed point, only valid when s_count > 1
 
         struct {
             bool recalculate_flag:1;             // Planner flag to recalculate trapezoids on entry junction
@@ -82,11 +134,13 @@ class Block {
             bool primary_axis:1;                 // set if this move is a primary axis
             bool is_g123:1;                      // set if this is a G1, G2 or G3
             volatile bool is_ticking:1;          // set when this block is being actively ticked by the stepticker
-            volatile bool locked:1;              // set to true when the critical data is being updated, stepticker will have to skip if this is set
+            bool is_fp32:1;                      // rates use the 1.31 fixed point fast path
+            bool is_scurve:1;                    // ramps are jerk limited
+            bool junction_nominal:1;             // max_entry_speed is limited by the nominal speeds either side of the junction
+            bool is_dwell:1;                     // moves nothing, the step ticker counts out total_move_ticks
 
-            // 2024
-            // uint8_t  s_count:4;                  // number of laser intensity values
-            // uint8_t  move_axis:3;                // axis of greatest movement
+            uint8_t  s_count:4;                  // number of laser intensity values in s_values
+            uint8_t  n_events:4;                 // Conveyor events that are due as this block starts
             uint16_t s_value:12;                 // for laser 1.11 Fixed point
         };
 };
@@ -15,23 +15,22 @@ BlockQueue::BlockQueue()
     head_i = tail_i = length = 0;
     isr_tail_i = tail_i;
     ring = nullptr;
+    prefer_ahb = true;
+    ring_in_ahb = false;
 }
 
 BlockQueue::BlockQueue(unsigned int length)
 {
     head_i = tail_i = 0;
     isr_tail_i = tail_i;
-    void *v= AHB.alloc(sizeof(Block) * length);
-    if (v == nullptr) {
+    prefer_ahb = true;
+    ring = alloc_ring(length, ring_in_ahb);
+    if (ring == nullptr) {
         // TODO: Optionally add error reporting here (e.g., THEKERNEL->streams->printf("FATAL: BlockQueue alloc failed!\n");)
         // For now, just ensure the queue is unusable
         this->length = 0;
-        this->ring = nullptr;
-        // Consider adding __disable_irq(); while(1); or similar if this is truly fatal
         return;
     }
-    ring = new(v) Block[length];
-    // TODO: handle allocation failure
     this->length = length;
 }
 
@@ -43,16 +42,37 @@ BlockQueue::~BlockQueue()
 {
     head_i = tail_i = length = 0;
     isr_tail_i = tail_i;
-    if(ring != nullptr)
-        AHB.dealloc(ring); // delete [] ring;
+    free_ring(ring, ring_in_ahb);
     ring = nullptr;
 }
 
+/*
+ * ring storage, AHB SRAM keeps the main heap free, the heap is only used if AHB is not wanted or is full
+ */
+
+Block* BlockQueue::alloc_ring(unsigned int length, bool &in_ahb) const
+{
+    void *v = prefer_ahb ? AHB.alloc(sizeof(Block) * length) : nullptr;
+    in_ahb = (v != nullptr);
+    if (v == nullptr) {
+        v = malloc(sizeof(Block) * length);
+        if (v == nullptr) return nullptr;
+    }
+    return new(v) Block[length];
+}
+
+void BlockQueue::free_ring(Block* r, bool in_ahb)
+{
+    if (r == nullptr) return;
+    if (in_ahb) AHB.dealloc(r);
+    else free(r);
+}
+
 /*
  * index accessors (protected)
  */
 
-unsigned int BlockQueue::next(unsigned int item) const
+RAMFUNC unsigned int BlockQueue::next(unsigned int item) const
 {
     if (length == 0)
         return 0;
@@ -120,7 +140,7 @@ Block* BlockQueue::tail_ref()
     return &ring[tail_i];
 }
 
-Block* BlockQueue::item_ref(unsigned int i)
+RAMFUNC Block* BlockQueue::item_ref(unsigned int i)
 {
     return &ring[i];
 }
@@ -159,6 +179,16 @@ bool BlockQueue::is_empty() const
     return r;
 }
 
+unsigned int BlockQueue::count() const
+{
+    if (length == 0)
+        return 0;
+
+    // snapshot the indices as head_i may move under us
+    unsigned int h = head_i, t = tail_i;
+    return (h >= t) ? (h - t) : (length - t + h);
+}
+
 /*
  * resize
  */
@@ -173,12 +203,11 @@ bool BlockQueue::resize(unsigned int length)
 
             if (is_empty()) // check again in case something was pushed
             {
-                head_i = tail_i = this->length = 0;
+                head_i = tail_i = isr_tail_i = this->length = 0;
 
                 __enable_irq();
 
-                if (ring != nullptr)
-                    AHB.dealloc(ring); // delete [] ring;
+                free_ring(ring, ring_in_ahb);
                 ring = nullptr;
 
                 return true;
@@ -190,36 +219,33 @@ bool BlockQueue::resize(unsigned int length)
         }
 
         // Note: we don't use realloc so we can fall back to the existing ring if allocation fails
-        void *v= AHB.alloc(sizeof(Block) * length);
-        if (v == nullptr) {
-            // Allocation failed, cannot resize
-            return false;
-        }
-        Block* newring = new(v) Block[length];
+        bool new_in_ahb;
+        Block* newring = alloc_ring(length, new_in_ahb);
 
         if (newring != nullptr)
         {
             Block* oldring = ring;
+            bool old_in_ahb = ring_in_ahb;
 
             __disable_irq();
 
             if (is_empty()) // check again in case something was pushed while malloc did its thing
             {
                 ring = newring;
+                ring_in_ahb = new_in_ahb;
                 this->length = length;
-                head_i = tail_i = 0;
+                head_i = tail_i = isr_tail_i = 0;
 
                 __enable_irq();
 
-                if (oldring != nullptr)
-                    AHB.dealloc(oldring); // delete [] oldring;
+                free_ring(oldring, old_in_ahb);
 
                 return true;
             }
 
             __enable_irq();
 
-            AHB.dealloc(newring); // delete [] newring;
+            free_ring(newring, new_in_ahb);
         }
     }
 
@@ -37,6 +37,8 @@ public:
      */
     bool is_empty(void) const;
     bool is_full(void) const;
+    unsigned int count(void) const; // number of blocks between tail and head
+    unsigned int size(void) const { return length; }
 
     /*
      * resize
@@ -45,6 +47,10 @@ public:
      */
     bool resize(unsigned int);
 
+    // allocate the ring in AHB SRAM (the default) or on the main heap, takes effect on the next resize
+    void set_prefer_ahb(bool f) { prefer_ahb = f; }
+    bool is_in_ahb() const { return ring_in_ahb; }
+
     /*
      * provide
      * Block*      - new buffer pointer
@@ -77,5 +83,10 @@ protected:
     volatile unsigned int isr_tail_i;
 
 private:
+    Block* alloc_ring(unsigned int length, bool &in_ahb) const;
+    static void free_ring(Block* r, bool in_ahb);
+
     Block* ring;
+    bool prefer_ahb;
+    bool ring_in_ahb;
 };
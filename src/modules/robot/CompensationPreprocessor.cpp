@@ -15,13 +15,18 @@ using namespace std;
 #include "Module.h"
 #include "Kernel.h"
 #include "StreamOutput.h"
+#include "platform_memory.h"
 
+#include <cstdlib>
 #include <cstring>
 #include <cmath>
 #include <cstdio>
 
 CompensationPreprocessor::CompensationPreprocessor()
 {
+    buffer = nullptr;
+    buffer_in_ahb = false;
+    buffer_size = 0;
     buffer_head = 0;
     buffer_tail = 0;
     buffer_count = 0;
@@ -30,17 +35,47 @@ CompensationPreprocessor::CompensationPreprocessor()
     memset(uncompensated_position, 0, sizeof(uncompensated_position));
     memset(compensated_position, 0, sizeof(compensated_position));
     
-    // Initialize buffer
-    for (int i = 0; i < BUFFER_SIZE; i++) {
-        buffer[i].gcode = nullptr;
+    is_flushing = false;
+}
+
+CompensationPreprocessor::~CompensationPreprocessor()
+{
+    clear();
+    free_buffer();
+}
+
+void CompensationPreprocessor::set_lookahead(int moves)
+{
+    if (moves < MIN_LOOKAHEAD) moves = MIN_LOOKAHEAD;
+    if (moves > MAX_LOOKAHEAD) moves = MAX_LOOKAHEAD;
+    if (buffer != nullptr && moves == buffer_size) return;
+    
+    // The ring is only allocated here, moves are copied into its slots so nothing is allocated per move
+    free_buffer();
+    void* v = AHB.alloc(sizeof(BufferedGcode) * moves);
+    buffer_in_ahb = (v != nullptr);
+    if (v == nullptr) {
+        v = malloc(sizeof(BufferedGcode) * moves);
+    }
+    buffer = (BufferedGcode*)v;
+    buffer_size = (buffer != nullptr) ? moves : 0;
+    
+    for (int i = 0; i < buffer_size; i++) {
+        buffer[i].letters = 0;
         buffer[i].is_move = false;
         buffer[i].has_ijk = false;
+        buffer[i].absorbed = false;
     }
+    clear();
 }
 
-CompensationPreprocessor::~CompensationPreprocessor()
+void CompensationPreprocessor::free_buffer()
 {
-    clear();
+    if (buffer == nullptr) return;
+    if (buffer_in_ahb) AHB.dealloc(buffer);
+    else free(buffer);
+    buffer = nullptr;
+    buffer_size = 0;
 }
 
 void CompensationPreprocessor::set_compensation(CompensationType type, float radius)
@@ -55,7 +90,7 @@ void CompensationPreprocessor::set_compensation(CompensationType type, float rad
     }
 }
 
-bool CompensationPreprocessor::buffer_gcode(Gcode* gcode)
+bool CompensationPreprocessor::buffer_gcode(Gcode* gcode, int g)
 {
     if (!buffer_has_space()) {
         return false;
@@ -65,8 +100,8 @@ bool CompensationPreprocessor::buffer_gcode(Gcode* gcode)
     int slot_index = buffer_head;
     BufferedGcode& slot = buffer[slot_index];
     
-    // Clone and extract data
-    clone_and_extract(gcode, slot);
+    // Copy the words and extract data
+    extract(gcode, g, slot);
     
     // Update buffer pointers
     buffer_head = buffer_next_index(buffer_head);
@@ -75,13 +110,23 @@ bool CompensationPreprocessor::buffer_gcode(Gcode* gcode)
     return true;
 }
 
-void CompensationPreprocessor::clone_and_extract(Gcode* gcode, BufferedGcode& slot)
+void CompensationPreprocessor::extract(Gcode* gcode, int g, BufferedGcode& slot)
 {
-    // Clone the G-code object
-    slot.gcode = new Gcode(*gcode);
+    // Keep the parsed words, the compensated move is built from them again
+    slot.g = g;
+    slot.letters = 0;
+    slot.stream = gcode->stream;
+    slot.line = gcode->line;
+    for (int i = 0; i < 26; i++) {
+        if (gcode->has_letter('A' + i)) {
+            slot.letters |= (1UL << i);
+            slot.values[i] = gcode->get_value('A' + i);
+        }
+    }
     
     // Extract move type
-    slot.is_move = (gcode->has_g && (gcode->g == 0 || gcode->g == 1 || gcode->g == 2 || gcode->g == 3));
+    slot.is_move = (g >= 0 && g <= 3);
+    slot.absorbed = false;
     
     if (!slot.is_move) {
         slot.has_ijk = false;
@@ -116,9 +161,9 @@ void CompensationPreprocessor::clone_and_extract(Gcode* gcode, BufferedGcode& sl
     }
     
     // Extract arc parameters
-    if (gcode->g == 2 || gcode->g == 3) {
+    if (g == 2 || g == 3) {
         slot.has_ijk = true;
-        slot.is_cw = (gcode->g == 2);
+        slot.is_cw = (g == 2);
         slot.ijk[0] = gcode->has_letter('I') ? gcode->get_value('I') : 0.0f;
         slot.ijk[1] = gcode->has_letter('J') ? gcode->get_value('J') : 0.0f;
         slot.ijk[2] = gcode->has_letter('K') ? gcode->get_value('K') : 0.0f;
@@ -126,16 +171,20 @@ void CompensationPreprocessor::clone_and_extract(Gcode* gcode, BufferedGcode& sl
         slot.has_ijk = false;
     }
     
-    // Calculate direction vector for straight lines
-    if (gcode->g == 0 || gcode->g == 1) {
-        // Direction = endpoint - start
-        // Start is previous uncompensated_position (before update above)
-        // But we already updated it, so recalculate from current - previous
-        // Actually, we need to track the start position separately
-        // For now, we'll calculate direction during lookahead
-        slot.direction[X_AXIS] = 0;
-        slot.direction[Y_AXIS] = 0;
-        slot.direction[Z_AXIS] = 0;
+    // Direction and length in XY for straight lines, from this move's own start so the offset of
+    // any line can be worked out later without walking back through the buffer
+    slot.direction[X_AXIS] = 0;
+    slot.direction[Y_AXIS] = 0;
+    slot.direction[Z_AXIS] = 0;
+    slot.length = 0;
+    if (g == 0 || g == 1) {
+        float dx = slot.endpoint[X_AXIS] - slot.uncomp_start[X_AXIS];
+        float dy = slot.endpoint[Y_AXIS] - slot.uncomp_start[Y_AXIS];
+        slot.length = sqrtf(dx*dx + dy*dy);
+        if (slot.length > 0.00001f) {
+            slot.direction[X_AXIS] = dx / slot.length;
+            slot.direction[Y_AXIS] = dy / slot.length;
+        }
     }
 }
 
@@ -145,17 +194,15 @@ Gcode* CompensationPreprocessor::get_compensated_gcode()
         return nullptr;
     }
     
-    // Need at least 3 moves for lookahead (current + 2 ahead)
+    // Need the whole window for lookahead (current + the ones ahead)
     // UNLESS we're flushing (is_flushing == true), then output whatever we have
-    if (buffer_count < 3 && compensation_type != CompensationType::NONE && !is_flushing) {
+    if (buffer_count < buffer_size && compensation_type != CompensationType::NONE && !is_flushing) {
         return nullptr;
     }
     
     // Apply compensation to the tail move (oldest in buffer)
-    // When flushing with < 3 moves, we still try to apply compensation but with limited lookahead
-    if (buffer_count >= 3 || is_flushing) {
-        apply_compensation(buffer_tail);
-    }
+    // When flushing with a part filled window, we still try to apply compensation but with limited lookahead
+    apply_compensation(buffer_tail);
     
     // Create new Gcode with compensated coordinates
     BufferedGcode& slot = buffer[buffer_tail];
@@ -165,39 +212,30 @@ Gcode* CompensationPreprocessor::get_compensated_gcode()
     compensated_position[Y_AXIS] = slot.endpoint[Y_AXIS];
     compensated_position[Z_AXIS] = slot.endpoint[Z_AXIS];
     
-    // Build compensated G-code string
-    char cmd_buffer[256];
-    char* ptr = cmd_buffer;
-    
-    if (slot.gcode->has_g) {
-        ptr += snprintf(ptr, sizeof(cmd_buffer) - (ptr - cmd_buffer), "G%d ", slot.gcode->g);
-    }
-    
-    // Add compensated X/Y/Z coordinates
-    ptr += snprintf(ptr, sizeof(cmd_buffer) - (ptr - cmd_buffer), "X%.4f Y%.4f Z%.4f ", 
-                    slot.endpoint[X_AXIS], slot.endpoint[Y_AXIS], slot.endpoint[Z_AXIS]);
-    
-    // Add I/J/K for arcs
+    // Build the compensated move straight from the words, X/Y/Z are always given and I/J/K for arcs
+    const uint32_t xyz = (1UL << ('X' - 'A')) | (1UL << ('Y' - 'A')) | (1UL << ('Z' - 'A'));
+    const uint32_t ijk = (1UL << ('I' - 'A')) | (1UL << ('J' - 'A')) | (1UL << ('K' - 'A'));
+    uint32_t letters = (slot.letters & ~ijk) | xyz;
+    slot.values['X' - 'A'] = slot.endpoint[X_AXIS];
+    slot.values['Y' - 'A'] = slot.endpoint[Y_AXIS];
+    slot.values['Z' - 'A'] = slot.endpoint[Z_AXIS];
     if (slot.has_ijk) {
-        ptr += snprintf(ptr, sizeof(cmd_buffer) - (ptr - cmd_buffer), "I%.4f J%.4f K%.4f ", 
-                        slot.ijk[0], slot.ijk[1], slot.ijk[2]);
-    }
-    
-    // Add F if present
-    if (slot.gcode->has_letter('F')) {
-        ptr += snprintf(ptr, sizeof(cmd_buffer) - (ptr - cmd_buffer), "F%.1f", slot.gcode->get_value('F'));
+        letters |= ijk;
+        slot.values['I' - 'A'] = slot.ijk[0];
+        slot.values['J' - 'A'] = slot.ijk[1];
+        slot.values['K' - 'A'] = slot.ijk[2];
     }
     
-    // Create new Gcode from compensated string
-    Gcode* output = new Gcode(cmd_buffer, slot.gcode->stream);
-    
-    // Clean up original
-    delete slot.gcode;
-    slot.gcode = nullptr;
+    Gcode* output = new Gcode(slot.g, letters, slot.values, slot.stream, slot.line);
     
     buffer_tail = buffer_next_index(buffer_tail);
     buffer_count--;
     
+    // A flush ends once it is empty, so moves after an auto flush get the full lookahead again
+    if (buffer_count == 0) {
+        is_flushing = false;
+    }
+    
     return output;
 }
 
@@ -205,8 +243,8 @@ void CompensationPreprocessor::apply_compensation(int index)
 {
     BufferedGcode& current = buffer[index];
     
-    if (!current.is_move) {
-        return;  // Not a move, no compensation needed
+    if (!current.is_move || current.absorbed) {
+        return;  // Not a move, or a line a corner before it already placed
     }
     
     // Calculate compensated coordinates
@@ -231,96 +269,30 @@ void CompensationPreprocessor::apply_compensation(int index)
             is_left,
             current.is_cw
         );
+    } else if (current.length < 0.00001f) {
+        // No XY motion (a plunge or retract) - stay on the offset the last move left us at
+        new_endpoint[X_AXIS] = compensated_position[X_AXIS];
+        new_endpoint[Y_AXIS] = compensated_position[Y_AXIS];
     } else {
-        // Straight line - check for corner with next move
-        int next_index = buffer_next_index(index);
+        // Straight line - find the corner with the lines after it
+        float intersection[2];
+        int meet;
         
-        if (buffer_count > 1 && next_index != buffer_head) {
-            BufferedGcode& next = buffer[next_index];
+        if (find_corner(current, buffer_next_index(index), is_left, intersection, meet)) {
+            new_endpoint[X_AXIS] = intersection[0];
+            new_endpoint[Y_AXIS] = intersection[1];
             
-            if (next.is_move && !next.has_ijk) {
-                // Both current and next are lines - apply corner intersection
-                float dir1[2], dir2[2];
-                
-                // Calculate direction vectors
-                // dir1: from previous to current endpoint
-                float prev_x = (index == buffer_tail) ? uncompensated_position[X_AXIS] - current.endpoint[X_AXIS] : buffer[(index - 1 + BUFFER_SIZE) % BUFFER_SIZE].endpoint[X_AXIS];
-                float prev_y = (index == buffer_tail) ? uncompensated_position[Y_AXIS] - current.endpoint[Y_AXIS] : buffer[(index - 1 + BUFFER_SIZE) % BUFFER_SIZE].endpoint[Y_AXIS];
-                
-                dir1[0] = current.endpoint[X_AXIS] - prev_x;
-                dir1[1] = current.endpoint[Y_AXIS] - prev_y;
-                float mag1 = sqrtf(dir1[0]*dir1[0] + dir1[1]*dir1[1]);
-                if (mag1 > 0.00001f) {
-                    dir1[0] /= mag1;
-                    dir1[1] /= mag1;
-                }
-                
-                // dir2: from current to next endpoint
-                dir2[0] = next.endpoint[X_AXIS] - current.endpoint[X_AXIS];
-                dir2[1] = next.endpoint[Y_AXIS] - current.endpoint[Y_AXIS];
-                float mag2 = sqrtf(dir2[0]*dir2[0] + dir2[1]*dir2[1]);
-                if (mag2 > 0.00001f) {
-                    dir2[0] /= mag2;
-                    dir2[1] /= mag2;
-                }
-                
-                // Calculate corner intersection
-                float corner_point[2] = {current.endpoint[X_AXIS], current.endpoint[Y_AXIS]};
-                float intersection[2];
-                
-                if (calculate_corner_intersection(corner_point, dir1, dir2, compensation_radius, is_left, intersection)) {
-                    new_endpoint[X_AXIS] = intersection[0];
-                    new_endpoint[Y_AXIS] = intersection[1];
-                } else {
-                    // Parallel lines - use simple perpendicular offset
-                    calculate_perpendicular_offset(
-                        current.endpoint,
-                        dir1,
-                        compensation_radius,
-                        is_left,
-                        new_endpoint
-                    );
-                }
-            } else {
-                // Next move is not a line - use simple perpendicular offset
-                // Calculate direction from previous to current
-                float dir[2];
-                float prev_x = uncompensated_position[X_AXIS];
-                float prev_y = uncompensated_position[Y_AXIS];
-                
-                dir[0] = current.endpoint[X_AXIS] - prev_x;
-                dir[1] = current.endpoint[Y_AXIS] - prev_y;
-                float mag = sqrtf(dir[0]*dir[0] + dir[1]*dir[1]);
-                if (mag > 0.00001f) {
-                    dir[0] /= mag;
-                    dir[1] /= mag;
-                }
-                
-                calculate_perpendicular_offset(
-                    current.endpoint,
-                    dir,
-                    compensation_radius,
-                    is_left,
-                    new_endpoint
-                );
+            // The lines the corner cut past end where it does, they only keep their Z
+            for (int i = buffer_next_index(index); i != meet; i = buffer_next_index(i)) {
+                buffer[i].endpoint[X_AXIS] = intersection[0];
+                buffer[i].endpoint[Y_AXIS] = intersection[1];
+                buffer[i].absorbed = true;
             }
         } else {
-            // No next move or single move - use simple perpendicular offset
-            float dir[2];
-            float prev_x = uncompensated_position[X_AXIS];
-            float prev_y = uncompensated_position[Y_AXIS];
-            
-            dir[0] = current.endpoint[X_AXIS] - prev_x;
-            dir[1] = current.endpoint[Y_AXIS] - prev_y;
-            float mag = sqrtf(dir[0]*dir[0] + dir[1]*dir[1]);
-            if (mag > 0.00001f) {
-                dir[0] /= mag;
-                dir[1] /= mag;
-            }
-            
+            // Next move is not a line, is parallel or there is none - use simple perpendicular offset
             calculate_perpendicular_offset(
                 current.endpoint,
-                dir,
+                current.direction,
                 compensation_radius,
                 is_left,
                 new_endpoint
@@ -339,8 +311,50 @@ void CompensationPreprocessor::apply_compensation(int index)
         current.ijk[2] = new_ijk[2];
     }
     
-    // Modify G-code with new coordinates
-    modify_gcode_coordinates(current.gcode, new_endpoint, new_ijk, current.has_ijk);
+}
+
+bool CompensationPreprocessor::find_corner(const BufferedGcode& current, int next_index, bool is_left, float output[2], int& meet)
+{
+    const float corner_point[2] = {current.endpoint[X_AXIS], current.endpoint[Y_AXIS]};
+    float first[2];
+    bool have_first = false;
+    
+    // current is always the tail, so the rest of the window is the buffer_count - 1 moves after it
+    int i = next_index;
+    for (int n = 1; n < buffer_count; n++, i = buffer_next_index(i)) {
+        const BufferedGcode& next = buffer[i];
+        if (!next.is_move || next.has_ijk) {
+            break;  // Arcs are offset on their own
+        }
+        if (next.length < 0.00001f) {
+            continue;  // A plunge between two lines, the corner is between the lines either side of it
+        }
+        
+        float start[2] = {next.uncomp_start[X_AXIS], next.uncomp_start[Y_AXIS]};
+        float along;
+        if (!calculate_corner_intersection(corner_point, current.direction, start, next.direction, compensation_radius, is_left, output, &along)) {
+            break;  // Parallel, carries straight on
+        }
+        
+        // An inside corner pulls back along the next line, if it is further than the line is long the
+        // offset of that line would run backwards and gouge, so see if a later line meets us instead
+        if (along <= next.length) {
+            meet = i;
+            return true;
+        }
+        if (!have_first) {
+            memcpy(first, output, sizeof(first));
+            meet = i;
+            have_first = true;
+        }
+    }
+    
+    // Nothing in the window resolves it, keep the plain corner with the next line
+    if (have_first) {
+        memcpy(output, first, sizeof(first));
+        return true;
+    }
+    return false;
 }
 
 void CompensationPreprocessor::calculate_perpendicular_offset(
@@ -372,12 +386,14 @@ void CompensationPreprocessor::calculate_perpendicular_offset(
 }
 
 bool CompensationPreprocessor::calculate_corner_intersection(
-    const float corner_point[2],
+    const float point1[2],
     const float dir1[2],
+    const float point2[2],
     const float dir2[2],
     float radius,
     bool is_left,
-    float output[2]
+    float output[2],
+    float* along2
 )
 {
     float u1x = dir1[0];
@@ -397,12 +413,13 @@ bool CompensationPreprocessor::calculate_corner_intersection(
         n2x = u2y; n2y = -u2x;
     }
     
-    // Both offset lines start at the corner point
-    float p1x = corner_point[0] + n1x * radius;
-    float p1y = corner_point[1] + n1y * radius;
+    // The offset lines run through the end of the first line and the start of the second,
+    // which are the same corner point unless lines in between were skipped
+    float p1x = point1[0] + n1x * radius;
+    float p1y = point1[1] + n1y * radius;
     
-    float p2x = corner_point[0] + n2x * radius;
-    float p2y = corner_point[1] + n2y * radius;
+    float p2x = point2[0] + n2x * radius;
+    float p2y = point2[1] + n2y * radius;
     
     // Calculate determinant to check for parallel lines
     float det = u1x * u2y - u1y * u2x;
@@ -412,11 +429,14 @@ bool CompensationPreprocessor::calculate_corner_intersection(
         return false;
     }
     
-    // Calculate intersection parameter t1
+    // Calculate intersection parameters, t1 along the first offset line and t2 along the second
     float dx = p2x - p1x;
     float dy = p2y - p1y;
     
     float t1 = (dx * u2y - dy * u2x) / det;
+    if (along2 != nullptr) {
+        *along2 = (dx * u1y - dy * u1x) / det;
+    }
     
     // Calculate intersection point
     output[0] = p1x + t1 * u1x;
@@ -499,47 +519,6 @@ bool CompensationPreprocessor::compensate_arc_endpoint(
     return true;
 }
 
-void CompensationPreprocessor::modify_gcode_coordinates(
-    Gcode* gcode,
-    const float new_endpoint[3],
-    const float new_ijk[3],
-    bool has_ijk
-)
-{
-    // Rebuild G-code string with new coordinates
-    // This is the "Gcode-in, Gcode-out" approach
-    
-    char new_command[256];
-    char* ptr = new_command;
-    
-    // Copy command (G0, G1, G2, G3)
-    if (gcode->has_g) {
-        ptr += snprintf(ptr, sizeof(new_command) - (ptr - new_command), "G%d ", gcode->g);
-    }
-    
-    // Add X/Y/Z with new coordinates
-    ptr += snprintf(ptr, sizeof(new_command) - (ptr - new_command), "X%.4f Y%.4f Z%.4f ", 
-                    new_endpoint[X_AXIS], new_endpoint[Y_AXIS], new_endpoint[Z_AXIS]);
-    
-    // Add I/J/K for arcs
-    if (has_ijk) {
-        ptr += snprintf(ptr, sizeof(new_command) - (ptr - new_command), "I%.4f J%.4f K%.4f ", 
-                        new_ijk[0], new_ijk[1], new_ijk[2]);
-    }
-    
-    // Add F if present
-    if (gcode->has_letter('F')) {
-        ptr += snprintf(ptr, sizeof(new_command) - (ptr - new_command), "F%.1f ", gcode->get_value('F'));
-    }
-    
-    // We can't modify the Gcode object's private members directly,
-    // so this function doesn't actually work as intended.
-    // The solution is to not modify in place, but return a new Gcode object.
-    // However, for now we'll leave this as a placeholder since the gcode
-    // values should already be correct from our extract phase.
-    // TODO: Refactor to return new Gcode* instead of modifying in place
-}
-
 void CompensationPreprocessor::flush()
 {
     // Set flushing flag to bypass lookahead requirements
@@ -554,14 +533,6 @@ void CompensationPreprocessor::flush()
 
 void CompensationPreprocessor::clear()
 {
-    // Delete all buffered G-codes
-    for (int i = 0; i < BUFFER_SIZE; i++) {
-        if (buffer[i].gcode != nullptr) {
-            delete buffer[i].gcode;
-            buffer[i].gcode = nullptr;
-        }
-    }
-    
     buffer_head = 0;
     buffer_tail = 0;
     buffer_count = 0;
@@ -11,8 +11,10 @@
 #include "CompensationTypes.h"
 
 #include <cmath>
+#include <cstdint>
 
 class Gcode;
+class StreamOutput;
 
 /**
  * Cutter Compensation Preprocessor v2.0 - Bolt-On Architecture
@@ -20,12 +22,16 @@ class Gcode;
  * Design Philosophy:
  * - Gcode-in, Gcode-out: Modifies G-code coordinates, not internal structures
  * - Single execution path: ALL moves go through Robot::process_move()
- * - Lookahead buffer: 3-move window for corner detection
- * - Circular buffer: No heap allocation (10 slots fixed)
- * - String reconstruction: Rebuild G-code from modified coordinates
+ * - Lookahead buffer: an N-move window (cutter_compensation_lookahead, 3 by default) for corner
+ *   and gouge detection, the first move only comes out once N are buffered so a deeper window
+ *   also delays the start of motion by that many moves
+ * - Circular buffer: allocated once in AHB RAM when the window is set, nothing per move
+ * - Streaming offset: each line carries its own direction and length from when it was buffered,
+ *   so an offset corner only needs the move itself and the ones after it in the window
+ * - No string round trip: moves are buffered as their parsed words and handed back as a
+ *   Gcode built from the compensated words, nothing is copied as text or parsed again
  * 
- * Memory cost: ~2.2KB (10 slots × ~220 bytes/Gcode)
- * Code savings: -150 lines (removes duplicate transform logic)
+ * Memory cost: ~170 bytes per slot of the window
  */
 class CompensationPreprocessor {
 public:
@@ -39,6 +45,12 @@ public:
      */
     void set_compensation(CompensationType type, float radius);
     
+    /**
+     * Set how many moves are looked at before the oldest is compensated, reallocates the ring
+     * @param moves - Window size, clamped to MIN_LOOKAHEAD..MAX_LOOKAHEAD
+     */
+    void set_lookahead(int moves);
+    
     /**
      * Check if compensation is active
      */
@@ -46,14 +58,15 @@ public:
     
     /**
      * Buffer a G-code for processing
-     * @param gcode - G-code to buffer (will be cloned)
+     * @param gcode - G-code to buffer (its words are copied)
+     * @param g - the motion mode it is, 0-3, as the G may be modal
      * @return true if buffered, false if buffer full
      */
-    bool buffer_gcode(Gcode* gcode);
+    bool buffer_gcode(Gcode* gcode, int g);
     
     /**
-     * Get next compensated G-code
-     * @return Pointer to compensated Gcode, or nullptr if buffer empty
+     * Get next compensated G-code, built from the words so it is not parsed
+     * @return Pointer to compensated Gcode (caller deletes it), or nullptr if buffer empty
      */
     Gcode* get_compensated_gcode();
     
@@ -84,19 +97,29 @@ public:
 private:
     // Buffered G-code structure
     struct BufferedGcode {
-        Gcode* gcode;          // Cloned G-code object
+        uint8_t g;             // G0-G3
+        uint32_t letters;      // which words the move had, bit n is 'A' + n
+        float values[26];      // their values, indexed by letter - 'A'
+        StreamOutput* stream;
+        unsigned int line;
         float endpoint[3];     // Endpoint in XYZ
         float uncomp_start[3]; // Uncompensated start position (for arc center calculation)
         float ijk[3];          // I/J/K for arcs
         bool has_ijk;          // True if arc move
         bool is_cw;            // True for G2, false for G3
         bool is_move;          // True if G0/G1/G2/G3
-        float direction[3];    // Unit direction vector (for lines)
+        bool absorbed;         // A short line an inside corner cut past, it ends where the corner did
+        float direction[3];    // Unit XY direction vector (for lines)
+        float length;          // XY length of the uncompensated line
     };
     
+    static const int MIN_LOOKAHEAD = 2;
+    static const int MAX_LOOKAHEAD = 32;
+    
     // Circular buffer
-    static const int BUFFER_SIZE = 10;
-    BufferedGcode buffer[BUFFER_SIZE];
+    BufferedGcode* buffer;
+    bool buffer_in_ahb;
+    int buffer_size;
     int buffer_head;
     int buffer_tail;
     int buffer_count;
@@ -109,23 +132,30 @@ private:
     bool is_flushing;  // True when flushing remaining moves (ignore lookahead requirements)
     
     // Helper functions
-    bool buffer_has_space() const { return buffer_count < BUFFER_SIZE; }
-    int buffer_next_index(int index) const { return (index + 1) % BUFFER_SIZE; }
+    bool buffer_has_space() const { return buffer_count < buffer_size; }
+    int buffer_next_index(int index) const { return (index + 1 == buffer_size) ? 0 : index + 1; }
+    void free_buffer();
     
     /**
-     * Clone and extract G-code data
+     * Copy the words of the G-code and extract the move data
      * @param gcode - Original G-code
      * @param slot - Buffer slot to fill
      */
-    void clone_and_extract(Gcode* gcode, BufferedGcode& slot);
+    void extract(Gcode* gcode, int g, BufferedGcode& slot);
     
     /**
      * Apply compensation to move coordinates
-     * Looks ahead at next 2 moves for corner detection
+     * Looks ahead through the window for the corner, skipping lines too short to offset
      * @param index - Buffer index of move to compensate
      */
     void apply_compensation(int index);
     
+    /**
+     * Find where the offset of a line meets the offset of a later line in the window
+     * @return true if they meet, leaves the index of the line they met at in meet
+     */
+    bool find_corner(const BufferedGcode& current, int next_index, bool is_left, float output[2], int& meet);
+    
     /**
      * Calculate perpendicular offset for straight line
      */
@@ -141,12 +171,14 @@ private:
      * Calculate corner intersection
      */
     bool calculate_corner_intersection(
-        const float corner_point[2],
+        const float point1[2],
         const float dir1[2],
+        const float point2[2],
         const float dir2[2],
         float radius,
         bool is_left,
-        float output[2]
+        float output[2],
+        float* along2 = nullptr
     );
     
     /**
@@ -171,21 +203,6 @@ private:
         bool is_cw
     );
     
-    /**
-     * Modify G-code coordinates
-     * Rebuilds G-code string with new X/Y/I/J values
-     * @param gcode - G-code to modify
-     * @param new_endpoint - New XYZ endpoint
-     * @param new_ijk - New IJK values (for arcs)
-     * @param has_ijk - True if arc move
-     */
-    void modify_gcode_coordinates(
-        Gcode* gcode,
-        const float new_endpoint[3],
-        const float new_ijk[3],
-        bool has_ijk
-    );
-    
     // Geometry utilities
     float cross_product_2d(const float v1[2], const float v2[2]) {
         return v1[0] * v2[1] - v1[1] * v2[0];
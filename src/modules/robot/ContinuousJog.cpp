@@ -0,0 +1,97 @@
+/*
+      This file is part of Smoothie (http://smoothieware.org/). The motion control part is heavily based on Grbl (https://github.com/simen/grbl).
+      Smoothie is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+      Smoothie is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+      You should have received a copy of the GNU General Public License along with Smoothie. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ContinuousJog.h"
+
+#include "Kernel.h"
+#include "Robot.h"
+#include "Conveyor.h"
+
+#include <math.h>
+#include <algorithm>
+
+bool ContinuousJog::begin(const float dir[], uint8_t n, float rate_mm_s)
+{
+    n_motors= n;
+    rate= rate_mm_s;
+    at_limit= false;
+
+    // the rate is along the primary axes unless only the auxiliary axes move, the same as append_milestone
+    float sos= 0;
+    for (int i = 0; i < N_PRIMARY_AXIS && i < n_motors; ++i) sos += dir[i] * dir[i];
+    if(sos == 0) {
+        for (int i = N_PRIMARY_AXIS; i < n_motors; ++i) sos += dir[i] * dir[i];
+    }
+    float acc= THEROBOT->get_default_acceleration();
+    if(sos == 0 || rate <= 0 || acc <= 0) return false;
+
+    float length= rate * segment_time;
+    float scale= length / sqrtf(sos);
+    for (int i = 0; i < n_motors; ++i) segment[i]= dir[i] * scale;
+
+    // enough blocks to brake from the jog rate, and two more so a slow pass of the main loop does not stall it
+    float braking= rate * rate / (2.0F * acc);
+    horizon= ceilf(braking / length) + 2;
+    unsigned int room= THECONVEYOR->queue_free() + THECONVEYOR->queue_used() - 1;
+    if(horizon > room) horizon= room;
+
+    // plan the whole horizon before the first block starts so it accelerates all the way
+    THECONVEYOR->set_hold(true);
+    bool ok= feed();
+    THECONVEYOR->set_hold(false);
+    THECONVEYOR->force_queue();
+
+    return ok && THECONVEYOR->queue_pending() > 0;
+}
+
+bool ContinuousJog::feed()
+{
+    bool queued= false;
+    while(!at_limit && !THEKERNEL->is_halted() && THECONVEYOR->queue_pending() < horizon) {
+        if(!queue_segment()) break;
+        queued= true;
+    }
+
+    // do not wait for the queue delay, the jog has to start and keep going now
+    if(queued) THECONVEYOR->force_queue();
+    return !at_limit;
+}
+
+bool ContinuousJog::queue_segment()
+{
+    float scale= 1.0F;
+    if(THEROBOT->is_soft_endstop_enabled()) {
+        float pos[N_PRIMARY_AXIS];
+        THEROBOT->get_axis_position(pos, N_PRIMARY_AXIS);
+        for (int i = 0; i <= Z_AXIS && i < n_motors; ++i) {
+            if(!THEROBOT->is_homed(i) || segment[i] == 0) continue;
+
+            // how much further the queued moves can go before the limit
+            float room;
+            if(segment[i] < 0) {
+                if(isnan(THEROBOT->get_soft_endstop_min(i))) continue;
+                room= pos[i] - THEROBOT->get_soft_endstop_min(i);
+            } else {
+                if(isnan(THEROBOT->get_soft_endstop_max(i))) continue;
+                room= THEROBOT->get_soft_endstop_max(i) - pos[i];
+            }
+            if(room < fabsf(segment[i])) scale= std::min(scale, room / fabsf(segment[i]));
+        }
+    }
+
+    // close enough to the limit that another block would be a fraction of a step
+    if(scale < 0.001F) {
+        at_limit= true;
+        return false;
+    }
+
+    float delta[n_motors];
+    for (int i = 0; i < n_motors; ++i) delta[i]= segment[i] * scale;
+    if(scale < 1.0F) at_limit= true;
+
+    return THEROBOT->delta_move(delta, rate, n_motors);
+}
@@ -0,0 +1,44 @@
+/*
+      This file is part of Smoothie (http://smoothieware.org/). The motion control part is heavily based on Grbl (https://github.com/simen/grbl).
+      Smoothie is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+      Smoothie is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+      You should have received a copy of the GNU General Public License along with Smoothie. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "ActuatorCoordinates.h"
+
+#include <stdint.h>
+
+/*
+ * Streams a continuous jog to the planner as a rolling horizon of short blocks.
+ *
+ * The planner always ends the last block on the queue at rest, so if only the distance needed to
+ * brake from the jog speed (plus a couple of blocks of slack for the main loop) is ever queued, the
+ * machine is always ready to stop. Once feed() is no longer called it starts decelerating within one
+ * block and stops within the braking distance, whatever the size of the planner queue.
+ *
+ * Homed axes are clipped at the soft endstops, the last block ends on the limit and nothing more is queued.
+ */
+class ContinuousJog {
+    public:
+        // dir is the direction of each motor in machine coordinates, only its sign and proportion matter
+        bool begin(const float dir[], uint8_t n_motors, float rate_mm_s);
+        // tops the queue back up to the horizon, returns false once a soft endstop has been reached
+        bool feed();
+
+        float get_rate() const { return rate; }
+        unsigned int get_horizon() const { return horizon; }
+
+    private:
+        bool queue_segment();
+
+        static constexpr float segment_time= 0.02F; // seconds of motion per block at the jog rate
+
+        float segment[k_max_actuators];
+        float rate;
+        unsigned int horizon;       // blocks kept on the queue, including the one executing
+        uint8_t n_motors;
+        bool at_limit;
+};
@@ -22,13 +22,25 @@
 #include "StepTicker.h"
 #include "Robot.h"
 #include "StepperMotor.h"
+#include "platform_memory.h"
+#include "EventTrace.h"
+#include "Counters.h"
+#include "MemoryStats.h"
+#include "MemoryPool.h"
 
 #include <functional>
+#include <algorithm>
+#include <string.h>
 
 #include "mbed.h"
 
 #define planner_queue_size_checksum CHECKSUM("planner_queue_size")
+#define planner_queue_ahb_checksum CHECKSUM("planner_queue_ahb")
+#define planner_queue_reserve_checksum CHECKSUM("planner_queue_reserve")
+#define planner_queue_auto_max_checksum CHECKSUM("planner_queue_auto_max")
 #define queue_delay_time_ms_checksum CHECKSUM("queue_delay_time_ms")
+#define queue_idle_time_ms_checksum CHECKSUM("queue_idle_time_ms")
+#define fast_fixed_point_checksum CHECKSUM("planner_fast_fixed_point")
 
 /*
  * The conveyor holds the queue of blocks, takes care of creating them, and starting the executing chain of blocks
@@ -65,27 +77,86 @@ Conveyor::Conveyor()
     flush= false;
     continuous_mode = 0;
     hold_queue= false;
+    stats_on= false;
+    starve_start= 0;
+    last_queued= 0;
+    blocks_queued= 0;
+    starvations= 0;
+    memset(&qstats, 0, sizeof(qstats));
+    events_queued= events_attached= events_due= events_run= 0;
 }
 
 void Conveyor::on_module_loaded()
 {
     register_for_event(ON_IDLE);
     register_for_event(ON_HALT);
+    Counters::add("blocks_queued", &blocks_queued);
+    Counters::add("queue_starved", &starvations);
 
     // Attach to the end_of_move stepper event
     //THEKERNEL->step_ticker->finished_fnc = std::bind( &Conveyor::all_moves_finished, this);
-    queue_size = THEKERNEL->config->value(planner_queue_size_checksum)->by_default(32)->as_number();
+    // blocks no longer carry per motor tick info, so twice the lookahead fits in less memory than 32 used to
+    queue_size = THEKERNEL->config->value(planner_queue_size_checksum)->by_default(64)->as_number();
+    // 0 sizes it from what is left free once everything else has been set up
+    queue_reserve = THEKERNEL->config->value(planner_queue_reserve_checksum)->by_default(8192)->as_number();
+    queue_auto_max = THEKERNEL->config->value(planner_queue_auto_max_checksum)->by_default(128)->as_number();
     queue_delay_time_ms = THEKERNEL->config->value(queue_delay_time_ms_checksum)->by_default(100)->as_number();
+    // a queue that has had nothing added for this long is not being streamed to and can start, 0 always waits the delay
+    queue_idle_time_us = THEKERNEL->config->value(queue_idle_time_ms_checksum)->by_default(10)->as_number() * 1000;
+    // the queue goes in AHB SRAM unless told otherwise, falling back to the main heap if it does not fit
+    queue.set_prefer_ahb(THEKERNEL->config->value(planner_queue_ahb_checksum)->by_default(true)->as_bool());
+    // short blocks are stepped with 32 bit fixed point, long ones always use 64 bit
+    fast_fixed_point = THEKERNEL->config->value(fast_fixed_point_checksum)->by_default(true)->as_bool();
 }
 
 // we allocate the queue here after config is completed so we do not run out of memory during config
 void Conveyor::start(uint8_t n)
 {
-    Block::init(n); // set the number of motors which determines how big the tick info vector is
+    Block::init(n, fast_fixed_point); // set the number of motors which determines how big the tick info vector is
+    if(queue_size == 0) queue_size = auto_queue_size();
     queue.resize(queue_size);
     running = true;
 }
 
+// as many blocks as fit in the biggest free piece of AHB or the heap with the reserve left over, the one the
+// queue would rather be in is tried first by BlockQueue anyway
+unsigned int Conveyor::auto_queue_size() const
+{
+    uint32_t ahb_largest = 0;
+    if(queue.prefer_ahb) AHB.free(&ahb_largest);
+    MemoryStats::heap_t h;
+    MemoryStats::heap_walk(h);
+    uint32_t largest = std::max(ahb_largest, h.largest_free);
+
+    unsigned int n = largest > queue_reserve ? (largest - queue_reserve) / sizeof(Block) : 0;
+    if(n > queue_auto_max) n = queue_auto_max;
+    return n < k_min_queue_size ? k_min_queue_size : n;
+}
+
+bool Conveyor::resize_queue(unsigned int n)
+{
+    if(n != 0 && n < k_min_queue_size) return false;
+    // before start() it is just the size it will be given
+    if(queue.size() == 0) {
+        queue_size = n;
+        return true;
+    }
+
+    wait_for_idle();
+    if(THEKERNEL->is_halted()) return false;
+
+    // the old ring goes first so the new one can have its memory, it is put back if the new one does not fit
+    unsigned int old = queue.size();
+    if(!queue.resize(0)) return false;
+    if(n == 0) n = auto_queue_size();
+    if(!queue.resize(n)) {
+        queue.resize(old);
+        return false;
+    }
+    queue_size = n;
+    return true;
+}
+
 void Conveyor::on_halt(void* argument)
 {
     if(argument == nullptr) {
@@ -101,6 +172,8 @@ void Conveyor::on_idle(void*)
         check_queue();
     }
 
+    run_events();
+
     // we can garbage collect the block queue here
     if (queue.tail_i != queue.isr_tail_i) {
         if (queue.is_empty()) {
@@ -130,11 +203,23 @@ bool Conveyor::is_idle() const
     return false;
 }
 
+void Conveyor::queue_lines(unsigned int &running, unsigned int &newest)
+{
+    running= newest= 0;
+    if(queue.length == 0 || queue.head_i >= queue.length || queue.isr_tail_i >= queue.length) return;
+    if(queue.isr_tail_i != queue.head_i) running= queue.item_ref(queue.isr_tail_i)->line;
+    if(queue.tail_i != queue.head_i) newest= queue.item_ref(queue.prev(queue.head_i))->line;
+}
+
 // Wait for the queue to be empty and for all the jobs to finish in step ticker
 void Conveyor::wait_for_idle(bool wait_for_motors)
 {
+    // a move the robot is holding back to merge with the next one has to be planned first
+    THEROBOT->flush_coalesced();
+
     // wait for the job queue to empty, this means cycling everything on the block queue into the job queue
     // forcing them to be jobs
+    EventTrace::begin(EventTrace::WAIT_FOR_IDLE, wait_for_motors);
     running = false; // stops on_idle calling check_queue
     while (!queue.is_empty()) {
         check_queue(true); // forces queue to be made available to stepticker
@@ -149,6 +234,7 @@ void Conveyor::wait_for_idle(bool wait_for_motors)
     }
 
     running = true;
+    EventTrace::end(EventTrace::WAIT_FOR_IDLE, wait_for_motors);
     // returning now means that everything has totally finished
 }
 
@@ -170,7 +256,13 @@ void Conveyor::queue_head_block()
         return; // if we got a halt then we are done here
     }
 
+    // any events queued since the last block happen as this one starts
+    queue.head_ref()->n_events= (uint8_t)(events_queued - events_attached);
+    events_attached= events_queued;
+
     queue.produce_head();
+    last_queued= us_ticker_read();
+    ++blocks_queued;
 
     // not sure if this is the correct place but we need to turn on the motors if they were not already on
     THEKERNEL->call_event(ON_ENABLE, (void*)1); // turn all enable pins on
@@ -188,8 +280,12 @@ void Conveyor::check_queue(bool force)
 
     // if we have been waiting for more than the required waiting time and the queue is not empty, or the queue is full, then allow stepticker to get the tail
     // we do this to allow an idle system to pre load the queue a bit so the first few blocks run smoothly.
-    if(force || queue.is_full() || (us_ticker_read() - last_time_check) >= (queue_delay_time_ms * 1000)) {
-        last_time_check = us_ticker_read(); // reset timeout
+    // A single command or the end of a burst leaves the queue alone for a moment, that need not wait for the rest of the
+    // delay, only a stream still adding blocks is held
+    uint32_t now = us_ticker_read();
+    bool input_idle = queue_idle_time_us > 0 && (now - last_queued) >= queue_idle_time_us;
+    if(force || queue.is_full() || input_idle || (now - last_time_check) >= (queue_delay_time_ms * 1000)) {
+        last_time_check = now; // reset timeout
         if(!flush) allow_fetch = true;
         return;
     }
@@ -228,7 +324,7 @@ bool Conveyor::set_continuous_mode(bool f)
 }
 
 // called from step ticker ISR
-bool Conveyor::get_next_block(Block **block)
+RAMFUNC bool Conveyor::get_next_block(Block **block)
 {
     // this is used to allow us to put blocks onto an empty queue and not start until we say so
     // do not use to hold the queue when it is running otherwise it will stop with zero deceleration
@@ -249,8 +345,7 @@ bool Conveyor::get_next_block(Block **block)
     if(continuous_mode > 1){
             // keep feeding the second in the queue
             Block *b= queue.item_ref(queue.isr_tail_i);
-            // reset variable parts of the block
-            b->reset(static_cast<Block::tickinfo_t*>(saved_block));
+            // the step ticker starts its tick info afresh from the block each time
             b->is_ticking= true;
             b->recalculate_flag= false;
             this->current_feedrate= b->nominal_speed;
@@ -261,28 +356,137 @@ bool Conveyor::get_next_block(Block **block)
     // wait for queue to fill up, optimizes planning
     if(!allow_fetch) return false;
 
+    // the planner only ever publishes a complete update of a block, so it can always be taken
     Block *b= queue.item_ref(queue.isr_tail_i);
-    // we cannot use this now if it is being updated
-    if(!b->locked) {
-        if(!b->is_ready) __debugbreak(); // should never happen
-
-        b->is_ticking= true;
-        b->recalculate_flag= false;
-        this->current_feedrate= b->nominal_speed;
-        *block= b;
+    if(!b->is_ready) __debugbreak(); // should never happen
+
+    if(stats_on) {
+        if(starve_start != 0) {
+            record_starvation(us_ticker_read() - starve_start, starve_line);
+            starve_start= 0;
+        }
+        // how many are queued up behind this one, in powers of two
+        unsigned int behind= (queue.head_i + queue.length - queue.isr_tail_i) % queue.length - 1;
+        int bin= behind == 0 ? 0 : 32 - __builtin_clz(behind);
+        if(bin >= queue_stats_t::DEPTH_BINS) bin= queue_stats_t::DEPTH_BINS - 1;
+        ++qstats.depth[bin];
+    }
+
+    b->is_ticking= true;
+    b->recalculate_flag= false;
+    events_due += b->n_events;
+    b->n_events= 0;
+    this->current_feedrate= b->nominal_speed;
+    *block= b;
+    return true;
+}
+
+bool Conveyor::queue_event(event_fnc_t fnc, uint32_t arg)
+{
+    // a move the robot is holding back to merge with the next one comes before this
+    THEROBOT->flush_coalesced();
+
+    if(queue.is_empty() && events_run == events_queued) {
+        // nothing to keep in step with
+        fnc(arg);
         return true;
     }
 
-    return false;
+    if((uint8_t)(events_queued - events_run) >= k_max_events) return false;
+
+    event_t &e= events[events_queued % k_max_events];
+    e.fnc= fnc;
+    e.arg= arg;
+    ++events_queued;
+    return true;
+}
+
+// runs the events whose block has started, in the order they were queued
+void Conveyor::run_events()
+{
+    // the queue ran dry with some queued after the last block, they have nothing left to wait for. The step ticker
+    // takes no block from an empty queue so events_due is ours to set here
+    if(events_attached != events_queued && queue.is_empty() && events_run == events_due) {
+        events_attached= events_queued;
+        events_due= events_queued;
+    }
+
+    while(events_run != events_due) {
+        // copied out as running it may queue another
+        event_t e= events[events_run % k_max_events];
+        ++events_run;
+        e.fnc(e.arg);
+    }
 }
 
 // called from step ticker ISR when block is finished, do not do anything slow here
-void Conveyor::block_finished()
+RAMFUNC void Conveyor::block_finished()
 {
    if(continuous_mode <= 1){
+        unsigned int line= queue.item_ref(queue.isr_tail_i)->line;
         // we increment the isr_tail_i so we can get the next block
         queue.isr_tail_i= queue.next(queue.isr_tail_i);
         //if(continuous_mode == 1) continuous_mode= 2;
+
+        // ran out of blocks while the job is still being fed, not waiting for idle on purpose
+        if(stats_on && running && queue.isr_tail_i == queue.head_i && !THEKERNEL->is_halted()) {
+            uint32_t now= us_ticker_read();
+            starve_start= now == 0 ? 1 : now;
+            starve_line= line;
+        }
+    }
+}
+
+// called from the step ticker ISR, keeps the longest few in order
+void Conveyor::record_starvation(uint32_t us, unsigned int line)
+{
+    ++starvations;
+    ++qstats.starve_count;
+    qstats.starve_ms += us / 1000;
+
+    int bin= 0;
+    for (uint32_t t= 1000; bin < queue_stats_t::TIME_BINS - 1 && us >= t; t *= 10) ++bin;
+    ++qstats.starved[bin];
+
+    int i= queue_stats_t::WORST;
+    while(i > 0 && qstats.worst[i - 1].us < us) {
+        if(i < queue_stats_t::WORST) qstats.worst[i]= qstats.worst[i - 1];
+        --i;
+    }
+    if(i < queue_stats_t::WORST) qstats.worst[i]= {line, us};
+}
+
+void Conveyor::start_queue_stats()
+{
+    stats_on= false;
+    memset(&qstats, 0, sizeof(qstats));
+    starve_start= 0;
+    stats_on= true;
+}
+
+void Conveyor::stop_queue_stats()
+{
+    // the queue running dry at the end of the job is not starvation
+    stats_on= false;
+    starve_start= 0;
+}
+
+void Conveyor::print_queue_stats(StreamOutput *stream, const char *prefix) const
+{
+    static const char *depth_names[queue_stats_t::DEPTH_BINS]= {"0", "1", "2-3", "4-7", "8-15", "16-31", "32-63", "64+"};
+    static const char *time_names[queue_stats_t::TIME_BINS]= {"<1ms", "<10ms", "<100ms", "<1s", "<10s", "10s+"};
+
+    stream->printf("%sQueue depth at block start:", prefix);
+    for (int i = 0; i < queue_stats_t::DEPTH_BINS; ++i) {
+        stream->printf(" %s:%lu", depth_names[i], qstats.depth[i]);
+    }
+    stream->printf("\n%sStarved %lu times for %lu ms:", prefix, qstats.starve_count, qstats.starve_ms);
+    for (int i = 0; i < queue_stats_t::TIME_BINS; ++i) {
+        stream->printf(" %s:%lu", time_names[i], qstats.starved[i]);
+    }
+    stream->printf("\n");
+    for (int i = 0; i < queue_stats_t::WORST && qstats.worst[i].us > 0; ++i) {
+        stream->printf("%s  %lu ms after line %u\n", prefix, qstats.worst[i].us / 1000, qstats.worst[i].line);
     }
 }
 
@@ -303,6 +507,8 @@ void Conveyor::flush_queue()
     // now wait until the block queue has been flushed
     wait_for_idle(false);
 
+    // the events of the blocks thrown away go with them
+    events_attached= events_due= events_run= events_queued;
     flush= false;
 }
 
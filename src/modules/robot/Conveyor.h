@@ -9,8 +9,10 @@
 
 #include "libs/Module.h"
 #include "BlockQueue.h"
+#include "Callback.h"
 
 class Block;
+class StreamOutput;
 
 class Conveyor : public Module
 {
@@ -25,7 +27,20 @@ public:
     void wait_for_idle(bool wait_for_motors=true);
     bool is_queue_empty() { return queue.is_empty(); };
     bool is_queue_full() { return queue.is_full(); };
+    // free slots left before queue_head_block() would have to block
+    unsigned int queue_free() const { return queue.size() == 0 ? 0 : queue.size() - 1 - queue.count(); }
+    unsigned int queue_used() const { return queue.count(); }
+    unsigned int queue_length() const { return queue.size(); }
+    bool is_queue_in_ahb() const { return queue.is_in_ahb(); }
+    // sizes the queue to n blocks once everything queued has run, 0 sizes it from the free memory. Returns false
+    // and keeps the queue it had if the memory is not there or the machine is halted
+    bool resize_queue(unsigned int n);
+    // blocks the step ticker has not finished yet, including the one it is on
+    unsigned int queue_pending() const { return queue.length == 0 ? 0 : (queue.head_i + queue.length - queue.isr_tail_i) % queue.length; }
     bool is_idle() const;
+    // lines of the block the step ticker is on and of the last one queued, 0 if there is none. Only reads, the fault
+    // handler calls it
+    void queue_lines(unsigned int &running, unsigned int &newest);
 
     // returns next available block writes it to block and returns true
     bool get_next_block(Block **block);
@@ -39,26 +54,82 @@ public:
     bool is_continuous_mode() const { return continuous_mode == 1; }
     void set_hold(bool f) { hold_queue= f; }
 
+    // something to do when the motion queued so far has run rather than by waiting for idle, like a spindle speed
+    // change in the middle of a cut. It is attached to the next block queued and run from on_idle once that
+    // block starts, or right away if nothing is queued. Returns false if too many are waiting already
+    typedef Callback<void(uint32_t)> event_fnc_t;
+    bool queue_event(event_fnc_t fnc, uint32_t arg);
+
+    // how well the queue was kept fed while a job played, gathered by the step ticker a block at a time
+    struct starve_event_t {
+        unsigned int line;      // of the block the queue ran dry after
+        uint32_t us;
+    };
+    struct queue_stats_t {
+        static const int DEPTH_BINS= 8;     // blocks waiting as one starts: 0, 1, 2-3, 4-7 ... 64 and up
+        static const int TIME_BINS= 6;      // starvation: under 1ms, 10ms, 100ms, 1s, 10s and longer
+        static const int WORST= 4;
+        uint32_t depth[DEPTH_BINS];
+        uint32_t starved[TIME_BINS];
+        uint32_t starve_count;
+        uint32_t starve_ms;
+        starve_event_t worst[WORST];        // longest first
+    };
+    // the player starts them with a job and stops them at the end
+    void start_queue_stats();
+    void stop_queue_stats();
+    const queue_stats_t& get_queue_stats() const { return qstats; }
+    void print_queue_stats(StreamOutput *stream, const char *prefix= "") const;
+
     friend class Planner; // for queue
 
 private:
     void check_queue(bool force= false);
+    unsigned int auto_queue_size() const;
     void queue_head_block(void);
 
     using  Queue_t= BlockQueue;
     Queue_t queue;  // Queue of Blocks
     void *saved_block;
     
+    void record_starvation(uint32_t us, unsigned int line);
+    void run_events();
+
     uint32_t queue_delay_time_ms;
+    uint32_t queue_idle_time_us;
+    uint32_t last_queued;           // when the last block was added
     size_t queue_size;
+    uint32_t queue_reserve;         // bytes an automatically sized queue leaves free
+    uint16_t queue_auto_max;
+    queue_stats_t qstats;
+    // for the counters, from boot rather than per job
+    uint32_t blocks_queued;
+    volatile uint32_t starvations;  // while a job played, counted by the step ticker
+    volatile uint32_t starve_start; // when the queue ran dry, 0 if it has not
+    unsigned int starve_line;
     float current_feedrate{0}; // actual nominal feedrate that current block is running at in mm/sec
 
+    // queued events in a ring, the counts only ever go up and wrap together
+    struct event_t {
+        event_fnc_t fnc;
+        uint32_t arg;
+    };
+    static const uint8_t k_max_events= 8; // must fit Block::n_events and divide 256
+    static const unsigned int k_min_queue_size= 8;
+    event_t events[k_max_events];
+    uint8_t events_queued;          // added by queue_event()
+    uint8_t events_attached;        // given to a block
+    volatile uint8_t events_due;    // their block has started, counted by the step ticker
+    uint8_t events_run;
+
     struct {
         volatile bool running:1;
         volatile bool allow_fetch:1;
         bool flush:1;
         volatile bool hold_queue:1;
         volatile uint8_t continuous_mode:2;
+        bool fast_fixed_point:1;
+        volatile bool stats_on:1;
     };
 
 };
@@ -21,12 +21,15 @@ using namespace std;
 #include "checksumm.h"
 #include "Robot.h"
 #include "ConfigValue.h"
+#include "RSqrt.h"
 
 #include <math.h>
 #include <algorithm>
 
 #define junction_deviation_checksum    CHECKSUM("junction_deviation")
 #define z_junction_deviation_checksum  CHECKSUM("z_junction_deviation")
+#define rapid_junction_deviation_checksum   CHECKSUM("rapid_junction_deviation")
+#define z_rapid_junction_deviation_checksum CHECKSUM("z_rapid_junction_deviation")
 #define minimum_planner_speed_checksum CHECKSUM("minimum_planner_speed")
 
 // The Planner does the acceleration math for the queue of Blocks ( movements ).
@@ -44,14 +47,15 @@ void Planner::config_load()
 {
     this->junction_deviation = THEKERNEL->config->value(junction_deviation_checksum)->by_default(0.05F)->as_number();
     this->z_junction_deviation = THEKERNEL->config->value(z_junction_deviation_checksum)->by_default(NAN)->as_number(); // disabled by default
+    // rapids cut nothing so they can take corners faster, disabled by default
+    this->rapid_junction_deviation = THEKERNEL->config->value(rapid_junction_deviation_checksum)->by_default(NAN)->as_number();
+    this->z_rapid_junction_deviation = THEKERNEL->config->value(z_rapid_junction_deviation_checksum)->by_default(NAN)->as_number();
     this->minimum_planner_speed = THEKERNEL->config->value(minimum_planner_speed_checksum)->by_default(0.0f)->as_number();
 }
 
 
 // Append a block to the queue, compute it's speed factors
-// 2024
-bool Planner::append_block( ActuatorCoordinates &actuator_pos, uint8_t n_motors, float rate_mm_s, float distance, float *unit_vec, float acceleration, float s_value, bool g123, unsigned int _line)
-// bool Planner::append_block( ActuatorCoordinates &actuator_pos, uint8_t n_motors, float rate_mm_s, float distance, float *unit_vec, float acceleration, float *s_values, int s_count, bool g123, unsigned int _line)
+bool Planner::append_block( ActuatorCoordinates &actuator_pos, uint8_t n_motors, float rate_mm_s, float distance, float *unit_vec, float acceleration, float jerk, float shaper_time, float s_value, bool g123, float override_factor, unsigned int _line, const float *s_values, uint8_t s_count)
 {
     // Create ( recycle ) a new block
     Block* block = THECONVEYOR->queue.head_ref();
@@ -60,12 +64,6 @@ bool Planner::append_block( ActuatorCoordinates &actuator_pos, uint8_t n_motors,
     // Direction bits
     bool has_steps = false;
 
-    // 2024
-    /*
-    int bigaxis = 0;
-    int32_t bigsteps = 0;
-    */
-
     for (size_t i = 0; i < n_motors; i++) {
         int32_t steps = THEROBOT->actuators[i]->steps_to_target(actuator_pos[i]);
         // Update current position
@@ -78,13 +76,6 @@ bool Planner::append_block( ActuatorCoordinates &actuator_pos, uint8_t n_motors,
         block->direction_bits[i] = (steps < 0) ? 1 : 0;
         // save actual steps in block
         block->steps[i] = labs(steps);
-
-        // 2024
-        /*
-        if( labs(steps) > bigsteps ) {
-			bigaxis = i;
-			bigsteps = labs(steps);
-		}*/
     }
 
     // sometimes even though there is a detectable movement it turns out there are no steps to be had from such a small move
@@ -95,30 +86,26 @@ bool Planner::append_block( ActuatorCoordinates &actuator_pos, uint8_t n_motors,
     }
 
     // info needed by laser
-    // 2024
     block->s_value = roundf(s_value*(1<<11)); // 1.11 fixed point
     block->is_g123 = g123;
 
-    /*
-	block->move_axis = bigaxis;
-	block->s_count = s_count;
-	for( int i = 0; i < s_count; i++ ) {
-		block->s_values[i] = roundf(s_values[i] * (1<<11)); // 1.11 fixed point
-	}
-	block->s_value = block->s_values[0];
-
-	block->is_g123 = g123;
-	*/
+    if(s_values == nullptr || s_count < 2) s_count = 0;
+    else if(s_count > Block::k_max_s_values) s_count = Block::k_max_s_values;
+    block->s_count = s_count;
+    for (uint8_t i = 0; i < block->s_count; i++) {
+        block->s_values[i] = roundf(s_values[i] * (1<<11)); // 1.11 fixed point
+    }
 
-    // use default JD
-    float junction_deviation = this->junction_deviation;
+    // use default JD, or the rapid one for moves that do not cut
+    float junction_deviation = (!g123 && !isnan(this->rapid_junction_deviation)) ? this->rapid_junction_deviation : this->junction_deviation;
 
     // use either regular junction deviation or z specific and see if a primary axis move
     block->primary_axis = true;
     if(block->steps[ALPHA_STEPPER] == 0 && block->steps[BETA_STEPPER] == 0) {
         if(block->steps[GAMMA_STEPPER] != 0) {
             // z only move
-            if(!isnan(this->z_junction_deviation)) junction_deviation = this->z_junction_deviation;
+            if(!g123 && !isnan(this->z_rapid_junction_deviation)) junction_deviation = this->z_rapid_junction_deviation;
+            else if(!isnan(this->z_junction_deviation)) junction_deviation = this->z_junction_deviation;
 
         } else {
             // is not a primary axis move
@@ -136,12 +123,37 @@ bool Planner::append_block( ActuatorCoordinates &actuator_pos, uint8_t n_motors,
     }
 
     block->acceleration = acceleration; // save in block
+    block->jerk = jerk; // 0 for a trapezoid
+    block->shaper_time = shaper_time;
 
     // Max number of steps, for all axes
     auto mi = std::max_element(block->steps.begin(), block->steps.end());
     block->steps_event_count = *mi;
+    block->prepare_motors();
 
     block->millimeters = distance;
+    block->acceleration_per_second = (acceleration * block->steps_event_count) / distance;
+    block->inv_acceleration_per_second = distance / (acceleration * block->steps_event_count);
+
+    // the fastest the actuators and axis limits allow this move, rate_mm_s is already within it
+    float max_speed = THEROBOT->max_speed > 0.0F ? THEROBOT->max_speed : INFINITY;
+    for (size_t i = 0; i < n_motors; i++) {
+        if(block->steps[i] == 0) continue;
+        float d = block->steps[i] / THEROBOT->actuators[i]->get_steps_per_mm();
+        max_speed = std::min(max_speed, THEROBOT->actuators[i]->get_max_rate() * distance / d);
+    }
+    for (size_t i = X_AXIS; unit_vec != nullptr && i <= Z_AXIS; i++) {
+        if(THEROBOT->max_speeds[i] > 0.0F && fabsf(unit_vec[i]) > 0.00001F) max_speed = std::min(max_speed, THEROBOT->max_speeds[i] / fabsf(unit_vec[i]));
+    }
+    block->max_speed = std::max(max_speed, rate_mm_s);
+
+    // moves the realtime overrides apply to remember their speed at 100% so they can be rescaled while queued,
+    // the override may also have changed since the rate was worked out if the move was held back for merging
+    block->programmed_speed = 0.0F;
+    if(override_factor > 0.0F) {
+        block->programmed_speed = rate_mm_s / override_factor;
+        rate_mm_s = std::min(block->programmed_speed * THEROBOT->get_override_factor(g123), block->max_speed);
+    }
 
     // Calculate speed in mm/sec for each axis. No divide by zero due to previous checks.
     if( distance > 0.0F ) {
@@ -170,6 +182,7 @@ bool Planner::append_block( ActuatorCoordinates &actuator_pos, uint8_t n_motors,
     // NOTE however it does not take into account independent axis, in most cartesian X and Y and Z are totally independent
     // and this allows one to stop with little to no decleration in many cases. This is particualrly bad on leadscrew based systems that will skip steps.
     float vmax_junction = minimum_planner_speed; // Set default max junction speed
+    block->junction_nominal = false;
 
     // if unit_vec was null then it was not a primary axis move so we skip the junction deviation stuff
     if (unit_vec != nullptr && !THECONVEYOR->is_queue_empty()) {
@@ -191,11 +204,14 @@ bool Planner::append_block( ActuatorCoordinates &actuator_pos, uint8_t n_motors,
             // Skip and use default max junction speed for 0 degree acute junction.
             if (cos_theta <= 0.9999F) {
                 vmax_junction = std::min(previous_nominal_speed, block->nominal_speed);
+                block->junction_nominal = true;
+                block->max_junction_speed = INFINITY;
                 // Skip and avoid divide by zero for straight junctions at 180 degrees. Limit to min() of nominal speeds.
                 if (cos_theta >= -0.9999F) {
                     // Compute maximum junction velocity based on maximum acceleration and junction deviation
-                    float sin_theta_d2 = sqrtf(0.5F * (1.0F - cos_theta)); // Trig half angle identity. Always positive.
-                    vmax_junction = std::min(vmax_junction, sqrtf(acceleration * junction_deviation * sin_theta_d2 / (1.0F - sin_theta_d2)));
+                    float sin_theta_d2 = sqrtf_fast(0.5F * (1.0F - cos_theta)); // Trig half angle identity. Always positive.
+                    block->max_junction_speed = sqrtf_fast(acceleration * junction_deviation * sin_theta_d2 / (1.0F - sin_theta_d2));
+                    vmax_junction = std::min(vmax_junction, block->max_junction_speed);
                 }
             }
         }
@@ -238,6 +254,29 @@ bool Planner::append_block( ActuatorCoordinates &actuator_pos, uint8_t n_motors,
     return true;
 }
 
+// a block that moves nothing for a while, the stepticker counts it out so the queue keeps filling behind it. Its max
+// entry speed is zero so the move before it stops, and it is not a primary axis move so the one after it starts from rest
+bool Planner::append_dwell(float seconds, unsigned int _line)
+{
+    uint32_t ticks = seconds * THEKERNEL->step_ticker->get_frequency();
+    if(ticks == 0) return false;
+
+    Block* block = THECONVEYOR->queue.head_ref();
+    block->clear();
+    block->line = _line;
+    block->is_dwell = true;
+    block->primary_axis = false;
+    block->nominal_length_flag = true;
+    block->total_move_ticks = ticks;
+    memset(previous_unit_vec, 0, sizeof(previous_unit_vec));
+
+    this->recalculate();
+    block->ready();
+    THECONVEYOR->queue_head_block();
+
+    return true;
+}
+
 void Planner::recalculate()
 {
     Conveyor::Queue_t &queue = THECONVEYOR->queue;
@@ -258,6 +297,9 @@ void Planner::recalculate()
      * then we can set recalculate to false, since clearly adding another block didn't allow us to enter faster
      * and thus we don't need to check entry speed for this block any more
      *
+     * the first block without recalculate set is the watermark, everything before it is optimally planned
+     * and will not change, like grbl's block_buffer_planned, so only the blocks after it are revisited
+     *
      * once we find an accel limited block, we must find the max exit speed and walk the queue forwards
      *
      * for each block, walking forwards in the queue:
@@ -311,7 +353,14 @@ void Planner::recalculate()
             // so this block can decide if it's accel or decel limited and update its fields as appropriate
             exit_speed = current->forward_pass(exit_speed);
 
-            previous->calculate_trapezoid(previous->entry_speed, current->entry_speed);
+            // a block entered at its max entry speed can never change either, as more blocks can only
+            // raise exit speeds, so everything up to here is optimal and the reverse pass stops here from now on
+            if(current->entry_speed == current->max_entry_speed) current->recalculate_flag = false;
+
+            // only redo the trapezoid if the move through the stable part of the queue changed its speeds
+            if(previous->entry_speed != previous->trapezoid_entry_speed || current->entry_speed != previous->exit_speed) {
+                previous->calculate_trapezoid(previous->entry_speed, current->entry_speed);
+            }
         }
     }
 
@@ -325,13 +374,139 @@ void Planner::recalculate()
     current->calculate_trapezoid(current->entry_speed, minimum_planner_speed);
 }
 
+// the nominal speed of a queued block at the current realtime overrides
+float Planner::override_speed(const Block *block) const
+{
+    if(block->programmed_speed <= 0.0F) return block->nominal_speed;
+    return std::min(block->programmed_speed * THEROBOT->get_override_factor(block->is_g123), block->max_speed);
+}
+
+/*
+ * a realtime feed or rapid override changed, rescale the blocks in the queue it applies to and plan them again
+ * so it takes effect from the next block rather than once everything already queued has run
+ *
+ * the block at isr_tail_i is ticking or may be picked up at any moment so it is left as it is, the block after
+ * it has to enter at the speed it was planned to exit at. Slowing down can make that impossible, when the block
+ * could not decelerate from there to what the new plan allows after it, so that block keeps its old plan too and
+ * the override starts from the first block that can take it.
+ *
+ * a move waiting in queue_head_block for room has been planned already so it is the last block of the queue
+ */
+void Planner::apply_override()
+{
+    Conveyor::Queue_t &queue = THECONVEYOR->queue;
+
+    if(queue.isr_tail_i == queue.head_i) return;
+    unsigned int last = queue.head_ref()->is_ready ? queue.head_i : queue.prev(queue.head_i);
+    if(last == queue.isr_tail_i) return;
+    unsigned int first = queue.next(queue.isr_tail_i);
+
+    /*
+     * Step 1:
+     * the reverse pass at the new speeds, the max entry speed of each block is kept in entry_speed
+     */
+
+    float exit_speed = minimum_planner_speed;
+    unsigned int block_index = last;
+    while (true) {
+        Block *current = queue.item_ref(block_index);
+        unsigned int prev_index = queue.prev(block_index);
+        float speed = override_speed(current);
+
+        float max_entry_speed = current->max_entry_speed;
+        if(current->junction_nominal) {
+            Block *previous = queue.item_ref(prev_index);
+            float previous_speed = (prev_index == queue.isr_tail_i) ? previous->nominal_speed : override_speed(previous);
+            max_entry_speed = std::min({previous_speed, speed, current->max_junction_speed});
+        }
+
+        float entry_speed = max_entry_speed;
+        if(speed > max_allowable_speed(-current->acceleration, minimum_planner_speed, current->millimeters)) {
+            entry_speed = std::min(entry_speed, max_allowable_speed(-current->acceleration, exit_speed, current->millimeters));
+        }
+        current->entry_speed = entry_speed;
+        exit_speed = entry_speed;
+
+        if(block_index == first) break;
+        block_index = prev_index;
+    }
+
+    /*
+     * Step 2:
+     * find the first block that can enter at the exit speed of the block before it and still keep to the new plan,
+     * the ones before it keep their old plan
+     */
+
+    float entry_speed = queue.item_ref(queue.isr_tail_i)->exit_speed;
+    block_index = first;
+    while (true) {
+        Block *current = queue.item_ref(block_index);
+        float speed = override_speed(current);
+        float next_entry_speed = (block_index == last) ? minimum_planner_speed : queue.item_ref(queue.next(block_index))->entry_speed;
+        if(entry_speed <= speed && (speed <= max_allowable_speed(-current->acceleration, minimum_planner_speed, current->millimeters) ||
+                                    entry_speed <= max_allowable_speed(-current->acceleration, next_entry_speed, current->millimeters))) {
+            break;
+        }
+
+        current->entry_speed = current->trapezoid_entry_speed;
+        entry_speed = current->exit_speed;
+        if(block_index == last) {
+            // nothing could take it, the override applies to the moves queued from now on
+            return;
+        }
+        block_index = queue.next(block_index);
+    }
+
+    /*
+     * Step 3:
+     * rescale and walk forwards from there, redoing the trapezoids
+     */
+
+    Block *previous = queue.item_ref(queue.prev(block_index));
+    bool first_block = true;
+    while (true) {
+        Block *current = queue.item_ref(block_index);
+        float speed = override_speed(current);
+        float max_entry_speed = current->entry_speed;
+
+        if(speed != current->nominal_speed) {
+            current->nominal_rate *= speed / current->nominal_speed;
+            current->nominal_speed = speed;
+        }
+        current->nominal_length_flag = speed <= max_allowable_speed(-current->acceleration, minimum_planner_speed, current->millimeters);
+        if(current->junction_nominal) {
+            current->max_entry_speed = std::min({previous->nominal_speed, speed, current->max_junction_speed});
+        }
+
+        if(first_block) {
+            // its entry is fixed by the block before it
+            current->entry_speed = entry_speed;
+            current->recalculate_flag = false;
+            first_block = false;
+        } else {
+            current->entry_speed = std::min(max_entry_speed, previous->max_exit_speed());
+            previous->calculate_trapezoid(previous->entry_speed, current->entry_speed);
+            // if the stepticker took the previous block before the new trapezoid was published it exits as it was planned before
+            current->entry_speed = previous->exit_speed;
+            current->recalculate_flag = current->entry_speed != current->max_entry_speed;
+        }
+
+        if(block_index == last) {
+            current->calculate_trapezoid(current->entry_speed, minimum_planner_speed);
+            break;
+        }
+        previous = current;
+        block_index = queue.next(block_index);
+    }
+}
+
 
 // Calculates the maximum allowable speed at this point when you must be able to reach target_velocity using the
 // acceleration within the allotted distance.
 float Planner::max_allowable_speed(float acceleration, float target_velocity, float distance)
 {
     // Was acceleration*60*60*distance, in case this breaks, but here we prefer to use seconds instead of minutes
-    return(sqrtf(target_velocity * target_velocity - 2.0F * acceleration * distance));
+    return(sqrtf_fast(target_velocity * target_velocity - 2.0F * acceleration * distance));
 }
 
 
@@ -16,18 +16,22 @@ class Planner
 public:
     Planner();
     float max_allowable_speed( float acceleration, float target_velocity, float distance);
+    float get_junction_deviation() const { return junction_deviation; }
 
     friend class Robot; // for acceleration, junction deviation, minimum_planner_speed
 
 private:
-    bool append_block(ActuatorCoordinates &target, uint8_t n_motors, float rate_mm_s, float distance, float unit_vec[], float accleration, float s_value, bool g123, unsigned int _line);
-    // 2024
-    // bool append_block(ActuatorCoordinates &target, uint8_t n_motors, float rate_mm_s, float distance, float unit_vec[], float accleration, float *s_values, int s_count, bool g123, unsigned int _line);
+    bool append_block(ActuatorCoordinates &target, uint8_t n_motors, float rate_mm_s, float distance, float unit_vec[], float accleration, float jerk, float shaper_time, float s_value, bool g123, float override_factor, unsigned int _line, const float *s_values= nullptr, uint8_t s_count= 0);
+    bool append_dwell(float seconds, unsigned int _line);
     void recalculate();
+    void apply_override();
+    float override_speed(const Block *block) const;
     void config_load();
     float previous_unit_vec[N_PRIMARY_AXIS];
     float junction_deviation;    // Setting
     float z_junction_deviation;  // Setting
+    float rapid_junction_deviation;   // Setting : for G0, NAN uses the feed moves one
+    float z_rapid_junction_deviation; // Setting
     float minimum_planner_speed; // Setting
 };
 
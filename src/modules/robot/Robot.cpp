@@ -12,6 +12,7 @@
 #include "CompensationPreprocessor.h"
 #include "CompensationTypes.h"
 #include "Planner.h"
+#include "Block.h"
 #include "Conveyor.h"
 #include "Pin.h"
 #include "StepperMotor.h"
@@ -20,15 +21,18 @@
 #include "PublicData.h"
 #include "arm_solutions/BaseSolution.h"
 #include "arm_solutions/CartesianSolution.h"
+#ifndef CARTESIAN_ONLY
 #include "arm_solutions/RotatableCartesianSolution.h"
 #include "arm_solutions/LinearDeltaSolution.h"
 #include "arm_solutions/RotaryDeltaSolution.h"
 #include "arm_solutions/HBotSolution.h"
 #include "arm_solutions/CoreXZSolution.h"
 #include "arm_solutions/MorganSCARASolution.h"
+#endif
 #include "StepTicker.h"
 #include "checksumm.h"
 #include "utils.h"
+#include "Config.h"
 #include "ConfigValue.h"
 #include "libs/StreamOutput.h"
 #include "StreamOutputPool.h"
@@ -36,6 +40,8 @@
 #include "ActuatorCoordinates.h"
 #include "EndstopsPublicAccess.h"
 #include "ATCHandlerPublicAccess.h"
+#include "SpindlePublicAccess.h"
+#include "FixedFormat.h"
 
 #include "mbed.h" // for us_ticker_read()
 #include "mri.h"
@@ -51,6 +57,12 @@
 #define  mm_per_arc_segment_checksum         CHECKSUM("mm_per_arc_segment")
 #define  mm_max_arc_error_checksum           CHECKSUM("mm_max_arc_error")
 #define  arc_correction_checksum             CHECKSUM("arc_correction")
+#define  arc_segments_per_second_checksum    CHECKSUM("arc_segments_per_second")
+#define  queue_dwell_checksum                CHECKSUM("queue_dwell")
+#define  mm_max_coalesce_error_checksum      CHECKSUM("mm_max_coalesce_error")
+#define  path_blend_tolerance_checksum       CHECKSUM("path_blend_tolerance")
+#define  mm_max_compensation_error_checksum  CHECKSUM("mm_max_compensation_error")
+#define  cutter_compensation_lookahead_checksum CHECKSUM("cutter_compensation_lookahead")
 #define  x_axis_max_speed_checksum           CHECKSUM("x_axis_max_speed")
 #define  y_axis_max_speed_checksum           CHECKSUM("y_axis_max_speed")
 #define  z_axis_max_speed_checksum           CHECKSUM("z_axis_max_speed")
@@ -83,6 +95,9 @@
 #define  max_speed_checksum                  CHECKSUM("max_speed")
 #define  acceleration_checksum               CHECKSUM("acceleration")
 #define  z_acceleration_checksum             CHECKSUM("z_acceleration")
+#define  rapid_acceleration_checksum         CHECKSUM("rapid_acceleration")
+#define  z_rapid_acceleration_checksum       CHECKSUM("z_rapid_acceleration")
+#define  jerk_checksum                       CHECKSUM("jerk")
 
 #define  alpha_checksum                      CHECKSUM("alpha")
 #define  beta_checksum                       CHECKSUM("beta")
@@ -108,6 +123,8 @@
 #define zmin_checksum                      CHECKSUM("z_min")
 
 #define load_last_wcs_checksum             CHECKSUM("load_last_wcs")
+#define a_axis_wrap_checksum               CHECKSUM("a_axis_wrap")
+#define status_position_interval_checksum  CHECKSUM("status_position_interval_ms")
 
 #define PI 3.14159265358979323846F // force to be float, do not use M_PI
 
@@ -127,12 +144,28 @@ Robot::Robot()
     this->inch_mode = false;
     this->absolute_mode = true;
     this->e_absolute_mode = true;
+    this->inverse_time_mode = false;
+    this->soft_endstop_checked = false;
+    this->inverse_time_f = 0.0F;
+    this->cylinder_radius = 0.0F;
     this->select_plane(X_AXIS, Y_AXIS, Z_AXIS);
     memset(this->machine_position, 0, sizeof machine_position);
     memset(this->compensated_machine_position, 0, sizeof compensated_machine_position);
+    memset(this->spline_pq, 0, sizeof spline_pq);
     this->arm_solution = NULL;
     seconds_per_minute = 60.0F;
+    rapid_override = 1.0F;
+    move_override = 0.0F;
+    feed_override_delta = 0;
+    spindle_override_delta = 0;
+    rapid_override_request = 0;
+    feed_override_reset = false;
+    spindle_override_reset = false;
+    override_pending = false;
     this->compensationTransform = nullptr;
+    this->feedGate = nullptr;
+    this->status_position.valid = false;
+    this->compensationSplits = nullptr;
     this->get_e_scale_fnc= nullptr;
     this->wcs_offsets.fill(wcs_t(0.0F, 0.0F, 0.0F, 0.0F, 0.0F));
     this->g92_offset = wcs_t(0.0F, 0.0F, 0.0F, 0.0F, 0.0F);
@@ -142,6 +175,7 @@ Robot::Robot()
     this->n_motors= 0;
     memset(this->sin_r, 0, sizeof sin_r);
     memset(this->r, 0, sizeof r);
+    this->wcs_xform= wcs_xform_t{1, 0, {0}, {0}};
     
     // Initialize cutter compensation preprocessor (v2.0)
     this->compensation_preprocessor = new CompensationPreprocessor();
@@ -151,6 +185,8 @@ Robot::Robot()
 void Robot::on_module_loaded()
 {
     this->register_for_event(ON_GCODE_RECEIVED);
+    this->register_for_event(ON_IDLE);
+    this->register_for_event(ON_HALT);
 
     // Configuration
     this->load_config();
@@ -181,6 +217,7 @@ void Robot::on_module_loaded()
         this->cos_r[wcs_index] = cos(this->r[wcs_index] * PI / 180.0);
         this->sin_r[wcs_index] = sin(this->r[wcs_index] * PI / 180.0);
     }
+    update_wcs_transform();
 }
 
 #define ACTUATOR_CHECKSUMS(X) {     \
@@ -189,7 +226,9 @@ void Robot::on_module_loaded()
     CHECKSUM(X "_en_pin"),          \
     CHECKSUM(X "_steps_per_mm"),    \
     CHECKSUM(X "_max_rate"),        \
-    CHECKSUM(X "_acceleration")     \
+    CHECKSUM(X "_acceleration"),    \
+    CHECKSUM(X "_jerk"),            \
+    CHECKSUM(X "_shaper_frequency") \
 }
 
 void Robot::load_config()
@@ -200,6 +239,13 @@ void Robot::load_config()
     // Here we read the config to find out which arm solution to use
     if (this->arm_solution) delete this->arm_solution;
     int solution_checksum = get_checksum(THEKERNEL->config->value(arm_solution_checksum)->by_default("cartesian")->as_string());
+#ifdef CARTESIAN_ONLY
+    // this build only has the cartesian solution
+    if(solution_checksum != cartesian_checksum) {
+        THEKERNEL->streams->printf("Warning: arm_solution is not available in this build, using cartesian\n");
+    }
+    this->arm_solution = new CartesianSolution(THEKERNEL->config);
+#else
     // Note checksums are not const expressions when in debug mode, so don't use switch
     if(solution_checksum == hbot_checksum || solution_checksum == corexy_checksum) {
         this->arm_solution = new HBotSolution(THEKERNEL->config);
@@ -225,6 +271,7 @@ void Robot::load_config()
     } else {
         this->arm_solution = new CartesianSolution(THEKERNEL->config);
     }
+#endif
 
     this->feed_rate           = THEKERNEL->config->value(default_feed_rate_checksum   )->by_default( 1000.0F)->as_number();
     this->seek_rate           = THEKERNEL->config->value(default_seek_rate_checksum   )->by_default( 3000.0F)->as_number();
@@ -233,6 +280,15 @@ void Robot::load_config()
     this->mm_per_arc_segment  = THEKERNEL->config->value(mm_per_arc_segment_checksum  )->by_default(    0.0f)->as_number();
     this->mm_max_arc_error    = THEKERNEL->config->value(mm_max_arc_error_checksum    )->by_default(   0.002f)->as_number();
     this->arc_correction      = THEKERNEL->config->value(arc_correction_checksum      )->by_default(    5   )->as_number();
+    this->arc_segments_per_second = THEKERNEL->config->value(arc_segments_per_second_checksum )->by_default(0.0f )->as_number();
+    // G4 goes in the queue as a block that moves nothing rather than draining it and waiting in the main loop
+    this->queue_dwell = THEKERNEL->config->value(queue_dwell_checksum )->by_default(true )->as_bool();
+    this->mm_max_coalesce_error = THEKERNEL->config->value(mm_max_coalesce_error_checksum )->by_default(0.0f )->as_number();
+    // corners are exact until a G64
+    this->default_blend_tolerance = THEKERNEL->config->value(path_blend_tolerance_checksum )->by_default(0.02f )->as_number();
+    this->blend_tolerance = 0;
+    this->mm_max_compensation_error = THEKERNEL->config->value(mm_max_compensation_error_checksum )->by_default(0.0f )->as_number();
+    this->compensation_preprocessor->set_lookahead(THEKERNEL->config->value(cutter_compensation_lookahead_checksum )->by_default(3 )->as_int());
 
     // in mm/sec but specified in config as mm/min
     this->max_speeds[X_AXIS]  = THEKERNEL->config->value(x_axis_max_speed_checksum    )->by_default(4000.0F)->as_number() / 60.0F;
@@ -256,16 +312,15 @@ void Robot::load_config()
         	g92_offset = wcs_t(t[0], t[1], t[2], t[3], t[4]);
         }
     }
+    update_wcs_transform();
 
     // default s value for laser
     this->s_value = THEKERNEL->config->value(laser_module_default_power_checksum)->by_default(1.0F)->as_number()
     					* THEKERNEL->config->value(laser_module_maximum_s_value_checksum)->by_default(1.0f)->as_number();
 
-    // 2024
-    /*
 	this->s_values[0] = this->s_value;
 	this->s_count = 1;
-	*/
+	set_s_span(0, 1);
 
 	this->laser_module_offset_x = THEKERNEL->config->value(laser_module_offset_x_checksum)->by_default(-38.0f)->as_number() ;
 	this->laser_module_offset_y = THEKERNEL->config->value(laser_module_offset_y_checksum)->by_default(5.0f)->as_number() ;
@@ -273,7 +328,7 @@ void Robot::load_config()
 
 
     // Make our Primary XYZ StepperMotors, and potentially A B C
-    uint16_t const motor_checksums[][6] = {
+    uint16_t const motor_checksums[][8] = {
         ACTUATOR_CHECKSUMS("alpha"), // X
         ACTUATOR_CHECKSUMS("beta"),  // Y
         ACTUATOR_CHECKSUMS("gamma"), // Z
@@ -290,6 +345,11 @@ void Robot::load_config()
 
     // default acceleration setting, can be overriden with newer per axis settings
     this->default_acceleration= THEKERNEL->config->value(acceleration_checksum)->by_default(100.0F )->as_number(); // Acceleration is in mm/s^2
+    // jerk limited (S-curve) ramps, 0 keeps the constant acceleration trapezoids, can be lowered with per axis settings
+    this->default_jerk= THEKERNEL->config->value(jerk_checksum)->by_default(0.0F )->as_number(); // Jerk is in mm/s^3
+    // G0 and the other moves that do not cut can accelerate harder, they replace the XY and Z limits for those moves
+    this->rapid_acceleration= THEKERNEL->config->value(rapid_acceleration_checksum)->by_default(NAN)->as_number();
+    this->z_rapid_acceleration= THEKERNEL->config->value(z_rapid_acceleration_checksum)->by_default(NAN)->as_number();
 
     // make each motor
     for (size_t a = 0; a < MAX_ROBOT_ACTUATORS; a++) {
@@ -335,6 +395,10 @@ void Robot::load_config()
         	actuators[a]->set_max_rate(THEKERNEL->config->value(motor_checksums[a][4])->by_default(3000.0F)->as_number()/60.0F); // it is in mm/min and converted to mm/sec
         }
         actuators[a]->set_acceleration(THEKERNEL->config->value(motor_checksums[a][5])->by_default(NAN)->as_number()); // mm/secs²
+        actuators[a]->set_jerk(THEKERNEL->config->value(motor_checksums[a][6])->by_default(NAN)->as_number()); // mm/secs³
+        // the resonance of this axis in Hz, every ramp it moves in eases its acceleration in over one period of it
+        float f= THEKERNEL->config->value(motor_checksums[a][7])->by_default(0.0F)->as_number();
+        actuators[a]->set_shaper_time(f > 0.0F ? 1.0F / f : 0.0F);
     }
 
     check_max_actuator_speeds(); // check the configs are sane
@@ -362,6 +426,12 @@ void Robot::load_config()
     }
     #endif
 
+    // A is a rotary axis that goes the short way round to an absolute position, G91 moves still turn as far as asked
+    a_axis_wrap = n_motors > A_AXIS && !actuators[A_AXIS]->is_extruder() && THEKERNEL->config->value(a_axis_wrap_checksum)->by_default(false)->as_bool();
+
+    // however many ask for the status, the realtime position is worked out at most this often while moving
+    status_position_interval_us = THEKERNEL->config->value(status_position_interval_checksum)->by_default(20)->as_number() * 1000;
+
     //this->clearToolOffset();
 
     soft_endstop_enabled= THEKERNEL->config->value(soft_endstop_checksum, enable_checksum)->by_default(true)->as_bool();
@@ -411,6 +481,7 @@ void Robot::pop_state()
         this->inch_mode = std::get<4>(s);
         this->is_g123 = std::get<5>(s);
         this->current_wcs = std::get<6>(s);
+        update_wcs_transform();
     }
 }
 
@@ -439,6 +510,32 @@ void Robot::get_current_machine_position(float *pos) const
     arm_solution->actuator_to_cartesian(current_position, pos);
 }
 
+void Robot::get_status_position(float pos[5])
+{
+    auto &c = status_position;
+    uint32_t now = us_ticker_read();
+    bool compensated = compensationTransform != nullptr;
+    bool stale = !c.valid || compensated != c.compensated;
+    if(!stale && now - c.time_us >= status_position_interval_us) {
+        for (size_t i = 0; i < n_motors; ++i) {
+            if((int32_t)actuators[i]->get_current_step() != c.steps[i]) stale = true;
+        }
+    }
+
+    if(stale) {
+        for (size_t i = 0; i < n_motors; ++i) c.steps[i] = actuators[i]->get_current_step();
+        get_current_machine_position(c.pos);
+        // current_position includes the compensation transform so we need to get the inverse to get actual position
+        if(compensationTransform) compensationTransform(c.pos, true, false);
+        c.pos[A_AXIS] = n_motors > A_AXIS ? actuators[A_AXIS]->get_current_position() : 0;
+        c.pos[B_AXIS] = n_motors > B_AXIS ? actuators[B_AXIS]->get_current_position() : 0;
+        c.compensated = compensated;
+        c.time_us = now;
+        c.valid = true;
+    }
+    memcpy(pos, c.pos, sizeof(c.pos));
+}
+
 void Robot::print_position(uint8_t subcode, std::string& res, bool ignore_extruders) const
 {
     // M114.1 is a new way to do this (similar to how GRBL does it).
@@ -446,20 +543,23 @@ void Robot::print_position(uint8_t subcode, std::string& res, bool ignore_extrud
     // this does require a FK to get a machine position from the actuator position
     // and then invert all the transforms to get a workspace position from machine position
     // M114 just does it the old way uses machine_position and does inverse transforms to get the requested position
-    uint32_t n = 0;
-    char buf[64];
+    const char *label = "";
+    float xyz[3] = {0, 0, 0};
     if(subcode == 0) { // M114 print WCS
         wcs_t pos= mcs2wcs(machine_position);
-        n = snprintf(buf, sizeof(buf), "C: X:%1.4f Y:%1.4f Z:%1.4f", from_millimeters(std::get<X_AXIS>(pos)), from_millimeters(std::get<Y_AXIS>(pos)), from_millimeters(std::get<Z_AXIS>(pos)));
+        label = "C:";
+        xyz[0] = from_millimeters(std::get<X_AXIS>(pos)); xyz[1] = from_millimeters(std::get<Y_AXIS>(pos)); xyz[2] = from_millimeters(std::get<Z_AXIS>(pos));
 
     } else if(subcode == 4) {
         // M114.4 print last milestone
-        n = snprintf(buf, sizeof(buf), "MP: X:%1.4f Y:%1.4f Z:%1.4f", machine_position[X_AXIS], machine_position[Y_AXIS], machine_position[Z_AXIS]);
+        label = "MP:";
+        memcpy(xyz, machine_position, sizeof(xyz));
 
     } else if(subcode == 5) {
         // M114.5 print last machine position (which should be the same as M114.1 if axis are not moving and no level compensation)
         // will differ from LMS by the compensation at the current position otherwise
-        n = snprintf(buf, sizeof(buf), "CMP: X:%1.4f Y:%1.4f Z:%1.4f", compensated_machine_position[X_AXIS], compensated_machine_position[Y_AXIS], compensated_machine_position[Z_AXIS]);
+        label = "CMP:";
+        memcpy(xyz, compensated_machine_position, sizeof(xyz));
 
     } else {
         // get real time positions
@@ -471,39 +571,48 @@ void Robot::print_position(uint8_t subcode, std::string& res, bool ignore_extrud
 
         if(subcode == 1) { // M114.1 print realtime WCS
             wcs_t pos= mcs2wcs(mpos);
-            n = snprintf(buf, sizeof(buf), "WCS: X:%1.4f Y:%1.4f Z:%1.4f", from_millimeters(std::get<X_AXIS>(pos)), from_millimeters(std::get<Y_AXIS>(pos)), from_millimeters(std::get<Z_AXIS>(pos)));
+            label = "WCS:";
+            xyz[0] = from_millimeters(std::get<X_AXIS>(pos)); xyz[1] = from_millimeters(std::get<Y_AXIS>(pos)); xyz[2] = from_millimeters(std::get<Z_AXIS>(pos));
 
         } else if(subcode == 2) { // M114.2 print realtime Machine coordinate system
-            n = snprintf(buf, sizeof(buf), "MCS: X:%1.4f Y:%1.4f Z:%1.4f", mpos[X_AXIS], mpos[Y_AXIS], mpos[Z_AXIS]);
+            label = "MCS:";
+            memcpy(xyz, mpos, sizeof(xyz));
 
         } else if(subcode == 3) { // M114.3 print realtime actuator position
             // get real time current actuator position in mm
-            ActuatorCoordinates current_position{
-                actuators[X_AXIS]->get_current_position(),
-                actuators[Y_AXIS]->get_current_position(),
-                actuators[Z_AXIS]->get_current_position()
-            };
-            n = snprintf(buf, sizeof(buf), "APOS: X:%1.4f Y:%1.4f Z:%1.4f", current_position[X_AXIS], current_position[Y_AXIS], current_position[Z_AXIS]);
+            label = "APOS:";
+            for (int i = X_AXIS; i <= Z_AXIS; ++i) xyz[i] = actuators[i]->get_current_position();
+
+        } else {
+            return;
         }
     }
 
-    if(n > sizeof(buf)) n= sizeof(buf);
-    res.append(buf, n);
+    // formatted without printf, M114 is polled as often as the status report
+    char buf[24];
+    res.append(label);
+    for (int i = X_AXIS; i <= Z_AXIS; ++i) {
+        res.append(1, ' ').append(1, 'X' + i).append(1, ':');
+        res.append(buf, format_fixed(buf, sizeof(buf), xyz[i], 4));
+    }
 
     #if MAX_ROBOT_ACTUATORS > 3
     // deal with the ABC axis
     for (int i = A_AXIS; i < n_motors; ++i) {
-        n= 0;
         if(ignore_extruders && actuators[i]->is_extruder()) continue; // don't show an extruder as that will be E
+        float v;
         if(subcode == 4) { // M114.4 print last milestone
-            n= snprintf(buf, sizeof(buf), " %c:%1.4f", 'A'+i-A_AXIS, machine_position[i]);
+            v = machine_position[i];
 
         }else if(subcode == 2 || subcode == 3) { // M114.2/M114.3 print actuator position which is the same as machine position for ABC
             // current actuator position
-            n= snprintf(buf, sizeof(buf), " %c:%1.4f", 'A'+i-A_AXIS, actuators[i]->get_current_position());
+            v = actuators[i]->get_current_position();
+
+        }else{
+            continue;
         }
-        if(n > sizeof(buf)) n= sizeof(buf);
-        if(n > 0) res.append(buf, n);
+        res.append(1, ' ').append(1, 'A' + i - A_AXIS).append(1, ':');
+        res.append(buf, format_fixed(buf, sizeof(buf), v, 4));
     }
     #endif
 }
@@ -511,6 +620,19 @@ void Robot::print_position(uint8_t subcode, std::string& res, bool ignore_extrud
 // converts current last milestone (machine position without compensation transform) to work coordinate system (inverse transform)
 Robot::wcs_t Robot::mcs2selected_wcs(const wcs_t &pos, size_t n) const
 {
+    if(n == current_wcs) {
+        // the current wcs is folded into one rotation and offset
+        const wcs_xform_t &t= this->wcs_xform;
+        float x= std::get<X_AXIS>(pos), y= std::get<Y_AXIS>(pos);
+        return std::make_tuple(
+            t.cos_r * x + t.sin_r * y + t.to_wcs[X_AXIS],
+            t.cos_r * y - t.sin_r * x + t.to_wcs[Y_AXIS],
+            std::get<Z_AXIS>(pos) + t.to_wcs[Z_AXIS],
+            std::get<A_AXIS>(pos) + t.to_wcs[A_AXIS],
+            std::get<B_AXIS>(pos) + t.to_wcs[B_AXIS]
+        );
+    }
+
     return std::make_tuple(
         this->cos_r[n] * (std::get<X_AXIS>(pos) - std::get<X_AXIS>(wcs_offsets[n])) + this->sin_r[n] * (std::get<Y_AXIS>(pos) - std::get<Y_AXIS>(wcs_offsets[n])) + std::get<X_AXIS>(g92_offset) - std::get<X_AXIS>(tool_offset),
         this->cos_r[n] * (std::get<Y_AXIS>(pos) - std::get<Y_AXIS>(wcs_offsets[n])) - this->sin_r[n] * (std::get<X_AXIS>(pos) - std::get<X_AXIS>(wcs_offsets[n])) + std::get<Y_AXIS>(g92_offset) - std::get<Y_AXIS>(tool_offset),
@@ -523,15 +645,44 @@ Robot::wcs_t Robot::mcs2selected_wcs(const wcs_t &pos, size_t n) const
 // converts a position in work coordinate system to machine coordinate system (machine position)
 Robot::wcs_t Robot::wcs2mcs(const Robot::wcs_t& pos) const
 {
+    const wcs_xform_t &t= this->wcs_xform;
+    float x= std::get<X_AXIS>(pos), y= std::get<Y_AXIS>(pos);
     return std::make_tuple(
-        std::get<X_AXIS>(wcs_offsets[current_wcs]) + this->cos_r[current_wcs] * (std::get<X_AXIS>(pos) - std::get<X_AXIS>(g92_offset) + std::get<X_AXIS>(tool_offset)) - this->sin_r[current_wcs] * (std::get<Y_AXIS>(pos) - std::get<Y_AXIS>(g92_offset) + std::get<Y_AXIS>(tool_offset)),
-        std::get<Y_AXIS>(wcs_offsets[current_wcs]) + this->cos_r[current_wcs] * (std::get<Y_AXIS>(pos) - std::get<Y_AXIS>(g92_offset) + std::get<Y_AXIS>(tool_offset)) + this->sin_r[current_wcs] * (std::get<X_AXIS>(pos) - std::get<X_AXIS>(g92_offset) + std::get<X_AXIS>(tool_offset)),
-        std::get<Z_AXIS>(pos) + std::get<Z_AXIS>(wcs_offsets[current_wcs]) - std::get<Z_AXIS>(g92_offset) + std::get<Z_AXIS>(tool_offset),
-        std::get<A_AXIS>(pos) + std::get<A_AXIS>(wcs_offsets[current_wcs]) - std::get<A_AXIS>(g92_offset) + std::get<A_AXIS>(tool_offset),
-        std::get<B_AXIS>(pos) + std::get<B_AXIS>(wcs_offsets[current_wcs]) - std::get<B_AXIS>(g92_offset) + std::get<B_AXIS>(tool_offset)
+        t.cos_r * x - t.sin_r * y + t.to_mcs[X_AXIS],
+        t.cos_r * y + t.sin_r * x + t.to_mcs[Y_AXIS],
+        std::get<Z_AXIS>(pos) + t.to_mcs[Z_AXIS],
+        std::get<A_AXIS>(pos) + t.to_mcs[A_AXIS],
+        std::get<B_AXIS>(pos) + t.to_mcs[B_AXIS]
     );
 }
 
+// fold the current wcs offset and rotation, the g92 offset and the tool offset into the one rotation and offset
+// each way that mcs2wcs() and wcs2mcs() apply, this must be called whenever any of them change
+void Robot::update_wcs_transform()
+{
+    wcs_xform_t &t= this->wcs_xform;
+    float c= this->cos_r[current_wcs], s= this->sin_r[current_wcs];
+    float o[5], d[5];
+    std::tie(o[X_AXIS], o[Y_AXIS], o[Z_AXIS], o[A_AXIS], o[B_AXIS])= wcs_offsets[current_wcs];
+    std::tie(d[X_AXIS], d[Y_AXIS], d[Z_AXIS], d[A_AXIS], d[B_AXIS])= g92_offset;
+    float to[5];
+    std::tie(to[X_AXIS], to[Y_AXIS], to[Z_AXIS], to[A_AXIS], to[B_AXIS])= tool_offset;
+    for (int i = 0; i < 5; i++) d[i] -= to[i];
+
+    // wcs = R'(mcs - wcs offset) + g92 - tool
+    t.cos_r= c;
+    t.sin_r= s;
+    t.to_wcs[X_AXIS]= d[X_AXIS] - (c * o[X_AXIS] + s * o[Y_AXIS]);
+    t.to_wcs[Y_AXIS]= d[Y_AXIS] - (c * o[Y_AXIS] - s * o[X_AXIS]);
+    // mcs = wcs offset + R(wcs - g92 + tool)
+    t.to_mcs[X_AXIS]= o[X_AXIS] - (c * d[X_AXIS] - s * d[Y_AXIS]);
+    t.to_mcs[Y_AXIS]= o[Y_AXIS] - (c * d[Y_AXIS] + s * d[X_AXIS]);
+    for (int i = Z_AXIS; i <= B_AXIS; i++) {
+        t.to_wcs[i]= d[i] - o[i];
+        t.to_mcs[i]= o[i] - d[i];
+    }
+}
+
 // this does a sanity check that actuator speeds do not exceed steps rate capability
 // we will override the actuator max_rate if the combination of max_rate and steps/sec exceeds base_stepping_frequency
 void Robot::check_max_actuator_speeds()
@@ -602,6 +753,8 @@ void Robot::set_current_wcs_by_mpos(float x, float y, float z, float a, float b,
             }
         }
     }
+    update_wcs_transform();
+
     // save eeprom data if the current WCS is 0-5 or the Z offset is recalculated
     if (current_wcs <= 5 || recalculate_z_offset) {
         THEKERNEL->write_eeprom_data();
@@ -617,6 +770,9 @@ void Robot::on_gcode_received(void *argument)
 
     enum MOTION_MODE_T motion_mode= NONE;
 
+    // a move held back for merging has to go before anything that is not another move
+    if(gcode->has_m || (gcode->has_g && gcode->g > 3)) flush_coalesced();
+
     if( gcode->has_g) {
         // CRITICAL: Flush compensation buffer before non-move G-codes
         // This ensures buffered moves execute BEFORE commands like G28, G4, G10, etc.
@@ -638,17 +794,8 @@ void Robot::on_gcode_received(void *argument)
                     Gcode* compensated = compensation_preprocessor->get_compensated_gcode();
                     if (compensated != nullptr) {
                         flush_count++;
-                        gcode->stream->printf(">>AUTO_FLUSH[%d]: %s\n", flush_count, compensated->get_command());
-                        // Process the buffered move
-                        MOTION_MODE_T motion = NONE;
-                        if (compensated->has_g && (compensated->g == 0 || compensated->g == 1)) {
-                            motion = (compensated->g == 0) ? SEEK : LINEAR;
-                        } else if (compensated->has_g && (compensated->g == 2 || compensated->g == 3)) {
-                            motion = (compensated->g == 2) ? CW_ARC : CCW_ARC;
-                        }
-                        if (motion != NONE) {
-                            process_move(compensated, motion);
-                        }
+                        // Process the buffered move, it is always G0-G3
+                        process_move(compensated, (MOTION_MODE_T)(SEEK + compensated->g));
                         delete compensated;
                     } else {
                         gcode->stream->printf(">>AUTO_FLUSH: NULL gcode (expected, buffer empty)\n");
@@ -664,6 +811,7 @@ void Robot::on_gcode_received(void *argument)
             case 1:  motion_mode = LINEAR;  break;
             case 2:  motion_mode = CW_ARC;  break;
             case 3:  motion_mode = CCW_ARC; break;
+            case 5:  motion_mode = gcode->subcode == 1 ? QUAD_SPLINE : CUBIC_SPLINE; break;
             case 4: { // G4 Dwell
                 uint32_t delay_ms = 0;
                 if (gcode->has_letter('P')) {
@@ -680,7 +828,11 @@ void Robot::on_gcode_received(void *argument)
                 if (gcode->has_letter('S')) {
                     delay_ms += gcode->get_int('S') * 1000;
                 }
-                if (delay_ms > 0) {
+                if (delay_ms > 0 && this->queue_dwell) {
+                    // the step ticker counts it out, anything that waits for the queue to be idle waits for it too
+                    THEKERNEL->planner->append_dwell(delay_ms / 1000.0F, gcode->line);
+
+                } else if (delay_ms > 0) {
                     // drain queue
                     THEKERNEL->conveyor->wait_for_idle();
                     // wait for specified time
@@ -800,6 +952,8 @@ void Robot::on_gcode_received(void *argument)
                                 }
                             }
                         }
+                        update_wcs_transform();
+
                         // save eeprom data if the current WCS is 0-5 or the Z offset is recalculated
                         if (n <= 5 || recalculate_z_offset) {
                             THEKERNEL->write_eeprom_data();
@@ -825,17 +979,8 @@ void Robot::on_gcode_received(void *argument)
                     Gcode* compensated = compensation_preprocessor->get_compensated_gcode();
                     if (compensated != nullptr) {
                         flush_count++;
-                        gcode->stream->printf(">>G40_FLUSH[%d]: %s\n", flush_count, compensated->get_command());
-                        // Process the remaining buffered moves through normal path
-                        MOTION_MODE_T motion = NONE;
-                        if (compensated->has_g && (compensated->g == 0 || compensated->g == 1)) {
-                            motion = (compensated->g == 0) ? SEEK : LINEAR;
-                        } else if (compensated->has_g && (compensated->g == 2 || compensated->g == 3)) {
-                            motion = (compensated->g == 2) ? CW_ARC : CCW_ARC;
-                        }
-                        if (motion != NONE) {
-                            process_move(compensated, motion);
-                        }
+                        // Process the remaining buffered moves through normal path, they are always G0-G3
+                        process_move(compensated, (MOTION_MODE_T)(SEEK + compensated->g));
                         delete compensated;
                     } else {
                         gcode->stream->printf(">>G40_FLUSH: NULL gcode returned!\n");
@@ -882,6 +1027,7 @@ void Robot::on_gcode_received(void *argument)
                     current_wcs += gcode->subcode;
                     if(current_wcs >= MAX_WCS) current_wcs = MAX_WCS - 1;
                 }
+                update_wcs_transform();
                 if (current_wcs > 0 && current_wcs < 6) {
                     THEKERNEL->eeprom_data->current_wcs = current_wcs;
                     THEKERNEL->write_eeprom_data();
@@ -891,8 +1037,21 @@ void Robot::on_gcode_received(void *argument)
                 }
                 break;
 
+            case 61: this->blend_tolerance = 0; break; // G61 exact path, G61.1 is the same here
+            case 64: // G64 P<tolerance> rounds off the corners between feed moves by up to that much
+                this->blend_tolerance = std::max(0.0F, gcode->has_letter('P') ? this->to_millimeters(gcode->get_value('P')) : this->default_blend_tolerance);
+                break;
             case 90: this->absolute_mode = true; this->e_absolute_mode = true; break;
             case 91: this->absolute_mode = false; this->e_absolute_mode = false; break;
+            case 93: this->inverse_time_mode = true; break;
+            case 94: this->inverse_time_mode = false; break;
+
+            case 7:
+                // G7.1 R<radius> cylindrical interpolation, Y is the distance round a cylinder of that radius on A, R0 or no R ends it
+                if(gcode->subcode == 1) {
+                    this->cylinder_radius = gcode->has_letter('R') ? std::max(0.0F, this->to_millimeters(gcode->get_value('R'))) : 0.0F;
+                }
+                break;
 
             case 92: {
                 if(gcode->subcode == 1 || gcode->subcode == 2 || gcode->get_num_args() == 0) {
@@ -1012,6 +1171,7 @@ void Robot::on_gcode_received(void *argument)
                 }
                 #endif
 */
+                update_wcs_transform();
                 return;
             }
         }
@@ -1028,6 +1188,8 @@ void Robot::on_gcode_received(void *argument)
             case 2: // M2 end of program
                 //current_wcs = 0;
                 absolute_mode = true;
+                inverse_time_mode = false;
+                cylinder_radius = 0;
                 seconds_per_minute= 60;
                 break;
             case 17:
@@ -1242,6 +1404,14 @@ void Robot::on_gcode_received(void *argument)
                 THEKERNEL->conveyor->wait_for_idle();
                 break;
 
+            case 401: // M401 Sn resizes the planner queue to n blocks when the moves queued have run, S0 to what the free memory allows
+                if(gcode->has_letter('S') && !THEKERNEL->conveyor->resize_queue(gcode->get_uint('S'))) {
+                    gcode->stream->printf("error:planner queue can not be resized to %lu blocks\n", (unsigned long)gcode->get_uint('S'));
+                }
+                gcode->stream->printf("Planner queue: %u blocks of %u bytes in %s\n", THEKERNEL->conveyor->queue_length(),
+                    (unsigned)sizeof(Block), THEKERNEL->conveyor->is_queue_in_ahb() ? "AHB" : "heap");
+                break;
+
             case 500: // M500 saves some volatile settings to config override file
             case 503: { // M503 just prints the settings
                 gcode->stream->printf(";Steps per unit:\nM92 ");
@@ -1348,25 +1518,23 @@ void Robot::on_gcode_received(void *argument)
     if( motion_mode != NONE) {
         is_g123= motion_mode != SEEK;
         
-        if (compensation_preprocessor->is_active()) {
-            // Compensation is active - buffer the G-code
-            gcode->stream->printf(">>BUFFER_IN: %s (count=%d)\n", 
-                gcode->get_command(), compensation_preprocessor->get_buffer_count());
-            if (compensation_preprocessor->buffer_gcode(gcode)) {
-                // Successfully buffered - now try to get compensated output
+        if ((motion_mode == CUBIC_SPLINE || motion_mode == QUAD_SPLINE) && compensation_preprocessor->is_active()) {
+            // the preprocessor offsets lines and arcs only
+            gcode->is_error= true;
+            gcode->txt_after_ok= "G5 not supported with cutter compensation\n";
+            THEKERNEL->streams->printf("Alarm:G5 not supported with cutter compensation\n");
+        } else if (compensation_preprocessor->is_active()) {
+            // Compensation is active - buffer the words of the move
+            if (compensation_preprocessor->buffer_gcode(gcode, motion_mode - SEEK)) {
+                // Successfully buffered - now try to get compensated output, it comes out a few moves behind
                 Gcode* compensated = compensation_preprocessor->get_compensated_gcode();
                 if (compensated != nullptr) {
-                    gcode->stream->printf(">>COMP_OUT: %s (buffer_count=%d)\n", 
-                        compensated->get_command(), compensation_preprocessor->get_buffer_count());
-                    // Process the compensated G-code through normal path
-                    process_move(compensated, motion_mode);
+                    // Process the compensated move through normal path, it may not be the same motion as this one
+                    process_move(compensated, (MOTION_MODE_T)(SEEK + compensated->g));
                     delete compensated;  // Clean up after processing
-                } else {
-                    gcode->stream->printf(">>BUFFERING: waiting for lookahead (count=%d)\n", 
-                        compensation_preprocessor->get_buffer_count());
                 }
             } else {
-                // Buffer full - this shouldn't happen with 10 slots
+                // Buffer full - only if the ring could not be allocated, as a move always comes out when it fills
                 THEKERNEL->streams->printf("ERROR: Compensation buffer full\n");
                 process_move(gcode, motion_mode);  // Fall back to uncompensated
             }
@@ -1415,6 +1583,17 @@ void Robot::process_move(Gcode *gcode, enum MOTION_MODE_T motion_mode)
     // we have a G0/G1/G2/G3 so extract parameters and apply offsets to get machine coordinate target
     // get XYZ and one E (which goes to the selected extruder)/A and B
     float param[5]{NAN, NAN, NAN, NAN, NAN};
+
+    // the rapids before it went on while the spindle spun up
+    if(motion_mode != SEEK && motion_mode != NONE) pass_feed_gate();
+
+    #if MAX_ROBOT_ACTUATORS > 3
+    // the whole turns a wrapping A has made are dropped once it stands still, so it stays within a turn either way of 0
+    if(a_axis_wrap && fabsf(machine_position[A_AXIS]) >= 360.0F && THECONVEYOR->is_idle() && coalesced.n_points == 0) {
+        reset_axis_position(fmodf(machine_position[A_AXIS], 360.0F), A_AXIS);
+    }
+    #endif
+
     wcs_t pos= mcs2wcs(machine_position);
 
     // process primary axis
@@ -1425,6 +1604,22 @@ void Robot::process_move(Gcode *gcode, enum MOTION_MODE_T motion_mode)
         }
     }
 
+    #if MAX_ROBOT_ACTUATORS > 3
+    // in G7.1 Y does not move Y, it is unwrapped round the cylinder and turns A below
+    float cylinder_y = NAN;
+    if(cylinder_radius > 0) {
+        if(motion_mode == CW_ARC || motion_mode == CCW_ARC) {
+            gcode->is_error= true;
+            gcode->txt_after_ok= "G2/G3 not supported in G7.1\n";
+            THEKERNEL->streams->printf("Alarm:G2/G3 not supported in G7.1\n");
+            this->next_command_is_MCS = false;
+            return;
+        }
+        cylinder_y = param[Y_AXIS];
+        param[Y_AXIS] = NAN;
+    }
+    #endif
+
     float offset[3]{0,0,0};
     for(char letter = 'I'; letter <= 'K'; letter++) {
         if( gcode->has_letter(letter) ) {
@@ -1449,18 +1644,11 @@ void Robot::process_move(Gcode *gcode, enum MOTION_MODE_T motion_mode)
             if (isnan(param[Z_AXIS])) {
                 param[Z_AXIS] = std::get<Z_AXIS>(pos);
             }
-            // apply g92 offset and tool offset
-            param[X_AXIS] = param[X_AXIS] - std::get<X_AXIS>(g92_offset) + std::get<X_AXIS>(tool_offset);
-            param[Y_AXIS] = param[Y_AXIS] - std::get<Y_AXIS>(g92_offset) + std::get<Y_AXIS>(tool_offset);
-            param[Z_AXIS] = param[Z_AXIS] - std::get<Z_AXIS>(g92_offset) + std::get<Z_AXIS>(tool_offset);
-
-            // rotate the parameters
-            // param[x-z] after rotation is the vector from wcs origin to target in the machine coordinate system
-            rotate(&param[X_AXIS], &param[Y_AXIS], &param[Z_AXIS]);
-            
-            target[X_AXIS] = ROUND_NEAR_HALF(std::get<X_AXIS>(wcs_offsets[current_wcs]) + param[X_AXIS]);
-            target[Y_AXIS] = ROUND_NEAR_HALF(std::get<Y_AXIS>(wcs_offsets[current_wcs]) + param[Y_AXIS]);
-            target[Z_AXIS] = ROUND_NEAR_HALF(std::get<Z_AXIS>(wcs_offsets[current_wcs]) + param[Z_AXIS]);
+            // apply g92 offset and tool offset, the rotation and the wcs offset in one go, see update_wcs_transform()
+            const wcs_xform_t &t= this->wcs_xform;
+            target[X_AXIS] = ROUND_NEAR_HALF(t.cos_r * param[X_AXIS] - t.sin_r * param[Y_AXIS] + t.to_mcs[X_AXIS]);
+            target[Y_AXIS] = ROUND_NEAR_HALF(t.cos_r * param[Y_AXIS] + t.sin_r * param[X_AXIS] + t.to_mcs[Y_AXIS]);
+            target[Z_AXIS] = ROUND_NEAR_HALF(param[Z_AXIS] + t.to_mcs[Z_AXIS]);
 
                         
             arc_target_unrotated[X_AXIS] = target[X_AXIS] - machine_position[X_AXIS];
@@ -1541,15 +1729,17 @@ void Robot::process_move(Gcode *gcode, enum MOTION_MODE_T motion_mode)
             param[i] = gcode->get_value(letter);
         }
     }
+    if(!isnan(cylinder_y)) param[A_AXIS] = cylinder_y * 180.0F / (PI * cylinder_radius);
     if(!next_command_is_MCS) {
         if (this->absolute_mode) {
             // apply wcs offsets and g92 offset and tool offset
             if(!isnan(param[A_AXIS])) {
-                target[A_AXIS]= ROUND_NEAR_HALF(param[A_AXIS] + std::get<A_AXIS>(wcs_offsets[current_wcs]) - std::get<A_AXIS>(g92_offset) + std::get<A_AXIS>(tool_offset));
+                target[A_AXIS]= ROUND_NEAR_HALF(param[A_AXIS] + wcs_xform.to_mcs[A_AXIS]);
+                if(a_axis_wrap && isnan(cylinder_y)) target[A_AXIS]= shortest_a_target(target[A_AXIS]);
             }
                 	                	
             if(!isnan(param[B_AXIS])) {
-                target[B_AXIS]= ROUND_NEAR_HALF(param[B_AXIS] + std::get<B_AXIS>(wcs_offsets[current_wcs]) - std::get<B_AXIS>(g92_offset) + std::get<B_AXIS>(tool_offset));
+                target[B_AXIS]= ROUND_NEAR_HALF(param[B_AXIS] + wcs_xform.to_mcs[B_AXIS]);
 
             }
         } else {
@@ -1563,76 +1753,46 @@ void Robot::process_move(Gcode *gcode, enum MOTION_MODE_T motion_mode)
         for(int i= A_AXIS; i <= B_AXIS; ++i) {
             if(!isnan(param[i])) target[i] = ROUND_NEAR_HALF(param[i]);
         }
+        if(a_axis_wrap && isnan(cylinder_y) && !isnan(param[A_AXIS])) target[A_AXIS]= shortest_a_target(target[A_AXIS]);
     }
     
     #endif
 
-    if( gcode->has_letter('F') ) {
+    if(inverse_time_mode && motion_mode != NONE && motion_mode != SEEK) {
+        // in G93 every feed move must have its own F, it is the inverse of the minutes the move takes and is not a length
+        if(!gcode->has_letter('F')) {
+            gcode->is_error= true;
+            gcode->txt_after_ok= "F required in inverse time mode\n";
+            THEKERNEL->streams->printf("Alarm:F required in inverse time mode\n");
+            this->next_command_is_MCS = false;
+            return;
+        }
+        this->inverse_time_f = gcode->get_value('F');
+
+    } else if( gcode->has_letter('F') ) {
         if( motion_mode == SEEK )
             this->seek_rate = this->to_millimeters( gcode->get_value('F') );
         else
             this->feed_rate = this->to_millimeters( gcode->get_value('F') );
     }
 
+    // S is modal When specified on a G0/1/2/3 command, a G1 can also give a list S0.1:0.5:1 which is spread
+    // evenly along the line for raster engraving, the last one stays modal
+    s_count = 1;
     if(gcode->has_letter('S')) {
-    	s_value = gcode->get_value('S');
-    }
-
-    // S is modal When specified on a G0/1/2/3 command
-    if(gcode->has_letter('S')) {
-    	s_value = gcode->get_value('S');
+        char *p;
+        s_value = gcode->get_value('S', &p);
+        s_values[0] = s_value;
+        while(motion_mode == LINEAR && p != nullptr && *p == ':' && s_count < Block::k_max_s_values) {
+            char *e;
+            float v = strtof(p + 1, &e);
+            if(e == p + 1) break;
+            s_values[s_count++] = v;
+            p = e;
+        }
+        s_value = s_values[s_count - 1];
     }
 
-    /*
-	s_count = 1;
-	int index = gcode->index_of_letter('S');
-    if (index >= 0) {
-		s_value = gcode->get_value_at_index(index);
-		s_values[0] = s_value;
-
-		index = gcode->index_of_letter(':', index + 1);
-		if(index >= 0) {
-			s_values[1] = gcode->get_value_at_index(index);
-			s_count = 2;
-
-			index = gcode->index_of_letter(':', index+1);
-			if(index >= 0) {
-				s_values[2] = gcode->get_value_at_index(index);
-				s_count = 3;
-
-				index = gcode->index_of_letter(':', index+1);
-				if(index >= 0) {
-					s_values[3] = gcode->get_value_at_index(index);
-					s_count = 4;
-
-					index = gcode->index_of_letter(':', index+1);
-					if(index >= 0) {
-						s_values[4] = gcode->get_value_at_index(index);
-						s_count = 5;
-
-						index = gcode->index_of_letter(':', index+1);
-						if(index >= 0) {
-							s_values[5] = gcode->get_value_at_index(index);
-							s_count = 6;
-
-							index = gcode->index_of_letter(':', index+1);
-							if(index >= 0) {
-								s_values[6] = gcode->get_value_at_index(index);
-								s_count = 7;
-
-								index = gcode->index_of_letter(':', index+1);
-								if(index >= 0) {
-									s_values[7] = gcode->get_value_at_index(index);
-									s_count = 8;
-								}
-							}
-						}
-					}
-				}
-			}
-		}
-	}*/
-
     // fill
     arc_target_unrotated[A_AXIS] = target[A_AXIS];
     arc_target_unrotated[B_AXIS] = target[B_AXIS];
@@ -1649,19 +1809,63 @@ void Robot::process_move(Gcode *gcode, enum MOTION_MODE_T motion_mode)
         case NONE: break;
 
         case SEEK:
-            moved = this->append_line(gcode, target, this->seek_rate / seconds_per_minute, delta_e );
+            move_override = get_override_factor(false);
+            moved = this->append_line(gcode, target, this->seek_rate / seconds_per_minute * rapid_override, delta_e );
             break;
 
         case LINEAR:
-            moved = this->append_line(gcode, target, this->feed_rate / seconds_per_minute, delta_e );
+            move_override = get_override_factor(true);
+            moved = this->append_line(gcode, target, inverse_time_mode ? inverse_time_rate(target) : this->feed_rate / seconds_per_minute, delta_e );
             break;
 
         case CW_ARC:
         case CCW_ARC:
             // Note arcs are not currently supported by extruder based machines, as 3D slicers do not use arcs (G2/G3)
+            move_override = get_override_factor(true);
             moved = this->compute_arc(gcode, offset, arc_target_unrotated, target, motion_mode);
             break;
+
+        case CUBIC_SPLINE:
+        case QUAD_SPLINE: {
+            // G5 I J is the first control point from the start and P Q the second one from the end, G5.1 has only
+            // I J. Both are offsets in the work coordinates so they get the same rotation as an arc center
+            bool cubic = motion_mode == CUBIC_SPLINE;
+            if(this->plane_axis_2 != Z_AXIS) {
+                gcode->is_error= true;
+                gcode->txt_after_ok= "G5 is only supported in the G17 plane\n";
+                THEKERNEL->streams->printf("Alarm:G5 is only supported in the G17 plane\n");
+                break;
+            }
+            bool has_ij = gcode->has_letter('I') || gcode->has_letter('J');
+            if(cubic && !has_ij && this->current_motion_mode == CUBIC_SPLINE) {
+                // carries on tangent to the last G5
+                offset[0] = -this->spline_pq[0];
+                offset[1] = -this->spline_pq[1];
+            } else if(!has_ij || (cubic && !(gcode->has_letter('P') && gcode->has_letter('Q')))) {
+                gcode->is_error= true;
+                gcode->txt_after_ok= cubic ? "G5 needs I J P Q\n" : "G5.1 needs I J\n";
+                THEKERNEL->streams->printf("Alarm:%s", gcode->txt_after_ok.c_str());
+                break;
+            }
+            float pq[3]{0, 0, 0};
+            if(cubic) {
+                pq[0] = this->to_millimeters(gcode->get_value('P'));
+                pq[1] = this->to_millimeters(gcode->get_value('Q'));
+                this->spline_pq[0] = pq[0];
+                this->spline_pq[1] = pq[1];
+            }
+            rotate(&offset[0], &offset[1], &offset[2]);
+            rotate(&pq[0], &pq[1], &pq[2]);
+            float c1[2]{this->arc_milestone[X_AXIS] + offset[0], this->arc_milestone[Y_AXIS] + offset[1]};
+            float c2[2]{target[X_AXIS] + pq[0], target[Y_AXIS] + pq[1]};
+            move_override = get_override_factor(true);
+            moved = this->append_spline(gcode, target, c1, c2, cubic);
+            break;
+        }
     }
+    move_override = 0.0F;
+    s_count = 1;
+    soft_endstop_checked = false;
 
     // needed to act as start of next arc command
     memcpy(arc_milestone, target, sizeof(arc_milestone));
@@ -1773,6 +1977,69 @@ void Robot::reset_position_from_current_actuator_position()
     #endif
 }
 
+void Robot::pass_feed_gate()
+{
+    if(!feedGate) return;
+    Callback<void()> gate = feedGate;
+    feedGate = nullptr;
+    gate();
+}
+
+// the same angle as a, modulo 360, that is the least turn from where A is now, half a turn goes forwards
+float Robot::shortest_a_target(float a) const
+{
+    float d= fmodf(a - machine_position[A_AXIS], 360.0F);
+    if(d > 180.0F) d -= 360.0F;
+    else if(d <= -180.0F) d += 360.0F;
+    return machine_position[A_AXIS] + d;
+}
+
+// report a soft endstop that was exceeded and halt or drop the move, returns false if the move carries on regardless as a continuous jog does
+bool Robot::soft_endstop_exceeded(int axis)
+{
+    if(THECONVEYOR->is_continuous_mode()) return false;
+
+    if(THEKERNEL->is_grbl_mode()) {
+        THEKERNEL->streams->printf("error:");
+    }else{
+        THEKERNEL->streams->printf("Error: ");
+    }
+
+    if(soft_endstop_halt) {
+        THEKERNEL->streams->printf("Soft Endstop %c was exceeded - reset or $X or M999 required\n", axis+'X');
+        THEKERNEL->set_halt_reason(SOFT_LIMIT);
+        THEKERNEL->call_event(ON_HALT, nullptr);
+
+    //} else if(soft_endstop_truncate) {
+        // TODO VERY hard to do need to go back and change the target, and calculate intercept with the edge
+        // and store all preceding vectors that have on eor more points ourtside of bounds so we can create a propper clip against the boundaries
+
+    } else {
+        // ignore it
+        THEKERNEL->streams->printf("Soft Endstop %c was exceeded - entire move ignored\n", axis+'X');
+    }
+    return true;
+}
+
+// Check a whole move against the soft endstops before it is cut into segments, lo and hi bound everywhere it goes in
+// machine coordinates. Like the check of each milestone only an axis heading further out of bounds than it started
+// counts. Once checked the segments skip their own check, unless compensation can still move them
+bool Robot::within_soft_endstops(const float start[], const float lo[], const float hi[])
+{
+    if(!soft_endstop_enabled || THEKERNEL->is_zprobing() || THECONVEYOR->is_continuous_mode()) return true;
+
+    for (int i = 0; i <= Z_AXIS; ++i) {
+        if(!is_homed(i)) continue;
+        if((!isnan(soft_endstop_min[i]) && lo[i] < soft_endstop_min[i] && lo[i] < start[i] - 0.00001F) ||
+           (!isnan(soft_endstop_max[i]) && hi[i] > soft_endstop_max[i] && hi[i] > start[i] + 0.00001F)) {
+            if(soft_endstop_exceeded(i)) return false;
+        }
+    }
+
+    soft_endstop_checked = compensationTransform == nullptr;
+    return true;
+}
+
 // this needs to be done if compensation is turned off for continuous jog
 void Robot::reset_compensated_machine_position()
 {
@@ -1819,37 +2086,12 @@ bool Robot::append_milestone(const float target[], float rate_mm_s, unsigned int
         }
     }
 
-    // check soft endstops only for homed axis that are enabled
-    if(soft_endstop_enabled && !THEKERNEL->is_zprobing()) {
+    // check soft endstops only for homed axis that are enabled, a segment of a move that was checked as a whole needs no check of its own
+    if(soft_endstop_enabled && !soft_endstop_checked && !THEKERNEL->is_zprobing()) {
         for (int i = 0; i <= Z_AXIS; ++i) {
             if(!is_homed(i)) continue;
             if( (!isnan(soft_endstop_min[i]) && transformed_target[i] < soft_endstop_min[i]) && deltas[i] < 0 || (!isnan(soft_endstop_max[i]) && transformed_target[i] > soft_endstop_max[i]) && deltas[i] > 0) {
-                if(soft_endstop_halt && !THECONVEYOR->is_continuous_mode()) {
-                    if(THEKERNEL->is_grbl_mode()) {
-                        THEKERNEL->streams->printf("error:");
-                    }else{
-                        THEKERNEL->streams->printf("Error: ");
-                    }
-
-                    THEKERNEL->streams->printf("Soft Endstop %c was exceeded - reset or $X or M999 required\n", i+'X');
-                    THEKERNEL->set_halt_reason(SOFT_LIMIT);
-                    THEKERNEL->call_event(ON_HALT, nullptr);
-                    return false;
-
-                //} else if(soft_endstop_truncate) {
-                    // TODO VERY hard to do need to go back and change the target, and calculate intercept with the edge
-                    // and store all preceding vectors that have on eor more points ourtside of bounds so we can create a propper clip against the boundaries
-
-                } else if (!THECONVEYOR->is_continuous_mode()) {
-                    // ignore it
-                    if(THEKERNEL->is_grbl_mode()) {
-                        THEKERNEL->streams->printf("error:");
-                    }else{
-                        THEKERNEL->streams->printf("Error: ");
-                    }
-                    THEKERNEL->streams->printf("Soft Endstop %c was exceeded - entire move ignored\n", i+'X');
-                    return false;
-                }
+                if(soft_endstop_exceeded(i)) return false;
             }
         }
     }
@@ -1934,8 +2176,42 @@ bool Robot::append_milestone(const float target[], float rate_mm_s, unsigned int
 
     DEBUG_PRINTF("distance: %f, aux_move: %d\n", distance, auxilliary_move);
 
-    // use default acceleration to start with
-    float acceleration = default_acceleration;
+    // use default acceleration and jerk to start with
+    float acceleration = (!is_g123 && !isnan(rapid_acceleration)) ? rapid_acceleration : default_acceleration;
+    float jerk = default_jerk;
+    // the most each moving axis allows the block, NAN until one is found
+    float axis_acceleration = NAN;
+    // the longest jerk phase the moving axes want, to shape the acceleration around their resonance
+    float shaper_time = 0;
+
+#if MAX_ROBOT_ACTUATORS > 3
+    // with a rotary A the workpiece turns under the tool, F is the speed of the tool over the surface so take the
+    // rotary travel as an arc at the mean radius of the start and the end from the WCS A axis (Y=0 Z=0), the
+    // extra 30mm of perimeter keeps near the axis from spinning too fast. In G93 F already gives the time of the move.
+    // In G7.1 the radius is the one the Y words were unwrapped at, so F is the feed along the unwrapped path.
+    if(!inverse_time_mode && n_motors > A_AXIS && actuators[A_AXIS]->is_selected()) {
+        float da = fabsf(actuator_pos[A_AXIS] - actuators[A_AXIS]->get_last_milestone());
+        if(da >= 0.00001F) {
+            float radius = cylinder_radius;
+            if(radius <= 0) {
+                wcs_t from_wpos = this->mcs2wcs(wcs_t(compensated_machine_position[X_AXIS], compensated_machine_position[Y_AXIS], compensated_machine_position[Z_AXIS], 0, 0));
+                wcs_t to_wpos = this->mcs2wcs(wcs_t(transformed_target[X_AXIS], transformed_target[Y_AXIS], transformed_target[Z_AXIS], 0, 0));
+                float r0 = hypotf(std::get<Y_AXIS>(from_wpos), std::get<Z_AXIS>(from_wpos));
+                float r1 = hypotf(std::get<Y_AXIS>(to_wpos), std::get<Z_AXIS>(to_wpos));
+                radius = std::max(1.0F, (r0 + r1) / 2) + 30 / (2 * PI);
+            }
+            float mm_of_a = da * PI * radius / 180;
+            if (auxilliary_move) {
+                // A (and B) only, distance is in degrees so turn the surface speed into degrees per second
+                float other = sqrtf(std::max(0.0F, distance * distance - da * da));
+                rate_mm_s *= distance / hypotf(mm_of_a, other);
+            } else {
+                // XYZ with A, slow XYZ down so the combined path is at F
+                rate_mm_s *= distance / hypotf(distance, mm_of_a);
+            }
+        }
+    }
+#endif
 
     float isecs = distance / rate_mm_s;
 
@@ -1946,76 +2222,49 @@ bool Robot::append_milestone(const float target[], float rate_mm_s, unsigned int
 		if (d < 0.00001F || !actuators[actuator]->is_selected()) continue; // no realistic movement for this actuator
 
 		float actuator_rate = d / isecs;
-
-		if (actuator == A_AXIS) {
-		    // THEKERNEL->streams->printf("d: %f, rate: %f, distance: %f, aux_move: %d, acc: %f, isecs: %f, line: %d\n", d, actuator_rate, distance, auxilliary_move, acceleration, isecs, line);
-		    float a_perimeter = PI * 2 + 30;
-			// A Axis moved, calculate real A Axis speed based on Y and Z wcs
-	        wcs_t curr_mpos = wcs_t(target[X_AXIS], target[Y_AXIS], target[Z_AXIS], 0, 0);
-	        wcs_t curr_wpos = this->mcs2wcs(curr_mpos);
-			float abs_y_wcs = fabsf(std::get<Y_AXIS>(curr_wpos));
-			float abs_z_wcs = fabsf(std::get<Z_AXIS>(curr_wpos));
-			float rotation_radius = (abs_y_wcs > 0.00001 || abs_z_wcs > 0.00001) ? sqrtf(powf(abs_y_wcs, 2) + powf(abs_z_wcs, 2)) : 0;
-			if (rotation_radius > 1.0) {
-				a_perimeter = PI * 2 * rotation_radius + 30;
-		    }
-			if (auxilliary_move) {
-				// A axis move only, speed up if necessary
-				float mm_per_sec = a_perimeter * (rate_mm_s / 360);
-				if (mm_per_sec < rate_mm_s) {
-					// speed up
-					rate_mm_s *= (rate_mm_s / mm_per_sec);
-				}
-				if (rate_mm_s > actuators[actuator]->get_max_rate()) {
-					rate_mm_s = actuators[actuator]->get_max_rate();
-				}
-				float ma = actuators[actuator]->get_acceleration(); // in mm / sec² or degree / sec² for A axis
-				if (!isnan(ma)) acceleration = ma;
-				// THEKERNEL->streams->printf("only A: %1.4f, %1.4f, %1.4f, %1.4f\r\n", abs_y_wcs, abs_z_wcs, rate_mm_s, a_perimeter);
-				continue;
-			} else {
-				// A axis move along with other axis, speed down if necessary
-				float mm_per_sec = actuator_rate * a_perimeter / 360;
-				if (mm_per_sec > rate_mm_s) {
-					// speed down
-					actuator_rate *= (rate_mm_s / mm_per_sec);
-					rate_mm_s *= (rate_mm_s / mm_per_sec);
-					isecs = d / rate_mm_s;
-					// THEKERNEL->streams->printf("Speed down to : %1.4f, %1.4f, %1.4f\n", isecs, rate_mm_s, actuator_rate);
-				}
-				// if (rate_mm_s < 1)  rate_mm_s = 1;
-				// THEKERNEL->streams->printf("Not only A: %1.4f, %1.4f, %1.4f, %1.4f, %1.4f\r\n", abs_y_wcs, abs_z_wcs, actuator_rate, rate_mm_s, a_perimeter);
-			}
-		}
-
 		if (actuator_rate > actuators[actuator]->get_max_rate()) {
 			rate_mm_s *= (actuators[actuator]->get_max_rate() / actuator_rate);
 			isecs =  distance / rate_mm_s;
-			if (actuator == A_AXIS && !auxilliary_move) {
-				isecs = d / rate_mm_s;
-			}
 			DEBUG_PRINTF("new rate: %f - %d\n", rate_mm_s, actuator);
             // THEKERNEL->streams->printf("Reduce actuator Speed %d, from %1.2f to %1.2f\n", actuator, actuator_rate, rate_mm_s);
 		}
 
+		shaper_time = std::max(shaper_time, actuators[actuator]->get_shaper_time());
+
+		if (actuator == A_AXIS && auxilliary_move) {
+			// A axis move only, it accelerates as fast as A can
+			float ma = actuators[actuator]->get_acceleration(); // in degree / sec² for A axis
+			if (!isnan(ma)) acceleration = ma;
+			continue;
+		}
+
 		DEBUG_PRINTF("act: %d, d: %f, distance: %f, actrate: %f, rate: %f, secs: %f, acc: %f\n", actuator, d, distance, actuator_rate, rate_mm_s, 1/isecs, acceleration);
 
-		// adjust acceleration to lowest found, for all actuators as this also corrects
-		// the math for a tiny X move and large A move
+		// each axis with its own acceleration only sees its share of the block's, so the block can have what
+		// the most limiting of them allows, an axis without one holds the block to the default as it always has.
+		// this also corrects the math for a tiny X move and large A move
 		float ma = actuators[actuator]->get_acceleration(); // in mm / sec² or degree / sec² for A axis
+		if (!is_g123) {
+			if (actuator == Z_AXIS && !isnan(z_rapid_acceleration)) ma = z_rapid_acceleration;
+			else if (actuator < Z_AXIS && !isnan(rapid_acceleration)) ma = rapid_acceleration;
+		}
+		float aa = acceleration;
 		if (!isnan(ma)) {  // if axis does not have acceleration set then it uses the default_acceleration
-			float ca = (d / distance) * acceleration;
-			if (ca > ma) {
-				if (actuator == A_AXIS) {
-					acceleration *= (ma * 3 / ca);
-				} else {
-					acceleration *= (ma / ca);
-				}
-				DEBUG_PRINTF("new acceleration: %f\n", acceleration);
-				// THEKERNEL->streams->printf("Reduce acceleration from %1.2f to %1.2f, %f\n", ca, acceleration, rate_mm_s);
-			}
+			aa = (actuator == A_AXIS ? ma * 3 : ma) * distance / d;
+		}
+		if (isnan(axis_acceleration) || aa < axis_acceleration) {
+			axis_acceleration = aa;
+			DEBUG_PRINTF("new acceleration: %f\n", axis_acceleration);
+		}
+
+		// and the jerk the same way, only if jerk limiting is on
+		float mj = actuators[actuator]->get_jerk(); // in mm / sec³
+		if (jerk > 0 && !isnan(mj) && mj > 0) {
+			float cj = (d / distance) * jerk;
+			if (cj > mj) jerk *= (mj / cj);
 		}
 	}
+	if (!isnan(axis_acceleration)) acceleration = axis_acceleration;
 
     // if we are in feed hold wait here until it is released, this means that even segmented lines will pause
     while(THEKERNEL->get_feed_hold()) {
@@ -2024,12 +2273,10 @@ bool Robot::append_milestone(const float target[], float rate_mm_s, unsigned int
         if(THEKERNEL->is_halted()) return false;
     }
 
-    // Append the block to the planner
+    // Append the block to the planner, or merge it with the moves before it
     // NOTE that distance here should be either the distance travelled by the XYZ axis, or the E mm travel if a solo E move
     // NOTE this call will bock until there is room in the block queue, on_idle will continue to be called
-    if(THEKERNEL->planner->append_block( actuator_pos, n_motors, rate_mm_s, distance, auxilliary_move ? nullptr : unit_vec, acceleration, s_value, is_g123, line)) {
-// 2024
-//    if(THEKERNEL->planner->append_block( actuator_pos, n_motors, rate_mm_s, distance, auxilliary_move ? nullptr : unit_vec, acceleration, s_values, s_count, is_g123, line)) {
+    if(this->queue_move( actuator_pos, rate_mm_s, distance, auxilliary_move ? nullptr : unit_vec, acceleration, jerk, shaper_time, transformed_target, line)) {
         // this is the new compensated machine position
         memcpy(this->compensated_machine_position, transformed_target, n_motors * sizeof(float));
         return true;
@@ -2039,6 +2286,283 @@ bool Robot::append_milestone(const float target[], float rate_mm_s, unsigned int
     return false;
 }
 
+// CAM output for 3D surfacing is mostly long runs of tiny nearly collinear G1 moves, each costing a block and a planner
+// recalculate, so consecutive feed moves that all stay within mm_max_coalesce_error of one line are merged into one block.
+// The last move is held back until the next one shows whether it can be merged, anything that is not a G0-G3,
+// wait_for_idle, the queue running dry or nothing following for a while sends it to the planner.
+bool Robot::queue_move(ActuatorCoordinates &actuator_pos, float rate_mm_s, float distance, float *unit_vec, float acceleration, float jerk, float shaper_time, const float target[], unsigned int line)
+{
+    bool mergeable = (mm_max_coalesce_error > 0.0F || blend_tolerance > 0.0F) && unit_vec != nullptr && is_g123 && !coalesce_busy && s_count <= 1;
+    for (size_t i = N_PRIMARY_AXIS; mergeable && i < n_motors; i++) {
+        // moves of the other axis are never merged
+        if(fabsf(target[i] - compensated_machine_position[i]) >= 0.00001F) mergeable = false;
+    }
+
+    if(mergeable && mm_max_coalesce_error > 0.0F && coalesce_move(actuator_pos, rate_mm_s, acceleration, jerk, shaper_time, target)) return true;
+
+    // in G64 the corner between the held move and this one is rounded off before the held one goes
+    float start[N_PRIMARY_AXIS];
+    memcpy(start, compensated_machine_position, sizeof(start));
+    if(mergeable && blend_tolerance > 0.0F) {
+        blend_corner(actuator_pos, distance, unit_vec, rate_mm_s, acceleration, jerk, shaper_time, target, line, start);
+    }
+
+    flush_coalesced();
+
+    if(mergeable) {
+        // hold it back to see if the next move can be merged with it
+        coalesced.actuator_pos = actuator_pos;
+        memcpy(coalesced.start, start, sizeof(coalesced.start));
+        memcpy(coalesced.points[0], target, sizeof(coalesced.points[0]));
+        coalesced.n_points = 1;
+        coalesced.distance = distance;
+        coalesced.rate_mm_s = rate_mm_s;
+        coalesced.acceleration = acceleration;
+        coalesced.jerk = jerk;
+        coalesced.shaper_time = shaper_time;
+        coalesced.s_value = s_value;
+        coalesced.override_factor = move_override;
+        coalesced.line = line;
+        coalesced.time = us_ticker_read();
+        return true;
+    }
+
+    // a segment of a line with several S values gets just the ones along it, starting with the first
+    float span_values[Block::k_max_s_values];
+    uint8_t n = span_s_values(span_values);
+    return THEKERNEL->planner->append_block( actuator_pos, n_motors, rate_mm_s, distance, unit_vec, acceleration, jerk, shaper_time, n > 0 ? span_values[0] : s_value, is_g123, move_override, line, span_values, n);
+}
+
+// the S values of the line that fall in the part of it this milestone covers, 0 if it has just the one
+uint8_t Robot::span_s_values(float *out) const
+{
+    static_assert(sizeof(s_values) / sizeof(s_values[0]) == Block::k_max_s_values, "s_values must hold Block::k_max_s_values");
+    if(s_count <= 1 || !is_g123) return 0;
+
+    int first = floorf(s_span[0] * s_count + 0.001F);
+    int last = ceilf(s_span[1] * s_count - 0.001F) - 1;
+    if(first < 0) first = 0;
+    if(last >= s_count) last = s_count - 1;
+    if(last < first) last = first;
+
+    for (int i = first; i <= last; i++) {
+        out[i - first] = s_values[i];
+    }
+    return last - first + 1;
+}
+
+// merge the move to target into the held back move if every point of it stays within mm_max_coalesce_error of the new line
+bool Robot::coalesce_move(ActuatorCoordinates &actuator_pos, float rate_mm_s, float acceleration, float jerk, float shaper_time, const float target[])
+{
+    coalesce_t &c = coalesced;
+    if(c.n_points == 0 || c.n_points >= k_max_coalesce || s_value != c.s_value || move_override != c.override_factor) return false;
+    if(fabsf(rate_mm_s - c.rate_mm_s) > 0.01F * c.rate_mm_s) return false;
+
+    const float *last = c.points[c.n_points - 1];
+    const float *prev = c.n_points > 1 ? c.points[c.n_points - 2] : c.start;
+    float sos = 0, dot = 0;
+    for (int i = 0; i < N_PRIMARY_AXIS; i++) {
+        sos += powf(target[i] - c.start[i], 2);
+        dot += (target[i] - last[i]) * (last[i] - prev[i]);
+    }
+    float distance = sqrtf(sos);
+
+    // it has to carry on forwards, and not be a longer line than would otherwise have been segmented
+    if(dot <= 0.0F || distance < 0.00001F) return false;
+    if(this->mm_per_line_segment > 0.0F && distance > this->mm_per_line_segment) return false;
+
+    // distance of each point from the line from the start to the target
+    float tol2 = mm_max_coalesce_error * mm_max_coalesce_error;
+    for (int n = 0; n < c.n_points; n++) {
+        float len2 = 0, along = 0;
+        for (int i = 0; i < N_PRIMARY_AXIS; i++) {
+            float d = c.points[n][i] - c.start[i];
+            len2 += d * d;
+            along += d * (target[i] - c.start[i]);
+        }
+        along /= distance;
+        if(len2 - along * along > tol2) return false;
+    }
+
+    memcpy(c.points[c.n_points++], target, sizeof(c.points[0]));
+    c.actuator_pos = actuator_pos;
+    c.distance = distance;
+    c.rate_mm_s = std::min(c.rate_mm_s, rate_mm_s);
+    c.acceleration = std::min(c.acceleration, acceleration);
+    c.jerk = std::min(c.jerk, jerk);
+    c.shaper_time = std::max(c.shaper_time, shaper_time);
+    c.time = us_ticker_read();
+    return true;
+}
+
+// G64, the held move stops short of the corner it makes with the next move and a quadratic Bezier with the corner as its
+// control point takes the tool across to the next one, so the junctions are shallow enough to keep the feed up. It is
+// cut back by as much as keeps the curve within blend_tolerance of the corner, but by no more than half of either move.
+// The next move then starts where the curve ends, start and distance are changed to that
+void Robot::blend_corner(const ActuatorCoordinates &actuator_pos, float &distance, const float *unit_vec, float rate_mm_s, float acceleration, float jerk, float shaper_time, const float target[], unsigned int line, float start[])
+{
+    coalesce_t &c = coalesced;
+    if(c.n_points == 0 || c.distance < 0.00001F) return;
+
+    const float *corner = c.points[c.n_points - 1];
+    float u[N_PRIMARY_AXIS], cosa = 0;
+    for (int i = 0; i < N_PRIMARY_AXIS; i++) {
+        u[i] = (corner[i] - c.start[i]) / c.distance;
+        cosa += u[i] * unit_vec[i];
+    }
+    // nothing to round off when it carries straight on, and no way round when it turns back
+    if(cosa > 0.99999F || cosa < -0.996F) return;
+
+    // the middle of the curve is d sin(half the turn) / 2 from the corner
+    float sin_half = sqrtf((1 - cosa) / 2);
+    float d = std::min(2 * blend_tolerance / sin_half, std::min(c.distance, distance) / 2);
+
+    float a[N_PRIMARY_AXIS], e[N_PRIMARY_AXIS], b[N_PRIMARY_AXIS];
+    for (int i = 0; i < N_PRIMARY_AXIS; i++) {
+        e[i] = corner[i];
+        a[i] = e[i] - d * u[i];
+        b[i] = e[i] + d * unit_vec[i];
+    }
+
+    // the held move now ends where the curve starts
+    float p[k_max_actuators];
+    memcpy(p, target, n_motors * sizeof(float));
+    memcpy(p, a, sizeof(a));
+    memcpy(c.points[c.n_points - 1], a, sizeof(a));
+    c.distance -= d;
+    if(!disable_arm_solution) arm_solution->cartesian_to_actuator(p, c.actuator_pos);
+    else for (int i = X_AXIS; i <= Z_AXIS; i++) c.actuator_pos[i] = p[i];
+    flush_coalesced();
+
+    // in n chords the curve is within |a - 2e + b| / 4n^2 of them, keep that to an eighth of the tolerance
+    float d2 = 2 * d * sin_half;
+    int n = std::min(8.0F, std::max(1.0F, ceilf(sqrtf(2 * d2 / blend_tolerance))));
+    float from[N_PRIMARY_AXIS];
+    memcpy(from, a, sizeof(from));
+    for (int k = 1; k <= n; k++) {
+        float t = (float)k / n, s = 1 - t;
+        float sos = 0;
+        for (int i = 0; i < N_PRIMARY_AXIS; i++) {
+            p[i] = s * s * a[i] + 2 * s * t * e[i] + t * t * b[i];
+            sos += powf(p[i] - from[i], 2);
+        }
+        float len = sqrtf(sos);
+        if(len < 0.00001F) continue;
+
+        float uv[N_PRIMARY_AXIS];
+        for (int i = 0; i < N_PRIMARY_AXIS; i++) uv[i] = (p[i] - from[i]) / len;
+        ActuatorCoordinates ap = actuator_pos;
+        if(!disable_arm_solution) arm_solution->cartesian_to_actuator(p, ap);
+        else for (int i = X_AXIS; i <= Z_AXIS; i++) ap[i] = p[i];
+        for (size_t i = N_PRIMARY_AXIS; i < n_motors; i++) ap[i] = actuator_pos[i];
+
+        THEKERNEL->planner->append_block(ap, n_motors, rate_mm_s, len, uv, acceleration, jerk, shaper_time, s_value, true, move_override, line);
+        memcpy(from, p, sizeof(from));
+    }
+
+    float sos = 0;
+    for (int i = 0; i < N_PRIMARY_AXIS; i++) sos += powf(target[i] - from[i], 2);
+    distance = sqrtf(sos);
+    memcpy(start, from, sizeof(from));
+}
+
+// send the held back move to the planner, NOTE this can block until there is room in the queue
+void Robot::flush_coalesced()
+{
+    coalesce_t &c = coalesced;
+    if(c.n_points == 0 || coalesce_busy) return;
+
+    float unit_vec[N_PRIMARY_AXIS];
+    const float *end = c.points[c.n_points - 1];
+    for (int i = 0; i < N_PRIMARY_AXIS; i++) {
+        unit_vec[i] = (end[i] - c.start[i]) / c.distance;
+    }
+
+    // on_idle is called while the planner waits for room, it must not see this move again
+    c.n_points = 0;
+    coalesce_busy = true;
+    THEKERNEL->planner->append_block( c.actuator_pos, n_motors, c.rate_mm_s, c.distance, unit_vec, c.acceleration, c.jerk, c.shaper_time, c.s_value, true, c.override_factor, c.line);
+    coalesce_busy = false;
+}
+
+void Robot::on_idle(void *argument)
+{
+    if(override_pending) apply_realtime_overrides();
+
+    // do not hold a move back if the queue is running dry or nothing has followed it for a while
+    if(coalesced.n_points == 0 || coalesce_busy) return;
+    if(THECONVEYOR->is_queue_empty() || (us_ticker_read() - coalesced.time) >= coalesce_timeout_us) {
+        flush_coalesced();
+    }
+}
+
+// Grbl style realtime overrides, the receive interrupts only note them and apply_realtime_overrides() does the work
+bool Robot::realtime_override(uint8_t c)
+{
+    switch(c) {
+        case 0x90: feed_override_reset = true; feed_override_delta = 0; break;
+        case 0x91: feed_override_delta = feed_override_delta + 10; break;
+        case 0x92: feed_override_delta = feed_override_delta - 10; break;
+        case 0x93: feed_override_delta = feed_override_delta + 1; break;
+        case 0x94: feed_override_delta = feed_override_delta - 1; break;
+        case 0x95: rapid_override_request = 100; break;
+        case 0x96: rapid_override_request = 50; break;
+        case 0x97: rapid_override_request = 25; break;
+        case 0x99: spindle_override_reset = true; spindle_override_delta = 0; break;
+        case 0x9A: spindle_override_delta = spindle_override_delta + 10; break;
+        case 0x9B: spindle_override_delta = spindle_override_delta - 10; break;
+        case 0x9C: spindle_override_delta = spindle_override_delta + 1; break;
+        case 0x9D: spindle_override_delta = spindle_override_delta - 1; break;
+        default: return false;
+    }
+    override_pending = true;
+    return true;
+}
+
+void Robot::apply_realtime_overrides()
+{
+    __disable_irq();
+    int feed_delta = feed_override_delta;
+    int spindle_delta = spindle_override_delta;
+    uint8_t rapid = rapid_override_request;
+    bool feed_reset = feed_override_reset;
+    bool spindle_reset = spindle_override_reset;
+    feed_override_delta = 0;
+    spindle_override_delta = 0;
+    rapid_override_request = 0;
+    feed_override_reset = false;
+    spindle_override_reset = false;
+    override_pending = false;
+    __enable_irq();
+
+    if(feed_reset || feed_delta != 0 || rapid != 0) {
+        // the same limits as M220, but only up to 200% like grbl as it takes effect without any warning
+        float factor = (feed_reset ? 100.0F : 6000.0F / seconds_per_minute) + feed_delta;
+        factor = confine(factor, 10.0F, std::max(200.0F, 6000.0F / seconds_per_minute));
+        float new_rapid = rapid != 0 ? rapid / 100.0F : rapid_override;
+        if(6000.0F / factor != seconds_per_minute || new_rapid != rapid_override) {
+            seconds_per_minute = 6000.0F / factor;
+            rapid_override = new_rapid;
+            if(!THEKERNEL->is_halted()) THEKERNEL->planner->apply_override();
+        }
+    }
+
+    if(spindle_reset || spindle_delta != 0) {
+        struct spindle_status ss;
+        if(PublicData::get_value(pwm_spindle_control_checksum, get_spindle_status_checksum, &ss)) {
+            // the same limits as M223
+            float factor = confine((spindle_reset ? 100.0F : ss.factor) + spindle_delta, 50.0F, 200.0F);
+            PublicData::set_value(pwm_spindle_control_checksum, set_spindle_factor_checksum, &factor);
+        }
+    }
+}
+
+void Robot::on_halt(void *argument)
+{
+    // a held back move was never planned so the actuators are still at its start
+    if(argument == nullptr) coalesced.n_points = 0;
+}
+
 // Used to plan a single move used by things like endstops when homing, zprobe, extruder firmware retracts etc.
 bool Robot::delta_move(const float *delta, float rate_mm_s, uint8_t naxis)
 {
@@ -2068,7 +2592,91 @@ bool Robot::delta_move(const float *delta, float rate_mm_s, uint8_t naxis)
     return false;
 }
 
+// Queue a move to a work position in mm for the canned cycles, straight to the planner without making a Gcode.
+// NAN leaves that axis where it is, a feed of 0 is a rapid at the seek rate, otherwise it sets the modal feed rate in mm/min.
+// A fixed_rate feed is exactly feed mm/min whatever the overrides are and leaves the modal rate alone, for tapping
+bool Robot::cycle_move(float x, float y, float z, float feed, unsigned int line, bool fixed_rate)
+{
+    if(THEKERNEL->is_halted()) return false;
+
+    float rate_mm_s;
+    if(fixed_rate) {
+        rate_mm_s = feed / 60.0F;
+    } else {
+        if(feed > 0.0F) this->feed_rate = feed;
+        rate_mm_s = (feed > 0.0F) ? this->feed_rate / seconds_per_minute : this->seek_rate / seconds_per_minute * rapid_override;
+    }
+    if(rate_mm_s <= 0.0F) return false;
+
+    // the same transform as an absolute G0/G1, see process_move()
+    wcs_t pos= mcs2wcs(machine_position);
+    float param[3]{isnan(x) ? std::get<X_AXIS>(pos) : x, isnan(y) ? std::get<Y_AXIS>(pos) : y, isnan(z) ? std::get<Z_AXIS>(pos) : z};
+    float target[n_motors];
+    memcpy(target, machine_position, n_motors*sizeof(float));
+    const wcs_xform_t &t= this->wcs_xform;
+    target[X_AXIS] = ROUND_NEAR_HALF(t.cos_r * param[X_AXIS] - t.sin_r * param[Y_AXIS] + t.to_mcs[X_AXIS]);
+    target[Y_AXIS] = ROUND_NEAR_HALF(t.cos_r * param[Y_AXIS] + t.sin_r * param[X_AXIS] + t.to_mcs[Y_AXIS]);
+    target[Z_AXIS] = ROUND_NEAR_HALF(param[Z_AXIS] + t.to_mcs[Z_AXIS]);
+
+    is_g123= feed > 0.0F;
+    if(is_g123) pass_feed_gate();
+    move_override = fixed_rate ? 0.0F : get_override_factor(is_g123);
+    bool moved= append_milestone(target, rate_mm_s, line);
+    move_override = 0.0F;
+    if(moved) {
+        memcpy(machine_position, target, n_motors*sizeof(float));
+    }
+    return moved;
+}
+
+// a stretch of a laser raster row from where we are by dx, dy in the WCS at feed mm/min with the n S values spread evenly
+// along it, as a G1 S0.1:0.5:1 would, or a rapid with the laser off over a blank stretch if n is 0. The modal S is left as it was.
+bool Robot::raster_move(float dx, float dy, float feed, const float *s, uint8_t n, unsigned int line)
+{
+    if(THEKERNEL->is_halted()) return false;
+    if(n > Block::k_max_s_values) n = Block::k_max_s_values;
+
+    is_g123= n > 0;
+    float rate_mm_s = is_g123 ? feed / seconds_per_minute : this->seek_rate / seconds_per_minute * rapid_override;
+    if(rate_mm_s <= 0.0F) return false;
+
+    float target[n_motors];
+    memcpy(target, machine_position, n_motors*sizeof(float));
+    const wcs_xform_t &t= this->wcs_xform;
+    target[X_AXIS] += t.cos_r * dx - t.sin_r * dy;
+    target[Y_AXIS] += t.cos_r * dy + t.sin_r * dx;
+
+    float saved_s = s_value;
+    if(is_g123) {
+        for (uint8_t i = 0; i < n; i++) s_values[i] = s[i];
+        s_count = n;
+        s_value = s[0];
+    }
+    move_override = get_override_factor(is_g123);
+    bool moved= append_milestone(target, rate_mm_s, line);
+    move_override = 0.0F;
+    s_count = 1;
+    s_value = saved_s;
+    if(moved) {
+        memcpy(machine_position, target, n_motors*sizeof(float));
+    }
+    return moved;
+}
+
 // Append a move to the queue ( cutting it into segments if needed )
+// In G93 a line takes 1/F minutes, so the rate is its length times F, degrees per second if only the rotary axis move
+float Robot::inverse_time_rate(const float target[]) const
+{
+    float sos= 0;
+    for (int i = X_AXIS; i <= Z_AXIS; i++) sos += powf(target[i] - machine_position[i], 2);
+#if MAX_ROBOT_ACTUATORS > 3
+    if(sos < 0.00001F * 0.00001F) {
+        for (int i = A_AXIS; i < n_motors; i++) sos += powf(target[i] - machine_position[i], 2);
+    }
+#endif
+    return sqrtf(sos) * this->inverse_time_f / seconds_per_minute;
+}
+
 bool Robot::append_line(Gcode *gcode, const float target[], float rate_mm_s, float delta_e)
 {
     // catch negative or zero feed rates and return the same error as GRBL does
@@ -2087,6 +2695,14 @@ bool Robot::append_line(Gcode *gcode, const float target[], float rate_mm_s, flo
         return this->append_milestone(target, rate_mm_s, gcode->line);
     }
 
+    // a line goes no further than its ends
+    float lo[3], hi[3];
+    for (int i = 0; i <= Z_AXIS; ++i) {
+        lo[i] = std::min(machine_position[i], target[i]);
+        hi[i] = std::max(machine_position[i], target[i]);
+    }
+    if(!within_soft_endstops(machine_position, lo, hi)) return false;
+
     /*
         For extruders, we need to do some extra work to limit the volumetric rate if specified...
         If using volumetric limts we need to be using volumetric extrusion for this to work as Ennn needs to be in mm³ not mm
@@ -2127,7 +2743,26 @@ bool Robot::append_line(Gcode *gcode, const float target[], float rate_mm_s, flo
     }
 
     bool moved= false;
-    if (segments > 1) {
+    float ts[k_max_compensation_segments];
+    int n_ts;
+    if (segments > 1 && compensationTransform && this->mm_max_compensation_error > 0.0F && this->delta_segments_per_second <= 1.0F &&
+        (n_ts= compensation_segments(machine_position, target, ts)) > 0) {
+        // only split where the compensation needs it, the last one is the target itself
+        float start[n_motors];
+        float segment_end[n_motors];
+        memcpy(start, machine_position, n_motors*sizeof(float));
+        for (int i = 0; i < n_ts - 1; i++) {
+            if(THEKERNEL->is_halted()) return false; // don't queue any more segments
+            for (int j = 0; j < n_motors; j++)
+                segment_end[j] = start[j] + (target[j] - start[j]) * ts[i];
+
+            set_s_span(i == 0 ? 0 : ts[i - 1], ts[i]);
+            bool b= this->append_milestone(segment_end, rate_mm_s, gcode->line);
+            moved= moved || b;
+        }
+        set_s_span(n_ts > 1 ? ts[n_ts - 2] : 0, 1);
+
+    } else if (segments > 1) {
         // A vector to keep track of the endpoint of each segment
         float segment_delta[n_motors];
         float segment_end[n_motors];
@@ -2146,13 +2781,16 @@ bool Robot::append_line(Gcode *gcode, const float target[], float rate_mm_s, flo
 
             // Append the end of this segment to the queue
             // this can block waiting for free block queue or if in feed hold
+            set_s_span((float)(i - 1) / segments, (float)i / segments);
             bool b= this->append_milestone(segment_end, rate_mm_s, gcode->line);
             moved= moved || b;
         }
+        set_s_span((float)(segments - 1) / segments, 1);
     }
 
     // Append the end of this full move to the queue
     if(this->append_milestone(target, rate_mm_s, gcode->line)) moved= true;
+    set_s_span(0, 1);
 
     this->next_command_is_MCS = false; // always reset this
 
@@ -2160,11 +2798,67 @@ bool Robot::append_line(Gcode *gcode, const float target[], float rate_mm_s, flo
 }
 
 
+// Work out where to split a line with the compensation transform applied, instead of every mm_per_line_segment.
+// Between the kinks the compensation reports, a bilinear grid is a quadratic along the line, so how far the offset at the
+// middle is from the average of the ends tells how many equal parts that piece needs to stay within mm_max_compensation_error.
+// Fills ts with the fraction along the line of the end of each segment, the last one is 1, returns how many or -1 if too many.
+int Robot::compensation_segments(const float from[], const float to[], float ts[])
+{
+    float splits[k_max_compensation_segments];
+    int n_splits= 0;
+    if(compensationSplits) {
+        n_splits= compensationSplits(from, to, splits, k_max_compensation_segments - 1);
+        if(n_splits < 0) return -1;
+        std::sort(splits, splits + n_splits);
+    }
+    splits[n_splits++]= 1.0F;
+
+    // the compensation offset at t along the line
+    auto offset_at= [this, from, to](float t, float *off) {
+        float p[k_max_actuators];
+        for (int i = 0; i < n_motors; i++) p[i]= from[i] + (to[i] - from[i]) * t;
+        memcpy(off, p, N_PRIMARY_AXIS*sizeof(float));
+        compensationTransform(p, false, false);
+        for (int i = 0; i < N_PRIMARY_AXIS; i++) off[i]= p[i] - off[i];
+    };
+
+    int n= 0;
+    float t0= 0, off0[N_PRIMARY_AXIS];
+    offset_at(t0, off0);
+    for (int s = 0; s < n_splits; s++) {
+        float t1= splits[s];
+        if(t1 - t0 < 0.0001F && t1 < 1.0F) continue;
+
+        float off1[N_PRIMARY_AXIS], offm[N_PRIMARY_AXIS];
+        offset_at(t1, off1);
+        offset_at((t0 + t1) / 2, offm);
+        float err= 0;
+        for (int i = 0; i < N_PRIMARY_AXIS; i++) {
+            err= std::max(err, fabsf(offm[i] - (off0[i] + off1[i]) / 2));
+        }
+
+        // the error of a quadratic goes down with the square of the number of parts
+        int parts= std::max(1.0F, ceilf(sqrtf(err / this->mm_max_compensation_error)));
+        if(n + parts > k_max_compensation_segments) return -1;
+        for (int p = 1; p <= parts; p++) {
+            ts[n++]= t0 + (t1 - t0) * p / parts;
+        }
+
+        t0= t1;
+        memcpy(off0, off1, sizeof(off0));
+    }
+
+    return n;
+}
+
 // Append an arc to the queue ( cutting it into segments as needed )
 // TODO does not support any E parameters so cannot be used for 3D printing.
+// TODO native arc blocks, the step ticker assumes every motor keeps its direction and its ratio to the dominant motor
+// for the whole block, an arc changes both so it would need its own interpolator in the ISR with direction changes
+// mid block, until then arcs are lines and arc_segments_per_second is the way to keep them from flooding the queue
 bool Robot::append_arc(Gcode * gcode, const float target[], const float rotated_target[], const float offset[], float radius, bool is_clockwise )
 {
-    float rate_mm_s= this->feed_rate / seconds_per_minute;
+    float rate_mm_s= (inverse_time_mode ? this->inverse_time_f : this->feed_rate) / seconds_per_minute;
     // catch negative or zero feed rates and return the same error as GRBL does
     if(rate_mm_s <= 0.0F) {
         gcode->is_error= true;
@@ -2226,6 +2920,37 @@ bool Robot::append_arc(Gcode * gcode, const float target[], const float rotated_
         return false;
     }
 
+    // the arc is the center plus cos(theta) u + sin(theta) v, theta going from 0 to angular_travel, plus a part of the
+    // linear travel. Along each axis that is furthest out at the ends or where theta is atan2(v, u) (+ n pi)
+    float u[3]{0, 0, 0}, v[3]{0, 0, 0}, lin[3]{0, 0, 0};
+    u[this->plane_axis_0] = arc_start_vector[this->plane_axis_0];
+    u[this->plane_axis_1] = arc_start_vector[this->plane_axis_1];
+    v[this->plane_axis_0] = -arc_start_vector[this->plane_axis_1];
+    v[this->plane_axis_1] = arc_start_vector[this->plane_axis_0];
+    memcpy(lin, linear_vector, sizeof(lin));
+    rotate(&u[0], &u[1], &u[2]);
+    rotate(&v[0], &v[1], &v[2]);
+    float t0 = std::min(0.0F, angular_travel), t1 = std::max(0.0F, angular_travel);
+    float lo[3], hi[3];
+    for (int i = 0; i <= Z_AXIS; ++i) {
+        float a = u[i] * cosf(t0) + v[i] * sinf(t0), b = u[i] * cosf(t1) + v[i] * sinf(t1);
+        float mn = std::min(a, b), mx = std::max(a, b);
+        float tc = atan2f(v[i], u[i]);
+        for (int n = -3; n <= 3; ++n) {
+            float t = tc + n * PI;
+            if(t <= t0 || t >= t1) continue;
+            float c = u[i] * cosf(t) + v[i] * sinf(t);
+            mn = std::min(mn, c);
+            mx = std::max(mx, c);
+        }
+        lo[i] = arc_center[i] + mn + std::min(0.0F, lin[i]);
+        hi[i] = arc_center[i] + mx + std::max(0.0F, lin[i]);
+    }
+    if(!within_soft_endstops(machine_position, lo, hi)) return false;
+
+    // in G93 the whole arc takes 1/F minutes
+    if(inverse_time_mode) rate_mm_s *= millimeters_of_travel;
+
     // limit segments by maximum arc error
     float arc_segment = this->mm_per_arc_segment;
     if ((this->mm_max_arc_error > 0) && (2 * radius > this->mm_max_arc_error)) {
@@ -2240,6 +2965,14 @@ bool Robot::append_arc(Gcode * gcode, const float target[], const float rotated_
         arc_segment= 0.5F; /// the old default, so we avoid the divide by zero
     }
 
+    // at high feeds small segments go by faster than they can be planned and the queue drains, so do not make more
+    // segments a second than arc_segments_per_second even though the chord error is then above mm_max_arc_error,
+    // but never more than a radian of arc per segment
+    if(this->arc_segments_per_second > 0.0F) {
+        float feed_segment = std::min(rate_mm_s / this->arc_segments_per_second, radius);
+        if(feed_segment > arc_segment) arc_segment = feed_segment;
+    }
+
     // Figure out how many segments for this gcode
     // TODO for deltas we need to make sure we are at least as many segments as requested, also if mm_per_line_segment is set we need to use the
     uint16_t segments = floorf(millimeters_of_travel / arc_segment);
@@ -2257,31 +2990,26 @@ bool Robot::append_arc(Gcode * gcode, const float target[], const float rotated_
         sin(phi) cos(phi] * r ;
         For arc generation, the center of the circle is the axis of rotation and the radius vector is
         defined from the circle center to the initial position. Each line segment is formed by successive
-        vector rotations. This requires only two cos() and sin() computations to form the rotation
-        matrix for the duration of the entire arc. Error may accumulate from numerical round-off, since
-        all float numbers are single precision on the Arduino. (True float precision will not have
-        round off issues for CNC applications.) Single precision error can accumulate to be greater than
-        tool precision in some cases. Therefore, arc path correction is implemented.
-
-        Small angle approximation may be used to reduce computation overhead further. This approximation
-        holds for everything, but very small circles and large mm_per_arc_segment values. In other words,
-        theta_per_segment would need to be greater than 0.1 rad and N_ARC_CORRECTION would need to be large
-        to cause an appreciable drift error. N_ARC_CORRECTION~=25 is more than small enough to correct for
-        numerical drift error. N_ARC_CORRECTION may be on the order a hundred(s) before error becomes an
-        issue for CNC machines with the single precision Arduino calculations.
-        This approximation also allows mc_arc to immediately insert a line segment into the planner
-        without the initial overhead of computing cos() or sin(). By the time the arc needs to be applied
-        a correction, the planner should have caught up to the lag caused by the initial mc_arc overhead.
-        This is important when there are successive arc motions.
+        vector rotations.
+
+        The rotation matrix is exact, so the only drift is float round-off and it only needs an occasional
+        correction to the radius vector. That correction is also done incrementally, the rotation of
+        arc_correction+1 segments is applied to the correction matrix each time rather than calling
+        sin() and cos() for every correction, so the whole arc needs only four trig calls.
         */
         // Vector rotation matrix values
-        float cos_T = 1 - 0.5F * theta_per_segment * theta_per_segment; // Small angle approximation
-        float sin_T = theta_per_segment;
+        float cos_T = cosf(theta_per_segment);
+        float sin_T = sinf(theta_per_segment);
+
+        // rotation between corrections, and the rotation from the initial radius vector to the next correction
+        float theta_per_correction = theta_per_segment * (this->arc_correction + 1);
+        float cos_C = cosf(theta_per_correction);
+        float sin_C = sinf(theta_per_correction);
+        float cos_Ti = 1.0F;
+        float sin_Ti = 0.0F;
 
         // TODO we need to handle the ABC axis here by segmenting them
         float arc_target[n_motors];
-        float sin_Ti;
-        float cos_Ti;
         float r_axisi;
         uint16_t i;
         int8_t count = 0;
@@ -2304,8 +3032,9 @@ bool Robot::append_arc(Gcode * gcode, const float target[], const float rotated_
             } else {
                 // Arc correction to radius vector. Computed only every N_ARC_CORRECTION increments.
                 // Compute exact location by applying transformation matrix from initial radius vector(=-offset).
-                cos_Ti = cosf(i * theta_per_segment);
-                sin_Ti = sinf(i * theta_per_segment);
+                r_axisi = sin_Ti * cos_C + cos_Ti * sin_C;
+                cos_Ti = cos_Ti * cos_C - sin_Ti * sin_C;
+                sin_Ti = r_axisi;
                 arc_start_vector[this->plane_axis_0] = -offset[this->plane_axis_0] * cos_Ti + offset[this->plane_axis_1] * sin_Ti;
                 arc_start_vector[this->plane_axis_1] = -offset[this->plane_axis_0] * sin_Ti - offset[this->plane_axis_1] * cos_Ti;
                 count = 0;
@@ -2328,6 +3057,96 @@ bool Robot::append_arc(Gcode * gcode, const float target[], const float rotated_
     return moved;
 }
 
+// Append a G5 cubic or G5.1 quadratic Bezier in the XY plane, cut into as many lines as the arc settings would give an
+// arc of the same curvature: enough for mm_max_arc_error, no shorter than mm_per_arc_segment and no more a second than
+// arc_segments_per_second. c1 and c2 are the control points in machine XY, c2 is not used for a quadratic. The other
+// axes move evenly along it
+bool Robot::append_spline(Gcode * gcode, const float target[], const float c1[], const float c2[], bool cubic)
+{
+    float rate_mm_s= (inverse_time_mode ? this->inverse_time_f : this->feed_rate) / seconds_per_minute;
+    if(rate_mm_s <= 0.0F) {
+        gcode->is_error= true;
+        gcode->txt_after_ok= (rate_mm_s == 0 ? "Undefined feed rate" : "feed rate < 0");
+        THEKERNEL->streams->printf(rate_mm_s == 0 ? "Alarm:Undefined feed rate\n" : "Alarm:feed rate < 0\n");
+        return false;
+    }
+
+    // control polygon, like the arc it starts from arc_milestone
+    float px[4] = {this->arc_milestone[X_AXIS], c1[0], cubic ? c2[0] : target[X_AXIS], target[X_AXIS]};
+    float py[4] = {this->arc_milestone[Y_AXIS], c1[1], cubic ? c2[1] : target[Y_AXIS], target[Y_AXIS]};
+    int n = cubic ? 3 : 2;
+
+    // the curve is no longer than its control polygon and no shorter than its chord, take the middle
+    float polygon = 0;
+    for (int i = 0; i < n; ++i) polygon += hypotf(px[i + 1] - px[i], py[i + 1] - py[i]);
+    float chord = hypotf(px[n] - px[0], py[n] - py[0]);
+    float length = (polygon + chord) / 2;
+    float dz = target[Z_AXIS] - machine_position[Z_AXIS];
+    length = hypotf(length, dz);
+    if(length < 0.000001F) return false;
+
+    // it stays inside the box of its control points
+    float lo[3], hi[3];
+    lo[X_AXIS] = hi[X_AXIS] = px[0];
+    lo[Y_AXIS] = hi[Y_AXIS] = py[0];
+    for (int i = 1; i <= n; ++i) {
+        lo[X_AXIS] = std::min(lo[X_AXIS], px[i]); hi[X_AXIS] = std::max(hi[X_AXIS], px[i]);
+        lo[Y_AXIS] = std::min(lo[Y_AXIS], py[i]); hi[Y_AXIS] = std::max(hi[Y_AXIS], py[i]);
+    }
+    lo[Z_AXIS] = std::min(machine_position[Z_AXIS], target[Z_AXIS]);
+    hi[Z_AXIS] = std::max(machine_position[Z_AXIS], target[Z_AXIS]);
+    if(!within_soft_endstops(machine_position, lo, hi)) return false;
+
+    if(inverse_time_mode) rate_mm_s *= length;
+
+    // N even segments of a Bezier are within max |B''| / 8N^2 of it, and for degree n |B''| is at most n(n-1) times
+    // the largest second difference of the control points
+    float d2 = 0;
+    for (int i = 0; i + 2 <= n; ++i) {
+        d2 = std::max(d2, hypotf(px[i] - 2 * px[i + 1] + px[i + 2], py[i] - 2 * py[i + 1] + py[i + 2]));
+    }
+    float segments;
+    if(this->mm_max_arc_error > 0) {
+        segments = ceilf(sqrtf(n * (n - 1) * d2 / (8 * this->mm_max_arc_error)));
+        if(this->mm_per_arc_segment > 0.0001F) segments = std::min(segments, floorf(length / this->mm_per_arc_segment));
+    } else {
+        segments = floorf(length / (this->mm_per_arc_segment < 0.0001F ? 0.5F : this->mm_per_arc_segment));
+    }
+    if(this->arc_segments_per_second > 0.0F) {
+        segments = std::min(segments, floorf(length * this->arc_segments_per_second / rate_mm_s));
+    }
+    segments = std::max(1.0F, std::min(segments, 65535.0F));
+
+    float seg_target[n_motors];
+    bool moved = false;
+    uint16_t count = segments;
+    for (uint16_t i = 1; i < count; i++) {
+        if(THEKERNEL->is_halted()) return false; // don't queue any more segments
+
+        float t = (float)i / count, s = 1 - t;
+        float b[4];
+        if(cubic) {
+            b[0] = s * s * s; b[1] = 3 * s * s * t; b[2] = 3 * s * t * t; b[3] = t * t * t;
+        } else {
+            b[0] = s * s; b[1] = 2 * s * t; b[2] = t * t;
+        }
+        seg_target[X_AXIS] = seg_target[Y_AXIS] = 0;
+        for (int k = 0; k <= n; ++k) {
+            seg_target[X_AXIS] += b[k] * px[k];
+            seg_target[Y_AXIS] += b[k] * py[k];
+        }
+        for (int k = Z_AXIS; k < n_motors; ++k) {
+            seg_target[k] = machine_position[k] + t * (target[k] - machine_position[k]);
+        }
+        bool m = this->append_milestone(seg_target, rate_mm_s, gcode->line);
+        moved = moved || m;
+    }
+
+    if(this->append_milestone(target, rate_mm_s, gcode->line)) moved = true;
+
+    return moved;
+}
+
 // Do the math for an arc and add it to the queue
 bool Robot::compute_arc(Gcode * gcode, const float offset[], const float target[], const float rotated_target[], enum MOTION_MODE_T motion_mode)
 {
@@ -2370,6 +3189,7 @@ void Robot::select_plane(uint8_t axis_0, uint8_t axis_1, uint8_t axis_2)
 void Robot::clearToolOffset()
 {
     this->tool_offset= wcs_t(0,0,0,0,0);
+    update_wcs_transform();
 
     THEKERNEL->eeprom_data->TLO = 0;
 
@@ -2379,6 +3199,7 @@ void Robot::loadToolOffset(const float offset[N_PRIMARY_AXIS]) {
 	this->tool_offset = wcs_t(offset[0], offset[1], offset[2], 0, 0);
     // update laser offset
     setLaserOffset();
+    update_wcs_transform();
 }
 
 void Robot::saveToolOffset(const float offset[N_PRIMARY_AXIS], const float cur_tool_mz) {
@@ -2395,11 +3216,13 @@ void Robot::setLaserOffset()
 		g92_offset = wcs_t(laser_module_offset_x, laser_module_offset_y, laser_module_offset_z, 0, 0);
 		THEKERNEL->streams->printf("Laser offset set to: %1.3f, %1.3f, %1.3f\n", laser_module_offset_x, laser_module_offset_y, laser_module_offset_z);
 		// g92_offset = wcs_t(laser_module_offset_x, laser_module_offset_y, laser_module_offset_z + std::get<Z_AXIS>(tool_offset));
+		update_wcs_transform();
 	}
 }
 
 void Robot::clearLaserOffset() {
 	this->g92_offset = wcs_t(0.0F, 0.0F, 0.0F, 0.0F, 0.0F);
+	update_wcs_transform();
 }
 
 
@@ -2413,13 +3236,11 @@ bool Robot::is_homed(uint8_t i) const
     if(i >= 3) return false; // safety
 
     // if we are homing we ignore soft endstops so return false
-    bool homing;
-    bool ok = PublicData::get_value(endstops_checksum, get_homing_status_checksum, 0, &homing);
-    if(!ok || homing) return false;
+    if(THEKERNEL->is_homing()) return false;
 
     // check individual axis homing status
     bool homed[3];
-    ok = PublicData::get_value(endstops_checksum, get_homed_status_checksum, 0, homed);
+    bool ok = PublicData::get_value(endstops_checksum, get_homed_status_checksum, 0, homed);
     if(!ok) return false;
     return homed[i];
 }
@@ -16,10 +16,15 @@ using std::string;
 #include <vector>
 
 #include "libs/Module.h"
+#include "Callback.h"
 #include "ActuatorCoordinates.h"
 #include "nuts_bolts.h"
 #include <fastmath.h>
 
+#ifdef CARTESIAN_ONLY
+#include "arm_solutions/CartesianSolution.h"
+#endif
+
 class Gcode;
 class BaseSolution;
 class StepperMotor;
@@ -34,6 +39,10 @@ class Robot : public Module {
         Robot();
         void on_module_loaded();
         void on_gcode_received(void* argument);
+        void on_idle(void* argument);
+        void on_halt(void* argument);
+        void flush_coalesced();
+        void apply_realtime_overrides();
 
         void reset_axis_position(float position, int axis);
         void reset_axis_position(float x, float y, float z);
@@ -41,7 +50,13 @@ class Robot : public Module {
         void reset_position_from_current_actuator_position();
         void reset_compensated_machine_position();
         float get_seconds_per_minute() const { return seconds_per_minute; }
+        // the factor the realtime overrides scale a G1/G2/G3 or a G0 by
+        float get_override_factor(bool g123) const { return (60.0F / seconds_per_minute) * (g123 ? 1.0F : rapid_override); }
+        // single byte realtime override codes, called from the receive interrupts, returns true if c was one
+        bool realtime_override(uint8_t c);
         float get_z_maxfeedrate() const { return this->max_speeds[Z_AXIS]; }
+        float get_max_speed(int axis) const { return this->max_speeds[axis]; }
+        float get_seek_rate() const { return this->seek_rate; }
         float get_default_acceleration() const { return default_acceleration; }
         void loadToolOffset(const float offset[N_PRIMARY_AXIS]);
         void saveToolOffset(const float offset[N_PRIMARY_AXIS], const float cur_tool_mz);
@@ -61,12 +76,17 @@ class Robot : public Module {
         void get_axis_position(float position[], size_t n= 3) const { memcpy(position, this->machine_position, n*sizeof(float)); }
         wcs_t get_axis_position() const { return wcs_t(machine_position[X_AXIS], machine_position[Y_AXIS], machine_position[Z_AXIS], machine_position[A_AXIS], machine_position[B_AXIS]); }
         void get_current_machine_position(float *pos) const;
+        // the realtime position for status reports, with the compensation taken back out of XYZ and A and B as the actuators
+        // are, shared by everyone asking and only worked out again after the motors stepped and the interval has gone by
+        void get_status_position(float pos[5]);
         void print_position(uint8_t subcode, std::string& buf, bool ignore_extruders=false) const;
         uint8_t get_current_wcs() const { return current_wcs; }
         std::vector<wcs_t> get_wcs_state() const;
         std::tuple<float, float, float, uint8_t> get_last_probe_position() const { return last_probe_position; }
         void set_last_probe_position(std::tuple<float, float, float, uint8_t> p) { last_probe_position = p; }
         bool delta_move(const float delta[], float rate_mm_s, uint8_t naxis);
+        bool cycle_move(float x, float y, float z, float feed, unsigned int line= 0, bool fixed_rate= false);
+        bool raster_move(float dx, float dy, float feed, const float *s, uint8_t n, unsigned int line= 0);
         void rotate(float pos[]){return rotate(&pos[0], &pos[1], &pos[2]);}
         void rotate(float *x, float *y, float *z);
         void unrotate(float *x, float *y, float *z);
@@ -79,13 +99,22 @@ class Robot : public Module {
         bool is_homed_all_axes();
         void override_homed_check(bool home_override_value);
 
+#ifdef CARTESIAN_ONLY
+        CartesianSolution* arm_solution;                      // The only arm solution in this build, so its calls inline
+#else
         BaseSolution* arm_solution;                           // Selected Arm solution ( millimeters to step calculation )
+#endif
 
         // gets accessed by Panel, Endstops, ZProbe
         std::vector<StepperMotor*> actuators;
 
         // set by a leveling strategy to transform the target of a move according to the current plan
-        std::function<void(float*, bool, bool)> compensationTransform;
+        Callback<void(float*, bool, bool)> compensationTransform;
+        // optionally set with it, fills in the fractions along the line from, to where the compensation has a kink
+        // (grid cell boundaries etc), at most max of them in any order, returns how many or -1 if there are more
+        Callback<int(const float*, const float*, float*, int)> compensationSplits;
+        // set by a spindle that is still spinning up, the next feed move waits for it to return, it is cleared once called
+        Callback<void()> feedGate;
         // set by an active extruder, returns the amount to scale the E parameter by (to convert mm³ to mm)
         std::function<float(void)> get_e_scale_fnc;
 
@@ -112,8 +141,12 @@ class Robot : public Module {
             bool save_g92:1;                                  // save g92 on M500 if set
             bool save_g54:1;                                  // save WCS on M500 if set
             bool is_g123:1;
+            bool inverse_time_mode:1;                         // G93, F is the inverse of the minutes a feed move takes
             bool soft_endstop_enabled:1;
             bool soft_endstop_halt:1;
+            bool soft_endstop_checked:1;                      // the whole move was checked before it was cut into segments
+            bool queue_dwell:1;                               // G4 is a block in the queue
+            bool a_axis_wrap:1;                               // absolute A moves go the short way round, see shortest_a_target()
             uint8_t plane_axis_0:2;                           // Current plane ( XY, XZ, YZ )
             uint8_t plane_axis_1:2;
             uint8_t plane_axis_2:2;
@@ -135,14 +168,29 @@ class Robot : public Module {
             SEEK, // G0
             LINEAR, // G1
             CW_ARC, // G2
-            CCW_ARC // G3
+            CCW_ARC, // G3
+            CUBIC_SPLINE, // G5
+            QUAD_SPLINE // G5.1
         };
 
         void load_config();
         bool append_milestone(const float target[], float rate_mm_s, unsigned int line);
+        bool queue_move(ActuatorCoordinates &actuator_pos, float rate_mm_s, float distance, float *unit_vec, float acceleration, float jerk, float shaper_time, const float target[], unsigned int line);
+        bool coalesce_move(ActuatorCoordinates &actuator_pos, float rate_mm_s, float acceleration, float jerk, float shaper_time, const float target[]);
+        void blend_corner(const ActuatorCoordinates &actuator_pos, float &distance, const float *unit_vec, float rate_mm_s, float acceleration, float jerk, float shaper_time, const float target[], unsigned int line, float start[]);
+        uint8_t span_s_values(float *out) const;
+        void set_s_span(float from, float to) { s_span[0]= from; s_span[1]= to; }
         bool append_line( Gcode* gcode, const float target[], float rate_mm_s, float delta_e);
+        bool within_soft_endstops(const float start[], const float lo[], const float hi[]);
+        bool soft_endstop_exceeded(int axis);
+        float inverse_time_rate(const float target[]) const;
+        float shortest_a_target(float a) const;
+        void pass_feed_gate();
+        void update_wcs_transform();
+        int compensation_segments(const float from[], const float to[], float ts[]);
         bool append_arc( Gcode* gcode, const float target[], const float rotated_target[], const float offset[], float radius, bool is_clockwise );
         bool compute_arc(Gcode* gcode, const float offset[], const float target[], const float rotated_target[], enum MOTION_MODE_T motion_mode);
+        bool append_spline(Gcode* gcode, const float target[], const float c1[], const float c2[], bool cubic);
         void process_move(Gcode *gcode, enum MOTION_MODE_T);
 
         float theta(float x, float y);
@@ -151,12 +199,27 @@ class Robot : public Module {
         void setLaserOffset();
         int get_active_extruder() const;
 
+        struct {
+            uint32_t time_us;
+            int32_t steps[k_max_actuators];
+            float pos[5];
+            bool compensated;
+            bool valid;
+        } status_position;
+        uint32_t status_position_interval_us;
+
         std::array<wcs_t, MAX_WCS> wcs_offsets; // these are persistent once saved with M500
         uint8_t current_wcs{0}; // 0 means G54 is enabled this is persistent once saved with M500
         wcs_t g92_offset;
         wcs_t tool_offset; // used for multiple extruders, sets the tool offset for the current extruder applied first
         float cos_r[MAX_WCS];
         float sin_r[MAX_WCS];
+        // the current wcs, g92 and tool offsets and rotation folded together, see update_wcs_transform()
+        struct wcs_xform_t {
+            float cos_r, sin_r;
+            float to_wcs[5];                                  // wcs = R'mcs + to_wcs
+            float to_mcs[5];                                  // mcs = R wcs + to_mcs
+        } wcs_xform;
         std::tuple<float, float, float, uint8_t> last_probe_position{0,0,0,0};
 
         uint8_t current_motion_mode;
@@ -166,33 +229,73 @@ class Robot : public Module {
         float machine_position[k_max_actuators]; // Last requested position, in millimeters, which is what we were requested to move to in the gcode after offsets applied but before compensation transform
         float compensated_machine_position[k_max_actuators]; // Last machine position, which is the position before converting to actuator coordinates (includes compensation transform)
 
+        // the feed move held back by queue_move to be merged with the collinear moves after it
+        static const uint8_t k_max_coalesce = 8;
+        static const uint32_t coalesce_timeout_us = 20000;
+        struct coalesce_t {
+            ActuatorCoordinates actuator_pos;                 // target of the merged move
+            float start[N_PRIMARY_AXIS];                      // compensated position it starts from
+            float points[k_max_coalesce][N_PRIMARY_AXIS];     // the end of each of the moves merged so far
+            float distance;
+            float rate_mm_s;
+            float acceleration;
+            float jerk;
+            float shaper_time;
+            float s_value;
+            float override_factor;
+            uint32_t time;                                    // us_ticker_read() of the last merge
+            unsigned int line;
+            uint8_t n_points{0};
+        } coalesced;
+        float mm_max_coalesce_error;                         // Setting : merge feed moves that stay this close to a line, 0 to disable
+        float blend_tolerance;                               // G64 P, how far a corner between feed moves may be rounded off, 0 in G61
+        float default_blend_tolerance;                       // Setting : the tolerance of a G64 without P
+        bool coalesce_busy{false};
+
         float seek_rate;                                     // Current rate for seeking moves ( mm/min )
         float feed_rate;                                     // Current rate for feeding moves ( mm/min )
+        float inverse_time_f;                                // F of the current move in G93 ( 1/min )
+        float cylinder_radius;                               // G7.1 radius Y is unwrapped at onto A, 0 when off
         float mm_per_line_segment;                           // Setting : Used to split lines into segments
+        float mm_max_compensation_error;                     // Setting : split compensated lines only where the compensation moves this far off a straight segment, 0 to disable
+        static const uint8_t k_max_compensation_segments = 64;
         float mm_per_arc_segment;                            // Setting : Used to split arcs into segments
         float mm_max_arc_error;                              // Setting : Used to limit total arc segments to max error
         float delta_segments_per_second;                     // Setting : Used to split lines into segments for delta based on speed
         float seconds_per_minute;                            // for realtime speed change
+        float rapid_override;                                // realtime rapid override, 1, 0.5 or 0.25
+        float move_override;                                 // the override factor in the rate of the move being queued, 0 if the move is not overridden
+
+        // realtime override codes from the receive interrupts, applied from on_idle
+        volatile int16_t feed_override_delta;
+        volatile int16_t spindle_override_delta;
+        volatile uint8_t rapid_override_request;             // percent, 0 if there is none
+        volatile bool feed_override_reset;
+        volatile bool spindle_override_reset;
+        volatile bool override_pending;
         float default_acceleration;                          // the defualt accleration if not set for each axis
+        float default_jerk;                                  // Setting : jerk for S-curve ramps, 0 uses trapezoids
+        float rapid_acceleration;                            // Setting : for moves that do not cut, XY, NAN uses the feed move ones
+        float z_rapid_acceleration;                          // Setting : the same for Z
         float s_value;                                       // modal S value
-        // 2024
-        /*
-        float s_values[8];                                   // block S values
-		int   s_count;
-		*/
+        float s_values[8];                                   // S values of the G1 being queued, spread evenly along it, Block::k_max_s_values
+        uint8_t s_count;                                     // number of them, only more than one while that G1 is queued
+        float s_span[2];                                     // the fraction of the line the milestone being queued covers
         float arc_milestone[3];                              // used as start of an arc command
+        float spline_pq[2];                                  // P Q of the last G5, a G5 without I J starts tangent to it
         float max_delta;
 
         float laser_module_offset_x;
 		float laser_module_offset_y;
 		float laser_module_offset_z;
 
-		// Number of arc generation iterations by small angle approximation before exact arc trajectory
+		// Number of arc generation iterations by incremental rotation before exact arc trajectory
         // correction. This parameter may be decreased if there are issues with the accuracy of the arc
         // generations. In general, the default value is more than enough for the intended CNC applications
         // of grbl, and should be on the order or greater than the size of the buffer to help with the
         // computational efficiency of generating arcs.
         int arc_correction;                                  // Setting : how often to rectify arc computation
+        float arc_segments_per_second;                       // Setting : most arc segments a second at the feed rate, 0 to disable
         float max_speeds[3];                                 // Setting : max allowable speed in mm/s for each axis
         float max_speed;                                     // Setting : maximum feedrate in mm/s as specified by F parameter
         bool probe_tool_not_calibrated;
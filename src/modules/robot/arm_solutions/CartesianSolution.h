@@ -1,16 +1,24 @@
 #pragma once
 
-#include "libs/Module.h"
-#include "libs/Kernel.h"
 #include "BaseSolution.h"
+#include "ActuatorCoordinates.h"
 #include "libs/nuts_bolts.h"
 
-#include "libs/Config.h"
+class Config;
 
-class CartesianSolution : public BaseSolution {
+// final and inline so that calls through a CartesianSolution pointer are not virtual, see CARTESIAN_ONLY in Robot.h
+class CartesianSolution final : public BaseSolution {
     public:
         CartesianSolution(){};
         CartesianSolution(Config*){};
-        void cartesian_to_actuator( const float millimeters[], ActuatorCoordinates &steps ) const override;
-        void actuator_to_cartesian( const ActuatorCoordinates &steps, float millimeters[] ) const override;
+        void cartesian_to_actuator( const float cartesian_mm[], ActuatorCoordinates &actuator_mm ) const override {
+            actuator_mm[ALPHA_STEPPER] = cartesian_mm[X_AXIS];
+            actuator_mm[BETA_STEPPER ] = cartesian_mm[Y_AXIS];
+            actuator_mm[GAMMA_STEPPER] = cartesian_mm[Z_AXIS];
+        }
+        void actuator_to_cartesian( const ActuatorCoordinates &actuator_mm, float cartesian_mm[] ) const override {
+            cartesian_mm[ALPHA_STEPPER] = actuator_mm[X_AXIS];
+            cartesian_mm[BETA_STEPPER ] = actuator_mm[Y_AXIS];
+            cartesian_mm[GAMMA_STEPPER] = actuator_mm[Z_AXIS];
+        }
 };
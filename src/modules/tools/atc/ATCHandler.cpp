@@ -31,6 +31,7 @@
 #include "libs/SerialMessage.h"
 #include "libs/StreamOutput.h"
 #include "modules/utils/player/PlayerPublicAccess.h"
+#include "modules/utils/player/JobScan.h"
 #include "ATCHandlerPublicAccess.h"
 #include "ZProbePublicAccess.h"
 #include "SpindlePublicAccess.h"
@@ -59,6 +60,7 @@
 #define detect_pin_checksum			CHECKSUM("detect_pin")
 #define detect_rate_mm_s_checksum	CHECKSUM("detect_rate_mm_s")
 #define detect_travel_mm_checksum 	CHECKSUM("detect_travel_mm")
+#define stop_on_detect_checksum 	CHECKSUM("stop_on_detect")
 
 #define safe_z_checksum				CHECKSUM("safe_z_mm")
 #define safe_z_empty_checksum		CHECKSUM("safe_z_empty_mm")
@@ -71,6 +73,9 @@
 #define slow_rate_mm_m_checksum		CHECKSUM("slow_rate_mm_m")
 #define retract_mm_checksum			CHECKSUM("retract_mm")
 #define probe_height_mm_checksum	CHECKSUM("probe_height_mm")
+#define tlo_cache_s_checksum		CHECKSUM("tlo_cache_s")
+#define tlo_cache_verify_checksum	CHECKSUM("tlo_cache_verify")
+#define tlo_cache_tolerance_mm_checksum CHECKSUM("tlo_cache_tolerance_mm")
 
 #define coordinate_checksum			CHECKSUM("coordinate")
 #define anchor_width_checksum		CHECKSUM("anchor_width")
@@ -119,12 +124,25 @@ ATCHandler::ATCHandler()
     position_y = 8888;
     position_a = 88888888;
     position_b = 88888888;
+    seconds = 0;
+    memset(rack, 0, sizeof(rack));
 }
 
 void ATCHandler::clear_script_queue(){
-	while (!this->script_queue.empty()) {
-		this->script_queue.pop();
-	}
+	this->script_queue.clear();
+}
+
+// a G53 or G90 G53 rapid or feed in a script, it queues a block and nothing else so it can be sent along with the next one
+static bool is_script_move(const char *line)
+{
+	if (strncmp(line, "G90 ", 4) == 0) line += 4;
+	return strncmp(line, "G53 G0 ", 7) == 0 || strncmp(line, "G53 G1 ", 7) == 0;
+}
+
+// the tool change routines only depend on the config, the tool and the units so they are cached
+uint32_t ATCHandler::script_key(int tool, bool clear_z) const
+{
+	return (tool & 0xFFFFF) | (clear_z << 20) | (THEROBOT->inch_mode << 21);
 }
 
 void ATCHandler::fill_calibrate_probe_anchor_scripts(bool invert_probe){
@@ -190,6 +208,7 @@ void ATCHandler::calibrate_set_value(Gcode *gcode)
 				THEKERNEL->streams->printf("New Anchor 1 X: %.3f\nNew Anchor 1 Y: %.3f\n", final_x, final_y);
 				this->anchor1_x = final_x;
 				this->anchor1_y = final_y;
+				this->script_cache.clear();
 				THEKERNEL->streams->printf("These values have been temporarily set. You can test the position with M496.3\nTo make them permanent run:\nconfig-set sd coordinate.anchor1_x %.3f\nconfig-set sd coordinate.anchor1_y %.3f\n", final_x, final_y);
 				break;
 				break;
@@ -586,7 +605,6 @@ void ATCHandler::fill_change_scripts(int new_tool, bool clear_z) {
 
 void ATCHandler::fill_manual_drop_scripts(int old_tool) {
 	char buff[100];
-	struct atc_tool *current_tool = &atc_tools[old_tool];
 	// set atc status
 	this->script_queue.push("M497.1");
 	//make extra sure the spindle is off
@@ -598,6 +616,8 @@ void ATCHandler::fill_manual_drop_scripts(int old_tool) {
 	//move to clearance
 	snprintf(buff, sizeof(buff), "G90 G53 G0 X%.3f Y%.3f", THEROBOT->from_millimeters(probe_mx_mm), THEROBOT->from_millimeters(probe_my_mm));
 	this->script_queue.push(buff);
+	// no hands near it until it has stopped
+	this->script_queue.push("M5.1");
 
 	//print status
 	snprintf(buff, sizeof(buff), ";Ready to drop tool %d. Prepare to catch tool, resume will loosen collet\n", old_tool);
@@ -622,7 +642,6 @@ void ATCHandler::fill_manual_drop_scripts(int old_tool) {
 
 void ATCHandler::fill_manual_pickup_scripts(int new_tool, bool clear_z, bool auto_calibrate = false, float custom_TLO = NAN) {
 	char buff[100];
-	struct atc_tool *current_tool = &atc_tools[new_tool];
 	// set atc status
 	this->script_queue.push("M497.2");
 	// lift z to safe position with fast speed
@@ -685,8 +704,14 @@ void ATCHandler::fill_drop_scripts(int old_tool) {
 	if (!THEROBOT->is_homed_all_axes()) {
 		return;
 	};
+
+	uint32_t key = script_key(old_tool, false);
+	if (this->script_cache.get(ScriptCache::DROP, key, this->script_queue)) {
+		return;
+	}
+	uint32_t mark = this->script_queue.pushed();
 	
-	struct atc_tool *current_tool = &atc_tools[old_tool];
+	const rack_tool_t *current_tool = &rack[old_tool];
 	// set atc status
 	this->script_queue.push("M497.1");
     // lift z axis to atc start position
@@ -700,6 +725,8 @@ void ATCHandler::fill_drop_scripts(int old_tool) {
     // move x and y to reseted tool position
 	snprintf(buff, sizeof(buff), "G53 G0 X%.3f Y%.3f", THEROBOT->from_millimeters(current_tool->mx_mm), THEROBOT->from_millimeters(current_tool->my_mm));
 	this->script_queue.push(buff);
+	// it may have spun down on the way here, it has to have stopped before it goes into the rack
+	this->script_queue.push("M5.1");
     // drop z axis to z position with fast speed
 	snprintf(buff, sizeof(buff), "G53 G1 Z%.3f F%.3f", THEROBOT->from_millimeters(current_tool->mz_mm + safe_z_offset_mm), THEROBOT->from_millimeters(fast_z_rate));
 	this->script_queue.push(buff);
@@ -715,6 +742,8 @@ void ATCHandler::fill_drop_scripts(int old_tool) {
 	this->script_queue.push("M493.2 T-1");
 	// move around to see if tool is dropped, halt if not
 	this->script_queue.push("M492.1");
+
+	this->script_cache.put(ScriptCache::DROP, key, this->script_queue, mark);
 }
 
 void ATCHandler::fill_pick_scripts(int new_tool, bool clear_z) {
@@ -722,7 +751,14 @@ void ATCHandler::fill_pick_scripts(int new_tool, bool clear_z) {
 	if (!THEROBOT->is_homed_all_axes()) {
 		return;
 	};
-	struct atc_tool *current_tool = &atc_tools[new_tool];
+
+	uint32_t key = script_key(new_tool, clear_z);
+	if (this->script_cache.get(ScriptCache::PICK, key, this->script_queue)) {
+		return;
+	}
+	uint32_t mark = this->script_queue.pushed();
+
+	const rack_tool_t *current_tool = &rack[new_tool];
 	// set atc status
 	this->script_queue.push("M497.2");
 	// lift z to safe position with fast speed
@@ -755,6 +791,7 @@ void ATCHandler::fill_pick_scripts(int new_tool, bool clear_z) {
 	snprintf(buff, sizeof(buff), "M493.2 T%d", new_tool);
 	this->script_queue.push(buff);
 
+	this->script_cache.put(ScriptCache::PICK, key, this->script_queue, mark);
 }
 
 void ATCHandler::fill_cali_scripts(bool is_probe, bool clear_z) {
@@ -763,6 +800,13 @@ void ATCHandler::fill_cali_scripts(bool is_probe, bool clear_z) {
 		return;
 	};
 
+	// the laser mode and the machine change which lines are used
+	uint32_t key = script_key(is_probe, clear_z) | (THEKERNEL->get_laser_mode() << 22);
+	if (this->script_cache.get(ScriptCache::CALI, key, this->script_queue)) {
+		return;
+	}
+	uint32_t mark = this->script_queue.pushed();
+
 	if(is_probe){
 	// open probe laser
 		this->script_queue.push("M494.1");
@@ -821,6 +865,35 @@ void ATCHandler::fill_cali_scripts(bool is_probe, bool clear_z) {
 		// close probe laser	
 	    this->script_queue.push("M494.2");
 	}
+
+	this->script_cache.put(ScriptCache::CALI, key, this->script_queue, mark);
+}
+
+// instead of fill_cali_scripts() for a rack tool in the TLO cache, one fast touch to check it or nothing at all
+void ATCHandler::fill_tlo_cache_scripts(int tool) {
+	char buff[100];
+
+	// set atc status
+	this->script_queue.push("M497.3");
+	if (this->tlo_cache_verify) {
+		// lift z to safe position with fast speed
+		snprintf(buff, sizeof(buff), "G53 G0 Z%.3f", THEROBOT->from_millimeters(this->safe_z_mm));
+		this->script_queue.push(buff);
+		// move x and y to calibrate position
+		snprintf(buff, sizeof(buff), "G53 G0 X%.3f Y%.3f", THEROBOT->from_millimeters(probe_mx_mm), THEROBOT->from_millimeters(probe_my_mm));
+		this->script_queue.push(buff);
+		// touch once with fast speed
+		snprintf(buff, sizeof(buff), "G38.6 Z%.3f F%.3f", probe_mz_mm, probe_fast_rate);
+		this->script_queue.push(buff);
+	}
+	// use the cached offset, or calibrate if the touch does not match it
+	snprintf(buff, sizeof(buff), "M493.5 T%d V%d", tool, this->tlo_cache_verify);
+	this->script_queue.push(buff);
+	if (this->tlo_cache_verify) {
+		// lift z to safe position with fast speed
+		snprintf(buff, sizeof(buff), "G53 G0 Z%.3f", THEROBOT->from_millimeters(this->safe_z_mm));
+		this->script_queue.push(buff);
+	}
 }
 
 void ATCHandler::fill_margin_scripts(float x_pos, float y_pos, float x_pos_max, float y_pos_max) {
@@ -1056,7 +1129,7 @@ void ATCHandler::fill_xyzprobe_scripts(float tool_dia, float probe_height) {
 
 
 void ATCHandler::fill_autolevel_scripts(float x_pos, float y_pos,
-		float x_size, float y_size, int x_grids, int y_grids, float height)
+		float x_size, float y_size, int x_grids, int y_grids, float height, int map)
 {
 	char buff[100];
 	if (!THEROBOT->is_homed_all_axes()) {
@@ -1072,8 +1145,12 @@ void ATCHandler::fill_autolevel_scripts(float x_pos, float y_pos,
 	snprintf(buff, sizeof(buff), "G90 G0 X%.3f Y%.3f", THEROBOT->from_millimeters(x_pos), THEROBOT->from_millimeters(y_pos));
 	this->script_queue.push(buff);
 
-	// do auto leveling
-	snprintf(buff, sizeof(buff), "G32R1X0Y0A%.3fB%.3fI%dJ%dH%.3f", x_size, y_size, x_grids, y_grids, height);
+	// do auto leveling, or use the map kept for the fixture if it still fits
+	if (map > 0) {
+		snprintf(buff, sizeof(buff), "M375.2P%dX0Y0A%.3fB%.3fI%dJ%dH%.3f", map, x_size, y_size, x_grids, y_grids, height);
+	} else {
+		snprintf(buff, sizeof(buff), "G32R1X0Y0A%.3fB%.3fI%dJ%dH%.3f", x_size, y_size, x_grids, y_grids, height);
+	}
 	this->script_queue.push(buff);
 	
 	// close wired probe laser
@@ -1116,6 +1193,9 @@ void ATCHandler::on_module_loaded()
 void ATCHandler::on_config_reload(void *argument)
 {
 	char buff[10];
+
+	// all the positions in the cached routines come from here
+	this->script_cache.clear();
 	
 	if(CARVERA == THEKERNEL->factory_set->MachineModel)
 	{
@@ -1135,6 +1215,8 @@ void ATCHandler::on_config_reload(void *argument)
 	detector_info.detect_pin.from_string( THEKERNEL->config->value(atc_checksum, detector_checksum, detect_pin_checksum)->by_default("0.20^" )->as_string())->as_input();
 	detector_info.detect_rate = THEKERNEL->config->value(atc_checksum, detector_checksum, detect_rate_mm_s_checksum)->by_default(1  )->as_number();
 	detector_info.detect_travel = THEKERNEL->config->value(atc_checksum, detector_checksum, detect_travel_mm_checksum)->by_default(1  )->as_number();
+	// a check for a tool can end as soon as the sensor sees it, only a check for no tool needs the whole sweep
+	detector_info.stop_enable = THEKERNEL->config->value(atc_checksum, detector_checksum, stop_on_detect_checksum)->by_default(true)->as_bool();
 
 	this->safe_z_mm = THEKERNEL->config->value(atc_checksum, safe_z_checksum)->by_default(-10)->as_number();
 	this->safe_z_empty_mm = THEKERNEL->config->value(atc_checksum, safe_z_empty_checksum)->by_default(-20)->as_number();
@@ -1146,6 +1228,11 @@ void ATCHandler::on_config_reload(void *argument)
 	this->probe_fast_rate = THEKERNEL->config->value(atc_checksum, probe_checksum, fast_rate_mm_m_checksum)->by_default(300  )->as_number();
 	this->probe_slow_rate = THEKERNEL->config->value(atc_checksum, probe_checksum, slow_rate_mm_m_checksum)->by_default(60   )->as_number();
 	this->probe_retract_mm = THEKERNEL->config->value(atc_checksum, probe_checksum, retract_mm_checksum)->by_default(2   )->as_number();
+	this->tlo_cache_s = THEKERNEL->config->value(atc_checksum, probe_checksum, tlo_cache_s_checksum)->by_default(0  )->as_int();
+	this->tlo_cache_verify = THEKERNEL->config->value(atc_checksum, probe_checksum, tlo_cache_verify_checksum)->by_default(true)->as_bool();
+	this->tlo_cache_tolerance = THEKERNEL->config->value(atc_checksum, probe_checksum, tlo_cache_tolerance_mm_checksum)->by_default(0.05F)->as_number();
+	// the probe position may have changed
+	clear_tlo_cache();
 	this->probe_height_mm = THEKERNEL->config->value(atc_checksum, probe_checksum, probe_height_mm_checksum)->by_default(0   )->as_number();
 	
 	this->anchor_width = THEKERNEL->config->value(coordinate_checksum, anchor_width_checksum)->by_default(15  )->as_number();
@@ -1167,18 +1254,15 @@ void ATCHandler::on_config_reload(void *argument)
 		this->toolrack_offset_y = THEKERNEL->config->value(coordinate_checksum, toolrack_offset_y_checksum)->by_default(196  )->as_number();
 	}
 	
-	atc_tools.clear();
 	if(THEKERNEL->factory_set->FuncSetting & (1<<3))	//for CE1 expand
 	{
 		for (int i = 0; i <=  8; i ++) {
-			struct atc_tool tool;
-			tool.num = i;
+			rack_tool_t &tool = rack[i];
 		    // lift z axis to atc start position
 			snprintf(buff, sizeof(buff), "tool%d", i);
 			tool.mx_mm = this->anchor1_x + this->toolrack_offset_x;
 			tool.my_mm = this->anchor1_y + this->toolrack_offset_y -5 + (i == 0 ? 219 : (8 - i) * 25);
 			tool.mz_mm = this->toolrack_z - 4.5;
-			atc_tools.push_back(tool);
 		}
 		probe_mx_mm = this->anchor1_x + this->toolrack_offset_x;
 		probe_my_mm = this->anchor1_y + this->toolrack_offset_y -5 + 197;
@@ -1187,14 +1271,12 @@ void ATCHandler::on_config_reload(void *argument)
 	else
 	{
 		for (int i = 0; i <=  6; i ++) {
-			struct atc_tool tool;
-			tool.num = i;
+			rack_tool_t &tool = rack[i];
 		    // lift z axis to atc start position
 			snprintf(buff, sizeof(buff), "tool%d", i);
 			tool.mx_mm = this->anchor1_x + this->toolrack_offset_x;
 			tool.my_mm = this->anchor1_y + this->toolrack_offset_y + (i == 0 ? 210 : (6 - i) * 30);
 			tool.mz_mm = this->toolrack_z;
-			atc_tools.push_back(tool);
 		}
 		probe_mx_mm = this->anchor1_x + this->toolrack_offset_x;
 		probe_my_mm = this->anchor1_y + this->toolrack_offset_y + 180;
@@ -1232,6 +1314,8 @@ void ATCHandler::on_halt(void* argument)
     if (argument == nullptr ) {
 
         abort();
+        // the machine may have been stopped anywhere, measure every tool again
+        clear_tlo_cache();
 
 		if(CARVERA_AIR == THEKERNEL->factory_set->MachineModel)
 	    {
@@ -1296,14 +1380,26 @@ uint32_t ATCHandler::read_detector(uint32_t dummy)
 
     if (detector_info.detect_pin.get()) {
     	detector_info.triggered = true;
+    	// the tool is there, the rest of the sweep would only confirm it again
+    	if (detector_info.stop_on_detect && STEPPER[Y_AXIS]->is_moving()) STEPPER[Y_AXIS]->stop_moving();
     }
 
     return 0;
 }
 
 // Called every second in an ISR
+// M494.0 opens the probe laser and starts its countdown, M494.1 opens it, M494.2 closes it
+void ATCHandler::queued_probe_laser(uint32_t subcode)
+{
+	bool b = subcode != 2;
+	PublicData::set_value( switch_checksum, detector_switch_checksum, state_checksum, &b );
+	if (subcode == 0) THEKERNEL->set_probeLaser(true);
+}
+
 uint32_t ATCHandler::countdown_probe_laser(uint32_t dummy)
 {
+	this->seconds++;
+
 	if(THEKERNEL->factory_set->FuncSetting & (1<<2))	//ATC 
 	{
 		if (this->probe_laser_last < 120) {
@@ -1333,7 +1429,7 @@ uint32_t ATCHandler::countdown_probe_laser(uint32_t dummy)
     return 0;
 }
 
-bool ATCHandler::laser_detect() {
+bool ATCHandler::laser_detect(bool stop_on_detect) {
     // First wait for the queue to be empty
     THECONVEYOR->wait_for_idle();
 
@@ -1346,31 +1442,37 @@ bool ATCHandler::laser_detect() {
     }
 
     // move around and check laser detector
-    detecting = true;
+    float start_y = THEROBOT->get_axis_position(Y_AXIS);
     detector_info.triggered = false;
+    detector_info.stop_on_detect = stop_on_detect && detector_info.stop_enable;
+    detecting = true;
 
 	float delta[Y_AXIS + 1];
-	for (size_t i = 0; i <= Y_AXIS; i++) delta[i] = 0;
-	delta[Y_AXIS]= detector_info.detect_travel / 2;
-	THEROBOT->delta_move(delta, detector_info.detect_rate, Y_AXIS + 1);
-	// wait for it
-	THECONVEYOR->wait_for_idle();
-	if(THEKERNEL->is_halted()) return false;
-
-	delta[Y_AXIS]= 0 - detector_info.detect_travel;
-	THEROBOT->delta_move(delta, detector_info.detect_rate, Y_AXIS + 1);
-	// wait for it
-	THECONVEYOR->wait_for_idle();
-	if(THEKERNEL->is_halted()) return false;
-
-	delta[Y_AXIS]= detector_info.detect_travel / 2;
-	THEROBOT->delta_move(delta, detector_info.detect_rate, Y_AXIS + 1);
-	// wait for it
-	THECONVEYOR->wait_for_idle();
-	if(THEKERNEL->is_halted()) return false;
-
+	const float sweep[3] = { detector_info.detect_travel / 2, -detector_info.detect_travel, detector_info.detect_travel / 2 };
+	for (int s = 0; s < 3; s++) {
+		for (size_t i = 0; i <= Y_AXIS; i++) delta[i] = 0;
+		delta[Y_AXIS]= sweep[s];
+		THEROBOT->delta_move(delta, detector_info.detect_rate, Y_AXIS + 1);
+		// wait for it
+		THECONVEYOR->wait_for_idle();
+		if(THEKERNEL->is_halted()) {
+			detecting = false;
+			return false;
+		}
+		if(detector_info.stop_on_detect && detector_info.triggered) break;
+	}
 
 	detecting = false;
+	if(detector_info.stop_on_detect && detector_info.triggered) {
+		// stopped part way, back to where the sweep started
+		THEROBOT->reset_position_from_current_actuator_position();
+		for (size_t i = 0; i <= Y_AXIS; i++) delta[i] = 0;
+		delta[Y_AXIS]= start_y - THEROBOT->get_axis_position(Y_AXIS);
+		THEROBOT->delta_move(delta, detector_info.detect_rate, Y_AXIS + 1);
+		THECONVEYOR->wait_for_idle();
+		if(THEKERNEL->is_halted()) return false;
+	}
+	detector_info.stop_on_detect = false;
 	// switch off detector
 	switch_state = false;
     ok = PublicData::set_value(switch_checksum, detector_switch_checksum, state_checksum, &switch_state);
@@ -1504,11 +1606,25 @@ void ATCHandler::set_tool_offset()
     uint8_t ps;
     std::tie(px, py, pz, ps) = THEROBOT->get_last_probe_position();
     if (ps == 1) {
-        cur_tool_mz = pz;
+        set_tool_mz(pz, true);
+    }
+
+}
+
+// measured is false when it comes from the TLO cache, so its age stays that of the measurement
+void ATCHandler::set_tool_mz(float mz, bool measured)
+{
+        cur_tool_mz = mz;
         if (ref_tool_mz < 1) {
         	tool_offset = cur_tool_mz - ref_tool_mz;
         	const float offset[3] = {0.0, 0.0, tool_offset};
         	THEROBOT->saveToolOffset(offset, cur_tool_mz);
+        	if (measured && this->active_tool > 0 && this->active_tool <= this->tool_number && this->active_tool <= MAX_RACK_TOOLS) {
+        		rack_tool_t &t = rack[this->active_tool];
+        		t.tlo_mz = cur_tool_mz;
+        		t.tlo_time = this->seconds;
+        		t.tlo_valid = true;
+        	}
 		} else{
 			THEKERNEL->eeprom_data->REFMZ = -10;
 			THEKERNEL->write_eeprom_data();
@@ -1520,8 +1636,83 @@ void ATCHandler::set_tool_offset()
 			THEKERNEL->streams->printf("ERROR: warning, unexpected reference tool length found, reset machine then recalibrate tool\n");
 			return;
 		}
-    }
+}
+
+void ATCHandler::clear_tlo_cache()
+{
+	for (int i = 0; i <= MAX_RACK_TOOLS; i++) {
+		rack[i].tlo_valid = false;
+	}
+}
+
+// a rack tool measured recently enough, the probe (tool 0) is always calibrated as that also checks it works
+bool ATCHandler::tlo_cached(int tool) const
+{
+	if (this->tlo_cache_s == 0 || tool < 1 || tool > this->tool_number || tool > MAX_RACK_TOOLS || ref_tool_mz >= 1) {
+		return false;
+	}
+	const rack_tool_t &c = rack[tool];
+	return c.tlo_valid && this->seconds - c.tlo_time <= this->tlo_cache_s;
+}
+
+// the player indexes the tool changes of a job before playing it, say which tool comes after this one
+void ATCHandler::report_next_tool(unsigned int line)
+{
+	struct pad_tool_plan plan;
+	plan.after_line = line;
+	if (line == 0 || !PublicData::get_value(player_checksum, get_tool_plan_checksum, &plan)) {
+		return;
+	}
+	// at the first change, any tool the job needs that can not be changed to would stop it part way through
+	struct pad_job_scan job;
+	if (plan.index == 1 && PublicData::get_value(player_checksum, get_job_scan_checksum, &job)) {
+		for (int i = 0; i < job.scan->tool_count; i++) {
+			if (job.scan->tools[i] > this->max_manual_tool_number) {
+				THEKERNEL->streams->printf("WARNING: the job uses T%d, past the last manual tool\r\n", job.scan->tools[i]);
+			}
+		}
+	}
+	if (plan.next_tool < 0) {
+		THEKERNEL->streams->printf("Last tool change of the job (%u/%u)\r\n", plan.index, plan.count);
+	} else {
+		THEKERNEL->streams->printf("Next tool: T%d at line %lu (%u/%u)%s\r\n", plan.next_tool, plan.next_line, plan.index, plan.count,
+			this->tlo_cached(plan.next_tool) ? ", TLO cached" : "");
+	}
+}
+
+// M493.5 after fill_tlo_cache_scripts(), the last probe is the verify touch if there was one
+void ATCHandler::use_cached_tool_offset(int tool, bool verify)
+{
+	if (!tlo_cached(tool)) {
+		THEKERNEL->streams->printf("ERROR: No recent TLO for T%d, recalibrate tool\n", tool);
+		THEKERNEL->set_halt_reason(MANUAL);
+		THEKERNEL->call_event(ON_HALT, nullptr);
+		return;
+	}
+
+	const rack_tool_t &c = rack[tool];
+	if (verify) {
+		float px, py, pz;
+		uint8_t ps;
+		std::tie(px, py, pz, ps) = THEROBOT->get_last_probe_position();
+		if (ps != 1 || fabsf(pz - c.tlo_mz) > this->tlo_cache_tolerance) {
+			// it moved, finish the calibration with the slow touch from here
+			THEKERNEL->streams->printf("T%d TLO changed by %.3f, recalibrating\n", tool, ps == 1 ? pz - c.tlo_mz : NAN);
+			char buff[64];
+			snprintf(buff, sizeof(buff), "G91 G0 Z%.3f", THEROBOT->from_millimeters(probe_retract_mm));
+			Gcode lift(buff, &(StreamOutput::NullStream));
+			THEKERNEL->call_event(ON_GCODE_RECEIVED, &lift);
+			snprintf(buff, sizeof(buff), "G38.6 Z%.3f F%.3f", -1 - probe_retract_mm, probe_slow_rate);
+			Gcode touch(buff, &(StreamOutput::NullStream));
+			THEKERNEL->call_event(ON_GCODE_RECEIVED, &touch);
+			if (THEKERNEL->is_halted()) return;
+			set_tool_offset();
+			return;
+		}
+	}
 
+	set_tool_mz(c.tlo_mz, false);
+	THEKERNEL->streams->printf("T%d reusing TLO measured %lu s ago\n", tool, (unsigned long)(this->seconds - c.tlo_time));
 }
 
 void ATCHandler::set_tlo_by_offset(float z_axis_offset){
@@ -1642,11 +1833,17 @@ void ATCHandler::on_gcode_received(void *argument)
 						THEKERNEL->streams->printf("Start picking new tool: T%d\r\n", new_tool);
 						atc_status = PICK;
 						this->fill_manual_pickup_scripts(new_tool,true,auto_calibrate,custom_TLO);
+						this->report_next_tool(gcode->line);
 					} else if(new_tool >= 0){ //standard ATC
 						THEKERNEL->streams->printf("Start picking new tool: T%d\r\n", new_tool);
 						atc_status = PICK;
 						this->fill_pick_scripts(new_tool, true);
-						this->fill_cali_scripts(new_tool == 0 || new_tool >= 999990, false);
+						if (this->tlo_cached(new_tool)) {
+							this->fill_tlo_cache_scripts(new_tool);
+						} else {
+							this->fill_cali_scripts(new_tool == 0 || new_tool >= 999990, false);
+						}
+						this->report_next_tool(gcode->line);
 					} else if(new_tool == -1 && (THEKERNEL->get_laser_mode())) {
 						THEROBOT->push_state();
 						THEROBOT->get_axis_position(last_pos, 3);
@@ -1903,8 +2100,8 @@ void ATCHandler::on_gcode_received(void *argument)
 			if(THEKERNEL->factory_set->FuncSetting & (1<<2))	//ATC 
 			{
 				if (gcode->subcode == 0 || gcode->subcode == 1) {
-					// check true
-					if (!laser_detect()) {
+					// check true, done as soon as the tool is seen
+					if (!laser_detect(true)) {
 				        THEKERNEL->set_halt_reason(ATC_NO_TOOL);
 				        THEKERNEL->call_event(ON_HALT, nullptr);
 				        THEKERNEL->streams->printf("ERROR: Unexpected tool absence detected, please check tool rack!\n");
@@ -1967,7 +2164,10 @@ void ATCHandler::on_gcode_received(void *argument)
 				}
 			} else if (gcode->subcode == 3) { //set current tool offset
 				
-				
+				// set by hand, so a measurement cached for the tool no longer applies
+				if (this->active_tool >= 0 && this->active_tool <= MAX_RACK_TOOLS) {
+					rack[this->active_tool].tlo_valid = false;
+				}
 				if (gcode->has_letter('Z')) {
 					cur_tool_mz = gcode->get_value('Z');
 					if (ref_tool_mz < 1) {
@@ -1995,6 +2195,17 @@ void ATCHandler::on_gcode_received(void *argument)
 				THEKERNEL->streams->printf("current tool offset [%.3f] , reference tool offset [%.3f]\n",cur_tool_mz,ref_tool_mz);
 			} else if (gcode->subcode == 4) { //report current TLO
 				THEKERNEL->streams->printf("current tool offset [%.3f] , reference tool offset [%.3f]\n",cur_tool_mz,ref_tool_mz);
+			} else if (gcode->subcode == 5) { //use the cached TLO of tool T, V1 if the last probe was a touch to verify it
+				if (gcode->has_letter('T')) {
+					this->use_cached_tool_offset(gcode->get_int('T'), gcode->has_letter('V') && gcode->get_int('V') > 0);
+				}
+			} else if (gcode->subcode == 6) { //forget the cached TLOs, T for just one tool
+				if (gcode->has_letter('T')) {
+					int t = gcode->get_int('T');
+					if (t >= 0 && t <= MAX_RACK_TOOLS) rack[t].tlo_valid = false;
+				} else {
+					clear_tlo_cache();
+				}
 			}
 		} else if (gcode->m == 494) {
 			if(THEKERNEL->factory_set->FuncSetting & (1<<2))	//ATC 
@@ -2010,21 +2221,13 @@ void ATCHandler::on_gcode_received(void *argument)
 			}
 			else	//Manual Tool Change
 			{
-				// control probe laser
-				if (gcode->subcode == 0 ){
-					// open probe laser
-					bool b = true;
-	            	PublicData::set_value( switch_checksum, detector_switch_checksum, state_checksum, &b );
-	            	THEKERNEL->set_probeLaser(true);
-				}
-				else if( gcode->subcode == 1) {
-					// open probe laser
-					bool b = true;
-	            	PublicData::set_value( switch_checksum, detector_switch_checksum, state_checksum, &b );
-				} else if (gcode->subcode == 2) {
-					// close probe laser
-					bool b = false;
-	            	PublicData::set_value( switch_checksum, detector_switch_checksum, state_checksum, &b );
+				// control probe laser, in step with the motion rather than stopping it
+				if (gcode->subcode <= 2) {
+					Conveyor::event_fnc_t fnc = Conveyor::event_fnc_t::bind<ATCHandler, &ATCHandler::queued_probe_laser>(this);
+					if (!THECONVEYOR->queue_event(fnc, gcode->subcode)) {
+						THECONVEYOR->wait_for_idle();
+						fnc(gcode->subcode);
+					}
 				}
 
 			}
@@ -2147,7 +2350,8 @@ void ATCHandler::on_gcode_received(void *argument)
 			            }
 			            if (leveling) {
 			            	gcode->stream->printf("Auto leveling, grid: %d * %d height: %1.2f\r\n", x_level_grids, y_level_grids, z_level_height);
-		            		this->fill_autolevel_scripts(x_path_pos, y_path_pos, x_level_size, y_level_size, x_level_grids, y_level_grids, z_level_height);
+		            		this->fill_autolevel_scripts(x_path_pos, y_path_pos, x_level_size, y_level_size, x_level_grids, y_level_grids, z_level_height,
+		            			gcode->has_letter('L') ? gcode->get_int('L') : 0);
 			            }
 			            if (gcode->has_letter('P')) {
 			            	gcode->stream->printf("goto x and y clearance first\r\n");
@@ -2232,7 +2436,7 @@ void ATCHandler::on_gcode_received(void *argument)
 			{
 				THEKERNEL->streams->printf("probe -- mx:%1.1f my:%1.1f mz:%1.1f\n", probe_mx_mm, probe_my_mm, probe_mz_mm);
 				for (int i = 0; i <=  tool_number; i ++) {
-					THEKERNEL->streams->printf("tool%d -- mx:%1.1f my:%1.1f mz:%1.1f\n", atc_tools[i].num, atc_tools[i].mx_mm, atc_tools[i].my_mm, atc_tools[i].mz_mm);
+					THEKERNEL->streams->printf("tool%d -- mx:%1.1f my:%1.1f mz:%1.1f\n", i, rack[i].mx_mm, rack[i].my_mm, rack[i].mz_mm);
 				}
 			}
 			else if (gcode->subcode == 3) 
@@ -2311,22 +2515,38 @@ void ATCHandler::on_main_loop(void *argument)
             }
         }
 
+        if (this->script_queue.overflowed()) {
+        	// running what did fit of a routine would be worse than not running it
+        	THEKERNEL->streams->printf("ERROR: ATC script too long\n");
+        	this->clear_script_queue();
+        	THEKERNEL->set_halt_reason(MANUAL);
+        	THEKERNEL->call_event(ON_HALT, nullptr);
+        	return;
+        }
+
         while (!this->script_queue.empty()) {
-        	THEKERNEL->streams->printf("%s\r\n", this->script_queue.front().c_str());
+        	THEKERNEL->streams->printf("%s\r\n", this->script_queue.front());
 			struct SerialMessage message;
 			message.message = this->script_queue.front();
 			message.stream = THEKERNEL->streams;
 			message.line = 0;
+			bool move = is_script_move(message.message.c_str());
 			this->script_queue.pop();
 
 			// waits for the queue to have enough room
 			THEKERNEL->call_event(ON_CONSOLE_LINE_RECEIVED, &message);
+
+			// moves that follow each other go to the planner together, so it can plan through the junction
+			// between them instead of maybe starting the first and having to stop at its end
+			if (move && !THEKERNEL->is_halted() && !this->script_queue.empty() && is_script_move(this->script_queue.front())) {
+				continue;
+			}
             return;
         }
 
 		if (this->atc_status != AUTOMATION) {
-	        // return to z clearance position
-	        rapid_move(true, NAN, NAN, this->clearance_z, NAN, NAN);
+	        // return to z clearance position, the XY move is queued straight after it
+	        rapid_move(true, NAN, NAN, this->clearance_z, NAN, NAN, false);
 
 	        // return to saved x and y position
 	        rapid_move(true, last_pos[0], last_pos[1], NAN, NAN, NAN);
@@ -2350,7 +2570,7 @@ void ATCHandler::on_main_loop(void *argument)
 		THEKERNEL->streams->printf("G28 means goto clearance position on CARVERA\n");
 		THEROBOT->push_state();
 		// goto z clearance
-		rapid_move(true, NAN, NAN, this->clearance_z, NAN, NAN);
+		rapid_move(true, NAN, NAN, this->clearance_z, NAN, NAN, false);
 		// goto x and y clearance
 		rapid_move(true, this->clearance_x, this->clearance_y, NAN, NAN, NAN);
 		THECONVEYOR->wait_for_idle();
@@ -2564,7 +2784,8 @@ void ATCHandler::on_main_loop(void *argument)
 // issue a coordinated move directly to robot, and return when done
 // Only move the coordinates that are passed in as not nan
 // NOTE must use G53 to force move in machine coordinates and ignore any WCS offsets
-void ATCHandler::rapid_move(bool mc, float x, float y, float z, float a, float b)
+// wait is false to queue another move after this one without stopping in between
+void ATCHandler::rapid_move(bool mc, float x, float y, float z, float a, float b, bool wait)
 {
     #define CMDLEN 128
     char *cmd= new char[CMDLEN]; // use heap here to reduce stack usage
@@ -2606,7 +2827,9 @@ void ATCHandler::rapid_move(bool mc, float x, float y, float z, float a, float b
     message.stream = &(StreamOutput::NullStream);
     message.line = 0;
     THEKERNEL->call_event(ON_CONSOLE_LINE_RECEIVED, &message );
-    THEKERNEL->conveyor->wait_for_idle();
+    if (wait) {
+        THEKERNEL->conveyor->wait_for_idle();
+    }
 
 }
 
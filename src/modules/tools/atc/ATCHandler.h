@@ -7,6 +7,7 @@ using namespace std;
 #include <queue>
 #include "Pin.h"
 #include "Gcode.h"
+#include "ScriptQueue.h"
 
 class ATCHandler : public Module
 {
@@ -66,6 +67,7 @@ private:
     uint32_t beep_beep(uint32_t dummy);
 
     void switch_probe_laser(bool state);
+    void queued_probe_laser(uint32_t subcode);
 
     // clamp actions
     void clamp_tool();
@@ -73,7 +75,8 @@ private:
     void home_clamp();
 
     // laser detect
-    bool laser_detect();
+    // sweeps Y across the tool sensor, true if it saw a tool. With stop_on_detect the sweep ends as soon as it does
+    bool laser_detect(bool stop_on_detect = false);
 
     // probe check
     bool probe_detect();
@@ -84,12 +87,18 @@ private:
 
     // set tool offset afteer calibrating
     void set_tool_offset();
+    void set_tool_mz(float mz, bool measured);
+    bool tlo_cached(int tool) const;
+    void use_cached_tool_offset(int tool, bool verify);
+    void clear_tlo_cache();
+    void report_next_tool(unsigned int line);
 
     //
     void fill_change_scripts(int new_tool, bool clear_z);
     void fill_drop_scripts(int old_tool);
     void fill_pick_scripts(int new_tool, bool clear_z);
     void fill_cali_scripts(bool is_probe, bool clear_z);
+    void fill_tlo_cache_scripts(int tool);
 
     //
     void fill_manual_drop_scripts(int old_tool);
@@ -104,7 +113,8 @@ private:
     //
     void set_tlo_by_offset(float z_axis_offset);
 
-    void fill_autolevel_scripts(float x_pos, float y_pos, float x_size, float y_size, int x_grids, int y_grids, float height);
+    // map > 0 reuses leveling map number map when it still fits the stock, see M375.2
+    void fill_autolevel_scripts(float x_pos, float y_pos, float x_size, float y_size, int x_grids, int y_grids, float height, int map = 0);
     void fill_goto_origin_scripts(float x_pos, float y_pos);
 
     void fill_calibrate_probe_anchor_scripts(bool invert_probe);
@@ -116,14 +126,16 @@ private:
     void calibrate_set_value(Gcode *gcode);
 
     void clear_script_queue();
+    uint32_t script_key(int tool, bool clear_z) const;
 
-    void rapid_move(bool mc, float x, float y, float z, float a, float b);
+    void rapid_move(bool mc, float x, float y, float z, float a, float b, bool wait= true);
     void beep_complete();
     void beep_alarm();
     void beep_tool_change(int tool);
     void beep_error();
 
-    std::queue<string> script_queue;
+    ScriptQueue script_queue;
+    ScriptCache script_cache;
 
     uint16_t debounce;
     bool atc_homing;
@@ -154,7 +166,9 @@ private:
         Pin detect_pin;
         float detect_rate;
         float detect_travel;
-        bool triggered;
+        volatile bool triggered;
+        volatile bool stop_on_detect;   // stop the sweep when it triggers
+        bool stop_enable;
     };
     detector_info_t detector_info;
 
@@ -195,15 +209,6 @@ private:
 
     bool skip_path_origin;
 
-    struct atc_tool {
-    	int num;
-    	float mx_mm;
-    	float my_mm;
-    	float mz_mm;
-    };
-
-    vector<struct atc_tool> atc_tools;
-
     int active_tool;
     int target_tool;
     int tool_number;
@@ -217,6 +222,24 @@ private:
     float ref_tool_mz;
     float cur_tool_mz;
     float tool_offset;
+
+    // each rack tool by its number, 0 is the probe's: where its pocket is and the TLO it was last measured
+    // with this power cycle, so picking it again can skip or shorten the calibration, anything that may have
+    // moved a tool or the machine clears that
+    static const int MAX_RACK_TOOLS = 8;
+    struct rack_tool_t {
+        float mx_mm;
+        float my_mm;
+        float mz_mm;
+        float tlo_mz;       // cur_tool_mz it measured
+        uint32_t tlo_time;  // seconds when it was measured
+        bool tlo_valid;
+    };
+    rack_tool_t rack[MAX_RACK_TOOLS + 1];
+    volatile uint32_t seconds;  // since power on, counted in countdown_probe_laser()
+    uint32_t tlo_cache_s;       // how old a measurement may be to reuse, 0 never reuses
+    float tlo_cache_tolerance;  // how far a verify touch may be from it
+    bool tlo_cache_verify;      // check a reused TLO with one fast touch
     int beep_state;
     int beep_count;
 
@@ -0,0 +1,123 @@
+#include "ScriptQueue.h"
+
+#include "platform_memory.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+ScriptQueue::ScriptQueue()
+{
+    buf = nullptr;
+    in_ahb = false;
+    overflow = false;
+    head = tail = 0;
+    total = 0;
+}
+
+ScriptQueue::~ScriptQueue()
+{
+    if(buf == nullptr) return;
+    if(in_ahb) AHB.dealloc(buf);
+    else free(buf);
+}
+
+// the modules are made before AHB is busy, but only allocate once a routine is actually run
+bool ScriptQueue::allocate()
+{
+    if(buf != nullptr) return true;
+    buf = (char *)AHB.alloc(CAPACITY);
+    in_ahb = (buf != nullptr);
+    if(buf == nullptr) buf = (char *)malloc(CAPACITY);
+    return buf != nullptr;
+}
+
+bool ScriptQueue::make_room(size_t len)
+{
+    if(!allocate() || len > CAPACITY) {
+        overflow = true;
+        return false;
+    }
+
+    if(tail + len > CAPACITY) {
+        // move what is still queued down to the start to make room
+        memmove(buf, buf + head, tail - head);
+        tail -= head;
+        head = 0;
+        if(tail + len > CAPACITY) {
+            overflow = true;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ScriptQueue::push(const char *line)
+{
+    return push_block(line, strlen(line) + 1);
+}
+
+bool ScriptQueue::push_block(const char *lines, size_t len)
+{
+    if(!make_room(len)) return false;
+
+    memcpy(buf + tail, lines, len);
+    tail += len;
+    total += len;
+    return true;
+}
+
+size_t ScriptQueue::copy_since(uint32_t mark, char *dst, size_t max) const
+{
+    size_t len = total - mark;
+    // all of it has to still be queued, and nothing lost to an overflow
+    if(overflow || len > max || len > (size_t)(tail - head)) return 0;
+    memcpy(dst, buf + tail - len, len);
+    return len;
+}
+
+void ScriptQueue::pop()
+{
+    if(empty()) return;
+    head += strlen(buf + head) + 1;
+    if(head == tail) head = tail = 0;
+}
+
+void ScriptQueue::clear()
+{
+    head = tail = 0;
+    overflow = false;
+}
+
+ScriptCache::ScriptCache()
+{
+    buf = nullptr;
+    clear();
+}
+
+bool ScriptCache::get(int slot, uint32_t key, ScriptQueue &q)
+{
+    slot_t &s = slots[slot];
+    if(!s.valid || s.key != key) return false;
+    return q.push_block(buf + slot * SLOT_SIZE, s.len);
+}
+
+void ScriptCache::put(int slot, uint32_t key, const ScriptQueue &q, uint32_t mark)
+{
+    if(buf == nullptr) {
+        // only AHB, if there is no room it just is not cached
+        buf = (char *)AHB.alloc(SLOT_SIZE * NUM_SLOTS);
+        if(buf == nullptr) return;
+    }
+
+    slot_t &s = slots[slot];
+    s.len = q.copy_since(mark, buf + slot * SLOT_SIZE, SLOT_SIZE);
+    s.key = key;
+    s.valid = s.len > 0;
+}
+
+void ScriptCache::clear()
+{
+    for (auto &s : slots) {
+        s.valid = false;
+    }
+}
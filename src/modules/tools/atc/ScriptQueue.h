@@ -0,0 +1,78 @@
+#ifndef _SCRIPTQUEUE_H
+#define _SCRIPTQUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * FIFO of the command lines a tool change, calibration or probing routine is made of.
+ * The lines are copied one after another into a fixed buffer in AHB, allocated once,
+ * instead of a heap string each, so the routines do not churn the heap.
+ * Used like the std::queue<string> it replaced, front() is valid until the next pop().
+ */
+class ScriptQueue
+{
+public:
+    static const size_t CAPACITY = 4096;
+
+    ScriptQueue();
+    ~ScriptQueue();
+
+    // false and the line is dropped if it does not fit, overflowed() then stays true until clear()
+    bool push(const char *line);
+    bool empty() const { return head == tail; }
+    const char *front() const { return buf + head; }
+    void pop();
+    void clear();
+    bool overflowed() const { return overflow; }
+
+    // total bytes pushed so far, the lines pushed since a mark are the last pushed() - mark bytes
+    uint32_t pushed() const { return total; }
+    // copy the lines pushed since mark to dst, returns their size or 0 if they do not fit in max
+    size_t copy_since(uint32_t mark, char *dst, size_t max) const;
+    // push a block of nul terminated lines as copied out by copy_since()
+    bool push_block(const char *lines, size_t len);
+
+private:
+    bool allocate();
+    bool make_room(size_t len);
+
+    char *buf;
+    bool in_ahb;
+    bool overflow;
+    uint16_t head;  // offset of the first line
+    uint16_t tail;  // offset past the last line
+    uint32_t total;
+};
+
+/*
+ * The text of the last few routines that only depend on the config and a few arguments (which tool,
+ * the units, ...), so repeating a tool change copies the lines instead of formatting them all again.
+ * Each routine has one slot, cleared when the config is reloaded or a position it uses is changed.
+ */
+class ScriptCache
+{
+public:
+    enum { DROP, PICK, CALI, NUM_SLOTS };
+    static const size_t SLOT_SIZE = 384;
+
+    ScriptCache();
+
+    // pushes the cached lines for slot if they were made for key
+    bool get(int slot, uint32_t key, ScriptQueue &q);
+    // caches what has been pushed to q since mark for slot and key
+    void put(int slot, uint32_t key, const ScriptQueue &q, uint32_t mark);
+    void clear();
+
+private:
+    struct slot_t {
+        uint32_t key;
+        uint16_t len;
+        bool valid;
+    };
+
+    char *buf;
+    slot_t slots[NUM_SLOTS];
+};
+
+#endif
@@ -17,8 +17,11 @@
 #include "StepperMotor.h"
 #include "StreamOutputPool.h"
 #include "nuts_bolts.h"
+#include "PublicData.h"
+#include "SpindlePublicAccess.h"
 
 #include <math.h> /* fmod */
+#include "us_ticker_api.h"
 
 
 
@@ -34,6 +37,8 @@
 #define drillingcycles_checksum CHECKSUM("drillingcycles")
 #define enable_checksum         CHECKSUM("enable")
 #define dwell_units_checksum    CHECKSUM("dwell_units")
+#define peck_retract_checksum   CHECKSUM("peck_retract")
+#define tap_retract_factor_checksum CHECKSUM("tap_retract_factor")
 
 Drillingcycles::Drillingcycles() {}
 
@@ -58,6 +63,7 @@ void Drillingcycles::on_module_loaded()
 
     this->initial_z = 0;
     this->r_plane   = 0;
+    this->line      = 0;
 
     this->reset_sticky();
 }
@@ -67,6 +73,10 @@ void Drillingcycles::on_config_reload(void *argument)
     // take the dwell units configured by user, or select S (seconds) by default
     string dwell_units = THEKERNEL->config->value(drillingcycles_checksum, dwell_units_checksum)->by_default("S")->as_string();
     this->dwell_units  = (dwell_units == "P") ? DWELL_UNITS_P : DWELL_UNITS_S;
+    // G73 chip breaking retract in mm
+    this->peck_retract = THEKERNEL->config->value(drillingcycles_checksum, peck_retract_checksum)->by_default(0.5F)->as_number();
+    // self reversing tapping heads usually come out faster than they went in
+    this->tap_retract_factor = THEKERNEL->config->value(drillingcycles_checksum, tap_retract_factor_checksum)->by_default(1.0F)->as_number();
 }
 
 /*
@@ -75,10 +85,15 @@ http://www.tormach.com/g81_g89_backgroung.html
 
 /!\ This code expects a clean gcode, no fail safe at this time.
 
-Implemented     : G80-83, G98, G99
+Implemented     : G73, G74, G80-84, G98, G99
 Absolute mode   : yes
 Relative mode   : no
 Incremental (L) : no
+
+G73 pecks like G83 but only backs off peck_retract between pecks to break the chip.
+G84/G74 feed in at the pitch (K) times the measured spindle RPM, or at F if there is no K,
+dwell P and feed back out to R. The spindle only turns one way, so these are for self
+reversing or tension/compression tapping heads, G74 being the same move for a left hand tap.
 */
 
 /* reset all sticky values, called before each cycle */
@@ -89,16 +104,18 @@ void Drillingcycles::reset_sticky()
     this->sticky_f = 0; // feedrate
     this->sticky_q = 0; // peck drilling increment
     this->sticky_p = 0; // dwell in seconds
+    this->sticky_k = 0; // thread pitch
 }
 
 /* update all sticky values, called before each hole */
 void Drillingcycles::update_sticky(Gcode *gcode)
 {
-    if (gcode->has_letter('Z')) this->sticky_z = gcode->get_value('Z');
-    if (gcode->has_letter('R')) this->sticky_r = gcode->get_value('R');
-    if (gcode->has_letter('F')) this->sticky_f = gcode->get_value('F');
-    if (gcode->has_letter('Q')) this->sticky_q = gcode->get_value('Q');
+    if (gcode->has_letter('Z')) this->sticky_z = THEROBOT->to_millimeters(gcode->get_value('Z'));
+    if (gcode->has_letter('R')) this->sticky_r = THEROBOT->to_millimeters(gcode->get_value('R'));
+    if (gcode->has_letter('F')) this->sticky_f = THEROBOT->to_millimeters(gcode->get_value('F'));
+    if (gcode->has_letter('Q')) this->sticky_q = THEROBOT->to_millimeters(gcode->get_value('Q'));
     if (gcode->has_letter('P')) this->sticky_p = gcode->get_value('P');
+    if (gcode->has_letter('K')) this->sticky_k = THEROBOT->to_millimeters(gcode->get_value('K'));
 
     // set retract plane
     if (this->retract_type == RETRACT_TO_Z)
@@ -107,27 +124,34 @@ void Drillingcycles::update_sticky(Gcode *gcode)
         this->r_plane = this->sticky_r;
 }
 
-/* send a formatted Gcode line */
-int Drillingcycles::send_gcode(const char* format, ...)
+/*
+The moves are queued straight to the planner rather than made into G-code lines and parsed again,
+so one hole after another is only the blocks and the planner blends the retract into the next rapid.
+NAN leaves an axis where it is, a move to where we already are queues nothing.
+*/
+void Drillingcycles::rapid_to(float x, float y, float z)
+{
+    THEROBOT->cycle_move(x, y, z, 0, this->line);
+}
+
+void Drillingcycles::feed_to(float z)
 {
-    // handle variable arguments
-    va_list args;
-    va_start(args, format);
-    // make the formatted string
-    char line[32]; // max length for an gcode line
-    int n = vsnprintf(line, sizeof(line), format, args);
-    va_end(args);
-    // debug, print the gcode sended
-    //THEKERNEL->streams->printf(">>> %s\r\n", line);
-    // make gcode object and send it (right way)
-    Gcode gc(line, &(StreamOutput::NullStream));
-    THEKERNEL->call_event(ON_GCODE_RECEIVED, &gc);
-    // return the gcode srting length
-    return n;
+    THEROBOT->cycle_move(NAN, NAN, z, this->sticky_f, this->line);
 }
 
-/* G83: peck drilling */
-void Drillingcycles::peck_hole()
+/* wait at the bottom of the hole, the same as G4 once the moves so far are done */
+void Drillingcycles::dwell(float seconds)
+{
+    THEKERNEL->conveyor->wait_for_idle();
+    uint32_t start = us_ticker_read();
+    while ((us_ticker_read() - start) < (uint32_t)(seconds * 1000000.0F)) {
+        THEKERNEL->call_event(ON_IDLE, this);
+        if (THEKERNEL->is_halted()) return;
+    }
+}
+
+/* G83: peck drilling, G73: chip breaking */
+bool Drillingcycles::peck_hole(bool chip_break)
 {
     // start values
     float depth  = this->sticky_r - this->sticky_z; // travel depth
@@ -140,59 +164,104 @@ void Drillingcycles::peck_hole()
         // decrement depth
         z_pos -= this->sticky_q;
         // feed down to depth at feedrate (F and Z)
-        this->send_gcode("G1 F%1.4f Z%1.4f", this->sticky_f, z_pos);
-        // rapids to retract position (R)
-        this->send_gcode("G0 Z%1.4f", this->sticky_r);
+        this->feed_to(z_pos);
+        // rapids to retract position (R), or just back off a little to break the chip
+        if (chip_break)
+            this->rapid_to(NAN, NAN, std::min(z_pos + this->peck_retract, this->sticky_r));
+        else
+            this->rapid_to(NAN, NAN, this->sticky_r);
+        // stop queuing pecks once halted
+        if (THEKERNEL->is_halted()) return false;
     }
 
-    // final depth not reached
-    if (rest > 0) {
+    // final depth not reached, also when the depth is a whole number of pecks
+    if (rest > 0 || z_pos > this->sticky_z) {
         // feed down to final depth at feedrate (F and Z)
-        this->send_gcode("G1 F%1.4f Z%1.4f", this->sticky_f, this->sticky_z);
+        this->feed_to(this->sticky_z);
     }
+    return !THEKERNEL->is_halted();
 }
 
-void Drillingcycles::make_hole(Gcode *gcode)
+/* the feed for tapping, false if the spindle is not turning */
+bool Drillingcycles::tap_feed(float &feed)
 {
-    // compile X and Y values
-    char x[16] = "";
-    char y[16] = "";
-    if (gcode->has_letter('X'))
-        snprintf(x, sizeof(x), " X%1.4f", gcode->get_value('X'));
-    if (gcode->has_letter('Y'))
-        snprintf(y, sizeof(y), " Y%1.4f", gcode->get_value('Y'));
+    struct spindle_status ss;
+    if (!PublicData::get_value(pwm_spindle_control_checksum, get_spindle_status_checksum, &ss) || !ss.state)
+        return false;
+
+    if (this->sticky_k > 0) {
+        // one pitch per turn at the speed the spindle is really doing, the target until it reports one
+        float rpm = (ss.current_rpm > 0) ? ss.current_rpm : ss.target_rpm;
+        feed = rpm * this->sticky_k;
+    } else {
+        feed = this->sticky_f;
+    }
+    return feed > 0;
+}
+
+/* G84/G74: tapping, the overrides must not change the feed or it would not match the pitch */
+void Drillingcycles::tap_hole(float feed)
+{
+    // feed down to depth at the tapping feed
+    THEROBOT->cycle_move(NAN, NAN, this->sticky_z, feed, this->line, true);
+    if (THEKERNEL->is_halted()) return;
+
+    // dwell while the head reverses
+    if (this->sticky_p > 0) {
+        this->dwell(this->dwell_units == DWELL_UNITS_S ? this->sticky_p : this->sticky_p / 1000.0F);
+    }
+
+    // feed back out to R
+    THEROBOT->cycle_move(NAN, NAN, this->sticky_r, feed * this->tap_retract_factor, this->line, true);
+}
+
+void Drillingcycles::make_hole(Gcode *gcode, int code)
+{
+    this->line = gcode->line;
+
+    // tapping needs the spindle running, check before moving to the hole
+    float tap = 0;
+    bool tapping = (code == 84 || code == 74);
+    if (tapping && !this->tap_feed(tap)) {
+        gcode->stream->printf("Drillingcycles: spindle must be turning to tap.\r\n");
+        gcode->stream->printf("Drillingcycles: skip hole...\r\n");
+        return;
+    }
+
+    // X and Y values, in mm like the sticky ones
+    float x = gcode->has_letter('X') ? THEROBOT->to_millimeters(gcode->get_value('X')) : NAN;
+    float y = gcode->has_letter('Y') ? THEROBOT->to_millimeters(gcode->get_value('Y')) : NAN;
 
     // rapids to X/Y
-    this->send_gcode("G0%s%s", x, y);
-    // rapids to retract position (R)
-    this->send_gcode("G0 Z%1.4f", this->sticky_r);
+    this->rapid_to(x, y, NAN);
+    // rapids to retract position (R), nothing is queued if the last hole already left us there
+    this->rapid_to(NAN, NAN, this->sticky_r);
+
+    if (tapping) {
+        this->tap_hole(tap);
+        if (THEKERNEL->is_halted()) return;
+        // rapids retract at R-Plane (Initial-Z or R)
+        this->rapid_to(NAN, NAN, this->r_plane);
+        return;
+    }
 
     // if peck drilling
-    if (this->sticky_q > 0)
-        this->peck_hole();
-    else
+    if (this->sticky_q > 0) {
+        if (!this->peck_hole(code == 73)) return;
+    } else {
         // feed down to depth at feedrate (F and Z)
-        this->send_gcode("G1 F%1.4f Z%1.4f", this->sticky_f, this->sticky_z);
+        this->feed_to(this->sticky_z);
+        if (THEKERNEL->is_halted()) return;
+    }
 
     // if dwell, wait for x seconds
     if (this->sticky_p > 0) {
-        if (this->dwell_units == DWELL_UNITS_S){
-            // dwell exprimed in seconds
-            this->send_gcode("G4 S%f", this->sticky_p);
-        }else{
-            // dwell exprimed in milliseconds
-            if(THEKERNEL->is_grbl_mode()) {
-                // in grbl mode (and linuxcnc) P is decimal seconds
-                this->send_gcode("G4 P%f", this->sticky_p * 1000.0);
-            }else{
-                // in reprap P is milliseconds, they always have to be different!
-                this->send_gcode("G4 P%f", this->sticky_p);
-            }
-        }
+        // dwell exprimed in seconds, or in milliseconds
+        this->dwell(this->dwell_units == DWELL_UNITS_S ? this->sticky_p : this->sticky_p / 1000.0F);
     }
 
     // rapids retract at R-Plane (Initial-Z or R)
-    this->send_gcode("G0 Z%1.4f", this->r_plane);
+    this->rapid_to(NAN, NAN, this->r_plane);
 }
 
 void Drillingcycles::on_gcode_received(void* argument)
@@ -233,7 +302,7 @@ void Drillingcycles::on_gcode_received(void* argument)
         // if retract position is R-Plane
         if (this->retract_type == RETRACT_TO_R) {
             // rapids retract at Initial-Z to avoid futur collisions
-            this->send_gcode("G0 Z%1.4f", this->initial_z);
+            this->rapid_to(NAN, NAN, this->initial_z);
         }
     }
     // in cycle
@@ -246,9 +315,9 @@ void Drillingcycles::on_gcode_received(void* argument)
             return;
         }
         // implemented cycles
-        if (code == 81 || code == 82 || code == 83) {
+        if (code == 73 || code == 74 || code == 81 || code == 82 || code == 83 || code == 84) {
             this->update_sticky(gcode);
-            this->make_hole(gcode);
+            this->make_hole(gcode, code);
         }
     }
 }
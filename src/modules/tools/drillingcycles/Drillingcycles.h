@@ -24,9 +24,13 @@ class Drillingcycles : public Module
         void on_gcode_received(void *argument);
         void reset_sticky();
         void update_sticky(Gcode *gcode);
-        int  send_gcode(const char* format, ...);
-        void make_hole(Gcode *gcode);
-        void peck_hole();
+        void rapid_to(float x, float y, float z);
+        void feed_to(float z);
+        void dwell(float seconds);
+        void make_hole(Gcode *gcode, int code);
+        bool peck_hole(bool chip_break);
+        bool tap_feed(float &feed);
+        void tap_hole(float feed);
 
         bool cycle_started; // cycle status
         int  retract_type;  // rretract type
@@ -34,14 +38,20 @@ class Drillingcycles : public Module
         float initial_z;    // Initial-Z
         float r_plane;      // R-Plane
 
+        // positions are in mm in the work coordinates and the feedrate in mm/min
         float sticky_z;     // final depth
         float sticky_r;     // R-Plane
         float sticky_f;     // feedrate
 
         float sticky_q;     // depth increment
         float sticky_p;     // dwell pause
+        float sticky_k;     // thread pitch for tapping
+
+        float peck_retract;       // how far G73 backs off after each peck
+        float tap_retract_factor; // how much faster than in the tapping head comes out
 
         int   dwell_units;  // units for dwell
+        unsigned int line;  // line of the hole being made, for the moves it queues
 };
 
 #endif
@@ -29,6 +29,10 @@
 #include "StepTicker.h"
 #include "BaseSolution.h"
 #include "SerialMessage.h"
+#include "InterruptIn.h"
+#include "IrqPriority.h"
+#include "us_ticker_api.h"
+#include "HomeRecord.h"
 
 #include <ctype.h>
 #include <algorithm>
@@ -61,11 +65,15 @@ enum DEFNS { MIN_PIN, MAX_PIN, MAX_TRAVEL, FAST_RATE, SLOW_RATE, RETRACT, DIRECT
 
 #define endstop_debounce_count_checksum  CHECKSUM("endstop_debounce_count")
 #define endstop_debounce_ms_checksum     CHECKSUM("endstop_debounce_ms")
+#define endstop_interrupt_checksum       CHECKSUM("endstop_interrupt")
 
 #define home_z_first_checksum            CHECKSUM("home_z_first")
+#define home_together_checksum           CHECKSUM("home_all_together")
 #define homing_order_checksum            CHECKSUM("homing_order")
 #define move_to_origin_checksum          CHECKSUM("move_to_origin_after_home")
 #define park_after_home_checksum         CHECKSUM("park_after_home")
+#define quick_reference_axis_checksum    CHECKSUM("quick_reference_axis")
+#define quick_reference_tolerance_checksum CHECKSUM("quick_reference_tolerance")
 
 #define alpha_trim_checksum              CHECKSUM("alpha_trim_mm")
 #define beta_trim_checksum               CHECKSUM("beta_trim_mm")
@@ -111,7 +119,14 @@ enum STATES {
 
 Endstops::Endstops()
 {
-    this->status = NOT_HOMING;
+    set_status(NOT_HOMING);
+}
+
+// the kernel keeps the machine state from this rather than asking for it every time
+void Endstops::set_status(char s)
+{
+    this->status = s;
+    THEKERNEL->set_homing(s != NOT_HOMING);
 }
 
 void Endstops::on_module_loaded()
@@ -134,9 +149,16 @@ void Endstops::on_module_loaded()
     register_for_event(ON_GCODE_RECEIVED);
     register_for_event(ON_GET_PUBLIC_DATA);
     register_for_event(ON_SET_PUBLIC_DATA);
+    register_for_event(ON_HALT);
+    register_for_event(ON_ENABLE);
+
+    take_home_record();
 
 
     THEKERNEL->slow_ticker->attach(1000, this, &Endstops::read_endstops);
+    if(THEKERNEL->config->value(endstop_interrupt_checksum)->by_default(true)->as_bool()) {
+        attach_endstop_interrupts();
+    }
 
     // load g28 data from eeprom
 //    this->g28_position[0] = THEKERNEL->eeprom_data->G28[0];
@@ -214,6 +236,7 @@ bool Endstops::load_old_config()
 	
 	            // init struct
 	            info->debounce = 0;
+	            info->timing = false;
 	            info->axis =	i >Z_AXIS ? 'A'+i-3 : 'X'+i;
 	            info->axis_index = i;
 	
@@ -283,6 +306,7 @@ bool Endstops::load_old_config()
 	
 	            // init struct
 	            info->debounce = 0;
+	            info->timing = false;
 	            info->axis = 'X' + i;
 	            info->axis_index = i;
 	
@@ -387,6 +411,7 @@ bool Endstops::load_config()
 
         // init pin struct
         pin_info->debounce= 0;
+        pin_info->timing= false;
         pin_info->axis= toupper(axis[0]);
         pin_info->axis_index= i;
 
@@ -488,6 +513,9 @@ void Endstops::get_global_configs()
     this->is_scara=  THEKERNEL->config->value(scara_homing_checksum)->by_default(false)->as_bool();
 
     this->home_z_first= THEKERNEL->config->value(home_z_first_checksum)->by_default(true)->as_bool();
+    // every axis seeks its endstop at once and stops on its own, cartesians only as the others home one motor at a time
+    this->home_together= THEKERNEL->config->value(home_together_checksum)->by_default(false)->as_bool() &&
+                         !(this->is_corexy || this->is_delta || this->is_rdelta || this->is_scara);
 
     this->trim_mm[0] = THEKERNEL->config->value(alpha_trim_checksum)->by_default(0)->as_number();
     this->trim_mm[1] = THEKERNEL->config->value(beta_trim_checksum)->by_default(0)->as_number();
@@ -520,6 +548,46 @@ void Endstops::get_global_configs()
     }else{
         this->park_after_home= false;
     }
+
+    // after a reset one touch on this axis takes back the kept position, if it lands within the tolerance of where it should
+    string qaxis = THEKERNEL->config->value(quick_reference_axis_checksum)->by_default("Z")->as_string();
+    this->quick_reference_axis = qaxis.empty() ? 'Z' : toupper(qaxis[0]);
+    this->quick_reference_tolerance = THEKERNEL->config->value(quick_reference_tolerance_checksum)->by_default(0.1F)->as_number();
+    this->position_kept = false;
+}
+
+// put the actuators back where the last software reset left them, they stay unhomed until G28.7 has checked them
+void Endstops::take_home_record()
+{
+    float pos[k_max_actuators];
+    size_t n = THEROBOT->get_number_registered_motors();
+    if(is_delta || is_rdelta || is_scara || !HomeRecord::take(pos, n)) return;
+
+    ActuatorCoordinates ac;
+    for (size_t i = 0; i < k_max_actuators; ++i) ac[i] = i < n ? pos[i] : NAN;
+    THEROBOT->reset_actuator_position(ac);
+    this->position_kept = true;
+    THEKERNEL->streams->printf("Position kept over the reset, G28.7 checks it with one touch on %c instead of homing\r\n", quick_reference_axis);
+}
+
+void Endstops::on_halt(void *argument)
+{
+    if(argument != nullptr || !HomeRecord::armed()) return;
+
+    // the drivers go off on any halt, these are the ones that may also have lost steps while they were on
+    uint8_t reason = THEKERNEL->get_halt_reason();
+    bool lost = reason > 20 || reason == HOME_FAIL || reason == E_STOP || reason == CRASH_DETECTED;
+    // stopped dead part way through a move, the planner had got further than the motors
+    for (auto a : THEROBOT->actuators) {
+        if((int32_t)a->get_current_step() != a->get_last_milestone_steps()) lost = true;
+    }
+    if(lost) HomeRecord::arm(false);
+}
+
+void Endstops::on_enable(void *argument)
+{
+    // bit0 set turns them all on, anything else turns some off and they may have been moved by hand
+    if((uint32_t)(uintptr_t)argument != 0x01) HomeRecord::arm(false);
 }
 
 bool Endstops::debounced_get(Pin *pin)
@@ -550,7 +618,7 @@ void Endstops::on_idle(void *argument)
 
                 if(i->debounce++ > debounce_count) { // can use less as it calls on_idle in between
                     // clear the state
-                    this->status = NOT_HOMING;
+                    set_status(NOT_HOMING);
                 }
             }
         }
@@ -597,7 +665,7 @@ void Endstops::on_idle(void *argument)
 	                }else{
 	                    THEKERNEL->streams->printf("ALARM: Hard limit %c%c\n", STEPPER[i->axis_index]->which_direction() ? '-' : '+', i->axis);
 	                }
-	                this->status = LIMIT_TRIGGERED;
+	                set_status(LIMIT_TRIGGERED);
 	                i->debounce = 0;
 	                // disables heaters and motors, ignores incoming Gcode and flushes block queue
 	                THEKERNEL->set_halt_reason(HARD_LIMIT);
@@ -617,7 +685,7 @@ void Endstops::on_idle(void *argument)
 	                }else{
 	                    THEKERNEL->streams->printf("ALARM: Hard limit %c%c\n", STEPPER[i->axis_index]->which_direction() ? '-' : '+', i->axis);
 	                }
-	                this->status = LIMIT_TRIGGERED;
+	                set_status(LIMIT_TRIGGERED);
 	                i->debounce = 0;
 	                // disables heaters and motors, ignores incoming Gcode and flushes block queue
 	                THEKERNEL->set_halt_reason(HARD_LIMIT);
@@ -636,7 +704,7 @@ void Endstops::on_idle(void *argument)
 void Endstops::back_off_home(axis_bitmap_t axis)
 {
     std::vector<std::pair<char, float>> params;
-    this->status = BACK_OFF_HOME;
+    set_status(BACK_OFF_HOME);
 
     float slow_rate= NAN; // default mm/sec
 
@@ -680,7 +748,7 @@ void Endstops::back_off_home(axis_bitmap_t axis)
         THEROBOT->pop_state();
     }
 
-    this->status = NOT_HOMING;
+    set_status(NOT_HOMING);
 }
 
 // If enabled will move the head to 0,0 after homing, but only if X and Y were set to home
@@ -690,16 +758,16 @@ void Endstops::move_to_origin(axis_bitmap_t axis)
 
     if(park_after_home) {
         // do park instead of goto origin
-        this->status = MOVE_TO_ORIGIN;
+        set_status(MOVE_TO_ORIGIN);
         handle_park_g28();
-        this->status = NOT_HOMING;
+        set_status(NOT_HOMING);
         return;
     }
 
     // ignore if disabled
     if(!this->move_to_origin_after_home) return;
 
-    this->status = MOVE_TO_ORIGIN;
+    set_status(MOVE_TO_ORIGIN);
     // Do we need to check if we are already at 0,0? probably not as the G0 will not do anything if we are
     // float pos[3]; THEROBOT->get_axis_position(pos); if(pos[0] == 0 && pos[1] == 0) return;
 
@@ -716,7 +784,80 @@ void Endstops::move_to_origin(axis_bitmap_t axis)
     // Wait for above to finish
     THECONVEYOR->wait_for_idle();
     THEROBOT->pop_state();
-    this->status = NOT_HOMING;
+    set_status(NOT_HOMING);
+}
+
+// homing endstop pins on P0 and P2 also interrupt on both edges, so the debounce time starts at the
+// actual edge and with no debounce the motor is stopped right here instead of on the next 1ms tick
+void Endstops::attach_endstop_interrupts()
+{
+    for (size_t i = 0; i < homing_axis.size(); ++i) {
+        endstop_info_t *info = homing_axis[i].pin_info;
+        if(info == nullptr || !info->pin.connected()) continue;
+        if(info->pin.port_number != 0 && info->pin.port_number != 2) continue; // those stay polled only
+
+        // corexy can share one endstop between axis, only attach it once
+        bool seen = false;
+        for (size_t j = 0; j < i; ++j) {
+            if(homing_axis[j].pin_info == info) seen = true;
+        }
+        if(seen) continue;
+
+        // these last as long as the module
+        mbed::InterruptIn *irq = new mbed::InterruptIn(port_pin((PortName)info->pin.port_number, info->pin.pin));
+        irq->rise(this, &Endstops::on_endstop_edge);
+        irq->fall(this, &Endstops::on_endstop_edge);
+        IrqPriority::apply(EINT3_IRQn);
+    }
+}
+
+void Endstops::on_endstop_edge()
+{
+    if(this->status != MOVING_TO_ENDSTOP_SLOW && this->status != MOVING_TO_ENDSTOP_FAST && this->status != A_LIMITE_CHECK) return;
+
+    uint32_t now = us_ticker_read();
+    for(auto& e : homing_axis) {
+        if(e.pin_info != nullptr) check_homing_endstop(e, now);
+    }
+}
+
+// called from both the edge interrupt and the 1ms tick, stops the motor once the endstop
+// has read triggered for endstop_debounce_ms
+void Endstops::check_homing_endstop(homing_info_t &e, uint32_t now)
+{
+    int m= e.axis_index;
+
+    // for corexy homing in X or Y we must only check the associated endstop, works as we only home one axis at a time for corexy
+    if(is_corexy && (m == X_AXIS || m == Y_AXIS) && !axis_to_home[m]) return;
+
+    if(!STEPPER[m]->is_moving()) return;
+
+    endstop_info_t *info = e.pin_info;
+    if(!info->pin.get()) {
+        // The endstop was not hit yet
+        info->timing = false;
+        info->Nontriggered = true;
+        return;
+    }
+
+    if(this->status == A_LIMITE_CHECK) return;
+
+    if(!info->timing) {
+        info->trigger_us = now;
+        info->timing = true;
+    }
+    if(now - info->trigger_us < debounce_ms * 1000) return;
+
+    if(is_corexy && (m == X_AXIS || m == Y_AXIS)) {
+        // corexy when moving in X or Y we need to stop both the X and Y motors
+        STEPPER[X_AXIS]->stop_moving();
+        STEPPER[Y_AXIS]->stop_moving();
+
+    }else{
+        // we signal the motor to stop, which will preempt any moves on that axis
+        STEPPER[m]->stop_moving();
+    }
+    info->triggered= true;
 }
 
 // Called every millisecond in an ISR
@@ -725,41 +866,10 @@ uint32_t Endstops::read_endstops(uint32_t dummy)
     if(this->status != MOVING_TO_ENDSTOP_SLOW && this->status != MOVING_TO_ENDSTOP_FAST && this->status != A_LIMITE_CHECK) return 0; // not doing anything we need to monitor for
 
     // check each homing endstop
+    uint32_t now = us_ticker_read();
     for(auto& e : homing_axis) { // check all axis homing endstops
         if(e.pin_info == nullptr) continue; // ignore if not a homing endstop
-        int m= e.axis_index;
-
-        // for corexy homing in X or Y we must only check the associated endstop, works as we only home one axis at a time for corexy
-        if(is_corexy && (m == X_AXIS || m == Y_AXIS) && !axis_to_home[m]) continue;
-
-        if(STEPPER[m]->is_moving()) {
-            // if it is moving then we check the associated endstop, and debounce it
-            if(e.pin_info->pin.get()) {
-            	if(this->status != A_LIMITE_CHECK)
-                {
-	                if(e.pin_info->debounce < debounce_ms) {
-	                    e.pin_info->debounce++;
-	
-	                } else {
-	            	
-	                    if(is_corexy && (m == X_AXIS || m == Y_AXIS)) {
-	                        // corexy when moving in X or Y we need to stop both the X and Y motors
-	                        STEPPER[X_AXIS]->stop_moving();
-	                        STEPPER[Y_AXIS]->stop_moving();
-	
-	                    }else{
-	                        // we signal the motor to stop, which will preempt any moves on that axis
-	                        STEPPER[m]->stop_moving();
-	                    }
-	                	e.pin_info->triggered= true;
-	                }
-				}
-            } else {
-                // The endstop was not hit yet
-                e.pin_info->debounce= 0;
-                e.pin_info->Nontriggered = true;
-            }
-        }
+        check_homing_endstop(e, now);
     }
 
     return 0;
@@ -791,6 +901,73 @@ void Endstops::home_xy()
     // Wait for axis to have homed
     THECONVEYOR->wait_for_idle();
 }
+
+// the feed rate for a move of several axis that takes as long as the slowest of them at its own rate,
+// rather than all of them at the lowest rate
+float Endstops::together_rate(const float *delta, bool slow)
+{
+    float t= 0, sos= 0, aux= 0;
+    for (auto& e : homing_axis) {
+        int c= e.axis_index;
+        if(delta[c] == 0) continue;
+        t= std::max(t, fabsf(delta[c]) / (slow ? e.slow_rate : e.fast_rate));
+        if(c <= Z_AXIS) sos += delta[c] * delta[c];
+        else aux += delta[c] * delta[c];
+    }
+    if(t <= 0) return 0;
+    // the planner times a move by XYZ and only by ABC when XYZ do not move
+    return sqrtf(sos > 0 ? sos : aux) / t;
+}
+
+// one move to the endstops for all the axis, the step ticker stops each one on its own endstop and the rest carry on
+void Endstops::home_all_together(const bool *axis_is_on)
+{
+    bool abc_checked= THEKERNEL->factory_set->FuncSetting & (1<<0);
+    float delta[homing_axis.size()];
+    for (auto& e : homing_axis) {
+        int c= e.axis_index;
+        delta[c]= 0;
+        if(!axis_to_home[c] || (c >= A_AXIS && abc_checked && !axis_is_on[c])) continue;
+        delta[c]= e.home_direction ? -e.max_travel : e.max_travel;
+    }
+
+    float rate= together_rate(delta, false);
+    if(rate > 0) THEROBOT->delta_move(delta, rate, homing_axis.size());
+    THECONVEYOR->wait_for_idle();
+}
+
+// A B and C have a long triggering gap, move them off their endstops first and note which ones could,
+// those that could not are left out of homing
+void Endstops::clear_abc_endstops(bool *axis_is_on)
+{
+	set_status(MOVING_BACK);
+	for (size_t i = A_AXIS; i < homing_axis.size(); ++i) {
+		if(!axis_to_home[i]) continue;
+		float delta[i+1];
+		for (size_t j = 0; j <= i; ++j) delta[j]= 0;
+		delta[i]= homing_axis[i].retract*50; // retract*50 shoud > the whole triggering gap
+		if(!homing_axis[i].home_direction) delta[i]= -delta[i];
+		THEROBOT->delta_move(delta, homing_axis[i].fast_rate, i+1);
+		// wait for it
+		THECONVEYOR->wait_for_idle();
+		// Check if the endstop is triggered
+		if(homing_axis[i].pin_info->pin.get())
+		{
+			THEROBOT->delta_move(delta, homing_axis[i].fast_rate, i+1);
+			// wait for it
+			THECONVEYOR->wait_for_idle();
+			if(!homing_axis[i].pin_info->pin.get())
+			{
+				axis_is_on[i] = true;
+			}
+		}
+		else
+		{
+			axis_is_on[i] = true;
+		}
+	}
+}
+
 void Endstops::check_4th(char *data)
 {
 	bool btriggered = true;
@@ -800,11 +977,12 @@ void Endstops::check_4th(char *data)
 	if(axis_to_home[A_AXIS]) 
 	{		
 		homing_axis[A_AXIS].pin_info->debounce= 0;
+		homing_axis[A_AXIS].pin_info->timing= false;
 		homing_axis[A_AXIS].pin_info->triggered = false;
 		homing_axis[A_AXIS].pin_info->Nontriggered = false;
 		
 		// Start moving the axes to the origin
-    	this->status = MOVING_TO_ENDSTOP_SLOW;
+    	set_status(MOVING_TO_ENDSTOP_SLOW);
     	float delta[A_AXIS+1];
 	    for (size_t j = 0; j <= A_AXIS; ++j) delta[j]= 0;
 	    delta[A_AXIS]= 380; // we go the max
@@ -817,9 +995,10 @@ void Endstops::check_4th(char *data)
 		
 		if(btriggered)
 		{			
-    		this->status = A_LIMITE_CHECK;
+    		set_status(A_LIMITE_CHECK);
     	
 			homing_axis[A_AXIS].pin_info->debounce= 0;
+			homing_axis[A_AXIS].pin_info->timing= false;
 			homing_axis[A_AXIS].pin_info->triggered = false;
 			homing_axis[A_AXIS].pin_info->Nontriggered = false;
 			for (size_t j = 0; j <= A_AXIS; ++j) delta[j]= 0;
@@ -851,7 +1030,7 @@ void Endstops::check_4th(char *data)
         back_off_home(bs);
         THEROBOT->reset_axis_position(0, homing_axis[A_AXIS].axis_index);
         
-		this->status = status;
+		set_status(status);
 	}
 }
 void Endstops::home(axis_bitmap_t a)
@@ -865,6 +1044,7 @@ void Endstops::home(axis_bitmap_t a)
     // reset debounce counts for all endstops
     for(auto& e : endstops) {
        e->debounce= 0;
+       e->timing= false;
        e->triggered= false;
     }
 
@@ -875,97 +1055,71 @@ void Endstops::home(axis_bitmap_t a)
     this->axis_to_home= a;
 
     // Start moving the axes to the origin
-    this->status = MOVING_TO_ENDSTOP_FAST;
+    set_status(MOVING_TO_ENDSTOP_FAST);
 
     THEROBOT->disable_segmentation= true; // we must disable segmentation as this won't work with it enabled
 
-    if(!home_z_first) home_xy();
+    if(home_together) {
+        if(THEKERNEL->factory_set->FuncSetting & (1<<0)) clear_abc_endstops(axis_is_on);
+        set_status(MOVING_TO_ENDSTOP_FAST);
+        home_all_together(axis_is_on);
 
-    if(axis_to_home[Z_AXIS]) {
-        // now home z
-        float delta[3] {0, 0, homing_axis[Z_AXIS].max_travel}; // we go the max z
-        if(homing_axis[Z_AXIS].home_direction) delta[Z_AXIS]= -delta[Z_AXIS];
-        THEROBOT->delta_move(delta, homing_axis[Z_AXIS].fast_rate, 3);
-        // wait for Z
-        THECONVEYOR->wait_for_idle();
-    }
+    } else {
+        if(!home_z_first) home_xy();
+
+        if(axis_to_home[Z_AXIS]) {
+            // now home z
+            float delta[3] {0, 0, homing_axis[Z_AXIS].max_travel}; // we go the max z
+            if(homing_axis[Z_AXIS].home_direction) delta[Z_AXIS]= -delta[Z_AXIS];
+            THEROBOT->delta_move(delta, homing_axis[Z_AXIS].fast_rate, 3);
+            // wait for Z
+            THECONVEYOR->wait_for_idle();
+        }
 
-    if(home_z_first) home_xy();
-    if(THEKERNEL->factory_set->FuncSetting & (1<<0))	//A axis home enabled
-    {
-    	//We first move A B and C back a certain distance because the triggering gap of the A B and C is relatively long
-		// Start moving the axes back
-		this->status = MOVING_BACK;
-		if(homing_axis.size() > 3)
-		{
-	        for (size_t i = A_AXIS; i < homing_axis.size(); ++i) {
-	            if(axis_to_home[i]) {
-	                // now home A B or C
-	                float delta[i+1];
-	                for (size_t j = 0; j <= i; ++j) delta[j]= 0;
-	                delta[i]= homing_axis[i].retract*50; // retract*50 shoud > the whole triggering gap
-	                if(!homing_axis[i].home_direction) delta[i]= -delta[i];
-	                THEROBOT->delta_move(delta, homing_axis[i].fast_rate, i+1);
-	                // wait for it
-	                THECONVEYOR->wait_for_idle();
-	                // Check if the endstop is triggered
-	                if(homing_axis[i].pin_info->pin.get())
-	                {
-	                	for (size_t j = 0; j <= i; ++j) delta[j]= 0;
-		                delta[i]= homing_axis[i].retract*50; // retract*50 shoud > the whole triggering gap
-		                if(!homing_axis[i].home_direction) delta[i]= -delta[i];
-		                THEROBOT->delta_move(delta, homing_axis[i].fast_rate, i+1);
-		                // wait for it
-		                THECONVEYOR->wait_for_idle();
-		                if(!homing_axis[i].pin_info->pin.get())
-		                {
-		                	axis_is_on[i] = true;
-		                }
-	                }
-	                else
-	                {
-	                	axis_is_on[i] = true;
-	                }
-	            }
-	        }
-    	}
-    	// Start moving the axes to the origin
-    	this->status = MOVING_TO_ENDSTOP_FAST;
-    	// potentially home A B and C individually
-	    if(homing_axis.size() > 3){
-	        for (size_t i = A_AXIS; i < homing_axis.size(); ++i) {
-	            if(axis_to_home[i] && (axis_is_on[i] == true)) {
-	                // now home A B or C
-	                float delta[i+1];
-	                for (size_t j = 0; j <= i; ++j) delta[j]= 0;
-	                delta[i]= homing_axis[i].max_travel; // we go the max
-	                if(homing_axis[i].home_direction) delta[i]= -delta[i];
-	                THEROBOT->delta_move(delta, homing_axis[i].fast_rate, i+1);
-	                // wait for it
-	                THECONVEYOR->wait_for_idle();
-	            }
-	        }
-	    }
+        if(home_z_first) home_xy();
+        if(THEKERNEL->factory_set->FuncSetting & (1<<0))	//A axis home enabled
+        {
+        	//We first move A B and C back a certain distance because the triggering gap of the A B and C is relatively long
+    		// Start moving the axes back
+    		clear_abc_endstops(axis_is_on);
+        	// Start moving the axes to the origin
+        	set_status(MOVING_TO_ENDSTOP_FAST);
+        	// potentially home A B and C individually
+    	    if(homing_axis.size() > 3){
+    	        for (size_t i = A_AXIS; i < homing_axis.size(); ++i) {
+    	            if(axis_to_home[i] && (axis_is_on[i] == true)) {
+    	                // now home A B or C
+    	                float delta[i+1];
+    	                for (size_t j = 0; j <= i; ++j) delta[j]= 0;
+    	                delta[i]= homing_axis[i].max_travel; // we go the max
+    	                if(homing_axis[i].home_direction) delta[i]= -delta[i];
+    	                THEROBOT->delta_move(delta, homing_axis[i].fast_rate, i+1);
+    	                // wait for it
+    	                THECONVEYOR->wait_for_idle();
+    	            }
+    	        }
+    	    }
     	
+        }
+        else
+        {
+    	    // potentially home A B and C individually
+    	    if(homing_axis.size() > 3){
+    	        for (size_t i = A_AXIS; i < homing_axis.size(); ++i) {
+    	            if(axis_to_home[i]) {
+    	                // now home A B or C
+    	                float delta[i+1];
+    	                for (size_t j = 0; j <= i; ++j) delta[j]= 0;
+    	                delta[i]= homing_axis[i].max_travel; // we go the max
+    	                if(homing_axis[i].home_direction) delta[i]= -delta[i];
+    	                THEROBOT->delta_move(delta, homing_axis[i].fast_rate, i+1);
+    	                // wait for it
+    	                THECONVEYOR->wait_for_idle();
+    	            }
+    	        }
+    	    }
+    	}
     }
-    else
-    {
-	    // potentially home A B and C individually
-	    if(homing_axis.size() > 3){
-	        for (size_t i = A_AXIS; i < homing_axis.size(); ++i) {
-	            if(axis_to_home[i]) {
-	                // now home A B or C
-	                float delta[i+1];
-	                for (size_t j = 0; j <= i; ++j) delta[j]= 0;
-	                delta[i]= homing_axis[i].max_travel; // we go the max
-	                if(homing_axis[i].home_direction) delta[i]= -delta[i];
-	                THEROBOT->delta_move(delta, homing_axis[i].fast_rate, i+1);
-	                // wait for it
-	                THECONVEYOR->wait_for_idle();
-	            }
-	        }
-	    }
-	}
 
     // check that the endstops were hit and it did not stop short for some reason
     // if the endstop is not triggered then enter ALARM state
@@ -973,7 +1127,7 @@ void Endstops::home(axis_bitmap_t a)
     if(axis_to_home[X_AXIS] || axis_to_home[Y_AXIS] || axis_to_home[Z_AXIS]) {
         for (size_t i = X_AXIS; i <= Z_AXIS; ++i) {
             if((axis_to_home[i] || this->is_delta || this->is_rdelta) && !homing_axis[i].pin_info->triggered) {
-                this->status = NOT_HOMING;
+                set_status(NOT_HOMING);
                 THEKERNEL->set_halt_reason(HOME_FAIL);
                 THEKERNEL->call_event(ON_HALT, nullptr);
                 THEROBOT->disable_segmentation= false;
@@ -986,7 +1140,7 @@ void Endstops::home(axis_bitmap_t a)
     if(homing_axis.size() > 3){
         for (size_t i = A_AXIS; i < homing_axis.size(); ++i) {
             if(axis_to_home[i] && !homing_axis[i].pin_info->triggered && (axis_is_on[i] == true)) {
-                this->status = NOT_HOMING;
+                set_status(NOT_HOMING);
                 THEKERNEL->set_halt_reason(HOME_FAIL);
                 THEKERNEL->call_event(ON_HALT, nullptr);
                 THEROBOT->disable_segmentation = false;
@@ -1003,7 +1157,7 @@ void Endstops::home(axis_bitmap_t a)
     }
 
     // Move back a small distance for all homing axis
-    this->status = MOVING_BACK;
+    set_status(MOVING_BACK);
     float delta[homing_axis.size()];
     for (size_t i = 0; i < homing_axis.size(); ++i) delta[i]= 0;
 
@@ -1018,12 +1172,14 @@ void Endstops::home(axis_bitmap_t a)
         }
     }
 
+    // homing together each axis backs off and touches again at its own slow rate
+    if(home_together) feed_rate= together_rate(delta, true);
     THEROBOT->delta_move(delta, feed_rate, homing_axis.size());
     // wait until finished
     THECONVEYOR->wait_for_idle();
 
     // Start moving the axes towards the endstops slowly
-    this->status = MOVING_TO_ENDSTOP_SLOW;
+    set_status(MOVING_TO_ENDSTOP_SLOW);
     for (auto& i : homing_axis) {
         int c= i.axis_index;
         if(axis_to_home[c]) {
@@ -1033,6 +1189,7 @@ void Endstops::home(axis_bitmap_t a)
             delta[c]= 0;
         }
     }
+    if(home_together) feed_rate= together_rate(delta, true);
     THEROBOT->delta_move(delta, feed_rate, homing_axis.size());
     // wait until finished
     THECONVEYOR->wait_for_idle();
@@ -1046,7 +1203,7 @@ void Endstops::home(axis_bitmap_t a)
         THEROBOT->disable_arm_solution = false;  // Arm solution enabled again.
     }
 
-    this->status = NOT_HOMING;
+    set_status(NOT_HOMING);
 }
 
 void Endstops::process_home_command(Gcode* gcode)
@@ -1055,6 +1212,9 @@ void Endstops::process_home_command(Gcode* gcode)
     THEKERNEL->disable_endstops = false;
     // First wait for the queue to be empty
     THECONVEYOR->wait_for_idle();
+    // a failed or partial homing is not kept over a reset
+    HomeRecord::arm(false);
+    this->position_kept = false;
 
     // turn off any compensation transform so Z does not move as XY home
     auto savect= THEROBOT->compensationTransform;
@@ -1111,7 +1271,11 @@ void Endstops::process_home_command(Gcode* gcode)
     }
 
     // do the actual homing
-    if(homing_order != 0 && !is_scara) {
+    if(home_together) {
+        // the order is only there to keep axis out of each others way, they all go at once here
+        home(haxis);
+
+    } else if(homing_order != 0 && !is_scara) {
         // if an order has been specified do it in the specified order
         // homing order is 0bfffeeedddcccbbbaaa where aaa is 1,2,3,4,5,6 to specify the first axis (XYZABC), bbb is the second and ccc is the third etc
         // eg 0b0101011001010 would be Y X Z A, 011 010 001 100 101 would be  B A X Y Z
@@ -1244,6 +1408,70 @@ void Endstops::process_home_command(Gcode* gcode)
         move_to_origin(haxis);
     }
     THEKERNEL->disable_endstops  = previous_disable_endstops;
+
+    bool all_homed = true;
+    for (auto &p : homing_axis) {
+        if(p.pin_info != nullptr && !p.homed) all_homed = false;
+    }
+    HomeRecord::arm(all_homed);
+}
+
+// G28.7 homes the one axis from the position kept over the reset, if it touches where it should the others are taken as homed too
+void Endstops::quick_reference(Gcode *gcode)
+{
+    if(!this->position_kept) {
+        gcode->stream->printf("error: No position was kept over the reset, home with G28\n");
+        return;
+    }
+    char letter = quick_reference_axis;
+    for (auto &p : homing_axis) {
+        if(gcode->has_letter(p.axis)) letter = p.axis;
+    }
+    homing_info_t *h = nullptr;
+    for (auto &p : homing_axis) {
+        if(p.axis == letter && p.pin_info != nullptr) h = &p;
+    }
+    if(h == nullptr) {
+        gcode->stream->printf("error: %c has no endstop to check against\n", letter);
+        return;
+    }
+    // one go only, whatever it finds
+    this->position_kept = false;
+
+    bool previous_disable_endstops = THEKERNEL->disable_endstops;
+    THEKERNEL->disable_endstops = false;
+    THECONVEYOR->wait_for_idle();
+    auto savect = THEROBOT->compensationTransform;
+    THEROBOT->compensationTransform = nullptr;
+
+    // unlike G28 the axis is not zeroed first, so where it touches says if the kept position held
+    axis_bitmap_t bs;
+    bs.set(h->axis_index);
+    home(bs);
+    THEROBOT->compensationTransform = savect;
+    THEKERNEL->disable_endstops = previous_disable_endstops;
+    if(THEKERNEL->is_halted()) {
+        gcode->stream->printf("ERROR: Quick reference failed, home with G28\n");
+        return;
+    }
+
+    float pos[k_max_actuators];
+    THEROBOT->get_axis_position(pos, THEROBOT->get_number_registered_motors());
+    float expected = h->homing_position + h->home_offset;
+    float error = pos[h->axis_index] - expected;
+    THEROBOT->reset_axis_position(expected, h->axis_index);
+    h->homed = true;
+
+    if(fabsf(error) > quick_reference_tolerance) {
+        gcode->stream->printf("error: %c touched %1.3f mm from the kept position, home with G28\n", h->axis, error);
+    } else {
+        for (auto &p : homing_axis) {
+            if(p.pin_info != nullptr) p.homed = true;
+        }
+        HomeRecord::arm(true);
+        gcode->stream->printf("%c touched %1.3f mm from the kept position, it is taken back\n", h->axis, error);
+    }
+    back_off_home(bs);
 }
 
 void Endstops::set_homing_offset(Gcode *gcode)
@@ -1279,6 +1507,8 @@ void Endstops::set_homing_offset(Gcode *gcode)
         homing_axis[Z_AXIS].homed= false; // force it to be homed
     }
 
+    // the next reset would otherwise keep positions homed to the old offsets
+    HomeRecord::arm(false);
     gcode->stream->printf("Homing Offset: X %5.3f Y %5.3f Z %5.3f will take effect next home\n", homing_axis[X_AXIS].home_offset, homing_axis[Y_AXIS].home_offset, homing_axis[Z_AXIS].home_offset);
 }
 
@@ -1365,6 +1595,7 @@ void Endstops::on_gcode_received(void *argument)
                 break;
 
             case 5: // G28.5 is a smoothie special it clears the homed flag for the specified axis, or all if not specifed
+                HomeRecord::arm(false);
                 if(gcode->get_num_args() == 0) {
                     for (auto &p : homing_axis) p.homed= false;
                 } else {
@@ -1385,6 +1616,10 @@ void Endstops::on_gcode_received(void *argument)
                 gcode->add_nl= true;
                 break;
 
+            case 7: // G28.7 checks the position kept over a reset with one touch instead of homing
+                quick_reference(gcode);
+                break;
+
             default:
                 if(THEKERNEL->is_grbl_mode()) {
                     gcode->stream->printf("error:Unsupported command\n");
@@ -32,15 +32,25 @@ class Endstops : public Module{
         using axis_bitmap_t = std::bitset<6>;
         void home(axis_bitmap_t a);
         void home_xy();
+        void home_all_together(const bool *axis_is_on);
+        void clear_abc_endstops(bool *axis_is_on);
+        float together_rate(const float *delta, bool slow);
         void back_off_home(axis_bitmap_t axis);
         void move_to_origin(axis_bitmap_t axis);
         void on_get_public_data(void* argument);
         void on_set_public_data(void* argument);
         void on_idle(void *argument);
+        void on_halt(void *argument);
+        void set_status(char s);
+        void on_enable(void *argument);
         bool debounced_get(Pin *pin);
         void process_home_command(Gcode* gcode);
+        void take_home_record();
+        void quick_reference(Gcode* gcode);
         void set_homing_offset(Gcode* gcode);
         uint32_t read_endstops(uint32_t dummy);
+        void on_endstop_edge();
+        void attach_endstop_interrupts();
         void handle_park_g28();
 
         // global settings
@@ -50,12 +60,15 @@ class Endstops : public Module{
         axis_bitmap_t axis_to_home;
 
         float trim_mm[3];
+        float quick_reference_tolerance;
+        char quick_reference_axis;
 
         Pin cover_endstop_pin;
 
         // per endstop settings
         using endstop_info_t = struct {
             Pin pin;
+            uint32_t trigger_us; // when it was first seen triggered while homing, valid when timing is set
             struct {
                 uint16_t debounce:16;
                 char axis:8; // one of XYZABC
@@ -63,6 +76,7 @@ class Endstops : public Module{
                 bool limit_enable:1;
                 bool triggered:1;
                 bool Nontriggered:1;
+                bool timing:1;
             };
         };
 
@@ -94,6 +108,8 @@ class Endstops : public Module{
             };
         };
 
+        void check_homing_endstop(homing_info_t &e, uint32_t now);
+
         // array of endstops
         std::vector<endstop_info_t *> endstops;
 
@@ -112,7 +128,9 @@ class Endstops : public Module{
             bool is_rdelta:1;
             bool is_scara:1;
             bool home_z_first:1;
+            bool home_together:1;
             bool move_to_origin_after_home:1;
             bool park_after_home:1;
+            bool position_kept:1;       // the actuators were put back where the last reset left them, G28.7 checks it
         };
 };
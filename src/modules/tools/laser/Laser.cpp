@@ -43,12 +43,15 @@
 #define laser_module_minimum_power_checksum     CHECKSUM("laser_module_minimum_power")
 #define laser_module_max_power_checksum         CHECKSUM("laser_module_max_power")
 #define laser_module_maximum_s_value_checksum   CHECKSUM("laser_module_maximum_s_value")
+#define laser_module_power_update_rate_checksum CHECKSUM("laser_module_power_update_rate")
+#define laser_module_raster_skip_checksum       CHECKSUM("laser_module_raster_skip")
 
 Laser::Laser()
 {
     laser_on = false;
     scale = 1;
     testing = false;
+    block_synced = false;
 }
 
 void Laser::on_module_loaded()
@@ -108,6 +111,7 @@ void Laser::on_module_loaded()
 
     // S value that represents maximum (default 1)
     this->laser_maximum_s_value = THEKERNEL->config->value(laser_module_maximum_s_value_checksum)->by_default(1.0f)->as_number() ;
+    this->raster_skip = THEKERNEL->config->value(laser_module_raster_skip_checksum)->by_default(5.0f)->as_number() ;
 
     set_laser_power(0);
 
@@ -116,11 +120,22 @@ void Laser::on_module_loaded()
     this->register_for_event(ON_GCODE_RECEIVED);
     this->register_for_event(ON_CONSOLE_LINE_RECEIVED);
     this->register_for_event(ON_GET_PUBLIC_DATA);
+    this->register_for_event(ON_SET_PUBLIC_DATA);
 
     // no point in updating the power more than the PWM frequency, but not faster than 1KHz
     ms_per_tick = 1000 / std::min(1000UL, 1000000 / period);
     // 2024
     THEKERNEL->slow_ticker->attach(std::min(1000UL, 1000000 / period), this, &Laser::set_proportional_power);
+
+    // while a block is running the step ticker updates the power in step with the motion instead,
+    // again no faster than the PWM frequency
+    uint32_t rate = THEKERNEL->config->value(laser_module_power_update_rate_checksum)->by_default(5000)->as_number();
+    rate = std::min(rate, 1000000 / period);
+    if(rate > 0) {
+        StepTicker *st = StepTicker::getInstance();
+        st->set_block_tick_fnc(Callback<void()>::bind<Laser, &Laser::on_block_tick>(this), st->get_frequency() / rate);
+        block_synced = true;
+    }
     // THEKERNEL->slow_ticker->attach(std::min(4000UL, 1000000 / period), this, &Laser::set_proportional_power);
     // THEKERNEL->slow_ticker->attach(1, this, &Laser::set_proportional_power);
 
@@ -374,21 +389,79 @@ void Laser::on_gcode_received(void *argument)
     }
 }
 
-// calculates the current speed ratio from the currently executing block
-float Laser::current_speed_ratio(const Block *block) const
+void Laser::on_set_public_data(void* argument)
 {
-    // find the primary moving actuator (the one with the most steps)
+    PublicDataRequest* pdr = static_cast<PublicDataRequest*>(argument);
+    if(!pdr->starts_with(laser_checksum)) return;
+    if(pdr->second_element_is(raster_row_checksum)) {
+        pad_raster_row *r = static_cast<pad_raster_row *>(pdr->get_data_ptr());
+        raster_row(r->gcode, r->row);
+        pdr->set_taken();
+    }
+}
 
-	// 2024
-    size_t pm = 0;
-    uint32_t max_steps = 0;
-    for (size_t i = 0; i < THEROBOT->get_number_registered_motors(); i++) {
-        // find the motor with the most steps
-        if(block->steps[i] > max_steps) {
-            max_steps = block->steps[i];
-            pm = i;
+// M327 I<pitch> J<pitch> F<feed> S<S of a 255 pixel> :<base64 row> burns a row of pixels from where the laser is, one each
+// I, J along X, Y. The pixels go up to a block's worth at a time as the S values of one move, a run of the same value as
+// a move of its own and a blank run of raster_skip or more is rapided over, so a row takes a few moves instead of a G1 a pixel
+void Laser::raster_row(Gcode *gcode, const char *row)
+{
+    const size_t n_max = Block::k_max_s_values;
+    uint8_t px[96];
+    size_t n = base64_decode(row, px, sizeof(px));
+    float dx = gcode->has_letter('I') ? THEROBOT->to_millimeters(gcode->get_value('I')) : 0;
+    float dy = gcode->has_letter('J') ? THEROBOT->to_millimeters(gcode->get_value('J')) : 0;
+    float pitch = hypotf(dx, dy);
+    if(!THEKERNEL->get_laser_mode() || n == 0 || pitch <= 0) {
+        gcode->stream->printf("error:M327 needs laser mode, I or J and a row of pixels\n");
+        return;
+    }
+    float feed = gcode->has_letter('F') ? THEROBOT->to_millimeters(gcode->get_value('F')) : THEROBOT->get_feed_rate();
+    float s_max = (gcode->has_letter('S') ? gcode->get_value('S') : this->laser_maximum_s_value) / 255;
+
+    // how many pixels from i have the same value
+    auto run_at = [&](size_t i) {
+        size_t r = 1;
+        while (i + r < n && px[i + r] == px[i]) r++;
+        return r;
+    };
+    auto skipped = [&](size_t i, size_t r) { return px[i] == 0 && raster_skip > 0 && r * pitch >= raster_skip; };
+
+    size_t i = 0;
+    while (i < n && !THEKERNEL->is_halted()) {
+        size_t r = run_at(i);
+        if(skipped(i, r)) {
+            THEROBOT->raster_move(dx * r, dy * r, 0, nullptr, 0, gcode->line);
+            i += r;
+            continue;
+        }
+        if(r >= n_max) {
+            float s = px[i] * s_max;
+            THEROBOT->raster_move(dx * r, dy * r, feed, &s, 1, gcode->line);
+            i += r;
+            continue;
+        }
+
+        // the pixels up to the next run that goes by itself
+        float s[n_max];
+        size_t k = 0;
+        while (k < n_max && i + k < n) {
+            if(k > 0) {
+                size_t rk = run_at(i + k);
+                if(rk >= n_max || skipped(i + k, rk)) break;
+            }
+            s[k] = px[i + k] * s_max;
+            k++;
         }
+        THEROBOT->raster_move(dx * k, dy * k, feed, s, k, gcode->line);
+        i += k;
     }
+}
+
+// calculates the current speed ratio from the currently executing block
+float Laser::current_speed_ratio(const Block *block) const
+{
+    // the primary moving actuator (the one with the most steps)
+    size_t pm = block->dominant_motor;
 
     // figure out the ratio of its speed, from 0 to 1 based on where it is on the trapezoid,
     // this is based on the fraction it is of the requested rate (nominal rate)
@@ -416,23 +489,19 @@ bool Laser::get_laser_power(float& power) const
     // Note to avoid a race condition where the block is being cleared we check the is_ready flag which gets cleared first,
     // as this is an interrupt if that flag is not clear then it cannot be cleared while this is running and the block will still be valid (albeit it may have finished)
     if (block != nullptr && block->is_ready && block->is_g123) {
-    	// 2024
-        float requested_power = (float)block->s_value / (1 << 11) / this->laser_maximum_s_value; // s_value is 1.11 Fixed point
-        float ratio = current_speed_ratio(block);
-        power = requested_power * ratio * scale;
-        return true;
-
-        /*
-		int axis = block->move_axis;
-		int shift_steps = block->tick_info[axis].steps_to_move / int(block->s_count);
-		int idx = block->tick_info[axis].step_count / shift_steps;
-
-        float requested_power = (float)block->s_values[idx] / (1 << 11) / this->laser_maximum_s_value; // s_value is 1.11 Fixed point
+        uint16_t s = block->s_value;
+        if (block->s_count > 1) {
+            // a raster line, the S values are spread evenly along it so pick by how far the dominant motor is through it
+            const StepTicker *st = StepTicker::getInstance();
+            uint32_t steps = st->get_steps_to_move(block->dominant_motor);
+            uint32_t idx = steps > 0 ? (uint64_t)st->get_step_count(block->dominant_motor) * block->s_count / steps : 0;
+            if (idx >= block->s_count) idx = block->s_count - 1;
+            s = block->s_values[idx];
+        }
+        float requested_power = (float)s / (1 << 11) / this->laser_maximum_s_value; // s_value is 1.11 Fixed point
         float ratio = current_speed_ratio(block);
         power = requested_power * ratio * scale;
         return true;
-        */
-
     }
 
     return false;
@@ -440,13 +509,29 @@ bool Laser::get_laser_power(float& power) const
 
 // called every millisecond from timer ISR
 uint32_t Laser::set_proportional_power(uint32_t dummy)
+{
+    // the step ticker has it while there is a block
+    if (block_synced && StepTicker::getInstance()->get_current_block() != nullptr) {
+        return 0;
+    }
+    update_power();
+    return 0;
+}
+
+// called from the step ticker ISR as the block runs
+void Laser::on_block_tick()
+{
+    update_power();
+}
+
+void Laser::update_power()
 {
 	if (!THEKERNEL->get_laser_mode()) {
-		return 0;
+		return;
 	}
     if (this->testing) {
         set_laser_power(this->laser_test_power * scale);
-        return 0;
+        return;
     }
 
     if (laser_on) {
@@ -464,8 +549,6 @@ uint32_t Laser::set_proportional_power(uint32_t dummy)
         // turn laser off
         set_laser_power(0);
     }
-
-    return 0;
 }
 
 bool Laser::set_laser_power(float power)
@@ -16,6 +16,7 @@ namespace mbed {
 }
 class Pin;
 class Block;
+class Gcode;
 
 class Laser : public Module{
     public:
@@ -26,6 +27,7 @@ class Laser : public Module{
         void on_gcode_received(void *argument);
         void on_console_line_received(void *argument);
         void on_get_public_data(void* argument);
+        void on_set_public_data(void* argument);
 
         void set_scale(float s) { scale= s/100; }
         float get_scale() const { return scale*100; }
@@ -33,8 +35,11 @@ class Laser : public Module{
 
     private:
         uint32_t set_proportional_power(uint32_t dummy);
+        void on_block_tick();
+        void update_power();
         bool get_laser_power(float& power) const;
         float current_speed_ratio(const Block *block) const;
+        void raster_row(Gcode *gcode, const char *row);
 
         Pin *laser_pin;
         mbed::PwmOut *pwm_pin;    // PWM output to regulate the laser power
@@ -44,6 +49,7 @@ class Laser : public Module{
         float laser_minimum_power; // value used to tickle the laser on moves.  Also minimum value for auto-scaling
         float laser_maximum_s_value; // Value of S code that will represent max power
         float scale;
+        float raster_skip;         // blank raster stretches at least this long are rapided over, mm
 
         int32_t ms_per_tick; // ms between each ticks, depends on PWM frequency
 
@@ -53,5 +59,6 @@ class Laser : public Module{
             bool ttl_used:1;        // stores whether we have a TTL output
             bool ttl_inverting:1;   // stores whether the TTL output should be inverted
             bool testing:1;     // set when manually firing
+            bool block_synced:1;  // the step ticker updates the power while a block runs
         };
 };
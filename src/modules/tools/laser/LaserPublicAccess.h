@@ -14,6 +14,9 @@
 
 #define laser_checksum		         CHECKSUM("laser")
 #define get_laser_status_checksum    CHECKSUM("get_laser_status")
+#define raster_row_checksum          CHECKSUM("raster_row")
+
+class Gcode;
 
 struct laser_status {
 	bool mode;
@@ -23,4 +26,10 @@ struct laser_status {
     float scale; // 0 - 100
 };
 
+// an M327 line, the words before the row and the base64 row itself
+struct pad_raster_row {
+    Gcode *gcode;
+    const char *row;
+};
+
 #endif /* SRC_MODULES_TOOLS_LASER_LASERPUBLICACCESS_H_ */
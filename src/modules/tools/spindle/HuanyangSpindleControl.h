@@ -23,6 +23,7 @@ class HuanyangSpindleControl: public ModbusSpindleControl {
         void turn_off(void);
         void set_speed(int);
         void report_speed(void);
+        void query_speed(void);
 };
 
 #endif
@@ -12,6 +12,9 @@
 #include "BufferedSoftSerial.h"
 #include "Modbus.h"
 
+#include "us_ticker_api.h"
+#include <string.h>
+
 Modbus::Modbus( PinName tx_pin, PinName rx_pin, PinName dir_pin){
     serial = new BufferedSoftSerial( tx_pin, rx_pin );
     serial->baud(9600);
@@ -20,6 +23,7 @@ Modbus::Modbus( PinName tx_pin, PinName rx_pin, PinName dir_pin){
     dir_output = new GPIO(dir_pin);
     dir_output->output();
     dir_output->clear();
+    init_queue();
 }
 
 Modbus::Modbus( PinName tx_pin, PinName rx_pin, PinName dir_pin, int baud_rate){
@@ -30,6 +34,7 @@ Modbus::Modbus( PinName tx_pin, PinName rx_pin, PinName dir_pin, int baud_rate){
     dir_output = new GPIO(dir_pin);
     dir_output->output();
     dir_output->clear();
+    init_queue();
 }
 
 Modbus::Modbus( PinName tx_pin, PinName rx_pin, PinName dir_pin, int baud_rate, const char *format){
@@ -55,36 +60,137 @@ Modbus::Modbus( PinName tx_pin, PinName rx_pin, PinName dir_pin, int baud_rate,
     dir_output = new GPIO(dir_pin);
     dir_output->output();
     dir_output->clear();
+    init_queue();
+}
+
+void Modbus::init_queue()
+{
+    first_queued = 0;
+    n_queued = 0;
+    reply_got = 0;
+    state = IDLE;
+    state_us = us_ticker_read();
+    serial->attach_tx_done(this, &Modbus::on_tx_done);
+}
+
+bool Modbus::queue(const char *telegram, int len, int reply_len, reply_fnc_t fnc)
+{
+    if(n_queued >= max_queued || len + 2 > max_telegram || reply_len > max_telegram || (reply_len > 0 && reply_len < 4)) return false;
+
+    request_t &r = requests[(first_queued + n_queued) % max_queued];
+    memcpy(r.telegram, telegram, len);
+    unsigned int crc = crc16(telegram, len);
+    r.telegram[len] = crc & 0xFF;   // CRC LSB
+    r.telegram[len + 1] = crc >> 8; // CRC MSB
+    r.len = len + 2;
+    r.reply_len = reply_len;
+    r.fnc = fnc;
+    n_queued++;
+
+    // get it going straight away if the line is free
+    poll();
+    return true;
 }
 
-// Called when the module has just been loaded
-void Modbus::on_module_loaded() {
-    // We want to be called every time a new char is received
-    serial->attach(this, &Modbus::on_serial_char_received, BufferedSoftSerial::RxIrq);
+void Modbus::clear()
+{
+    // the one being sent or waited for stays at the front until it is finished
+    int keep = (state == IDLE) ? 0 : 1;
+    for (int i = keep; i < n_queued; i++) {
+        requests[(first_queued + i) % max_queued].fnc = nullptr;
+    }
+    if(n_queued > keep) n_queued = keep;
+}
+
+// Called from the serial interrupt when the last byte of the telegram is out
+void Modbus::on_tx_done()
+{
+    if(state != SENDING) return;
+
+    dir_output->clear();
+    state_us = us_ticker_read();
+    state = RECEIVING;
+}
+
+void Modbus::finish(bool ok)
+{
+    request_t &r = requests[first_queued];
+    reply_fnc_t fnc = r.fnc;
+    r.fnc = nullptr;
+    first_queued = (first_queued + 1) % max_queued;
+    n_queued--;
+
+    state_us = us_ticker_read();
+    state = GAP;
+
+    if(fnc) fnc(ok, reply, reply_got);
 }
 
-// Called on Serial::RxIrq interrupt, meaning we have received a char
-void Modbus::on_serial_char_received(){
-    buffer.push_back(serial->getc());
+// advance the current transaction, never waits
+void Modbus::poll()
+{
+    uint32_t now = us_ticker_read();
+
+    switch(state) {
+        case IDLE:
+            if(n_queued == 0) return;
+            // throw away anything left over on the line
+            while(serial->readable()) serial->getc();
+            reply_got = 0;
+            dir_output->set();
+            state_us = now;
+            state = ENABLING;
+            break;
+
+        case ENABLING:
+            if(now - state_us < enable_us) return;
+            state_us = now;
+            state = SENDING;
+            serial->write(requests[first_queued].telegram, requests[first_queued].len);
+            break;
+
+        case SENDING:
+            // on_tx_done() moves us on, unless the serial port never finishes
+            if(now - state_us >= reply_timeout_us + (uint32_t)(requests[first_queued].len * delay_time * 1000)) {
+                dir_output->clear();
+                finish(false);
+            }
+            break;
+
+        case RECEIVING: {
+            uint8_t want = requests[first_queued].reply_len;
+            if(want == 0) {
+                finish(true);
+                break;
+            }
+            while(serial->readable() && reply_got < want) {
+                reply[reply_got++] = serial->getc();
+            }
+            if(reply_got >= want) {
+                finish(crc16(reply, want - 2) == (unsigned int)((uint8_t)reply[want - 2] | ((uint8_t)reply[want - 1] << 8)));
+            } else if(now - state_us >= reply_timeout_us) {
+                finish(false);
+            }
+            break;
+        }
+
+        case GAP:
+            if(now - state_us < turnaround_us) return;
+            state = IDLE;
+            break;
+    }
 }
 
-void Modbus::read_coil(int slave_addr, int coil_addr, int n_coils){
-    char telegram[8];
-    unsigned int crc;
+void Modbus::read_coil(int slave_addr, int coil_addr, int n_coils, reply_fnc_t fnc){
+    char telegram[6];
     telegram[0] = slave_addr;       // Slave address
     telegram[1] = 0x01;             // Function code
     telegram[2] = (coil_addr >> 8); // Coil address MSB
     telegram[3] = coil_addr & 0xFF; // Coil address LSB
     telegram[4] = (n_coils >> 8);   // number of coils to read MSB
     telegram[5] = n_coils & 0xFF;   // number of coils to read LSB
-    crc = crc16(telegram, 6);       
-    telegram[6] = crc;              // CRC LSB
-    telegram[7] = (crc >> 8);       // CRC MSB
-    dir_output->set();
-    serial->write(telegram,8);
-    delay((int) ceil(50 + 8 * delay_time));
-    dir_output->clear();
-    // TODO: read reply from buffer and return it
+    // address, function, byte count, the coils packed 8 to a byte and the CRC
+    queue(telegram, 6, 3 + (n_coils + 7) / 8 + 2, fnc);
 }
 
 void Modbus::read_holding_register(int slave_addr, int reg_addr, int n_regs){
@@ -93,40 +199,28 @@ void Modbus::read_holding_register(int slave_addr, int reg_addr, int n_regs){
 }
 
 void Modbus::write_coil(int slave_addr, int coil_addr, bool data){
-    char telegram[8];
-    unsigned int crc;
+    char telegram[6];
     telegram[0] = slave_addr;       // Slave address
     telegram[1] = 0x05;             // Function code
     telegram[2] = (coil_addr >> 8); // Coil address MSB
     telegram[3] = coil_addr & 0xFF; // Coil address LSB
     telegram[4] = 0x00;             // Data MSB
     telegram[5] = (data == true) ? 0xFF : 0x00; // Data LSB
-    crc = crc16(telegram, 6);       
-    telegram[6] = crc;              // CRC LSB
-    telegram[7] = (crc >> 8);       // CRC MSB
-    dir_output->set();
-    serial->write(telegram,8);
-    delay((int) ceil(50 + 8 * delay_time));
-    dir_output->clear();
+    // the reply echoes the request
+    queue(telegram, 6, 8);
 }
 
 
 void Modbus::write_holding_register(int slave_addr, int reg_addr, int data){
-    char telegram[8];
-    unsigned int crc;
+    char telegram[6];
     telegram[0] = slave_addr;       // Slave address
     telegram[1] = 0x06;             // Function code
     telegram[2] = (reg_addr >> 8);  // Register address MSB
     telegram[3] = reg_addr;         // Register address LSB
     telegram[4] = (data >> 8);      // Data MSB
     telegram[5] = data;             // Data LSB
-    crc = crc16(telegram, 6);       
-    telegram[6] = crc;              // CRC LSB
-    telegram[7] = (crc >> 8);       // CRC MSB
-    dir_output->set();
-    serial->write(telegram,8);
-    delay((int) ceil(50 + 8 * delay_time));
-    dir_output->clear();
+    // the reply echoes the request
+    queue(telegram, 6, 8);
 }
 
 void Modbus::diagnostic(int slave_addr, int test_sub_code, int data){
@@ -153,16 +247,7 @@ void Modbus::calculate_delay(int baudrate, int bits, int parity, int stop) {
     delay_time = bittime * (1 + bits + parity + 1);
 }
 
-void Modbus::delay(unsigned int value) {
-    
-    uint32_t start = us_ticker_read(); // mbed call
-    while ((us_ticker_read() - start) < value*1000) {
-        THEKERNEL->call_event(ON_IDLE, this);
-    }
-
-}
-
-unsigned int Modbus::crc16(char *data, unsigned int len) {
+unsigned int Modbus::crc16(const char *data, unsigned int len) {
     
     static const unsigned short crc_table[] = {
     0X0000, 0XC0C1, 0XC181, 0X0140, 0XC301, 0X03C0, 0X0280, 0XC241,
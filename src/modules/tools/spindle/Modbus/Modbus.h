@@ -9,21 +9,33 @@
 #define MODBUS_H
 
 #include "libs/Module.h"
-#include <vector>
+#include <functional>
+#include <stdint.h>
 
 class BufferedSoftSerial;
 class GPIO;
 
-class Modbus : public Module {
+// Modbus RTU master over a soft serial port and an RS485 direction pin.
+// Telegrams are queued and sent one at a time from poll(), which must be called from the main loop. The transmitter is
+// released from the serial interrupt as soon as the last byte is out, the reply is collected as it comes in and handed to
+// the callback, so nothing waits for the line.
+class Modbus {
     public:
+        // called from poll() with the whole reply including the CRC, ok is false if it timed out or the CRC did not match
+        using reply_fnc_t = std::function<void(bool ok, const char *reply, int len)>;
+
         Modbus( PinName rx_pin, PinName tx_pin, PinName dir_pin);
         Modbus( PinName rx_pin, PinName tx_pin, PinName dir_pin, int baud_rate);
         Modbus( PinName rx_pin, PinName tx_pin, PinName dir_pin, int baud_rate, const char *format);
 
-        void on_module_loaded();
-        void on_serial_char_received();
+        // queue a telegram without its CRC, reply_len is the length of the expected reply with the CRC or 0 if it is not read
+        bool queue(const char *telegram, int len, int reply_len= 0, reply_fnc_t fnc= nullptr);
+        // drop the telegrams that have not been started yet
+        void clear();
+        void poll();
+        bool is_busy() const { return state != IDLE || n_queued > 0; }
 
-        void read_coil(int slave_addr, int coil_addr, int n_coils);
+        void read_coil(int slave_addr, int coil_addr, int n_coils, reply_fnc_t fnc= nullptr);
         void read_holding_register(int slave_addr, int reg_addr, int n_regs);
         void write_coil(int slave_addr, int coil_addr, bool data);
         void write_holding_register(int slave_addr, int reg_addr, int data);
@@ -32,15 +44,43 @@ class Modbus : public Module {
         void write_multiple_registers(int slave_addr, int start_addr, int data);
         void read_write_multiple_holding_registers(int slave_addr, int read_addr, int n_read, int write_addr, int data);
         void calculate_delay(int baudrate, int bits, int parity, int stop);
-        void delay(unsigned int);
-        unsigned int crc16(char *data, unsigned int len); 
+        unsigned int crc16(const char *data, unsigned int len);
 
         GPIO *dir_output;
 
         BufferedSoftSerial* serial;
-        std::vector<int> buffer;
 
-        float delay_time;        
+        float delay_time;       // ms per character on the line
+
+    private:
+        static const int max_telegram = 16;
+        static const int max_queued = 4;
+        static const uint32_t enable_us = 1000;        // lets the transceiver settle before the first byte
+        static const uint32_t turnaround_us = 50000;   // silence between transactions, some VFDs need much more than 3.5 characters
+        static const uint32_t reply_timeout_us = 100000;
+
+        enum STATE { IDLE, ENABLING, SENDING, RECEIVING, GAP };
+
+        struct request_t {
+            char telegram[max_telegram];
+            uint8_t len;
+            uint8_t reply_len;
+            reply_fnc_t fnc;
+        };
+
+        void init_queue();
+        void on_tx_done();
+        void finish(bool ok);
+
+        request_t requests[max_queued];
+        uint8_t first_queued;
+        uint8_t n_queued;
+
+        char reply[max_telegram];
+        uint8_t reply_got;
+
+        volatile STATE state;
+        volatile uint32_t state_us;      // when the current state was entered
 };
 
 #endif
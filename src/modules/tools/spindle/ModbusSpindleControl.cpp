@@ -14,6 +14,7 @@
 #include "checksumm.h"
 #include "ConfigValue.h"
 #include "ModbusSpindleControl.h"
+#include "us_ticker_api.h"
 
 #define spindle_checksum                    CHECKSUM("spindle")
 #define spindle_rx_pin_checksum             CHECKSUM("rx_pin")
@@ -24,6 +25,9 @@ void ModbusSpindleControl::on_module_loaded()
 {
 
     spindle_on = false;
+    current_rpm = 0;
+    rpm_valid = false;
+    last_query_us = us_ticker_read();
     PinName rx_pin;
     PinName tx_pin;
     PinName dir_pin;
@@ -50,6 +54,19 @@ void ModbusSpindleControl::on_module_loaded()
     modbus = new Modbus(tx_pin, rx_pin, dir_pin);
 }
 
+void ModbusSpindleControl::on_idle(void *argument)
+{
+    // the transactions run in the background, this moves them along
+    modbus->poll();
+
+    // keep the cached speed fresh so reporting it never has to ask the VFD
+    uint32_t now = us_ticker_read();
+    if(!modbus->is_busy() && now - last_query_us >= 500000) {
+        last_query_us = now;
+        query_speed();
+    }
+}
+
 void ModbusSpindleControl::turn_on(void)
 {
     // TODO: Implement Modbus command to turn spindle on
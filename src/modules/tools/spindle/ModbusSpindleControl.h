@@ -9,6 +9,7 @@
 #define MODBUS_SPINDLE_CONTROL_MODULE_H
 
 #include "SpindleControl.h"
+#include <stdint.h>
 
 class Modbus;
 
@@ -18,6 +19,7 @@ class ModbusSpindleControl: public SpindleControl {
         ModbusSpindleControl() {};
         virtual ~ModbusSpindleControl() {};
         void on_module_loaded();
+        void on_idle(void *argument);
         
         Modbus* modbus;
         
@@ -26,6 +28,14 @@ class ModbusSpindleControl: public SpindleControl {
         virtual void set_speed(int);
         virtual void report_speed(void);
 
+    protected:
+        // queue a read of the speed that updates current_rpm, called at a fixed rate while the line is free
+        virtual void query_speed(void) {};
+
+        float current_rpm;
+        bool rpm_valid;
+        uint32_t last_query_us;
+
 };
 
 #endif
@@ -12,16 +12,17 @@
 #include "checksumm.h"
 #include "ConfigValue.h"
 #include "StreamOutputPool.h"
-#include "SlowTicker.h"
 #include "Conveyor.h"
 #include "system_LPC17xx.h"
 #include "PublicDataRequest.h"
 #include "SpindlePublicAccess.h"
+#include "Robot.h"
 #include "utils.h"
 
 #include "libs/Pin.h"
 #include "Gcode.h"
 #include "InterruptIn.h"
+#include "IrqPriority.h"
 #include "PwmOut.h"
 #include "port_api.h"
 #include "us_ticker_api.h"
@@ -38,6 +39,8 @@
 #define spindle_control_D_checksum          CHECKSUM("control_D")
 #define spindle_control_smoothing_checksum  CHECKSUM("control_smoothing")
 #define spindle_delay_s_checksum			CHECKSUM("delay_s")
+#define spindle_at_speed_tolerance_checksum	CHECKSUM("at_speed_tolerance")
+#define spindle_overlap_spin_checksum		CHECKSUM("overlap_spin")
 #define spindle_acc_ratio_checksum			CHECKSUM("acc_ratio")
 #define spindle_alarm_pin_checksum			CHECKSUM("alarm_pin")
 #define spindle_stall_s_checksum			CHECKSUM("stall_s")
@@ -52,13 +55,22 @@ PWMSpindleControl::PWMSpindleControl()
 
 void PWMSpindleControl::on_module_loaded()
 {
-    last_time = 0;
     last_edge = 0;
+    edge_time = 0;
+    edge_count = 0;
     current_rpm = 0;
-    current_I_value = 0;
     current_pwm_value = 0;
-    time_since_update = 0;
+    current_load = 0;
+    at_speed = false;
+    last_rpm = 0;
+    rpm_q8 = 0;
+    pwm_q24 = 0;
+    load_q16 = 0;
+    prev_error = 0;
+    update_count = 0;
+    target_change_count = 0;
     stall_timer = 0;
+    spin_time = 0;
     
     spindle_on = false;
     
@@ -69,8 +81,13 @@ void PWMSpindleControl::on_module_loaded()
     control_P_term = THEKERNEL->config->value(spindle_checksum, spindle_control_P_checksum)->by_default(0.0001f)->as_number();
     control_I_term = THEKERNEL->config->value(spindle_checksum, spindle_control_I_checksum)->by_default(0.0001f)->as_number();
     control_D_term = THEKERNEL->config->value(spindle_checksum, spindle_control_D_checksum)->by_default(0.0001f)->as_number();
+    set_p_term(control_P_term);
+    set_d_term(control_D_term);
 
     delay_s        = THEKERNEL->config->value(spindle_checksum, spindle_delay_s_checksum)->by_default(3)->as_number();
+    at_speed_tolerance = THEKERNEL->config->value(spindle_checksum, spindle_at_speed_tolerance_checksum)->by_default(5.0f)->as_number() / 100.0f;
+    // it needs the feedback to know when it is at speed
+    overlap        = THEKERNEL->config->value(spindle_checksum, spindle_overlap_spin_checksum)->by_default(false)->as_bool() && at_speed_tolerance > 0;
     stall_s        = THEKERNEL->config->value(spindle_checksum, spindle_stall_s_checksum)->by_default(100)->as_number();
     stall_count_rpm = THEKERNEL->config->value(spindle_checksum, spindle_stall_count_rpm_checksum)->by_default(8000)->as_number();
     stall_alarm_rpm = THEKERNEL->config->value(spindle_checksum, spindle_stall_alarm_rpm_checksum)->by_default(5000)->as_number();
@@ -83,6 +100,7 @@ void PWMSpindleControl::on_module_loaded()
         smoothing_decay = 1.0f;
     else
         smoothing_decay = 1.0f / (UPDATE_FREQ * smoothing_time);
+    decay_q16 = smoothing_decay * (1 << 16);
 
     // Get the pin for hardware pwm
     {
@@ -105,6 +123,7 @@ void PWMSpindleControl::on_module_loaded()
     {
     	max_pwm = 0.9;
     }
+    max_pwm_q24 = confine(max_pwm, 0.0f, 1.0f) * (1 << 24);
     
     int period = THEKERNEL->config->value(spindle_checksum, spindle_pwm_period_checksum)->by_default(1000)->as_int();
     THEKERNEL->Spindle_period_us = period;
@@ -120,7 +139,7 @@ void PWMSpindleControl::on_module_loaded()
             PinName pinname = port_pin((PortName)smoothie_pin->port_number, smoothie_pin->pin);
             feedback_pin = new mbed::InterruptIn(pinname);
             feedback_pin->rise(this, &PWMSpindleControl::on_pin_rise);
-            NVIC_SetPriority(EINT3_IRQn, 16);
+            IrqPriority::apply(EINT3_IRQn);
         } else {
             THEKERNEL->streams->printf("Error: Spindle feedback pin has to be on P0 or P2.\n");
             delete this;
@@ -128,42 +147,51 @@ void PWMSpindleControl::on_module_loaded()
         }
         delete smoothie_pin;
     }
-    
-    THEKERNEL->slow_ticker->attach(UPDATE_FREQ, this, &PWMSpindleControl::on_update_speed);
+
+    last_update = us_ticker_read();
 }
 
+// only timestamps the edge, the control loop works out the speed from all the edges since it last ran
 void PWMSpindleControl::on_pin_rise()
 {
-	if (irq_count >= pulses_per_rev) {
-		irq_count = 0;
-		rev_count ++;
-		uint32_t timestamp = us_ticker_read();
-		rev_time = timestamp - last_rev_time;
-		last_rev_time = timestamp;
-		time_since_update = 0;
+	uint32_t timestamp = us_ticker_read();
+	uint32_t dt = timestamp - last_edge;
+	// the first edge after stopping has nothing to measure from
+	if (dt < 1000000) {
+		edge_time += dt;
+		edge_count ++;
 	}
-	irq_count ++;
+	last_edge = timestamp;
 }
 
-uint32_t PWMSpindleControl::on_update_speed(uint32_t dummy)
+// the speed control loop, run from on_idle at UPDATE_FREQ rather than in an interrupt
+void PWMSpindleControl::update_speed()
 {
-    // If we don't get any interrupts for 1 second, set current RPM to 0
-    if (++time_since_update > UPDATE_FREQ)
-    {
-    	current_rpm = 0;
-    }
-    else{    // Calculate current RPM
+	__disable_irq();
+	uint32_t t = edge_time;
+	uint32_t n = edge_count;
+	edge_time = 0;
+	edge_count = 0;
+	uint32_t since_edge = us_ticker_read() - last_edge;
+	__enable_irq();
 
-	    uint32_t t = rev_time;
-	    if (t > 2000 * acc_ratio ) //RPM < 30000
-	    {	
-	        float new_rpm = 1000000 * acc_ratio * 60.0f / t;
-	        current_rpm = smoothing_decay * new_rpm + (1.0f - smoothing_decay) * current_rpm;
+    // If we don't get any interrupts for 1 second, set current RPM to 0
+    if (since_edge > 1000000) {
+    	rpm_q8 = 0;
+    } else if (n > 0 && t > 0) {
+    	// average period of the edges, one revolution is pulses_per_rev of them
+    	uint32_t rev_time = (uint64_t)t * (uint32_t)pulses_per_rev / n;
+	    if (rev_time > 2000 * acc_ratio ) //RPM < 30000
+	    {
+	        int32_t new_rpm_q8 = (uint32_t)(1000000 * 60 * acc_ratio) * (int64_t)256 / rev_time;
+	        rpm_q8 += ((int64_t)(new_rpm_q8 - rpm_q8) * decay_q16) >> 16;
 	    }
 	}
+
+	int32_t target = target_rpm * (factor / 100);
 	if(CARVERA_AIR == THEKERNEL->factory_set->MachineModel)
     {
-		if( fabs(target_rpm - last_rpm) > 500 )
+		if( fabsf(target_rpm - last_rpm) > 500 )
 		{
 			target_change_count = 0;
 			last_rpm = target_rpm;
@@ -172,49 +200,78 @@ uint32_t PWMSpindleControl::on_update_speed(uint32_t dummy)
     if (spindle_on) {
     	if (update_count > UPDATE_FREQ / 5) {
     		update_count = 0;
-            float error = target_rpm * (factor / 100) - current_rpm;
-            float acc_pwm = control_P_term * error;
-            
+            int32_t error = target - (rpm_q8 >> 8);
+            int64_t acc_pwm = (int64_t)p_term_q24 * error;
+
             if(CARVERA_AIR == THEKERNEL->factory_set->MachineModel)
             {
             	if(target_change_count>UPDATE_FREQ*5)	//when speed changed time < 7s,we didn't use D_ter,to rapid speed up/down
 	            {
-	            	acc_pwm += control_D_term * (error - prev_error);
+	            	acc_pwm += (int64_t)d_term_q24 * (error - prev_error);
 	            	target_change_count = UPDATE_FREQ*5;
             	}
             }
-            float new_pwm = current_pwm_value + acc_pwm;
-            new_pwm = confine(new_pwm, 0.0f, max_pwm);
+            pwm_q24 = confine(pwm_q24 + acc_pwm, (int64_t)0, (int64_t)max_pwm_q24);
 
             prev_error = error;
-            current_pwm_value = new_pwm;
     	}
     	update_count ++;
     	if(CARVERA_AIR == THEKERNEL->factory_set->MachineModel)
         {
 			target_change_count ++;
 		}
-
-		if (current_pwm_value > max_pwm) {
-			current_pwm_value = max_pwm;
-		}
     } else {
-        current_I_value = 0;
-        current_pwm_value = 0;
+        pwm_q24 = 0;
     }
 
+    // cached for status reports and the at speed gate so nothing has to work it out when asked
+    int32_t rpm = rpm_q8 >> 8;
+    at_speed = spindle_on && abs(target - rpm) <= at_speed_tolerance * target;
+    int32_t load = max_pwm_q24 > 0 ? ((int64_t)pwm_q24 << 16) / max_pwm_q24 : 0;
+    load_q16 += ((int64_t)(load - load_q16) * decay_q16) >> 16;
+
+    current_rpm = rpm;
+    current_pwm_value = pwm_q24 / (float)(1 << 24);
+    current_load = load_q16 / (float)(1 << 16);
+
+    write_pwm();
+}
+
+void PWMSpindleControl::write_pwm()
+{
     if (output_inverted)
         pwm_pin->write(1.0f - current_pwm_value);
     else
         pwm_pin->write(current_pwm_value);
-    
-    return 0;
+}
+
+// holds up the gcode until the spindle is within tolerance of the target RPM, at most delay_s from turning it on
+void PWMSpindleControl::wait_for_speed() {
+    while ((us_ticker_read() - spin_time) < (uint32_t)delay_s * 1000000) {
+        THEKERNEL->call_event(ON_IDLE, this);
+        if (THEKERNEL->is_halted() || at_speed || !spindle_on) return;
+    }
+}
+
+// holds up the gcode until the feedback says it has stopped, at most delay_s from turning it off
+void PWMSpindleControl::wait_for_stop() {
+    while (!spindle_on && current_rpm > 0 && (us_ticker_read() - spin_time) < (uint32_t)delay_s * 1000000) {
+        THEKERNEL->call_event(ON_IDLE, this);
+        if (THEKERNEL->is_halted()) return;
+    }
 }
 
 void PWMSpindleControl::turn_on() {
     spindle_on = true;
-    THEKERNEL->spindleon = true;
-    if (delay_s > 0) {
+    THEKERNEL->set_spindle_on(true);
+    at_speed = false;
+    spin_time = us_ticker_read();
+    if (delay_s > 0 && overlap) {
+        // the rapids to the work go on while it spins up, the first feed move waits for it
+        THEROBOT->feedGate = Callback<void()>::bind<PWMSpindleControl, &PWMSpindleControl::wait_for_speed>(this);
+    } else if (delay_s > 0 && at_speed_tolerance > 0) {
+        wait_for_speed();
+    } else if (delay_s > 0) {
         char buf[80];
         size_t n = snprintf(buf, sizeof(buf), "G4P%d", delay_s);
         if(n > sizeof(buf)) n= sizeof(buf);
@@ -226,8 +283,15 @@ void PWMSpindleControl::turn_on() {
 
 void PWMSpindleControl::turn_off() {
     spindle_on = false;
-    THEKERNEL->spindleon = false;
-    if (delay_s > 0) {
+    THEKERNEL->set_spindle_on(false);
+    // don't wait for the control loop, it may not run again for a while if we are halting
+    pwm_q24 = 0;
+    current_pwm_value = 0;
+    write_pwm();
+    spin_time = us_ticker_read();
+    THEROBOT->feedGate = nullptr;
+    // it spins down while the Z goes up and over to the rack, M5.1 waits for it before the tool is let go
+    if (delay_s > 0 && !overlap) {
         char buf[80];
         size_t n = snprintf(buf, sizeof(buf), "G4P%d", delay_s);
         if(n > sizeof(buf)) n= sizeof(buf);
@@ -251,6 +315,7 @@ void PWMSpindleControl::report_speed() {
 
 void PWMSpindleControl::set_p_term(float p) {
     control_P_term = p;
+    p_term_q24 = p * (1 << 24);
 }
 
 
@@ -261,6 +326,7 @@ void PWMSpindleControl::set_i_term(float i) {
 
 void PWMSpindleControl::set_d_term(float d) {
     control_D_term = d;
+    d_term_q24 = d * (1 << 24);
 }
 
 
@@ -286,6 +352,8 @@ void PWMSpindleControl::on_get_public_data(void* argument)
 		t->target_rpm = this->target_rpm;
 		t->current_pwm_value = this->current_pwm_value;
 		t->factor= this->factor;
+		t->load = this->current_load;
+		t->at_speed = this->at_speed;
 		pdr->set_taken();
     }
 }
@@ -298,6 +366,10 @@ void PWMSpindleControl::on_set_public_data(void* argument)
     if(pdr->second_element_is(turn_off_spindle_checksum)) {
         this->turn_off();
         pdr->set_taken();
+    } else if(pdr->second_element_is(set_spindle_factor_checksum)) {
+        // realtime spindle override
+        this->set_factor(*static_cast<float *>(pdr->get_data_ptr()));
+        pdr->set_taken();
     }
 }
 
@@ -332,6 +404,12 @@ bool PWMSpindleControl::get_stall(void)
 
 void PWMSpindleControl::on_idle(void *argument)
 {
+	uint32_t now = us_ticker_read();
+	if (now - last_update >= 1000000 / UPDATE_FREQ) {
+		last_update = now;
+		update_speed();
+	}
+
 	if(THEKERNEL->is_halted()) return;
 	// check spindle alarm
     if (this->get_alarm()) {
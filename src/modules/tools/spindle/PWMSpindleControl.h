@@ -30,7 +30,10 @@ class PWMSpindleControl: public SpindleControl {
     private:
         
         void on_pin_rise();
-        uint32_t on_update_speed(uint32_t dummy);
+        void update_speed();
+        void write_pwm();
+        void wait_for_speed();
+        void wait_for_stop();
         
         mbed::PwmOut *pwm_pin; // PWM output for spindle speed control
         mbed::InterruptIn *feedback_pin; // Interrupt pin for measuring speed
@@ -38,15 +41,24 @@ class PWMSpindleControl: public SpindleControl {
        
         bool vfd_spindle; // true if we have a VFD driven spindle
 
-        // Current values, updated at runtime
+        // Current values, updated at runtime, the control loop works in fixed point
+        // and these are the float copies for reporting
         float current_rpm;
         float target_rpm;
         float last_rpm;
-        float current_I_value;
-        float prev_error;
         float current_pwm_value;
-        int time_since_update;
-        uint32_t last_irq;
+        float current_load;
+        bool at_speed;
+        uint32_t last_update;       // us_ticker time of the last control loop update
+
+        int32_t rpm_q8;             // filtered RPM << 8
+        int32_t pwm_q24;            // PWM duty, 1 << 24 is full on
+        int32_t load_q16;           // filtered pwm_q24 / max_pwm_q24, 1 << 16 is max_pwm
+        int32_t prev_error;         // in RPM
+        int32_t decay_q16;          // smoothing_decay
+        int32_t max_pwm_q24;
+        int32_t p_term_q24;
+        int32_t d_term_q24;
 
         // Values from config
         volatile float pulses_per_rev;
@@ -56,6 +68,9 @@ class PWMSpindleControl: public SpindleControl {
         float smoothing_decay;
         float max_pwm;
         int  delay_s;
+        bool overlap;               // spin up and down while it moves, the first feed move and M5.1 wait instead
+        uint32_t spin_time;         // us_ticker time the spindle was last turned on or off
+        float at_speed_tolerance;
         int  stall_s;
         int  stall_count_rpm;
         int  stall_alarm_rpm;
@@ -63,14 +78,11 @@ class PWMSpindleControl: public SpindleControl {
         float acc_ratio;
         Pin alarm_pin;
 
-        // These fields are updated by the interrupt
-        uint32_t last_edge; // Timestamp of last edge
-        volatile uint32_t last_time; // Time delay between last two edges
-        volatile uint32_t irq_count;
-        
-        uint32_t last_rev_time;
-        volatile uint32_t rev_time;
-        volatile uint32_t rev_count;
+        // These fields are updated by the interrupt, the time between every pair of edges is summed until the control loop takes it
+        volatile uint32_t last_edge; // Timestamp of last edge
+        volatile uint32_t edge_time; // Sum of the times between edges since the last update
+        volatile uint32_t edge_count; // and how many edges that was
+
         uint32_t update_count;
         uint32_t target_change_count;
 
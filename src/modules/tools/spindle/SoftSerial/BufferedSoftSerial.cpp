@@ -118,6 +118,7 @@ void BufferedSoftSerial::txIrq(void)
         } else {
             // disable the TX interrupt when there is nothing left to send
             SoftSerial::attach(NULL, SoftSerial::TxIrq);
+            _txdone.call();
             break;
         }
     }
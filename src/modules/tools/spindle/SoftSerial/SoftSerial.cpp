@@ -20,8 +20,10 @@ SoftSerial::SoftSerial(PinName TX, PinName RX, const char* name) {
         rx = new InterruptIn(RX);
         rx_en = true;
         out_valid = false;
+        rx_bit = -1;
         rxticker.attach(this, &SoftSerial::rx_handler);
-        rx->fall(this, &SoftSerial::rx_gpio_irq_handler);
+        rx->fall(this, &SoftSerial::rx_fall_handler);
+        rx->rise(this, &SoftSerial::rx_rise_handler);
     }
     
     baud(9600);
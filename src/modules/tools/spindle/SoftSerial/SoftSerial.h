@@ -100,13 +100,18 @@ protected:
     
     FunctionPointer fpointer[2];
     
-    //rx
-    void rx_gpio_irq_handler(void);
+    //rx, decoded from the times of its edges, see SoftSerial_rx.cpp
+    void rx_fall_handler(void);
+    void rx_rise_handler(void);
+    void rx_edge(int level);
+    void rx_fill(int cells);
     void rx_handler(void);
-    int read_buffer, rx_bit;
+    int read_buffer;
+    volatile int rx_bit;            // cells of the frame read so far, -1 between frames
+    int rx_level;                   // of the line since the last edge
+    unsigned int rx_last;           // us_ticker_read() at the last edge
     volatile int out_buffer;
     volatile bool out_valid;
-    bool rx_error;
     FlexTicker rxticker;
     
     //tx
@@ -7,9 +7,12 @@
 
 #include "libs/Kernel.h"
 #include "SoftSerial.h"
+#include "us_ticker_api.h"
 
-
-uint32_t overhead_us = 200 * 1000000 / SystemCoreClock;         //Random estimation of the overhead of mbed libs, makes slow devices like LPC812 @ 12MHz perform better
+// The frame is read from when its edges come rather than by sampling each bit on a timer. Each edge is timed with
+// us_ticker_read() and the bit cells since the one before are the level the line had, so a byte costs an interrupt
+// per change of level and one timer event in its stop bit. Every timer event goes through us_ticker_insert_event(),
+// which walks the event list with interrupts off, step ticker included, so that is the part there is less of.
 
 int SoftSerial::_getc( void ) {
     out_valid = false;
@@ -20,76 +23,97 @@ int SoftSerial::readable(void) {
     return out_valid;
 }
 
-//Start receiving byte
-void SoftSerial::rx_gpio_irq_handler(void) {
-    rxticker.prime();
-    rxticker.setNext(bit_period + (bit_period >> 1) - overhead_us);
-    rx->fall(NULL);
-    rx_bit = 0;
-    rx_error = false;
-};    
+void SoftSerial::rx_fall_handler(void) {
+    rx_edge(0);
+}
 
-void SoftSerial::rx_handler(void) {
-    //Receive data
-    int val = rx->read();
- 
-    rxticker.setNext(bit_period);
-    rx_bit++;
-    
-    
-    if (rx_bit <= _bits) {
-        read_buffer |= val << (rx_bit - 1);
+void SoftSerial::rx_rise_handler(void) {
+    rx_edge(1);
+}
+
+// the cells up to the edge had the level the line had since the last one
+void SoftSerial::rx_fill(int cells) {
+    if (cells > _total_bits - rx_bit)
+        cells = _total_bits - rx_bit;
+    if (cells <= 0)
+        return;
+    if (rx_level)
+        read_buffer |= ((1 << cells) - 1) << rx_bit;
+    rx_bit += cells;
+}
+
+void SoftSerial::rx_edge(int level) {
+    unsigned int now = us_ticker_read();
+
+    if (rx_bit < 0) {
+        // idle, a rise is the end of a frame that has already been given up on
+        if (level)
+            return;
+        //Start receiving byte
+        rx_bit = 0;
+        rx_level = 0;
+        rx_last = now;
+        read_buffer = 0;
+        // once, in the middle of the last stop bit, by when every edge of the frame has come
+        rxticker.prime();
+        rxticker.setNext(_total_bits * bit_period - (bit_period >> 1));
         return;
     }
-    
+
+    rx_fill((int)(now - rx_last + (bit_period >> 1)) / bit_period);
+    rx_level = level;
+    rx_last = now;
+}
+
+// the stop bit, what is left of the frame has the level of the last edge
+void SoftSerial::rx_handler(void) {
+    rxticker.detach();
+    if (rx_bit < 0)
+        return;
+    rx_fill(_total_bits - rx_bit);
+    rx_bit = -1;
+
+    int frame = read_buffer;
+    bool error = (frame & 1) != 0;
+    int data = (frame >> 1) & ((1 << _bits) - 1);
+
     //Receive parity
+    int parity_bit = (frame >> (1 + _bits)) & 1;
     bool parity_count;
-    if (rx_bit == _bits + 1) {
-        switch (_parity) {
-            case Forced1:
-                if (val == 0)
-                    rx_error = true;
-                return;
-            case Forced0:
-                if (val == 1)
-                    rx_error = true;
-                return;
-            case Even:
-            case Odd:
-                parity_count = val;
-                for (int i = 0; i<_bits; i++) {
-                    if (((read_buffer >> i) & 0x01) == 1)
-                        parity_count = !parity_count;
-                }
-                if ((parity_count) && (_parity == Even))
-                    rx_error = true;
-                if ((!parity_count) && (_parity == Odd))
-                    rx_error = true;
-                return;
-            case None:
-                // No parity, nothing to do here
-                break;
-        }
+    switch (_parity) {
+        case Forced1:
+            if (parity_bit == 0)
+                error = true;
+            break;
+        case Forced0:
+            if (parity_bit == 1)
+                error = true;
+            break;
+        case Even:
+        case Odd:
+            parity_count = parity_bit;
+            for (int i = 0; i<_bits; i++) {
+                if (((data >> i) & 0x01) == 1)
+                    parity_count = !parity_count;
+            }
+            if ((parity_count) && (_parity == Even))
+                error = true;
+            if ((!parity_count) && (_parity == Odd))
+                error = true;
+            break;
+        case None:
+            // No parity, nothing to do here
+            break;
     }
-    
+
     //Receive stop
-    if (rx_bit < _bits + (bool)_parity + _stop_bits) {
-        if (!val)
-            rx_error = true;
-        return;
-    }    
-    
-    //The last stop bit
-    if (!val)
-        rx_error = true;
-    
-    if (!rx_error) {
+    int stop = frame >> (1 + _bits + (bool)_parity);
+    if (stop != (1 << _stop_bits) - 1)
+        error = true;
+
+    if (!error) {
         out_valid = true;
-        out_buffer = read_buffer;
+        out_buffer = data;
         fpointer[RxIrq].call();
     }
-    read_buffer = 0;
-    rxticker.detach(); 
-    rx->fall(this, &SoftSerial::rx_gpio_irq_handler);
 }
-
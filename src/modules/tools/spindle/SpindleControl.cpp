@@ -45,6 +45,12 @@ void SpindleControl::on_gcode_received(void *argument)
         {
         	if(THEKERNEL->is_halted()) return; // if in halted state ignore any commands
         	if (!THEKERNEL->get_laser_mode()) {
+                // already running, only the speed changes and that need not stop the motion
+                if (spindle_on && gcode->has_letter('S')) {
+                    queue_speed(gcode->get_value('S'));
+                    return;
+                }
+
                 // current tool number and tool offset
                 struct tool_status tool;
                 bool tool_ok = PublicData::get_value( atc_handler_checksum, get_tool_status_checksum, &tool );
@@ -78,6 +84,12 @@ void SpindleControl::on_gcode_received(void *argument)
                 }
         	}
         }
+        else if (gcode->m == 5 && gcode->subcode == 1)
+        {
+            // M5.1: hold until a spindle that has been turned off has stopped, before the tool is let go
+            THECONVEYOR->wait_for_idle();
+            wait_for_stop();
+        }
         else if (gcode->m == 5)
         {
         	if (!THEKERNEL->get_laser_mode()) {
@@ -110,9 +122,32 @@ void SpindleControl::on_gcode_received(void *argument)
             }
         }
     }
+    else if (!gcode->has_g && gcode->has_letter('S'))
+    {
+        // S on its own changes the speed of a running spindle
+        if (spindle_on && !THEKERNEL->is_halted() && !THEKERNEL->get_laser_mode()) {
+            queue_speed(gcode->get_value('S'));
+        }
+    }
 
 }
 
+// the new speed takes effect as the next move starts, so the moves either side of it are planned as one
+void SpindleControl::queue_speed(float rpm)
+{
+    if (rpm < 0) rpm = 0;
+    if (!THECONVEYOR->queue_event(Conveyor::event_fnc_t::bind<SpindleControl, &SpindleControl::queued_speed>(this), (uint32_t)rpm)) {
+        // too many waiting, fall back to stopping for it
+        THECONVEYOR->wait_for_idle();
+        set_speed(rpm);
+    }
+}
+
+void SpindleControl::queued_speed(uint32_t rpm)
+{
+    set_speed(rpm);
+}
+
 void SpindleControl::on_halt(void *argument)
 {
     if (argument == nullptr) {
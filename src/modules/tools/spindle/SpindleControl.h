@@ -10,6 +10,8 @@
 
 #include "libs/Module.h"
 
+#include <stdint.h>
+
 class SpindleControl: public Module {
     public:
         SpindleControl() {};
@@ -22,9 +24,12 @@ class SpindleControl: public Module {
     private:
         void on_gcode_received(void *argument);
         void on_halt(void *argument);
-        
+        void queue_speed(float rpm);
+        void queued_speed(uint32_t rpm);
+
         virtual void turn_on(void) {};
         virtual void turn_off(void) {};
+        virtual void wait_for_stop(void) {};
         virtual void set_speed(int) {};
         virtual void report_speed(void) {};
         virtual void set_p_term(float) {};
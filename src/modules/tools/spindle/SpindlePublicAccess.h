@@ -8,6 +8,7 @@
 #define pwm_spindle_control_checksum		CHECKSUM("pwm_spindle_control")
 #define get_spindle_status_checksum    CHECKSUM("get_spindle_status")
 #define turn_off_spindle_checksum    CHECKSUM("turn_off_spindle_status")
+#define set_spindle_factor_checksum    CHECKSUM("set_spindle_factor")
 
 struct spindle_status {
 	bool state;
@@ -15,6 +16,8 @@ struct spindle_status {
     float target_rpm;
     float current_pwm_value;
 	float factor;
+	float load;			// filtered PWM drive as a fraction of max_pwm, a rough estimate of how hard the spindle is working
+	bool at_speed;		// the RPM is within the at speed tolerance of the target
 };
 
 #endif
@@ -24,10 +24,14 @@
 #include "utils.h"
 
 #include "PwmOut.h"
+#include "InterruptIn.h"
+#include "IrqPriority.h"
+#include "us_ticker_api.h"
 
 #include "MRI_Hooks.h"
 
 #include <algorithm>
+#include <string.h>
 
 #define    startup_state_checksum       CHECKSUM("startup_state")
 #define    startup_value_checksum       CHECKSUM("startup_value")
@@ -49,6 +53,7 @@
 #define    pwm_period_ms_checksum       CHECKSUM("pwm_period_ms")
 #define    failsafe_checksum            CHECKSUM("failsafe_set_to")
 #define    ignore_on_halt_checksum      CHECKSUM("ignore_on_halt")
+#define    input_pin_debounce_checksum  CHECKSUM("input_pin_debounce_ms")
 
 #define ROUND2DP(x) (roundf(x * 1e2F) / 1e2F)
 
@@ -226,8 +231,19 @@ void Switch::on_config_reload(void *argument)
         this->output_type= NONE;
         // set to initial state
         this->input_pin_state = this->input_pin->get();
-        // input pin polling
-        THEKERNEL->slow_ticker->attach( 100, this, &Switch::pinpoll_tick);
+        this->edge_pending = false;
+        this->debounce_ms = THEKERNEL->config->value(switch_checksum, this->name_checksum, input_pin_debounce_checksum )->by_default(5)->as_number();
+        if(this->input_pin->port_number == 0 || this->input_pin->port_number == 2) {
+            // these last as long as the module
+            mbed::InterruptIn *irq = this->input_pin->interrupt_pin();
+            irq->rise(this, &Switch::on_input_edge);
+            irq->fall(this, &Switch::on_input_edge);
+            IrqPriority::apply(EINT3_IRQn);
+            this->register_for_event(ON_IDLE);
+        } else {
+            // input pin polling, only P0 and P2 can interrupt
+            THEKERNEL->slow_ticker->attach( 100, this, &Switch::pinpoll_tick);
+        }
     }
 
     if(!is_input) {
@@ -439,16 +455,37 @@ void Switch::on_gcode_received(void *argument)
     if (!(match_input_on_gcode(gcode) || match_input_off_gcode(gcode))) {
         return;
     }
-    // we need to sync this with the queue, so we need to wait for queue to empty, however due to certain slicers
-    // issuing redundant swicth on calls regularly we need to optimize by making sure the value is actually changing
-    // hence we need to do the wait for queue in each case rather than just once at the start
+    // in step with the motion, the change is attached to the next move queued and happens as it starts, so coolant
+    // or air switched between cuts neither stops the planner nor comes on before the moves ahead of it have run
+    Conveyor::event_fnc_t fnc;
+    uint32_t arg = 0;
     if(match_input_on_gcode(gcode)) {
-    	this->turn_on_switch(gcode->has_letter('S') ? gcode->get_value('S') : -1);
-    } else if (match_input_off_gcode(gcode)) {
-    	this->turn_off_switch();
+        float value = gcode->has_letter('S') ? gcode->get_value('S') : -1;
+        memcpy(&arg, &value, sizeof arg);
+        fnc = Conveyor::event_fnc_t::bind<Switch, &Switch::queued_on>(this);
+    } else {
+        fnc = Conveyor::event_fnc_t::bind<Switch, &Switch::queued_off>(this);
+    }
+    if(!THECONVEYOR->queue_event(fnc, arg)) {
+        // too many waiting, fall back to stopping for it
+        THECONVEYOR->wait_for_idle();
+        fnc(arg);
     }
 }
 
+// the value is the bits of the float S given, -1 for none
+void Switch::queued_on(uint32_t value)
+{
+    float v;
+    memcpy(&v, &value, sizeof v);
+    this->turn_on_switch(v);
+}
+
+void Switch::queued_off(uint32_t)
+{
+    this->turn_off_switch();
+}
+
 void Switch::on_get_public_data(void *argument)
 {
     PublicDataRequest *pdr = static_cast<PublicDataRequest *>(argument);
@@ -548,7 +585,22 @@ void Switch::on_main_loop(void *argument)
     }
 }
 
-// TODO Make this use InterruptIn
+// pin change interrupt, the bounces after it only move the time on
+void Switch::on_input_edge()
+{
+    this->edge_us = us_ticker_read();
+    this->edge_pending = true;
+}
+
+// idle runs inside every wait loop too, so the input is still seen while the main loop is blocked
+void Switch::on_idle(void *arg)
+{
+    if(!this->edge_pending || us_ticker_read() - this->edge_us < this->debounce_ms * 1000U) return;
+    // cleared first so an edge while it is read is not lost
+    this->edge_pending = false;
+    pinpoll_tick(0);
+}
+
 // Check the state of the button and act accordingly
 uint32_t Switch::pinpoll_tick(uint32_t dummy)
 {
@@ -32,8 +32,10 @@ class Switch : public Module {
         void on_get_public_data(void* argument);
         void on_set_public_data(void* argument);
         void on_halt(void *arg);
+        void on_idle(void *arg);
 
         uint32_t pinpoll_tick(uint32_t dummy);
+        void on_input_edge();
         enum OUTPUT_TYPE {NONE, SIGMADELTA, DIGITAL, HWPWM, SWPWM, DIGITALPWM};
 
     private:
@@ -43,6 +45,8 @@ class Switch : public Module {
         bool match_input_off_gcode(const Gcode* gcode) const;
         void turn_on_switch(float value);
         void turn_off_switch();
+        void queued_on(uint32_t value);
+        void queued_off(uint32_t);
 
         float switch_value;
         float default_on_value;
@@ -61,6 +65,10 @@ class Switch : public Module {
         };
         std::string    output_on_command;
         std::string    output_off_command;
+        // an input on P0 or P2 interrupts on both edges and is read once it has been steady for debounce_ms
+        volatile uint32_t edge_us;
+        volatile bool  edge_pending;
+        uint16_t       debounce_ms;
         struct {
             uint16_t  name_checksum:16;
             uint16_t  input_pin_behavior:16;
@@ -8,7 +8,7 @@
 #ifndef TEMPSENSOR_H
 #define TEMPSENSOR_H
 
-#include <map>
+#include "LetterMap.h"
 #include <stdint.h>
 
 class TempSensor
@@ -22,7 +22,7 @@ public:
     // Return temperature in degrees Celsius.
     virtual float get_temperature() { return -1.0F; }
 
-    typedef std::map<char, float> sensor_options_t;
+    typedef LetterMap<float> sensor_options_t;
     virtual bool set_optional(const sensor_options_t& options) { return false; }
     virtual bool get_optional(sensor_options_t& options) { return false; }
     virtual void get_raw() {}
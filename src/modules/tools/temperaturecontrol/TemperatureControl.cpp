@@ -99,9 +99,12 @@ void TemperatureControl::on_module_loaded()
     this->register_for_event(ON_GET_PUBLIC_DATA);
     this->register_for_event(ON_IDLE);
     this->register_for_event(ON_SECOND_TICK);
+    // the sensor readings and violation checks do not need to run every time round the loop
+    this->schedule_event(ON_IDLE, 10);
 
     if(!this->readonly) {
         this->register_for_event(ON_MAIN_LOOP);
+        this->schedule_event(ON_MAIN_LOOP, 20, true);
         this->register_for_event(ON_SET_PUBLIC_DATA);
         this->register_for_event(ON_HALT);
     }
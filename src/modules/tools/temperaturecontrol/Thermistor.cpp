@@ -15,6 +15,7 @@
 #include "libs/Median.h"
 #include "utils.h"
 #include "StreamOutputPool.h"
+#include "platform_memory.h"
 
 // a const list of predefined thermistors
 #include "predefined_thermistors.h"
@@ -47,10 +48,14 @@ Thermistor::Thermistor()
     min_temp= 999;
     max_temp= 0;
     this->thermistor_number= 0; // not a predefined thermistor
+    this->table= nullptr;
+    this->table_shift= 0;
+    this->table_valid= false;
 }
 
 Thermistor::~Thermistor()
 {
+    if(table != nullptr) AHB.dealloc(table);
 }
 
 // Get configuration from the config file
@@ -180,6 +185,28 @@ void Thermistor::UpdateConfig(uint16_t module_checksum, uint16_t name_checksum)
         return;
     }
 
+    build_table();
+}
+
+// work out the temperature at every table step from the current coefficients
+void Thermistor::build_table()
+{
+    // readings use the exact calculation until the table is done
+    table_valid= false;
+    if(table == nullptr) {
+        table= (int16_t *)AHB.alloc(table_size * sizeof(int16_t));
+        if(table == nullptr) return;
+    }
+
+    const uint32_t max_adc_value= THEKERNEL->adc->get_max_value();
+    table_shift= 0;
+    while((max_adc_value >> table_shift) >= table_size - 1) table_shift++;
+
+    for (int i = 0; i < table_size; i++) {
+        float t= calc_temperature(i << table_shift);
+        table[i]= (isinf(t) || t < -300.0F || t > 3000.0F) ? table_invalid : (int16_t)roundf(t * 10.0F);
+    }
+    table_valid= true;
 }
 
 // print out predefined thermistors
@@ -281,6 +308,21 @@ void Thermistor::get_raw()
 }
 
 float Thermistor::adc_value_to_temperature(uint32_t adc_value)
+{
+    if(table_valid) {
+        uint32_t i= adc_value >> table_shift;
+        if(i < table_size - 1 && table[i] != table_invalid && table[i + 1] != table_invalid) {
+            int32_t f= adc_value & ((1 << table_shift) - 1);
+            int32_t t= (table[i] << table_shift) + (table[i + 1] - table[i]) * f;
+            return t / (10.0F * (1 << table_shift));
+        }
+    }
+
+    // the ends of the range where the curve is too steep to interpolate, or open and short circuit
+    return calc_temperature(adc_value);
+}
+
+float Thermistor::calc_temperature(uint32_t adc_value)
 {
     const uint32_t max_adc_value= THEKERNEL->adc->get_max_value();
     if ((adc_value >= max_adc_value) || (adc_value == 0))
@@ -352,6 +394,7 @@ bool Thermistor::set_optional(const sensor_options_t& options) {
             calc_jk();
             thermistor_number= predefined;
             this->bad_config= false;
+            build_table();
             return true;
 
         }else {
@@ -370,6 +413,7 @@ bool Thermistor::set_optional(const sensor_options_t& options) {
             use_steinhart_hart= true;
             thermistor_number= predefined;
             this->bad_config= false;
+            build_table();
             return true;
         }
     }
@@ -396,6 +440,7 @@ bool Thermistor::set_optional(const sensor_options_t& options) {
     }
 
     if(this->bad_config) this->bad_config= false;
+    build_table();
 
     return true;
 }
@@ -36,8 +36,17 @@ class Thermistor : public TempSensor
     private:
         int new_thermistor_reading();
         float adc_value_to_temperature(uint32_t adc_value);
+        float calc_temperature(uint32_t adc_value);
+        void build_table();
         void calc_jk();
 
+        // ADC value to temperature in 0.1C every 1 << table_shift ADC counts, interpolated between,
+        // worked out from the coefficients when they are set so the reading does not need logf
+        static const int table_size = 129;
+        static const int16_t table_invalid = INT16_MIN;
+        int16_t *table;
+        uint8_t table_shift;
+
         // Thermistor computation settings using beta, not used if using Steinhart-Hart
         float r0;
         float t0;
@@ -66,6 +75,7 @@ class Thermistor : public TempSensor
         struct {
             bool bad_config:1;
             bool use_steinhart_hart:1;
+            volatile bool table_valid:1;
         };
         uint8_t thermistor_number;
 };
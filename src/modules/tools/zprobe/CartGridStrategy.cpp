@@ -57,6 +57,16 @@
     Display mode of current grid can be changed to human readable mode (table with coordinates) by using
        leveling-strategy.rectangular-grid.human_readable  true
 
+    The grid is interpolated bilinearly by default, a smooth bicubic surface through the probed points fits warped stock
+    much better with a coarse grid, so fewer points need to be probed for the same accuracy...
+        leveling-strategy.rectangular-grid.bicubic  true
+
+    Normally every point is probed from the full probe height, with a probe_clearance each point is instead probed from
+    that far above the height predicted from the points already probed around it, and the probe only lifts that far
+    above the surface between points. If the bed is not found where it was predicted the point is probed again the usual way.
+    This is much quicker on large grids, but the surface between points must not rise more than this above the probed points...
+        leveling-strategy.rectangular-grid.probe_clearance  1
+
     For probes like the bltouch you can define a before probe and after probe GCode sequence (to deploy and stow the probe)
         leveling-strategy.rectangular-grid.before_probe_gcode M280
         leveling-strategy.rectangular-grid.after_probe_gcode M281
@@ -74,6 +84,7 @@
     M370 clears the grid and turns off compensation
     M374 Save grid to /sd/cartesian.grid (Note grid cannot be saved in two corners mode)
     M374.1 delete /sd/cartesian.grid
+    The saved grid carries a version and a crc, grids saved by older firmware without them still load
     M375 Load the grid from /sd/cartesian.grid and enable compensation
     M375.1 display the current grid
     M561 clears the grid and turns off compensation
@@ -100,6 +111,8 @@
 #include "nuts_bolts.h"
 #include "utils.h"
 #include "platform_memory.h"
+#include "WriteQueue.h"
+#include "crc16.h"
 
 #include <string>
 #include <algorithm>
@@ -125,15 +138,91 @@
 #define dampening_start_checksum     CHECKSUM("dampening_start")
 #define before_probe_gcode_checksum  CHECKSUM("before_probe_gcode")
 #define after_probe_gcode_checksum   CHECKSUM("after_probe_gcode")
+#define bicubic_checksum             CHECKSUM("bicubic")
+#define probe_clearance_checksum     CHECKSUM("probe_clearance")
 #define flex_x_points_checksum       CHECKSUM("flex_x_points")
 #define flex_compensation_always_active_checksum CHECKSUM("flex_compensation_always_active")
+#define verify_tolerance_checksum    CHECKSUM("verify_tolerance")
 
 #define GRIDFILE "/sd/cartesian.grid"
 #define GRIDFILE_NM "/sd/cartesian_nm.grid"
 #define FLEX_COMPENSATION_FILE "/sd/flex_compensation.dat"
+#define LEVELING_MAP_FILE "/sd/leveling_%d.map"
 
 #define PI 3.14159265358979323846F
 
+namespace {
+    // saved files are their layout behind this header, files saved before it have the layout alone
+    struct saved_header_t {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t crc;       // crc16_ccitt of the layout
+        uint32_t length;    // of the layout
+    };
+    const uint32_t GRID_MAGIC = 0x44495247; // "GRID"
+    const uint32_t FLEX_MAGIC = 0x58454C46; // "FLEX"
+    const uint32_t MAP_MAGIC = 0x50414D4C;  // "LMAP"
+    const uint16_t SAVED_VERSION = 1;
+
+    std::string add_header(uint32_t magic, const std::string &layout)
+    {
+        saved_header_t h{magic, SAVED_VERSION, crc16_ccitt(layout.data(), layout.size()), (uint32_t)layout.size()};
+        std::string data((const char *)&h, sizeof(h));
+        data.append(layout);
+        return data;
+    }
+
+    // reads the whole file in one go and leaves just the layout in data, checked if it has a header
+    bool read_saved(const char *filename, uint32_t magic, size_t max_layout, std::string &data, StreamOutput *stream)
+    {
+        FILE *fp = fopen(filename, "r");
+        if(fp == NULL) {
+            stream->printf("error:Failed to open %s\n", filename);
+            return false;
+        }
+        data.resize(sizeof(saved_header_t) + max_layout + 1);
+        size_t n = fread(&data[0], 1, data.size(), fp);
+        fclose(fp);
+        data.resize(n);
+
+        saved_header_t h;
+        if(n < sizeof(h) || memcmp(data.data(), &magic, sizeof(magic)) != 0) {
+            if(n > max_layout) {
+                stream->printf("error:%s is too big\n", filename);
+                return false;
+            }
+            return true;
+        }
+
+        memcpy(&h, data.data(), sizeof(h));
+        data.erase(0, sizeof(h));
+        if(h.version != SAVED_VERSION) {
+            stream->printf("error:%s is version %d, only %d can be read\n", filename, h.version, SAVED_VERSION);
+            return false;
+        }
+        if(h.length != data.size() || h.crc != crc16_ccitt(data.data(), data.size())) {
+            stream->printf("error:%s is corrupt\n", filename);
+            return false;
+        }
+        return true;
+    }
+
+    // the next n bytes of a layout read by read_saved
+    bool take(const std::string &data, size_t &at, void *out, size_t n)
+    {
+        if(at + n > data.size()) return false;
+        memcpy(out, data.data() + at, n);
+        at += n;
+        return true;
+    }
+}
+
+// the flex triangle, all in mm
+#define FLEX_TRIANGLE_Y 90.0F           // Y distance between the plane through both rods to the center of the spindle
+#define FLEX_MACHINE_OFFSET_Z 51.0F     // Z distance between the centerplane between the rods and the end of the spindle
+#define FLEX_SENSOR_MACHINE_Z -115.36F  // Z machine coordinate if the tool length would be 0
+#define FLEX_Z_RANGE 160.0F             // Z travel the flex direction is tabled over, below the top
+
 CartGridStrategy::CartGridStrategy(ZProbe *zprobe) : LevelingStrategy(zprobe)
 {
     grid = nullptr;
@@ -143,6 +232,8 @@ CartGridStrategy::CartGridStrategy(ZProbe *zprobe) : LevelingStrategy(zprobe)
     flex_max_delta = 0.0F;
     cartesian_grid_active = false;
     flex_compensation_always_active = false;
+    comp_cache.tlo = NAN;
+    comp_cache.cell = -1;
 }
 
 CartGridStrategy::~CartGridStrategy()
@@ -162,10 +253,14 @@ bool CartGridStrategy::handleConfig()
     this->new_file_format= true;
 
     tolerance = THEKERNEL->config->value(leveling_strategy_checksum, cart_grid_leveling_strategy_checksum, tolerance_checksum)->by_default(0.03F)->as_number();
+    // how far the three points M375.2 probes may be from a kept map for it to be used again
+    verify_tolerance = THEKERNEL->config->value(leveling_strategy_checksum, cart_grid_leveling_strategy_checksum, verify_tolerance_checksum)->by_default(0.05F)->as_number();
     save = THEKERNEL->config->value(leveling_strategy_checksum, cart_grid_leveling_strategy_checksum, save_checksum)->by_default(false)->as_bool();
     do_home = THEKERNEL->config->value(leveling_strategy_checksum, cart_grid_leveling_strategy_checksum, do_home_checksum)->by_default(true)->as_bool();
     only_by_two_corners = THEKERNEL->config->value(leveling_strategy_checksum, cart_grid_leveling_strategy_checksum, only_by_two_corners_checksum)->by_default(false)->as_bool();
     human_readable = THEKERNEL->config->value(leveling_strategy_checksum, cart_grid_leveling_strategy_checksum, human_readable_checksum)->by_default(false)->as_bool();
+    bicubic = THEKERNEL->config->value(leveling_strategy_checksum, cart_grid_leveling_strategy_checksum, bicubic_checksum)->by_default(false)->as_bool();
+    probe_clearance = THEKERNEL->config->value(leveling_strategy_checksum, cart_grid_leveling_strategy_checksum, probe_clearance_checksum)->by_default(0.0F)->as_number();
     do_manual_attach = THEKERNEL->config->value(leveling_strategy_checksum, cart_grid_leveling_strategy_checksum, m_attach_checksum)->by_default(false)->as_bool();
 
     this->height_limit = THEKERNEL->config->value(leveling_strategy_checksum, cart_grid_leveling_strategy_checksum, height_limit_checksum)->by_default(NAN)->as_number();
@@ -270,62 +365,26 @@ void CartGridStrategy::save_grid(StreamOutput *stream)
 
     // we use a different file format depending on whether it is square or not
     const char *filename= (this->new_file_format) ? GRIDFILE_NM : GRIDFILE;
-    FILE *fp = fopen(filename, "w");
-    if(fp == NULL) {
-        stream->printf("error:Failed to open grid file %s\n", filename);
-        return;
-    }
-    uint8_t tmp_configured_grid_size = current_grid_x_size;
-    if(fwrite(&tmp_configured_grid_size, sizeof(uint8_t), 1, fp) != 1) {
-        stream->printf("error:Failed to write grid x size\n");
-        fclose(fp);
-        return;
-    }
 
+    // the file is put together here and written from idle by the write queue
+    std::string data;
+    data.reserve(2 + (4 + current_grid_x_size * current_grid_y_size) * sizeof(float));
+    data.append(1, (char)current_grid_x_size);
     if(this->new_file_format){
-        tmp_configured_grid_size = current_grid_y_size;
-        if(fwrite(&tmp_configured_grid_size, sizeof(uint8_t), 1, fp) != 1) {
-            stream->printf("error:Failed to write grid y size\n");
-            fclose(fp);
-            return;
-        }
-    }
-
-    if(fwrite(&x_start, sizeof(float), 1, fp) != 1)  {
-        stream->printf("error:Failed to write x_start\n");
-        fclose(fp);
-        return;
-    }
-    
-    if(fwrite(&y_start, sizeof(float), 1, fp) != 1)  {
-        stream->printf("error:Failed to write y_start\n");
-        fclose(fp);
-        return;
+        data.append(1, (char)current_grid_y_size);
     }
+    data.append((const char *)&x_start, sizeof(float));
+    data.append((const char *)&y_start, sizeof(float));
+    data.append((const char *)&x_size, sizeof(float));
+    data.append((const char *)&y_size, sizeof(float));
+    data.append((const char *)grid, current_grid_x_size * current_grid_y_size * sizeof(float));
 
-    if(fwrite(&x_size, sizeof(float), 1, fp) != 1)  {
-        stream->printf("error:Failed to write x_size\n");
-        fclose(fp);
+    data = add_header(GRID_MAGIC, data);
+    if(!WriteQueue::replace(filename, data.data(), data.size())) {
+        stream->printf("error:Failed to write grid file %s\n", filename);
         return;
     }
-
-    if(fwrite(&y_size, sizeof(float), 1, fp) != 1)  {
-        stream->printf("error:Failed to write y_size\n");
-        fclose(fp);
-        return;
-    }
-
-    for (int y = 0; y < current_grid_y_size; y++) {
-        for (int x = 0; x < current_grid_x_size; x++) {
-            if(fwrite(&grid[x + (current_grid_x_size * y)], sizeof(float), 1, fp) != 1) {
-                stream->printf("error:Failed to write grid\n");
-                fclose(fp);
-                return;
-            }
-        }
-    }
     stream->printf("grid saved to %s\n", filename);
-    fclose(fp);
 }
 
 bool CartGridStrategy::load_grid(StreamOutput *stream)
@@ -333,87 +392,67 @@ bool CartGridStrategy::load_grid(StreamOutput *stream)
     // we use a different file format depending on whether it is square or not
     const char *filename= (this->new_file_format) ? GRIDFILE_NM : GRIDFILE;
 
-    FILE *fp = fopen(filename, "r");
-    if(fp == NULL) {
-        stream->printf("error:Failed to open grid %s\n", filename);
+    // a grid that was just saved may still be queued
+    WriteQueue::sync(filename);
+    std::string data;
+    if(!read_saved(filename, GRID_MAGIC, 2 + (4 + configured_grid_x_size * configured_grid_y_size) * sizeof(float), data, stream)) {
         return false;
     }
 
+    size_t at = 0;
     uint8_t load_grid_x_size, load_grid_y_size;
     float x, y, temp_x_start, temp_y_start;
 
-    if(fread(&load_grid_x_size, sizeof(uint8_t), 1, fp) != 1) {
+    if(!take(data, at, &load_grid_x_size, sizeof(uint8_t))) {
         stream->printf("error:Failed to read grid size\n");
-        fclose(fp);
         return false;
     }
 
     if(load_grid_x_size > configured_grid_x_size) {
         stream->printf("error:grid size x is greater than config - read %d - config %d\n", load_grid_x_size, configured_grid_x_size);
-        fclose(fp);
         return false;
     }
 
     load_grid_y_size = load_grid_x_size;
 
     if(this->new_file_format){
-        if(fread(&load_grid_y_size, sizeof(uint8_t), 1, fp) != 1) {
+        if(!take(data, at, &load_grid_y_size, sizeof(uint8_t))) {
             stream->printf("error:Failed to read grid size\n");
-            fclose(fp);
             return false;
         }
 
         if(load_grid_y_size > configured_grid_y_size) {
             stream->printf("error:grid size y is greater than config - read %d - config %d\n", load_grid_y_size, configured_grid_y_size);
-            fclose(fp);
             return false;
         }
     }
 
-    current_grid_x_size = load_grid_x_size;
-    current_grid_y_size = load_grid_y_size;
-
-    if(fread(&temp_x_start, sizeof(float), 1, fp) != 1) {
-        stream->printf("error:Failed to read x_start\n");
-        fclose(fp);
+    if(!take(data, at, &temp_x_start, sizeof(float)) || !take(data, at, &temp_y_start, sizeof(float))) {
+        stream->printf("error:Failed to read grid start\n");
         return false;
     }
 
-    if(fread(&temp_y_start, sizeof(float), 1, fp) != 1) {
-        stream->printf("error:Failed to read y_start\n");
-        fclose(fp);
-        return false;
-    }
-
-    x_start = temp_x_start;
-    y_start = temp_y_start;
-
-    if(fread(&x, sizeof(float), 1, fp) != 1) {
-        stream->printf("error:Failed to read grid x size\n");
-        fclose(fp);
+    if(!take(data, at, &x, sizeof(float)) || !take(data, at, &y, sizeof(float))) {
+        stream->printf("error:Failed to read grid size\n");
         return false;
     }
 
-    if(fread(&y, sizeof(float), 1, fp) != 1) {
-        stream->printf("error:Failed to read grid y size\n");
-        fclose(fp);
+    // the whole grid is there before any of it replaces the current one
+    size_t grid_bytes = load_grid_x_size * load_grid_y_size * sizeof(float);
+    if(data.size() - at < grid_bytes) {
+        stream->printf("error:Failed to read grid\n");
         return false;
     }
 
+    current_grid_x_size = load_grid_x_size;
+    current_grid_y_size = load_grid_y_size;
+    x_start = temp_x_start;
+    y_start = temp_y_start;
     x_size = x;
     y_size = y;
+    take(data, at, grid, grid_bytes);
 
-    for (int y = 0; y < current_grid_y_size; y++) {
-        for (int x = 0; x < current_grid_x_size; x++) {
-            if(fread(&grid[x + (current_grid_x_size * y)], sizeof(float), 1, fp) != 1) {
-                stream->printf("error:Failed to read grid\n");
-                fclose(fp);
-                return false;
-            }
-        }
-    }
     stream->printf("grid loaded, grid: (%f, %f), size: %d x %d\n", x_size, y_size, load_grid_x_size, load_grid_y_size);
-    fclose(fp);
     return true;
 }
 
@@ -514,6 +553,9 @@ bool CartGridStrategy::handleGcode(Gcode *gcode)
                 const char *filename= (this->new_file_format) ? GRIDFILE_NM : GRIDFILE;
                 remove(filename);
                 gcode->stream->printf("%s deleted\n", filename);
+            } else if(gcode->subcode == 2) { // M374.2 Pn: keep the grid as leveling map n
+                if(gcode->has_letter('P')) save_map(gcode->get_int('P'), gcode->stream);
+                else gcode->stream->printf("error:No leveling map number given\n");
             } else {
                 __disable_irq();
                 save_grid(gcode->stream);
@@ -525,6 +567,11 @@ bool CartGridStrategy::handleGcode(Gcode *gcode)
         } else if(gcode->m == 375) { // M375: load grid, M375.1 display grid
             if(gcode->subcode == 1) {
                 print_bed_level(gcode->stream);
+            } else if(gcode->subcode == 2) {
+                THEKERNEL->conveyor->wait_for_idle();
+                THEROBOT->disable_segmentation= true;
+                use_map(gcode);
+                THEROBOT->disable_segmentation= false;
             } else {
                 if (load_grid(gcode->stream)) {
                     cartesian_grid_active = true;
@@ -590,7 +637,9 @@ void CartGridStrategy::setAdjustFunction(bool on)
 }
 
 void CartGridStrategy::updateCompensationTransform()
-{   
+{
+    update_compensation_cache();
+
     if(flex_compensation_active) {
         THEKERNEL->set_flex_compensation_active(true);
     } else {
@@ -599,14 +648,154 @@ void CartGridStrategy::updateCompensationTransform()
     // Enable compensation transform if ANY compensation is active
     if(cartesian_grid_active || flex_compensation_active) {
         // set the compensationTransform in robot
-        using std::placeholders::_1;
-        using std::placeholders::_2;
-        using std::placeholders::_3;
-        THEROBOT->compensationTransform = std::bind(&CartGridStrategy::doCompensation, this, _1, _2, _3);
+        THEROBOT->compensationTransform = Callback<void(float*, bool, bool)>::bind<CartGridStrategy, &CartGridStrategy::doCompensation>(this);
+        THEROBOT->compensationSplits = Callback<int(const float*, const float*, float*, int)>::bind<CartGridStrategy, &CartGridStrategy::compensationSplits>(this);
     } else {
         // clear it
         THEROBOT->compensationTransform = nullptr;
+        THEROBOT->compensationSplits = nullptr;
+    }
+}
+
+// the current grid kept as map n, where it is taken from the origin of the WCS it was probed in so it follows the fixture
+bool CartGridStrategy::save_map(int n, StreamOutput *stream)
+{
+    if(isnan(grid[0])) {
+        stream->printf("error:No grid to save\n");
+        return false;
+    }
+
+    Robot::wcs_t origin = THEROBOT->wcs2mcs(Robot::wcs_t(0, 0, 0, 0, 0));
+    map_info_t info;
+    info.x_points = current_grid_x_size;
+    info.y_points = current_grid_y_size;
+    info.wcs = THEROBOT->get_current_wcs();
+    info.unused = 0;
+    info.x_from_origin = x_start - std::get<X_AXIS>(origin);
+    info.y_from_origin = y_start - std::get<Y_AXIS>(origin);
+    info.x_size = x_size;
+    info.y_size = y_size;
+
+    std::string data((const char *)&info, sizeof(info));
+    data.append((const char *)grid, current_grid_x_size * current_grid_y_size * sizeof(float));
+    data = add_header(MAP_MAGIC, data);
+
+    char filename[32];
+    snprintf(filename, sizeof(filename), LEVELING_MAP_FILE, n);
+    if(!WriteQueue::replace(filename, data.data(), data.size())) {
+        stream->printf("error:Failed to write leveling map %s\n", filename);
+        return false;
+    }
+    stream->printf("leveling map %d saved to %s\n", n, filename);
+    return true;
+}
+
+// false if there is no map n or it does not fit the configured grid
+bool CartGridStrategy::read_map(int n, map_info_t &info, std::vector<float> &values)
+{
+    char filename[32];
+    snprintf(filename, sizeof(filename), LEVELING_MAP_FILE, n);
+    WriteQueue::sync(filename);
+    FILE *fp = fopen(filename, "r");
+    if(fp == NULL) return false;
+    fclose(fp);
+
+    std::string data;
+    size_t max_layout = sizeof(info) + configured_grid_x_size * configured_grid_y_size * sizeof(float);
+    if(!read_saved(filename, MAP_MAGIC, max_layout, data, THEKERNEL->streams)) return false;
+
+    size_t at = 0;
+    if(!take(data, at, &info, sizeof(info))) return false;
+    if(info.x_points < 2 || info.y_points < 2 || info.x_points * info.y_points > configured_grid_x_size * configured_grid_y_size) return false;
+    values.resize(info.x_points * info.y_points);
+    return take(data, at, values.data(), values.size() * sizeof(float));
+}
+
+// probes three corners of a kept map, which has to match the differences between them, a change of the stock
+// height as a whole is taken out by the Z zero so only its tilt and warp count
+bool CartGridStrategy::verify_map(const map_info_t &info, const std::vector<float> &values, float xs, float ys, float height, float &worst)
+{
+    cartesian_grid_active = false;
+    updateCompensationTransform();
+    if(!findBed(xs, ys, height)) return false;
+    float z_start = THEROBOT->get_axis_position(Z_AXIS);
+
+    const int corners[3][2] = {{0, 0}, {info.x_points - 1, 0}, {0, info.y_points - 1}};
+    float first = 0;
+    worst = 0;
+    for (int i = 0; i < 3; i++) {
+        int ix = corners[i][0], iy = corners[i][1];
+        float x = xs + (info.x_size / (info.x_points - 1)) * ix;
+        float y = ys + (info.y_size / (info.y_points - 1)) * iy;
+        float mm;
+        if(!zprobe->doProbeAt(mm, x - X_PROBE_OFFSET_FROM_EXTRUDER, y - Y_PROBE_OFFSET_FROM_EXTRUDER)) return false;
+        float measured = height - mm;
+        if (i == 0) first = measured;
+        float expected = values[ix + info.x_points * iy] - values[0];
+        float off = fabsf((measured - first) - expected);
+        if(off > worst) worst = off;
+    }
+    if(THEROBOT->get_axis_position(Z_AXIS) < z_start) zprobe->coordinated_move(NAN, NAN, z_start, zprobe->getFastFeedrate());
+    return true;
+}
+
+/*
+ * M375.2 Pn [X Y A B I J H], uses leveling map n when three points probed on the stock agree with it, otherwise
+ * probes the grid again as G32 R1 X Y A B I J H would and keeps it as map n for the next time.
+ */
+bool CartGridStrategy::use_map(Gcode *gc)
+{
+    if(!gc->has_letter('P')) {
+        gc->stream->printf("error:No leveling map number given\n");
+        return false;
+    }
+    int n = gc->get_int('P');
+    float height = gc->has_letter('H') ? gc->get_value('H') : zprobe->getProbeHeight();
+    // the grid is probed from where it starts, not where the verify left it
+    float here[3];
+    THEROBOT->get_axis_position(here, 3);
+
+    map_info_t info;
+    std::vector<float> values;
+    if(read_map(n, info, values)) {
+        Robot::wcs_t origin = THEROBOT->wcs2mcs(Robot::wcs_t(0, 0, 0, 0, 0));
+        float xs = std::get<X_AXIS>(origin) + info.x_from_origin;
+        float ys = std::get<Y_AXIS>(origin) + info.y_from_origin;
+        float worst;
+        if(info.wcs != THEROBOT->get_current_wcs()) {
+            gc->stream->printf("leveling map %d is for G%d, probing again\n", n, 54 + info.wcs);
+        } else if(!verify_map(info, values, xs, ys, height, worst)) {
+            gc->stream->printf("error:Verify probe of leveling map %d failed\n", n);
+            return false;
+        } else if(worst > verify_tolerance) {
+            gc->stream->printf("leveling map %d is off by %1.3f mm, probing again\n", n, worst);
+        } else {
+            current_grid_x_size = info.x_points;
+            current_grid_y_size = info.y_points;
+            x_start = xs;
+            y_start = ys;
+            x_size = info.x_size;
+            y_size = info.y_size;
+            memcpy(grid, values.data(), values.size() * sizeof(float));
+            cartesian_grid_active = true;
+            updateCompensationTransform();
+            gc->stream->printf("leveling map %d verified within %1.3f mm, grid probe skipped\n", n, worst);
+            return true;
+        }
     }
+
+    if(!gc->has_letter('A') || !gc->has_letter('B')) {
+        gc->stream->printf("error:No leveling map %d to use and no grid to probe for it\n", n);
+        return false;
+    }
+    char buf[96];
+    snprintf(buf, sizeof(buf), "G32 R1 X%1.3f Y%1.3f A%1.3f B%1.3f I%d J%d H%1.3f", gc->has_letter('X') ? gc->get_value('X') : 0,
+        gc->has_letter('Y') ? gc->get_value('Y') : 0, gc->get_value('A'), gc->get_value('B'),
+        gc->has_letter('I') ? gc->get_int('I') : current_grid_x_size, gc->has_letter('J') ? gc->get_int('J') : current_grid_y_size, height);
+    Gcode probe(buf, gc->stream);
+    zprobe->coordinated_move(here[X_AXIS], here[Y_AXIS], NAN, zprobe->getFastFeedrate());
+    handleGcode(&probe);
+    return cartesian_grid_active && save_map(n, gc->stream);
 }
 
 bool CartGridStrategy::findBed(float x, float y, float z)
@@ -777,6 +966,10 @@ bool CartGridStrategy::doProbe(Gcode *gc)
     float z_reference = (gc->has_letter('H') ? gc->get_value('H') : zprobe->getProbeHeight()) - mm; // this should be zero
     gc->stream->printf("probe at 0,0 is %1.3f mm\n", z_reference);
 
+    // every probe done by doProbeAt() starts from and returns to this height
+    float z_start = THEROBOT->get_axis_position(Z_AXIS);
+    float probe_h = gc->has_letter('H') ? gc->get_value('H') : zprobe->getProbeHeight();
+
     // keep track of worst case delta
     float max_delta= fabs(z_reference);
     float max_z = z_reference;
@@ -799,20 +992,35 @@ bool CartGridStrategy::doProbe(Gcode *gc)
         for (int xCount = xStart; xCount != xStop; xCount += xInc) {
             float xProbe = this->x_start + (this->x_size / (this->current_grid_x_size - 1)) * xCount;
 
-            if(!zprobe->doProbeAt(mm, xProbe - X_PROBE_OFFSET_FROM_EXTRUDER, yProbe - Y_PROBE_OFFSET_FROM_EXTRUDER)){
-                return false;
+            float predicted;
+            if(probe_clearance > 0 && predict_grid_point(xCount, yCount, xInc, predicted)) {
+                // the machine Z the probe should trigger at, from the grid value
+                float z_bed = predicted + z_reference + z_start - probe_h;
+                if(!probe_near(mm, xProbe, yProbe, z_bed, z_start)) return false;
+
+            } else {
+                // back up to the full probe height if the last point was probed from nearer the bed
+                if(THEROBOT->get_axis_position(Z_AXIS) < z_start) zprobe->coordinated_move(NAN, NAN, z_start, zprobe->getFastFeedrate());
+                if(!zprobe->doProbeAt(mm, xProbe - X_PROBE_OFFSET_FROM_EXTRUDER, yProbe - Y_PROBE_OFFSET_FROM_EXTRUDER)){
+                    return false;
+                }
             }
 
-            float measured_z = (gc->has_letter('H') ? gc->get_value('H') : zprobe->getProbeHeight()) - mm; // this is the delta z from bed at 0,0
+            float measured_z = probe_h - mm; // this is the delta z from bed at 0,0
             max_z = (measured_z > max_z ) ? measured_z : max_z;
             min_z = (measured_z < min_z ) ? measured_z : min_z;	
             measured_z = measured_z - z_reference;
-            gc->stream->printf("DEBUG: X%1.3f, Y%1.3f, Z%1.3f\n", xProbe, yProbe, measured_z);
+            if (!zprobe->log_probe(xProbe, yProbe, measured_z, true, ProbeLog::GRID)) {
+                gc->stream->printf("DEBUG: X%1.3f, Y%1.3f, Z%1.3f\n", xProbe, yProbe, measured_z);
+            }
             grid[xCount + (this->current_grid_x_size * yCount)] = measured_z;
             if(fabs(measured_z) > max_delta) max_delta= fabs(measured_z);
         }
     }
 
+    // leave it at the height it would have been left at
+    if(THEROBOT->get_axis_position(Z_AXIS) < z_start) zprobe->coordinated_move(NAN, NAN, z_start, zprobe->getFastFeedrate());
+
     print_bed_level(gc->stream);
 
     gc->stream->printf("Max deviation from zero: %1.3f\n", max_delta);
@@ -836,76 +1044,200 @@ bool CartGridStrategy::doProbe(Gcode *gc)
     return true;
 }
 
+// predict the grid value at x, y from the points probed before it, the grid is probed in rows going back and forth
+// so the point before it in the row and the row before are already done
+bool CartGridStrategy::predict_grid_point(int x, int y, int x_inc, float &z)
+{
+    int nx = this->current_grid_x_size;
+    int px = x - x_inc;
+    bool have_prev = px >= 0 && px < nx;
+    if(have_prev && y > 0) {
+        // carry on the slope of the row before
+        z = grid[px + (nx * y)] + grid[x + (nx * (y - 1))] - grid[px + (nx * (y - 1))];
+    } else if(have_prev) {
+        int ppx = px - x_inc;
+        z = (ppx >= 0 && ppx < nx) ? 2 * grid[px + (nx * y)] - grid[ppx + (nx * y)] : grid[px + (nx * y)];
+    } else if(y > 0) {
+        z = grid[x + (nx * (y - 1))];
+    } else {
+        return false;
+    }
+    return !isnan(z);
+}
+
+// probe at x, y starting probe_clearance above where the bed is expected to be rather than from the full height,
+// mm is then what doProbeAt() would have returned from z_start, the probe is left where it triggered
+bool CartGridStrategy::probe_near(float &mm, float x, float y, float z_bed, float z_start)
+{
+    // lift clear of where it is and of where it is going, but never above the usual height
+    float z_from = std::min(z_start, std::max(THEROBOT->get_axis_position(Z_AXIS), z_bed) + probe_clearance);
+    zprobe->coordinated_move(NAN, NAN, z_from, zprobe->getFastFeedrate());
+    zprobe->coordinated_move(x - X_PROBE_OFFSET_FROM_EXTRUDER, y - Y_PROBE_OFFSET_FROM_EXTRUDER, NAN, zprobe->getFastFeedrate() * 4);
+
+    float moved;
+    if(zprobe->run_probe(moved, zprobe->getSlowFeedrate(), z_from - z_bed + probe_clearance)) {
+        mm = z_start - (z_from - moved);
+        return true;
+    }
+    if(THEKERNEL->is_halted()) return false;
+
+    // it was not where it was predicted, so probe it the usual way
+    zprobe->coordinated_move(NAN, NAN, z_start, zprobe->getFastFeedrate());
+    return zprobe->doProbeAt(mm, x - X_PROBE_OFFSET_FROM_EXTRUDER, y - Y_PROBE_OFFSET_FROM_EXTRUDER);
+}
+
+void CartGridStrategy::update_compensation_cache()
+{
+    // find min/maxes, and handle the case where size is negative (assuming this is possible? Legacy code supported this)
+    comp_cache.min_x = std::min(this->x_start, this->x_start + this->x_size);
+    comp_cache.max_x = std::max(this->x_start, this->x_start + this->x_size);
+    comp_cache.min_y = std::min(this->y_start, this->y_start + this->y_size);
+    comp_cache.max_y = std::max(this->y_start, this->y_start + this->y_size);
+    comp_cache.cells_per_x = (this->x_size != 0) ? (this->current_grid_x_size - 1) / this->x_size : 0;
+    comp_cache.cells_per_y = (this->y_size != 0) ? (this->current_grid_y_size - 1) / this->y_size : 0;
+    comp_cache.flex_cells_per_x = (flex_x_size > 0 && flex_current_x_points > 1) ? (flex_current_x_points - 1) / flex_x_size : 0;
+
+    // the grid position is found in fixed point, see doCompensation()
+    comp_cache.q_x_start = q16_from_float(this->x_start);
+    comp_cache.q_y_start = q16_from_float(this->y_start);
+    comp_cache.q_cells_per_x = q24_from_float(comp_cache.cells_per_x);
+    comp_cache.q_cells_per_y = q24_from_float(comp_cache.cells_per_y);
+    comp_cache.q_grid_max_x = q16_from_float(this->current_grid_x_size - 1.001F);
+    comp_cache.q_grid_max_y = q16_from_float(this->current_grid_y_size - 1.001F);
+
+    // forces flex_z and the cell coefficients to be worked out again on the next segment
+    comp_cache.tlo = NAN;
+    comp_cache.cell = -1;
+}
+
+// adds the fraction along a to b of each crossing of the lines at start + k*step, k < lines, in between
+static bool add_splits(float a, float b, float start, float step, int lines, float *ts, int &n, int max_ts)
+{
+    if(fabsf(b - a) < 0.00001F) return true;
+    for (int k = 0; k < lines; k++) {
+        float t = (start + k * step - a) / (b - a);
+        if(t > 0.0F && t < 1.0F) {
+            if(n >= max_ts) return false;
+            ts[n++] = t;
+        }
+    }
+    return true;
+}
+
+// where doCompensation() is not smooth along the line from, to: the grid lines and edges, the damping heights and the flex points
+int CartGridStrategy::compensationSplits(const float *from, const float *to, float *ts, int max_ts)
+{
+    int n = 0;
+    if(cartesian_grid_active && !isnan(grid[0])) {
+        if(!add_splits(from[X_AXIS], to[X_AXIS], x_start, x_size / (current_grid_x_size - 1), current_grid_x_size, ts, n, max_ts)) return -1;
+        if(!add_splits(from[Y_AXIS], to[Y_AXIS], y_start, y_size / (current_grid_y_size - 1), current_grid_y_size, ts, n, max_ts)) return -1;
+        if(!isnan(damping_interval) && !add_splits(from[Z_AXIS], to[Z_AXIS], dampening_start, damping_interval, 2, ts, n, max_ts)) return -1;
+    }
+    if(flex_compensation_active && flex_compensation_data != nullptr && flex_current_x_points > 1) {
+        if(!add_splits(from[X_AXIS], to[X_AXIS], flex_x_start, flex_x_size / (flex_current_x_points - 1), flex_current_x_points, ts, n, max_ts)) return -1;
+    }
+    return n;
+}
+
+// the coefficients of the bicubic patch over the grid cell at x, y, in cell units, see doCompensation()
+// the slopes at the corners are central differences of the neighbouring points (one sided at the edges of the grid)
+// so the patches join smoothly, this is the Catmull-Rom surface through the probed points
+void CartGridStrategy::bicubic_coefficients(int x, int y)
+{
+    int nx = this->current_grid_x_size;
+    int ny = this->current_grid_y_size;
+    auto z = [this, nx](int i, int j) { return grid[i + (j * nx)]; };
+
+    // value, x slope, y slope and cross slope at each corner
+    float f[2][2], fx[2][2], fy[2][2], fxy[2][2];
+    for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < 2; j++) {
+            int gx = x + i, gy = y + j;
+            int x0 = std::max(gx - 1, 0), x1 = std::min(gx + 1, nx - 1);
+            int y0 = std::max(gy - 1, 0), y1 = std::min(gy + 1, ny - 1);
+            f[i][j] = z(gx, gy);
+            fx[i][j] = (z(x1, gy) - z(x0, gy)) / (x1 - x0);
+            fy[i][j] = (z(gx, y1) - z(gx, y0)) / (y1 - y0);
+            fxy[i][j] = (z(x1, y1) - z(x1, y0) - z(x0, y1) + z(x0, y0)) / ((x1 - x0) * (y1 - y0));
+        }
+    }
+
+    // A = M F M', with F the corner values and slopes and M the cubic hermite basis
+    const float m[4][4] = {{1, 0, 0, 0}, {0, 0, 1, 0}, {-3, 3, -2, -1}, {2, -2, 1, 1}};
+    const float F[4][4] = {
+        {f[0][0],  f[0][1],  fy[0][0],  fy[0][1]},
+        {f[1][0],  f[1][1],  fy[1][0],  fy[1][1]},
+        {fx[0][0], fx[0][1], fxy[0][0], fxy[0][1]},
+        {fx[1][0], fx[1][1], fxy[1][0], fxy[1][1]}
+    };
+    float mf[4][4];
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            mf[i][j] = 0;
+            for (int k = 0; k < 4; k++) mf[i][j] += m[i][k] * F[k][j];
+        }
+    }
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            float a = 0;
+            for (int k = 0; k < 4; k++) a += mf[i][k] * m[j][k];
+            comp_cache.bicubic[i][j] = a;
+        }
+    }
+}
+
 void CartGridStrategy::doCompensation(float *target, bool inverse, bool debug)
 {
     // First handle flex compensation if active (applied first as requested)
     if(flex_compensation_active && flex_compensation_data != nullptr && flex_current_x_points > 0) {
-        // Convert constants to integers (multiply by 10000 for fixed-point arithmetic)
-        int triangle_y_int = 900000;            // Y distance between the plane through both rods to the center of the spindle (90.0 * 10000)
-        int machine_offset_z_int = 510000;      // Z distance between the centerplane between the rods and the end of the spindle (51.0 * 10000)
-        int sensor_machine_z_int = -1153600;   // Z machine coordinate if the tool length would be 0 (-115.36 * 10000)
-        int refmz_int = (int)(THEKERNEL->eeprom_data->REFMZ * 10000.0f);                  
-        int TLO_int = (int)(THEKERNEL->eeprom_data->TLO * 10000.0f);
-        float interpolated_delta = 0.0;
-
-        // Convert target Z to integer for calculation
-        int target_z_int = (int)(target[Z_AXIS] * 10000.0f);
-        int triangle_z_int = abs(target_z_int) + machine_offset_z_int + TLO_int + refmz_int - sensor_machine_z_int;
-
-        float y_component = 0.0;
-        float z_component = 0.0;
-
-        // Check if target is within flex compensation range
-        if (target[X_AXIS] >= flex_x_start && target[X_AXIS] <= flex_x_start + flex_x_size) {
-            // Calculate grid spacing using integers
-            int flex_x_size_int = (int)(flex_x_size * 10000.0f);
-            int grid_spacing_int = flex_x_size_int / (flex_current_x_points - 1);
-            
-            // Find which grid segment the target falls into
-            int target_x_int = (int)(target[X_AXIS] * 10000.0f);
-            int flex_x_start_int = (int)(flex_x_start * 10000.0f);
-            int relative_x_int = target_x_int - flex_x_start_int;
-            int grid_index = relative_x_int / grid_spacing_int;
-            
-            // Clamp grid_index to valid range
-            if (grid_index >= flex_current_x_points - 1) {
-                grid_index = flex_current_x_points - 2;  // Use last segment
-            }
-            if (grid_index < 0) {
-                grid_index = 0;  // Use first segment
-            }
-            
-            // Calculate interpolation factor using integers
-            int grid_x_low_int = flex_x_start_int + grid_index * grid_spacing_int;
-            int grid_x_high_int = flex_x_start_int + (grid_index + 1) * grid_spacing_int;
-            int t_numerator = target_x_int - grid_x_low_int;
-            int t_denominator = grid_x_high_int - grid_x_low_int;
-            
-            // Calculate interpolation factor t (0 to 10000 for 0.0 to 1.0)
-            int t_int = 0;
-            if (t_denominator != 0) {
-                t_int = (t_numerator * 10000) / t_denominator;
-            }
-            
-            // Clamp t_int to [0, 10000] range
-            if (t_int < 0) t_int = 0;
-            if (t_int > 10000) t_int = 10000;
-            
-            // Linear interpolation between two grid points using integers
-            float delta_low = flex_compensation_data[grid_index];
-            float delta_high = flex_compensation_data[grid_index + 1];
-            interpolated_delta = delta_low + (t_int / 10000.0f) * (delta_high - delta_low);
-        }else{
-            if(target[X_AXIS] < this->x_start){
-                interpolated_delta = flex_compensation_data[0];
-            }else{
-                interpolated_delta = flex_compensation_data[flex_current_x_points - 1];
+        // the tool length only changes on a tool change so only redo this when it does
+        float tlo = THEKERNEL->eeprom_data->TLO;
+        float refmz = THEKERNEL->eeprom_data->REFMZ;
+        if(tlo != comp_cache.tlo || refmz != comp_cache.refmz) {
+            comp_cache.tlo = tlo;
+            comp_cache.refmz = refmz;
+            comp_cache.flex_z = FLEX_MACHINE_OFFSET_Z + tlo + refmz - FLEX_SENSOR_MACHINE_Z;
+
+            // the rotational component only depends on the height, so it is tabled here and interpolated per segment,
+            // the flex itself is linear between its points so the two make one bilinear lookup in X and Z
+            for (int k = 0; k <= FLEX_Z_STEPS; k++) {
+                float triangle_z = k * (FLEX_Z_RANGE / FLEX_Z_STEPS) + comp_cache.flex_z;
+                float r = 1.0F / sqrtf(FLEX_TRIANGLE_Y * FLEX_TRIANGLE_Y + triangle_z * triangle_z);
+                comp_cache.flex_dir[k][0] = triangle_z * r;
+                comp_cache.flex_dir[k][1] = FLEX_TRIANGLE_Y * r;
             }
         }
 
-        // rotational component
-        y_component = cos(atan((triangle_y_int / 10000.0f) / (triangle_z_int / 10000.0f))) * interpolated_delta;
-        z_component = sin(atan((triangle_y_int / 10000.0f) / (triangle_z_int / 10000.0f))) * interpolated_delta;
+        float interpolated_delta;
+        if(target[X_AXIS] >= flex_x_start && target[X_AXIS] <= flex_x_start + flex_x_size && flex_current_x_points > 1) {
+            // Linear interpolation between the two points either side of the target
+            float fx = (target[X_AXIS] - flex_x_start) * comp_cache.flex_cells_per_x;
+            int i = std::max(0, std::min(flex_current_x_points - 2, (int)fx));
+            float t = std::max(0.0F, std::min(1.0F, fx - i));
+            interpolated_delta = flex_compensation_data[i] + t * (flex_compensation_data[i + 1] - flex_compensation_data[i]);
+        } else if(target[X_AXIS] < flex_x_start) {
+            interpolated_delta = flex_compensation_data[0];
+        } else {
+            interpolated_delta = flex_compensation_data[flex_current_x_points - 1];
+        }
+
+        // rotational component, cos(atan(y/z)) and sin(atan(y/z)), from the table while inside it
+        float y_dir, z_dir;
+        float fz = fabsf(target[Z_AXIS]) * (FLEX_Z_STEPS / FLEX_Z_RANGE);
+        if(fz < FLEX_Z_STEPS) {
+            int k = (int)fz;
+            float t = fz - k;
+            const float *a = comp_cache.flex_dir[k], *b = comp_cache.flex_dir[k + 1];
+            y_dir = a[0] + t * (b[0] - a[0]);
+            z_dir = a[1] + t * (b[1] - a[1]);
+        } else {
+            float triangle_z = fabsf(target[Z_AXIS]) + comp_cache.flex_z;
+            float r = 1.0F / sqrtf(FLEX_TRIANGLE_Y * FLEX_TRIANGLE_Y + triangle_z * triangle_z);
+            y_dir = triangle_z * r;
+            z_dir = FLEX_TRIANGLE_Y * r;
+        }
+        float y_component = interpolated_delta * y_dir;
+        float z_component = interpolated_delta * z_dir;
 
         if (inverse) {
             target[Y_AXIS] = target[Y_AXIS] - y_component;
@@ -933,12 +1265,6 @@ void CartGridStrategy::doCompensation(float *target, bool inverse, bool debug)
             }
         }
 
-        // find min/maxes, and handle the case where size is negative (assuming this is possible? Legacy code supported this)
-        float min_x = std::min(this->x_start, this->x_start + this->x_size);
-        float max_x = std::max(this->x_start, this->x_start + this->x_size);
-        float min_y = std::min(this->y_start, this->y_start + this->y_size);
-        float max_y = std::max(this->y_start, this->y_start + this->y_size);
-
         // clamp the input to the bounds of the compensation grid
         // if a point is beyond the bounds of the grid, it will get the offset of the closest grid point
         //    float x_target = std::min(std::max(target[X_AXIS], min_x), max_x);
@@ -947,23 +1273,54 @@ void CartGridStrategy::doCompensation(float *target, bool inverse, bool debug)
         // change to set offset = 0 if a point is beyond the bounds of the grid
         float x_target = target[X_AXIS];
         float y_target = target[Y_AXIS];
-        if (x_target < min_x - 0.001 || x_target > max_x + 0.001 || y_target < min_y - 0.001 || y_target > max_y + 0.001) {
+        if (x_target < comp_cache.min_x - 0.001F || x_target > comp_cache.max_x + 0.001F || y_target < comp_cache.min_y - 0.001F || y_target > comp_cache.max_y + 0.001F) {
             // Continue to flex compensation even if cartesian grid is out of bounds
         } else {
+            // the position in cell units in Q16.16, the whole part is the cell and the fraction the ratio across it
             // we need to make sure that floor_x and floor_y are always < grid_size-1
-            float grid_x = std::max(0.001F, std::min(this->current_grid_x_size - 1.001F, (x_target - this->x_start) / (this->x_size / (this->current_grid_x_size - 1))));
-            float grid_y = std::max(0.001F, std::min(this->current_grid_y_size - 1.001F, (y_target - this->y_start) / (this->y_size / (this->current_grid_y_size - 1))));
-            int floor_x = floorf(grid_x);
-            int floor_y = floorf(grid_y);
-            float ratio_x = grid_x - floor_x;
-            float ratio_y = grid_y - floor_y;
-            float z1 = grid[(floor_x) + ((floor_y) * this->current_grid_x_size)];
-            float z2 = grid[(floor_x) + ((floor_y + 1) * this->current_grid_x_size)];
-            float z3 = grid[(floor_x + 1) + ((floor_y) * this->current_grid_x_size)];
-            float z4 = grid[(floor_x + 1) + ((floor_y + 1) * this->current_grid_x_size)];
-            float left = (1 - ratio_y) * z1 + ratio_y * z2;
-            float right = (1 - ratio_y) * z3 + ratio_y * z4;
-            float offset = (1 - ratio_x) * left + ratio_x * right;
+            const q16_t q_min = Q16_ONE / 1000;
+            q16_t grid_x = q16_scale(q16_from_float(x_target) - comp_cache.q_x_start, comp_cache.q_cells_per_x);
+            q16_t grid_y = q16_scale(q16_from_float(y_target) - comp_cache.q_y_start, comp_cache.q_cells_per_y);
+            grid_x = std::max(q_min, std::min(comp_cache.q_grid_max_x, grid_x));
+            grid_y = std::max(q_min, std::min(comp_cache.q_grid_max_y, grid_y));
+            int floor_x = q16_floor(grid_x);
+            int floor_y = q16_floor(grid_y);
+
+            // consecutive segments nearly always land in the same cell, so keep its coefficients
+            int cell = (floor_x) + ((floor_y) * this->current_grid_x_size);
+            float offset;
+            if(bicubic) {
+                if(cell != comp_cache.cell) {
+                    bicubic_coefficients(floor_x, floor_y);
+                    comp_cache.cell = cell;
+                }
+                float ratio_x = q16_to_float(q16_frac(grid_x));
+                float ratio_y = q16_to_float(q16_frac(grid_y));
+                float row[4];
+                for (int i = 0; i < 4; i++) {
+                    const float *a = comp_cache.bicubic[i];
+                    row[i] = ((a[3] * ratio_y + a[2]) * ratio_y + a[1]) * ratio_y + a[0];
+                }
+                offset = ((row[3] * ratio_x + row[2]) * ratio_x + row[1]) * ratio_x + row[0];
+
+            } else {
+                if(cell != comp_cache.cell) {
+                    float z1 = grid[cell];
+                    float z2 = grid[cell + this->current_grid_x_size];
+                    float z3 = grid[cell + 1];
+                    float z4 = grid[cell + 1 + this->current_grid_x_size];
+                    comp_cache.cell_nan = isnan(z1) || isnan(z2) || isnan(z3) || isnan(z4);
+                    if(!comp_cache.cell_nan) {
+                        comp_cache.a = q16_from_float(z1);
+                        comp_cache.b = q16_from_float(z3 - z1);
+                        comp_cache.c = q16_from_float(z2 - z1);
+                        comp_cache.d = q16_from_float(z1 - z2 - z3 + z4);
+                    }
+                    comp_cache.cell = cell;
+                }
+                offset = comp_cache.cell_nan ? NAN :
+                    q16_to_float(q16_bilerp(comp_cache.a, comp_cache.b, comp_cache.c, comp_cache.d, q16_frac(grid_x), q16_frac(grid_y)));
+            }
 
             // handle case where the grid was incomplete (should never happen)
             if(!isnan(offset)) {
@@ -1224,71 +1581,45 @@ void CartGridStrategy::save_flex_compensation_data(StreamOutput *stream)
         return;
     }
 
-    FILE *fp = fopen(FLEX_COMPENSATION_FILE, "w");
-    if(fp == NULL) {
-        stream->printf("error: Failed to open flex compensation file %s\n", FLEX_COMPENSATION_FILE);
-        return;
-    }
-
-    // Write flex_x_start (float)
-    if(fwrite(&flex_x_start, sizeof(float), 1, fp) != 1) {
-        stream->printf("error: Failed to write flex_x_start\n");
-        fclose(fp);
-        return;
-    }
+    std::string data;
+    data.append((const char *)&flex_x_start, sizeof(float));
+    data.append(1, (char)flex_current_x_points);
+    data.append((const char *)&flex_x_size, sizeof(float));
+    data.append((const char *)flex_compensation_data, flex_current_x_points * sizeof(float));
 
-    // Write flex_current_grid_x_size (uint8_t)
-    if(fwrite(&flex_current_x_points, sizeof(uint8_t), 1, fp) != 1) {
-        stream->printf("error: Failed to write flex_current_grid_x_size\n");
-        fclose(fp);
+    data = add_header(FLEX_MAGIC, data);
+    if(!WriteQueue::replace(FLEX_COMPENSATION_FILE, data.data(), data.size())) {
+        stream->printf("error: Failed to write flex compensation file %s\n", FLEX_COMPENSATION_FILE);
         return;
     }
 
-    // Write flex_x_size (float)
-    if(fwrite(&flex_x_size, sizeof(float), 1, fp) != 1) {
-        stream->printf("error: Failed to write flex_x_size\n");
-        fclose(fp);
-        return;
-    }
-
-    // Write compensation data for the actual grid size used
-    for(int i = 0; i < flex_current_x_points; i++) {
-        if(fwrite(&flex_compensation_data[i], sizeof(float), 1, fp) != 1) {
-            stream->printf("error: Failed to write flex compensation data at index %d\n", i);
-            fclose(fp);
-            return;
-        }
-    }
-
     stream->printf("Flex compensation data saved to %s\n", FLEX_COMPENSATION_FILE);
     stream->printf("Saved: flex_x_start=%.3f, flex_grid_size=%d, flex_x_size=%.3f\n", 
                    flex_x_start, flex_current_x_points, flex_x_size);
-    fclose(fp);
 }
 
 bool CartGridStrategy::load_flex_compensation_data(StreamOutput *stream)
 {
-    FILE *fp = fopen(FLEX_COMPENSATION_FILE, "r");
-    if(fp == NULL) {
-        stream->printf("error: Failed to open flex compensation file %s\n", FLEX_COMPENSATION_FILE);
+    WriteQueue::sync(FLEX_COMPENSATION_FILE);
+    std::string data;
+    if(!read_saved(FLEX_COMPENSATION_FILE, FLEX_MAGIC, 1 + (2 + flex_x_points) * sizeof(float), data, stream)) {
         return false;
     }
 
+    size_t at = 0;
     float load_flex_x_start;
     uint8_t load_flex_current_x_points;
     float load_flex_x_size;
 
     // Read flex_x_start (float)
-    if(fread(&load_flex_x_start, sizeof(float), 1, fp) != 1) {
+    if(!take(data, at, &load_flex_x_start, sizeof(float))) {
         stream->printf("error: Failed to read flex_x_start\n");
-        fclose(fp);
         return false;
     }
 
     // Read flex_current_grid_x_size (uint8_t)
-    if(fread(&load_flex_current_x_points, sizeof(uint8_t), 1, fp) != 1) {
+    if(!take(data, at, &load_flex_current_x_points, sizeof(uint8_t))) {
         stream->printf("error: Failed to read flex_current_grid_x_size\n");
-        fclose(fp);
         return false;
     }
 
@@ -1296,14 +1627,17 @@ bool CartGridStrategy::load_flex_compensation_data(StreamOutput *stream)
     if(load_flex_current_x_points > flex_x_points) {
         stream->printf("error: Loaded flex grid size %d exceeds maximum configured size %d\n", 
                       load_flex_current_x_points, flex_x_points);
-        fclose(fp);
         return false;
     }
 
     // Read flex_x_size (float)
-    if(fread(&load_flex_x_size, sizeof(float), 1, fp) != 1) {
+    if(!take(data, at, &load_flex_x_size, sizeof(float))) {
         stream->printf("error: Failed to read flex_x_size\n");
-        fclose(fp);
+        return false;
+    }
+
+    if(data.size() - at < load_flex_current_x_points * sizeof(float)) {
+        stream->printf("error: Failed to read flex compensation data\n");
         return false;
     }
 
@@ -1311,13 +1645,7 @@ bool CartGridStrategy::load_flex_compensation_data(StreamOutput *stream)
     reset_flex_compensation();
 
     // Load compensation data for the actual grid size used
-    for(int i = 0; i < load_flex_current_x_points; i++) {
-        if(fread(&flex_compensation_data[i], sizeof(float), 1, fp) != 1) {
-            stream->printf("error: Failed to read flex compensation data at index %d\n", i);
-            fclose(fp);
-            return false;
-        }
-    }
+    take(data, at, flex_compensation_data, load_flex_current_x_points * sizeof(float));
 
     // Set the loaded values
     flex_x_start = load_flex_x_start;
@@ -1329,7 +1657,6 @@ bool CartGridStrategy::load_flex_compensation_data(StreamOutput *stream)
     stream->printf("Flex compensation data loaded from %s\n", FLEX_COMPENSATION_FILE);
     stream->printf("Loaded: flex_x_start=%.3f, flex_grid_size=%d, flex_x_size=%.3f\n", 
                    flex_x_start, flex_current_x_points, flex_x_size);
-    fclose(fp);
     return true;
 }
 
@@ -1,9 +1,11 @@
 #pragma once
 
 #include "LevelingStrategy.h"
+#include "FixedPoint.h"
 
 #include <string>
 #include <tuple>
+#include <vector>
 #include <cstdint>
 
 #define cart_grid_leveling_strategy_checksum CHECKSUM("rectangular-grid")
@@ -24,14 +26,32 @@ private:
     bool doProbe(Gcode *gc);
     bool scan_bed(Gcode *gc);
     bool findBed(float x, float y, float z);
+    bool predict_grid_point(int x, int y, int x_inc, float &z);
+    bool probe_near(float &mm, float x, float y, float z_bed, float z_start);
     void setAdjustFunction(bool on);
     void updateCompensationTransform();
+    void update_compensation_cache();
     void print_bed_level(StreamOutput *stream);
     void doCompensation(float *target, bool inverse, bool debug);
+    void bicubic_coefficients(int x, int y);
+    int compensationSplits(const float *from, const float *to, float *ts, int max_ts);
     void reset_bed_level();
     void save_grid(StreamOutput *stream);
     bool load_grid(StreamOutput *stream);
 
+    // leveling maps kept for a fixture, by number, with the WCS they were probed in
+    struct map_info_t {
+        uint8_t x_points, y_points;
+        uint8_t wcs;
+        uint8_t unused;
+        float x_from_origin, y_from_origin; // x_start, y_start from the XY origin of the WCS
+        float x_size, y_size;
+    };
+    bool save_map(int n, StreamOutput *stream);
+    bool read_map(int n, map_info_t &info, std::vector<float> &values);
+    bool verify_map(const map_info_t &info, const std::vector<float> &values, float xs, float ys, float height, float &worst);
+    bool use_map(Gcode *gc);
+
     // Flex compensation methods
     bool doFlexMeasurement(Gcode *gc);
     void print_flex_compensation_data(StreamOutput *stream);
@@ -41,6 +61,8 @@ private:
 
     float initial_height;
     float tolerance;
+    float verify_tolerance;
+    float probe_clearance;
 
     float height_limit;
     float dampening_start;
@@ -67,6 +89,7 @@ private:
         bool only_by_two_corners:1;
         bool human_readable:1;
         bool new_file_format:1;
+        bool bicubic:1;
     };
 
     // Flex compensation data
@@ -83,5 +106,24 @@ private:
     // Compensation state tracking
     bool cartesian_grid_active;
 
+    static const int FLEX_Z_STEPS = 16;
+
+    // worked out once by update_compensation_cache() rather than for every segment in doCompensation()
+    struct {
+        float min_x, max_x, min_y, max_y;   // grid bounds
+        float cells_per_x, cells_per_y;     // grid cells per mm
+        float flex_cells_per_x;             // flex points per mm
+        float flex_z;                       // constant part of the flex triangle height, for tlo and refmz
+        float flex_dir[FLEX_Z_STEPS + 1][2]; // Y and Z per mm of flex at heights 0 to FLEX_Z_RANGE down, for flex_z
+        float tlo, refmz;                   // the eeprom values flex_z was worked out with
+        int cell;                           // grid cell the coefficients below are for, -1 if none
+        q16_t a, b, c, d;                   // offset in that cell is a + b*rx + c*ry + d*rx*ry, in Q16.16
+        bool cell_nan;                      // a corner of that cell was never probed
+        q16_t q_x_start, q_y_start;         // x_start, y_start in Q16.16
+        int32_t q_cells_per_x, q_cells_per_y; // cells_per_x, cells_per_y in Q8.24
+        q16_t q_grid_max_x, q_grid_max_y;   // highest position in cell units, so the cell is always < grid size - 1
+        float bicubic[4][4];                // or the sum of bicubic[i][j] * rx^i * ry^j
+    } comp_cache;
+
     static const char* FLEX_COMPENSATION_FILE;
 };
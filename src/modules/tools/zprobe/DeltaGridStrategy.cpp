@@ -401,9 +401,7 @@ void DeltaGridStrategy::setAdjustFunction(bool on)
 {
     if(on) {
         // set the compensationTransform in robot
-        using std::placeholders::_1;
-        using std::placeholders::_2;
-        THEROBOT->compensationTransform = std::bind(&DeltaGridStrategy::doCompensation, this, _1, _2); // [this](float *target, bool inverse) { doCompensation(target, inverse); };
+        THEROBOT->compensationTransform = Callback<void(float*, bool, bool)>::bind<DeltaGridStrategy, &DeltaGridStrategy::doCompensation>(this);
     } else {
         // clear it
         THEROBOT->compensationTransform = nullptr;
@@ -523,7 +521,7 @@ void DeltaGridStrategy::extrapolate_unprobed_bed_level()
     }
 }
 
-void DeltaGridStrategy::doCompensation(float *target, bool inverse)
+void DeltaGridStrategy::doCompensation(float *target, bool inverse, bool debug)
 {
     // Adjust print surface height by linear interpolation over the bed_level array.
     int half = (grid_size - 1) / 2;
@@ -0,0 +1,161 @@
+#include "ProbeLog.h"
+
+#include "StreamOutput.h"
+#include "MemoryPool.h"
+#include "platform_memory.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+// where a spill file is kept open between points, and reopened after it has been read back
+static std::string spill_path;
+
+bool ProbeLog::start(size_t n, const char *path, bool quiet)
+{
+    stop();
+    if (n == 0) return false;
+
+    // the AHB banks first, the grid and the planner are there too so it may not have room
+    ring = (record_t *)AHB.alloc(n * sizeof(record_t));
+    ahb = ring != nullptr;
+    if (!ahb) ring = (record_t *)malloc(n * sizeof(record_t));
+    if (ring == nullptr) return false;
+
+    capacity = n;
+    this->quiet = quiet;
+    clear();
+    if (path != nullptr && *path != '\0') {
+        spill_path = path;
+        spill = fopen(path, "wb");
+        if (spill == nullptr) {
+            stop();
+            return false;
+        }
+    }
+    return true;
+}
+
+void ProbeLog::stop()
+{
+    if (spill != nullptr) {
+        fclose(spill);
+        spill = nullptr;
+    }
+    if (ring != nullptr) {
+        if (ahb) AHB.dealloc(ring);
+        else free(ring);
+        ring = nullptr;
+    }
+    capacity = 0;
+    clear();
+}
+
+void ProbeLog::clear()
+{
+    head = count = 0;
+    total = dropped = spilled = 0;
+    if (spill != nullptr) {
+        fclose(spill);
+        spill = fopen(spill_path.c_str(), "wb");
+    }
+}
+
+void ProbeLog::add(float x, float y, float z, bool ok, SOURCE source)
+{
+    if (ring == nullptr) return;
+
+    if (count == capacity && !spill_ring()) {
+        // the oldest one goes
+        head = (head + 1) % capacity;
+        --count;
+        ++dropped;
+    }
+    record_t &r = ring[(head + count) % capacity];
+    r.x = x;
+    r.y = y;
+    r.z = z;
+    r.seq = total & 0xFFFF;
+    r.ok = ok ? 1 : 0;
+    r.source = source;
+    ++count;
+    ++total;
+}
+
+// the whole ring in at most two writes, between points when the machine is standing still
+bool ProbeLog::spill_ring()
+{
+    if (spill == nullptr) return false;
+    size_t first = capacity - head < count ? capacity - head : count;
+    bool ok = fwrite(&ring[head], sizeof(record_t), first, spill) == first &&
+              fwrite(&ring[0], sizeof(record_t), count - first, spill) == count - first;
+    if (!ok) {
+        // a full card stops the spilling, the ring carries on overwriting
+        fclose(spill);
+        spill = nullptr;
+        return false;
+    }
+    spilled += count;
+    head = count = 0;
+    return true;
+}
+
+void ProbeLog::print_csv(StreamOutput *stream)
+{
+    stream->printf("seq,x,y,z,ok,source\n");
+    replay(stream, true);
+}
+
+void ProbeLog::print_binary(StreamOutput *stream)
+{
+    stream->printf("#PROBELOG %lu %u\n", (unsigned long)(spilled + count), (unsigned)RECORD_SIZE);
+    replay(stream, false);
+}
+
+void ProbeLog::print_status(StreamOutput *stream) const
+{
+    if (ring == nullptr) {
+        stream->printf("Probe log off\n");
+        return;
+    }
+    stream->printf("Probe log: %u of %u in %s, %lu logged, %lu spilled, %lu dropped%s\n", (unsigned)count, (unsigned)capacity,
+        ahb ? "AHB" : "heap", (unsigned long)total, (unsigned long)spilled, (unsigned long)dropped, quiet ? ", quiet" : "");
+}
+
+// sends the records in batches rather than a write per point
+void ProbeLog::replay(StreamOutput *stream, bool csv)
+{
+    char buf[256];
+    size_t n = 0;
+    auto emit = [&](const record_t &r) {
+        if (csv) {
+            if (n > sizeof(buf) - 64) {
+                stream->puts(buf, n);
+                n = 0;
+            }
+            n += snprintf(&buf[n], sizeof(buf) - n, "%u,%1.4f,%1.4f,%1.4f,%u,%u\n", r.seq, r.x, r.y, r.z, r.ok, r.source);
+        } else {
+            if (n + sizeof(r) > sizeof(buf)) {
+                stream->puts(buf, n);
+                n = 0;
+            }
+            memcpy(&buf[n], &r, sizeof(r));
+            n += sizeof(r);
+        }
+    };
+
+    if (spill != nullptr) {
+        // read back through a handle of its own, then carry on appending
+        fclose(spill);
+        FILE *fp = fopen(spill_path.c_str(), "rb");
+        if (fp != nullptr) {
+            record_t r;
+            while (fread(&r, sizeof(r), 1, fp) == 1) emit(r);
+            fclose(fp);
+        }
+        spill = fopen(spill_path.c_str(), "ab");
+    }
+    for (size_t i = 0; i < count; i++) emit(at(i));
+    if (n > 0) stream->puts(buf, n);
+    if (!csv) stream->puts("\n", 1);
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+class StreamOutput;
+
+/*
+ * Probe results kept in RAM for the host to fetch in one go, instead of a line printed for each point
+ * while a digitizing or inspection run is going. It holds the last points probed in a ring, and if a
+ * spill file is set the ring is written out to it whenever it fills, so none are lost.
+ *
+ * G38 points are machine coordinates in mm, grid points are where on the grid the probe went and the height
+ * found there from the first point, as the grid is printed. They are sent back as CSV, or as the records themselves,
+ * RECORD_SIZE bytes each, little endian floats, after a one line header giving how many follow.
+ */
+class ProbeLog {
+    public:
+        enum SOURCE { G38 = 0, GRID = 1, SCAN = 2 };
+
+        struct record_t {
+            float x, y, z;
+            uint16_t seq;           // the low bits of the number of points logged before it
+            uint8_t ok;             // 1 if the probe triggered, a scan also logs where it released with 0
+            uint8_t source;
+        };
+        static const size_t RECORD_SIZE = sizeof(record_t);
+
+        ProbeLog() : ring(nullptr), ahb(false), capacity(0), head(0), count(0), total(0), dropped(0), spilled(0), spill(nullptr), quiet(false) {}
+        ~ProbeLog() { stop(); }
+
+        // starts logging into a ring of n points, spilling to path when it fills if path is set
+        bool start(size_t n, const char *path, bool quiet);
+        void stop();
+        void clear();
+        bool active() const { return ring != nullptr; }
+        // the results are only logged, not printed as they come
+        bool is_quiet() const { return active() && quiet; }
+
+        void add(float x, float y, float z, bool ok, SOURCE source);
+
+        // the points spilled first, then those in the ring
+        void print_csv(StreamOutput *stream);
+        void print_binary(StreamOutput *stream);
+        void print_status(StreamOutput *stream) const;
+
+    private:
+        bool spill_ring();
+        const record_t &at(size_t i) const { return ring[(head + i) % capacity]; }
+        void replay(StreamOutput *stream, bool csv);
+
+        record_t *ring;
+        bool ahb;
+        size_t capacity;
+        size_t head;                // oldest point in the ring
+        size_t count;
+        uint32_t total;
+        uint32_t dropped;           // overwritten without a spill file
+        uint32_t spilled;
+        FILE *spill;
+        bool quiet;
+};
@@ -359,13 +359,19 @@ void ThreePointStrategy::setAdjustFunction(bool on)
 {
     if(on) {
         // set the compensationTransform in robot
-        THEROBOT->compensationTransform= [this](float *target, bool inverse, bool debug) { if(inverse) target[2] -= this->plane->getz(target[0], target[1]); else target[2] += this->plane->getz(target[0], target[1]); };
+        THEROBOT->compensationTransform= Callback<void(float*, bool, bool)>::bind<ThreePointStrategy, &ThreePointStrategy::doCompensation>(this);
     }else{
         // clear it
         THEROBOT->compensationTransform= nullptr;
     }
 }
 
+void ThreePointStrategy::doCompensation(float *target, bool inverse, bool debug)
+{
+    if(inverse) target[2] -= this->plane->getz(target[0], target[1]);
+    else target[2] += this->plane->getz(target[0], target[1]);
+}
+
 // find the Z offset for the point on the plane at x, y
 float ThreePointStrategy::getZOffset(float x, float y)
 {
@@ -26,6 +26,7 @@ private:
     std::tuple<float, float> parseXY(const char *str);
     std::tuple<float, float, float> parseXYZ(const char *str);
     void setAdjustFunction(bool);
+    void doCompensation(float *target, bool inverse, bool debug);
     bool test_probe_points(Gcode *gcode);
 
     std::tuple<float, float, float> probe_offsets;
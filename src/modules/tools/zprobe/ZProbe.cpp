@@ -30,10 +30,15 @@
 #include "us_ticker_api.h"
 #include "ATCHandlerPublicAccess.h"
 // strategies we know about
-#include "DeltaCalibrationStrategy.h"
 #include "ThreePointStrategy.h"
-#include "DeltaGridStrategy.h"
 #include "CartGridStrategy.h"
+// the delta strategies are not built for a cartesian only machine
+#ifndef CARTESIAN_ONLY
+#include "DeltaCalibrationStrategy.h"
+#include "DeltaGridStrategy.h"
+#endif
+#include "InterruptIn.h"
+#include "IrqPriority.h"
 
 #include <vector>
 
@@ -52,6 +57,12 @@
 #define max_z_checksum           CHECKSUM("max_z")
 #define reverse_z_direction_checksum CHECKSUM("reverse_z")
 #define dwell_before_probing_checksum CHECKSUM("dwell_before_probing")
+#define probe_interrupt_checksum CHECKSUM("probe_interrupt")
+#define touch_tolerance_checksum CHECKSUM("touch_tolerance")
+#define touch_approach_margin_checksum CHECKSUM("touch_approach_margin")
+#define max_touches_checksum     CHECKSUM("max_touches")
+#define result_log_size_checksum CHECKSUM("result_log_size")
+#define result_log_spill_checksum CHECKSUM("result_log_spill")
 
 // from endstop section
 #define delta_homing_checksum    CHECKSUM("delta_homing")
@@ -99,8 +110,27 @@ void ZProbe::on_module_loaded()
     probing = false;
     calibrating = false;
     tlo_calibrating = false;
-    THEKERNEL->slow_ticker->attach(1000, this, &ZProbe::read_probe);
-    THEKERNEL->slow_ticker->attach(1000, this, &ZProbe::read_calibrate);
+    is_3dprobe_active = false;
+    scanning = false;
+    scan_edges = nullptr;
+    read_probe_hook = THEKERNEL->slow_ticker->attach(1000, this, &ZProbe::read_probe);
+    read_calibrate_hook = THEKERNEL->slow_ticker->attach(1000, this, &ZProbe::read_calibrate);
+    update_polling();
+
+    // latch the trigger position on the pin edge as well, the 1ms poll above is then only the fallback
+    probe_irq = nullptr;
+    probe_latched = false;
+    if(THEKERNEL->config->value(zprobe_checksum, probe_interrupt_checksum)->by_default(true)->as_bool() && this->pin.connected()) {
+        if(this->pin.port_number == 0 || this->pin.port_number == 2) {
+            PinName pinname = port_pin((PortName)this->pin.port_number, this->pin.pin);
+            probe_irq = new mbed::InterruptIn(pinname);
+            probe_irq->rise(this, &ZProbe::on_probe_edge);
+            probe_irq->fall(this, &ZProbe::on_probe_edge);
+            IrqPriority::apply(EINT3_IRQn);
+        } else {
+            THEKERNEL->streams->printf("ZProbe pin has to be on P0 or P2 for probe_interrupt, polling it instead\n");
+        }
+    }
 	if(!(THEKERNEL->factory_set->FuncSetting & (1<<2)))	//Manual Tool change 
 	{
     	THEKERNEL->slow_ticker->attach(100, this, &ZProbe::probe_doubleHit);
@@ -127,19 +157,21 @@ void ZProbe::config_load()
 
             // check with each known strategy and load it if it matches
             switch(cs) {
+#ifndef CARTESIAN_ONLY
                 case delta_calibration_strategy_checksum:
                     ls= new DeltaCalibrationStrategy(this);
                     found= true;
                     break;
 
-                case three_point_leveling_strategy_checksum:
-                    // NOTE this strategy is mutually exclusive with the delta calibration strategy
-                    ls= new ThreePointStrategy(this);
+                case delta_grid_leveling_strategy_checksum:
+                    ls= new DeltaGridStrategy(this);
                     found= true;
                     break;
+#endif
 
-                case delta_grid_leveling_strategy_checksum:
-                    ls= new DeltaGridStrategy(this);
+                case three_point_leveling_strategy_checksum:
+                    // NOTE this strategy is mutually exclusive with the delta calibration strategy
+                    ls= new ThreePointStrategy(this);
                     found= true;
                     break;
 
@@ -162,6 +194,7 @@ void ZProbe::config_load()
     this->is_delta = THEKERNEL->config->value(delta_homing_checksum)->by_default(false)->as_bool();
     this->is_rdelta = THEKERNEL->config->value(rdelta_homing_checksum)->by_default(false)->as_bool();
 
+#ifndef CARTESIAN_ONLY
     // default for backwards compatibility add DeltaCalibrationStrategy if a delta
     // may be deprecated
     if(this->strategies.empty()) {
@@ -170,6 +203,7 @@ void ZProbe::config_load()
             this->strategies.back()->handleConfig();
         }
     }
+#endif
 
     this->probe_height  = THEKERNEL->config->value(zprobe_checksum, probe_height_checksum)->by_default(5)->as_number();
     this->slow_feedrate = THEKERNEL->config->value(zprobe_checksum, slow_feedrate_checksum)->by_default(5)->as_number(); // feedrate in mm/sec
@@ -183,6 +217,14 @@ void ZProbe::config_load()
         this->max_z = THEKERNEL->config->value(gamma_max_checksum)->by_default(200)->as_number(); // maximum zprobe distance
     }
     this->dwell_before_probing = THEKERNEL->config->value(zprobe_checksum, dwell_before_probing_checksum)->by_default(0)->as_number(); // dwell time in seconds before probing
+    // the probing cycles repeat the slow touch until the touches agree within this, 0 is one slow touch
+    this->touch_tolerance = THEKERNEL->config->value(zprobe_checksum, touch_tolerance_checksum)->by_default(0)->as_number();
+    this->max_touches = THEKERNEL->config->value(zprobe_checksum, max_touches_checksum)->by_default(5)->as_int();
+    // a touch after the first goes at the fast feed to this short of where the last one found the surface
+    this->touch_approach_margin = THEKERNEL->config->value(zprobe_checksum, touch_approach_margin_checksum)->by_default(0.2F)->as_number();
+    // points M467 S1 keeps in RAM, and the file on the card they go to each time that fills if it is set
+    this->result_log_size = THEKERNEL->config->value(zprobe_checksum, result_log_size_checksum)->by_default(256)->as_int();
+    this->result_log_spill = THEKERNEL->config->value(zprobe_checksum, result_log_spill_checksum)->by_default("")->as_string();
 
 }
 
@@ -208,6 +250,7 @@ void ZProbe::on_main_loop(void *argument)
             PublicData::set_value( switch_checksum, detector_switch_checksum, ignore_on_halt_checksum, &ignore_on_halt );
         }
     }
+    update_polling();
     
     
     switch(probing_cycle)
@@ -261,6 +304,14 @@ void ZProbe::on_main_loop(void *argument)
     }
 }
 
+// the pin polls are only needed while a probe move is running or the 3D probe is fitted, they are
+// turned on before a probe move starts and back off from the main loop once it is done
+void ZProbe::update_polling()
+{
+    THEKERNEL->slow_ticker->set_enabled(read_probe_hook, probing || calibrating || is_3dprobe_active || scanning);
+    THEKERNEL->slow_ticker->set_enabled(read_calibrate_hook, calibrating);
+}
+
 uint32_t ZProbe::read_probe(uint32_t dummy)
 {
     if (CARVERA_AIR == THEKERNEL->factory_set->MachineModel && (is_3dprobe_active || probing || calibrating)){
@@ -277,7 +328,7 @@ uint32_t ZProbe::read_probe(uint32_t dummy)
             probe_triggered = true;
             // Set halt state immediately for fast response, defer event processing to main loop
             // Disable crash detection during TLO calibration to prevent false positives
-            if (!probing && !calibrating && !tlo_calibrating) {
+            if (!probing && !calibrating && !tlo_calibrating && !scanning) {
                 THEKERNEL->set_halt_reason(CRASH_DETECTED);
                 THEKERNEL->set_halted(true);
                 // Set a flag to process the halt event in the main loop
@@ -288,6 +339,12 @@ uint32_t ZProbe::read_probe(uint32_t dummy)
         }
     }
 
+    if (scanning) {
+        // without the interrupt the poll finds the edges, a millisecond late at worst
+        if (probe_irq == nullptr) latch_scan_edge(this->pin.get() != invert_probe);
+        return 0;
+    }
+
     if (!probing) return 0;
 
     // we check all axis as it maybe a G38.2 X10 for instance, not just a probe in Z
@@ -301,7 +358,7 @@ uint32_t ZProbe::read_probe(uint32_t dummy)
             
             if (!probe_detected) {
                 probe_detected = true;
-                probe_pin_position = STEPPER[Z_AXIS]->get_current_position();
+                probe_pin_position = probe_latched ? latched_position[Z_AXIS] : STEPPER[Z_AXIS]->get_current_position();
             // if we are calibrating, the stop to the actuators comes from the read_calibrate method
             } else if (!calibrating) {
                 // we signal the motors to stop, which will preempt any moves on that axis
@@ -310,14 +367,191 @@ uint32_t ZProbe::read_probe(uint32_t dummy)
                 debounce = 0;
             }
         } else {
-            // The endstop was not hit yet
+            // The endstop was not hit yet, an edge latched so far was a bounce
             debounce = 0;
+            if (!probe_detected) probe_latched = false;
         }
     }
 
     return 0;
 }
 
+// called from the pin interrupt, both edges as the level that means triggered depends on invert_probe
+void ZProbe::on_probe_edge()
+{
+    if (scanning) {
+        latch_scan_edge(this->pin.get() != invert_probe);
+        return;
+    }
+    if (!probing || probe_latched || this->pin.get() == invert_probe) return;
+    if (!(STEPPER[X_AXIS]->is_moving() || STEPPER[Y_AXIS]->is_moving() || STEPPER[Z_AXIS]->is_moving())) return;
+
+    // the step ticker has a higher priority, do not let it step between the axis
+    __disable_irq();
+    for (int i = X_AXIS; i <= Z_AXIS; ++i) {
+        latched_position[i] = STEPPER[i]->get_current_position();
+    }
+    __enable_irq();
+    probe_latched = true;
+
+    // with a debounce the poll has to confirm it first, the position stays the one latched here
+    if (debounce_ms == 0 && !probe_detected) {
+        probe_detected = true;
+        probe_pin_position = latched_position[Z_AXIS];
+        if (!calibrating) {
+            for (auto &a : THEROBOT->actuators) a->stop_moving();
+        }
+    }
+}
+
+// where the probe triggered in machine coordinates, false if the interrupt did not latch it
+bool ZProbe::get_latched_position(float *pos)
+{
+    if (!probe_latched || !probe_detected) return false;
+    actuator_to_machine(latched_position, pos);
+    return true;
+}
+
+void ZProbe::actuator_to_machine(const float *actuator, float *pos)
+{
+    // only X Y and Z go through the arm solution
+    ActuatorCoordinates actuator_pos;
+    actuator_pos.fill(0);
+    for (int i = X_AXIS; i <= Z_AXIS; ++i) {
+        actuator_pos[i] = actuator[i];
+    }
+    THEROBOT->arm_solution->actuator_to_cartesian(actuator_pos, pos);
+    if(THEROBOT->compensationTransform) THEROBOT->compensationTransform(pos, true, false); // get inverse compensation transform
+}
+
+// from the pin interrupt or the poll, a level the same as the last one is a bounce
+void ZProbe::latch_scan_edge(bool triggered)
+{
+    if (triggered == scan_pin) return;
+    scan_pin = triggered;
+    if (!(STEPPER[X_AXIS]->is_moving() || STEPPER[Y_AXIS]->is_moving() || STEPPER[Z_AXIS]->is_moving())) return;
+
+    uint8_t next = (scan_head + 1) % SCAN_EDGES;
+    if (next == scan_tail) {
+        ++scan_overrun;
+    } else {
+        scan_edge_t &e = scan_edges[scan_head];
+        __disable_irq();
+        for (int i = X_AXIS; i <= Z_AXIS; ++i) {
+            e.actuator[i] = STEPPER[i]->get_current_position();
+        }
+        __enable_irq();
+        e.us = us_ticker_read() - scan_start_us;
+        e.triggered = triggered;
+        scan_head = next;
+    }
+
+    if (triggered && scan_stop) {
+        for (auto &a : THEROBOT->actuators) a->stop_moving();
+    }
+}
+
+// logs the edges latched so far, and prints them unless the log is quiet
+uint32_t ZProbe::drain_scan_edges(StreamOutput *stream)
+{
+    uint32_t n = 0;
+    while (scan_tail != scan_head) {
+        const scan_edge_t &e = scan_edges[scan_tail];
+        float pos[3];
+        actuator_to_machine(e.actuator, pos);
+        if (!log_probe(pos[X_AXIS], pos[Y_AXIS], pos[Z_AXIS], e.triggered, ProbeLog::SCAN)) {
+            stream->printf("[SCN:%1.3f,%1.3f,%1.3f:%d:%lu]\n", THEROBOT->from_millimeters(pos[X_AXIS]), THEROBOT->from_millimeters(pos[Y_AXIS]),
+                THEROBOT->from_millimeters(pos[Z_AXIS]), e.triggered ? 1 : 0, (unsigned long)(e.us / 1000));
+        }
+        scan_tail = (scan_tail + 1) % SCAN_EDGES;
+        ++n;
+    }
+    return n;
+}
+
+/*
+ * M468 X Y Z [F] [R] [P], moves by X Y Z at the probing feed and latches where the probe triggers and releases on
+ * the way, instead of stopping at the first touch like G38. With R each trigger stops the move, Z goes up by R
+ * and the rest of the move carries on from there, so a scan across a part steps up its profile one point at a
+ * time. Without R the move runs through and every edge is latched on the way. P stops it after that many points.
+ *
+ * Points go to the M467 log too, each is printed as [SCN:x,y,z:triggered:ms] with the time since the scan started
+ * unless the log is quiet.
+ */
+void ZProbe::probe_scan(Gcode *gcode)
+{
+    float path[3] = {0, 0, 0};
+    for (int i = X_AXIS; i <= Z_AXIS; ++i) {
+        if (gcode->has_letter('X' + i)) path[i] = THEROBOT->to_millimeters(gcode->get_value('X' + i));
+    }
+    rotateXY(path[X_AXIS], path[Y_AXIS], &path[X_AXIS], &path[Y_AXIS], THEROBOT->r[THEROBOT->get_current_wcs()]);
+    float length = get_xyz_move_length(path[X_AXIS], path[Y_AXIS], path[Z_AXIS]);
+    if (length <= 0) {
+        gcode->stream->printf("error:at least one of X Y or Z must be specified, and be > or < 0\n");
+        return;
+    }
+    float rate = gcode->has_letter('F') ? gcode->get_value('F') / 60 : this->slow_feedrate;
+    float retract = gcode->has_letter('R') ? THEROBOT->to_millimeters(gcode->get_value('R')) : 0;
+    uint32_t max_points = gcode->has_letter('P') ? gcode->get_value('P') : 1000;
+
+    THEKERNEL->conveyor->wait_for_idle();
+    if (this->pin.get() != invert_probe) {
+        gcode->stream->printf("Error:ZProbe triggered before move, aborting command.\n");
+        return;
+    }
+
+    scan_edges = new scan_edge_t[SCAN_EDGES];
+    scan_head = scan_tail = 0;
+    scan_overrun = 0;
+    scan_pin = false;
+    scan_stop = retract > 0;
+    scan_start_us = us_ticker_read();
+    scanning = true;
+    update_polling();
+    THEKERNEL->set_zprobing(true);
+
+    uint32_t points = 0;
+    bool ok = true;
+    while (points < max_points && !THEKERNEL->is_halted()) {
+        float start[3], now[3];
+        THEROBOT->get_axis_position(start, 3);
+        if (!THEROBOT->delta_move(path, rate, 3)) break;
+        THEKERNEL->conveyor->wait_for_idle();
+        // a trigger stopped it short of where it was going
+        THEROBOT->reset_position_from_current_actuator_position();
+        points += drain_scan_edges(gcode->stream);
+        if (!scan_stop) break;
+
+        THEROBOT->get_axis_position(now, 3);
+        for (int i = X_AXIS; i <= Z_AXIS; ++i) path[i] -= now[i] - start[i];
+        if (get_xyz_move_length(path[X_AXIS], path[Y_AXIS], path[Z_AXIS]) < 0.001F) break;
+        if (this->pin.get() == invert_probe) continue;
+
+        float lift[3] = {0, 0, retract};
+        THEROBOT->delta_move(lift, this->return_feedrate, 3);
+        THEKERNEL->conveyor->wait_for_idle();
+        THEROBOT->reset_position_from_current_actuator_position();
+        points += drain_scan_edges(gcode->stream);
+        if (this->pin.get() != invert_probe) {
+            gcode->stream->printf("ALARM: Probe still triggered %1.3f above the scan point\n", retract);
+            ok = false;
+            break;
+        }
+    }
+
+    THEKERNEL->set_zprobing(false);
+    scanning = false;
+    update_polling();
+    delete[] scan_edges;
+    scan_edges = nullptr;
+
+    gcode->stream->printf("Scan: %lu points%s\n", (unsigned long)points, scan_overrun > 0 ? ", some edges were too close together to keep" : "");
+    if (!ok) {
+        THEKERNEL->set_halt_reason(PROBE_FAIL);
+        THEKERNEL->call_event(ON_HALT, nullptr);
+    }
+}
+
 uint32_t ZProbe::read_calibrate(uint32_t dummy)
 {
     if (!calibrating) return 0;
@@ -435,6 +669,7 @@ bool ZProbe::run_probe(float& mm, float feedrate, float max_dist, bool reverse)
     probe_detected = false;
     debounce = 0;
     cali_debounce = 0;
+    update_polling();
 
     reset_probe_tracking();
 
@@ -453,9 +688,9 @@ bool ZProbe::run_probe(float& mm, float feedrate, float max_dist, bool reverse)
     THECONVEYOR->wait_for_idle();
     if(THEKERNEL->is_halted()) return false;
 
-    // now see how far we moved, get delta in z we moved
+    // now see how far we moved, get delta in z we moved, to where it triggered if that was latched
     // NOTE this works for deltas as well as all three actuators move the same amount in Z
-    mm = z_start_pos - THEROBOT->actuators[2]->get_current_position();
+    mm = z_start_pos - ((probe_latched && probe_detected) ? latched_position[Z_AXIS] : THEROBOT->actuators[2]->get_current_position());
 
     // set the last probe position to the actuator units moved during this home
     THEROBOT->set_last_probe_position(std::make_tuple(0, 0, mm, probe_detected ? 1:0));
@@ -747,6 +982,31 @@ void ZProbe::on_gcode_received(void *argument)
                     }
                 }
                 break;                
+            case 467:
+                // M467 S1 [Q0] logs the results from here on, quietly unless Q0, M467 S0 stops, M467 the state
+                // M467.1 sends them as CSV, M467.2 as binary records and M467.3 clears them
+                if (gcode->subcode == 1) {
+                    this->results.print_csv(gcode->stream);
+                } else if (gcode->subcode == 2) {
+                    this->results.print_binary(gcode->stream);
+                } else if (gcode->subcode == 3) {
+                    this->results.clear();
+                } else if (gcode->has_letter('S') && gcode->get_value('S') == 0) {
+                    this->results.stop();
+                } else if (gcode->has_letter('S')) {
+                    bool quiet = !gcode->has_letter('Q') || gcode->get_value('Q') != 0;
+                    if (!this->results.start(this->result_log_size, this->result_log_spill.c_str(), quiet)) {
+                        gcode->stream->printf("error:Probe log of %u points could not be started\n", this->result_log_size);
+                    }
+                } else {
+                    this->results.print_status(gcode->stream);
+                }
+                break;
+
+            case 468:
+                probe_scan(gcode);
+                break;
+
             case 670:
                 if (gcode->has_letter('S')) this->slow_feedrate = gcode->get_value('S');
                 if (gcode->has_letter('K')) this->fast_feedrate = gcode->get_value('K');
@@ -783,6 +1043,7 @@ void ZProbe::reset_probe_tracking() {
     calibrate_pin_position = 0.0F;
     probe_pin_position = 0.0F;
     calibrate_current_z = 0.0F;
+    probe_latched = false;
 }
 
 // special way to probe in the X or Y or Z direction using planned moves, should work with any kinematics
@@ -828,6 +1089,7 @@ bool ZProbe::probe_XYZ(Gcode *gcode)
     calibrating = false;
     debounce = 0;
     cali_debounce = 0;
+    update_polling();
 
     reset_probe_tracking();    
 
@@ -853,7 +1115,9 @@ bool ZProbe::probe_XYZ(Gcode *gcode)
     // this also sets last_milestone to the machine coordinates it stopped at
     THEROBOT->reset_position_from_current_actuator_position();
     float pos[3];
-    THEROBOT->get_axis_position(pos, 3);
+    if(!get_latched_position(pos)) {
+        THEROBOT->get_axis_position(pos, 3);
+    }
 
     if(THEKERNEL->is_flex_compensation_active()) {
         if(THEROBOT->compensationTransform) THEROBOT->compensationTransform(pos, true, false); // get inverse compensation transform
@@ -862,7 +1126,9 @@ bool ZProbe::probe_XYZ(Gcode *gcode)
     uint8_t probeok = probe_detected ? 1 : 0;
 
     // print results using the GRBL format
-    gcode->stream->printf("[PRB:%1.3f,%1.3f,%1.3f:%d]\n", THEKERNEL->robot->from_millimeters(pos[X_AXIS]), THEKERNEL->robot->from_millimeters(pos[Y_AXIS]), THEKERNEL->robot->from_millimeters(pos[Z_AXIS]), probeok);
+    if (!log_probe(pos[X_AXIS], pos[Y_AXIS], pos[Z_AXIS], probeok, ProbeLog::G38)) {
+        gcode->stream->printf("[PRB:%1.3f,%1.3f,%1.3f:%d]\n", THEKERNEL->robot->from_millimeters(pos[X_AXIS]), THEKERNEL->robot->from_millimeters(pos[Y_AXIS]), THEKERNEL->robot->from_millimeters(pos[Z_AXIS]), probeok);
+    }
     THEROBOT->set_last_probe_position(std::make_tuple(pos[X_AXIS], pos[Y_AXIS], pos[Z_AXIS], probeok));
 
     if(probeok == 0 && (gcode->subcode == 2 || gcode->subcode == 4)) {
@@ -879,6 +1145,12 @@ bool ZProbe::probe_XYZ(Gcode *gcode)
     return true; //probe was activated
 }
 
+bool ZProbe::log_probe(float x, float y, float z, bool ok, ProbeLog::SOURCE source)
+{
+    this->results.add(x, y, z, ok, source);
+    return this->results.is_quiet();
+}
+
 uint8_t ZProbe::check_probe_tool() {
     struct tool_status tool;
     bool ok = PublicData::get_value( atc_handler_checksum, get_tool_status_checksum, &tool );
@@ -949,6 +1221,7 @@ void ZProbe::calibrate_Z(Gcode *gcode)
     if (check_probe_tool() > 0) {
         probing = true;
     }
+    update_polling();
 
     // do a delta move which will stop as soon as the probe is triggered, or the distance is reached
     float delta[3]= {0, 0, z};
@@ -1191,19 +1464,63 @@ bool ZProbe::fast_slow_probe_sequence(int axis, int direction){
     moveBuffer[1] = retracty;
     moveBuffer[2] = retractz;
     THEROBOT->delta_move(moveBuffer, param.feed_rate, 3);
-    //slow probe
-    memset(&this->buff, 0 , sizeof(this->buff));
-    std::sprintf(this->buff, "G38.%i X%.3f Y%.3f Z%.3f F%.3f", 2 + param.probe_g38_subcode,THEROBOT->from_millimeters(x), THEROBOT->from_millimeters(y), THEROBOT->from_millimeters(z), param.slowZprobeRate);
-    this->gcodeBuffer = new Gcode(this->buff, &StreamOutput::NullStream);
-    probe_XYZ(this->gcodeBuffer);
-    delete gcodeBuffer;
-    // always wait for idle before getting the machine pos
-    THECONVEYOR->wait_for_idle();
-    //store position
-    THEROBOT->get_current_machine_position(mpos);
-    // current_position/mpos includes the compensation transform so we need to get the inverse to get actual position
-    if(THEKERNEL->is_flex_compensation_active()) {
-        if(THEROBOT->compensationTransform) THEROBOT->compensationTransform(mpos, true, false); // get inverse compensation transform
+    // slow probe, with a tolerance it is repeated until the touches agree and their mean is used
+    int touches = param.touch_tolerance > 0 ? std::max(2, max_touches) : 1;
+    float first[3], sum[3] = {0, 0, 0}, sum_sq = 0, spread = 0;
+    int n = 0;
+    while (n < touches) {
+        if (n > 0) {
+            // the last touch was a retract away, so only the last bit needs the slow feed
+            float approach = param.retract_distance - touch_approach_margin;
+            if (approach > 0) {
+                float scale = approach / param.retract_distance;
+                moveBuffer[0] = -retractx * scale;
+                moveBuffer[1] = -retracty * scale;
+                moveBuffer[2] = -retractz * scale;
+                THEROBOT->delta_move(moveBuffer, param.feed_rate, 3);
+            }
+        }
+        memset(&this->buff, 0 , sizeof(this->buff));
+        std::sprintf(this->buff, "G38.%i X%.3f Y%.3f Z%.3f F%.3f", 2 + param.probe_g38_subcode,THEROBOT->from_millimeters(x), THEROBOT->from_millimeters(y), THEROBOT->from_millimeters(z), param.slowZprobeRate);
+        this->gcodeBuffer = new Gcode(this->buff, &StreamOutput::NullStream);
+        bool hit = probe_XYZ(this->gcodeBuffer);
+        delete gcodeBuffer;
+        // always wait for idle before getting the machine pos
+        THECONVEYOR->wait_for_idle();
+        //store position
+        THEROBOT->get_current_machine_position(mpos);
+        // current_position/mpos includes the compensation transform so we need to get the inverse to get actual position
+        if(THEKERNEL->is_flex_compensation_active()) {
+            if(THEROBOT->compensationTransform) THEROBOT->compensationTransform(mpos, true, false); // get inverse compensation transform
+        }
+        if (!hit || THEKERNEL->is_halted()) break;
+
+        // kept relative to the first touch, squares of whole machine coordinates lose the microns in a float
+        if (n == 0) memcpy(first, mpos, sizeof(first));
+        for (int i = 0; i < 3; i++) {
+            float d = mpos[i] - first[i];
+            sum[i] += d;
+            sum_sq += d * d;
+        }
+        n++;
+        if (n >= 2) {
+            float mean_sq = 0;
+            for (int i = 0; i < 3; i++) mean_sq += (sum[i] / n) * (sum[i] / n);
+            spread = sqrtf(std::max(0.0F, (sum_sq - n * mean_sq) / (n - 1)));
+            if (spread <= param.touch_tolerance) break;
+        }
+        if (n < touches) {
+            moveBuffer[0] = retractx;
+            moveBuffer[1] = retracty;
+            moveBuffer[2] = retractz;
+            THEROBOT->delta_move(moveBuffer, param.feed_rate, 3);
+        }
+    }
+    if (n > 1) {
+        for (int i = 0; i < 3; i++) mpos[i] = first[i] + sum[i] / n;
+        if (spread > param.touch_tolerance) {
+            THEKERNEL->streams->printf("WARNING: %d touches spread %.4f, more than the %.4f tolerance\n", n, spread, param.touch_tolerance);
+        }
     }
 
     // if probing x positive then the output goes to the positive out and vice versa
@@ -1342,6 +1659,9 @@ bool ZProbe::parse_parameters(Gcode *gcode, bool override_probe_check){
     if (gcode->has_letter('J')){
         param.extra_probe_distance = gcode->get_value('J');
     }
+    if (gcode->has_letter('W')){ //repeat touches until they agree within this
+        param.touch_tolerance = gcode->get_value('W');
+    }
     if (gcode->has_letter('I')){ //invert for NC probe
         if (gcode->get_value('I') > 0)
         {
@@ -1373,6 +1693,7 @@ void ZProbe::init_parameters_and_out_coords(){
     param.probe_g38_subcode = 0;                       //I
     param.slowZprobeRate = 50;                         
     param.extra_probe_distance = 4;                    //J
+    param.touch_tolerance = this->touch_tolerance;     //W
 }
 
 void ZProbe::probe_bore(bool calibration) //M461
@@ -12,7 +12,9 @@
 #include "Pin.h"
 #include <fastmath.h>
 #include "ATCHandlerPublicAccess.h"
+#include "ProbeLog.h"
 
+#include <string>
 #include <vector>
 
 // defined here as they are used in multiple files
@@ -23,6 +25,10 @@ class StepperMotor;
 class Gcode;
 class StreamOutput;
 class LevelingStrategy;
+class Hook;
+namespace mbed {
+    class InterruptIn;
+}
 
 // Homing States
 enum PROBING_CYCLES {
@@ -69,6 +75,7 @@ struct probe_parameters{
     float visualize_path_distance;
     float rotation_offset_per_probe;
     float extra_probe_distance;
+    float touch_tolerance;
     int repeat;
     int probe_g38_subcode;
     int save_position;
@@ -125,10 +132,16 @@ public:
     xy_output_coordinates& get_output_coordinates() { return out_coords; }
     bool fast_slow_probe_sequence_public(int axis, int direction);
     void init_parameters_and_out_coords();
+    // true if the result went to the log only and is not to be printed
+    bool log_probe(float x, float y, float z, bool ok, ProbeLog::SOURCE source);
 
 private:
     void config_load();
     bool probe_XYZ(Gcode *gcode);
+    void probe_scan(Gcode *gcode);
+    void latch_scan_edge(bool triggered);
+    uint32_t drain_scan_edges(StreamOutput *stream);
+    void actuator_to_machine(const float *actuator, float *pos);
     void rotate(int axis, float axis_distance, float *y_x, float *y_y, float rotation_angle);
     void rotateXY(float x_in = NAN, float y_in = NAN, float *x_out = nullptr, float *y_out = nullptr, float rotation_angle = 0);
     float get_xyz_move_length(float x, float y, float z);
@@ -148,6 +161,9 @@ private:
     void calibrate_Z(Gcode *gc);
     uint32_t read_probe(uint32_t dummy);
     uint32_t read_calibrate(uint32_t dummy);
+    void on_probe_edge();
+    void update_polling();
+    bool get_latched_position(float *pos);
     void on_get_public_data(void* argument);
     void on_set_public_data(void* argument);
     uint32_t probe_doubleHit(uint32_t dummy);
@@ -162,7 +178,14 @@ private:
     float max_z;
     bool tool_0_3axis;
     float dwell_before_probing;
+    float touch_tolerance;
+    float touch_approach_margin;
+    int max_touches;
     bool is_3dprobe_active;
+    // M467, probe results kept for the host to fetch in bulk
+    ProbeLog results;
+    uint16_t result_log_size;
+    std::string result_log_spill;
 
     Gcode* gcodeBuffer;
     char buff[100];
@@ -172,6 +195,9 @@ private:
 
     Pin pin;
     Pin calibrate_pin;
+    mbed::InterruptIn *probe_irq;
+    Hook *read_probe_hook;
+    Hook *read_calibrate_hook;
     std::vector<LevelingStrategy*> strategies;
     uint16_t debounce_ms;
 	volatile uint16_t debounce, cali_debounce;
@@ -212,6 +238,25 @@ private:
     volatile float calibrate_current_z;
     volatile bool safety_margin_exceeded;
     volatile float distance_moved;
+
+    // actuator positions snapshot by the probe pin interrupt at the moment it triggered
+    volatile bool probe_latched;
+    float latched_position[3];
+
+    // M468, every edge on the way along a scan move, latched the same way and taken off after the move
+    struct scan_edge_t {
+        float actuator[3];
+        uint32_t us;                // since the scan started
+        bool triggered;
+    };
+    static const int SCAN_EDGES = 64;
+    scan_edge_t *scan_edges;
+    volatile uint8_t scan_head, scan_tail;
+    volatile uint16_t scan_overrun;
+    volatile bool scanning;
+    volatile bool scan_stop;        // stop at a trigger so it can be retracted from
+    volatile bool scan_pin;         // the level last seen, for the poll without the interrupt
+    uint32_t scan_start_us;
 };
 
 #endif /* ZPROBE_H_ */
@@ -11,6 +11,8 @@ class MainButton : public Module {
         uint32_t button_tick(uint32_t dummy);
         uint32_t led_tick(uint32_t dummy);
         void on_second_tick(void *);
+        void on_state_change(void *);
+        void on_gcode_received(void *argument);
         void on_get_public_data(void* argument);
         void on_set_public_data(void* argument);
 
@@ -50,6 +52,7 @@ class MainButton : public Module {
 
         bool button_pressed;
         volatile BUTTON_STATE button_state;
+        bool state_changed;
         
         bool stop_on_cover_open;
 
@@ -61,6 +64,15 @@ class MainButton : public Module {
         void switch_power_12(int state);
         void switch_power_24(int state);
         uint8_t old_state;
+
+        // what was last sent to the leds on the Air, a byte each of R, G and B for the five of them
+        static const int LED_FRAME_SIZE = 15;
+        unsigned char led_frame[LED_FRAME_SIZE];
+        uint32_t led_sent_us;
+        // set by M150, shown instead of the machine state
+        volatile bool custom_led;
+        unsigned char custom_rgb[3];
+        void send_led_frame();
         void set_led_color(unsigned char R1, unsigned char G1, unsigned char B1,unsigned char R2, unsigned char G2, unsigned char B2,unsigned char R3, unsigned char G3, unsigned char B3,unsigned char R4, unsigned char G4, unsigned char B4,unsigned char R5, unsigned char G5, unsigned char B5);
         void set_led_colors(unsigned char R, unsigned char G, unsigned char B);
         void set_led_num(unsigned char ColorFR, unsigned char ColorFG, unsigned char ColorFB, unsigned char ColorBR, unsigned char ColorBG, unsigned char ColorBB, unsigned char num);
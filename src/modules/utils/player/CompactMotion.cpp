@@ -0,0 +1,115 @@
+/*
+    This file is part of Smoothie (http://smoothieware.org/). The motion control part is heavily based on Grbl (https://github.com/simen/grbl).
+    Smoothie is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+    Smoothie is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+    You should have received a copy of the GNU General Public License along with Smoothie. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "CompactMotion.h"
+
+#include "LineReader.h"
+#include "Gcode.h"
+
+#include <string.h>
+#include <math.h>
+
+namespace CompactMotion {
+
+namespace {
+    // zigzag LEB128, returns the bytes it took or -1 if it runs off the end or past 32 bits
+    int read_varint(LineReader &reader, int32_t &value)
+    {
+        uint32_t u = 0;
+        for (int i = 0; i < 5; ++i) {
+            uint8_t b;
+            if(reader.read(&b, 1) != 1) return -1;
+            u |= (uint32_t)(b & 0x7F) << (7 * i);
+            if(!(b & 0x80)) {
+                value = (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+                return i + 1;
+            }
+        }
+        return -1;
+    }
+}
+
+bool read_header(LineReader &reader)
+{
+    uint8_t hdr[HEADER_SIZE];
+    if(reader.read(hdr, HEADER_SIZE) != HEADER_SIZE) return false;
+
+    return hdr[0] == 'C' && hdr[1] == 'M' && hdr[2] == 'S' && hdr[3] >= 1 && hdr[3] <= VERSION;
+}
+
+int read_record(LineReader &reader, Record &rec, DeltaBase &base)
+{
+    if(reader.read(&rec.op, 1) != 1) return 0;
+
+    if(rec.op <= OP_G3) {
+        uint8_t mask[2];
+        if(reader.read(mask, 2) != 2) return -1;
+        rec.words = mask[0] | (mask[1] << 8);
+
+        size_t n = __builtin_popcount(rec.words) * sizeof(float);
+        if(reader.read(rec.values, n) != n) return -1;
+
+        // the axes it sets are what a following delta record is from
+        int v = 0;
+        for (int i = 0; i < DELTA_AXES; ++i) {
+            if(rec.words & (1 << i)) base.axis[i] = lroundf(rec.values[v++] * DELTA_SCALE);
+        }
+        return 3 + n;
+    }
+
+    if(rec.op <= OP_DELTA_G3) {
+        uint8_t mask[2];
+        if(reader.read(mask, 2) != 2) return -1;
+        rec.words = mask[0] | (mask[1] << 8);
+        rec.op -= OP_DELTA_G0 - OP_G0;
+
+        int len = 3;
+        int v = 0;
+        for (int i = 0; i < MAX_WORDS; ++i) {
+            if(!(rec.words & (1 << i))) continue;
+            int32_t d;
+            int n = read_varint(reader, d);
+            if(n < 0) return -1;
+            len += n;
+            if(i < DELTA_AXES) {
+                base.axis[i] += d;
+                d = base.axis[i];
+            }
+            rec.values[v++] = d / DELTA_SCALE;
+        }
+        return len;
+    }
+
+    if(rec.op == OP_TEXT) {
+        uint8_t len;
+        if(reader.read(&len, 1) != 1 || len > MAX_TEXT) return -1;
+        if(reader.read(rec.text, len) != len) return -1;
+        rec.text[len] = '\n';
+        rec.text[len + 1] = '\0';
+        return 2 + len;
+    }
+
+    return -1;
+}
+
+Gcode *make_gcode(const Record &rec, StreamOutput *stream, unsigned int line)
+{
+    uint32_t letters = 0;
+    float values[26];
+    int v = 0;
+    for (int i = 0; i < MAX_WORDS; ++i) {
+        if(rec.words & (1 << i)) {
+            int idx = WORDS[i] - 'A';
+            letters |= (1UL << idx);
+            values[idx] = rec.values[v++];
+        }
+    }
+
+    return new Gcode(rec.op - OP_G0, letters, values, stream, line);
+}
+
+}
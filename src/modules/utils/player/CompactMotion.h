@@ -0,0 +1,79 @@
+/*
+    This file is part of Smoothie (http://smoothieware.org/). The motion control part is heavily based on Grbl (https://github.com/simen/grbl).
+    Smoothie is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+    Smoothie is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+    You should have received a copy of the GNU General Public License along with Smoothie. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <stddef.h>
+
+class LineReader;
+class Gcode;
+class StreamOutput;
+
+/*
+ * Compact binary motion stream, a pre-tokenized alternative to G-code text that the player
+ * can feed to the robot without any text parsing, strtof or GcodeDispatch string handling.
+ *
+ * The host converts the job, the file keeps its usual name and is recognised by its header:
+ *
+ *   header  'C' 'M' 'S' version(1) then 4 reserved bytes
+ *
+ * followed by records, each one counts as one line for progress and goto:
+ *
+ *   0x00-0x03   G0-G3, uint16 word mask then one float per set bit in WORDS order
+ *   0x04-0x07   G0-G3 delta coded (version 2), uint16 word mask then one zigzag LEB128 varint per set
+ *               bit, in thousandths. For X Y Z A B C it is the change from where the last motion record
+ *               left that axis, for the other words it is the value itself
+ *   0x10        text, uint8 length then that many bytes of G-code (no newline), used for
+ *               everything that is not a plain G0-G3 (M codes, tool changes, G53, comments etc)
+ *
+ * All floats are little endian IEEE, the same as the target stores them. A delta coded move along one axis
+ * of a job in mm with three decimals is 4-5 bytes rather than 7. The axis values are kept as integer
+ * thousandths while decoding so the deltas never drift, a float record sets them too so the host can
+ * mix the two.
+ */
+namespace CompactMotion {
+    const size_t HEADER_SIZE = 8;
+    const uint8_t VERSION = 2;
+
+    const uint8_t OP_G0 = 0x00;
+    const uint8_t OP_G3 = 0x03;
+    const uint8_t OP_DELTA_G0 = 0x04;
+    const uint8_t OP_DELTA_G3 = 0x07;
+    const uint8_t OP_TEXT = 0x10;
+
+    // bit n of the word mask is WORDS[n]
+    const char WORDS[] = "XYZABCIJKRFSPEQL";
+    const int MAX_WORDS = 16;
+    const int MAX_TEXT = 128;
+    // the first DELTA_AXES words are delta coded, in units of 1/DELTA_SCALE
+    const int DELTA_AXES = 6;
+    const float DELTA_SCALE = 1000.0F;
+
+    struct Record {
+        uint8_t op;
+        uint16_t words;
+        float values[MAX_WORDS];    // packed, in the order of the set bits
+        char text[MAX_TEXT + 2];    // nul terminated, with a trailing newline like a line from the file
+    };
+
+    // where the motion records so far have left each delta coded axis, what the next delta is from.
+    // Starts at zero at the top of the file and has to be kept with any offset the reader seeks back to
+    struct DeltaBase {
+        int32_t axis[DELTA_AXES] = {};
+    };
+
+    // reads the header at the current position, returns true if this is a compact stream
+    bool read_header(LineReader &reader);
+
+    // returns the number of bytes the record used, 0 at end of file and -1 if the record is corrupt.
+    // A delta coded record comes back as a plain G0-G3 one with its values worked out from base
+    int read_record(LineReader &reader, Record &rec, DeltaBase &base);
+
+    // makes a G0-G3 Gcode from a motion record, rec.op is OP_G0-OP_G3
+    Gcode *make_gcode(const Record &rec, StreamOutput *stream, unsigned int line);
+}
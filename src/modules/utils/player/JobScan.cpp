@@ -0,0 +1,262 @@
+/*
+      This file is part of Smoothie (http://smoothieware.org/). The motion control part is heavily based on Grbl (https://github.com/simen/grbl).
+      Smoothie is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+      Smoothie is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+      You should have received a copy of the GNU General Public License along with Smoothie. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "JobScan.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define PI 3.14159265358979F
+#define CANNED 81
+
+static const float feed_edges[JobScan::FEED_BUCKETS - 1] = {100, 250, 500, 1000, 2000, 4000, 8000};
+
+JobScan::JobScan()
+{
+    begin();
+}
+
+void JobScan::begin()
+{
+    for (int i = 0; i < 3; i++) {
+        min[i] = 1e9F;
+        max[i] = -1e9F;
+        position[i] = 0;
+        g92[i] = 0;
+        known[i] = false;
+    }
+    for (int i = 0; i < FEED_BUCKETS; i++) cut_mm[i] = 0;
+    tool_count = 0;
+    lines = 0;
+    first_error = 0;
+    feed = 0;
+    motion = 0;
+    plane = 17;
+    next_tool = -1;
+    absolute = true;
+    inches = false;
+}
+
+float JobScan::bucket_edge(int i)
+{
+    return i < FEED_BUCKETS - 1 ? feed_edges[i] : INFINITY;
+}
+
+// what the robot, the probe, the drilling cycles and the homing take, anything else is an error when played
+bool JobScan::supported(int g)
+{
+    return (g >= 0 && g <= 5) || g == 7 || g == 10 || (g >= 17 && g <= 21) || (g >= 28 && g <= 33) || g == 38 ||
+           (g >= 40 && g <= 42) || (g >= 53 && g <= 59) || g == 61 || g == 64 || g == 73 || g == 74 ||
+           (g >= 80 && g <= 84) || (g >= 90 && g <= 94) || g == 98 || g == 99;
+}
+
+void JobScan::line(const char *s)
+{
+    bool has[26] = {false};
+    float val[26];
+    bool m6 = false, no_move = false, machine = false, set_g92 = false, clear_g92 = false, bad = false;
+
+    lines++;
+    // a : starts the raster row of an M327, which is not words
+    while (*s != '\0' && *s != ';' && *s != '\n' && *s != ':') {
+        char c = *s++;
+        if (c == '(') {
+            while (*s != '\0' && *s != ')') s++;
+            if (*s == ')') s++;
+            continue;
+        }
+        if (c >= 'a' && c <= 'z') c -= 'a' - 'A';
+        if (c < 'A' || c > 'Z') continue;
+
+        char *end;
+        float v = strtof(s, &end);
+        if (end == s) continue;
+        s = end;
+
+        if (c == 'G') {
+            int code = (int)v;
+            int sub = (int)roundf((v - code) * 10);
+            if (!supported(code)) bad = true;
+            if (code <= 3) {
+                motion = code;
+            } else if (code == 80) {
+                motion = -1;
+            } else if (code == 73 || code == 74 || (code >= 81 && code <= 84)) {
+                motion = CANNED;
+            } else if (code >= 17 && code <= 19) {
+                plane = code;
+            } else if (code == 20 || code == 21) {
+                inches = code == 20;
+            } else if (code == 90 || code == 91) {
+                absolute = code == 90;
+            } else if (code == 92) {
+                no_move = true;
+                if (sub == 0) set_g92 = true;
+                else clear_g92 = true;
+            } else if (code == 53) {
+                machine = true;
+            } else if (code == 4 || code == 10 || (code >= 28 && code <= 33) || code == 38) {
+                // dwells, setting offsets, homing and probing do not go to the words on the line
+                no_move = true;
+            }
+        } else if (c == 'M') {
+            if ((int)v == 6) m6 = true;
+        } else {
+            has[c - 'A'] = true;
+            val[c - 'A'] = v;
+        }
+    }
+
+    if (bad && first_error == 0) first_error = lines;
+
+    float scale = inches ? 25.4F : 1.0F;
+    if (has['F' - 'A'] && val['F' - 'A'] > 0) feed = val['F' - 'A'] * scale;
+    if (has['T' - 'A']) next_tool = (int)val['T' - 'A'];
+    if (m6 && next_tool >= 0) add_tool(next_tool);
+
+    if (clear_g92) {
+        for (int i = 0; i < 3; i++) g92[i] = 0;
+    }
+    if (set_g92) {
+        // the position stays where it is and is called what the words say from here on
+        for (int i = 0; i < 3; i++) {
+            if (has['X' - 'A' + i]) {
+                g92[i] = position[i] - val['X' - 'A' + i] * scale;
+                known[i] = true;
+            }
+        }
+    }
+    // the line is not played as it is on the card, so it is not followed either
+    if (no_move || machine || bad || motion < 0) return;
+    if (!has['X' - 'A'] && !has['Y' - 'A'] && !has['Z' - 'A']) return;
+
+    float target[3];
+    for (int i = 0; i < 3; i++) {
+        if (!has['X' - 'A' + i]) target[i] = position[i];
+        else if (absolute) target[i] = val['X' - 'A' + i] * scale + g92[i];
+        else target[i] = position[i] + val['X' - 'A' + i] * scale;
+        // where the job starts is not known, an axis is only counted once it has been moved
+        if (has['X' - 'A' + i] && absolute) known[i] = true;
+    }
+
+    if (motion == CANNED) {
+        // drills down to Z at each XY and comes back up, to the R plane at the lowest
+        extend(target);
+        if (has['R' - 'A']) {
+            float r[3] = {target[0], target[1], val['R' - 'A'] * scale + (absolute ? g92[2] : position[2])};
+            extend(r);
+        }
+        position[0] = target[0];
+        position[1] = target[1];
+        return;
+    }
+
+    if ((motion == 2 || motion == 3) && plane == 17 && (has['I' - 'A'] || has['J' - 'A'])) {
+        float offset[3] = {has['I' - 'A'] ? val['I' - 'A'] * scale : 0, has['J' - 'A'] ? val['J' - 'A'] * scale : 0, 0};
+        arc(target, offset, motion == 2);
+    } else {
+        if (motion != 0) {
+            float dx = target[0] - position[0], dy = target[1] - position[1], dz = target[2] - position[2];
+            cut(sqrtf(dx * dx + dy * dy + dz * dz));
+        }
+        move(target);
+    }
+}
+
+void JobScan::move(const float target[3])
+{
+    extend(target);
+    for (int i = 0; i < 3; i++) position[i] = target[i];
+}
+
+void JobScan::arc(const float target[3], const float offset[3], bool cw)
+{
+    float cx = position[0] + offset[0], cy = position[1] + offset[1];
+    float r = hypotf(offset[0], offset[1]);
+    float a0 = atan2f(-offset[1], -offset[0]);
+    float a1 = atan2f(target[1] - cy, target[0] - cx);
+    float sweep = cw ? a0 - a1 : a1 - a0;
+    // the same start and end is a full circle
+    if (sweep <= 0) sweep += 2 * PI;
+
+    // the quadrant points the arc passes through on its way
+    for (int q = 0; q < 4; q++) {
+        float a = q * PI / 2;
+        float d = cw ? a0 - a : a - a0;
+        while (d < 0) d += 2 * PI;
+        while (d >= 2 * PI) d -= 2 * PI;
+        if (d <= sweep) {
+            float p[3] = {cx + r * cosf(a), cy + r * sinf(a), position[2]};
+            extend(p);
+        }
+    }
+    float dz = target[2] - position[2];
+    cut(sqrtf(r * sweep * r * sweep + dz * dz));
+    move(target);
+}
+
+void JobScan::extend(const float p[3])
+{
+    for (int i = 0; i < 3; i++) {
+        if (!known[i]) continue;
+        if (p[i] < min[i]) min[i] = p[i];
+        if (p[i] > max[i]) max[i] = p[i];
+    }
+}
+
+void JobScan::add_tool(int t)
+{
+    for (int i = 0; i < tool_count; i++) {
+        if (tools[i] == t) return;
+    }
+    if (tool_count < MAX_TOOLS) tools[tool_count++] = t;
+}
+
+void JobScan::cut(float distance)
+{
+    int b = 0;
+    while (b < FEED_BUCKETS - 1 && feed >= feed_edges[b]) b++;
+    cut_mm[b] += distance;
+}
+
+bool JobScan::save(const char *path, long size) const
+{
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) return false;
+    fprintf(fp, "jobscan 1 %ld\n", size);
+    fprintf(fp, "lines %lu %lu\n", lines, first_error);
+    fprintf(fp, "bounds %.3f %.3f %.3f %.3f %.3f %.3f\n", min[0], min[1], min[2], max[0], max[1], max[2]);
+    fprintf(fp, "tools %u", tool_count);
+    for (int i = 0; i < tool_count; i++) fprintf(fp, " %d", tools[i]);
+    fprintf(fp, "\ncut");
+    for (int i = 0; i < FEED_BUCKETS; i++) fprintf(fp, " %.1f", cut_mm[i]);
+    fprintf(fp, "\n");
+    return fclose(fp) == 0;
+}
+
+bool JobScan::load(const char *path, long size)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) return false;
+    long sz = -1;
+    unsigned int n = 0;
+    bool ok = fscanf(fp, "jobscan 1 %ld lines %lu %lu", &sz, &lines, &first_error) == 3 && sz == size &&
+              fscanf(fp, " bounds %f %f %f %f %f %f", &min[0], &min[1], &min[2], &max[0], &max[1], &max[2]) == 6 &&
+              fscanf(fp, " tools %u", &n) == 1 && n <= MAX_TOOLS;
+    tool_count = 0;
+    for (unsigned int i = 0; ok && i < n; i++) {
+        ok = fscanf(fp, "%d", &tools[i]) == 1;
+        tool_count = i + 1;
+    }
+    int at = 0;
+    ok = ok && fscanf(fp, " cut%n", &at) == 0 && at > 0;
+    for (int i = 0; ok && i < FEED_BUCKETS; i++) ok = fscanf(fp, "%f", &cut_mm[i]) == 1;
+    fclose(fp);
+    if (!ok) begin();
+    return ok;
+}
@@ -0,0 +1,66 @@
+/*
+      This file is part of Smoothie (http://smoothieware.org/). The motion control part is heavily based on Grbl (https://github.com/simen/grbl).
+      Smoothie is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+      Smoothie is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+      You should have received a copy of the GNU General Public License along with Smoothie. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * What a job does, read from its G-code without running any of it: how far it goes on each axis, the
+ * tools it changes to, the first line with a G code the firmware does not have and how much it cuts at
+ * each feed.
+ *
+ * The bounds are in the job's own coordinates, before any WCS offset, from the end points of the moves
+ * plus the extremes of the XY arcs that sweep past them. Moves in machine coordinates (G53) and anything
+ * that goes where we can not follow (homing, probing) are left out.
+ *
+ * The result is kept as a small text file next to the file's digest, so it is scanned once after it is
+ * uploaded rather than each time it is played.
+ */
+class JobScan {
+    public:
+        static const int MAX_TOOLS = 16;
+        static const int FEED_BUCKETS = 8;
+
+        JobScan();
+
+        void begin();
+        void line(const char *s);
+
+        // the sidecar is only trusted for a file of the size it was written for
+        bool save(const char *path, long size) const;
+        bool load(const char *path, long size);
+
+        bool has_bounds(int axis) const { return min[axis] <= max[axis]; }
+        // the upper edge in mm/min of each feed bucket, the last has no upper edge
+        static float bucket_edge(int i);
+
+        float min[3], max[3];
+        int tools[MAX_TOOLS];
+        uint8_t tool_count;
+        unsigned long lines;
+        unsigned long first_error;          // 0 if every line is fine
+        float cut_mm[FEED_BUCKETS];          // distance fed at each feed
+
+    private:
+        void move(const float target[3]);
+        void arc(const float target[3], const float offset[3], bool cw);
+        void extend(const float p[3]);
+        void add_tool(int t);
+        void cut(float distance);
+        static bool supported(int g);
+
+        float position[3];
+        float g92[3];                        // what G92 has taken off the words
+        float feed;                          // mm/min
+        bool known[3];
+        int motion;
+        int plane;
+        int next_tool;
+        bool absolute;
+        bool inches;
+};
@@ -0,0 +1,276 @@
+/*
+      This file is part of Smoothie (http://smoothieware.org/). The motion control part is heavily based on Grbl (https://github.com/simen/grbl).
+      Smoothie is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+      Smoothie is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+      You should have received a copy of the GNU General Public License along with Smoothie. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "MacroFlow.h"
+#include "LineReader.h"
+#include "Gcode.h"
+#include "Kernel.h"
+#include "StreamOutput.h"
+#include "StreamOutputPool.h"
+
+#include <ctype.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// true if p starts with the keyword as a whole word
+static bool keyword(const char *p, const char *kw)
+{
+    size_t n = strlen(kw);
+    return strncasecmp(p, kw, n) == 0 && !isalpha(p[n]);
+}
+
+static const char *skip_space(const char *p)
+{
+    while (*p == ' ' || *p == '\t') p++;
+    return p;
+}
+
+// the number after a keyword like DO or END, -1 if there is none
+static int block_number(const char *p)
+{
+    p = skip_space(p);
+    if (!isdigit(*p)) return -1;
+    return strtol(p, nullptr, 10);
+}
+
+// the n of the DOn on a WHILE line, without evaluating the condition
+static int loop_number(const char *p)
+{
+    for (const char *q = p + 5; *q != '\0'; ++q) {
+        if (toupper(q[0]) == 'D' && toupper(q[1]) == 'O' && !isalpha(q[-1])) {
+            int n = block_number(q + 2);
+            if (n >= 0) return n;
+        }
+    }
+    return -1;
+}
+
+MacroFlow::MacroFlow()
+{
+    reset();
+}
+
+void MacroFlow::reset()
+{
+    n_loops = 0;
+    n_labels = 0;
+    next_label = 0;
+    skipping = NOT_SKIPPING;
+    skip_id = 0;
+    skip_depth = 0;
+    skip_label = 0;
+    wrapped = false;
+}
+
+MacroFlow::RESULT MacroFlow::line(char *buf, long offset, unsigned long &line_no, LineReader &reader)
+{
+    const char *p = skip_space(buf);
+
+    // N words label the line for GOTO
+    if ((*p == 'N' || *p == 'n') && isdigit(p[1])) {
+        char *e;
+        uint32_t n = strtoul(p + 1, &e, 10);
+        add_label(n, offset, line_no);
+        p = skip_space(e);
+
+        if (skipping == SKIP_TO_LABEL && n == skip_label) {
+            skipping = NOT_SKIPPING;
+        }
+    }
+
+    if (skipping == SKIP_TO_LABEL) return SKIP;
+
+    if (skipping == SKIP_TO_END) {
+        // only loops with the same number have to be counted to find the right END
+        if (keyword(p, "WHILE") && loop_number(p) == skip_id) {
+            skip_depth++;
+        } else if (keyword(p, "END") && block_number(p + 3) == skip_id) {
+            if (skip_depth == 0) skipping = NOT_SKIPPING;
+            else skip_depth--;
+        }
+        return SKIP;
+    }
+
+    // anything else is an ordinary line and gets played
+    switch (toupper(*p)) {
+        case 'W': case 'E': case 'G': case 'I': break;
+        default: return RUN;
+    }
+
+    if (keyword(p, "WHILE")) {
+        p += 5;
+        float value;
+        if (!condition(p, line_no, value)) return FAIL;
+        p = skip_space(p);
+        int id = keyword(p, "DO") ? block_number(p + 2) : -1;
+        if (id < 0) return fail("WHILE needs DO and a number", line_no);
+
+        bool again = n_loops > 0 && loops[n_loops - 1].offset == offset;
+        if (value != 0) {
+            if (!again) {
+                // a loop with the same number left by a GOTO is over, and so is anything inside it
+                for (int i = 0; i < n_loops; ++i) {
+                    if (loops[i].id == id) {
+                        n_loops = i;
+                        break;
+                    }
+                }
+                if (n_loops >= MAX_LOOPS) return fail("WHILE loops nested too deep", line_no);
+                loops[n_loops++] = {offset, line_no, (uint8_t)id};
+            }
+        } else {
+            if (again) n_loops--;
+            skipping = SKIP_TO_END;
+            skip_id = id;
+            skip_depth = 0;
+        }
+        return SKIP;
+    }
+
+    if (keyword(p, "END")) {
+        int id = block_number(p + 3);
+        if (id < 0) return RUN; // not ours
+        if (n_loops == 0 || loops[n_loops - 1].id != id) return fail("END without its WHILE DO", line_no);
+
+        // back to the WHILE to test the condition again
+        const loop_t &l = loops[n_loops - 1];
+        if (!reader.seek(l.offset)) return fail("cannot seek back to WHILE", line_no);
+        line_no = l.line - 1;
+        return JUMP;
+    }
+
+    if (keyword(p, "GOTO")) {
+        return go_to(p + 4, line_no, reader);
+    }
+
+    if (keyword(p, "IF")) {
+        p += 2;
+        float value;
+        if (!condition(p, line_no, value)) return FAIL;
+        p = skip_space(p);
+
+        if (keyword(p, "GOTO")) {
+            if (value == 0) return SKIP;
+            return go_to(p + 4, line_no, reader);
+        }
+
+        if (keyword(p, "THEN")) {
+            if (value == 0) return SKIP;
+            // the statement is played as if it were the line
+            p = skip_space(p + 4);
+            memmove(buf, p, strlen(p) + 1);
+            return RUN;
+        }
+
+        return fail("IF needs GOTO or THEN", line_no);
+    }
+
+    return RUN;
+}
+
+// evaluates the [condition] at p and moves p past it
+bool MacroFlow::condition(const char *&p, unsigned long line_no, float &value)
+{
+    p = skip_space(p);
+    if (*p != '[') {
+        fail("expected [ for the condition", line_no);
+        return false;
+    }
+
+    if (!expression(p, value)) {
+        if (!THEKERNEL->is_halted()) fail("bad condition", line_no);
+        return false;
+    }
+    return true;
+}
+
+// evaluates the expression at p and moves p past it, false if it did not give a number
+bool MacroFlow::expression(const char *&p, float &value)
+{
+    // the expression operators are lower case
+    char low[136];
+    size_t n = 0;
+    for (; p[n] != '\0' && n < sizeof(low) - 1; ++n) low[n] = tolower(p[n]);
+    low[n] = '\0';
+
+    Gcode gc("", &StreamOutput::NullStream);
+    char *e;
+    value = gc.evaluate_expression(low, &e);
+    if (isnan(value) || e == low) return false;
+    p += e - low;
+    return true;
+}
+
+// jumps to the label given by the number or expression at p
+MacroFlow::RESULT MacroFlow::go_to(const char *p, unsigned long &line_no, LineReader &reader)
+{
+    float f;
+    if (!expression(p, f) || f < 0) {
+        if (THEKERNEL->is_halted()) return FAIL;
+        return fail("GOTO needs a line number", line_no);
+    }
+    uint32_t n = lroundf(f);
+
+    for (int i = 0; i < n_labels; ++i) {
+        if (labels[i].n == n) {
+            if (!reader.seek(labels[i].offset)) return fail("cannot seek to label", line_no);
+            line_no = labels[i].line - 1;
+            return JUMP;
+        }
+    }
+
+    // not passed yet, read on until it turns up
+    skipping = SKIP_TO_LABEL;
+    skip_label = n;
+    wrapped = false;
+    return SKIP;
+}
+
+void MacroFlow::add_label(uint32_t n, long offset, unsigned long line_no)
+{
+    for (int i = 0; i < n_labels; ++i) {
+        if (labels[i].n == n) return;
+    }
+
+    // when it is full the oldest go first, they can still be found by reading the file
+    if (n_labels < MAX_LABELS) n_labels++;
+    labels[next_label] = {offset, line_no, n};
+    next_label = (next_label + 1) % MAX_LABELS;
+}
+
+bool MacroFlow::end_of_file(LineReader &reader, unsigned long &line_no)
+{
+    if (skipping == SKIP_TO_LABEL && !wrapped && reader.seek(0)) {
+        // the label may be before where we started looking
+        wrapped = true;
+        line_no = 0;
+        return true;
+    }
+
+    if (skipping == SKIP_TO_LABEL) {
+        THEKERNEL->streams->printf("Error: GOTO %lu, there is no line N%lu\r\n", (unsigned long)skip_label, (unsigned long)skip_label);
+        THEKERNEL->set_halt_reason(MANUAL);
+        THEKERNEL->call_event(ON_HALT, nullptr);
+    } else if (skipping == SKIP_TO_END) {
+        THEKERNEL->streams->printf("Error: WHILE DO%d has no END%d\r\n", skip_id, skip_id);
+        THEKERNEL->set_halt_reason(MANUAL);
+        THEKERNEL->call_event(ON_HALT, nullptr);
+    }
+    reset();
+    return false;
+}
+
+MacroFlow::RESULT MacroFlow::fail(const char *msg, unsigned long line_no)
+{
+    THEKERNEL->streams->printf("Error: %s on line %lu\r\n", msg, line_no);
+    THEKERNEL->set_halt_reason(MANUAL);
+    THEKERNEL->call_event(ON_HALT, nullptr);
+    reset();
+    return FAIL;
+}
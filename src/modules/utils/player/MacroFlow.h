@@ -0,0 +1,79 @@
+/*
+      This file is part of Smoothie (http://smoothieware.org/). The motion control part is heavily based on Grbl (https://github.com/simen/grbl).
+      Smoothie is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+      Smoothie is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+      You should have received a copy of the GNU General Public License along with Smoothie. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+class LineReader;
+
+/*
+ * Fanuc style macro control flow for files being played.
+ *
+ *   WHILE [cond] DOn ... ENDn      loops while cond is not zero, n tells nested loops apart
+ *   IF [cond] GOTO n               jumps to the line starting with Nn when cond is not zero
+ *   IF [cond] THEN statement       runs the rest of the line when cond is not zero
+ *   GOTO n                         n may be an expression too, GOTO #101
+ *
+ * Every line the player reads goes through line() first, which only has to look at the first word
+ * of anything that is not one of these. Jumps seek the reader, back to the WHILE of a loop or to a
+ * label remembered as it was passed, a label further on is found by skipping lines until it turns
+ * up, wrapping round to the start of the file once. Conditions go through the expression cache, so a
+ * loop compiles them the first time round only.
+ *
+ * Conditions are evaluated as the line is read, ahead of the moves still queued, so a condition on
+ * the machine position needs an M400 before it. Keywords and conditions are not case sensitive.
+ */
+class MacroFlow {
+    public:
+        enum RESULT {
+            RUN,    // play the line, which a THEN may have replaced with its statement
+            SKIP,   // the line is done with, nothing to play
+            JUMP,   // the reader has been moved, line_no is the number of lines before where it is now
+            FAIL,   // an error was reported and the machine halted
+        };
+
+        MacroFlow();
+        void reset();
+
+        // buf is line number line_no of the file and starts at offset in the reader
+        RESULT line(char *buf, long offset, unsigned long &line_no, LineReader &reader);
+        // the file ran out, true if the reader went back to the start still looking for a label
+        bool end_of_file(LineReader &reader, unsigned long &line_no);
+
+    private:
+        static const int MAX_LOOPS = 8;
+        static const int MAX_LABELS = 32;
+
+        struct loop_t {
+            long offset;            // of the WHILE line
+            unsigned long line;
+            uint8_t id;
+        };
+        struct label_t {
+            long offset;
+            unsigned long line;
+            uint32_t n;
+        };
+
+        bool condition(const char *&p, unsigned long line_no, float &value);
+        bool expression(const char *&p, float &value);
+        RESULT go_to(const char *p, unsigned long &line_no, LineReader &reader);
+        void add_label(uint32_t n, long offset, unsigned long line_no);
+        RESULT fail(const char *msg, unsigned long line_no);
+
+        loop_t loops[MAX_LOOPS];
+        label_t labels[MAX_LABELS];
+        uint32_t skip_label;
+        uint8_t n_loops;
+        uint8_t n_labels;
+        uint8_t next_label;
+        uint8_t skip_id;            // the loop being skipped to its END
+        uint8_t skip_depth;         // loops with the same number nested inside it
+        enum { NOT_SKIPPING, SKIP_TO_END, SKIP_TO_LABEL } skipping;
+        bool wrapped;
+};
@@ -0,0 +1,275 @@
+/*
+    This file is part of Smoothie (http://smoothieware.org/). The motion control part is heavily based on Grbl (https://github.com/simen/grbl).
+    Smoothie is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+    Smoothie is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+    You should have received a copy of the GNU General Public License along with Smoothie. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "MotionEstimate.h"
+
+#include "libs/Kernel.h"
+#include "Robot.h"
+#include "Planner.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#define PI 3.14159265358979F
+
+MotionEstimate::MotionEstimate()
+{
+    begin();
+}
+
+void MotionEstimate::begin()
+{
+    position[0] = position[1] = position[2] = 0;
+    secs = 0;
+    pending = false;
+    motion = 0;
+    plane = 17;
+    absolute = true;
+    inches = false;
+
+    if (THEROBOT == nullptr) {
+        accel = 100;
+        junction_deviation = 0.05F;
+        max_speeds[0] = max_speeds[1] = max_speeds[2] = 100;
+        feed = seek = 100;
+        return;
+    }
+
+    accel = THEROBOT->get_default_acceleration();
+    junction_deviation = THEKERNEL->planner->get_junction_deviation();
+    for (int i = 0; i < 3; i++) {
+        max_speeds[i] = THEROBOT->get_max_speed(i);
+    }
+    seek = THEROBOT->get_seek_rate() / THEROBOT->get_seconds_per_minute();
+    feed = THEROBOT->get_feed_rate() / THEROBOT->get_seconds_per_minute();
+}
+
+void MotionEstimate::line(const char *s)
+{
+    bool has[26] = {false};
+    float val[26];
+    bool stopped = false, machine = false, dwell = false;
+
+    while (*s != '\0' && *s != ';' && *s != '\n') {
+        char c = *s++;
+        if (c == '(') {
+            while (*s != '\0' && *s != ')') s++;
+            if (*s == ')') s++;
+            continue;
+        }
+        if (c >= 'a' && c <= 'z') c -= 'a' - 'A';
+        if (c < 'A' || c > 'Z') continue;
+
+        char *end;
+        float v = strtof(s, &end);
+        if (end == s) continue;
+        s = end;
+
+        if (c == 'G') {
+            int code = (int)v;
+            if (code <= 3) {
+                motion = code;
+            } else if (code == 4) {
+                dwell = true;
+            } else if (code >= 17 && code <= 19) {
+                plane = code;
+            } else if (code == 20 || code == 21) {
+                inches = code == 20;
+            } else if (code == 90 || code == 91) {
+                absolute = code == 90;
+            } else if (code == 28 || code == 30 || code == 38 || code == 53 || (code >= 73 && code <= 89)) {
+                // homing, probing, machine coordinates and canned cycles go where we can not follow
+                machine = true;
+            }
+        } else if (c == 'M') {
+            // tool changes, spindle changes and waits all stop the machine
+            stopped = true;
+        } else {
+            has[c - 'A'] = true;
+            val[c - 'A'] = v;
+        }
+    }
+
+    float scale = inches ? 25.4F : 1.0F;
+    if (has['F' - 'A'] && val['F' - 'A'] > 0) {
+        float rate = val['F' - 'A'] * scale / 60.0F;
+        if (motion == 0) seek = rate;
+        else feed = rate;
+    }
+
+    if (dwell) {
+        stop();
+        float ms = has['P' - 'A'] ? val['P' - 'A'] * (THEKERNEL->is_grbl_mode() ? 1000.0F : 1.0F) : 0;
+        if (has['S' - 'A']) ms += val['S' - 'A'] * 1000.0F;
+        secs += ms / 1000.0F;
+        return;
+    }
+
+    if (machine) {
+        if (!absolute) {
+            // relative machine moves still get the right distance
+            for (int i = 0; i < 3; i++) {
+                if (has['X' - 'A' + i]) position[i] += val['X' - 'A' + i] * scale;
+            }
+        }
+        stop();
+        return;
+    }
+
+    if (stopped) stop();
+
+    if (!has['X' - 'A'] && !has['Y' - 'A'] && !has['Z' - 'A']) return;
+
+    float target[3];
+    for (int i = 0; i < 3; i++) {
+        float v = has['X' - 'A' + i] ? val['X' - 'A' + i] * scale : (absolute ? position[i] : 0);
+        target[i] = absolute ? v : position[i] + v;
+    }
+    float offset[3];
+    bool has_offset = false;
+    for (int i = 0; i < 3; i++) {
+        offset[i] = has['I' - 'A' + i] ? val['I' - 'A' + i] * scale : 0;
+        has_offset |= has['I' - 'A' + i];
+    }
+
+    move(motion, target, offset, has_offset);
+}
+
+void MotionEstimate::record(const CompactMotion::Record &rec)
+{
+    if (rec.op == CompactMotion::OP_TEXT) {
+        line(rec.text);
+        return;
+    }
+
+    motion = rec.op - CompactMotion::OP_G0;
+    float scale = inches ? 25.4F : 1.0F;
+    float target[3] = {absolute ? position[0] : 0, absolute ? position[1] : 0, absolute ? position[2] : 0};
+    float offset[3] = {0, 0, 0};
+    bool has_axis = false, has_offset = false;
+    int v = 0;
+    for (int i = 0; i < CompactMotion::MAX_WORDS; ++i) {
+        if (!(rec.words & (1 << i))) continue;
+        float value = rec.values[v++];
+        char c = CompactMotion::WORDS[i];
+        if (c >= 'X' && c <= 'Z') {
+            target[c - 'X'] = value * scale;
+            has_axis = true;
+        } else if (c >= 'I' && c <= 'K') {
+            offset[c - 'I'] = value * scale;
+            has_offset = true;
+        } else if (c == 'F' && value > 0) {
+            if (motion == 0) seek = value * scale / 60.0F;
+            else feed = value * scale / 60.0F;
+        }
+    }
+
+    if (!has_axis) return;
+    if (!absolute) {
+        for (int i = 0; i < 3; i++) target[i] += position[i];
+    }
+    move(motion, target, offset, has_offset);
+}
+
+void MotionEstimate::end()
+{
+    stop();
+}
+
+void MotionEstimate::move(int code, const float target[3], const float *offset, bool has_offset)
+{
+    float delta[3];
+    float chord = 0;
+    for (int i = 0; i < 3; i++) {
+        delta[i] = target[i] - position[i];
+        chord += delta[i] * delta[i];
+    }
+    chord = sqrtf(chord);
+
+    float unit[3] = {0, 0, 0};
+    if (chord > 0) {
+        for (int i = 0; i < 3; i++) unit[i] = delta[i] / chord;
+    }
+
+    float distance = chord;
+    if (code >= 2 && has_offset) {
+        // the same angular travel as Robot::compute_arc
+        int a0 = plane == 19 ? 1 : 0;
+        int a1 = plane == 17 ? 1 : 2;
+        int al = plane == 17 ? 2 : (plane == 18 ? 1 : 0);
+        float r0 = -offset[a0], r1 = -offset[a1];
+        float t0 = target[a0] - (position[a0] + offset[a0]);
+        float t1 = target[a1] - (position[a1] + offset[a1]);
+        float radius = hypotf(r0, r1);
+        float angular_travel;
+        if (delta[a0] == 0 && delta[a1] == 0) {
+            angular_travel = 2 * PI;
+        } else {
+            angular_travel = atan2f(r0 * t1 - r1 * t0, r0 * t0 + r1 * t1);
+            if (code == 2 && angular_travel > 0) angular_travel -= 2 * PI;
+            else if (code == 3 && angular_travel < 0) angular_travel += 2 * PI;
+        }
+        distance = hypotf(angular_travel * radius, delta[al]);
+    }
+
+    for (int i = 0; i < 3; i++) position[i] = target[i];
+    add(distance, code == 0 ? seek : feed, unit);
+}
+
+void MotionEstimate::add(float distance, float rate, const float unit[3])
+{
+    if (distance < 0.00001F || rate <= 0) return;
+
+    for (int i = 0; i < 3; i++) {
+        if (fabsf(unit[i]) > 1e-6F) {
+            rate = std::min(rate, max_speeds[i] / fabsf(unit[i]));
+        }
+    }
+
+    float entry = 0;
+    if (pending) {
+        // the junction speed as Planner::append_block works it out
+        float cos_theta = -(pending_unit[0] * unit[0] + pending_unit[1] * unit[1] + pending_unit[2] * unit[2]);
+        float junction = 0;
+        if (junction_deviation > 0 && cos_theta <= 0.9999F) {
+            junction = std::min(pending_rate, rate);
+            if (cos_theta >= -0.9999F) {
+                float sin_theta_d2 = sqrtf(0.5F * (1.0F - cos_theta));
+                junction = std::min(junction, sqrtf(accel * junction_deviation * sin_theta_d2 / (1.0F - sin_theta_d2)));
+            }
+        }
+        // and no faster than the last move can get to from its entry
+        junction = std::min(junction, sqrtf(pending_entry * pending_entry + 2 * accel * pending_distance));
+        finish(junction);
+        entry = junction;
+    }
+
+    pending = true;
+    pending_distance = distance;
+    pending_rate = rate;
+    pending_entry = entry;
+    memcpy(pending_unit, unit, sizeof(pending_unit));
+}
+
+// the time of a trapezoid like Block::calculate_trapezoid, or a triangle if it never reaches the rate
+void MotionEstimate::finish(float exit)
+{
+    if (!pending) return;
+    pending = false;
+
+    float v = pending_rate, ve = std::min(pending_entry, v), vx = std::min(exit, v);
+    float accelerate = (v * v - ve * ve) / (2 * accel);
+    float decelerate = (v * v - vx * vx) / (2 * accel);
+    if (accelerate + decelerate <= pending_distance) {
+        secs += (v - ve) / accel + (v - vx) / accel + (pending_distance - accelerate - decelerate) / v;
+    } else {
+        float peak = sqrtf(std::max(accel * pending_distance + (ve * ve + vx * vx) / 2, std::max(ve * ve, vx * vx)));
+        secs += (peak - ve) / accel + (peak - vx) / accel;
+    }
+}
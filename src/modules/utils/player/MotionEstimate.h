@@ -0,0 +1,60 @@
+/*
+    This file is part of Smoothie (http://smoothieware.org/). The motion control part is heavily based on Grbl (https://github.com/simen/grbl).
+    Smoothie is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+    Smoothie is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+    You should have received a copy of the GNU General Public License along with Smoothie. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "CompactMotion.h"
+
+/*
+ * Estimates how long a job takes to run from its G-code, without queueing anything.
+ *
+ * Each move gets a trapezoid from the robot's acceleration, its feed (or the seek rate for G0)
+ * clamped to the axis max speeds, and entry and exit speeds from the same junction deviation
+ * formula the planner uses. A move is only timed once the next one is seen, so its exit speed is
+ * known, a move followed by anything that stops the machine ends at rest.
+ *
+ * Overrides, tool changes and probing are not counted, G4 dwells are.
+ */
+class MotionEstimate {
+    public:
+        MotionEstimate();
+
+        // reads the current robot and planner settings and starts at no time at the origin
+        void begin();
+        void line(const char *s);
+        void record(const CompactMotion::Record &rec);
+        // ends the last move
+        void end();
+
+        // seconds up to the end of the last move that has been timed
+        float seconds() const { return secs; }
+
+    private:
+        void move(int code, const float target[3], const float *offset, bool has_offset);
+        void add(float distance, float rate, const float unit[3]);
+        void finish(float exit);
+        void stop() { finish(0); }
+
+        float position[3];      // mm
+        float accel;
+        float junction_deviation;
+        float max_speeds[3];
+        float feed, seek;        // mm/s
+        float secs;
+
+        // the move waiting for the next one to know its exit speed
+        float pending_distance;
+        float pending_rate;
+        float pending_entry;
+        float pending_unit[3];
+        bool pending;
+
+        int motion;
+        int plane;
+        bool absolute;
+        bool inches;
+};
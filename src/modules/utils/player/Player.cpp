@@ -21,6 +21,11 @@
 #include "ConfigValue.h"
 #include "SDFAT.h"
 #include "md5.h"
+#include "crc16.h"
+#include "EventTrace.h"
+#include "WriteQueue.h"
+#include "Task.h"
+#include "Scratch.h"
 
 #include "modules/robot/Conveyor.h"
 #include "DirHandle.h"
@@ -33,6 +38,9 @@
 #include "StepTicker.h"
 #include "Block.h"
 #include "quicklz.h"
+#include "CompactMotion.h"
+#include "MotionEstimate.h"
+#include "GcodeDispatch.h"
 
 #include <math.h>
 
@@ -41,6 +49,7 @@
 #include <algorithm>
 
 #include "mbed.h"
+#include "MemoryStats.h"
 
 #define home_on_boot_checksum             CHECKSUM("home_on_boot")
 #define on_boot_gcode_checksum            CHECKSUM("on_boot_gcode")
@@ -49,11 +58,26 @@
 #define before_resume_gcode_checksum      CHECKSUM("before_resume_gcode")
 #define leave_heaters_on_suspend_checksum CHECKSUM("leave_heaters_on_suspend")
 #define laser_module_clustering_checksum 	  CHECKSUM("laser_module_clustering")
+#define player_batch_lines_checksum       CHECKSUM("player_batch_lines")
+#define player_batch_time_us_checksum     CHECKSUM("player_batch_time_us")
+#define player_stream_lz_checksum         CHECKSUM("player_stream_lz")
+#define player_index_job_checksum         CHECKSUM("player_index_job")
+#define player_echo_checksum              CHECKSUM("player_echo")
+#define player_progress_interval_checksum CHECKSUM("player_progress_interval")
+#define player_job_log_checksum           CHECKSUM("player_job_log")
+#define coordinate_checksum               CHECKSUM("coordinate")
+#define clearance_z_checksum              CHECKSUM("clearance_z")
+
+// stop batching lines when fewer than this many blocks are free in the planner queue,
+// a single line (eg an arc) can produce several blocks
+#define BATCH_QUEUE_HEADROOM 4
+#define MAX_TOOL_CHANGES 64
+#define MAX_LINE_MARKS 128
+#define LINE_MARK_STRIDE 1000
+#define MAX_QUEUED_JOBS 8
 
 extern SDFAT mounter;
 
-unsigned char xbuff[8200] __attribute__((section("AHBSRAM"))); /* 2 for data length, 8192 for XModem + 3 head chars + 2 crc + nul */
-static unsigned char fbuff[4096] __attribute__((section("AHBSRAM")));
 // used for XMODEM
 #define SOH  0x01
 #define STX  0x02
@@ -65,6 +89,8 @@ static unsigned char fbuff[4096] __attribute__((section("AHBSRAM")));
 
 #define MAXRETRANS 10
 #define TIMEOUT_MS 100
+// most packets a host may send in upload -w<n> mode before waiting for an ACK
+#define MAX_UPLOAD_WINDOW 8
 
 
 Player::Player()
@@ -72,16 +98,34 @@ Player::Player()
     this->playing_file = false;
     this->current_file_handler = nullptr;
     this->booted = false;
+    this->clear_buffered_queue();
+    this->job_result = nullptr;
+    this->job_lines = 0;
+    this->job_time_last = 0;
+    memset(this->job_time_us, 0, sizeof(this->job_time_us));
     this->elapsed_secs = 0;
     this->reply_stream = nullptr;
     this->inner_playing = false;
+    this->compact_file = false;
+    this->echo_lines = false;
+    this->echo_mode = ECHO_NONE;
+    this->progress_interval_us = 5000000;
+    this->last_progress = 0;
     this->slope = 0.0;
+    this->index.clear();
+    this->next_index.clear();
+    this->preparing = nullptr;
+    this->scanning = nullptr;
+    this->scan_loaded = false;
+    this->stop_point.line = 0;
+    this->stop_point.pending = false;
 }
 
 void Player::on_module_loaded()
 {
     this->register_for_event(ON_CONSOLE_LINE_RECEIVED);
     this->register_for_event(ON_MAIN_LOOP);
+    this->register_for_event(ON_IDLE);
     this->register_for_event(ON_SECOND_TICK);
     this->register_for_event(ON_GET_PUBLIC_DATA);
     this->register_for_event(ON_SET_PUBLIC_DATA);
@@ -100,12 +144,43 @@ void Player::on_module_loaded()
     this->leave_heaters_on = THEKERNEL->config->value(leave_heaters_on_suspend_checksum)->by_default(false)->as_bool();
 
     this->laser_clustering = THEKERNEL->config->value(laser_module_clustering_checksum)->by_default(false)->as_bool();
+
+    // number of lines fed per main loop pass when playing a file, 1 is the legacy one line per loop
+    this->batch_lines = THEKERNEL->config->value(player_batch_lines_checksum)->by_default(1)->as_int();
+    if(this->batch_lines < 1) this->batch_lines = 1;
+    this->batch_time_us = THEKERNEL->config->value(player_batch_time_us_checksum)->by_default(2000)->as_int();
+
+    // keep uploaded .lz files compressed and decompress them while playing instead of after the upload
+    this->stream_lz = THEKERNEL->config->value(player_stream_lz_checksum)->by_default(true)->as_bool();
+
+    // read through a job for its tool changes and line offsets before playing it
+    this->index_enable = THEKERNEL->config->value(player_index_job_checksum)->by_default(true)->as_bool();
+
+    // none, errors or progress: what a job played without -v reports while it runs
+    string echo = THEKERNEL->config->value(player_echo_checksum)->by_default("none")->as_string();
+    this->echo_mode = echo == "progress" ? ECHO_PROGRESS : echo == "errors" ? ECHO_ERRORS : ECHO_NONE;
+    // seconds between progress lines
+    this->progress_interval_us = THEKERNEL->config->value(player_progress_interval_checksum)->by_default(5.0F)->as_number() * 1000000;
+    // a line for every job that ends is appended to this, empty for none
+    this->job_log = THEKERNEL->config->value(player_job_log_checksum)->by_default("/sd/jobs.log")->as_string();
+    this->error_stream.set_output(THEKERNEL->streams);
+    // the same height the tool changer lifts to
+    this->clearance_z = THEKERNEL->config->value(coordinate_checksum, clearance_z_checksum)->by_default(-3)->as_number();
 }
 
 void Player::on_halt(void* argument)
 {
     this->clear_buffered_queue();
 
+    // the step ticker has not seen the halt yet, so where it stopped is taken from on_main_loop. Lines of a
+    // macro are not the job's, so a stop in one is not kept
+    if(argument == nullptr && this->playing_file && !this->inner_playing && this->macro_file_queue.empty()) {
+        this->stop_point.filename = this->filename;
+        this->stop_point.fed = this->played_lines;
+        this->stop_point.line = 0;
+        this->stop_point.pending = true;
+    }
+
     if(argument == nullptr && this->playing_file ) {
         abort_command("1", &(StreamOutput::NullStream));
 	}
@@ -119,12 +194,89 @@ void Player::on_halt(void* argument)
 	}
 }
 
+// while the planner queue is full the robot is spinning on_idle waiting for room,
+// use that time to read the next chunk of the file so the read does not stall feeding lines later
+void Player::on_idle(void *)
+{
+    if(this->playing_file || this->job_result != nullptr) account_job_time();
+    if(this->job_result != nullptr && THEKERNEL->conveyor->is_idle()) log_job();
+
+    if(this->playing_file && this->reader.needs_prefetch() && THEKERNEL->conveyor->queue_free() < BATCH_QUEUE_HEADROOM) {
+        this->reader.prefetch();
+    }
+}
+
+// the time since the last call goes to whatever the machine is doing now, on_idle runs every main loop pass
+// and while anything waits so each share is a few ms at most
+void Player::account_job_time()
+{
+    uint32_t now = us_ticker_read();
+    uint32_t us = now - this->job_time_last;
+    this->job_time_last = now;
+
+    int what;
+    uint8_t atc = THEKERNEL->get_atc_state();
+    const Block *b = THEKERNEL->step_ticker->get_current_block();
+    if (THEKERNEL->is_suspending() || THEKERNEL->get_feed_hold()) {
+        what = JOB_PAUSED;
+    } else if (atc == ATC_DROP || atc == ATC_PICK || atc == ATC_CALIBRATE) {
+        what = JOB_TOOL_CHANGE;
+    } else if (THEKERNEL->is_zprobing() || atc == ATC_ZPROBE || atc == ATC_AUTOLEVEL) {
+        what = JOB_PROBING;
+    } else if (b != nullptr && !b->is_dwell) {
+        what = b->is_g123 ? JOB_CUTTING : JOB_RAPIDS;
+    } else {
+        what = JOB_OTHER;
+    }
+    this->job_time_us[what] += us;
+}
+
+void Player::end_job(const char *result)
+{
+    if (this->job_log.empty()) return;
+    // a job played straight after another
+    if (this->job_result != nullptr) log_job();
+    this->job_result = result;
+    this->job_filename = this->filename;
+    this->job_lines = this->played_lines;
+}
+
+// one line a job, for seeing across many machines and jobs where the time goes
+void Player::log_job()
+{
+    account_job_time();
+    uint64_t total = 0;
+    for (int i = 0; i < JOB_TIMES; i++) total += this->job_time_us[i];
+    float secs = total / 1e6F;
+
+    char line[320];
+    int n = snprintf(line, sizeof(line),
+        "%s result=%s lines=%lu secs=%.1f cutting=%.1f rapids=%.1f tool_change=%.1f probing=%.1f paused=%.1f other=%.1f "
+        "starved=%.1f lines_per_sec=%.1f peak_heap=%lu\n",
+        this->job_filename.c_str(), this->job_result, this->job_lines, secs,
+        this->job_time_us[JOB_CUTTING] / 1e6F, this->job_time_us[JOB_RAPIDS] / 1e6F, this->job_time_us[JOB_TOOL_CHANGE] / 1e6F,
+        this->job_time_us[JOB_PROBING] / 1e6F, this->job_time_us[JOB_PAUSED] / 1e6F, this->job_time_us[JOB_OTHER] / 1e6F,
+        THEKERNEL->conveyor->get_queue_stats().starve_ms / 1e3F, secs > 0 ? this->job_lines / secs : 0,
+        (unsigned long)MemoryStats::peak_heap_used());
+    if (n >= (int)sizeof(line)) {
+        // a very long file name, keep the newline
+        n = sizeof(line) - 1;
+        line[n - 1] = '\n';
+    }
+    WriteQueue::append(this->job_log.c_str(), line, n);
+    this->job_result = nullptr;
+    this->job_filename.clear();
+}
+
 void Player::on_second_tick(void *)
 {
-    if(this->playing_file) this->elapsed_secs++;
+    if(this->playing_file) {
+        this->elapsed_secs++;
+        MemoryStats::sample();
+    }
 }
 
-void Player::select_file(string argument)
+void Player::select_file(string argument, bool index)
 {
 
     this->filename = argument;
@@ -145,10 +297,11 @@ void Player::select_file(string argument)
     if (this->filename.rfind(".cnc") != this->filename.length() - 4) {
         this->filename += ".cnc";
     }
-    this->current_stream = nullptr;
+    this->set_echo(false);
 
     if(this->current_file_handler != NULL) {
         this->playing_file = false;
+        this->reader.detach();
         fclose(this->current_file_handler);
     }
     this->current_file_handler = fopen( this->filename.c_str(), "r");
@@ -166,6 +319,8 @@ void Player::select_file(string argument)
             this->file_size = ftell(this->current_file_handler);
             fseek(this->current_file_handler, 0, SEEK_SET);
         }
+        this->attach_reader();
+        if (index) this->index_job();
         THEKERNEL->streams->printf("File opened:%s Size:%ld\r\n", this->filename.c_str(), this->file_size);
         THEKERNEL->streams->printf("File selected\r\n");
     }
@@ -174,6 +329,474 @@ void Player::select_file(string argument)
     this->elapsed_secs = 0;
     this->playing_lines = 0;
     this->goto_line = 0;
+    this->flow.reset();
+}
+
+// attach the read ahead to a newly opened file and see if it is a compact binary motion stream
+void Player::attach_reader()
+{
+    this->reader.attach(this->current_file_handler);
+    this->delta_base = CompactMotion::DeltaBase();
+    this->compact_file = CompactMotion::read_header(this->reader);
+    if(!this->compact_file) {
+        this->reader.seek(0);
+    }
+}
+
+// progress is measured against the size of the file on the card, which for a compressed file is not the number of bytes played
+void Player::count_played(int len)
+{
+    if (this->reader.compressed()) {
+        this->played_cnt = this->reader.source_tell();
+    } else {
+        this->played_cnt += len;
+    }
+}
+
+// follows the modal words of a line, returns true if it is an M6 with a T word. Comments are skipped
+static bool parse_modal(const char *s, Player::modal_t &m)
+{
+    bool m6 = false;
+    int t = -1;
+    bool has[3] = {false, false, false};
+    float xyz[3];
+    // what the XYZ words of the line are: where it goes, the new name of where it is, or a move that can not be followed
+    enum { MOVE, SET, LOST, NONE } words = MOVE;
+    bool canned = false, wcs_changed = false;
+    while (*s != '\0' && *s != ';' && *s != '\n') {
+        char c = *s++;
+        if (c == '(') {
+            while (*s != '\0' && *s != ')') s++;
+            if (*s == ')') s++;
+            continue;
+        }
+        if (c >= 'a' && c <= 'z') c -= 'a' - 'A';
+        if (c != 'G' && c != 'M' && c != 'T' && c != 'F' && c != 'S' && (c < 'X' || c > 'Z')) continue;
+
+        char *end;
+        float v = strtof(s, &end);
+        if (end == s) continue;
+        s = end;
+        int code = (int)v;
+        int sub = (int)roundf((v - code) * 10);
+        switch (c) {
+            case 'G':
+                if (code <= 3 && sub == 0) m.motion = code;
+                else if (code >= 17 && code <= 19) m.plane = code;
+                else if (code == 20 || code == 21) m.inches = code == 20;
+                else if (code == 90 || code == 91) m.absolute = code == 90;
+                else if (code >= 54 && code <= 58) { m.wcs = code - 54; wcs_changed = true; }
+                else if (code == 59 && sub <= 3) { m.wcs = 5 + sub; wcs_changed = true; }
+                else if (code == 92 && sub == 0) words = SET;
+                else if (code == 53 || code == 28 || code == 30 || code == 38 || code == 92) words = LOST;
+                else if (code == 4 || code == 10) words = NONE;
+                else if (code == 73 || code == 74 || (code >= 81 && code <= 89)) canned = true;
+                break;
+            case 'X': case 'Y': case 'Z':
+                has[c - 'X'] = true;
+                xyz[c - 'X'] = v;
+                break;
+            case 'M':
+                if (code == 3) m.spindle_on = true;
+                else if (code == 5) m.spindle_on = false;
+                else if (code == 6 && sub == 0) m6 = true;
+                break;
+            case 'T': t = code; break;
+            case 'F': m.feed = v; break;
+            case 'S': m.speed = v; break;
+        }
+    }
+
+    // another WCS leaves the tool where it was under other coordinates
+    if (wcs_changed) m.pos[0] = m.pos[1] = m.pos[2] = NAN;
+    if (words == LOST && !has[0] && !has[1] && !has[2]) has[0] = has[1] = has[2] = true;
+    for (int i = 0; i < 3; i++) {
+        if (!has[i] || words == NONE) continue;
+        if (words == SET) m.pos[i] = xyz[i];
+        else if (words == LOST) m.pos[i] = NAN;
+        else m.pos[i] = m.absolute ? xyz[i] : m.pos[i] + xyz[i];
+    }
+    // a drilling cycle comes back up to somewhere the line does not say
+    if (canned && words == MOVE) m.pos[2] = NAN;
+
+    if (m6 && t >= 0) {
+        m.tool = t;
+        return true;
+    }
+    return false;
+}
+
+// the same for a compact motion record
+static bool parse_modal(const CompactMotion::Record &rec, Player::modal_t &m)
+{
+    if (rec.op == CompactMotion::OP_TEXT) return parse_modal(rec.text, m);
+
+    m.motion = rec.op - CompactMotion::OP_G0;
+    int v = 0;
+    for (int i = 0; i < CompactMotion::MAX_WORDS; ++i) {
+        if (rec.words & (1 << i)) {
+            if (CompactMotion::WORDS[i] == 'F') m.feed = rec.values[v];
+            else if (CompactMotion::WORDS[i] == 'S') m.speed = rec.values[v];
+            else if (i < 3) m.pos[i] = m.absolute ? rec.values[v] : m.pos[i] + rec.values[v];
+            v++;
+        }
+    }
+    return false;
+}
+
+void Player::job_index_t::clear()
+{
+    this->tool_changes.clear();
+    this->line_marks.clear();
+    this->line_mark_stride = LINE_MARK_STRIDE;
+    this->filename.clear();
+    this->size = 0;
+    this->lines = 0;
+    this->secs = 0;
+}
+
+Player::JobIndexer::JobIndexer(LineReader &reader, bool compact, job_index_t &index, bool reserve) : reader(reader), index(index)
+{
+    this->lines = this->cnt = 0;
+    this->raw_lines = this->raw_cnt = 0;
+    this->compact = compact;
+    this->discard = false;
+    index.clear();
+    // all at once rather than growing it while the file is read
+    if (reserve) index.line_marks.reserve(MAX_LINE_MARKS);
+}
+
+bool Player::JobIndexer::step(int n)
+{
+    if (this->compact) {
+        CompactMotion::Record rec;
+        int len;
+        while (n-- > 0) {
+            if ((len = CompactMotion::read_record(this->reader, rec, this->delta_base)) <= 0) return false;
+            bool m6 = parse_modal(rec, this->modal);
+            this->estimate.record(rec);
+            if (m6 && this->index.tool_changes.size() < MAX_TOOL_CHANGES) {
+                this->index.tool_changes.push_back({this->lines + 1, this->cnt, this->modal.tool, this->estimate.seconds()});
+            }
+            this->lines += 1;
+            this->cnt = this->reader.compressed() ? this->reader.source_tell() : this->cnt + len;
+            this->raw_lines = this->lines;
+            this->add_line_mark(this->lines, this->cnt);
+        }
+        return true;
+    }
+
+    // empty and discarded long lines are not played, but goto counts them
+    char buf[130];
+    while (n-- > 0) {
+        if (this->reader.gets(buf, sizeof(buf)) == NULL) return false;
+        int len = strlen(buf);
+        if (len == 0) continue;
+        this->raw_lines += 1;
+        this->raw_cnt = this->reader.compressed() ? this->reader.source_tell() : this->raw_cnt + len;
+        bool complete = buf[len - 1] == '\n' || this->reader.eof();
+        bool played = complete && !this->discard && len > 1;
+        this->discard = !complete;
+
+        // goto_line_number() follows the state of every line it skips the same way
+        bool m6 = parse_modal(buf, this->modal);
+        if (played) {
+            this->estimate.line(buf);
+        }
+        if (buf[len - 1] == '\n') {
+            this->add_line_mark(this->raw_lines, this->raw_cnt);
+        }
+        if (!played) continue;
+
+        if (m6 && this->index.tool_changes.size() < MAX_TOOL_CHANGES) {
+            this->index.tool_changes.push_back({this->lines + 1, this->cnt, this->modal.tool, this->estimate.seconds()});
+        }
+        this->lines += 1;
+        this->cnt = this->reader.compressed() ? this->reader.source_tell() : this->cnt + len;
+    }
+    return true;
+}
+
+void Player::JobIndexer::finish()
+{
+    this->estimate.end();
+    this->index.lines = this->raw_lines;
+    this->index.secs = this->estimate.seconds();
+}
+
+// called at the end of each line while indexing, when the marks are full every other one is dropped
+// and the stride doubles so any size of file fits
+void Player::JobIndexer::add_line_mark(unsigned long lines, unsigned long cnt)
+{
+    if (lines % this->index.line_mark_stride != 0) return;
+
+    auto &marks = this->index.line_marks;
+    if (marks.size() >= MAX_LINE_MARKS) {
+        size_t n = 0;
+        for (size_t i = 1; i < marks.size(); i += 2) {
+            marks[n++] = marks[i];
+        }
+        marks.resize(n);
+        this->index.line_mark_stride *= 2;
+        if (lines % this->index.line_mark_stride != 0) return;
+    }
+
+    marks.push_back({lines, this->reader.tell(), cnt, this->modal, this->estimate.seconds(), this->delta_base});
+}
+
+// one pass over the job before it plays to find its tool changes, with the line numbers and offsets
+// they will be played at, and to mark where every so many lines start so goto does not have to read
+// the file from the beginning. Then the reader goes back to the start of the file
+void Player::index_job()
+{
+    // a macro returning to the job reopens the same file, which is already indexed
+    if (this->current_file_handler == NULL || (this->filename == this->index.filename && this->file_size == this->index.size)) return;
+
+    // queue next found it ready
+    if (this->index_enable && this->filename == this->next_index.filename && this->file_size == this->next_index.size) {
+        std::swap(this->index, this->next_index);
+        this->next_index.clear();
+        return;
+    }
+
+    this->index.clear();
+    if (!this->index_enable) return;
+
+    JobIndexer indexer(this->reader, this->compact_file, this->index, true);
+    while (indexer.step(100)) {
+        THEKERNEL->call_event(ON_IDLE);
+    }
+    indexer.finish();
+
+    this->reader.seek(this->compact_file ? CompactMotion::HEADER_SIZE : 0);
+    this->delta_base = CompactMotion::DeltaBase();
+    if (!this->reader.corrupt()) {
+        this->index.filename = this->filename;
+        this->index.size = this->file_size;
+    }
+}
+
+/*
+ * Opens the job after the one playing and indexes it with a reader of its own, a few lines each main loop pass,
+ * only while the job that is playing has its read ahead full and the planner queue has plenty in it, or while
+ * nothing plays. It reads through stdio rather than a read ahead buffer of its own as that would be another 8k,
+ * so a compressed job is left to be indexed when it is played. It stops as soon as Player::preparing is not it.
+ */
+class Player::PrepareTask : public Task {
+    public:
+        PrepareTask(Player *player, const string &filename) : player(player), filename(filename), fp(nullptr), indexer(nullptr) {}
+        ~PrepareTask()
+        {
+            delete indexer;
+            reader.detach();
+            if (fp != nullptr) fclose(fp);
+            if (player->preparing == this) player->preparing = nullptr;
+        }
+
+    protected:
+        bool step()
+        {
+            TASK_BEGIN();
+            fp = fopen(filename.c_str(), "r");
+            if (fp == nullptr) {
+                THEKERNEL->streams->printf("Next job not found: %s\r\n", filename.c_str());
+                return false;
+            }
+            fseek(fp, 0, SEEK_END);
+            size = ftell(fp);
+            fseek(fp, 0, SEEK_SET);
+            reader.attach(fp, false);
+            if (reader.corrupt()) return false;
+            compact = CompactMotion::read_header(reader);
+            if (!compact) reader.seek(0);
+            // a short job does not need the room for all the marks
+            indexer = new JobIndexer(reader, compact, index, false);
+
+            for (;;) {
+                TASK_WAIT_UNTIL(player->preparing != this || player->background_may_step());
+                if (player->preparing != this || !indexer->step(PREPARE_LINES)) break;
+            }
+            if (player->preparing != this || reader.corrupt()) return false;
+
+            indexer->finish();
+            index.filename = filename;
+            index.size = size;
+            std::swap(player->next_index, index);
+            player->announce_next_job();
+            TASK_END();
+        }
+
+    private:
+        static const int PREPARE_LINES = 20;
+
+        Player *player;
+        string filename;
+        FILE *fp;
+        long size;
+        bool compact;
+        LineReader reader;
+        job_index_t index;
+        JobIndexer *indexer;
+};
+
+bool Player::background_may_step() const
+{
+    if (!this->playing_file) return true;
+    if (THEKERNEL->is_halted() || this->reader.needs_prefetch()) return false;
+    return THECONVEYOR->queue_free() < BATCH_QUEUE_HEADROOM;
+}
+
+/*
+ * Scans a job that has just been uploaded, in idle time the same way PrepareTask indexes the next job, and leaves
+ * what it found next to the file's digest for when it is played. A newer upload takes over from it.
+ */
+class Player::ScanTask : public Task {
+    public:
+        ScanTask(Player *player, const string &filename) : player(player), filename(filename), fp(nullptr), size(0), discard(false) {}
+        ~ScanTask()
+        {
+            reader.detach();
+            if (fp != nullptr) fclose(fp);
+            if (player->scanning == this) player->scanning = nullptr;
+        }
+
+    protected:
+        bool step()
+        {
+            TASK_BEGIN();
+            fp = fopen(filename.c_str(), "r");
+            if (fp == nullptr) return false;
+            fseek(fp, 0, SEEK_END);
+            size = ftell(fp);
+            fseek(fp, 0, SEEK_SET);
+            reader.attach(fp, false);
+            // compressed and compact files are left alone, they are not lines of G-code on the card
+            if (reader.corrupt() || CompactMotion::read_header(reader)) return false;
+            reader.seek(0);
+
+            for (;;) {
+                TASK_WAIT_UNTIL(player->scanning != this || player->background_may_step());
+                if (player->scanning != this || !scan_lines(SCAN_LINES)) break;
+            }
+            if (player->scanning != this) return false;
+            scan.save(change_to_scan_path(filename).c_str(), size);
+            TASK_END();
+        }
+
+    private:
+        static const int SCAN_LINES = 20;
+
+        bool scan_lines(int n)
+        {
+            char buf[130];
+            while (n-- > 0) {
+                if (reader.gets(buf, sizeof(buf)) == NULL) return false;
+                int len = strlen(buf);
+                if (len == 0) continue;
+                // the rest of a line too long to play is not scanned either
+                bool complete = buf[len - 1] == '\n' || reader.eof();
+                if (!discard) scan.line(buf);
+                discard = !complete;
+            }
+            return true;
+        }
+
+        Player *player;
+        string filename;
+        FILE *fp;
+        long size;
+        bool discard;
+        LineReader reader;
+        JobScan scan;
+};
+
+// a file uploaded again while it is still being scanned is scanned from the start
+void Player::scan_job(const string &filename)
+{
+    if (filename.find("gcodes/") == string::npos) return;
+    remove(change_to_scan_path(filename).c_str());
+    this->scanning = new ScanTask(this, filename);
+    Task::start(this->scanning);
+}
+
+// what the scan of the job about to play found, with its bounds where the current offsets put them
+void Player::report_scan(StreamOutput *stream)
+{
+    this->scan_loaded = this->scan.load(change_to_scan_path(this->filename).c_str(), this->file_size);
+    if (!this->scan_loaded) return;
+
+    static const char axes[] = "XYZ";
+    Robot::wcs_t lo = THEROBOT->wcs2mcs(Robot::wcs_t(this->scan.min[0], this->scan.min[1], this->scan.min[2], 0, 0));
+    Robot::wcs_t hi = THEROBOT->wcs2mcs(Robot::wcs_t(this->scan.max[0], this->scan.max[1], this->scan.max[2], 0, 0));
+    float mlo[3] = {std::get<X_AXIS>(lo), std::get<Y_AXIS>(lo), std::get<Z_AXIS>(lo)};
+    float mhi[3] = {std::get<X_AXIS>(hi), std::get<Y_AXIS>(hi), std::get<Z_AXIS>(hi)};
+    for (int i = 0; i < 3; i++) {
+        if (!this->scan.has_bounds(i)) continue;
+        stream->printf("  %c %.3f to %.3f\r\n", axes[i], this->scan.min[i], this->scan.max[i]);
+        if (!THEROBOT->is_soft_endstop_enabled()) continue;
+        // a rotated WCS can swap which end is lower on X and Y
+        float a = std::min(mlo[i], mhi[i]), b = std::max(mlo[i], mhi[i]);
+        float smin = THEROBOT->get_soft_endstop_min(i), smax = THEROBOT->get_soft_endstop_max(i);
+        if ((!isnan(smin) && a < smin) || (!isnan(smax) && b > smax)) {
+            stream->printf("  WARNING: %c goes past the soft endstops from this WCS\r\n", axes[i]);
+        }
+    }
+    if (this->scan.tool_count > 0) {
+        stream->printf("  Tools");
+        for (int i = 0; i < this->scan.tool_count; i++) stream->printf(" T%d", this->scan.tools[i]);
+        stream->printf("\r\n");
+    }
+    if (this->scan.first_error > 0) {
+        stream->printf("  WARNING: unsupported G code at line %lu\r\n", this->scan.first_error);
+    }
+}
+
+// starts preparing the job at the front of the queue if it is not ready or on its way
+void Player::prepare_next_job()
+{
+    if (!this->index_enable || this->job_queue.empty()) return;
+    const string &next = this->job_queue.front();
+    if (this->next_index.filename == next) return;
+
+    // the one being prepared ends on its next step
+    this->next_index.clear();
+    this->preparing = new PrepareTask(this, next);
+    Task::start(this->preparing);
+}
+
+// once it is ready and nothing is playing
+void Player::announce_next_job()
+{
+    if (this->playing_file || this->job_queue.empty() || this->next_index.filename != this->job_queue.front()) return;
+    THEKERNEL->streams->printf("Next job ready: %s, queue next to play it\r\n", this->job_queue.front().c_str());
+}
+
+// estimated seconds of motion up to the line, in between the marks it is taken as even
+float Player::estimate_at(unsigned long line) const
+{
+    unsigned long l0 = 0, l1 = this->index.lines;
+    float s0 = 0, s1 = this->index.secs;
+    for (auto &m : this->index.line_marks) {
+        if (m.line > line) {
+            l1 = m.line;
+            s1 = m.secs;
+            break;
+        }
+        l0 = m.line;
+        s0 = m.secs;
+    }
+    if (line >= l1 || l1 <= l0) return s1;
+    return s0 + (s1 - s0) * (line - l0) / (l1 - l0);
+}
+
+// index of the first tool change after the line, -1 if there are none
+int Player::next_tool_change(unsigned long line) const
+{
+    if (!this->job_indexed()) return -1;
+    for (size_t i = 0; i < this->index.tool_changes.size(); i++) {
+        if (this->index.tool_changes[i].line > line) return i;
+    }
+    return -1;
 }
 
 void Player::goto_line_number(unsigned long line_number)
@@ -181,23 +804,57 @@ void Player::goto_line_number(unsigned long line_number)
     this->goto_line = line_number;
     this->goto_line = this->goto_line < 1 ? 1 : this->goto_line;
     THEKERNEL->streams->printf("Goto line %lu...\r\n", this->goto_line);
+    // loops and labels from before the jump no longer apply
+    this->flow.reset();
     // goto line
     char buf[130]; // lines upto 128 characters are allowed, anything longer is discarded
 
-    // goto file begin
-    fseek(this->current_file_handler, 0, SEEK_SET);
-    played_lines = 0;
-    played_cnt   = 0;
+    // goto the last indexed line before the one we want, or the file begin, and read on from there
+    const line_mark_t *mark = nullptr;
+    if (this->job_indexed()) {
+        for (auto &m : this->index.line_marks) {
+            if (m.line >= this->goto_line) break;
+            mark = &m;
+        }
+    }
+    if (mark != nullptr && this->reader.seek(mark->offset)) {
+        played_lines = mark->line;
+        played_cnt   = mark->cnt;
+        this->goto_modal = mark->modal;
+        this->delta_base = mark->base;
+    } else {
+        this->reader.seek(this->compact_file ? CompactMotion::HEADER_SIZE : 0);
+        played_lines = 0;
+        played_cnt   = 0;
+        this->goto_modal = modal_t();
+        this->delta_base = CompactMotion::DeltaBase();
+    }
 
-    while (fgets(buf, sizeof(buf), this->current_file_handler) != NULL) {
+    if (this->compact_file) {
+        // each record is a line
+        CompactMotion::Record rec;
+        int len;
+        while (played_lines < this->goto_line && (len = CompactMotion::read_record(this->reader, rec, this->delta_base)) > 0) {
+            if (played_lines % 100 == 0) {
+                THEKERNEL->call_event(ON_IDLE);
+            }
+            parse_modal(rec, this->goto_modal);
+            played_lines += 1;
+            this->count_played(len);
+        }
+        return;
+    }
+
+    while (this->reader.gets(buf, sizeof(buf)) != NULL) {
         if (played_lines % 100 == 0) {
             THEKERNEL->call_event(ON_IDLE);
         }
         int len = strlen(buf);
         if (len == 0) continue; // empty line? should not be possible
 
+        parse_modal(buf, this->goto_modal);
         played_lines += 1;
-        played_cnt += len;
+        this->count_played(len);
         if (played_lines >= this->goto_line) {
             break;
         }
@@ -288,9 +945,10 @@ void Player::on_gcode_received(void *argument)
                     if(this->current_file_handler == NULL) {
                         gcode->stream->printf("file.open failed: %s\r\n", currentfn.c_str());
                     } else {
+                        this->attach_reader();
                         this->filename = currentfn;
                         this->file_size = old_size;
-                        this->current_stream = nullptr;
+                        this->set_echo(false);
                     }
                 }
             } else {
@@ -394,8 +1052,8 @@ void Player::on_gcode_received(void *argument)
                 }
             }
             
-            //open file and play
-            this->select_file(new_filepath);
+            //open file and play, the macro is not indexed so the job keeps its index for when it returns
+            this->select_file(new_filepath, false);
             this->play_opened_file();
 
         } else if (gcode->m == 99) { // return from macro to main program
@@ -452,6 +1110,8 @@ void Player::on_console_line_received( void *argument )
     	this->goto_command( possible_command, new_message.stream );
     }else if (cmd == "buffer") {
     	this->buffer_command( possible_command, new_message.stream );
+    }else if (cmd == "queue") {
+    	this->queue_command( possible_command, new_message.stream );
     }else if (cmd == "upload") {
     	this->upload_command( possible_command, new_message.stream );
     }else if (cmd == "download") {
@@ -463,13 +1123,74 @@ void Player::on_console_line_received( void *argument )
     }
 }
 
-// Buffer gcode to queue
+// Buffer gcode to run while a job plays, buffer -i for it to run on the next main loop pass rather than between the job's lines
 void Player::buffer_command( string parameters, StreamOutput *stream )
 {
-	this->buffered_queue.push(parameters);
+	bool immediate = parameters.compare(0, 3, "-i ") == 0;
+	if (immediate) parameters.erase(0, 3);
+
+	if (!(immediate ? this->immediate_lane.push(parameters) : this->boundary_lane.push(parameters))) {
+		stream->printf("error:Command not buffered, %s: %s\r\n", parameters.size() >= (size_t)command_lane_t<4>::LINE_SIZE ? "too long" : "lane full", parameters.c_str());
+		return;
+	}
 	stream->printf("Command buffered: %s\r\n", parameters.c_str());
 }
 
+// queue <file> adds a job to play after the current one, queue next plays the first one once the last has finished,
+// queue lists them and queue clear empties it
+void Player::queue_command( string parameters, StreamOutput *stream )
+{
+    string arg = shift_parameter(parameters);
+    if (arg.empty()) {
+        if (this->job_queue.empty()) stream->printf("Job queue empty\r\n");
+        for (size_t i = 0; i < this->job_queue.size(); i++) {
+            bool ready = i == 0 && this->next_index.filename == this->job_queue[0];
+            stream->printf("%u: %s%s\r\n", (unsigned)i + 1, this->job_queue[i].c_str(), ready ? " (ready)" : "");
+        }
+
+    } else if (arg == "clear") {
+        this->job_queue.clear();
+        this->next_index.clear();
+        this->preparing = nullptr;
+        stream->printf("Job queue cleared\r\n");
+
+    } else if (arg == "next") {
+        if (this->job_queue.empty()) {
+            stream->printf("Job queue empty\r\n");
+            return;
+        }
+        if (this->playing_file || THEKERNEL->is_suspending() || THEKERNEL->is_waiting()) {
+            stream->printf("Currently printing, queue next once it has finished\r\n");
+            return;
+        }
+        string next = this->job_queue.front();
+        this->job_queue.pop_front();
+        // picks up the index if it is ready, and starts on the job after
+        this->play_command(next, stream);
+
+    } else {
+        if (this->job_queue.size() >= MAX_QUEUED_JOBS) {
+            stream->printf("error:Job queue full\r\n");
+            return;
+        }
+        this->job_queue.push_back(absolute_from_relative(arg));
+        stream->printf("Job queued: %s\r\n", this->job_queue.back().c_str());
+        this->prepare_next_job();
+    }
+}
+
+void Player::run_buffered(const char *line)
+{
+	if (this->echo_lines) THEKERNEL->streams->printf("%s\r\n", line);
+	struct SerialMessage message;
+	message.message = line;
+	message.stream = THEKERNEL->streams;
+	message.line = 0;
+
+	// waits for the queue to have enough room
+	THEKERNEL->call_event(ON_CONSOLE_LINE_RECEIVED, &message);
+}
+
 // Play a gcode file by considering each line as if it was received on the serial console
 void Player::play_command( string parameters, StreamOutput *stream )
 {
@@ -499,6 +1220,7 @@ void Player::play_command( string parameters, StreamOutput *stream )
     }
 
     if (this->current_file_handler != NULL) { // must have been a paused print
+        this->reader.detach();
         fclose(this->current_file_handler);
     }
 
@@ -522,12 +1244,7 @@ void Player::play_command( string parameters, StreamOutput *stream )
     this->playing_file = true;
 
     // Output to the current stream if we were passed the -v ( verbose ) option
-    if( options.find_first_of("Vv") == string::npos ) {
-        this->current_stream = nullptr;
-    } else {
-        // we send to the kernels stream as it cannot go away
-        this->current_stream = THEKERNEL->streams;
-    }
+    this->set_echo(options.find_first_of("Vv") != string::npos);
 
     // get size of file
     int result = fseek(this->current_file_handler, 0, SEEK_END);
@@ -539,11 +1256,29 @@ void Player::play_command( string parameters, StreamOutput *stream )
         fseek(this->current_file_handler, 0, SEEK_SET);
         stream->printf("  File size %ld\r\n", file_size);
     }
+    this->attach_reader();
+    this->index_job();
+    this->prepare_next_job();
+    this->report_scan(stream);
+    if (!this->index.tool_changes.empty()) {
+        stream->printf("  Tool changes %u\r\n", (unsigned int)this->index.tool_changes.size());
+    }
+    if (this->job_indexed() && this->index.secs > 0) {
+        unsigned long est = roundf(this->index.secs);
+        stream->printf("  Estimated time %02lu:%02lu:%02lu\r\n", est / 3600, (est % 3600) / 60, est % 60);
+    }
     this->played_cnt = 0;
     this->played_lines = 0;
     this->elapsed_secs = 0;
     this->playing_lines = 0;
     this->goto_line = 0;
+    this->flow.reset();
+    // the last one still running when this one was started, before its stats are cleared
+    if (this->job_result != nullptr) log_job();
+    MemoryStats::start();
+    THEKERNEL->conveyor->start_queue_stats();
+    memset(this->job_time_us, 0, sizeof(this->job_time_us));
+    this->job_time_last = us_ticker_read();
 
     // force into absolute mode
     THEROBOT->absolute_mode = true;
@@ -551,6 +1286,14 @@ void Player::play_command( string parameters, StreamOutput *stream )
 
     // reset current position;
     THEROBOT->reset_position_from_current_actuator_position();
+
+    // -c carries on from where a halt stopped this job, otherwise the stop point is no longer wanted
+    THEKERNEL->step_ticker->clear_stop_record();
+    if (options.find_first_of("Cc") == string::npos) {
+        this->stop_point.line = 0;
+    } else if (!this->continue_from_stop(stream)) {
+        abort_command("", stream);
+    }
 }
 
 // Goto a certain line when playing a file
@@ -596,8 +1339,14 @@ void Player::progress_command( string parameters, StreamOutput *stream )
 
     if(file_size > 0) {
         unsigned long est = 0;
-        if(this->elapsed_secs > 10) {
-            unsigned long bytespersec = played_cnt / this->elapsed_secs;
+        unsigned long bytespersec = 0;
+        bool estimated = this->job_indexed() && this->index.secs > 0;
+        if(estimated) {
+            // from the motion of the rest of the job rather than how fast the file is being read
+            float left = this->index.secs - this->estimate_at(this->played_lines);
+            est = left > 0 ? roundf(left) : 0;
+        } else if(this->elapsed_secs > 10) {
+            bytespersec = played_cnt / this->elapsed_secs;
             if(bytespersec > 0)
                 est = (file_size - played_cnt) / bytespersec;
         }
@@ -609,6 +1358,25 @@ void Player::progress_command( string parameters, StreamOutput *stream )
             if(est > 0) {
                 stream->printf(", est time: %02lu:%02lu:%02lu",  est / 3600, (est % 3600) / 60, est % 60);
             }
+            if(this->job_indexed() && !this->index.tool_changes.empty()) {
+                int next = this->next_tool_change(this->played_lines);
+                unsigned int count = this->index.tool_changes.size();
+                stream->printf(", tool change: %u/%u", next < 0 ? count : (unsigned int)next, count);
+                if(next >= 0) {
+                    const tool_change_t &tc = this->index.tool_changes[next];
+                    stream->printf(", next: T%d at line %lu", tc.tool, tc.line);
+                    unsigned long est_tool = 0;
+                    if(estimated) {
+                        float left = tc.secs - this->estimate_at(this->played_lines);
+                        est_tool = left > 0 ? roundf(left) : 0;
+                    } else if(bytespersec > 0 && tc.offset > played_cnt) {
+                        est_tool = (tc.offset - played_cnt) / bytespersec;
+                    }
+                    if(est_tool > 0) {
+                        stream->printf(" in %02lu:%02lu:%02lu", est_tool / 3600, (est_tool % 3600) / 60, est_tool % 60);
+                    }
+                }
+            }
             stream->printf("\r\n");
         } else {
             stream->printf("SD printing byte %lu/%lu\r\n", played_cnt, file_size);
@@ -629,6 +1397,7 @@ void Player::abort_command( string parameters, StreamOutput *stream )
         return;
     }
 
+    if (this->playing_file) end_job("aborted");
     this->playing_file = false;
     this->played_cnt = 0;
     this->played_lines = 0;
@@ -639,8 +1408,10 @@ void Player::abort_command( string parameters, StreamOutput *stream )
     this->filename = "";
     this->current_stream = NULL;
 
+    this->reader.detach();
     fclose(current_file_handler);
     current_file_handler = NULL;
+    THEKERNEL->conveyor->stop_queue_stats();
 
     THEKERNEL->set_suspending(false);
     THEKERNEL->set_waiting(true);
@@ -677,9 +1448,8 @@ void Player::abort_command( string parameters, StreamOutput *stream )
 }
 
 void Player::clear_buffered_queue(){
-	while (!this->buffered_queue.empty()) {
-		this->buffered_queue.pop();
-	}
+	this->immediate_lane.clear();
+	this->boundary_lane.clear();
 }
 
 void Player::clear_macro_file_queue(){
@@ -706,22 +1476,29 @@ void Player::on_main_loop(void *argument)
 
     }
 
+    if (this->stop_point.pending && THEKERNEL->step_ticker->get_current_block() == nullptr) {
+        this->take_stop_point();
+    }
+
     if ( this->playing_file ) {
+        // all of them, there are only a few
+        while (!this->immediate_lane.empty() && !THEKERNEL->is_halted()) {
+            char line[sizeof(this->immediate_lane.lines[0])];
+            strcpy(line, this->immediate_lane.front());
+            this->immediate_lane.pop();
+            run_buffered(line);
+        }
+
         if(THEKERNEL->is_halted() || THEKERNEL->is_suspending() || THEKERNEL->is_waiting() || this->inner_playing) {
             return;
         }
 
-        // check if there are bufferd command
-        while (!this->buffered_queue.empty()) {
-        	THEKERNEL->streams->printf("%s\r\n", this->buffered_queue.front().c_str());
-			struct SerialMessage message;
-			message.message = this->buffered_queue.front();
-			message.stream = THEKERNEL->streams;
-			message.line = 0;
-			this->buffered_queue.pop();
-
-			// waits for the queue to have enough room
-			THEKERNEL->call_event(ON_CONSOLE_LINE_RECEIVED, &message);
+        // one between each of the job's lines
+        if (!this->boundary_lane.empty()) {
+            char line[sizeof(this->boundary_lane.lines[0])];
+            strcpy(line, this->boundary_lane.front());
+            this->boundary_lane.pop();
+            run_buffered(line);
             return;
         }
 
@@ -740,11 +1517,19 @@ void Player::on_main_loop(void *argument)
         float clustered_distance[8];
         */
 
-        while (fgets(buf, sizeof(buf), this->current_file_handler) != NULL) {
+        this->report_progress();
+
+        // in batch mode we keep feeding lines until the planner queue is nearly full or the time budget runs out
+        uint32_t batch_start = us_ticker_read();
+        int fed = 0;
+
+        if (this->compact_file && this->play_compact_records(batch_start)) return;
+
+        while (!this->compact_file && this->reader.gets(buf, sizeof(buf)) != NULL) {
 
             int len = strlen(buf);
             if (len == 0) continue; // empty line? should not be possible
-            if (buf[len - 1] == '\n' || feof(this->current_file_handler)) {
+            if (buf[len - 1] == '\n' || this->reader.eof()) {
                 if(discard) { // we are discarding a long line
                     discard = false;
                     continue;
@@ -752,6 +1537,23 @@ void Player::on_main_loop(void *argument)
 
                 if (len == 1) continue; // empty line
 
+                // WHILE, IF and GOTO are handled here, anything else is played as it is
+                unsigned long line_no = played_lines + 1;
+                MacroFlow::RESULT flow = this->flow.line(buf, this->reader.tell() - len, line_no, this->reader);
+                if (flow == MacroFlow::FAIL) return;
+                if (flow == MacroFlow::JUMP) {
+                    played_lines = line_no;
+                    played_cnt = this->reader.compressed() ? this->reader.source_tell() : this->reader.tell();
+                }
+                if (flow != MacroFlow::RUN) {
+                    if (flow == MacroFlow::SKIP) {
+                        played_lines += 1;
+                        this->count_played(len);
+                    }
+                    if (this->batch_done(++fed, batch_start)) return;
+                    continue;
+                }
+
                 /*
             	// Add laser cluster support when in laser mode
             	if (this->laser_clustering && THEKERNEL->get_laser_mode() && !THEROBOT->absolute_mode && played_lines > 100) {
@@ -768,7 +1570,7 @@ void Player::on_main_loop(void *argument)
                         clustered_s_value[cluster_index - 1] = s_value;
                         clustered_distance[cluster_index - 1] = distance;
                         played_lines += 1;
-                        played_cnt += len;
+                        this->count_played(len);
 						if (cluster_index >= 8 || (min_distance > 0 && sum_distance * 1.0 / min_distance > 7.9)) {
 	                        sprintf(md5_str, "G1 X%.3f Y%.3f S", sum_x_value, sum_y_value);
 	                        clustered_gcode = md5_str;
@@ -824,7 +1626,7 @@ void Player::on_main_loop(void *argument)
             	}
 */
 
-                if (this->current_stream != nullptr) {
+                if (this->echo_lines) {
                     this->current_stream->printf("%s", buf);
                 }
 
@@ -835,17 +1637,20 @@ void Player::on_main_loop(void *argument)
 
                 // waits for the queue to have enough room
                 // this->current_stream->printf("Run: %s", buf);
+                EventTrace::begin(EventTrace::PLAYER_LINE, message.line);
                 THEKERNEL->call_event(ON_CONSOLE_LINE_RECEIVED, &message);
+                EventTrace::end(EventTrace::PLAYER_LINE, message.line);
                 // fputs(buf, this->temp_file_handler);
                 // THEKERNEL->streams->printf("0-[Line: %d] %s\n", message.line, buf);
                 played_lines += 1;
-                played_cnt += len;
+                this->count_played(len);
                 //M335 disables line by line, M336 Enables. Pauses after every valid gcode line
                 if (THEKERNEL->get_line_by_line_exec_mode() && len > 2 && buf[0] != ';' && buf[0] != '('){
                     this->suspend_command("", THEKERNEL->streams);
+                    return;
                 }
 
-                return; // we feed one line per main loop
+                if (this->batch_done(++fed, batch_start)) return;
 
             } else {
                 // discard long line
@@ -854,6 +1659,16 @@ void Player::on_main_loop(void *argument)
             }
         }
 
+        // a GOTO still looking for its label carries on from the top of the file
+        if (!this->compact_file && this->flow.end_of_file(this->reader, played_lines)) return;
+        // or halted, which has already closed the file
+        if (!this->playing_file) return;
+
+        if (this->reader.corrupt()) {
+            THEKERNEL->streams->printf("Error: compressed file is corrupt, stopped after line %lu\r\n", played_lines);
+        }
+        end_job(this->reader.corrupt() ? "corrupt" : "done");
+
         this->playing_file = false;
         this->filename = "";
         played_cnt = 0;
@@ -862,6 +1677,7 @@ void Player::on_main_loop(void *argument)
         goto_line = 0;
         file_size = 0;
 
+        this->reader.detach();
         fclose(this->current_file_handler);
         current_file_handler = NULL;
 
@@ -872,10 +1688,111 @@ void Player::on_main_loop(void *argument)
             this->reply_stream->printf("Done printing file\r\n");
             this->reply_stream = NULL;
         }
+        // variables the job saved go to the eeprom now rather than waiting their turn
+        THEKERNEL->write_eeprom_data();
+        MemoryStats::print_peaks(THEKERNEL->streams, "// ");
+        THEKERNEL->conveyor->stop_queue_stats();
+        THEKERNEL->conveyor->print_queue_stats(THEKERNEL->streams, "// ");
         
         bool bbb = true;
         PublicData::set_value( atc_handler_checksum, set_job_complete_checksum, &bbb );
+        this->announce_next_job();
+    }
+}
+
+// where the replies to a played job go, we send to the kernels stream as it cannot go away
+void Player::set_echo(bool verbose)
+{
+    this->echo_lines = verbose;
+    this->last_progress = us_ticker_read();
+    if (verbose) {
+        this->current_stream = THEKERNEL->streams;
+    } else if (this->echo_mode == ECHO_NONE) {
+        this->current_stream = nullptr;
+    } else {
+        // errors still get back to the host, the oks and the lines themselves do not
+        this->current_stream = &this->error_stream;
+    }
+}
+
+// a line now and then rather than one per gcode line
+void Player::report_progress()
+{
+    if (this->echo_mode != ECHO_PROGRESS || this->echo_lines || this->file_size <= 0) return;
+    uint32_t now = us_ticker_read();
+    if (now - this->last_progress < this->progress_interval_us) return;
+    this->last_progress = now;
+    THEKERNEL->streams->printf("// Progress: %lu%% line %lu\r\n", (unsigned long)(((float)played_cnt * 100.0F) / file_size), played_lines);
+}
+
+// true when this main loop pass has fed enough lines
+bool Player::batch_done(int fed, uint32_t batch_start)
+{
+    // by default we feed one line per main loop
+    if (fed >= this->batch_lines) return true;
+
+    // the line may have changed our state (suspend, abort, macro call, M30 etc), let the main loop handle that
+    if (!this->playing_file || this->current_file_handler == NULL || !this->immediate_lane.empty() || !this->boundary_lane.empty() ||
+        THEKERNEL->is_halted() || THEKERNEL->is_suspending() || THEKERNEL->is_waiting() || this->inner_playing) {
+        return true;
     }
+
+    return THEKERNEL->conveyor->queue_free() < BATCH_QUEUE_HEADROOM || (us_ticker_read() - batch_start) >= this->batch_time_us;
+}
+
+// Feed records from a compact binary file, motion goes straight to the modules without being parsed,
+// text records are handled just like lines of a normal file. Returns false at the end of the file
+bool Player::play_compact_records(uint32_t batch_start)
+{
+    CompactMotion::Record rec;
+    int fed = 0;
+    int len;
+
+    while ((len = CompactMotion::read_record(this->reader, rec, this->delta_base)) > 0) {
+        StreamOutput *stream = this->current_stream == nullptr ? &(StreamOutput::NullStream) : this->current_stream;
+
+        if (rec.op == CompactMotion::OP_TEXT) {
+            if (this->echo_lines) {
+                this->current_stream->printf("%s", rec.text);
+            }
+
+            struct SerialMessage message;
+            message.message = rec.text;
+            message.stream = stream;
+            message.line = played_lines + 1;
+            THEKERNEL->call_event(ON_CONSOLE_LINE_RECEIVED, &message);
+
+        } else {
+            Gcode *gcode = CompactMotion::make_gcode(rec, stream, played_lines + 1);
+            THEKERNEL->gcode_dispatch->set_modal_command(gcode->g);
+
+            // waits for the queue to have enough room
+            THEKERNEL->call_event(ON_GCODE_RECEIVED, gcode);
+
+            if (gcode->is_error) {
+                // we cannot continue safely after an error so we enter HALT state, same as GcodeDispatch
+                THEKERNEL->streams->printf("Error: %s\r\n", gcode->txt_after_ok.empty() ? "unknown" : gcode->txt_after_ok.c_str());
+                THEKERNEL->streams->printf("Entering Alarm/Halt state\n");
+                THEKERNEL->call_event(ON_HALT, nullptr);
+            }
+            delete gcode;
+        }
+
+        played_lines += 1;
+        this->count_played(len);
+
+        if (THEKERNEL->get_line_by_line_exec_mode() && (rec.op != CompactMotion::OP_TEXT || (rec.text[0] != ';' && rec.text[0] != '(' && rec.text[0] != '\n'))) {
+            this->suspend_command("", THEKERNEL->streams);
+            return true;
+        }
+
+        if (this->batch_done(++fed, batch_start)) return true;
+    }
+
+    if (len < 0) {
+        THEKERNEL->streams->printf("Error: corrupt record after line %lu, stopping\r\n", played_lines);
+    }
+    return false;
 }
 
 /*
@@ -946,6 +1863,22 @@ void Player::on_get_public_data(void *argument)
     	bool b = this->inner_playing;
         pdr->set_data_ptr(&b);
         pdr->set_taken();
+
+    } else if (pdr->second_element_is(get_tool_plan_checksum)) {
+        if (!this->playing_file || !this->job_indexed() || this->index.tool_changes.empty()) return;
+        struct pad_tool_plan *p = static_cast<struct pad_tool_plan *>(pdr->get_data_ptr());
+        int next = this->next_tool_change(p->after_line);
+        p->count = this->index.tool_changes.size();
+        p->index = next < 0 ? p->count : next;
+        p->next_tool = next < 0 ? -1 : this->index.tool_changes[next].tool;
+        p->next_line = next < 0 ? 0 : this->index.tool_changes[next].line;
+        pdr->set_taken();
+
+    } else if (pdr->second_element_is(get_job_scan_checksum)) {
+        if (!this->playing_file || !this->scan_loaded) return;
+        struct pad_job_scan *p = static_cast<struct pad_job_scan *>(pdr->get_data_ptr());
+        p->scan = &this->scan;
+        pdr->set_taken();
     }
 }
 
@@ -1091,6 +2024,11 @@ void Player::resume_command(string parameters, StreamOutput *stream )
 
     THEROBOT->pop_state();
 
+    if (this->goto_line != 0) {
+        this->restore_goto_modal(stream);
+        this->goto_line = 0;
+    }
+
     if(THEKERNEL->is_halted()) {
         THEKERNEL->streams->printf("Resume aborted by kill\n");
         THEKERNEL->set_suspending(false);
@@ -1102,52 +2040,141 @@ void Player::resume_command(string parameters, StreamOutput *stream )
 	stream->printf("Playing file resumed\n");
 }
 
-unsigned int Player::crc16_ccitt(unsigned char *data, unsigned int len)
+// once the step ticker has let go of the block it was stepping. With no block the queue had run dry, so the lines
+// fed so far have all finished bar the last one, which may have been held back to merge with the next
+void Player::take_stop_point()
 {
-	static const unsigned short crc_table[] = {
-		0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
-		0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
-		0x1231, 0x0210, 0x3273, 0x2252, 0x52b5, 0x4294, 0x72f7, 0x62d6,
-		0x9339, 0x8318, 0xb37b, 0xa35a, 0xd3bd, 0xc39c, 0xf3ff, 0xe3de,
-		0x2462, 0x3443, 0x0420, 0x1401, 0x64e6, 0x74c7, 0x44a4, 0x5485,
-		0xa56a, 0xb54b, 0x8528, 0x9509, 0xe5ee, 0xf5cf, 0xc5ac, 0xd58d,
-		0x3653, 0x2672, 0x1611, 0x0630, 0x76d7, 0x66f6, 0x5695, 0x46b4,
-		0xb75b, 0xa77a, 0x9719, 0x8738, 0xf7df, 0xe7fe, 0xd79d, 0xc7bc,
-		0x48c4, 0x58e5, 0x6886, 0x78a7, 0x0840, 0x1861, 0x2802, 0x3823,
-		0xc9cc, 0xd9ed, 0xe98e, 0xf9af, 0x8948, 0x9969, 0xa90a, 0xb92b,
-		0x5af5, 0x4ad4, 0x7ab7, 0x6a96, 0x1a71, 0x0a50, 0x3a33, 0x2a12,
-		0xdbfd, 0xcbdc, 0xfbbf, 0xeb9e, 0x9b79, 0x8b58, 0xbb3b, 0xab1a,
-		0x6ca6, 0x7c87, 0x4ce4, 0x5cc5, 0x2c22, 0x3c03, 0x0c60, 0x1c41,
-		0xedae, 0xfd8f, 0xcdec, 0xddcd, 0xad2a, 0xbd0b, 0x8d68, 0x9d49,
-		0x7e97, 0x6eb6, 0x5ed5, 0x4ef4, 0x3e13, 0x2e32, 0x1e51, 0x0e70,
-		0xff9f, 0xefbe, 0xdfdd, 0xcffc, 0xbf1b, 0xaf3a, 0x9f59, 0x8f78,
-		0x9188, 0x81a9, 0xb1ca, 0xa1eb, 0xd10c, 0xc12d, 0xf14e, 0xe16f,
-		0x1080, 0x00a1, 0x30c2, 0x20e3, 0x5004, 0x4025, 0x7046, 0x6067,
-		0x83b9, 0x9398, 0xa3fb, 0xb3da, 0xc33d, 0xd31c, 0xe37f, 0xf35e,
-		0x02b1, 0x1290, 0x22f3, 0x32d2, 0x4235, 0x5214, 0x6277, 0x7256,
-		0xb5ea, 0xa5cb, 0x95a8, 0x8589, 0xf56e, 0xe54f, 0xd52c, 0xc50d,
-		0x34e2, 0x24c3, 0x14a0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
-		0xa7db, 0xb7fa, 0x8799, 0x97b8, 0xe75f, 0xf77e, 0xc71d, 0xd73c,
-		0x26d3, 0x36f2, 0x0691, 0x16b0, 0x6657, 0x7676, 0x4615, 0x5634,
-		0xd94c, 0xc96d, 0xf90e, 0xe92f, 0x99c8, 0x89e9, 0xb98a, 0xa9ab,
-		0x5844, 0x4865, 0x7806, 0x6827, 0x18c0, 0x08e1, 0x3882, 0x28a3,
-		0xcb7d, 0xdb5c, 0xeb3f, 0xfb1e, 0x8bf9, 0x9bd8, 0xabbb, 0xbb9a,
-		0x4a75, 0x5a54, 0x6a37, 0x7a16, 0x0af1, 0x1ad0, 0x2ab3, 0x3a92,
-		0xfd2e, 0xed0f, 0xdd6c, 0xcd4d, 0xbdaa, 0xad8b, 0x9de8, 0x8dc9,
-		0x7c26, 0x6c07, 0x5c64, 0x4c45, 0x3ca2, 0x2c83, 0x1ce0, 0x0cc1,
-		0xef1f, 0xff3e, 0xcf5d, 0xdf7c, 0xaf9b, 0xbfba, 0x8fd9, 0x9ff8,
-		0x6e17, 0x7e36, 0x4e55, 0x5e74, 0x2e93, 0x3eb2, 0x0ed1, 0x1ef0,
-	};
-
-	unsigned char tmp;
-	unsigned short crc = 0;
-
-	for (unsigned int i = 0; i < len; i ++) {
-        tmp = ((crc >> 8) ^ data[i]) & 0xff;
-        crc = ((crc << 8) ^ crc_table[tmp]) & 0xffff;
-	}
+    stop_point_t &sp = this->stop_point;
+    const StepTicker::stop_record_t &r = THEKERNEL->step_ticker->get_stop_record();
+    sp.pending = false;
+    sp.fraction = 0;
+    sp.line = sp.fed;
+    if (r.valid && r.line != 0) {
+        sp.line = r.line;
+        uint32_t steps = r.steps[r.dominant_motor];
+        sp.fraction = steps > 0 ? (float)r.step_count[r.dominant_motor] / steps : 0;
+    }
+
+    // the actuators are where their steps took them, not where the robot last planned to
+    THEROBOT->reset_position_from_current_actuator_position();
+    Robot::wcs_t wpos = THEROBOT->mcs2wcs(THEROBOT->get_axis_position());
+    sp.pos[0] = std::get<X_AXIS>(wpos);
+    sp.pos[1] = std::get<Y_AXIS>(wpos);
+    sp.pos[2] = std::get<Z_AXIS>(wpos);
+
+    if (sp.line == 0) return;
+    THEKERNEL->streams->printf("Job stopped %d%% through line %lu at X%.3f Y%.3f Z%.3f, play it with -c to carry on from there\n",
+        (int)(sp.fraction * 100), sp.line, sp.pos[0], sp.pos[1], sp.pos[2]);
+}
+
+// plays the job that halted from where it stopped rather than from the start of the line it was in. The lines
+// before it set the modal state as goto does, then the tool goes up to the clearance height, over and back down
+// to the point with the spindle running, and the line cut short carries on from there. An arc is started again
+// from its beginning, as its centre is given from there
+bool Player::continue_from_stop(StreamOutput *stream)
+{
+    stop_point_t &sp = this->stop_point;
+    if (sp.line == 0 || sp.filename != this->filename) {
+        stream->printf("error:%s has not been stopped part way\r\n", this->filename.c_str());
+        return false;
+    }
 
-	return crc & 0xffff;
+    if (sp.line > 1) {
+        this->goto_line_number(sp.line - 1);
+    } else {
+        this->goto_modal = modal_t();
+    }
+    this->goto_line = sp.line;
+
+    // what the line cut short does, read ahead and then put back
+    modal_t at = this->goto_modal;
+    long offset = this->reader.tell();
+    if (this->compact_file) {
+        CompactMotion::Record rec;
+        CompactMotion::DeltaBase base = this->delta_base;
+        if (CompactMotion::read_record(this->reader, rec, base) > 0) parse_modal(rec, at);
+    } else {
+        char buf[130];
+        if (this->reader.gets(buf, sizeof(buf)) != NULL) parse_modal(buf, at);
+    }
+    this->reader.seek(offset);
+
+    float scale = this->goto_modal.inches ? 25.4F : 1.0F;
+    float to[3] = {sp.pos[0], sp.pos[1], sp.pos[2]};
+    if (at.motion >= 2) {
+        const float *from = this->goto_modal.pos;
+        if (isnan(from[0]) || isnan(from[1]) || isnan(from[2])) {
+            stream->printf("error:line %lu is an arc and where it starts is not known, use goto\r\n", sp.line);
+            return false;
+        }
+        for (int i = 0; i < 3; i++) to[i] = from[i] * scale;
+        stream->printf("Line %lu is an arc, starting it again\r\n", sp.line);
+    }
+
+    const modal_t &m = this->goto_modal;
+    char wcs[8];
+    if (m.wcs < 6) snprintf(wcs, sizeof(wcs), "G%d", 54 + m.wcs);
+    else snprintf(wcs, sizeof(wcs), "G59.%d", m.wcs - 5);
+    char buf[4][96];
+    snprintf(buf[0], sizeof(buf[0]), "G21 G90 G53 G0 Z%.3f", this->clearance_z);
+    snprintf(buf[1], sizeof(buf[1]), "G21 G90 %s G0 X%.3f Y%.3f", wcs, to[0], to[1]);
+    if (m.spindle_on) snprintf(buf[2], sizeof(buf[2]), "M3 S%.1f", m.speed);
+    else snprintf(buf[2], sizeof(buf[2]), "M5");
+    snprintf(buf[3], sizeof(buf[3]), "G1 Z%.3f F%.3f", to[2], m.feed > 0 ? m.feed * scale : 300.0F);
+    for (auto &line : buf) {
+        stream->printf("Continuing: %s\r\n", line);
+        struct SerialMessage message;
+        message.message = line;
+        message.stream = &(StreamOutput::NullStream);
+        message.line = 0;
+        THEKERNEL->call_event(ON_CONSOLE_LINE_RECEIVED, &message);
+        if (THEKERNEL->is_halted()) return false;
+    }
+
+    this->restore_goto_modal(stream);
+    this->goto_line = 0;
+    sp.line = 0;
+    return true;
+}
+
+// after a goto the job carries on from a line it did not play up to, so put it in the modal state
+// the skipped lines would have left it in rather than the one it was suspended in
+void Player::restore_goto_modal(StreamOutput *stream)
+{
+    const modal_t &m = this->goto_modal;
+    char buf[128];
+    int n = snprintf(buf, sizeof(buf), "G%d G%d G%d", m.inches ? 20 : 21, m.absolute ? 90 : 91, m.plane);
+    if (m.wcs < 6) {
+        n += snprintf(buf + n, sizeof(buf) - n, " G%d", 54 + m.wcs);
+    } else {
+        n += snprintf(buf + n, sizeof(buf) - n, " G59.%d", m.wcs - 5);
+    }
+    if (m.feed > 0) {
+        n += snprintf(buf + n, sizeof(buf) - n, " F%.3f", m.feed);
+    }
+    if (m.motion <= 1) {
+        snprintf(buf + n, sizeof(buf) - n, " G%d", m.motion);
+    }
+    stream->printf("Restoring state at line %lu: %s\n", this->goto_line, buf);
+
+    struct SerialMessage message;
+    message.message = buf;
+    message.stream = &(StreamOutput::NullStream);
+    message.line = 0;
+    THEKERNEL->call_event(ON_CONSOLE_LINE_RECEIVED, &message);
+
+    if (m.spindle_on) {
+        snprintf(buf, sizeof(buf), "M3 S%.1f", m.speed);
+        stream->printf("Restoring spindle: %s\n", buf);
+        message.message = buf;
+        THEKERNEL->call_event(ON_CONSOLE_LINE_RECEIVED, &message);
+    }
+
+    // changing the tool is left to the operator
+    struct tool_status tool;
+    if (m.tool >= 0 && PublicData::get_value(atc_handler_checksum, get_tool_status_checksum, &tool) && tool.active_tool != m.tool) {
+        stream->printf("Warning: the job uses T%d from line %lu, T%d is active\n", m.tool, this->goto_line, tool.active_tool);
+    }
 }
 
 int Player::check_crc(int crc, unsigned char *data, unsigned int len)
@@ -1212,18 +2239,25 @@ void Player::set_serial_rx_irq(bool enable)
     bool enable_irq = enable;
     PublicData::set_value( atc_handler_checksum, set_serial_rx_irq_checksum, &enable_irq );
 }
-int Player::decompress(string sfilename, string dfilename, uint32_t sfilesize, StreamOutput* stream)
+int Player::decompress(string sfilename, string dfilename, uint32_t sfilesize, StreamOutput* stream, MD5 *digest)
 {
 	FILE *f_in = NULL, *f_out = NULL;
 	uint16_t  u16Sum = 0;
 	uint8_t u8ReadBuffer_hdr[BLOCK_HEADER_SIZE] = { 0 };
 	uint32_t u32DcmprsSize = 0, u32BlockSize = 0, u32BlockNum = 0, u32TotalDcmprsSize = 0, i = 0,j = 0,k=0;
 	qlz_state_decompress s_stDecompressState;
+	// compressed blocks are read into the transfer buffer, its top half is the output file's stdio buffer
+	Scratch::Lease xlease(Scratch::TRANSFER, "decompress"), flease(Scratch::BLOCK, "decompress");
+	unsigned char *xbuff = xlease.get(), *fbuff = flease.get();
+	if (xbuff == nullptr || fbuff == nullptr) {
+		stream->printf("Error: scratch buffers in use by %s!\r\n", xbuff == nullptr ? Scratch::owner(Scratch::TRANSFER) : Scratch::owner(Scratch::BLOCK));
+		return 0;
+	}
 	f_in= fopen(sfilename.c_str(), "rb");
 	f_out= fopen(dfilename.c_str(), "w+");
 	if (f_in == NULL || f_out == NULL)
 	{
-		memset(fbuff, 0, sizeof(fbuff));
+		memset(fbuff, 0, flease.size());
 		sprintf((char*)fbuff, "Error: failed to create file [%s]!\r\n", filename.substr(0, 30).c_str());
 		goto _exit;
 	}
@@ -1249,13 +2283,16 @@ int Player::decompress(string sfilename, string dfilename, uint32_t sfilesize, S
 		// Set the file write system buffer 4096 Byte
 		setvbuf(f_out, (char*)&xbuff[4096], _IOFBF, 4096);
 		fwrite(fbuff, sizeof(char),u32DcmprsSize, f_out);
+		if (digest != nullptr) {
+			digest->update(fbuff, u32DcmprsSize);
+		}
 		u32TotalDcmprsSize += u32DcmprsSize;
 		u32BlockNum += 1;
 		if(++k>10)
 		{
 			k=0;
 			THEKERNEL->call_event(ON_IDLE);
-			memset(fbuff, 0, sizeof(fbuff));
+			memset(fbuff, 0, flease.size());
 			sprintf((char*)fbuff, "#Info: decompart = %u\r\n", u32BlockNum);
 			stream->printf((char*)fbuff);
 		}
@@ -1270,7 +2307,7 @@ int Player::decompress(string sfilename, string dfilename, uint32_t sfilesize, S
 		fclose(f_in);
 	if (f_out!= NULL)
 		fclose(f_out);
-	memset(fbuff, 0, sizeof(fbuff));
+	memset(fbuff, 0, flease.size());
 	sprintf((char*)fbuff, "#Info: decompart = %u\r\n", u32BlockNum);
 	stream->printf((char*)fbuff);
 	return 1;
@@ -1297,6 +2334,34 @@ void Player::upload_command( string parameters, StreamOutput *stream )
     int recv_count = 0;
     bool md5_received = false;
     uint32_t u32filesize = 0;
+    // md5 of what is written to the card, worked out as it goes so it never has to be read back
+    MD5 digest;
+
+    // on network streams each packet is ACKed before it is written so the host sends the next one while
+    // we write to the SD card, the serial stream is polled with its rx irq off so it has to wait for the write
+    bool write_behind = stream->type() != 0;
+    // with -w<n> on the end of the line the host may send n packets before waiting for an ACK, which then
+    // covers all of them. NAK is followed by the packet number to resend from and EOT may follow the last packet directly
+    int window = 1;
+    int unacked = 0;
+    // with -p the job starts playing as soon as the upload has been checked, without waiting for the host
+    // to send the play command
+    bool play_after = false;
+    for (;;) {
+        size_t opos = parameters.rfind(" -");
+        if (opos == string::npos || opos + 2 >= parameters.size()) break;
+        if (parameters.compare(opos + 2, string::npos, "p") == 0) {
+            play_after = true;
+        } else if (parameters[opos + 2] == 'w' && opos + 3 < parameters.size() &&
+                   parameters.find_first_not_of("0123456789", opos + 3) == string::npos) {
+            if (write_behind) {
+                window = std::min(std::max(atoi(parameters.c_str() + opos + 3), 1), MAX_UPLOAD_WINDOW);
+            }
+        } else {
+            break;
+        }
+        parameters = parameters.substr(0, opos);
+    }
 
     // open file
 	char error_msg[64];
@@ -1314,7 +2379,11 @@ void Player::upload_command( string parameters, StreamOutput *stream )
     }
     THEKERNEL->set_uploading(true);
 
-    if (!THECONVEYOR->is_idle()) {
+    // packets land in the transfer buffer, the block buffer is the file's stdio buffer
+    Scratch::Lease xlease(Scratch::TRANSFER, "upload"), flease(Scratch::BLOCK, "upload");
+    unsigned char *xbuff = xlease.get(), *fbuff = flease.get();
+
+    if (!THECONVEYOR->is_idle() || xbuff == nullptr || fbuff == nullptr) {
         stream->_putc(EOT);
         if (stream->type() == 0) {
         	set_serial_rx_irq(true);
@@ -1329,14 +2398,19 @@ void Player::upload_command( string parameters, StreamOutput *stream )
 	//if file is lzCompress file,then need to put .lz dir
 	unsigned int start_pos = filename.find(".lz");
 	FILE *fd;
+	string upload_filename = filename;
 	if (start_pos != string::npos) {
 		start_pos = lzfilename.rfind(".lz");
 		lzfilename=lzfilename.substr(0, start_pos);
-    	fd = fopen(lzfilename.c_str(), "wb");
-    }
-    else {
-    	fd = fopen(filename.c_str(), "wb");
+		if (this->stream_lz) {
+			// the compressed file is the only copy, it is decompressed as it is played
+			upload_filename = filename.substr(0, filename.find(".lz"));
+			remove(lzfilename.c_str());
+		} else {
+			upload_filename = lzfilename;
+		}
     }
+	fd = fopen(upload_filename.c_str(), "wb");
 		
     FILE *fd_md5 = NULL;
     //if file is lzCompress file,then need to Decompress
@@ -1445,17 +2519,47 @@ void Player::upload_command( string parameters, StreamOutput *stream )
         } else if (xbuff[1] == (unsigned char)(~xbuff[2]) &&
         		xbuff[1] == packetno && check_crc(crc, &xbuff[3], bufsz + 1 + is_stx)) {
 
-            // Set the file write system buffer 4096 Byte
-        	setvbuf(fd, (char*)fbuff, _IOFBF, 4096);
-			fwrite(&xbuff[4 + is_stx], sizeof(char), len, fd);
 			u32filesize += len;
 			++ packetno;
 			retrans = MAXRETRANS + 1;
+			if (write_behind && ++unacked >= window) {
+				stream->_putc(ACK);
+				unacked = 0;
+			}
+
+            // Set the file write system buffer 4096 Byte
+        	setvbuf(fd, (char*)fbuff, _IOFBF, 4096);
+			if (fwrite(&xbuff[4 + is_stx], sizeof(char), len, fd) != (size_t)len) {
+				cancel_transfer(stream);
+				sprintf(error_msg, "Error: failed to write file!\r\n");
+				goto upload_error;
+			}
+			digest.update(&xbuff[4 + is_stx], len);
 			THEKERNEL->call_event(ON_IDLE);
+			if (!write_behind) {
+				stream->_putc(ACK);
+			}
+            continue;
+        } else if (xbuff[1] == (unsigned char)(~xbuff[2]) &&
+        		xbuff[1] == (unsigned char)(packetno - 1) && check_crc(crc, &xbuff[3], bufsz + 1 + is_stx)) {
+        	// the host did not see our ACK and sent the last packet again
             stream->_putc(ACK);
             continue;
         }
     reject:
+		if (window > 1) {
+			// drop whatever else of the window is in flight, then tell the host where to go back to
+			flush_input(stream);
+			unacked = 0;
+			stream->_putc(NAK);
+			stream->_putc(packetno);
+			if (-- retrans <= 0) {
+	            cancel_transfer(stream);
+	        	sprintf(error_msg, "Error: too many retry error!\r\n");
+	            goto upload_error; /* too many retry error */
+			}
+			continue;
+		}
 		stream->_putc(NAK);
 		if (-- retrans <= 0) {
             cancel_transfer(stream);
@@ -1471,7 +2575,7 @@ upload_error:
 	if (fd != NULL) {
 		fclose(fd);
 		fd = NULL;
-		remove(filename.c_str());
+		remove(upload_filename.c_str());
 	}
 	if (fd_md5 != NULL) {
 		fclose(fd_md5);
@@ -1507,9 +2611,20 @@ upload_success:
 	string desfilename= filename;
 	if (start_pos != string::npos) {
 		desfilename=filename.substr(0, start_pos);
-		if(!decompress(srcfilename,desfilename,u32filesize,stream))
-			goto upload_error;
+		if (!this->stream_lz) {
+			// the decompressor claims both buffers itself
+			xlease.give_back();
+			flease.give_back();
+			// the file on the card is the decompressed one
+			digest = MD5();
+			if(!decompress(srcfilename,desfilename,u32filesize,stream,&digest))
+				goto upload_error;
+		}
     }
+	if (filename.find("firmware.bin") == string::npos) {
+		save_file_digest(desfilename, digest.finalize().hexdigest());
+		this->scan_job(desfilename);
+	}
 
 	// renable TIME0 and TIME1
 	NVIC_EnableIRQ(TIMER0_IRQn);     // Enable interrupt handler
@@ -1518,6 +2633,10 @@ upload_success:
     	set_serial_rx_irq(true);
     }
 	stream->printf("Info: upload success: %s.\r\n", desfilename.c_str());
+
+	if (play_after && filename.find("firmware.bin") == string::npos) {
+		this->play_command(desfilename, stream);
+	}
 }
 
 
@@ -1526,9 +2645,14 @@ void Player::test_command( string parameters, StreamOutput* stream ) {
 	FILE *fd = fopen(filename.c_str(), "rb");
 	if (NULL != fd) {
         MD5 md5;
-        uint8_t md5_buf[64];
+        // whole sectors straight from f_read() into the block buffer, or a sector at a time if it is in use
+        setvbuf(fd, NULL, _IONBF, 0);
+        Scratch::Lease lease(Scratch::BLOCK, "md5");
+        uint8_t sector[512];
+        uint8_t *md5_buf = lease.get() != nullptr ? lease.get() : sector;
+        size_t md5_buf_size = lease.get() != nullptr ? lease.size() : sizeof(sector);
         do {
-            size_t n = fread(md5_buf, 1, sizeof(md5_buf), fd);
+            size_t n = fread(md5_buf, 1, md5_buf_size, fd);
             if (n > 0) md5.update(md5_buf, n);
             THEKERNEL->call_event(ON_IDLE);
         } while (!feof(fd));
@@ -1563,7 +2687,10 @@ void Player::download_command( string parameters, StreamOutput *stream )
     }
     THEKERNEL->set_uploading(true);
 
-    if (!THECONVEYOR->is_idle()) {
+    Scratch::Lease xlease(Scratch::TRANSFER, "download");
+    unsigned char *xbuff = xlease.get();
+
+    if (!THECONVEYOR->is_idle() || xbuff == nullptr) {
         cancel_transfer(stream);
         if (stream->type() == 0) {
         	set_serial_rx_irq(true);
@@ -1597,6 +2724,8 @@ void Player::download_command( string parameters, StreamOutput *stream )
 			goto download_error;
 	    }
 	}
+	// read the packets straight into xbuff, the 8k wifi packets are whole sectors
+	setvbuf(fd, NULL, _IONBF, 0);
     
 
     for(;;) {
@@ -9,17 +9,27 @@
 #pragma once
 
 #include "Module.h"
+#include "LineReader.h"
+#include "CompactMotion.h"
+#include "MacroFlow.h"
+#include "MotionEstimate.h"
+#include "JobScan.h"
+#include "ErrorStream.h"
 
 #include <stdio.h>
+#include <math.h>
 #include <string>
 #include <map>
 #include <vector>
 #include <queue>
+#include <deque>
 #include <cstdint>
+#include <cstring>
 
 using std::string;
 
 class StreamOutput;
+class MD5;
 
 class Player : public Module {
     public:
@@ -28,8 +38,9 @@ class Player : public Module {
         void on_module_loaded();
         void on_console_line_received( void* argument );
         void on_main_loop( void* argument );
+        void on_idle( void* argument );
         void on_second_tick(void* argument);
-        void select_file(string argument);
+        void select_file(string argument, bool index = true);
         void goto_line_number(unsigned long line_number);
         void play_opened_file();
         void end_of_file();
@@ -38,6 +49,20 @@ class Player : public Module {
         void on_gcode_received(void *argument);
         void on_halt(void *argument);
 
+        // the modal state of a job after a line, followed while indexing and while skipping lines
+        struct modal_t {
+            float feed = 0;         // F in the units of the file, 0 until there is one
+            float speed = 0;        // S
+            int tool = -1;          // T of the last M6
+            uint8_t motion = 0;     // G0-G3
+            uint8_t plane = 17;
+            uint8_t wcs = 0;        // G54 to G59.3
+            bool absolute = true;
+            bool inches = false;
+            bool spindle_on = false;
+            float pos[3] = {NAN, NAN, NAN}; // XYZ the line ends at in the job's coordinates, NAN where it is not known
+        };
+
     private:
         void play_command( string parameters, StreamOutput* stream );
         void progress_command( string parameters, StreamOutput* stream );
@@ -53,15 +78,31 @@ class Player : public Module {
         
         string extract_options(string& args);
 
+        void attach_reader();
+        void index_job();
+        float estimate_at(unsigned long line) const;
+        void restore_goto_modal(StreamOutput *stream);
+        void take_stop_point();
+        bool continue_from_stop(StreamOutput *stream);
+        int next_tool_change(unsigned long line) const;
+        bool job_indexed() const { return !index.filename.empty() && filename == index.filename; }
+        void queue_command( string parameters, StreamOutput* stream );
+        void prepare_next_job();
+        void announce_next_job();
+        void count_played(int len);
+        bool batch_done(int fed, uint32_t batch_start);
+        bool play_compact_records(uint32_t batch_start);
+        void set_echo(bool verbose);
+        void report_progress();
+
         void set_serial_rx_irq(bool enable);
         int inbyte(StreamOutput *stream, unsigned int timeout_ms);
         int inbytes(StreamOutput *stream, char **buf, int size, unsigned int timeout_ms);
         void flush_input(StreamOutput *stream);
         void cancel_transfer(StreamOutput *stream);
-        unsigned int crc16_ccitt(unsigned char *data, unsigned int len);
         int check_crc(int crc, unsigned char *data, unsigned int len);
 		
-		int decompress(string sfilename, string dfilename, uint32_t sfilesize, StreamOutput* stream);
+		int decompress(string sfilename, string dfilename, uint32_t sfilesize, StreamOutput* stream, MD5 *digest = nullptr);
 //		int compressfile(string sfilename, string dfilename, StreamOutput* stream);
         // 2024
         // bool check_cluster(const char *gcode_str, float *x_value, float *y_value, float *distance, float *slope, float *s_value);
@@ -73,17 +114,54 @@ class Player : public Module {
         string on_boot_gcode;
         StreamOutput* current_stream;
         StreamOutput* reply_stream;
+        ErrorStream error_stream;
 
         char md5_str[64];
 
-        std::queue<string> buffered_queue;
+        // commands sent with buffer while a job plays, held in place rather than on the heap. The immediate lane is
+        // run on the next main loop pass even while the job is suspended, the other one is run in order between
+        // the job's lines, so it takes effect from the next block the player queues
+        template<int N> struct command_lane_t {
+            static const int LINE_SIZE= 96;
+            char lines[N][LINE_SIZE];
+            uint8_t head, count;
+            bool empty() const { return count == 0; }
+            bool push(const string &s) {
+                if (count == N || s.size() >= LINE_SIZE) return false;
+                char *l= lines[(head + count++) % N];
+                memcpy(l, s.c_str(), s.size() + 1);
+                return true;
+            }
+            const char *front() const { return lines[head]; }
+            void pop() { head= (head + 1) % N; --count; }
+            void clear() { head= count= 0; }
+        };
+        command_lane_t<4> immediate_lane;
+        command_lane_t<8> boundary_lane;
         void clear_buffered_queue();
+        void run_buffered(const char *line);
+
+        // where the time of the job being played goes, counted from on_idle
+        enum JOB_TIME { JOB_CUTTING, JOB_RAPIDS, JOB_TOOL_CHANGE, JOB_PROBING, JOB_PAUSED, JOB_OTHER, JOB_TIMES };
+        uint64_t job_time_us[JOB_TIMES];
+        uint32_t job_time_last;
+        string job_log;
+        // a job that has been read to the end is logged once the motion it queued has run
+        const char *job_result;
+        string job_filename;
+        unsigned long job_lines;
+        void account_job_time();
+        void end_job(const char *result);
+        void log_job();
 
         using macro_file_queue_item= std::tuple<std::string, unsigned long>; // allows running macros. This forms a stact filepath, line number, to return to when the internal file is complete
         std::queue<macro_file_queue_item> macro_file_queue;
         void clear_macro_file_queue();
 
         FILE* current_file_handler;
+        LineReader reader;
+        CompactMotion::DeltaBase delta_base; // where the records read so far left the axes of a compact file
+        MacroFlow flow;
         // FILE* temp_file_handler;
         long file_size;
         unsigned long played_cnt;
@@ -91,8 +169,99 @@ class Player : public Module {
         unsigned long played_lines;
         unsigned long goto_line;
         unsigned int playing_lines;
+
+        // every M6 in the job, found by a pass over the file before it starts playing
+        struct tool_change_t {
+            unsigned long line;
+            unsigned long offset;   // in the same units as played_cnt
+            int tool;
+            float secs;             // estimated motion time up to it
+        };
+        std::vector<tool_change_t> tool_changes;
+
+        // where every line_mark_stride lines of the job start, as goto_line_number() counts lines
+        struct line_mark_t {
+            unsigned long line;     // lines before offset
+            long offset;            // reader offset
+            unsigned long cnt;      // played_cnt at offset
+            modal_t modal;          // state after the lines before offset
+            float secs;             // estimated motion time of the lines before offset
+            CompactMotion::DeltaBase base; // what the delta records of a compact file after offset are from
+        };
+        // what the pass over a job finds, filename is empty until a pass has got to the end of it
+        struct job_index_t {
+            std::vector<tool_change_t> tool_changes;
+            std::vector<line_mark_t> line_marks;
+            unsigned long line_mark_stride;
+            string filename;
+            long size;
+            unsigned long lines;
+            float secs;             // estimated motion time of the whole job
+            void clear();
+        };
+        job_index_t index;
+
+        // the pass itself, a bounded number of lines at a time so it can also run in the background
+        class JobIndexer {
+            public:
+                JobIndexer(LineReader &reader, bool compact, job_index_t &index, bool reserve);
+                // indexes up to n more lines, false once the file has been read to the end
+                bool step(int n);
+                // fills in the totals once step() has returned false
+                void finish();
+
+            private:
+                void add_line_mark(unsigned long lines, unsigned long cnt);
+
+                LineReader &reader;
+                job_index_t &index;
+                CompactMotion::DeltaBase delta_base;
+                modal_t modal;
+                MotionEstimate estimate;
+                // lines and bytes as on_main_loop plays them, and as goto_line_number() counts them
+                unsigned long lines, cnt;
+                unsigned long raw_lines, raw_cnt;
+                bool compact;
+                bool discard;
+        };
+
+        // jobs to play one after the other. While one plays the next is opened and indexed in idle time, so it can
+        // start straight away once the operator says so with queue next
+        std::deque<string> job_queue;
+        job_index_t next_index;
+        class PrepareTask;
+        PrepareTask *preparing;
+        // a pass in idle time keeps out of the way of the job that is playing
+        bool background_may_step() const;
+
+        // what the job being played does, from the scan made in idle time after it was uploaded
+        JobScan scan;
+        class ScanTask;
+        ScanTask *scanning;
+        void scan_job(const string &filename);
+        void report_scan(StreamOutput *stream);
+        modal_t goto_modal;         // state after the last line goto_line_number() skipped
+        uint32_t batch_time_us;
+        // what a job played without -v sends back, the lines themselves only with -v
+        enum ECHO_MODE { ECHO_NONE, ECHO_ERRORS, ECHO_PROGRESS };
+        uint8_t echo_mode;
+        uint32_t progress_interval_us;
+        uint32_t last_progress;
+        int batch_lines;
         uint8_t current_motion_mode;
         float saved_position[3]; // only saves XYZ
+
+        // where a halt stopped the job, inside the line it was cutting, for play -c to carry on from
+        struct stop_point_t {
+            string filename;
+            unsigned long line;     // the line cut short, 0 if there is none to carry on from
+            unsigned long fed;      // lines given to the robot when it halted
+            float fraction;         // how far through its move the block being stepped got
+            float pos[3];           // WCS in mm
+            bool pending;           // waiting for the step ticker to let go of the block
+        };
+        stop_point_t stop_point;
+        float clearance_z;          // machine Z the tool goes back to the stop point at
         float slope;
         std::map<uint16_t, float> saved_temperatures;
         struct {
@@ -104,5 +273,10 @@ class Player : public Module {
             bool override_leave_heaters_on:1;
             bool inner_playing:1;
             bool laser_clustering:1;
+            bool compact_file:1;
+            bool stream_lz:1;
+            bool index_enable:1;
+            bool echo_lines:1;
+            bool scan_loaded:1;
         };
 };
@@ -8,6 +8,10 @@
 #define get_progress_checksum     CHECKSUM("progress")
 #define inner_playing_checksum    CHECKSUM("inner_playing")
 #define restart_job_checksum    CHECKSUM("restart_job")
+#define get_tool_plan_checksum    CHECKSUM("tool_plan")
+#define get_job_scan_checksum     CHECKSUM("job_scan")
+
+class JobScan;
 
 struct pad_progress {
     unsigned int percent_complete;
@@ -15,4 +19,18 @@ struct pad_progress {
     unsigned long elapsed_secs;
     std::string filename;
 };
+
+// the caller sets after_line, the player fills in the first tool change after it
+struct pad_tool_plan {
+    unsigned long after_line;
+    int next_tool;              // -1 if there are no more tool changes
+    unsigned long next_line;
+    unsigned int index;         // tool changes up to and including after_line
+    unsigned int count;         // tool changes in the whole job
+};
+
+// what the job being played was found to do when it was uploaded, only good until the job ends
+struct pad_job_scan {
+    const JobScan *scan;
+};
 #endif
@@ -23,6 +23,7 @@
 #include "version.h"
 #include "PublicDataRequest.h"
 #include "AppendFileStream.h"
+#include "WriteQueue.h"
 #include "FileStream.h"
 #include "checksumm.h"
 #include "PublicData.h"
@@ -34,6 +35,8 @@
 #include "StepperMotor.h"
 #include "Configurator.h"
 #include "Block.h"
+#include "StepTicker.h"
+#include "SlowTicker.h"
 #include "SpindlePublicAccess.h"
 #include "ZProbePublicAccess.h"
 #include "LaserPublicAccess.h"
@@ -42,10 +45,22 @@
 #include "ATCHandlerPublicAccess.h"
 // #include "NetworkPublicAccess.h"
 #include "platform_memory.h"
+#include "SlabPool.h"
+#include "MemoryStats.h"
+#include "Scratch.h"
+#include "BootTrace.h"
+#include "IrqPriority.h"
+#include "EventTrace.h"
+#include "PcSampler.h"
+#include "Counters.h"
+#include "Task.h"
 #include "SwitchPublicAccess.h"
 #include "SDFAT.h"
 #include "Thermistor.h"
 #include "md5.h"
+#include "LineReader.h"
+#include "MotionEstimate.h"
+#include "ContinuousJog.h"
 #include "utils.h"
 #include "AutoPushPop.h"
 #include "MainButtonPublicAccess.h"
@@ -58,7 +73,6 @@
 #include <strings.h> // For strncasecmp
 
 extern unsigned int g_maximumHeapAddress;
-extern unsigned char xbuff[8200];
 
 #define EOT  0x04
 #define CAN  0x16 //0x18
@@ -100,6 +114,10 @@ const SimpleShell::ptentry_t SimpleShell::commands_table[] = {
 	{"ftype",	 SimpleShell::ftype_command},
     {"version",  SimpleShell::version_command},
     {"mem",      SimpleShell::mem_command},
+    {"boot",     SimpleShell::boot_command},
+    {"irq",      SimpleShell::irq_command},
+    {"trace",    SimpleShell::trace_command},
+    {"counters", SimpleShell::counters_command},
     {"get",      SimpleShell::get_command},
     {"set_temp", SimpleShell::set_temp_command},
     {"switch",   SimpleShell::switch_command},
@@ -115,6 +133,9 @@ const SimpleShell::ptentry_t SimpleShell::commands_table[] = {
     {"calc_thermistor", SimpleShell::calc_thermistor_command},
     {"thermistors", SimpleShell::print_thermistors_command},
     {"md5sum",   SimpleShell::md5sum_command},
+    {"isr",      SimpleShell::isr_command},
+    {"bench",    SimpleShell::bench_command},
+    {"queue",    SimpleShell::queue_command},
 	{"time",   SimpleShell::time_command},
     {"test",     SimpleShell::test_command},
     {"model",  SimpleShell::model_command},
@@ -131,59 +152,13 @@ const SimpleShell::ptentry_t SimpleShell::commands_table[] = {
 
 int SimpleShell::reset_delay_secs = 0;
 
-// Adam Greens heap walk from http://mbed.org/forum/mbed/topic/2701/?page=4#comment-22556
 static uint32_t heapWalk(StreamOutput *stream, bool verbose)
 {
-    uint32_t chunkNumber = 1;
-    // The __end__ linker symbol points to the beginning of the heap.
-    uint32_t chunkCurr = (uint32_t)&__end__;
-    // __malloc_free_list is the head pointer to newlib-nano's link list of free chunks.
-    uint32_t freeCurr = __malloc_free_list;
-    // Calling _sbrk() with 0 reserves no more memory but it returns the current top of heap.
-    uint32_t heapEnd = _sbrk(0);
-    // accumulate totals
-    uint32_t freeSize = 0;
-    uint32_t usedSize = 0;
-
-    stream->printf("Used Heap Size: %lu\n", heapEnd - chunkCurr);
-
-    // Walk through the chunks until we hit the end of the heap.
-    while (chunkCurr < heapEnd) {
-        // Assume the chunk is in use.  Will update later.
-        int      isChunkFree = 0;
-        // The first 32-bit word in a chunk is the size of the allocation.  newlib-nano over allocates by 8 bytes.
-        // 4 bytes for this 32-bit chunk size and another 4 bytes to allow for 8 byte-alignment of returned pointer.
-        uint32_t chunkSize = *(uint32_t *)chunkCurr;
-        // The start of the next chunk is right after the end of this one.
-        uint32_t chunkNext = chunkCurr + chunkSize;
-
-        // The free list is sorted by address.
-        // Check to see if we have found the next free chunk in the heap.
-        if (chunkCurr == freeCurr) {
-            // Chunk is free so flag it as such.
-            isChunkFree = 1;
-            // The second 32-bit word in a free chunk is a pointer to the next free chunk (again sorted by address).
-            freeCurr = *(uint32_t *)(freeCurr + 4);
-        }
-
-        // Skip past the 32-bit size field in the chunk header.
-        chunkCurr += 4;
-        // 8-byte align the data pointer.
-        chunkCurr = (chunkCurr + 7) & ~7;
-        // newlib-nano over allocates by 8 bytes, 4 bytes for the 32-bit chunk size and another 4 bytes to allow for 8
-        // byte-alignment of the returned pointer.
-        chunkSize -= 8;
-        if (verbose)
-            stream->printf("  Chunk: %lu  Address: 0x%08lX  Size: %lu  %s\n", chunkNumber, chunkCurr, chunkSize, isChunkFree ? "CHUNK FREE" : "");
-
-        if (isChunkFree) freeSize += chunkSize;
-        else usedSize += chunkSize;
-
-        chunkCurr = chunkNext;
-        chunkNumber++;
-    }
-    stream->printf("Allocated: %lu, Free: %lu\r\n", usedSize, freeSize);
-    return freeSize;
+    MemoryStats::heap_t h;
+    stream->printf("Used Heap Size: %lu\n", _sbrk(0) - (uint32_t)&__end__);
+    MemoryStats::heap_walk(h, verbose ? stream : nullptr);
+    stream->printf("Allocated: %lu, Free: %lu, Largest free: %lu\r\n", h.used, h.free, h.largest_free);
+    return h.free;
 }
 
 
@@ -279,6 +254,35 @@ void SimpleShell::on_gcode_received(void *argument)
 
 bool SimpleShell::parse_command(const char *cmd, string args, StreamOutput *stream)
 {
+    // the table in name order the first time through, so finding a command is a binary search not a scan
+    static const int n_commands = sizeof(commands_table) / sizeof(commands_table[0]) - 1;
+    static uint8_t order[n_commands];
+    static bool sorted = false;
+    if (!sorted) {
+        for (int i = 0; i < n_commands; ++i) {
+            int j = i;
+            for (; j > 0 && strcasecmp(commands_table[order[j - 1]].command, commands_table[i].command) > 0; --j) {
+                order[j] = order[j - 1];
+            }
+            order[j] = i;
+        }
+        sorted = true;
+    }
+
+    int lo = 0, hi = n_commands - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        const ptentry_t *p = &commands_table[order[mid]];
+        int c = strcasecmp(cmd, p->command);
+        if (c == 0) {
+            p->func(args, stream);
+            return true;
+        }
+        if (c < 0) hi = mid - 1;
+        else lo = mid + 1;
+    }
+
+    // commands have always matched on a prefix of the word, so keep that for anything that is not a whole name
     for (const ptentry_t *p = commands_table; p->command != NULL; ++p) {
         if (strncasecmp(cmd, p->command, strlen(p->command)) == 0) {
             p->func(args, stream);
@@ -292,13 +296,14 @@ bool SimpleShell::parse_command(const char *cmd, string args, StreamOutput *stre
 // When a new line is received, check if it is a command, and if it is, act upon it
 void SimpleShell::on_console_line_received( void *argument )
 {
-    SerialMessage new_message = *static_cast<SerialMessage *>(argument);
-    string possible_command = new_message.message;
+    SerialMessage &new_message = *static_cast<SerialMessage *>(argument);
 
-    // ignore anything that is not lowercase or a $ as it is not a command
-    if(possible_command.size() == 0 || (!islower(possible_command[0]) && possible_command[0] != '$')) {
+    // ignore anything that is not lowercase or a $ as it is not a command, before copying it as every gcode line comes through here
+    const string &line = new_message.message;
+    if(line.empty() || (!islower(line[0]) && line[0] != '$')) {
         return;
     }
+    string possible_command = line;
 
     // it is a grbl compatible command
     if(possible_command[0] == '$' && possible_command.size() >= 2) {
@@ -343,6 +348,31 @@ void SimpleShell::on_console_line_received( void *argument )
                 switch_command(possible_command, new_message.stream);
                 break;
 
+            case 'P':
+                // event dispatch and slow ticker profiling, $P1 starts (or restarts) it, $P0 stops it, $P reports
+                if(possible_command.size() >= 3 && (possible_command[2] == '0' || possible_command[2] == '1')) {
+                    THEKERNEL->set_event_profiling(possible_command[2] == '1');
+                    THEKERNEL->slow_ticker->reset_stats();
+                } else {
+                    THEKERNEL->print_event_profile(new_message.stream);
+                    THEKERNEL->slow_ticker->print_stats(new_message.stream);
+                }
+                new_message.stream->printf("ok\n");
+                break;
+
+            case 'R':
+                // main loop PC sampling, $R1 [hz] starts (or restarts) it, $R0 stops it, $R reports
+                if(possible_command.size() >= 3 && possible_command[2] == '1') {
+                    uint32_t hz = possible_command.size() > 4 ? strtoul(possible_command.c_str() + 4, nullptr, 10) : 1000;
+                    if(!PcSampler::start(hz)) new_message.stream->printf("error:Could not start sampling\n");
+                } else if(possible_command.size() >= 3 && possible_command[2] == '0') {
+                    PcSampler::stop();
+                } else {
+                    PcSampler::print(new_message.stream);
+                }
+                new_message.stream->printf("ok\n");
+                break;
+
             case 'J':
                 // instant jog command
                 if(!this->cont_mode_active) {
@@ -397,8 +427,66 @@ void SimpleShell::on_console_line_received( void *argument )
     }
 }
 
+// returns true if -<c> is in the options, with the number right after it in value if there is one
+static bool ls_option(const string &opts, char c, unsigned long *value)
+{
+    for (size_t i = opts.find('-'); i != string::npos; i = opts.find('-', i + 1)) {
+        if (i + 1 < opts.size() && opts[i + 1] == c) {
+            if (value != nullptr) *value = strtoul(opts.c_str() + i + 2, nullptr, 10);
+            return true;
+        }
+    }
+    return false;
+}
+
+static struct dirent *ls_next(DIR *d)
+{
+    struct dirent *p;
+    while ((p = readdir(d)) != NULL && p->d_name[0] == '.') ;
+    return p;
+}
+
+// where the last page of a paged listing stopped, the directory stays open so the next page carries on
+// from there instead of reading past everything before it again. the entry after the page has already
+// been read to know if there are more, so it is kept to start the next page with
+static struct {
+    DIR *dir;
+    string path;
+    uint32_t gen;
+    unsigned long next;
+    bool has_peek;
+    struct dirent peek;
+} ls_cursor;
+
+static void ls_cursor_close()
+{
+    if (ls_cursor.dir != NULL) closedir(ls_cursor.dir);
+    ls_cursor.dir = NULL;
+    ls_cursor.has_peek = false;
+}
+
+// adds a line to the listing in buf, sent once it passes flush_at. without a buffer it goes out straight away
+static void ls_emit(StreamOutput *stream, unsigned char *buf, unsigned int &npos, size_t flush_at, const char *line)
+{
+    size_t n = strlen(line);
+    if (buf == nullptr) {
+        stream->puts(line, n);
+        return;
+    }
+    memcpy(&buf[npos], line, n);
+    npos += n;
+    if (npos >= flush_at) {
+        stream->puts((char *)buf, npos);
+        npos = 0;
+    }
+}
+
 // Act upon an ls command
 // Convert the first parameter into an absolute path, then list the files in that path
+// -s adds the size and date, -b the same as hex (size, FAT date << 16 | FAT time) which is shorter and quicker
+// -u<gen> only says unchanged if nothing in the directory has changed since the listing that gave gen
+// -o<offset> -n<count> list count entries starting at offset, followed by #more <offset> if there are more
+// any of -b -u -o -n first give the #gen of the directory to check against later
 void SimpleShell::ls_command( string parameters, StreamOutput *stream )
 {
     string path, opts;
@@ -418,21 +506,62 @@ void SimpleShell::ls_command( string parameters, StreamOutput *stream )
 
     path = absolute_from_relative(path);
 
+    unsigned long since = 0, offset = 0, count = 0;
+    bool sizes = ls_option(opts, 's', nullptr);
+    bool compact = ls_option(opts, 'b', nullptr);
+    bool check = ls_option(opts, 'u', &since);
+    bool paged = ls_option(opts, 'o', &offset) | ls_option(opts, 'n', &count);
+    bool eot = ls_option(opts, 'e', nullptr);
+    uint32_t gen = FATFileSystem::dir_generation(path.c_str());
+
+    if (check && since == gen) {
+        stream->printf("#gen %lu unchanged\r\n", gen);
+        if (eot) stream->_putc(EOT);
+        return;
+    }
+
     DIR *d;
     struct dirent *p;
     struct tm timeinfo;
     char dirTmp[256]; 
     unsigned int npos=0;
-    d = opendir(path.c_str());
+    bool resumed = paged && ls_cursor.dir != NULL && ls_cursor.gen == gen && ls_cursor.next == offset && ls_cursor.path == path;
+    if (resumed) {
+        d = ls_cursor.dir;
+    } else {
+        ls_cursor_close();
+        d = opendir(path.c_str());
+    }
     if (d != NULL) {
-        while ((p = readdir(d)) != NULL) {
-        	if (p->d_name[0] == '.') {
-        		continue;
-        	}
+        // batched up in the transfer buffer, or a line at a time while an upload or download has it
+        Scratch::Lease lease(Scratch::TRANSFER, "ls");
+        unsigned char *xbuff = lease.get();
+        size_t flush_at = lease.size() > 300 ? lease.size() - 300 : 0;
+        if (compact || check || paged) {
+            sprintf(dirTmp, "#gen %lu\r\n", gen);
+            ls_emit(stream, xbuff, npos, flush_at, dirTmp);
+        }
+        if (resumed && ls_cursor.has_peek) {
+            p = &ls_cursor.peek;
+            ls_cursor.has_peek = false;
+        } else {
+            if (!resumed) {
+                for (unsigned long i = 0; i < offset && ls_next(d) != NULL; i++) ;
+            }
+            p = ls_next(d);
+        }
+        unsigned long listed = 0;
+        for (; p != NULL; p = ls_next(d)) {
+            if (count != 0 && listed == count) break;
+            listed++;
         	for (int i = 0; i < NAME_MAX; i ++) {
         		if (p->d_name[i] == ' ') p->d_name[i] = 0x01;
         	}
-        	if (opts.find("-s", 0, 2) != string::npos) {
+        	if (compact) {
+        	    // name size date
+                sprintf(dirTmp, "%s%s %lx %lx\r\n", p->d_name, p->d_isdir ? "/" : "", p->d_isdir ? 0UL : (unsigned long)p->d_fsize,
+                        ((unsigned long)p->d_date << 16) | p->d_time);
+        	} else if (sizes) {
         	    get_fftime(p->d_date, p->d_time, &timeinfo);
         		// name size date
                 memset(dirTmp, 0, sizeof(dirTmp));
@@ -444,26 +573,33 @@ void SimpleShell::ls_command( string parameters, StreamOutput *stream )
                 memset(dirTmp, 0, sizeof(dirTmp));
                 sprintf(dirTmp, "%s%s\r\n", string(p->d_name).c_str(), p->d_isdir ? "/" : "");
         	}
-        	memcpy(&xbuff[npos], dirTmp, strlen(dirTmp));
-        	npos += strlen(dirTmp);
-        	if(npos >= 7900)
-        	{
-        		stream->puts((char *)xbuff, npos);
-        		npos = 0;
-        	}
-        	
+        	ls_emit(stream, xbuff, npos, flush_at, dirTmp);
+        }
+        if (p != NULL) {
+            // stopped at the page size with more to come, keep our place
+            sprintf(dirTmp, "#more %lu\r\n", offset + listed);
+            ls_emit(stream, xbuff, npos, flush_at, dirTmp);
+            ls_cursor.dir = d;
+            ls_cursor.path = path;
+            ls_cursor.gen = gen;
+            ls_cursor.next = offset + listed;
+            ls_cursor.peek = *p;
+            ls_cursor.has_peek = true;
+        } else if (resumed) {
+            ls_cursor_close();
+        } else {
+            closedir(d);
         }
         if( npos != 0)
         {
         	stream->puts((char *)xbuff, npos);
         }
-        closedir(d);
-        if(opts.find("-e", 0, 2) != string::npos) {
-        	char eot = EOT;
-            stream->puts(&eot, 1);
+        if(eot) {
+        	char c = EOT;
+            stream->puts(&c, 1);
         }
     } else {
-        if(opts.find("-e", 0, 2) != string::npos) {
+        if(eot) {
             stream->_putc(CAN);
         }
         stream->printf("Could not open directory %s\r\n", path.c_str());
@@ -474,6 +610,8 @@ extern SDFAT mounter;
 
 void SimpleShell::remount_command( string parameters, StreamOutput *stream )
 {
+    // anything still queued belongs on the card as it was
+    WriteQueue::sync();
     mounter.remount();
     stream->printf("remounted\r\n");
 }
@@ -524,6 +662,7 @@ void SimpleShell::rm_command( string parameters, StreamOutput *stream )
     	}*/
     	string str_lz = absolute_from_relative(lz_path);
 		s = remove(str_lz.c_str());
+		remove(change_to_digest_path(path).c_str());
 		if(send_eof) {
             stream->_putc(EOT);
     	}
@@ -573,6 +712,7 @@ void SimpleShell::mv_command( string parameters, StreamOutput *stream )
         	}
         }*/
         s = rename(lz_from.c_str(), lz_to.c_str());
+        rename(change_to_digest_path(from).c_str(), change_to_digest_path(to).c_str());
         if (send_eof) {
 			stream->_putc(EOT);
 		}
@@ -679,12 +819,32 @@ void SimpleShell::cat_command( string parameters, StreamOutput *stream )
         safe_delay_ms(delay * 1000);
     }
 
-    // Open file
+    // Open file, with anything still queued for it written first
+    WriteQueue::sync(filename.c_str());
     FILE *lp = fopen(filename.c_str(), "r");
     if (lp == NULL) {
         stream->printf("File not found: %s\r\n", filename.c_str());
         return;
     }
+    // the whole file, in sector sized blocks read unbuffered and sent as they are
+    if (limit < 0) {
+        setvbuf(lp, NULL, _IONBF, 0);
+        char block[512];
+        size_t n;
+        while ((n = fread(block, 1, sizeof(block), lp)) > 0) {
+            int sent = stream->puts(block, n);
+            if (sent < (int)n) {
+                fclose(lp);
+                stream->printf("Caching error, size: %u, sent: %d", (unsigned int)n, sent);
+                return;
+            }
+            // we need to kick things or they die
+            THEKERNEL->call_event(ON_IDLE);
+        }
+        fclose(lp);
+        return;
+    }
+
     // string buffer;
     char buffer[192];
     memset(buffer, 0, sizeof(buffer));
@@ -749,6 +909,7 @@ void SimpleShell::load_command( string parameters, StreamOutput *stream )
         filename = THEKERNEL->config_override_filename();
     }
 
+    WriteQueue::sync(filename.c_str());
     FILE *fp = fopen(filename.c_str(), "r");
     if(fp != NULL) {
         char buf[132];
@@ -783,9 +944,9 @@ void SimpleShell::save_command( string parameters, StreamOutput *stream )
 
     //remove(filename.c_str()); // seems to cause a hang every now and then
     {
-        FileStream fs(filename.c_str());
-        fs.printf("; DO NOT EDIT THIS FILE\n");
         // this also will truncate the existing file instead of deleting it
+        static const char header[] = "; DO NOT EDIT THIS FILE\n";
+        WriteQueue::replace(filename.c_str(), header, sizeof(header) - 1);
     }
 
     // stream that appends to file
@@ -803,6 +964,11 @@ void SimpleShell::save_command( string parameters, StreamOutput *stream )
     delete gcode;
     __enable_irq();
 
+    // the settings were only queued, write them now with interrupts on
+    if(!WriteQueue::sync(filename.c_str())) {
+        stream->printf("error:Failed to write %s\r\n", filename.c_str());
+        return;
+    }
     stream->printf("Settings Stored to %s\r\n", filename.c_str());
 }
 
@@ -818,8 +984,15 @@ void SimpleShell::mem_command( string parameters, StreamOutput *stream)
     stream->printf("Total Free RAM (Main Heap): %lu bytes\r\n", heap_unallocated_top + heap_fragmented_free);
 
     // Use MemoryPool::free() which calculates total free space in the pool
-    uint32_t ahb_total_free = AHB.free();
-    stream->printf("AHB Pool Total Free: %lu bytes\r\n", ahb_total_free);
+    uint32_t ahb_largest_free;
+    uint32_t ahb_total_free = AHB.free(&ahb_largest_free);
+    stream->printf("AHB Pool Total Free: %lu bytes, Largest free: %lu bytes\r\n", ahb_total_free, ahb_largest_free);
+    MemoryStats::stack_t st;
+    MemoryStats::stack_usage(st);
+    stream->printf("Stack: %lu bytes, used %lu, high water %lu, never touched %lu\r\n", st.size, st.used, st.high_water, st.size - st.high_water);
+    SLAB.debug(stream);
+    Scratch::print(stream);
+    MemoryStats::print_peaks(stream);
 
     if (verbose) {
         stream->printf("--- AHB Pool Details ---\n");
@@ -827,7 +1000,48 @@ void SimpleShell::mem_command( string parameters, StreamOutput *stream)
         stream->printf("--- End AHB Pool Details ---\n");
     }
 
-    stream->printf("Block size: %u bytes, Tickinfo size: %u bytes\n", sizeof(Block), sizeof(Block::tickinfo_t) * Block::n_actuators);
+    stream->printf("Block size: %u bytes\n", sizeof(Block));
+}
+
+void SimpleShell::boot_command( string parameters, StreamOutput *stream)
+{
+    BootTrace::print(stream);
+}
+
+void SimpleShell::irq_command( string parameters, StreamOutput *stream)
+{
+    IrqPriority::print(stream);
+}
+
+// counters prints them all as JSON, counters reset zeroes them
+void SimpleShell::counters_command( string parameters, StreamOutput *stream)
+{
+    if (shift_parameter(parameters) == "reset") {
+        Counters::reset();
+    } else {
+        Counters::print_json(stream);
+    }
+}
+
+// trace on [entries], trace off, trace dump
+void SimpleShell::trace_command( string parameters, StreamOutput *stream)
+{
+    string what = shift_parameter(parameters);
+    if (what == "on") {
+        string n = shift_parameter(parameters);
+        uint16_t entries = n.empty() ? 512 : strtoul(n.c_str(), nullptr, 10);
+        if (EventTrace::start(entries)) {
+            stream->printf("Tracing into %u entries\n", entries);
+        } else {
+            stream->printf("No room for %u trace entries\n", entries);
+        }
+    } else if (what == "off") {
+        EventTrace::stop();
+    } else if (what == "dump") {
+        EventTrace::print(stream);
+    } else {
+        stream->printf("usage: trace on [entries] | off | dump\n");
+    }
 }
 
 static uint32_t getDeviceType()
@@ -1010,144 +1224,12 @@ void SimpleShell::wlan_command( string parameters, StreamOutput *stream)
     }
 }
 
-// wlan config
+// diagnose [seq], only the fields that changed since the report with that N: when given
 void SimpleShell::diagnose_command( string parameters, StreamOutput *stream)
 {
-	std::string str;
-    size_t n;
-    char buf[128];
-    bool ok = false;
-
-    str.append("{");
-
-    // get spindle state
-    struct spindle_status ss;
-    ok = PublicData::get_value(pwm_spindle_control_checksum, get_spindle_status_checksum, &ss);
-    if (ok) {
-        n = snprintf(buf, sizeof(buf), "S:%d,%d", (int)ss.state, (int)ss.target_rpm);
-        if(n > sizeof(buf)) n= sizeof(buf);
-        str.append(buf, n);
-    }
-
-    // get laser state
-    struct laser_status ls;
-    ok = PublicData::get_value(laser_checksum, get_laser_status_checksum, &ls);
-    if (ok) {
-        n = snprintf(buf, sizeof(buf), "|L:%d,%d", (int)ls.state, (int)ls.power);
-        if(n > sizeof(buf)) n= sizeof(buf);
-        str.append(buf, n);
-    }
-
-    // get switchs state
-    struct pad_switch pad;
-    if(THEKERNEL->factory_set->FuncSetting & (1<<2))	//ATC 
-    {
-    	ok = PublicData::get_value(switch_checksum, get_checksum("vacuum"), 0, &pad);
-    }
-    else
-    {
-    	ok = PublicData::get_value(switch_checksum, get_checksum("powerfan"), 0, &pad);
-    }
-    	
-    if (ok) {
-        n = snprintf(buf, sizeof(buf), "|V:%d,%d", (int)pad.state, (int)pad.value);
-        if(n > sizeof(buf)) n = sizeof(buf);
-        str.append(buf, n);
-    }
-    ok = PublicData::get_value(switch_checksum, get_checksum("spindlefan"), 0, &pad);
-    if (ok) {
-        n = snprintf(buf, sizeof(buf), "|F:%d,%d", (int)pad.state, (int)pad.value);
-        if(n > sizeof(buf)) n = sizeof(buf);
-        str.append(buf, n);
-    }
-    ok = PublicData::get_value(switch_checksum, get_checksum("light"), 0, &pad);
-    if (ok) {
-        n = snprintf(buf, sizeof(buf), "|G:%d", (int)pad.state);
-        if(n > sizeof(buf)) n = sizeof(buf);
-        str.append(buf, n);
-    }
-    if(CARVERA_AIR == THEKERNEL->factory_set->MachineModel)
-	{	
-    	bool ok2 = false;
-    	bool ok3 = false;
-    	struct pad_switch pad2,pad3;
-	    ok = PublicData::get_value(switch_checksum, get_checksum("beep"), 0, &pad);
-	    ok2 = PublicData::get_value(switch_checksum, get_checksum("extendin"), 0, &pad2);
-	   	ok3 = PublicData::get_value(switch_checksum, get_checksum("extendout"), 0, &pad3);
-	    if (ok&&ok2&&ok3) {
-	        n = snprintf(buf, sizeof(buf), ",%d,%d,%d,%d", (int)pad.state, (int)pad2.state, (int)pad3.state, (int)pad3.value);
-	        if(n > sizeof(buf)) n = sizeof(buf);
-	        str.append(buf, n);
-	    }
-	    
-	}
-    ok = PublicData::get_value(switch_checksum, get_checksum("toolsensor"), 0, &pad);
-    if (ok) {
-        n = snprintf(buf, sizeof(buf), "|T:%d", (int)pad.state);
-        if(n > sizeof(buf)) n = sizeof(buf);
-        str.append(buf, n);
-    }
-    ok = PublicData::get_value(switch_checksum, get_checksum("air"), 0, &pad);
-    if (ok) {
-        n = snprintf(buf, sizeof(buf), "|R:%d", (int)pad.state);
-        if(n > sizeof(buf)) n = sizeof(buf);
-        str.append(buf, n);
-    }
-    ok = PublicData::get_value(switch_checksum, get_checksum("probecharger"), 0, &pad);
-    if (ok) {
-        n = snprintf(buf, sizeof(buf), "|C:%d", (int)pad.state);
-        if(n > sizeof(buf)) n = sizeof(buf);
-        str.append(buf, n);
-    }
-
-    // get states
-    char data[11];
-    ok = PublicData::get_value(endstops_checksum, get_endstop_states_checksum, 0, data);
-    if (ok) {
-        n = snprintf(buf, sizeof(buf), "|E:%d,%d,%d,%d,%d,%d", data[0], data[1], data[2], data[3], data[4], data[5]);
-        if(n > sizeof(buf)) n = sizeof(buf);
-        str.append(buf, n);
-    }
-    if(THEKERNEL->factory_set->FuncSetting & ((1<<0)|(1<<1)) )
-    {
-    	ok = PublicData::get_value(endstops_checksum, get_endstopAB_states_checksum, 0, data);
-	    if (ok) {
-	        n = snprintf(buf, sizeof(buf), ",%d,%d", data[0],data[1]);
-	        if(n > sizeof(buf)) n = sizeof(buf);
-	        str.append(buf, n);
-	    }
-    }
-
-    // get probe and calibrate states
-    ok = PublicData::get_value(zprobe_checksum, get_zprobe_pin_states_checksum, 0, &data[6]);
-    if (ok) {
-        n = snprintf(buf, sizeof(buf), "|P:%d,%d", data[6], data[7]);
-        if(n > sizeof(buf)) n = sizeof(buf);
-        str.append(buf, n);
-    }
-	
-	if(THEKERNEL->factory_set->FuncSetting & (1<<2))	//ATC 
-	{
-	    // get atc endstop and tool senser states
-	    ok = PublicData::get_value(atc_handler_checksum, get_atc_pin_status_checksum, 0, &data[8]);
-	    if (ok) {
-	        n = snprintf(buf, sizeof(buf), "|A:%d,%d", data[8], data[9]);
-	        if(n > sizeof(buf)) n = sizeof(buf);
-	        str.append(buf, n);
-	    }
-	}
-
-    // get e-stop states
-    ok = PublicData::get_value(main_button_checksum, get_e_stop_state_checksum, 0, &data[10]);
-    if (ok) {
-        n = snprintf(buf, sizeof(buf), "|I:%d", data[10]);
-        if(n > sizeof(buf)) n = sizeof(buf);
-        str.append(buf, n);
-    }
-
-    str.append("}\n");
-    stream->printf("%s", str.c_str());
-
+    string s = shift_parameter(parameters);
+    uint32_t since = s.empty() ? 0 : strtoul(s.c_str(), nullptr, 10);
+    stream->puts(THEKERNEL->get_diagnose_string(since));
 }
 
 // sleep command
@@ -1398,6 +1480,93 @@ void SimpleShell::fset_command( string parameters, StreamOutput *stream)
     	}
     }
 }
+// print the step ticker ISR timing, -r resets it
+void SimpleShell::isr_command( string parameters, StreamOutput *stream )
+{
+    StepTicker *st = StepTicker::getInstance();
+    if (shift_parameter(parameters) == "-r") {
+        st->reset_stats();
+        stream->printf("ISR stats reset\n");
+        return;
+    }
+
+    const StepTicker::isr_stats_t &ss = st->get_step_stats();
+    const StepTicker::isr_stats_t &us = st->get_unstep_stats();
+    uint32_t budget = SystemCoreClock / st->get_frequency();
+    stream->printf("step_tick cycles min: %lu max: %lu avg: %lu, count: %lu\n", ss.count ? ss.min : 0, ss.max, ss.avg(), ss.count);
+    stream->printf("unstep_tick cycles min: %lu max: %lu avg: %lu, count: %lu\n", us.count ? us.min : 0, us.max, us.avg(), us.count);
+    stream->printf("cycles per tick: %lu, max load: %lu%%, overruns: %lu\n", budget, budget ? ss.max * 100 / budget : 0, st->get_overruns());
+}
+
+void SimpleShell::queue_command( string parameters, StreamOutput *stream )
+{
+    if (shift_parameter(parameters) == "-r") {
+        THECONVEYOR->start_queue_stats();
+        stream->printf("Queue stats reset\n");
+        return;
+    }
+    THECONVEYOR->print_queue_stats(stream);
+}
+
+// reads a job through the gcode parser and the time estimate the way the player would, nothing is queued
+// or moved, so it shows how fast this board can feed lines from the sd card: bench file
+// planning and starvation need the motion to run, the host simulator measures those
+void SimpleShell::bench_command( string parameters, StreamOutput *stream )
+{
+    string filename = absolute_from_relative(shift_parameter(parameters));
+    FILE *fp = fopen(filename.c_str(), "r");
+    if (fp == NULL) {
+        stream->printf("File not found: %s\r\n", filename.c_str());
+        return;
+    }
+
+    LineReader reader;
+    reader.attach(fp);
+    MotionEstimate estimate;
+    uint32_t heap_start = _sbrk(0), ahb_min = AHB.free();
+    uint32_t lines = 0, moves = 0, read_us = 0, idle_us = 0;
+    char buf[132];
+
+    uint32_t start = us_ticker_read();
+    while (true) {
+        uint32_t t = us_ticker_read();
+        char *s = reader.gets(buf, sizeof(buf));
+        read_us += us_ticker_read() - t;
+        if (s == nullptr) break;
+
+        size_t n = strlen(buf);
+        while (n > 0 && (buf[n - 1] == '\n' || buf[n - 1] == '\r' || buf[n - 1] == ' ')) buf[--n] = '\0';
+        if (n == 0 || buf[0] == ';' || buf[0] == '(') continue;
+
+        Gcode gc(buf, &StreamOutput::NullStream);
+        if (gc.has_g && gc.g <= 3) ++moves;
+        estimate.line(buf);
+        ++lines;
+
+        // the rest of the machine still needs looking after, but that is not part of the time
+        if ((lines & 63) == 0) {
+            t = us_ticker_read();
+            reader.prefetch();
+            THEKERNEL->call_event(ON_IDLE);
+            uint32_t f = AHB.free();
+            if (f < ahb_min) ahb_min = f;
+            idle_us += us_ticker_read() - t;
+        }
+    }
+    estimate.end();
+    uint32_t us = us_ticker_read() - start - idle_us;
+    reader.detach();
+    fclose(fp);
+
+    float secs = us / 1e6F;
+    unsigned long est = estimate.seconds();
+    stream->printf("%lu lines, %lu moves in %1.3f s, %1.0f lines/s, %1.0f moves/s\r\n", lines, moves, secs,
+                   secs > 0 ? lines / secs : 0, secs > 0 ? moves / secs : 0);
+    stream->printf("reading %lu%%, job estimate %02lu:%02lu:%02lu\r\n", us ? (uint32_t)((uint64_t)read_us * 100 / us) : 0,
+                   est / 3600, (est % 3600) / 60, est % 60);
+    stream->printf("heap grew %lu, AHB free min %lu\r\n", _sbrk(0) - heap_start, ahb_min);
+}
+
 // print out build version
 void SimpleShell::version_command( string parameters, StreamOutput *stream )
 {
@@ -1703,7 +1872,7 @@ void SimpleShell::get_command( string parameters, StreamOutput *stream)
 
     } else if (what == "status") {
         // also ? on serial and usb
-        stream->printf("%s\n", THEKERNEL->get_query_string().c_str());
+        stream->printf("%s\n", THEKERNEL->get_query_string(stream));
 
     } else if (what == "compensation") {
     	float mpos[3];
@@ -1835,27 +2004,61 @@ void SimpleShell::switch_command( string parameters, StreamOutput *stream)
     }
 }
 
+namespace {
+	// md5sum of a file, a few sectors each time round the main loop
+	class Md5SumTask : public Task {
+		public:
+			Md5SumTask(FILE *lp, const string &filename, StreamOutput *stream) : lp(lp), filename(filename), stream(stream)
+			{
+				// unbuffered whole sectors go from f_read() straight into the buffer
+				setvbuf(lp, NULL, _IONBF, 0);
+			}
+			~Md5SumTask() { fclose(lp); }
+
+		protected:
+			bool step()
+			{
+				uint8_t buf[512];
+				TASK_BEGIN();
+				while (!feof(lp) && !ferror(lp)) {
+					for (int i = 0; i < 4; ++i) {
+						size_t n= fread(buf, 1, sizeof buf, lp);
+						if(n > 0) md5.update(buf, n);
+						if(n < sizeof buf) break;
+					}
+					TASK_YIELD();
+				}
+				stream->printf("%s %s\n", md5.finalize().hexdigest().c_str(), filename.c_str());
+				TASK_END();
+			}
+
+		private:
+			FILE *lp;
+			string filename;
+			StreamOutput *stream;
+			MD5 md5;
+	};
+}
+
 void SimpleShell::md5sum_command( string parameters, StreamOutput *stream )
 {
 	string filename = absolute_from_relative(parameters);
 
+	// files that were uploaded had their md5 worked out as they were written
+	string digest;
+	if (load_file_digest(filename, digest)) {
+		stream->printf("%s %s\n", digest.c_str(), filename.c_str());
+		return;
+	}
+
 	// Open file
 	FILE *lp = fopen(filename.c_str(), "r");
 	if (lp == NULL) {
 		stream->printf("File not found: %s\r\n", filename.c_str());
 		return;
 	}
-	MD5 md5;
-	uint8_t buf[64];
-	do {
-		size_t n= fread(buf, 1, sizeof buf, lp);
-		if(n > 0) md5.update(buf, n);
-		THEKERNEL->call_event(ON_IDLE);
-	} while(!feof(lp));
-
-	stream->printf("%s %s\n", md5.finalize().hexdigest().c_str(), filename.c_str());
-	fclose(lp);
-
+	// a big file takes a while, it is read from the main loop rather than all at once here
+	Task::start(new Md5SumTask(lp, filename, stream));
 }
 
 // runs several types of test on the mechanisms
@@ -2036,10 +2239,8 @@ void SimpleShell::jog(string parameters, StreamOutput *stream)
     float scale= 1.0F;
     float fr= NAN;
     float delta[n_motors];
-    float delta_const[n_motors];
     for (int i = 0; i < n_motors; ++i) {
         delta[i]= 0;
-        delta_const[i]= 0;
     }
 
     // $J is first parameter
@@ -2150,13 +2351,15 @@ void SimpleShell::jog(string parameters, StreamOutput *stream)
     int min_axis = 0;
     int max_axis = 0;
 
-    float min_time= 0.05;
     if(cont_mode) {
         this->cont_mode_active = true;
-        // continuous jog mode
-        // calculate minimum distance to travel to accomodate acceleration and feedrate
+        // continuous jog mode, only the direction of each axis is used
+        for (int i = 0; i < n_motors; ++i) {
+            if(delta[i] != 0) delta[i]= delta[i] < 0 ? -1 : 1;
+        }
+        THEROBOT->rotate(&delta[0], &delta[1], &delta[2]);
+
         float acc= THEROBOT->get_default_acceleration();
-        
         // Validate acceleration value
         if(acc <= 0 || isnan(acc)) {
             stream->printf("error: Invalid acceleration value: %f\n", acc);
@@ -2164,160 +2367,38 @@ void SimpleShell::jog(string parameters, StreamOutput *stream)
             this->cont_mode_active = false;  // Reset flag before returning
             return;
         }
-        
-        float ta= fr/acc; // time to reach feed rate
-        float da= 0.5F * acc * powf(ta, 2); // distance required to accelerate (or decelerate)
-        float dc = min_time * fr;
-        if((da + dc)/ fr > 5) {
-            // increase feedrate so it will not take more than 5 seconds
-            fr= (da*3)/5;
-        }
-        
-
-        // we need to move at least this distance to reach full speed
-        for (int i = 0; i < n_motors; ++i) {
-            if(delta[i] != 0) {
-                delta[i]= da * (delta[i]<0?-1:1);
-                delta_const[i]= dc * (delta[i]<0?-1:1);
-            }
-        }
-        THEROBOT->rotate(&delta[0], &delta[1], &delta[2]);
-        THEROBOT->rotate(&delta_const[0], &delta_const[1], &delta_const[2]);
-        // stream->printf("distance: %f, time:%f, X%f Y%f Z%f, speed:%f\n", d, t, delta[0], delta[1], delta[2], fr);
-        // Check soft limits during continuous jogging
-        if(THEROBOT->is_soft_endstop_enabled()) {
-            bool move_to_min_limit = false;
-            bool move_to_max_limit = false;
-            float scale = 10000.0F;
-            // Check each axis that is homed
-            for (int i = 0; i <= Z_AXIS; ++i) {
-                if(!THEROBOT->is_homed(i)) continue;
-                
-                // Calculate distance to soft limits
-                dist_to_min[i] = (current_pos[i] - THEROBOT->get_soft_endstop_min(i));
-                dist_to_max[i] = (THEROBOT->get_soft_endstop_max(i) - current_pos[i]);
-                // If moving towards a limit and brake distance is greater than distance to limit
-                if(delta[i] < 0 && !isnan(THEROBOT->get_soft_endstop_min(i)) && 
-                    dist_to_min[i] <= fabs(2 * delta[i] + 2* delta_const[i])){
-                    if (scale > dist_to_min[i]/fabs(2 * delta[i] + 2 * delta_const[i])) {
-                        scale = dist_to_min[i]/fabs(2 * delta[i] + 2 * delta_const[i]);
-                    }
-                    if (dist_to_min[i] <= 0) {
-                        stream->printf("error:Soft Endstop %c would be exceeded - ignore jog command\n", i+'X');
-                        stream->printf("^Y\n");
-                        this->cont_mode_active = false;  // Reset flag before returning
-                        return;
-                    }
-                    move_to_min_limit = true;
-                }
-                if(delta[i] > 0 && !isnan(THEROBOT->get_soft_endstop_max(i)) && 
-                    dist_to_max[i] <= fabs(2 * delta[i] + 2 * delta_const[i])) {
-                    if (scale > dist_to_max[i]/fabs(2 * delta[i] + 2 * delta_const[i])) {
-                        scale = dist_to_max[i]/fabs(2 * delta[i] + 2 * delta_const[i]);
-                        stream->printf("scale[%d]: %f\n", i, scale);
-                    }
-                    if (dist_to_max[i] <= 0) {
-                        stream->printf("error:Soft Endstop %c would be exceeded - ignore jog command\n", i+'X');
-                        stream->printf("^Y\n");
-                        this->cont_mode_active = false;  // Reset flag before returning
-                        return;
-                    }
-                    move_to_max_limit = true;
-                }
-            }
-            if(move_to_min_limit || move_to_max_limit) {
-                for (int j = X_AXIS; j <= Z_AXIS; ++j) {
-                    delta[j] = (2 * delta[j] + 2 * delta_const[j]) * scale;
-                }
-                THEROBOT->delta_move(delta, fr, n_motors);
-                THECONVEYOR->wait_for_idle();
-                stream->printf("^Y\n");
-                this->cont_mode_active = false;  // Reset flag before returning
-                return;
-            }
+        if(fr <= 0 || isnan(fr)) {
+            stream->printf("error: Invalid jog rate: %f\n", fr);
+            stream->printf("^Y\n");
+            this->cont_mode_active = false;  // Reset flag before returning
+            return;
         }
 
         THECONVEYOR->wait_for_idle();
-        // turn off any compensation transform so Z does not move as we jog
-        //auto savect= THEROBOT->compensationTransform;
-        //THEROBOT->reset_compensated_machine_position();
-
-        // feed three blocks that allow full acceleration, full speed and full deceleration
-        THECONVEYOR->set_hold(true);
-        THEROBOT->delta_move(delta, fr, n_motors); // accelerates upto speed
-        THEROBOT->delta_move(delta_const, fr, n_motors); // continues at full speed
-        THEROBOT->delta_move(delta_const, fr, n_motors); // continues at full speed
-        THEROBOT->delta_move(delta, fr, n_motors); // decelerates to zero
-
-        // DEBUG
-        // THECONVEYOR->dump_queue();
-
-        // tell it to run the second block until told to stop
-        if(!THECONVEYOR->set_continuous_mode(true)) {
-            stream->printf("error:Not enough memory to run continuous mode\n");
-            THECONVEYOR->set_hold(false);
-            THECONVEYOR->flush_queue();
+
+        // keeps only the braking distance queued, so it stops within that once we stop feeding it
+        ContinuousJog jogger;
+        THECONVEYOR->set_continuous_mode(true);
+        if(!jogger.begin(delta, n_motors, fr)) {
+            THECONVEYOR->set_continuous_mode(false);
+            if(!THEKERNEL->is_halted()) THECONVEYOR->wait_for_idle();
+            stream->printf("error:Soft Endstop would be exceeded - ignore jog command\n");
             stream->printf("^Y\n");
             this->cont_mode_active = false;  // Reset flag before returning
             return;
         }
 
-        THECONVEYOR->set_hold(false);
-        THECONVEYOR->force_queue();
-
-        uint32_t last_block_time = us_ticker_read() / 1000;
-
         this->keep_alive_time = us_ticker_read() / 1000;
-        uint32_t block_interval_ms = (uint32_t)((ta + 0.5 *min_time) * 1000.0f);
-        float time_start_to_end_block = 0;
-        int stage = 0;
-        THECONVEYOR->set_continuous_mode(true);
-
         while(!THEKERNEL->get_stop_request() && !THEKERNEL->get_internal_stop_request()) {
-            
             // Check halt state FIRST - this prevents the loop from continuing when halted
             if(THEKERNEL->is_halted()) break;
-            
-            // Check soft limits during continuous jogging
-            if(THEROBOT->is_soft_endstop_enabled()) {
-                float current_pos[n_motors];
-                THEROBOT->get_current_machine_position(current_pos);
-
-                // Check each axis that is homed
-                for (int i = 0; i <= Z_AXIS; ++i) {
-                    if(!THEROBOT->is_homed(i)) continue;
-                    
-                    // Calculate distance to soft limits
-                    float dist_to_min = current_pos[i] - THEROBOT->get_soft_endstop_min(i);
-                    float dist_to_max = THEROBOT->get_soft_endstop_max(i) - current_pos[i];
-                    
-                    // If moving towards a limit and brake distance is greater than distance to limit
-                    if(delta[i] < 0 && !isnan(THEROBOT->get_soft_endstop_min(i)) && 
-                        dist_to_min <= fabs(2 * delta_const[i] + delta[i]) + 1) {
-                        THEKERNEL->set_internal_stop_request(true);
-                        break;
-                    }
-                    if(delta[i] > 0 && !isnan(THEROBOT->get_soft_endstop_max(i)) &&     
-                        dist_to_max <= fabs(2 * delta_const[i] + delta[i]) + 1) {
-                        THEKERNEL->set_internal_stop_request(true);
-                        break;
-                    }
-                }
-            }
-            // Add another coasting block every block_interval_ms milliseconds
-            uint32_t current_time = us_ticker_read() / 1000;
-            if(current_time - last_block_time >= block_interval_ms && !THEKERNEL->get_internal_stop_request()) {
-                // Calculate time for this block before updating last_block_time
-                
-                THEROBOT->delta_move(delta_const, fr, n_motors);
-                if(stage == 0) {
-                    time_start_to_end_block = current_time - last_block_time;
-                    block_interval_ms = (uint32_t)((min_time) * 1000.0f);
-                    stage++;
-                }
-                last_block_time = current_time;
+
+            // the last block queued ends on a soft endstop, let it run out
+            if(!jogger.feed()) {
+                THEKERNEL->set_internal_stop_request(true);
+                break;
             }
-            
+
             THEKERNEL->call_event(ON_IDLE);
 
             if(THEKERNEL->get_keep_alive_request()) {
@@ -2329,14 +2410,13 @@ void SimpleShell::jog(string parameters, StreamOutput *stream)
         }
         THECONVEYOR->set_continuous_mode(false);
         THEKERNEL->set_stop_request(false);
+        // what is left on the queue is already planned to come to a stop
         if (!THEKERNEL->is_halted()) {
             THECONVEYOR->wait_for_idle();
         }
 
         // reset the position based on current actuator position
         THEROBOT->reset_position_from_current_actuator_position();
-        // restore compensationTransform
-        //THEROBOT->compensationTransform= savect;
         stream->printf("^Y\n");
         this->cont_mode_active = false;
     }else{
@@ -2398,16 +2478,22 @@ void SimpleShell::help_command( string parameters, StreamOutput *stream )
     stream->printf("Commands:\r\n");
     stream->printf("version\r\n");
     stream->printf("mem [-v]\r\n");
-    stream->printf("ls [-s] [-e] [folder]\r\n");
+    stream->printf("boot - where the time went while booting\r\n");
+    stream->printf("irq - interrupt priorities, configured and in effect\r\n");
+    stream->printf("trace on [entries] | off | dump - timeline of blocks, lines, reads and waits\r\n");
+    stream->printf("counters [reset] - the running counts as JSON\r\n");
+    stream->printf("ls [-s] [-b] [-e] [-u<gen>] [-o<offset>] [-n<count>] [folder]\r\n");
     stream->printf("cd folder\r\n");
     stream->printf("pwd\r\n");
     stream->printf("cat file [limit] [-e] [-d 10]\r\n");
     stream->printf("rm file [-e]\r\n");
     stream->printf("mv file newfile [-e]\r\n");
     stream->printf("remount\r\n");
-    stream->printf("play file [-v]\r\n");
+    stream->printf("play file [-v] [-c] - -c carries on from where a halt stopped the file\r\n");
     stream->printf("progress - shows progress of current play\r\n");
     stream->printf("abort - abort currently playing file\r\n");
+    stream->printf("queue [file|next|clear] - jobs to play one after another, the next is prepared while one plays\r\n");
+    stream->printf("buffer [-i] command - run command between the lines of the playing file, -i on the next pass even if suspended\r\n");
     stream->printf("reset - reset smoothie\r\n");
     stream->printf("dfu - enter dfu boot loader\r\n");
     stream->printf("break - break into debugger\r\n");
@@ -2420,13 +2506,62 @@ void SimpleShell::help_command( string parameters, StreamOutput *stream )
     stream->printf("net\r\n");
     stream->printf("ap [channel]\r\n");
     stream->printf("wlan [ssid] [password] [-d] [-e]\r\n");
-    stream->printf("diagnose\r\n");
+    stream->printf("diagnose [seq] - only what changed since the report with N:seq\r\n");
     stream->printf("load [file] - loads a configuration override file from soecified name or config-override\r\n");
     stream->printf("save [file] - saves a configuration override file as specified filename or as config-override\r\n");
     stream->printf("upload filename - saves a stream of text to the named file\r\n");
     stream->printf("calc_thermistor [-s0] T1,R1,T2,R2,T3,R3 - calculate the Steinhart Hart coefficients for a thermistor\r\n");
     stream->printf("thermistors - print out the predefined thermistors\r\n");
     stream->printf("md5sum file - prints md5 sum of the given file\r\n");
+    stream->printf("isr [-r] - prints the step ticker ISR cycles and overruns, -r resets them\r\n");
+    stream->printf("queue [-r] - prints the planner queue depth and starvation of the last or current job, -r resets them\r\n");
+    stream->printf("bench file - reads the file through the gcode parser and time estimate without moving, prints how fast it went\r\n");
+}
+
+// key=value for each setting in the file, read in blocks and sent in blocks rather than a character and a printf at a
+// time. Lines are cut where the config reader cuts them, see FileConfigSource::readLine()
+static void send_config_lines(FILE *lp, StreamOutput *stream)
+{
+    char in[512], line[132], out[256];
+    size_t len = 0, n = 0, got;
+    bool more = true;
+
+    while (more) {
+        got = fread(in, 1, sizeof(in), lp);
+        more = got > 0;
+        // the last line counts even without a newline
+        if (!more && len > 0) in[got++] = '\n';
+        for (size_t i = 0; i < got; i++) {
+            if (in[i] != '\n') {
+                if (len < sizeof(line) - 1) line[len++] = in[i];
+                continue;
+            }
+            line[len] = '\0';
+            len = 0;
+
+            const char *key = line + strspn(line, " \t");
+            if (*key == '\0' || *key == '#' || *key == '\r') continue;
+            size_t key_len = strcspn(key, " \t");
+            if (key[key_len] == '\0') continue;
+            const char *value = key + key_len + strspn(key + key_len, " \t");
+            if (*value == '\0' || *value == '#') continue;
+            size_t value_len = 1 + strcspn(value + 1, "\r\n# \t");
+
+            if (n + key_len + value_len + 2 > sizeof(out)) {
+                stream->puts(out, n);
+                n = 0;
+                // we need to kick things or they die
+                THEKERNEL->call_event(ON_IDLE);
+            }
+            memcpy(&out[n], key, key_len);
+            n += key_len;
+            out[n++] = '=';
+            memcpy(&out[n], value, value_len);
+            n += value_len;
+            out[n++] = '\n';
+        }
+    }
+    if (n > 0) stream->puts(out, n);
 }
 
 // output all configs
@@ -2445,54 +2580,13 @@ void SimpleShell::config_get_all_command( string parameters, StreamOutput *strea
         }
     }
 
-    string buffer;
-    string key, value;
-    int c;
-	size_t begin_key, end_key, end_value, vsize;
     // Open the config file ( find it if we haven't already found it )
-	FILE *lp = fopen(filename.c_str(), "r");
+    FILE *lp = fopen(filename.c_str(), "r");
     if (lp == NULL) {
         stream->printf("Config file not found: %s\r\n", filename.c_str());
         return;
     }
-	while ((c = fgetc (lp)) != EOF) {
-		buffer.append((char *)&c, 1);
-		if (c == '\n') {
-			// process and send key=value data
-		    if( buffer.length() < 3 ) {
-		    	buffer.clear();
-		        continue;
-		    }
-		    begin_key = buffer.find_first_not_of(" \t");
-		    if (begin_key == string::npos || buffer[begin_key] == '#') {
-		    	buffer.clear();
-		    	continue;
-		    }
-		    end_key = buffer.find_first_of(" \t", begin_key);
-		    if(end_key == string::npos) {
-		    	buffer.clear();
-		        continue;
-		    }
-
-		    size_t begin_value = buffer.find_first_not_of(" \t", end_key);
-		    if(begin_value == string::npos || buffer[begin_value] == '#') {
-		    	buffer.clear();
-		    	continue;
-		    }
-
-		    key = buffer.substr(begin_key,  end_key - begin_key);
-		    end_value = buffer.find_first_of("\r\n# \t", begin_value + 1);
-		    vsize = (end_value == string::npos) ? end_value : end_value - begin_value;
-		    value = buffer.substr(begin_value, vsize);
-
-		    stream->printf("%s=%s\n", key.c_str(), value.c_str());
-
-			buffer.clear();
-			// we need to kick things or they die
-			THEKERNEL->call_event(ON_IDLE);
-		}
-	}
-
+    send_config_lines(lp, stream);
     fclose(lp);
 
     if(send_eof) {
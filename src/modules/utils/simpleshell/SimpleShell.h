@@ -53,10 +53,17 @@ private:
     static void calc_thermistor_command( string parameters, StreamOutput *stream);
     static void print_thermistors_command( string parameters, StreamOutput *stream);
     static void md5sum_command( string parameters, StreamOutput *stream);
+    static void isr_command( string parameters, StreamOutput *stream);
+    static void bench_command( string parameters, StreamOutput *stream);
+    static void queue_command( string parameters, StreamOutput *stream);
     static void grblDP_command( string parameters, StreamOutput *stream);
 
     static void switch_command(string parameters, StreamOutput *stream );
     static void mem_command(string parameters, StreamOutput *stream );
+    static void boot_command(string parameters, StreamOutput *stream );
+    static void irq_command(string parameters, StreamOutput *stream );
+    static void trace_command(string parameters, StreamOutput *stream );
+    static void counters_command(string parameters, StreamOutput *stream );
 
     static void net_command( string parameters, StreamOutput *stream);
     static void ap_command( string parameters, StreamOutput *stream);
@@ -17,6 +17,7 @@
 #include "brd_cfg.h"
 #include "M8266WIFIDrv.h"
 #include "M8266HostIf.h"
+#include "Gpdma.h"
 
 /***********************************************************************************
  * M8266HostIf_GPIO_SPInCS_nRESET_Pin_Init                                         *
@@ -107,19 +108,13 @@ void M8266HostIf_SPI_SetSpeed(u32 SPI_BaudRatePrescaler) // SPI_BaudRatePrescale
 #ifdef M8266WIFI_SPI_ACCESS_USE_DMA
 void M8266HostIf_SPI_DMA_Init(void)
 {
-
-	LPC_SC->PCONP  |= ((uint32_t)1 << 29);    				 // enable the GPDMA function power/clock
-	LPC_GPDMA->DMACIntTCClear   |=                     // DMA Interrupt Terminal Count Request Clear register
-									    (1<<((M8266WIFI_INTERFACE_SPI_RX_DMA_STREAM-LPC_GPDMACH0)>>5))
-										 |(1<<((M8266WIFI_INTERFACE_SPI_TX_DMA_STREAM-LPC_GPDMACH0)>>5));
-	LPC_GPDMA->DMACIntErrClr   |=                       // DMA Interrupt Error Clear register
-									    (1<<((M8266WIFI_INTERFACE_SPI_RX_DMA_STREAM-LPC_GPDMACH0)>>5))
-										 |(1<<((M8266WIFI_INTERFACE_SPI_TX_DMA_STREAM-LPC_GPDMACH0)>>5));
-
-	LPC_GPDMA->DMACConfig    =
-											(1<<0) 		// enable DMA
-										 |(0<<1)		// using little-endian mode
-										 ;
+	// powers up and enables the GPDMA and clears our channels' status, leaving the SD card's channels alone
+	if (!Gpdma::claim( M8266WIFI_DMA_CHANNEL_BIT(M8266WIFI_INTERFACE_SPI_RX_DMA_STREAM)
+	                  |M8266WIFI_DMA_CHANNEL_BIT(M8266WIFI_INTERFACE_SPI_TX_DMA_STREAM)))
+	{
+		M8266WIFI_INTERFACE_SPI->DMACR = 0;            // channels taken, stay on programmed I/O
+		return;
+	}
 
 	// Set DMA Channel for SPI RX
 	M8266WIFI_INTERFACE_SPI_RX_DMA_STREAM->DMACCLLI   = 0;
@@ -29,6 +29,10 @@
 #include "SwitchPublicAccess.h"
 #include "WifiPublicAccess.h"
 #include "libs/utils.h"
+#include "libs/SlowTicker.h"
+#include "libs/StepTicker.h"
+#include "StepperMotor.h"
+#include "SpindlePublicAccess.h"
 
 #include "libs/SerialMessage.h"
 #include "libs/StreamOutput.h"
@@ -37,10 +41,16 @@
 
 #include "port_api.h"
 #include "InterruptIn.h"
+#include "IrqPriority.h"
+#include "EventTrace.h"
+#include "Counters.h"
 
 #include "gpio.h"
+#include "us_ticker_api.h"
 
 #include <math.h>
+#include <strings.h>
+#include <algorithm>
 
 #define wifi_checksum                     CHECKSUM("wifi")
 #define wifi_enable                       CHECKSUM("enable")
@@ -50,6 +60,9 @@
 #define udp_send_port_checksum		      CHECKSUM("udp_send_port")
 #define udp_recv_port_checksum		      CHECKSUM("udp_recv_port")
 #define tcp_timeout_s_checksum			  CHECKSUM("tcp_timeout_s")
+#define auto_report_ms_checksum			  CHECKSUM("auto_report_ms")
+#define telemetry_hz_checksum			  CHECKSUM("telemetry_hz")
+#define telemetry_port_checksum			  CHECKSUM("telemetry_port")
 
 
 WifiProvider::WifiProvider()
@@ -58,7 +71,24 @@ WifiProvider::WifiProvider()
 	udp_link_no = 1;
 	wifi_init_ok = false;
 	has_data_flag = false;
+	auto_report_flag = false;
+	telemetry_flag = false;
+	has_client = false;
+	primary_ip[0] = '\0';
+	primary_port = 0;
+	primary_level = WIFI_SUB_FULL;
+	rx_bytes = 0;
+	tx_bytes = 0;
+	for (int i = 0; i < WIFI_MAX_MONITORS; i++) {
+		monitors[i].provider = this;
+	}
+	telemetry_last_us = 0;
+	telemetry_last_cycles = 0;
 	connection_fail_count = 0;
+	tx_len = 0;
+	init_state = WIFI_INIT_DONE;
+	init_step_us = 0;
+	init_wait_us = 0;
 }
 
 void WifiProvider::on_module_loaded()
@@ -69,6 +99,9 @@ void WifiProvider::on_module_loaded()
         return;
     }
 
+	Counters::add("wifi_rx_bytes", &rx_bytes);
+	Counters::add("wifi_tx_bytes", &tx_bytes);
+
 	this->tcp_port = THEKERNEL->config->value(wifi_checksum, tcp_port_checksum)->by_default(2222)->as_int();
 	this->udp_send_port = THEKERNEL->config->value(wifi_checksum, udp_send_port_checksum)->by_default(3333)->as_int();
 	this->udp_recv_port = THEKERNEL->config->value(wifi_checksum, udp_recv_port_checksum)->by_default(4444)->as_int();
@@ -77,9 +110,6 @@ void WifiProvider::on_module_loaded()
     strncpy(this->machine_name, config_name.c_str(), sizeof(this->machine_name) - 1);
     this->machine_name[sizeof(this->machine_name) - 1] = '\0'; // Ensure null termination
 
-    // Init Wifi Module
-    this->init_wifi_module(false);
-
     // Add interrupt for WIFI data receving
     Pin *smoothie_pin = new(AHB) Pin();
     smoothie_pin->from_string(THEKERNEL->config->value(wifi_checksum, wifi_interrupt_pin_checksum)->by_default("2.11")->as_string());
@@ -88,7 +118,7 @@ void WifiProvider::on_module_loaded()
         PinName pinname = port_pin((PortName)smoothie_pin->port_number, smoothie_pin->pin);
         wifi_interrupt_pin = new(AHB) mbed::InterruptIn(pinname);
         wifi_interrupt_pin->rise(this, &WifiProvider::on_pin_rise);
-        NVIC_SetPriority(EINT3_IRQn, 16);
+        IrqPriority::apply(EINT3_IRQn);
     } else {
         THEKERNEL->streams->printf("Error: Wifi interrupt pin has to be on P0 or P2.\n");
         delete this;
@@ -96,13 +126,26 @@ void WifiProvider::on_module_loaded()
     }
     delete smoothie_pin;
 
-    // Add to the pack of streams kernel can call to, for example for broadcasting
-    THEKERNEL->streams->append_stream(this);
+    // the module is reset and set up from on_idle, it joins the streams when it is ready
+    this->init_wifi_module(false);
 
     query_flag = false;
     diagnose_flag = false;
     halt_flag = false;
 
+    // push the status to the client while the machine moves instead of waiting for it to ask, 0 to disable
+    int auto_report_ms = THEKERNEL->config->value(wifi_checksum, auto_report_ms_checksum)->by_default(0)->as_int();
+    if (auto_report_ms > 0) {
+        THEKERNEL->slow_ticker->attach(std::max(1, 1000 / auto_report_ms), this, &WifiProvider::auto_report_tick);
+    }
+
+    // binary telemetry to the connected client over UDP, 0 to disable
+    int telemetry_hz = THEKERNEL->config->value(wifi_checksum, telemetry_hz_checksum)->by_default(0)->as_int();
+    this->telemetry_port = THEKERNEL->config->value(wifi_checksum, telemetry_port_checksum)->by_default(5555)->as_int();
+    if (telemetry_hz > 0) {
+        THEKERNEL->slow_ticker->attach(std::min(telemetry_hz, 50), this, &WifiProvider::telemetry_tick);
+    }
+
 	this->register_for_event(ON_IDLE);
     this->register_for_event(ON_GCODE_RECEIVED);
     this->register_for_event(ON_MAIN_LOOP);
@@ -117,21 +160,237 @@ void WifiProvider::on_pin_rise()
 	has_data_flag = true;
 }
 
+// called by the slow ticker, the report itself is sent from on_idle
+uint32_t WifiProvider::auto_report_tick(uint32_t)
+{
+	auto_report_flag = true;
+	return 0;
+}
+
+uint32_t WifiProvider::telemetry_tick(uint32_t)
+{
+	telemetry_flag = true;
+	return 0;
+}
+
+// one datagram with what a monitor wants to graph, so it does not have to poll and parse the status report on the command link
+void WifiProvider::send_telemetry()
+{
+	telemetry_packet_t p;
+	p.magic[0] = 'C';
+	p.magic[1] = 'T';
+	p.version = TELEMETRY_VERSION;
+	p.state = THEKERNEL->get_state();
+	uint32_t now = us_ticker_read();
+	p.ms = now / 1000;
+
+	THEROBOT->get_current_machine_position(p.mpos);
+	if (THEROBOT->compensationTransform) THEROBOT->compensationTransform(p.mpos, true, false);
+	for (int i = A_AXIS; i <= B_AXIS; i++) {
+		p.mpos[i] = i < THEROBOT->get_number_registered_motors() ? THEROBOT->actuators[i]->get_current_position() : 0;
+	}
+	p.feed = THECONVEYOR->get_current_feedrate() * 60.0F;
+
+	struct spindle_status ss;
+	if (PublicData::get_value(pwm_spindle_control_checksum, get_spindle_status_checksum, &ss)) {
+		p.spindle_rpm = ss.current_rpm;
+		p.spindle_pwm = ss.current_pwm_value;
+	} else {
+		p.spindle_rpm = p.spindle_pwm = 0;
+	}
+
+	p.planner_used = std::min(255U, THECONVEYOR->queue_used());
+	p.planner_free = std::min(255U, THECONVEYOR->queue_free());
+
+	// step and unstep ISR cycles since the last packet against the cycles that went by
+	StepTicker *st = StepTicker::getInstance();
+	__disable_irq();
+	uint64_t cycles = st->get_step_stats().total + st->get_unstep_stats().total;
+	__enable_irq();
+	uint32_t elapsed = now - telemetry_last_us;
+	if (telemetry_last_us == 0 || cycles < telemetry_last_cycles || elapsed == 0) {
+		p.isr_load = 0; // first one or the stats were reset
+	} else {
+		p.isr_load = std::min<uint64_t>(1000, (cycles - telemetry_last_cycles) * 1000 / ((uint64_t)elapsed * (SystemCoreClock / 1000000)));
+	}
+	telemetry_last_us = now;
+	telemetry_last_cycles = cycles;
+
+	// to the monitors that want it, and the primary as well if it wants it and there are none
+	u16 status = 0;
+	bool sent = false;
+	for (int i = 0; i < WIFI_MAX_MONITORS; i++) {
+		if (monitors[i].in_use && monitors[i].level >= WIFI_SUB_STATUS) {
+			M8266WIFI_SPI_Send_Udp_Data((u8 *)&p, sizeof(p), udp_link_no, monitors[i].ip, this->telemetry_port, &status);
+			sent = true;
+		}
+	}
+	if (!sent && primary_ip[0] != '\0' && primary_level >= WIFI_SUB_STATUS) {
+		M8266WIFI_SPI_Send_Udp_Data((u8 *)&p, sizeof(p), udp_link_no, primary_ip, this->telemetry_port, &status);
+	}
+}
+
+bool WifiProvider::is_primary(const char *ip, u16 port) const
+{
+	return primary_ip[0] == '\0' || (port == primary_port && strcmp(ip, primary_ip) == 0);
+}
+
+// the monitor for a client, a new one is taken if it has none yet, nullptr if they are all in use
+WifiMonitorStream *WifiProvider::find_monitor(const char *ip, u16 port)
+{
+	WifiMonitorStream *free_monitor = nullptr;
+	for (int i = 0; i < WIFI_MAX_MONITORS; i++) {
+		WifiMonitorStream *m = &monitors[i];
+		if (m->in_use && m->port == port && strcmp(m->ip, ip) == 0) return m;
+		if (!m->in_use && free_monitor == nullptr) free_monitor = m;
+	}
+	if (free_monitor != nullptr) {
+		strncpy(free_monitor->ip, ip, sizeof(free_monitor->ip) - 1);
+		free_monitor->ip[sizeof(free_monitor->ip) - 1] = '\0';
+		free_monitor->port = port;
+		free_monitor->line_len = 0;
+		free_monitor->query_flag = false;
+		free_monitor->level = WIFI_SUB_NONE;
+		free_monitor->in_use = true;
+		set_monitor_level(free_monitor, WIFI_SUB_STATUS);
+	}
+	return free_monitor;
+}
+
+// only a full subscription is in the kernel's pool of streams and gets everything broadcast
+void WifiProvider::set_monitor_level(WifiMonitorStream *m, uint8_t level)
+{
+	if (m->level == WIFI_SUB_FULL && level != WIFI_SUB_FULL) {
+		THEKERNEL->streams->remove_stream(m);
+	} else if (m->level != WIFI_SUB_FULL && level == WIFI_SUB_FULL) {
+		THEKERNEL->streams->append_stream(m);
+	}
+	m->level = level;
+}
+
+// $SUB=full, $SUB=status or $SUB=none, returns false if the line is not one of them
+static bool parse_subscription(const char *line, uint8_t &level)
+{
+	if (strncasecmp(line, "$SUB=", 5) != 0) return false;
+	const char *v = line + 5;
+	if (strcasecmp(v, "full") == 0) {
+		level = WIFI_SUB_FULL;
+	} else if (strcasecmp(v, "status") == 0) {
+		level = WIFI_SUB_STATUS;
+	} else if (strcasecmp(v, "none") == 0) {
+		level = WIFI_SUB_NONE;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+// a monitor can only ask for the status and set what it is sent, anything else it sends is refused
+void WifiProvider::monitor_data(WifiMonitorStream *m, const u8 *data, u16 len)
+{
+	for (u16 i = 0; i < len; i++) {
+		char c = data[i];
+		if (c == '?') {
+			m->query_flag = true;
+			continue;
+		}
+		if (c != '\n' && c != '\r') {
+			if (m->line_len < sizeof(m->line) - 1) m->line[m->line_len++] = c;
+			continue;
+		}
+		if (m->line_len == 0) continue;
+
+		m->line[m->line_len] = '\0';
+		m->line_len = 0;
+		uint8_t level;
+		if (parse_subscription(m->line, level)) {
+			set_monitor_level(m, level);
+			m->puts("ok\n");
+		} else {
+			m->puts("error:Only the first client can send commands\n");
+		}
+	}
+}
+
+// forget the primary and the monitors that are no longer connected, the next client to send anything becomes the primary
+void WifiProvider::drop_clients(const ClientInfo clients[], u8 client_num)
+{
+	char ip[16];
+	bool primary_found = false;
+	bool found[WIFI_MAX_MONITORS] = {false};
+	for (u8 n = 0; n < client_num; n++) {
+		snprintf(ip, sizeof(ip), "%d.%d.%d.%d", clients[n].remote_ip[0], clients[n].remote_ip[1], clients[n].remote_ip[2], clients[n].remote_ip[3]);
+		if (clients[n].remote_port == primary_port && strcmp(ip, primary_ip) == 0) primary_found = true;
+		for (int i = 0; i < WIFI_MAX_MONITORS; i++) {
+			if (monitors[i].in_use && clients[n].remote_port == monitors[i].port && strcmp(ip, monitors[i].ip) == 0) found[i] = true;
+		}
+	}
+
+	if (!primary_found) {
+		primary_ip[0] = '\0';
+		primary_port = 0;
+		primary_level = WIFI_SUB_FULL;
+	}
+	for (int i = 0; i < WIFI_MAX_MONITORS; i++) {
+		if (monitors[i].in_use && !found[i]) {
+			set_monitor_level(&monitors[i], WIFI_SUB_NONE);
+			monitors[i].in_use = false;
+		}
+	}
+}
+
+// what is sent to a monitor is not buffered and is dropped if the module is busy
+int WifiProvider::send_monitor(WifiMonitorStream *m, const char *s, int size)
+{
+	if (!wifi_init_ok) return 0;
+	u16 status = 0;
+	return M8266WIFI_SPI_Send_BlockData((u8 *)s, size, WIFI_TX_IDLE_LOOPS, tcp_link_no, m->ip, m->port, &status);
+}
+
+int WifiMonitorStream::puts(const char *s, int size)
+{
+	if (provider == nullptr || !in_use) return 0;
+	return provider->send_monitor(this, s, size == 0 ? strlen(s) : size);
+}
+
 void WifiProvider::receive_wifi_data() {
 	u8 link_no;
 	u16 received = 0;
 	u16 status;
+	u8 remote_ip[4];
+	u16 remote_port = 0;
+	char ip[16];
 
 	while (true)
 	{
-		received = M8266WIFI_SPI_RecvData(WifiData, WIFI_DATA_MAX_SIZE, WIFI_DATA_TIMEOUT_MS, &link_no, &status);
+		EventTrace::begin(EventTrace::WIFI_RX);
+		received = M8266WIFI_SPI_RecvData_ex(WifiData, WIFI_DATA_MAX_SIZE, WIFI_DATA_TIMEOUT_MS, &link_no, remote_ip, &remote_port, &status);
+		EventTrace::end(EventTrace::WIFI_RX, received);
+		rx_bytes += received;
 		if (link_no == udp_link_no) {
 			return;
 		}
+		if (received > 0) {
+			snprintf(ip, sizeof(ip), "%d.%d.%d.%d", remote_ip[0], remote_ip[1], remote_ip[2], remote_ip[3]);
+			if (primary_ip[0] == '\0') {
+				strcpy(primary_ip, ip);
+				primary_port = remote_port;
+			} else if (!is_primary(ip, remote_port)) {
+				WifiMonitorStream *m = find_monitor(ip, remote_port);
+				if (m != nullptr) monitor_data(m, WifiData, received);
+				if (received < WIFI_DATA_MAX_SIZE) {
+					return;
+				}
+				continue;
+			}
+		}
 		for (int i = 0; i < received; i ++) {
 			if(THEKERNEL->is_cachewait()) {
 				continue;
 			}
+			if(WifiData[i] >= 0x90 && THEROBOT != nullptr && THEROBOT->realtime_override(WifiData[i])) {
+				continue;
+			}
 	        // Check for "?1" pattern
 			if (i < received - 1 && WifiData[i] == '?' && WifiData[i + 1] == '1') {
 				query_flag = true;
@@ -177,7 +436,7 @@ void WifiProvider::receive_wifi_data() {
 //	        	received = '\n';
 				WifiData[i] = '\n';
 	        }
-	        this->buffer.push_back(char(WifiData[i]));
+	        this->buffer.put(char(WifiData[i]));
 		}
 		if (received < WIFI_DATA_MAX_SIZE) {
 			return;
@@ -186,6 +445,7 @@ void WifiProvider::receive_wifi_data() {
 }
 
 bool WifiProvider::ready() {
+	if (tx_len > 0) flush_tx(WIFI_TX_BLOCK_LOOPS);
 	return M8266WIFI_SPI_Has_DataReceived();
 }
 
@@ -224,7 +484,10 @@ void WifiProvider::on_second_tick(void *)
 
 	if (!wifi_init_ok || THEKERNEL->is_uploading()) return;
 
-	M8266WIFI_SPI_List_Clients_On_A_TCP_Server(tcp_link_no, &client_num, RemoteClients, &status);
+	if (M8266WIFI_SPI_List_Clients_On_A_TCP_Server(tcp_link_no, &client_num, RemoteClients, &status)) {
+		drop_clients(RemoteClients, client_num);
+	}
+	has_client = client_num > 0;
 
 	M8266WIFI_SPI_Get_STA_Connection_Status(&connection_status, &status);
 	// THEKERNEL->streams->printf("M8266WIFI_SPI_Get_STA_Connection_Status: [%d]!\n", connection_status);
@@ -314,6 +577,14 @@ void WifiProvider::on_second_tick(void *)
 
 void WifiProvider::on_idle(void *argument)
  {
+	if (init_state != WIFI_INIT_DONE) {
+		step_wifi_init();
+		return;
+	}
+
+	// whatever was written since the last newline goes out now, but do not wait long for the module
+	if (tx_len > 0) flush_tx(WIFI_TX_IDLE_LOOPS);
+
 	if (THEKERNEL->is_uploading()) return;
 
 	if (has_data_flag || M8266WIFI_SPI_Has_DataReceived()) {
@@ -321,14 +592,44 @@ void WifiProvider::on_idle(void *argument)
 		receive_wifi_data();
 	}
 
+    if (telemetry_flag) {
+        telemetry_flag = false;
+        if (has_client) send_telemetry();
+    }
+
+    if (auto_report_flag) {
+        auto_report_flag = false;
+        // only while the position is changing, and not as well as a query that is about to be answered
+        uint8_t state = THEKERNEL->get_state();
+        if (has_client && (state == RUN || state == HOME)) {
+            if (!query_flag && primary_level >= WIFI_SUB_STATUS) {
+                puts(THEKERNEL->get_query_string(this));
+            }
+            for (int i = 0; i < WIFI_MAX_MONITORS; i++) {
+                WifiMonitorStream *m = &monitors[i];
+                if (m->in_use && !m->query_flag && m->level >= WIFI_SUB_STATUS) {
+                    m->puts(THEKERNEL->get_query_string(m));
+                }
+            }
+        }
+    }
+
     if (query_flag) {
         query_flag = false;
-        puts(THEKERNEL->get_query_string().c_str());
+        puts(THEKERNEL->get_query_string(this));
+    }
+
+    for (int i = 0; i < WIFI_MAX_MONITORS; i++) {
+        WifiMonitorStream *m = &monitors[i];
+        if (m->in_use && m->query_flag) {
+            m->query_flag = false;
+            m->puts(THEKERNEL->get_query_string(m));
+        }
     }
 
     if (diagnose_flag) {
     	diagnose_flag = false;
-    	puts(THEKERNEL->get_diagnose_string().c_str(), 0);
+    	puts(THEKERNEL->get_diagnose_string(), 0);
     }
 
     if (halt_flag) {
@@ -345,82 +646,138 @@ void WifiProvider::on_idle(void *argument)
 
 void WifiProvider::on_main_loop(void *argument)
 {
-    if( this->has_char('\n') ){
-        string received;
-        received.reserve(20);
-        while(1){
-           char c;
-           this->buffer.pop_front(c);
-           if( c == '\n' ){
-                struct SerialMessage message;
-                message.message = received;
-                message.stream = this;
-                THEKERNEL->call_event(ON_CONSOLE_LINE_RECEIVED, &message );
-                return;
-            }else{
-                received += c;
+    if( this->buffer.has_line() ){
+        // a streamed job arrives many lines to a packet, so take several a pass while the planner has room for
+        // them rather than one each time round the main loop
+        for (int n = 0; n < WIFI_RX_LINES_PER_LOOP && this->buffer.has_line(); n++) {
+            if (n > 0 && THECONVEYOR->queue_free() == 0) break;
+            string received;
+            received.reserve(20);
+            this->buffer.get_line(received);
+            uint8_t level;
+            if (parse_subscription(received.c_str(), level)) {
+                // only stops the status being pushed to the primary, it always gets the answers to what it sends
+                primary_level = level;
+                puts("ok\n");
+                continue;
             }
+            struct SerialMessage message;
+            message.message = received;
+            message.stream = this;
+            THEKERNEL->call_event(ON_CONSOLE_LINE_RECEIVED, &message );
         }
+    }else if( this->buffer.overflowed() ){
+        // the line is longer than the buffer, it would never complete
+        this->buffer.flush();
     }
 }
 
+// Send what has been collected in tx_data, anything the module would not take stays there for the next try
+// returns false if some is still waiting
+bool WifiProvider::flush_tx(u16 max_loops)
+{
+	if (tx_len == 0) return true;
+
+	u16 status = 0;
+	u32 sent = M8266WIFI_SPI_Send_BlockData(tx_data, tx_len, max_loops, tcp_link_no, primary_remote(), primary_port, &status);
+	tx_bytes += sent;
+	if (sent >= tx_len) {
+		tx_len = 0;
+		return true;
+	}
+
+	u8 errcode = status & 0xff;
+	if (errcode != 0x10 && errcode != 0x11) {
+		// not just busy, the link is gone or broken so there is nobody to send it to
+		tx_len = 0;
+		return true;
+	}
+
+	memmove(tx_data, tx_data + sent, tx_len - sent);
+	tx_len -= sent;
+	return false;
+}
+
+// Small writes are collected and sent as one packet on a newline, when the buffer fills or on idle,
+// instead of an SPI transaction each for every fragment of a printf or every _putc
 int WifiProvider::puts(const char* s, int size)
 {
 	size_t total_length = size == 0 ? strlen(s) : size;
-    size_t sent_index = 0;
-	u16 status = 0;
-	u32 sent = 0;
-	u32 to_send = 0;
-    while (sent_index < total_length) {
-    	to_send = total_length - sent_index > WIFI_DATA_MAX_SIZE ? WIFI_DATA_MAX_SIZE : total_length - sent_index;
-    	memcpy(WifiData, s + sent_index, to_send);
-		// errcode:
-		// 	0x13: Wrong link_no used
-		// 	0x14: connection by link_no not present
-		// 	0x15: connection by link_no closed
-		// 	0x18: No clients connecting to this TCP server
-		// 	0x1E: too many errors ecountered during sending can not fixed
-		// 	0x1F: Other errors
-    	sent = M8266WIFI_SPI_Send_BlockData(WifiData, to_send, 5000, tcp_link_no, NULL, 0, &status);
-    	sent_index += sent;
-		if (sent == to_send) {
-			continue;
-		} else {
-    		break;
+	if (tx_len + total_length <= WIFI_TX_BUFFER_SIZE) {
+		memcpy(tx_data + tx_len, s, total_length);
+		tx_len += total_length;
+		if (tx_len == WIFI_TX_BUFFER_SIZE || (total_length > 0 && s[total_length - 1] == '\n')) {
+			flush_tx(WIFI_TX_BLOCK_LOOPS);
 		}
-    }
-    return sent_index;
+		return total_length;
+	}
+
+	// too big to collect, send what is waiting first to keep the order then send this directly
+	if (!flush_tx(WIFI_TX_BLOCK_LOOPS)) {
+		return 0;
+	}
+
+	// straight from the caller's buffer, the block send splits it into packets itself and keeps
+	// the module's send window full, so a download packet is not copied through WifiData a piece at a time
+	// errcode:
+	// 	0x13: Wrong link_no used
+	// 	0x14: connection by link_no not present
+	// 	0x15: connection by link_no closed
+	// 	0x18: No clients connecting to this TCP server
+	// 	0x1E: too many errors ecountered during sending can not fixed
+	// 	0x1F: Other errors
+	u16 status = 0;
+	u32 sent = M8266WIFI_SPI_Send_BlockData((u8 *)s, total_length, WIFI_TX_BLOCK_LOOPS, tcp_link_no, primary_remote(), primary_port, &status);
+	tx_bytes += sent;
+	return sent;
 }
 
 int WifiProvider::_putc(int c)
 {
-	u16 status = 0;
-	u8 to_send = c;
-	if (M8266WIFI_SPI_Send_Data(&to_send, 1, tcp_link_no, &status) == 0) {
+	if (tx_len == WIFI_TX_BUFFER_SIZE && !flush_tx(WIFI_TX_BLOCK_LOOPS)) {
 		return 0;
-	} else {
-		return 1;
 	}
+	tx_data[tx_len++] = c;
+	if (c == '\n') flush_tx(WIFI_TX_BLOCK_LOOPS);
+	return 1;
 }
 
 int WifiProvider::_getc()
 {
+	// the other end may be waiting for what we sent before it answers
+	flush_tx(WIFI_TX_BLOCK_LOOPS);
 	u16 status;
 	u8 to_recv = 0, link_no;
-	M8266WIFI_SPI_RecvData(&to_recv, 1, WIFI_DATA_TIMEOUT_MS, &link_no, &status);
+	u8 remote_ip[4];
+	u16 remote_port = 0;
+	char ip[16];
+	if (M8266WIFI_SPI_RecvData_ex(&to_recv, 1, WIFI_DATA_TIMEOUT_MS, &link_no, remote_ip, &remote_port, &status) > 0) {
+		// an upload only comes from the primary, a monitor must not get mixed into it
+		snprintf(ip, sizeof(ip), "%d.%d.%d.%d", remote_ip[0], remote_ip[1], remote_ip[2], remote_ip[3]);
+		if (!is_primary(ip, remote_port)) return 0;
+	}
 	return to_recv;
 }
 
 int WifiProvider::gets(char** buf, int size)
 {
+	flush_tx(WIFI_TX_BLOCK_LOOPS);
 	u16 status;
 	u8 link_no;
-	u16 received = M8266WIFI_SPI_RecvData(WifiData,
-			(size == 0 || size > WIFI_DATA_MAX_SIZE) ? WIFI_DATA_MAX_SIZE : size, WIFI_DATA_TIMEOUT_MS, &link_no, &status);
+	u8 remote_ip[4];
+	u16 remote_port = 0;
+	char ip[16];
+	u16 received = M8266WIFI_SPI_RecvData_ex(WifiData,
+			(size == 0 || size > WIFI_DATA_MAX_SIZE) ? WIFI_DATA_MAX_SIZE : size, WIFI_DATA_TIMEOUT_MS, &link_no, remote_ip, &remote_port, &status);
 	if (link_no == udp_link_no) {
 		// THEKERNEL->streams->printf("gets, data from udp");
 		return 0;
 	}
+	if (received > 0) {
+		// an upload only comes from the primary, a monitor must not get mixed into it
+		snprintf(ip, sizeof(ip), "%d.%d.%d.%d", remote_ip[0], remote_ip[1], remote_ip[2], remote_ip[3]);
+		if (!is_primary(ip, remote_port)) return 0;
+	}
 	if (int(status & 0xff) == 32 || int(status & 0xff) == 34 || int(status & 0xff) == 47) {
 		THEKERNEL->streams->printf("gets, received: %d, status:%d, high: %d, low: %d!\n", received, status, int(status >> 8), int(status & 0xff));
 	}
@@ -428,28 +785,20 @@ int WifiProvider::gets(char** buf, int size)
 	return received;
 }
 
-// Does the queue have a given char ?
-bool WifiProvider::has_char(char letter) {
-    int index = this->buffer.tail;
-    while( index != this->buffer.head ){
-        if( this->buffer.buffer[index] == letter ){
-            return true;
-        }
-        index = this->buffer.next_block_index(index);
-    }
-    return false;
-}
-
 void WifiProvider::on_gcode_received(void *argument)
 {
     Gcode *gcode = static_cast<Gcode*>(argument);
     if (gcode->has_m) {
+    	if (gcode->m >= 481 && gcode->m <= 489 && !wifi_init_ok && !(gcode->m == 481 && gcode->subcode == 1)) {
+    		gcode->stream->printf("WiFi module is not ready\n");
+    		return;
+    	}
+
     	if (gcode->m == 481)  {
     		// basic wifi operations
 			if (gcode->subcode == 1) {
-		    	// reset wifi module
-				wifi_init_ok = false;
-				init_wifi_module(true);
+		    	// reset wifi module, the connections are only there to delete if it was up
+				init_wifi_module(wifi_init_ok);
 			} else if (gcode->subcode == 2) {
 				// set op mode to STA+AP
 				set_wifi_op_mode(3);
@@ -625,6 +974,7 @@ void WifiProvider::on_get_public_data(void* argument) {
     PublicDataRequest* pdr = static_cast<PublicDataRequest*>(argument);
     if(!pdr->starts_with(wlan_checksum)) return;
     if(!pdr->second_element_is(get_wlan_checksum)) return;
+    if(!wifi_init_ok) return;
 
 	u8 signals = 0;
 	u16 status = 0;
@@ -709,6 +1059,7 @@ void WifiProvider::on_set_public_data(void *argument)
 			&& !pdr->second_element_is(ap_set_ssid_checksum)
 			&& !pdr->second_element_is(ap_set_password_checksum)
 			&& !pdr->second_element_is(ap_enable_checksum)) return;
+    if(!wifi_init_ok) return;
 
     if (pdr->second_element_is(set_wlan_checksum)) {
         ap_conn_info *s = static_cast<ap_conn_info *>(pdr->get_data_ptr());
@@ -821,12 +1172,11 @@ void WifiProvider::query_wifi_status() {
 	}
 }
 
+// starts bringing the module up, which carries on from on_idle, reset when it was already up
 void WifiProvider::init_wifi_module(bool reset) {
 	u16 status = 0;
-	char address[20];
-	u8 param_len = 0;
-
 
+	wifi_init_ok = false;
 	if (reset) {
 		THEKERNEL->streams->printf("M8266WIFI_SPI_Delete_Connections...\n");
 		// disconnect current links
@@ -839,12 +1189,23 @@ void WifiProvider::init_wifi_module(bool reset) {
 
 		// remove current stream
 		THEKERNEL->streams->remove_stream(this);
+		tx_len = 0;
 	}
 
+	M8266HostIf_Init();
 
-	// THEKERNEL->streams->printf("M8266WIFI_Module_Init_Via_SPI...\n");
+	// nCS is held low through the reset for a normal boot
+	M8266HostIf_Set_SPI_nCS_Pin(0);
+	next_init_step(WIFI_INIT_RESET, 1);
+}
 
-	M8266HostIf_Init();
+// the rest of the set up once the module has booted
+void WifiProvider::configure_wifi_module() {
+	u16 status = 0;
+	char address[20];
+	u8 param_len = 0;
+
+	// THEKERNEL->streams->printf("M8266WIFI_Module_Init_Via_SPI...\n");
 
 	if (M8266WIFI_Module_Init_Via_SPI() == 0) {
 		THEKERNEL->streams->printf("M8266WIFI_Module_Init_Via_SPI, ERROR!\n");
@@ -879,10 +1240,8 @@ void WifiProvider::init_wifi_module(bool reset) {
 		THEKERNEL->streams->printf("Get AP_PARAM_TYPE_NETMASK_ADDR ERROR, status:%d, high: %d, low: %d!\n", status, int(status >> 8), int(status & 0xff));
 	}
 
-	if (reset) {
-		// append stream again
-		THEKERNEL->streams->append_stream(this);
-	}
+	// only now can what is sent to the streams go to the module
+	THEKERNEL->streams->append_stream(this);
 
 	wifi_init_ok = true;
 }
@@ -895,28 +1254,45 @@ void WifiProvider::M8266WIFI_Module_delay_ms(u16 nms)
 			M8266HostIf_delay_us(250);
 }
 
-void WifiProvider::M8266WIFI_Module_Hardware_Reset(void) // total 800ms  (Chinese: 本例子中这个函数的总共执行时间大约800毫秒)
+// One step of bringing the module up, called from on_idle until it is done. The hardware reset holds nCS low while
+// nRESET is pulsed, then waits for the module to sample its boot pins and boot, about 800ms in all, which used to be
+// spent waiting in on_module_loaded. The times are those of the M8266 example, the 300ms is well over the 18ms
+// needed for the boot pins as some boards are slow to settle, and the module needs around 500ms more to boot.
+void WifiProvider::step_wifi_init()
 {
-	M8266HostIf_Set_SPI_nCS_Pin(0);   			// Module nCS==ESP8266 GPIO15 as well, Low during reset in order for a normal reset (Chinese: 为了实现正常复位，模块的片选信号nCS在复位期间需要保持拉低)
-	M8266WIFI_Module_delay_ms(1); 	    		// delay 1ms, adequate for nCS stable (Chinese: 延迟1毫秒，确保片选nCS设置后有足够的时间来稳定)
-
-	M8266HostIf_Set_nRESET_Pin(0);					// Pull low the nReset Pin to bring the module into reset state (Chinese: 拉低nReset管脚让模组进入复位状态)
-	M8266WIFI_Module_delay_ms(5);      		// delay 5ms, adequate for nRESET stable(Chinese: 延迟5毫秒，确保片选nRESER设置后有足够的时间来稳定，也确保nCS和nRESET有足够的时间同时处于低电平状态)
-	                                        // give more time especially for some board not good enough
-	                                        //(Chinese: 如果主板不是很好，导致上升下降过渡时间较长，或者因为失配存在较长的振荡时间，所以信号到轨稳定的时间较长，那么在这里可以多给一些延时)
-
-	M8266HostIf_Set_nRESET_Pin(1);					// Pull high again the nReset Pin to bring the module exiting reset state (Chinese: 拉高nReset管脚让模组退出复位状态)
-	M8266WIFI_Module_delay_ms(300); 	  		// at least 18ms required for reset-out-boot sampling boottrap pin (Chinese: 至少需要18ms的延时来确保退出复位时足够的boottrap管脚采样时间)
-	                                        // Here, we use 300ms for adequate abundance, since some board GPIO, (Chinese: 在这里我们使用了300ms的延时来确保足够的富裕量，这是因为在某些主板上，)
-																					// needs more time for stable(especially for nRESET) (Chinese: 他们的GPIO可能需要较多的时间来输出稳定，特别是对于nRESET所对应的GPIO输出)
-																					// You may shorten the time or give more time here according your board v.s. effiency
-																					// (Chinese: 如果你的主机板在这里足够好，你可以缩短这里的延时来缩短复位周期；反之则需要加长这里的延时。
-																					//           总之，你可以调整这里的时间在你们的主机板上充分测试，找到一个合适的延时，确保每次复位都能成功。并适当保持一些富裕量，来兼容批量化时主板的个体性差异)
-	M8266HostIf_Set_SPI_nCS_Pin(1);         // release/pull-high(defualt) nCS upon reset completed (Chinese: 释放/拉高(缺省)片选信号
-	//M8266WIFI_Module_delay_ms(1); 	    		// delay 1ms, adequate for nCS stable (Chinese: 延迟1毫秒，确保片选nCS设置后有足够的时间来稳定)
+	if (us_ticker_read() - init_step_us < init_wait_us) return;
+
+	switch (init_state) {
+		case WIFI_INIT_RESET:
+			M8266HostIf_Set_nRESET_Pin(0);			// into reset
+			next_init_step(WIFI_INIT_RELEASE, 5);
+			break;
+
+		case WIFI_INIT_RELEASE:
+			M8266HostIf_Set_nRESET_Pin(1);			// out of reset, the boot pins are sampled now
+			next_init_step(WIFI_INIT_BOOT, 300);
+			break;
+
+		case WIFI_INIT_BOOT:
+			M8266HostIf_Set_SPI_nCS_Pin(1);			// release nCS once the reset is done
+			next_init_step(WIFI_INIT_CONFIGURE, 800 - 300 - 5 - 2);
+			break;
+
+		case WIFI_INIT_CONFIGURE:
+			init_state = WIFI_INIT_DONE;
+			configure_wifi_module();
+			break;
+
+		default:
+			break;
+	}
+}
 
-	M8266WIFI_Module_delay_ms(800-300-5-2); // Delay more than around 500ms for M8266WIFI module bootup and initialization，including bootup information print。No influence to host interface communication. Could be shorten upon necessary. But test for verification required if adjusted.
-	                                        // (Chinese: 延迟大约500毫秒，来等待模组成功复位后完成自己的启动过程和自身初始化，包括串口信息打印。但是此时不影响模组和单片主机之间的通信，这里的时间可以根据需要适当调整.如果调整缩短了这里的时间，建议充分测试，以确保系统(时序关系上的)可靠性)
+void WifiProvider::next_init_step(uint8_t state, uint32_t wait_ms)
+{
+	init_state = state;
+	init_step_us = us_ticker_read();
+	init_wait_us = wait_ms * 1000;
 }
 
 u8 WifiProvider::M8266WIFI_Module_Init_Via_SPI()
@@ -927,7 +1303,7 @@ u8 WifiProvider::M8266WIFI_Module_Init_Via_SPI()
 	//////////////////////////////////////////////////////////////////////////////////////////////////////
 	//Step 1: To hardware reset the module (with nCS=0 during reset) and wait up the module bootup
 	//(Chinese: 步骤1：对模组执行硬复位时序(在片选nCS拉低的时候对nRESET管脚输出低高电平)，并等待模组复位启动完毕
-	M8266WIFI_Module_Hardware_Reset();
+	// done by step_wifi_init() before this is called
 
 
 	/////////////////////////////////////////////////////////////////////////////////////////////////////
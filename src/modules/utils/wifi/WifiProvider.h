@@ -17,11 +17,63 @@ using namespace std;
 #include "StreamOutput.h"
 
 #include "M8266WIFIDrv.h"
-#include "libs/RingBuffer.h"
+#include "libs/TSRingBuffer.h"
 
 #define WIFI_DATA_MAX_SIZE 1460
 #define WIFI_DATA_TIMEOUT_MS 10
+#define WIFI_RX_BUFFER_SIZE 4096
+#define WIFI_RX_LINES_PER_LOOP 8
+#define WIFI_TX_BUFFER_SIZE 256
+#define WIFI_TX_BLOCK_LOOPS 5000
+#define WIFI_TX_IDLE_LOOPS 50
 #define MAX_WLAN_SIGNALS 8
+#define WIFI_MAX_MONITORS 3
+#define WIFI_MONITOR_LINE_SIZE 32
+
+// what a client gets sent besides the answers to its own queries, set by the client with $SUB=full, $SUB=status or $SUB=none
+enum WIFI_SUBSCRIPTION_T {
+    WIFI_SUB_NONE,      // nothing pushed to it
+    WIFI_SUB_STATUS,    // the pushed status reports and telemetry
+    WIFI_SUB_FULL       // and everything broadcast to all the streams
+};
+
+// Binary telemetry datagram sent to the connected client over UDP, little endian
+struct __attribute__((packed)) telemetry_packet_t {
+    uint8_t magic[2];           // 'C' 'T'
+    uint8_t version;            // TELEMETRY_VERSION
+    uint8_t state;              // Kernel state, RUN, IDLE etc
+    uint32_t ms;                // time stamp
+    float mpos[5];              // machine position X Y Z A B, without the compensation
+    float feed;                 // current feed rate in mm/min
+    float spindle_rpm;
+    float spindle_pwm;          // spindle PWM duty 0-1, stands in for the load
+    uint8_t planner_used;       // blocks queued
+    uint8_t planner_free;
+    uint16_t isr_load;          // time in the step ticker ISRs since the last packet, in 0.1%
+};
+#define TELEMETRY_VERSION 1
+
+class WifiProvider;
+
+// A client on the TCP server other than the primary one, a dashboard or monitor. It can only ask for the status and
+// set its subscription, what it is sent goes only to it and never waits on the module so it can not hold up the primary
+class WifiMonitorStream : public StreamOutput
+{
+public:
+    WifiMonitorStream() : provider(nullptr), port(0), level(WIFI_SUB_STATUS), line_len(0), query_flag(false), in_use(false) { ip[0] = '\0'; }
+
+    int puts(const char*, int size = 0);
+    int type() { return 1; }
+
+    WifiProvider *provider;
+    char ip[16];
+    u16 port;
+    uint8_t level;
+    char line[WIFI_MONITOR_LINE_SIZE];
+    uint8_t line_len;
+    bool query_flag;
+    bool in_use;
+};
 
 class WifiProvider : public Module, public StreamOutput
 {
@@ -41,18 +93,30 @@ public:
     int _putc(int c);
     int _getc(void);
     bool ready();
-    bool has_char(char letter);
     int type(); // 0: serial, 1: wifi
+    int rx_free() { return buffer.capacity() - buffer.size(); }
+
+    int send_monitor(WifiMonitorStream *m, const char *s, int size);
 
 
 private:
     void M8266WIFI_Module_delay_ms(u16 nms);
     void set_wifi_op_mode(u8 op_mode);
 
-    void M8266WIFI_Module_Hardware_Reset(void);
     u8 M8266WIFI_Module_Init_Via_SPI();
 
+    // the module is brought up a step at a time from on_idle rather than waiting for it to boot
+    enum WIFI_INIT_STATE {
+        WIFI_INIT_DONE,         // up, or given up on
+        WIFI_INIT_RESET,        // nCS low, about to hold nRESET low
+        WIFI_INIT_RELEASE,      // held in reset, about to let it go
+        WIFI_INIT_BOOT,         // out of reset, about to release nCS
+        WIFI_INIT_CONFIGURE     // booting, then the SPI link and connections are set up
+    };
     void init_wifi_module(bool reset);
+    void step_wifi_init();
+    void next_init_step(uint8_t state, uint32_t wait_ms);
+    void configure_wifi_module();
     void query_wifi_status();
 
     uint32_t ip_to_int(char* ip_addr);
@@ -61,25 +125,53 @@ private:
 
     void on_pin_rise();
     void receive_wifi_data();
+    bool flush_tx(u16 max_loops);
+    uint32_t auto_report_tick(uint32_t);
+    uint32_t telemetry_tick(uint32_t);
+    void send_telemetry();
+
+    char *primary_remote() { return primary_ip[0] != '\0' ? primary_ip : NULL; }
+    bool is_primary(const char *ip, u16 port) const;
+    WifiMonitorStream *find_monitor(const char *ip, u16 port);
+    void monitor_data(WifiMonitorStream *m, const u8 *data, u16 len);
+    void set_monitor_level(WifiMonitorStream *m, uint8_t level);
+    void drop_clients(const ClientInfo clients[], u8 client_num);
 
     mbed::InterruptIn *wifi_interrupt_pin; // Interrupt pin for measuring speed
     float probe_slow_rate;
 
-    RingBuffer<char, 256> buffer; // Receive buffer
+    // Receive buffer, in AHB with the rest of the provider. Big enough for a host counting characters against Bf to
+    // keep a couple of packets of a streamed job in flight, a received packet can be up to WIFI_DATA_MAX_SIZE
+    TSLineBuffer<WIFI_RX_BUFFER_SIZE> buffer;
     string test_buffer;
 
 	u8 WifiData[WIFI_DATA_MAX_SIZE];
+	u8 tx_data[WIFI_TX_BUFFER_SIZE]; // small writes are collected here and sent as one packet
+	u16 tx_len;
 
 	int tcp_port;
 	int udp_send_port;
 	int udp_recv_port;
 	int tcp_timeout_s;
+	int telemetry_port;
+	// the client commands come from and replies go to, the first client to send anything, empty until then
+	char primary_ip[16];
+	u16 primary_port;
+	uint8_t primary_level;
+	WifiMonitorStream monitors[WIFI_MAX_MONITORS];
+	uint32_t telemetry_last_us;
+	uint64_t telemetry_last_cycles;
 	int connection_fail_count;
+	uint32_t rx_bytes;
+	uint32_t tx_bytes;
 	char machine_name[64]; // Fixed-size buffer to avoid std::string heap allocation
 	char ap_address[16];
 	char ap_netmask[16];
 	char sta_address[16];
 	char sta_netmask[16];
+	uint32_t init_step_us;
+	uint32_t init_wait_us;
+	uint8_t init_state;
 
     struct {
     	u8  tcp_link_no;
@@ -89,6 +181,9 @@ private:
     	volatile bool query_flag:1;
     	volatile bool diagnose_flag:1;
     	volatile bool has_data_flag:1;
+    	volatile bool auto_report_flag:1;
+    	volatile bool telemetry_flag:1;
+    	bool has_client:1;
     };
 
 };
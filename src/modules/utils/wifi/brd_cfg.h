@@ -32,6 +32,9 @@
 //#define M8266WIFI_CONFIG_VIA_USART
 #define M8266WIFI_CONFIG_VIA_SPI
 
+// Left off: the transfers of M8266WIFI_SPI_RecvData/Send_BlockData are done inside the prebuilt M8266WIFIDrv_LPC17xx.a
+// by programmed I/O, the archive only calls back for nCS and delays and has no DMA path to switch on. Defining this
+// only sets up the GPDMA channels below and the SSP DMA requests, for a driver build that uses them
 //#define M8266WIFI_SPI_ACCESS_USE_DMA
 
 #if defined(MCU_IS_HT32F16XX)
@@ -193,7 +196,12 @@
 //     - SPI RX DMA   if DMA used
 ///////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////
-#ifdef M8266WIFI_SPI_ACCESS_USE_DMA
+#if defined(M8266WIFI_SPI_ACCESS_USE_DMA) && defined(MCU_IS_NXP_LPC17XX)
+// the SD card has GPDMA channels 6 and 7, see SDFileSystem.cpp
+#define M8266WIFI_INTERFACE_SPI_TX_DMA_STREAM							LPC_GPDMACH5
+#define M8266WIFI_INTERFACE_SPI_RX_DMA_STREAM							LPC_GPDMACH4
+#define M8266WIFI_DMA_CHANNEL_BIT(ch)									(1UL << (((uint32_t)(ch) - (uint32_t)LPC_GPDMACH0) / 0x20))
+#elif defined(M8266WIFI_SPI_ACCESS_USE_DMA)
 #define M8266WIFI_INTERFACE_SPI_TX_DMA										DMA2
 #define M8266WIFI_INTERFACE_SPI_TX_RCC_Periph_DMA 				RCC_AHB1Periph_DMA2
 #define M8266WIFI_INTERFACE_SPI_TX_DMA_CHANNEL 						DMA_Channel_3
@@ -16,7 +16,9 @@ This is aprt of the Smoothie test framework, it generates a Mockable Kernl so ke
 #include "libs/SlowTicker.h"
 #include "libs/Adc.h"
 #include "libs/StreamOutputPool.h"
+#ifndef TEST_HOST
 #include <mri.h>
+#endif
 #include "checksumm.h"
 #include "ConfigValue.h"
 
@@ -26,13 +28,17 @@ This is aprt of the Smoothie test framework, it generates a Mockable Kernl so ke
 #include "modules/communication/GcodeDispatch.h"
 #include "modules/robot/Planner.h"
 #include "modules/robot/Robot.h"
-#include "modules/robot/Stepper.h"
 #include "modules/robot/Conveyor.h"
 
 #include "Config.h"
 #include "FirmConfigSource.h"
 
+#ifdef TEST_HOST
+#include "HostHal.h"
+#endif
+
 #include <malloc.h>
+#include <string.h>
 #include <array>
 #include <functional>
 #include <map>
@@ -42,17 +48,27 @@ Kernel* Kernel::instance;
 // The kernel is the central point in Smoothie : it stores modules, and handles event calls
 Kernel::Kernel(){
     instance= this; // setup the Singleton instance of the kernel
+    frozen_hooks = nullptr;
 
+#ifdef TEST_HOST
+    // there is no uart on the host, the output goes to stdout
+    this->serial = nullptr;
+#else
     // serial first at fixed baud rate (DEFAULT_SERIAL_BAUD_RATE) so config can report errors to serial
     // Set to UART0, this will be changed to use the same UART as MRI if it's enabled
     this->serial = new SerialConsole(USBTX, USBRX, DEFAULT_SERIAL_BAUD_RATE);
+#endif
 
     // Config next, but does not load cache yet
     // loads config from in memory source for test framework must be loaded by test
     this->config = nullptr;
 
     this->streams = new StreamOutputPool();
+#ifdef TEST_HOST
+    this->streams->append_stream(new HostStdoutStream());
+#else
     this->streams->append_stream(this->serial);
+#endif
 
     this->current_path   = "/";
 
@@ -61,6 +77,24 @@ Kernel::Kernel(){
     // dummies (would be nice to refactor to not have to create a conveyor)
     this->conveyor= new Conveyor();
 
+#ifdef TEST_HOST
+    // on the host the robot and planner can be driven by a test, they are created by it once the config is set up
+    this->robot = nullptr;
+    this->planner = nullptr;
+    this->step_ticker = new StepTicker();
+    // the firmware defaults, the robot limits the motor rates to what this can step
+    this->base_stepping_frequency = 100000;
+    this->step_ticker->set_frequency(this->base_stepping_frequency);
+    this->step_ticker->set_unstep_time(1);
+    // there is no eeprom, so no offsets and no tool length
+    this->i2c = nullptr;
+    this->eeprom_data = new EEPROM_data();
+    memset(this->eeprom_data, 0, sizeof(EEPROM_data));
+    this->eeprom_written = nullptr;
+    this->factory_set = new FACTORY_SET();
+    memset(this->factory_set, 0, sizeof(FACTORY_SET));
+#endif
+
     // Configure UART depending on MRI config
     // Match up the SerialConsole to MRI UART. This makes it easy to use only one UART for both debug and actual commands.
     NVIC_SetPriorityGrouping(0);
@@ -74,15 +108,21 @@ void Kernel::add_module(Module* module){
 
 // Adds a hook for a given module and event
 void Kernel::register_for_event(_EVENT_ENUM id_event, Module *mod){
-    this->hooks[id_event].push_back(mod);
+    EventHandler fnc = event_handler(mod, id_event);
+    if(fnc != nullptr) this->hooks[id_event].push_back({mod, fnc});
+}
+
+// the tests register and unregister as they go, the lists are left as they are
+void Kernel::freeze_hooks()
+{
 }
 
 static std::map<_EVENT_ENUM, std::function<void(void*)> > event_callbacks;
 
 // Call a specific event with an argument
 void Kernel::call_event(_EVENT_ENUM id_event, void * argument){
-    for (auto m : hooks[id_event]) {
-        (m->*kernel_callback_functions[id_event])(argument);
+    for (auto h : hooks[id_event]) {
+        h.fnc(h.module, argument);
     }
     if(event_callbacks.find(id_event) != event_callbacks.end()){
         event_callbacks[id_event](argument);
@@ -91,11 +131,27 @@ void Kernel::call_event(_EVENT_ENUM id_event, void * argument){
     }
 }
 
+// the tests do not look at the machine state
+void Kernel::refresh_state()
+{
+}
+
+// the tests call the handlers directly
+void Kernel::set_event_schedule(_EVENT_ENUM id_event, Module *mod, uint16_t period_ms, bool background)
+{
+}
+
+// the tests mock the answers through the event callbacks so there is nothing to route
+void Kernel::call_public_data_event(_EVENT_ENUM id_event, PublicDataRequest *pdr)
+{
+    call_event(id_event, pdr);
+}
+
 // These are used by tests to test for various things. basically mocks
 bool Kernel::kernel_has_event(_EVENT_ENUM id_event, Module *mod)
 {
-    for (auto m : hooks[id_event]) {
-        if(m == mod) return true;
+    for (auto h : hooks[id_event]) {
+        if(h.module == mod) return true;
     }
     return false;
 }
@@ -103,13 +159,22 @@ bool Kernel::kernel_has_event(_EVENT_ENUM id_event, Module *mod)
 void Kernel::unregister_for_event(_EVENT_ENUM id_event, Module *mod)
 {
     for (auto i = hooks[id_event].begin(); i != hooks[id_event].end(); ++i) {
-        if(*i == mod) {
+        if(i->module == mod) {
             hooks[id_event].erase(i);
             return;
         }
     }
 }
 
+// there is no eeprom to write to
+void Kernel::write_eeprom_data()
+{
+}
+
+void Kernel::defer_eeprom_write()
+{
+}
+
 void test_kernel_setup_config(const char* start, const char* end)
 {
     THEKERNEL->config= new Config(new FirmConfigSource("rom", start, end) );
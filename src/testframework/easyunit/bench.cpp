@@ -0,0 +1,114 @@
+#include "bench.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef TEST_HOST
+#include <time.h>
+#else
+#include "LPC17xx.h"
+
+// DWT cycle counter, not in the cmsis headers we have
+#define DEMCR       (*(volatile uint32_t *)0xE000EDFC)
+#define DWT_CTRL    (*(volatile uint32_t *)0xE0001000)
+#define DWT_CYCCNT  (*(volatile uint32_t *)0xE0001004)
+#endif
+
+Bench::Bench(const SimpleString& benchCaseName, const SimpleString& benchName, uint32_t iterations)
+	: Test(benchCaseName, benchName), iterations_(iterations > 0 ? iterations : 1), iteration_(0), rounds_(1),
+	  round_(0), start_(0), paused_at_(0), excluded_(0)
+{
+}
+
+uint32_t Bench::now()
+{
+#ifdef TEST_HOST
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+#else
+	return DWT_CYCCNT;
+#endif
+}
+
+const char *Bench::unit()
+{
+#ifdef TEST_HOST
+	return "ns";
+#else
+	return "cycles";
+#endif
+}
+
+void Bench::run()
+{
+#ifdef TEST_HOST
+	bool timed = getenv("BENCH") != nullptr;
+#else
+	bool timed = true;
+	DEMCR |= CoreDebug_DEMCR_TRCENA;
+	DWT_CTRL |= 1;
+#endif
+	uint32_t iterations = iterations_;
+	if (!timed) iterations_ = 1;
+	rounds_ = timed ? BENCH_ROUNDS : 1;
+	round_ = 0;
+	iteration_ = 0;
+
+	body();
+
+	iterations_ = iterations;
+	if (round_ < rounds_) {
+		// the body returned without running its loop to the end
+		FAIL_M("Benchmark loop did not finish");
+	}
+
+	if (timed) {
+		float mean = 0, min = samples_[0];
+		for (int i = 0; i < rounds_; i++) {
+			mean += samples_[i];
+			if (samples_[i] < min) min = samples_[i];
+		}
+		mean /= rounds_;
+		float var = 0;
+		for (int i = 0; i < rounds_; i++) var += (samples_[i] - mean) * (samples_[i] - mean);
+		float sd = rounds_ > 1 ? sqrtf(var / (rounds_ - 1)) : 0;
+
+		printf("  Bench \"%s.%s\": %.1f %s/iteration, sd %.1f, fastest %.1f, %d rounds of %lu\n",
+			testCaseName_.asCharString(), testName_.asCharString(), mean, unit(), sd, min, rounds_,
+			(unsigned long)iterations_);
+	}
+	addTestPartResult(new TestPartResult(this, __FILE__, __LINE__, "bench", success));
+}
+
+bool Bench::next()
+{
+	if (iteration_ == 0) {
+		// the first iteration of a round
+		iteration_ = 1;
+		excluded_ = 0;
+		start_ = now();
+		return true;
+	}
+	if (iteration_ < iterations_) {
+		iteration_++;
+		return true;
+	}
+
+	uint32_t took = now() - start_ - excluded_;
+	samples_[round_++] = (float)took / iterations_;
+	iteration_ = 0;
+	if (round_ >= rounds_) return false;
+	return next();
+}
+
+void Bench::pause()
+{
+	paused_at_ = now();
+}
+
+void Bench::resume()
+{
+	excluded_ += now() - paused_at_;
+}
@@ -0,0 +1,82 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "test.h"
+
+#include <stdint.h>
+
+// the most rounds a benchmark is timed over
+#define BENCH_ROUNDS 10
+
+/**
+ * A test that times its body rather than checking it. The body sets up what
+ * it needs, then repeats the code being timed in a loop on next():
+ *
+ *     BENCH(GCodeBench, parse, 1000)
+ *     {
+ *         while (next()) {
+ *             Gcode gc("G1 X10 Y20 F600", &StreamOutput::NullStream);
+ *         }
+ *     }
+ *
+ * The loop is timed in rounds of the given number of iterations, and the mean,
+ * standard deviation and fastest of the per iteration times are printed. Time
+ * is in DWT cycles on the device and in nanoseconds on the host. Anything in
+ * the loop that should not count goes between pause() and resume().
+ *
+ * On the host a benchmark runs its loop once, as a test that it works, unless
+ * BENCH is set in the environment, which make bench does.
+ */
+class Bench : public Test
+{
+	public:
+		Bench(const SimpleString& benchCaseName, const SimpleString& benchName, uint32_t iterations);
+
+		void run();
+
+		/**
+		 * The code of the benchmark, BENCH() defines it.
+		 */
+		virtual void body() = 0;
+
+	protected:
+		/**
+		 * True while there are iterations left to time.
+		 */
+		bool next();
+
+		/**
+		 * Time from pause() to resume() is not counted.
+		 */
+		void pause();
+		void resume();
+
+	private:
+		static uint32_t now();
+		static const char *unit();
+
+		uint32_t iterations_;
+		uint32_t iteration_;
+		int rounds_;
+		int round_;
+		uint32_t start_;
+		uint32_t paused_at_;
+		uint32_t excluded_;
+		float samples_[BENCH_ROUNDS];
+};
+
+/**
+ * Define a benchmark, timed in rounds of the given iterations.
+ * User should put the benchmark code between brackets after using this macro.
+ * @param benchCaseName TestCase name the benchmark is reported under
+ * @param benchName Unique benchmark name
+ * @param iterations How many times the loop runs a round
+ */
+#define BENCH(benchCaseName, benchName, iterations)\
+  class benchCaseName##benchName##Bench : public Bench \
+	{ public: benchCaseName##benchName##Bench() : Bench (#benchCaseName , #benchName, iterations) {} \
+            void body(); } \
+    benchCaseName##benchName##BenchInstance; \
+	void benchCaseName##benchName##Bench::body ()
+
+#endif // BENCH_H
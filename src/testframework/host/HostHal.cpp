@@ -0,0 +1,108 @@
+/*
+      This file is part of Smoothie (http://smoothieware.org/). The motion control part is heavily based on Grbl (https://github.com/simen/grbl).
+      Smoothie is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+      Smoothie is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+      You should have received a copy of the GNU General Public License along with Smoothie. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+The hardware the host build stands in for. The LPC peripheral registers are ordinary memory mapped at
+their real addresses before anything else runs, so pins and timers can be set up and read back, and
+time only moves when a test advances it.
+*/
+
+#include "cmsis.h"
+#include "us_ticker_api.h"
+#include "wait_api.h"
+#include "HostHal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <sys/mman.h>
+
+NVIC_Type host_nvic;
+SCB_Type host_scb;
+SysTick_Type host_systick;
+DWT_Type host_dwt;
+CoreDebug_Type host_core_debug;
+volatile uint32_t host_primask;
+
+uint32_t SystemCoreClock = 100000000;
+
+static uint64_t host_time_us;
+
+static void map_registers(uintptr_t base, size_t size)
+{
+    void *p = mmap((void *)base, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (p != (void *)base) {
+        fprintf(stderr, "host: can not map the registers at %08lx\n", (unsigned long)base);
+        exit(1);
+    }
+}
+
+// before the static constructors, some of them set up pins
+__attribute__((constructor(101))) static void host_hal_init()
+{
+    map_registers(LPC_GPIO_BASE, 0x4000);
+    map_registers(LPC_APB0_BASE, 0x100000);
+    map_registers(LPC_AHB_BASE, 0x10000);
+}
+
+void host_advance_us(uint32_t us)
+{
+    host_time_us += us;
+}
+
+uint64_t host_time()
+{
+    return host_time_us;
+}
+
+extern "C" {
+
+uint32_t us_ticker_read()
+{
+    return (uint32_t)host_time_us;
+}
+
+void wait(float s)
+{
+    host_advance_us(s * 1000000);
+}
+
+void wait_ms(int ms)
+{
+    host_advance_us(ms * 1000);
+}
+
+void wait_us(int us)
+{
+    host_advance_us(us);
+}
+
+void NVIC_SystemReset(void)
+{
+    fprintf(stderr, "host: system reset\n");
+    exit(2);
+}
+
+void NVIC_SetVector(IRQn_Type IRQn, uint32_t vector)
+{
+}
+
+uint32_t NVIC_GetVector(IRQn_Type IRQn)
+{
+    return 0;
+}
+
+void error(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    exit(1);
+}
+
+}
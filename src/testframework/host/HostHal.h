@@ -0,0 +1,20 @@
+#ifndef HOSTHAL_H
+#define HOSTHAL_H
+
+#include "StreamOutput.h"
+
+#include <stdint.h>
+
+// the host us_ticker only moves when this is called
+void host_advance_us(uint32_t us);
+// microseconds since the start, us_ticker_read() is the low 32 bits of it
+uint64_t host_time();
+
+// what would go to the serial console
+class HostStdoutStream : public StreamOutput {
+    public:
+        int puts(const char *s, int size = 0) { return fwrite(s, 1, size > 0 ? size : strlen(s), stdout); }
+        int _putc(int c) { return fputc(c, stdout); }
+};
+
+#endif
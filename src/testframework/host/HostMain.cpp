@@ -0,0 +1,41 @@
+/*
+      This file is part of Smoothie (http://smoothieware.org/). The motion control part is heavily based on Grbl (https://github.com/simen/grbl).
+      Smoothie is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+      Smoothie is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+      You should have received a copy of the GNU General Public License along with Smoothie. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Test_main.cpp for the host, runs the tests and exits with the number that failed
+
+#include "libs/Kernel.h"
+#include "MemoryPool.h"
+#include "platform_memory.h"
+
+#include "easyunit/testharness.h"
+#include "easyunit/test.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <new>
+
+// stands in for the 32K of AHB SRAM the pool is on in the firmware
+static uint8_t ahb_ram[32 * 1024] __attribute__((aligned(8)));
+
+int main()
+{
+    _ahb = new MemoryPool(ahb_ram, sizeof(ahb_ram));
+
+    // the test kernel leaves most of the state the real one sets up alone, so it starts from zeroed memory
+    // here rather than whatever the heap had in it, and every run of the tests starts the same
+    Kernel* kernel = new(calloc(1, sizeof(Kernel))) Kernel();
+
+    printf("Starting tests...\n");
+
+    const TestResult *res = TestRegistry::runAndPrint();
+
+    printf("Done\n");
+
+    kernel->~Kernel();
+    free(kernel);
+    return res == nullptr ? 1 : res->getTotalFailures() + res->getTotalErrors();
+}
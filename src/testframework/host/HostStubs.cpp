@@ -0,0 +1,84 @@
+/*
+      This file is part of Smoothie (http://smoothieware.org/). The motion control part is heavily based on Grbl (https://github.com/simen/grbl).
+      Smoothie is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+      Smoothie is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+      You should have received a copy of the GNU General Public License along with Smoothie. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+Stand ins for the parts of the firmware the host build does not compile but the sources under test
+reference. There is no probe on the host, so every probe fails, and no shell to run commands with.
+*/
+
+#include "gpio.h"
+#include "ZProbe.h"
+#include "SimpleShell.h"
+#include "InterruptIn.h"
+#include "MemoryStats.h"
+
+// from main.cpp
+GPIO leds[4] = {
+    GPIO(P4_29),
+    GPIO(P4_28),
+    GPIO(P0_4),
+    GPIO(P1_17)
+};
+
+// pin interrupts never fire on the host, the mbed version needs a 32 bit pointer for its id
+mbed::InterruptIn::InterruptIn(PinName pin)
+{
+}
+
+mbed::InterruptIn::~InterruptIn()
+{
+}
+
+bool ZProbe::run_probe(float& mm, float feedrate, float max_dist, bool reverse)
+{
+    return false;
+}
+
+bool ZProbe::run_probe_return(float& mm, float feedrate, float max_dist, bool reverse)
+{
+    return false;
+}
+
+bool ZProbe::doProbeAt(float &mm, float x, float y)
+{
+    return false;
+}
+
+void ZProbe::coordinated_move(float x, float y, float z, float feedrate, bool relative)
+{
+}
+
+void ZProbe::home()
+{
+}
+
+bool ZProbe::fast_slow_probe_sequence_public(int axis, int direction)
+{
+    return false;
+}
+
+void ZProbe::init_parameters_and_out_coords()
+{
+}
+
+bool ZProbe::log_probe(float x, float y, float z, bool ok, ProbeLog::SOURCE source)
+{
+    return false;
+}
+
+// the host heap can not be walked, it is reported as the 64K free above the top the firmware has about
+void MemoryStats::heap_walk(heap_t &h, StreamOutput *verbose)
+{
+    h.used = 0;
+    h.free = 0;
+    h.largest_free = h.top_free = 64 * 1024;
+}
+
+bool SimpleShell::parse_command(const char *cmd, string args, StreamOutput *stream)
+{
+    return false;
+}
@@ -0,0 +1,375 @@
+/*
+      This file is part of Smoothie (http://smoothieware.org/). The motion control part is heavily based on Grbl (https://github.com/simen/grbl).
+      Smoothie is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+      Smoothie is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+      You should have received a copy of the GNU General Public License along with Smoothie. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Plays a G-code file through the robot, planner and conveyor and clocks the step ticker in virtual time,
+// writing out every step with the time it happened and how fast the motor was going.
+//
+//   host_sim [-c config] [-f csv|vcd] [-o file] [-p parse_us] file.gcode
+//
+// -c is a config file, by default it is src/config.default. -p is how long the main loop takes over each
+// line in us, the ticker runs for that long between lines so a queue that can not be kept full shows up
+// as starvation. The summary goes to stderr.
+//
+// The steps come out on the tick they are due on, the precise step timing of the MR1 match is not simulated.
+
+#include "libs/Kernel.h"
+#include "MemoryPool.h"
+#include "platform_memory.h"
+#include "Robot.h"
+#include "Planner.h"
+#include "Conveyor.h"
+#include "StepTicker.h"
+#include "StepperMotor.h"
+#include "Gcode.h"
+#include "StreamOutput.h"
+#include "Test_kernel.h"
+#include "HostHal.h"
+#include "Config.h"
+#include "ConfigValue.h"
+#include "checksumm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <time.h>
+#include <new>
+#include <string>
+#include <vector>
+
+extern const char _binary_config_default_start[];
+extern const char _binary_config_default_end[];
+
+static uint8_t ahb_ram[32 * 1024] __attribute__((aligned(8)));
+
+static const char motor_names[]= "XYZAB";
+
+// the summary goes to stderr so it stays out of the trace on stdout
+class StderrStream : public StreamOutput {
+    public:
+        int puts(const char *s, int size = 0) { return fwrite(s, 1, size > 0 ? size : strlen(s), stderr); }
+        int _putc(int c) { return fputc(c, stderr); }
+};
+
+struct motor_state_t {
+    int32_t steps;          // position at the last tick
+    bool dir;
+    float speed;            // mm/s last written out
+    uint32_t count;         // steps issued
+};
+
+static FILE *out;
+static bool vcd;
+static uint64_t ticks;
+static uint64_t time_us;    // what host_advance_us() has been given so far
+static std::vector<motor_state_t> motors;
+static const Block *last_block;
+static uint32_t blocks;
+static uint32_t starved;
+static uint64_t starved_ticks;
+static bool input_left;
+static bool in_line;        // ticks run from inside the robot are not counted as its time
+static double line_secs;
+static size_t heap_peak;
+static uint32_t ahb_free_min;
+
+// the heap is not walked on every tick, this is often enough to catch the queue at its fullest
+static void sample_memory()
+{
+    size_t used = mallinfo2().uordblks;
+    if (used > heap_peak) heap_peak = used;
+    uint32_t f = AHB.free();
+    if (f < ahb_free_min) ahb_free_min = f;
+}
+
+static uint64_t tick_ns(uint64_t t)
+{
+    return t * 1000000000ULL / (uint64_t)StepTicker::getInstance()->get_frequency();
+}
+
+static void vcd_header(int n)
+{
+    fprintf(out, "$timescale 1ns $end\n$scope module motors $end\n");
+    for (int m = 0; m < n; ++m) {
+        fprintf(out, "$var wire 1 s%d %c_step $end\n", m, motor_names[m]);
+        fprintf(out, "$var wire 1 d%d %c_dir $end\n", m, motor_names[m]);
+        fprintf(out, "$var real 64 v%d %c_speed $end\n", m, motor_names[m]);
+    }
+    fprintf(out, "$upscope $end\n$enddefinitions $end\n#0\n$dumpvars\n");
+    for (int m = 0; m < n; ++m) fprintf(out, "0s%d\n0d%d\nr0 v%d\n", m, m, m);
+    fprintf(out, "$end\n");
+}
+
+// one match of the step timer, a period or more if it coasted, then what it did to the motors
+static void tick()
+{
+    StepTicker *st = StepTicker::getInstance();
+    const Block *b = st->get_current_block();
+    uint32_t span = st->get_tick_span();
+    st->step_tick();
+    st->unstep_tick();
+    ticks += span;
+
+    static uint64_t sampled = 0;
+    if (ticks - sampled >= 1024) {
+        sampled = ticks;
+        sample_memory();
+    }
+
+    uint64_t now = tick_ns(ticks) / 1000;
+    if (now > time_us) {
+        host_advance_us(now - time_us);
+        time_us = now;
+    }
+
+    const Block *next = st->get_current_block();
+    if (next != nullptr && next != last_block) ++blocks;
+    if (next == nullptr) {
+        if (last_block != nullptr && input_left) ++starved;
+        if (input_left && blocks > 0) ++starved_ticks;
+    }
+    last_block = next;
+
+    uint64_t t = tick_ns(ticks - 1);
+    bool stamped = false;
+    uint32_t stepped_mask = 0;
+    for (size_t m = 0; m < motors.size(); ++m) {
+        StepperMotor *sm = THEROBOT->actuators[m];
+        motor_state_t &ms = motors[m];
+        int32_t pos = (int32_t)sm->get_current_step();
+        // the block finished on this tick, the rate is its last one
+        float speed = (b != nullptr && b == next) ? st->get_trapezoid_rate(m) / sm->get_steps_per_mm() : ms.speed;
+        if (next == nullptr && !sm->is_moving()) speed = 0;
+        bool stepped = pos != ms.steps;
+        bool dir = sm->which_direction();
+
+        if (vcd) {
+            if (stepped || dir != ms.dir || speed != ms.speed) {
+                if (!stamped) fprintf(out, "#%llu\n", (unsigned long long)t);
+                stamped = true;
+                if (dir != ms.dir) fprintf(out, "%dd%zu\n", dir ? 1 : 0, m);
+                if (speed != ms.speed) fprintf(out, "r%.3f v%zu\n", speed, m);
+                if (stepped) fprintf(out, "1s%zu\n", m);
+            }
+        } else if (stepped) {
+            fprintf(out, "%.3f,%c,%.4f,%.3f\n", t / 1000.0, motor_names[m], pos / sm->get_steps_per_mm(), speed);
+        }
+
+        if (stepped) {
+            ++ms.count;
+            stepped_mask |= 1 << m;
+        }
+        ms.steps = pos;
+        ms.dir = dir;
+        ms.speed = speed;
+    }
+
+    // the pulses end 1us later, before the next tick
+    if (vcd && stepped_mask != 0) {
+        fprintf(out, "#%llu\n", (unsigned long long)(t + 1000));
+        for (size_t m = 0; m < motors.size(); ++m) {
+            if (stepped_mask & (1 << m)) fprintf(out, "0s%zu\n", m);
+        }
+    }
+}
+
+static double now_secs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// while the queue is full the robot is only going round the conveyor's wait loop, so from one of these to
+// the next is not its time either
+static void idle_tick()
+{
+    static double last = 0;
+    static bool waiting = false;
+    if (!in_line) {
+        tick();
+        waiting = false;
+        return;
+    }
+    double t = now_secs();
+    tick();
+    double n = now_secs();
+    line_secs -= n - (waiting ? last : t);
+    last = n;
+    waiting = THECONVEYOR->is_queue_full();
+}
+
+static void run_us(uint32_t us)
+{
+    uint64_t end = ticks + (uint64_t)us * (uint64_t)StepTicker::getInstance()->get_frequency() / 1000000;
+    while (ticks < end) tick();
+}
+
+static bool read_file(const char *fn, std::string &s)
+{
+    FILE *fp = fopen(fn, "r");
+    if (fp == nullptr) return false;
+    char buf[512];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) s.append(buf, n);
+    fclose(fp);
+    return true;
+}
+
+// strips the comments, returns false if there is nothing left to send
+static bool clean(char *line)
+{
+    char *d = line;
+    bool in_paren = false;
+    for (char *s = line; *s != '\0' && *s != '\n' && *s != '\r'; ++s) {
+        if (in_paren) {
+            if (*s == ')') in_paren = false;
+            continue;
+        }
+        if (*s == ';') break;
+        if (*s == '(') {
+            in_paren = true;
+            continue;
+        }
+        *d++ = *s;
+    }
+    while (d > line && (d[-1] == ' ' || d[-1] == '\t')) --d;
+    *d = '\0';
+    char *s = line;
+    while (*s == ' ' || *s == '\t') ++s;
+    if (s != line) memmove(line, s, strlen(s) + 1);
+    return *line != '\0';
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: host_sim [-c config] [-f csv|vcd] [-o file] [-p parse_us] file.gcode\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *config_fn = nullptr, *out_fn = nullptr, *in_fn = nullptr;
+    uint32_t parse_us = 0;
+    // no getopt, unistd.h and mbed both declare sleep()
+    for (int i = 1; i < argc; ++i) {
+        const char *a = argv[i];
+        if (a[0] != '-') {
+            if (in_fn != nullptr) usage();
+            in_fn = a;
+            continue;
+        }
+        if (a[1] == '\0' || a[2] != '\0' || i + 1 >= argc) usage();
+        const char *v = argv[++i];
+        switch (a[1]) {
+            case 'c': config_fn = v; break;
+            case 'f':
+                if (strcmp(v, "vcd") == 0) vcd = true;
+                else if (strcmp(v, "csv") != 0) usage();
+                break;
+            case 'o': out_fn = v; break;
+            case 'p': parse_us = strtoul(v, nullptr, 10); break;
+            default: usage();
+        }
+    }
+    if (in_fn == nullptr) usage();
+
+    FILE *in = fopen(in_fn, "r");
+    if (in == nullptr) {
+        fprintf(stderr, "can not open %s\n", in_fn);
+        return 1;
+    }
+    out = out_fn != nullptr ? fopen(out_fn, "w") : stdout;
+    if (out == nullptr) {
+        fprintf(stderr, "can not open %s\n", out_fn);
+        return 1;
+    }
+
+    _ahb = new MemoryPool(ahb_ram, sizeof(ahb_ram));
+    Kernel *kernel = new(calloc(1, sizeof(Kernel))) Kernel();
+
+    std::string config;
+    if (config_fn != nullptr) {
+        if (!read_file(config_fn, config)) {
+            fprintf(stderr, "can not read %s\n", config_fn);
+            return 1;
+        }
+        test_kernel_setup_config(config.data(), config.data() + config.size());
+    } else {
+        test_kernel_setup_config(_binary_config_default_start, _binary_config_default_end);
+    }
+
+    // nothing else is loaded to answer these, and the test kernel would say so on stdout
+    test_kernel_trap_event(ON_ENABLE, [](void *) {});
+    test_kernel_trap_event(ON_GET_PUBLIC_DATA, [](void *) {});
+    test_kernel_trap_event(ON_SET_PUBLIC_DATA, [](void *) {});
+    // the conveyor waits for room in the queue in on_idle, which is where the ticker gets to run
+    test_kernel_trap_event(ON_IDLE, [](void *) { idle_tick(); });
+
+    // the test kernel does not set the step ticker up from the config
+    StepTicker::getInstance()->set_coast_time(THEKERNEL->config->value(CHECKSUM("step_coast_max_us"))->by_default(1000)->as_number());
+
+    THECONVEYOR->on_module_loaded();
+    THEROBOT = new Robot();
+    THEROBOT->on_module_loaded();
+    THEKERNEL->planner = new Planner();
+    THECONVEYOR->start(THEROBOT->get_number_registered_motors());
+
+    motors.resize(THEROBOT->get_number_registered_motors());
+    for (size_t m = 0; m < motors.size(); ++m) {
+        motors[m] = {(int32_t)THEROBOT->actuators[m]->get_current_step(), THEROBOT->actuators[m]->which_direction(), 0, 0};
+    }
+
+    if (vcd) vcd_header(motors.size());
+    else fprintf(out, "time_us,motor,position,velocity\n");
+
+    char line[256];
+    uint32_t lines = 0, line_no = 0;
+    input_left = true;
+    ahb_free_min = AHB.free();
+    // the same stats the player keeps on the machine
+    THECONVEYOR->start_queue_stats();
+    double start = now_secs();
+    while (fgets(line, sizeof(line), in) != nullptr) {
+        ++line_no;
+        if (!clean(line)) continue;
+        double t = now_secs();
+        in_line = true;
+        Gcode gc(line, &StreamOutput::NullStream, true, line_no);
+        THEROBOT->on_gcode_received(&gc);
+        in_line = false;
+        line_secs += now_secs() - t;
+        ++lines;
+        run_us(parse_us);
+        THEKERNEL->call_event(ON_IDLE);
+        sample_memory();
+    }
+    input_left = false;
+    fclose(in);
+    THECONVEYOR->stop_queue_stats();
+
+    THECONVEYOR->wait_for_idle();
+    double wall = now_secs() - start;
+    if (out != stdout) fclose(out);
+
+    double secs = tick_ns(ticks) / 1e9;
+    fprintf(stderr, "lines %u, blocks %u, %.3f s simulated\n", lines, blocks, secs);
+    // how fast this PC parses and plans, to compare builds with rather than to say what the board does
+    fprintf(stderr, "%.3f s run, %.3f s parsing and planning, %.0f lines/s, %.0f blocks/s\n", wall, line_secs,
+            line_secs > 0 ? lines / line_secs : 0, line_secs > 0 ? blocks / line_secs : 0);
+    fprintf(stderr, "heap peak %zu, AHB free min %u\n", heap_peak, ahb_free_min);
+    for (size_t m = 0; m < motors.size(); ++m) {
+        fprintf(stderr, "%c: %u steps, at %.4f\n", motor_names[m], motors[m].count, THEROBOT->actuators[m]->get_current_position());
+    }
+    fprintf(stderr, "starved %u times for %.3f s\n", starved, tick_ns(starved_ticks) / 1e9);
+    StderrStream err;
+    THECONVEYOR->print_queue_stats(&err);
+
+    kernel->~Kernel();
+    free(kernel);
+    return 0;
+}
@@ -0,0 +1,173 @@
+/*
+ * Host stand in for the CMSIS Cortex-M3 core header, used by the host build of the test framework.
+ *
+ * The real one is ARM assembler and fixed addresses in the system control space. Here the
+ * interrupt calls do nothing or just record the state, and the core peripherals are plain
+ * structs so code that sets them up runs. The LPC peripherals are left at their real addresses,
+ * which HostHal.cpp maps as ordinary memory.
+ */
+
+#ifndef __CORE_CM3_H_GENERIC
+#define __CORE_CM3_H_GENERIC
+#define __CORE_CM3_H_DEPENDANT
+// and the copy in libs/LPC17xx
+#define __CM3_CORE_H__
+
+#include <stdint.h>
+
+#define __CM3_CMSIS_VERSION_MAIN  (0x03)
+#define __CM3_CMSIS_VERSION_SUB   (0x01)
+#define __CORTEX_M                (0x03)
+
+#define __ASM            __asm
+#define __INLINE         inline
+#define __STATIC_INLINE  static inline
+
+#ifdef __cplusplus
+  #define   __I     volatile
+#else
+  #define   __I     volatile const
+#endif
+#define     __O     volatile
+#define     __IO    volatile
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct
+{
+  __IO uint32_t ISER[8];
+       uint32_t RESERVED0[24];
+  __IO uint32_t ICER[8];
+       uint32_t RSERVED1[24];
+  __IO uint32_t ISPR[8];
+       uint32_t RESERVED2[24];
+  __IO uint32_t ICPR[8];
+       uint32_t RESERVED3[24];
+  __IO uint32_t IABR[8];
+       uint32_t RESERVED4[56];
+  __IO uint8_t  IP[240];
+       uint32_t RESERVED5[644];
+  __O  uint32_t STIR;
+}  NVIC_Type;
+
+typedef struct
+{
+  __I  uint32_t CPUID;
+  __IO uint32_t ICSR;
+  __IO uint32_t VTOR;
+  __IO uint32_t AIRCR;
+  __IO uint32_t SCR;
+  __IO uint32_t CCR;
+  __IO uint8_t  SHP[12];
+  __IO uint32_t SHCSR;
+  __IO uint32_t CFSR;
+  __IO uint32_t HFSR;
+  __IO uint32_t DFSR;
+  __IO uint32_t MMFAR;
+  __IO uint32_t BFAR;
+  __IO uint32_t AFSR;
+} SCB_Type;
+
+typedef struct
+{
+  __IO uint32_t CTRL;
+  __IO uint32_t LOAD;
+  __IO uint32_t VAL;
+  __I  uint32_t CALIB;
+} SysTick_Type;
+
+typedef struct
+{
+  __IO uint32_t CTRL;
+  __IO uint32_t CYCCNT;
+} DWT_Type;
+
+typedef struct
+{
+  __IO uint32_t DHCSR;
+  __O  uint32_t DCRSR;
+  __IO uint32_t DCRDR;
+  __IO uint32_t DEMCR;
+} CoreDebug_Type;
+
+extern NVIC_Type host_nvic;
+extern SCB_Type host_scb;
+extern SysTick_Type host_systick;
+extern DWT_Type host_dwt;
+extern CoreDebug_Type host_core_debug;
+// what __disable_irq() and __enable_irq() last set
+extern volatile uint32_t host_primask;
+
+#define NVIC                ((NVIC_Type *) &host_nvic)
+#define SCB                 ((SCB_Type *) &host_scb)
+#define SysTick             ((SysTick_Type *) &host_systick)
+#define DWT                 ((DWT_Type *) &host_dwt)
+#define CoreDebug           ((CoreDebug_Type *) &host_core_debug)
+
+#define SCB_ICSR_PENDSVSET_Msk       (1UL << 28)
+#define SCB_ICSR_PENDSVCLR_Msk       (1UL << 27)
+#define SysTick_CTRL_ENABLE_Msk      (1UL << 0)
+#define SysTick_CTRL_TICKINT_Msk     (1UL << 1)
+#define SysTick_CTRL_CLKSOURCE_Msk   (1UL << 2)
+#define SysTick_CTRL_COUNTFLAG_Msk   (1UL << 16)
+#define DWT_CTRL_CYCCNTENA_Msk       (1UL << 0)
+#define CoreDebug_DEMCR_TRCENA_Msk   (1UL << 24)
+#define CoreDebug_DEMCR_TRCENA       CoreDebug_DEMCR_TRCENA_Msk
+
+// the firmware reaches the cycle counter by address where these are not defined already
+#define DEMCR                        (CoreDebug->DEMCR)
+#define DWT_CTRL                     (DWT->CTRL)
+#define DWT_CYCCNT                   (DWT->CYCCNT)
+
+/* core instructions, the barriers only have to stop the compiler reordering */
+__STATIC_INLINE void __NOP(void) {}
+__STATIC_INLINE void __WFI(void) {}
+__STATIC_INLINE void __WFE(void) {}
+__STATIC_INLINE void __SEV(void) {}
+__STATIC_INLINE void __ISB(void) { __asm__ __volatile__ ("" ::: "memory"); }
+__STATIC_INLINE void __DSB(void) { __asm__ __volatile__ ("" ::: "memory"); }
+__STATIC_INLINE void __DMB(void) { __asm__ __volatile__ ("" ::: "memory"); }
+__STATIC_INLINE uint32_t __REV(uint32_t value) { return __builtin_bswap32(value); }
+__STATIC_INLINE uint32_t __REV16(uint32_t value) { return ((value & 0xFF00FF00UL) >> 8) | ((value & 0x00FF00FFUL) << 8); }
+__STATIC_INLINE uint32_t __RBIT(uint32_t value) {
+  uint32_t r = 0;
+  for (int i = 0; i < 32; i++) { r = (r << 1) | (value & 1); value >>= 1; }
+  return r;
+}
+__STATIC_INLINE uint8_t __CLZ(uint32_t value) { return value == 0 ? 32 : __builtin_clz(value); }
+
+/* core functions */
+__STATIC_INLINE void __enable_irq(void) { host_primask = 0; }
+__STATIC_INLINE void __disable_irq(void) { host_primask = 1; }
+__STATIC_INLINE uint32_t __get_PRIMASK(void) { return host_primask; }
+__STATIC_INLINE void __set_PRIMASK(uint32_t priMask) { host_primask = priMask; }
+__STATIC_INLINE uint32_t __get_BASEPRI(void) { return 0; }
+__STATIC_INLINE void __set_BASEPRI(uint32_t value) { (void)value; }
+__STATIC_INLINE uint32_t __get_IPSR(void) { return 0; }
+__STATIC_INLINE uint32_t __get_CONTROL(void) { return 0; }
+__STATIC_INLINE uint32_t __get_MSP(void) { return 0; }
+__STATIC_INLINE uint32_t __get_PSP(void) { return 0; }
+
+/* NVIC, the interrupts are never taken on the host, the tests call the handlers themselves */
+__STATIC_INLINE void NVIC_SetPriorityGrouping(uint32_t PriorityGroup) { (void)PriorityGroup; }
+__STATIC_INLINE void NVIC_EnableIRQ(IRQn_Type IRQn) { NVIC->ISER[((uint32_t)(IRQn) >> 5)] = (1 << ((uint32_t)(IRQn) & 0x1F)); }
+__STATIC_INLINE void NVIC_DisableIRQ(IRQn_Type IRQn) { NVIC->ICER[((uint32_t)(IRQn) >> 5)] = (1 << ((uint32_t)(IRQn) & 0x1F)); }
+__STATIC_INLINE void NVIC_SetPendingIRQ(IRQn_Type IRQn) { NVIC->ISPR[((uint32_t)(IRQn) >> 5)] |= (1 << ((uint32_t)(IRQn) & 0x1F)); }
+__STATIC_INLINE void NVIC_ClearPendingIRQ(IRQn_Type IRQn) { NVIC->ISPR[((uint32_t)(IRQn) >> 5)] &= ~(1 << ((uint32_t)(IRQn) & 0x1F)); }
+__STATIC_INLINE uint32_t NVIC_GetPendingIRQ(IRQn_Type IRQn) { return (NVIC->ISPR[(uint32_t)(IRQn) >> 5] >> ((uint32_t)(IRQn) & 0x1F)) & 1; }
+__STATIC_INLINE void NVIC_SetPriority(IRQn_Type IRQn, uint32_t priority) { if ((int32_t)IRQn >= 0) NVIC->IP[(uint32_t)(IRQn)] = (uint8_t)(priority << 3); }
+__STATIC_INLINE uint32_t NVIC_GetPriority(IRQn_Type IRQn) { return (int32_t)IRQn >= 0 ? NVIC->IP[(uint32_t)(IRQn)] >> 3 : 0; }
+void NVIC_SystemReset(void);
+
+__STATIC_INLINE uint32_t SysTick_Config(uint32_t ticks) { SysTick->LOAD = ticks - 1; SysTick->CTRL = SysTick_CTRL_ENABLE_Msk; return 0; }
+
+#define ITM_RXBUFFER_EMPTY    0x5AA55AA5
+__STATIC_INLINE uint32_t ITM_SendChar(uint32_t ch) { return ch; }
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
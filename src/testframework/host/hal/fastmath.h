@@ -0,0 +1,2 @@
+/* newlib only, the host libm has the same functions */
+#include <math.h>
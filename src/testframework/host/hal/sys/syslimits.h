@@ -0,0 +1,3 @@
+/* newlib has NAME_MAX and PATH_MAX here, glibc in limits.h, and mkdir() comes with it there */
+#include <limits.h>
+#include <sys/stat.h>
@@ -0,0 +1,33 @@
+#include "EventTrace.h"
+#include "StringStream.h"
+
+#include <string>
+
+#include "easyunit/test.h"
+
+TEST(EventTraceTest, ring_keeps_the_newest)
+{
+    // off records nothing
+    EventTrace::record(EventTrace::SD_READ);
+    ASSERT_TRUE(EventTrace::ring == nullptr);
+
+    ASSERT_TRUE(EventTrace::start(4));
+    for (int i = 0; i < 6; i++) {
+        EventTrace::begin(EventTrace::SD_READ, i);
+    }
+    EventTrace::end(EventTrace::BLOCK, 77);
+
+    StringStream ss;
+    EventTrace::print(&ss);
+    std::string out = ss.getOutput();
+
+    // the oldest three were overwritten, what is left is printed oldest first
+    ASSERT_TRUE(out.find("4 entries") != std::string::npos);
+    ASSERT_TRUE(out.find("sd_read B 2\n") == std::string::npos);
+    size_t a = out.find("sd_read B 3\n"), b = out.find("sd_read B 5\n"), c = out.find("block E 77\n");
+    ASSERT_TRUE(a != std::string::npos && b != std::string::npos && c != std::string::npos);
+    ASSERT_TRUE(a < b && b < c);
+
+    EventTrace::stop();
+    ASSERT_TRUE(EventTrace::ring == nullptr);
+}
@@ -0,0 +1,60 @@
+#include "Task.h"
+
+#include <string>
+
+#include "easyunit/test.h"
+
+namespace {
+    // counts to n a step at a time, then waits for the gate to open
+    class CountTask : public Task {
+        public:
+            CountTask(int n, std::string &log, bool &gate, bool &deleted) : n(n), i(0), log(log), gate(gate), deleted(deleted) {}
+            ~CountTask() { deleted = true; }
+
+        protected:
+            bool step()
+            {
+                TASK_BEGIN();
+                for (i = 0; i < n; ++i) {
+                    log += (char)('0' + i);
+                    TASK_YIELD();
+                }
+                TASK_WAIT_UNTIL(gate);
+                log += 'e';
+                TASK_END();
+            }
+
+        private:
+            int n, i;
+            std::string &log;
+            bool &gate;
+            bool &deleted;
+    };
+}
+
+TEST(TaskTest, steps_and_waits)
+{
+    std::string log;
+    bool gate = false, deleted = false;
+    Task::start(new CountTask(3, log, gate, deleted));
+    ASSERT_EQUALS_V(1, (int)Task::running());
+
+    // one step each pass
+    Task::run_all();
+    ASSERT_TRUE(log == "0");
+    Task::run_all();
+    Task::run_all();
+    ASSERT_TRUE(log == "012");
+
+    // stays until the gate opens
+    Task::run_all();
+    Task::run_all();
+    ASSERT_TRUE(log == "012");
+    ASSERT_TRUE(!deleted);
+
+    gate = true;
+    Task::run_all();
+    ASSERT_TRUE(log == "012e");
+    ASSERT_TRUE(deleted);
+    ASSERT_EQUALS_V(0, (int)Task::running());
+}
@@ -1,12 +1,14 @@
 #include "utils.h"
 
 #include "Gcode.h"
+#include "Kernel.h"
 
 #include <vector>
 #include <stdio.h>
 #include <string.h>
 
 #include "easyunit/test.h"
+#include "easyunit/bench.h"
 
 TEST(GCodeTest,subcode)
 {
@@ -60,3 +62,113 @@ TEST(GCodeTest,subcode)
     ASSERT_EQUALS_DELTA_V(2.3, gc4.get_value('Y'), 0.001);
 
 }
+
+TEST(GCodeTest,cached_values)
+{
+    Gcode gc1("G1 X1.5 Y-2.25 F1000", nullptr);
+
+    ASSERT_TRUE(gc1.has_letter('X'));
+    ASSERT_TRUE(!gc1.has_letter('Z'));
+    ASSERT_EQUALS_DELTA_V(1.5, gc1.get_value('X'), 0.001);
+    // second lookup comes from the cache and must agree
+    ASSERT_EQUALS_DELTA_V(1.5, gc1.get_value('X'), 0.001);
+    ASSERT_EQUALS_DELTA_V(-2.25, gc1.get_value('Y'), 0.001);
+    ASSERT_EQUALS_DELTA_V(1000, gc1.get_value('F'), 0.001);
+
+    char *p= (char *)1;
+    ASSERT_EQUALS_DELTA_V(0, gc1.get_value('Z', &p), 0.001);
+    ASSERT_TRUE(p == nullptr);
+
+    ASSERT_EQUALS_DELTA_V(-2.25, gc1.get_value('Y', &p), 0.001);
+    // the expression parser also skips the space after the number
+    ASSERT_TRUE(p != nullptr && strcmp(p, "F1000") == 0);
+}
+
+TEST(GCodeTest,long_command)
+{
+    // longer than the inline buffer so it is stored on the heap
+    Gcode gc1("G1 X1.111111 Y2.222222 Z3.333333 A4.444444 B5.555555 F600", nullptr);
+
+    ASSERT_TRUE(gc1.has_g);
+    ASSERT_EQUALS_V(1, gc1.g);
+    ASSERT_EQUALS_V(6, gc1.get_num_args());
+    ASSERT_EQUALS_DELTA_V(5.555555, gc1.get_value('B'), 0.0001);
+
+    Gcode *gc2= new Gcode(gc1);
+    ASSERT_EQUALS_DELTA_V(3.333333, gc2->get_value('Z'), 0.0001);
+    delete gc2;
+}
+
+TEST(GCodeTest,from_words)
+{
+    float values[26];
+    values['X' - 'A']= 10.5F;
+    values['F' - 'A']= 1200;
+    Gcode gc1(1, (1UL << ('X' - 'A')) | (1UL << ('F' - 'A')), values, nullptr);
+
+    ASSERT_TRUE(gc1.has_g);
+    ASSERT_TRUE(!gc1.has_m);
+    ASSERT_EQUALS_V(1, gc1.g);
+    ASSERT_TRUE(gc1.has_letter('X'));
+    ASSERT_TRUE(!gc1.has_letter('Y'));
+    ASSERT_EQUALS_V(2, gc1.get_num_args());
+    ASSERT_EQUALS_DELTA_V(10.5, gc1.get_value('X'), 0.001);
+    ASSERT_EQUALS_V(1200, gc1.get_int('F'));
+
+    // the words survive a copy even though there is no text
+    Gcode gc2(gc1);
+    ASSERT_EQUALS_DELTA_V(10.5, gc2.get_value('X'), 0.001);
+    ASSERT_EQUALS_DELTA_V(1200, gc2.get_value('F'), 0.001);
+}
+
+TEST(GCodeTest,compiled_expressions)
+{
+    // the same text is compiled once, and each run reads the variables as they are now
+    THEKERNEL->local_vars[0]= 3; // #101
+    Gcode gc1("G1 X[#101*2+1] Y#101 Z[2^3 mod 5]", nullptr);
+    char *p;
+    ASSERT_EQUALS_DELTA_V(7, gc1.get_value('X', &p), 0.001);
+    ASSERT_TRUE(p != nullptr && strcmp(p, "Y#101 Z[2^3 mod 5]") == 0);
+    ASSERT_EQUALS_DELTA_V(3, gc1.get_value('Y'), 0.001);
+    ASSERT_EQUALS_DELTA_V(3, gc1.get_value('Z'), 0.001);
+
+    THEKERNEL->local_vars[0]= 4;
+    Gcode gc2("G1 X[#101*2+1] Y#101", nullptr);
+    ASSERT_EQUALS_DELTA_V(9, gc2.get_value('X'), 0.001);
+    ASSERT_EQUALS_DELTA_V(4, gc2.get_value('Y'), 0.001);
+
+    // text that starts the same but carries on is not mistaken for the cached one
+    Gcode gc3("G1 X[#101*2+1]*2", nullptr);
+    ASSERT_EQUALS_DELTA_V(18, gc3.get_value('X'), 0.001);
+
+    // a comparison takes everything after it, as the interpreter does
+    Gcode gc4("G1 X[#101 eq 4 and 1] Y[abs[-2] + sqrt[16]] Z[[#101 eq 4] and 1]", nullptr);
+    ASSERT_EQUALS_DELTA_V(0, gc4.get_value('X'), 0.001);
+    ASSERT_EQUALS_DELTA_V(1, gc4.get_value('Z'), 0.001);
+    ASSERT_EQUALS_DELTA_V(6, gc4.get_value('Y'), 0.001);
+    THEKERNEL->local_vars[0]= -100000;
+}
+
+TEST(GCodeTest,get_args)
+{
+    Gcode gc("M665 R12.5 L200 S1", nullptr);
+    LetterMap<float> args= gc.get_args();
+    ASSERT_EQUALS_V(3, (int)args.size());
+    ASSERT_EQUALS_DELTA_V(200, args['L'], 0.001);
+    ASSERT_TRUE(args.find('X') == args.end());
+
+    // in letter order, like the map it replaced
+    args.erase('S');
+    std::string letters;
+    for(auto &i : args) letters += i.first;
+    ASSERT_TRUE(letters == "LR");
+    ASSERT_EQUALS_DELTA_V(12.5, args.find('R')->second, 0.001);
+}
+
+// a typical CAM line, parsed and its cached values prepared
+BENCH(GCodeTest,parse,1000)
+{
+    while (next()) {
+        Gcode gc("G1 X12.345 Y-6.789 Z0.5 F1500", nullptr);
+    }
+}
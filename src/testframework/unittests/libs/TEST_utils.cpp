@@ -1,10 +1,26 @@
 #include "utils.h"
+#include "crc16.h"
+#include "FixedFormat.h"
+#include "FixedPoint.h"
+#include "RSqrt.h"
+#include "Counters.h"
+#include "Scratch.h"
+#include "Module.h"
+#include "ConfigValue.h"
+#include "ConfigCache.h"
+#include "FirmConfigSource.h"
+#include "StringStream.h"
+#include "ProbeLog.h"
 
 #include <vector>
+#include <algorithm>
 #include <stdio.h>
 #include <string.h>
+#include <math.h>
+#include <string>
 
 #include "easyunit/test.h"
+#include "easyunit/bench.h"
 
 TEST(UtilsTest,split)
 {
@@ -45,3 +61,224 @@ TEST(UtilsTest,append_parameters)
     ASSERT_TRUE(n == 24);
     ASSERT_TRUE(strcmp(buf, "X1.0000 Y2.0000 Z3.0000 ") == 0);
 }
+
+TEST(UtilsTest,crc16_ccitt)
+{
+    // the standard check value for CRC16-CCITT with an initial value of 0 (XMODEM)
+    const char *s= "123456789";
+    ASSERT_EQUALS_V(0x31C3, crc16_ccitt(s, 9));
+
+    // continuing from a previous result gives the same as one pass
+    uint16_t crc= crc16_ccitt(s, 4);
+    ASSERT_EQUALS_V(0x31C3, crc16_ccitt(s + 4, 5, crc));
+}
+
+TEST(UtilsTest,format_fixed)
+{
+    char buf[32], ref[32];
+    const float values[]= {0, 1, -1, 2.5F, 3.5F, 0.125F, 0.00005F, -0.00004F, 123.45675F, -371.0F, 9.99996F, 2500000.5F, 1e12F};
+    for(float v : values) {
+        for (int d = 0; d <= 4; ++d) {
+            size_t n= format_fixed(buf, sizeof(buf), v, d);
+            snprintf(ref, sizeof(ref), "%1.*f", d, v);
+            ASSERT_TRUE(n == strlen(ref));
+            ASSERT_TRUE(strcmp(buf, ref) == 0);
+        }
+    }
+
+    // cut short, always terminated
+    ASSERT_EQUALS_V(3, (int)format_fixed(buf, 4, -12.5F, 1));
+    ASSERT_TRUE(strcmp(buf, "-12") == 0);
+
+    format_int(buf, sizeof(buf), -2147483647L - 1);
+    ASSERT_TRUE(strcmp(buf, "-2147483648") == 0);
+}
+
+TEST(UtilsTest,q16_bilerp)
+{
+    // a cell of the height map, corners in mm
+    const float z1 = 0.125F, z2 = -0.0731F, z3 = 0.342F, z4 = -0.2F;
+    q16_t a = q16_from_float(z1), b = q16_from_float(z3 - z1), c = q16_from_float(z2 - z1), d = q16_from_float(z1 - z2 - z3 + z4);
+    for (int i = 0; i <= 16; i++) {
+        for (int j = 0; j <= 16; j++) {
+            float rx = i / 16.0F, ry = j / 16.0F;
+            float expect = z1 + (z3 - z1) * rx + ((z2 - z1) + (z1 - z2 - z3 + z4) * rx) * ry;
+            float got = q16_to_float(q16_bilerp(a, b, c, d, q16_from_float(rx), q16_from_float(ry)));
+            ASSERT_TRUE(fabsf(got - expect) < 1e-4F);
+        }
+    }
+
+    // the cell and the ratio across it, from a position in mm and cells per mm
+    q16_t grid = q16_scale(q16_from_float(123.4F) - q16_from_float(-10.0F), q24_from_float(4.0F / 300.0F));
+    float expect = (123.4F + 10.0F) * 4.0F / 300.0F;
+    ASSERT_EQUALS_V(1, q16_floor(grid));
+    ASSERT_TRUE(fabsf(q16_to_float(q16_frac(grid)) - (expect - 1)) < 1e-4F);
+}
+
+TEST(UtilsTest,sqrtf_fast)
+{
+    // speeds, accelerations and their squares, with every exponent parity and mantissa table entry on the way
+    for (float x = 1e-6F; x < 1e12F; x *= 1.01F) {
+        ASSERT_TRUE(fabsf(sqrtf_fast(x) / sqrtf(x) - 1.0F) < 1e-6F);
+    }
+    ASSERT_TRUE(sqrtf_fast(0.0F) == 0.0F);
+    ASSERT_TRUE(fabsf(sqrtf_fast(4.0F) - 2.0F) < 1e-6F);
+    ASSERT_TRUE(isnan(sqrtf_fast(-1.0F)));
+    ASSERT_TRUE(isinf(sqrtf_fast(INFINITY)));
+}
+
+TEST(UtilsTest,counters)
+{
+    static volatile uint32_t lines= 0;
+    Counters::add("test_lines", &lines);
+    lines= 42;
+
+    // a name registered again replaces the first, rather than showing twice
+    static volatile uint32_t other= 7;
+    Counters::add("test_lines", &other);
+
+    StringStream ss;
+    Counters::print_json(&ss);
+    std::string out= ss.getOutput();
+    ASSERT_TRUE(out[0] == '{' && out.find("}\n") == out.size() - 2);
+    ASSERT_TRUE(out.find("\"test_lines\":7") != std::string::npos);
+    ASSERT_TRUE(out.find("\"test_lines\":42") == std::string::npos);
+
+    Counters::reset();
+    ASSERT_EQUALS_V(0, (int)other);
+}
+
+TEST(UtilsTest,scratch_lease)
+{
+    {
+        Scratch::Lease upload(Scratch::TRANSFER, "upload");
+        ASSERT_TRUE(upload.get() != nullptr);
+        ASSERT_EQUALS_V(8200, (int)upload.size());
+
+        // a second claim is refused while the first holds it, the other buffer is still free
+        Scratch::Lease ls(Scratch::TRANSFER, "ls");
+        ASSERT_TRUE(ls.get() == nullptr);
+        ASSERT_EQUALS_V(0, (int)ls.size());
+        ASSERT_TRUE(strcmp(Scratch::owner(Scratch::TRANSFER), "upload") == 0);
+        ASSERT_TRUE(Scratch::owner(Scratch::BLOCK) == nullptr);
+
+        upload.give_back();
+        ASSERT_TRUE(Scratch::owner(Scratch::TRANSFER) == nullptr);
+        ASSERT_TRUE(Scratch::claim(Scratch::TRANSFER, "md5") != nullptr);
+        Scratch::release(Scratch::TRANSFER);
+
+        Scratch::Lease block(Scratch::BLOCK, "md5");
+        StringStream ss;
+        Scratch::print(&ss);
+        ASSERT_TRUE(ss.getOutput().find("block: 4096 bytes, md5") != std::string::npos);
+    }
+    // given back at the end of the scope
+    ASSERT_TRUE(Scratch::owner(Scratch::BLOCK) == nullptr);
+}
+
+TEST(UtilsTest,config_cache_compact)
+{
+    static const char cfg[] =
+        "alpha_enable true\n"
+        "beta_enable true # comment\n"
+        "gamma_name spindle\n"
+        "alpha_enable false\n";
+    FirmConfigSource source("rom", cfg, &cfg[sizeof(cfg) - 1]);
+    ConfigCache cache;
+    source.transfer_values_to_cache(&cache);
+    ASSERT_TRUE(cache.compact());
+
+    // three values and the texts "false", "spindle" and "true" once each
+    ASSERT_EQUALS_V(3, (int)cache.size());
+    ASSERT_EQUALS_V(3 * (int)sizeof(ConfigValue) + 6 + 8 + 5, (int)cache.packed_size());
+
+    // the later line replaced the first and lookups still find them in the packed block
+    uint16_t cs[3];
+    get_checksums(cs, "alpha_enable");
+    ASSERT_TRUE(!cache.lookup(cs)->as_bool());
+    get_checksums(cs, "beta_enable");
+    ASSERT_TRUE(cache.lookup(cs)->as_bool());
+    get_checksums(cs, "gamma_name");
+    ASSERT_TRUE(cache.lookup(cs)->as_string() == "spindle");
+    get_checksums(cs, "delta_name");
+    ASSERT_TRUE(cache.lookup(cs) == NULL);
+}
+
+namespace {
+    class IdleCounter : public Module {
+        public:
+            int idles = 0;
+            void on_idle(void *) { idles++; }
+    };
+}
+
+TEST(UtilsTest,event_handler)
+{
+    IdleCounter m;
+    EventHandler fnc = event_handler(&m, ON_IDLE);
+    ASSERT_TRUE(fnc != nullptr);
+    fnc(&m, nullptr);
+    ASSERT_EQUALS_V(1, m.idles);
+
+    // left as the empty one in Module, so no need to call it
+    ASSERT_TRUE(event_handler(&m, ON_MAIN_LOOP) == nullptr);
+}
+
+// a 256 byte upload packet
+BENCH(UtilsTest,crc16_ccitt,1000)
+{
+    char buf[256];
+    for (int i = 0; i < 256; i++) buf[i] = i * 7;
+    volatile uint16_t crc = 0;
+    while (next()) {
+        crc = crc16_ccitt(buf, sizeof(buf), crc);
+    }
+}
+
+TEST(UtilsTest,probe_log)
+{
+    ProbeLog log;
+    ASSERT_TRUE(!log.is_quiet());
+    ASSERT_TRUE(log.start(4, nullptr, true));
+    ASSERT_TRUE(log.is_quiet());
+
+    // without a spill file the oldest go once the ring is full
+    for (int i = 0; i < 6; ++i) log.add(i, 2 * i, -i, i != 3, ProbeLog::G38);
+    StringStream ss;
+    log.print_csv(&ss);
+    ASSERT_TRUE(ss.getOutput() == "seq,x,y,z,ok,source\n2,2.0000,4.0000,-2.0000,1,0\n3,3.0000,6.0000,-3.0000,0,0\n"
+                                  "4,4.0000,8.0000,-4.0000,1,0\n5,5.0000,10.0000,-5.0000,1,0\n");
+    ss.clear();
+    log.print_status(&ss);
+    ASSERT_TRUE(ss.getOutput().find("4 of 4") != std::string::npos);
+    ASSERT_TRUE(ss.getOutput().find("2 dropped") != std::string::npos);
+
+    // with one every point is kept, the spilled ones come back first
+    const char *path = "probe_log_test.bin";
+    ASSERT_TRUE(log.start(2, path, false));
+    for (int i = 0; i < 5; ++i) log.add(i, 0, 0, true, ProbeLog::GRID);
+    ss.clear();
+    log.print_csv(&ss);
+    std::string out = ss.getOutput();
+    ASSERT_EQUALS_V(6, (int)std::count(out.begin(), out.end(), '\n'));
+    ASSERT_TRUE(out.find("\n0,0.0000") != std::string::npos);
+    ASSERT_TRUE(out.find("\n4,4.0000") != std::string::npos);
+    log.stop();
+    remove(path);
+}
+
+TEST(UtilsTest, base64_decode)
+{
+    // a raster row, 0 0 255 128 16 stops at the padding
+    uint8_t out[8];
+    ASSERT_EQUALS_V(5, (int)base64_decode("AAD/gBA=\n", out, sizeof(out)));
+    ASSERT_EQUALS_V(0, out[0]);
+    ASSERT_EQUALS_V(255, out[2]);
+    ASSERT_EQUALS_V(128, out[3]);
+    ASSERT_EQUALS_V(16, out[4]);
+
+    // never more than it has room for
+    ASSERT_EQUALS_V(3, (int)base64_decode("TWFuTWFu", out, 3));
+    ASSERT_TRUE(memcmp(out, "Man", 3) == 0);
+    ASSERT_EQUALS_V(0, (int)base64_decode("", out, sizeof(out)));
+}
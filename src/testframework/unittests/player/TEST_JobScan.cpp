@@ -0,0 +1,59 @@
+#include "JobScan.h"
+
+#include <math.h>
+#include <stdio.h>
+
+#include "easyunit/test.h"
+
+static void scan_program(JobScan &scan, const char *const *program)
+{
+    scan.begin();
+    for (int i = 0; program[i] != nullptr; i++) scan.line(program[i]);
+}
+
+TEST(JobScan, bounds_tools_and_feeds)
+{
+    static const char *const program[] = {
+        "G21 G90 G54\n",
+        "T3 M6\n",
+        "G0 X10 Y10 Z5\n",
+        "G1 Z-2 F300\n",
+        "G2 X30 Y10 I10 J0 F1200\n",    // half circle over the top to Y20
+        "G91 G1 X-5\n",
+        "M6 T7\n",
+        "G90 G53 G0 Z0\n",              // machine coordinates are left out
+        "G12 X0\n",
+        NULL
+    };
+    JobScan scan;
+    scan_program(scan, program);
+
+    ASSERT_EQUALS_V(9, (int)scan.lines);
+    ASSERT_EQUALS_V(9, (int)scan.first_error);
+    ASSERT_EQUALS_DELTA(10.0F, scan.min[0], 0.001F);
+    ASSERT_EQUALS_DELTA(30.0F, scan.max[0], 0.001F);
+    ASSERT_EQUALS_DELTA(10.0F, scan.min[1], 0.001F);
+    ASSERT_TRUE(fabsf(scan.max[1] - 20.0F) < 0.01F);
+    ASSERT_EQUALS_DELTA(-2.0F, scan.min[2], 0.001F);
+    ASSERT_EQUALS_DELTA(5.0F, scan.max[2], 0.001F);
+    ASSERT_EQUALS_V(2, (int)scan.tool_count);
+    ASSERT_EQUALS_V(3, scan.tools[0]);
+    ASSERT_EQUALS_V(7, scan.tools[1]);
+
+    // 7mm at F300, half of a 10mm radius circle and the 5mm back at F1200
+    ASSERT_TRUE(fabsf(scan.cut_mm[2] - 7.0F) < 0.01F);
+    ASSERT_TRUE(fabsf(scan.cut_mm[4] - (31.416F + 5.0F)) < 0.01F);
+
+    // kept for a file of the same size only
+    const char *path = "jobscan_test.scan";
+    ASSERT_TRUE(scan.save(path, 1234));
+    JobScan loaded;
+    ASSERT_TRUE(!loaded.load(path, 1235));
+    ASSERT_TRUE(loaded.load(path, 1234));
+    remove(path);
+    ASSERT_EQUALS_V(9, (int)loaded.first_error);
+    ASSERT_EQUALS_V(2, (int)loaded.tool_count);
+    ASSERT_EQUALS_V(7, loaded.tools[1]);
+    ASSERT_TRUE(fabsf(loaded.max[1] - 20.0F) < 0.01F);
+    ASSERT_TRUE(fabsf(loaded.cut_mm[4] - 36.4F) < 0.1F);
+}
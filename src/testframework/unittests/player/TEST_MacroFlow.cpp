@@ -0,0 +1,79 @@
+#include "MacroFlow.h"
+#include "LineReader.h"
+#include "Gcode.h"
+#include "Kernel.h"
+#include "StreamOutput.h"
+#include "Test_kernel.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+#include "easyunit/test.h"
+
+// plays the program the way Player::on_main_loop does, returning the lines that would be sent on
+static std::string play(const char *program)
+{
+    FILE *fp = tmpfile();
+    fputs(program, fp);
+    rewind(fp);
+
+    LineReader reader;
+    reader.attach(fp);
+    MacroFlow flow;
+    std::string played;
+    unsigned long played_lines = 0;
+    char buf[130];
+
+    for (int guard = 0; guard < 1000; ++guard) {
+        if (reader.gets(buf, sizeof(buf)) == NULL) {
+            if (flow.end_of_file(reader, played_lines)) continue;
+            break;
+        }
+        int len = strlen(buf);
+        unsigned long line_no = played_lines + 1;
+        MacroFlow::RESULT r = flow.line(buf, reader.tell() - len, line_no, reader);
+        if (r == MacroFlow::FAIL) break;
+        if (r == MacroFlow::JUMP) {
+            played_lines = line_no;
+            continue;
+        }
+        played_lines += 1;
+        if (r == MacroFlow::SKIP) continue;
+
+        if (buf[0] == '#') {
+            Gcode gc(buf, &StreamOutput::NullStream);
+            gc.set_variable_value();
+        } else {
+            played += buf;
+        }
+    }
+
+    reader.detach();
+    fclose(fp);
+    return played;
+}
+
+TEST(MacroFlow,while_if_goto)
+{
+    bool halted = false;
+    test_kernel_trap_event(ON_HALT, [&halted](void *) { halted = true; });
+
+    std::string out = play(
+        "#101=0\n"
+        "WHILE [#101 LT 3] DO1\n"
+        "G1 X#101\n"
+        "#101=[#101+1]\n"
+        "END1\n"
+        "IF [#101 EQ 3] GOTO 20\n"
+        "G1 X99\n"
+        "N20 G1 Y1\n"
+        "IF [#101 GT 2] THEN G1 Z2\n"
+        "GOTO 10\n"
+        "G1 X98\n");
+    ASSERT_TRUE(out == "G1 X#101\nG1 X#101\nG1 X#101\nN20 G1 Y1\nG1 Z2\n");
+    // there is no N10, which halts once the whole file has been searched
+    ASSERT_TRUE(halted);
+    test_kernel_untrap_event(ON_HALT);
+    THEKERNEL->local_vars[0]= -100000;
+}
@@ -0,0 +1,384 @@
+#include "Kernel.h"
+#include "Robot.h"
+#include "Planner.h"
+#include "Conveyor.h"
+#include "Block.h"
+#include "StepperMotor.h"
+#include "StepTicker.h"
+#include "Gcode.h"
+#include "StreamOutput.h"
+#include "Test_kernel.h"
+#include "ContinuousJog.h"
+
+#include <math.h>
+
+#include "easyunit/test.h"
+#include "easyunit/bench.h"
+
+// only built on the host, the device test kernel has no robot to drive.
+// the config is the machine's five motors, the robot expects the A and B axes to be there
+DECLARE(Planner)
+END_DECLARE
+
+const static char planner_config[]= "\
+default_feed_rate 600 \n\
+default_seek_rate 600 \n\
+acceleration 100 \n\
+junction_deviation 0.05 \n\
+rapid_acceleration 400 \n\
+rapid_junction_deviation 0.01 \n\
+mm_per_line_segment 0 \n\
+alpha_step_pin 1.28 \n\
+alpha_dir_pin 1.29 \n\
+beta_step_pin 1.26 \n\
+beta_dir_pin 1.27 \n\
+gamma_step_pin 1.24 \n\
+gamma_dir_pin 1.25 \n\
+delta_step_pin 1.18 \n\
+delta_dir_pin 1.20 \n\
+epsilon_step_pin 1.21 \n\
+epsilon_dir_pin 1.23 \n\
+alpha_steps_per_mm 100 \n\
+beta_steps_per_mm 100 \n\
+gamma_steps_per_mm 100 \n\
+alpha_max_rate 6000 \n\
+beta_max_rate 6000 \n\
+gamma_max_rate 6000 \n\
+x_axis_max_speed 6000 \n\
+y_axis_max_speed 6000 \n\
+z_axis_max_speed 6000 \n\
+";
+
+static void planner_setup()
+{
+    test_kernel_setup_config(planner_config, &planner_config[sizeof(planner_config)]);
+
+    // the motors stay registered with the step ticker, so there is only ever the one robot
+    if(THEROBOT == nullptr) {
+        THECONVEYOR->on_module_loaded();
+        THEROBOT = new Robot();
+        THEROBOT->on_module_loaded();
+        THECONVEYOR->start(THEROBOT->get_number_registered_motors());
+    }
+    THEKERNEL->planner = new Planner();
+}
+
+// hand every block to the step ticker and back, then let the conveyor clean them up
+static void drain_queue()
+{
+    Block *b;
+    THECONVEYOR->force_queue();
+    while(THECONVEYOR->get_next_block(&b)) THECONVEYOR->block_finished();
+    while(!THECONVEYOR->is_queue_empty()) THECONVEYOR->on_idle(nullptr);
+}
+
+static void planner_teardown()
+{
+    drain_queue();
+    THEROBOT->reset_axis_position(0, 0, 0);
+
+    delete THEKERNEL->planner;
+    THEKERNEL->planner = nullptr;
+    test_kernel_teardown();
+}
+
+SETUP(Planner)
+{
+    planner_setup();
+}
+
+TEARDOWN(Planner)
+{
+    planner_teardown();
+}
+
+static void send(const char *line)
+{
+    Gcode gc(line, &StreamOutput::NullStream);
+    THEROBOT->on_gcode_received(&gc);
+}
+
+TESTF(Planner,straight_junction)
+{
+    send("G1 X10 F600");
+    send("G1 X20");
+    THEROBOT->flush_coalesced();
+    THECONVEYOR->force_queue();
+
+    Block *b;
+    ASSERT_TRUE(THECONVEYOR->get_next_block(&b));
+    ASSERT_EQUALS_V(1000, (int)b->steps[ALPHA_STEPPER]);
+    ASSERT_EQUALS_V(0, (int)b->steps[BETA_STEPPER]);
+    ASSERT_EQUALS_DELTA_V(10, b->nominal_speed, 0.001);
+    // starts at rest, and carries on at full speed into a move in the same direction
+    ASSERT_EQUALS_DELTA_V(0, b->entry_speed, 0.001);
+    ASSERT_EQUALS_DELTA_V(10, b->exit_speed, 0.001);
+}
+
+TESTF(Planner,right_angle_junction)
+{
+    send("G1 X10 F600");
+    send("G1 Y10");
+    THEROBOT->flush_coalesced();
+    THECONVEYOR->force_queue();
+
+    Block *b;
+    ASSERT_TRUE(THECONVEYOR->get_next_block(&b));
+    // the corner speed from the junction deviation, sin(45deg) for 90 degrees
+    float s= sqrtf(0.5F);
+    float v= sqrtf(100 * 0.05F * s / (1 - s));
+    ASSERT_EQUALS_DELTA_V(v, b->exit_speed, 0.01);
+}
+
+TESTF(Planner,rapid_junction)
+{
+    send("G0 X10");
+    send("G0 Y10");
+    THECONVEYOR->force_queue();
+
+    Block *b;
+    ASSERT_TRUE(THECONVEYOR->get_next_block(&b));
+    // G0 has its own acceleration and junction deviation
+    ASSERT_EQUALS_DELTA_V(400, b->acceleration, 0.001);
+    float s= sqrtf(0.5F);
+    float v= sqrtf(400 * 0.01F * s / (1 - s));
+    ASSERT_EQUALS_DELTA_V(v, b->exit_speed, 0.01);
+}
+
+TESTF(Planner,shaped_ramps)
+{
+    // a 20Hz resonance on X eases the acceleration in and out over 50ms, without changing the ramp
+    THEROBOT->actuators[X_AXIS]->set_shaper_time(0.05F);
+    send("G1 X10 F600");
+    THEROBOT->flush_coalesced();
+    THECONVEYOR->force_queue();
+    THEROBOT->actuators[X_AXIS]->set_shaper_time(0);
+
+    Block *b;
+    ASSERT_TRUE(THECONVEYOR->get_next_block(&b));
+    ASSERT_TRUE(b->is_scurve);
+    uint32_t f= THEKERNEL->step_ticker->get_frequency();
+    ASSERT_EQUALS_V((int)roundf(0.05F * f), (int)b->accel_jerk_ticks);
+    ASSERT_EQUALS_V((int)roundf(0.1F * f), (int)b->accelerate_until);
+}
+
+TESTF(Planner,queued_dwell)
+{
+    // the dwell waits in the queue, the moves either side of it stop and start from rest
+    send("G1 X10 F600");
+    send("G4 S1");
+    send("G1 X20");
+    THEROBOT->flush_coalesced();
+    THECONVEYOR->force_queue();
+
+    Block *b;
+    ASSERT_TRUE(THECONVEYOR->get_next_block(&b));
+    ASSERT_EQUALS_DELTA_V(0, b->exit_speed, 0.001);
+    THECONVEYOR->block_finished();
+
+    ASSERT_TRUE(THECONVEYOR->get_next_block(&b));
+    ASSERT_TRUE(b->is_dwell);
+    ASSERT_EQUALS_V((int)THEKERNEL->step_ticker->get_frequency(), (int)b->total_move_ticks);
+    THECONVEYOR->block_finished();
+
+    ASSERT_TRUE(THECONVEYOR->get_next_block(&b));
+    ASSERT_EQUALS_DELTA_V(0, b->entry_speed, 0.001);
+    ASSERT_EQUALS_V(1000, (int)b->steps[ALPHA_STEPPER]);
+}
+
+static void record_event(void *context, uint32_t arg)
+{
+    *static_cast<uint32_t*>(context) = arg;
+}
+
+TESTF(Planner,block_event)
+{
+    // an event queued between two moves happens as the second starts, and does not stop the first for it
+    uint32_t got = 0;
+    send("G1 X10 F600");
+    ASSERT_TRUE(THECONVEYOR->queue_event(Conveyor::event_fnc_t(&record_event, &got), 12000));
+    send("G1 X20");
+    THEROBOT->flush_coalesced();
+    THECONVEYOR->force_queue();
+
+    Block *b;
+    ASSERT_TRUE(THECONVEYOR->get_next_block(&b));
+    ASSERT_TRUE(b->exit_speed > 0);
+    THECONVEYOR->on_idle(nullptr);
+    ASSERT_EQUALS_V(0, (int)got);
+    THECONVEYOR->block_finished();
+
+    ASSERT_TRUE(THECONVEYOR->get_next_block(&b));
+    THECONVEYOR->on_idle(nullptr);
+    ASSERT_EQUALS_V(12000, (int)got);
+}
+
+TESTF(Planner,continuous_jog_horizon)
+{
+    // 50mm/s brakes in 12.5mm at 100mm/s^2, in 1mm blocks that is 13 of them and two spare
+    ContinuousJog jog;
+    float dir[]{1, 0, 0, 0, 0};
+    ASSERT_TRUE(jog.begin(dir, THEROBOT->get_number_registered_motors(), 50));
+    ASSERT_EQUALS_V(15, (int)jog.get_horizon());
+    ASSERT_EQUALS_V(15, (int)THECONVEYOR->queue_pending());
+
+    Block *b;
+    ASSERT_TRUE(THECONVEYOR->get_next_block(&b));
+    ASSERT_EQUALS_DELTA_V(50, b->nominal_speed, 0.001);
+    ASSERT_EQUALS_DELTA_V(0, b->entry_speed, 0.001);
+    ASSERT_TRUE(b->exit_speed > 0);
+    THECONVEYOR->block_finished();
+
+    // one block done gets one more, and the new last one still ends at rest
+    ASSERT_TRUE(jog.feed());
+    ASSERT_EQUALS_V(15, (int)THECONVEYOR->queue_pending());
+    ASSERT_EQUALS_DELTA_V(16, THEROBOT->get_axis_position(X_AXIS), 0.001);
+}
+
+TESTF(Planner,quadratic_spline)
+{
+    // from 0,0 to 10,0 with the control point at 5,5, the top of it is at 5,2.5
+    send("G5.1 X10 Y0 I5 J5 F600");
+    THEROBOT->flush_coalesced();
+    THECONVEYOR->force_queue();
+
+    ASSERT_TRUE(THECONVEYOR->queue_pending() > 4);
+    ASSERT_EQUALS_DELTA_V(10, THEROBOT->get_axis_position(X_AXIS), 0.001);
+    ASSERT_EQUALS_DELTA_V(0, THEROBOT->get_axis_position(Y_AXIS), 0.001);
+
+    // all the way up and back down, and never above the curve
+    int y = 0, top = 0;
+    Block *b;
+    while(THECONVEYOR->get_next_block(&b)) {
+        y += b->direction_bits[BETA_STEPPER] ? -(int)b->steps[BETA_STEPPER] : (int)b->steps[BETA_STEPPER];
+        top = std::max(top, y);
+        THECONVEYOR->block_finished();
+    }
+    ASSERT_EQUALS_V(0, y);
+    ASSERT_TRUE(top > 240 && top <= 250);
+}
+
+TESTF(Planner,blended_corner)
+{
+    // 0.05mm at a right angle is a curve from 0.1414mm before the corner to as far after it
+    send("G64 P0.05");
+    send("G1 X10 F600");
+    send("G1 Y10");
+    send("G61");
+    THECONVEYOR->force_queue();
+
+    // the first move stops short, then three chords of the curve and the rest of the second move
+    ASSERT_EQUALS_V(5, (int)THECONVEYOR->queue_pending());
+    Block *b;
+    ASSERT_TRUE(THECONVEYOR->get_next_block(&b));
+    ASSERT_EQUALS_V(986, (int)b->steps[ALPHA_STEPPER]);
+    float s= sqrtf(0.5F);
+    ASSERT_TRUE(b->exit_speed > sqrtf(100 * 0.05F * s / (1 - s)));
+    ASSERT_EQUALS_DELTA_V(10, THEROBOT->get_axis_position(Y_AXIS), 0.001);
+}
+
+TESTF(Planner,queue_resize)
+{
+    unsigned int old= THECONVEYOR->queue_length();
+    send("M401 S16");
+    ASSERT_EQUALS_V(16, (int)THECONVEYOR->queue_length());
+    send("G1 X10 F600");
+    send("G1 X20");
+    THEROBOT->flush_coalesced();
+    ASSERT_EQUALS_V(2, (int)THECONVEYOR->queue_used());
+    drain_queue();
+
+    // too small to plan with, the queue stays as it was
+    ASSERT_TRUE(!THECONVEYOR->resize_queue(2));
+    ASSERT_EQUALS_V(16, (int)THECONVEYOR->queue_length());
+
+    // the host heap reports 64K free, the reserve is taken off and it is capped
+    ASSERT_TRUE(THECONVEYOR->resize_queue(0));
+    unsigned int n= (64 * 1024 - 8192) / sizeof(Block);
+    ASSERT_EQUALS_V((int)(n < 128 ? n : 128), (int)THECONVEYOR->queue_length());
+
+    ASSERT_TRUE(THECONVEYOR->resize_queue(old));
+}
+
+// ticks the step ticker until the queue has run, returns how many times the step ISR ran
+static uint32_t run_ticker(uint64_t &ticks)
+{
+    StepTicker *st= THEKERNEL->step_ticker;
+    uint32_t calls= 0;
+    THEROBOT->flush_coalesced();
+    THECONVEYOR->force_queue();
+    ticks= 0;
+    do {
+        uint32_t span= st->get_tick_span();
+        st->step_tick();
+        st->unstep_tick();
+        ticks += span;
+        ++calls;
+    } while(st->get_current_block() != nullptr || THECONVEYOR->queue_pending() > 0);
+    while(!THECONVEYOR->is_queue_empty()) THECONVEYOR->on_idle(nullptr);
+    return calls;
+}
+
+TESTF(Planner,single_motor_coast)
+{
+    StepTicker *st= THEKERNEL->step_ticker;
+    uint64_t ticks, coasted_ticks;
+    send("G1 X10 F600");
+    uint32_t calls= run_ticker(ticks);
+    ASSERT_EQUALS_V(1000, (int)THEROBOT->actuators[ALPHA_STEPPER]->get_current_step());
+
+    // the same move back, coasting between the steps on the plateau
+    st->set_coast_time(1000);
+    send("G1 X0");
+    uint32_t coasted_calls= run_ticker(coasted_ticks);
+    st->set_coast_time(0);
+    ASSERT_EQUALS_V(0, (int)THEROBOT->actuators[ALPHA_STEPPER]->get_current_step());
+    ASSERT_EQUALS_V((int)ticks, (int)coasted_ticks);
+    ASSERT_TRUE(coasted_calls < calls / 4);
+}
+
+TESTF(Planner,stop_record)
+{
+    StepTicker *st= THEKERNEL->step_ticker;
+    Gcode gc("G1 X10 F600", &StreamOutput::NullStream, true, 7);
+    THEROBOT->on_gcode_received(&gc);
+    THEROBOT->flush_coalesced();
+    THECONVEYOR->force_queue();
+    for(int i= 0; i < 50000; ++i) {
+        st->step_tick();
+        st->unstep_tick();
+    }
+
+    // the tick that sees the halt keeps how far the block got
+    THEKERNEL->set_halted(true);
+    st->step_tick();
+    const StepTicker::stop_record_t &r= st->get_stop_record();
+    ASSERT_TRUE(r.valid);
+    ASSERT_EQUALS_V(7, (int)r.line);
+    ASSERT_EQUALS_V(ALPHA_STEPPER, (int)r.dominant_motor);
+    ASSERT_EQUALS_V(1000, (int)r.steps[ALPHA_STEPPER]);
+    int stepped= THEROBOT->actuators[ALPHA_STEPPER]->get_current_step();
+    ASSERT_TRUE(stepped > 0 && stepped < 1000);
+    ASSERT_EQUALS_V(stepped, (int)r.step_count[ALPHA_STEPPER]);
+
+    // as the motors do on a halt, the block is thrown away by the teardown
+    THEROBOT->actuators[ALPHA_STEPPER]->stop_moving();
+    THEKERNEL->set_halted(false);
+    st->clear_stop_record();
+}
+
+// a zigzag of feed moves through the robot and planner, the gcode is parsed and the queue emptied outside the timing
+BENCH(Planner,append_move,200)
+{
+    static const char *moves[]= {"G1 X10 Y1 F3000", "G1 X0 Y2", "G1 X10 Y3", "G1 X0 Y0"};
+    planner_setup();
+    int i= 0;
+    while(next()) {
+        pause();
+        if(THECONVEYOR->queue_free() < 2) drain_queue();
+        Gcode gc(moves[i++ & 3], &StreamOutput::NullStream);
+        resume();
+        THEROBOT->on_gcode_received(&gc);
+    }
+    planner_teardown();
+}
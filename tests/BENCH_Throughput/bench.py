@@ -0,0 +1,185 @@
+"""Throughput benchmark workloads for the motion pipeline.
+
+Writes a set of jobs that look like what the machine is given day to day, then plays each one through the
+host simulator and prints what it reported. The same files can be copied to the SD card and read on the
+machine with the bench console command.
+
+    python3 tests/BENCH_Throughput/bench.py [-o dir] [-p parse_us] [--sim path] [--no-run]
+"""
+
+import argparse
+import math
+import re
+import subprocess
+import sys
+from pathlib import Path
+
+ROOT = Path(__file__).resolve().parents[2]
+HOST = ROOT / "src" / "testframework" / "host"
+DEFAULT_SIM = HOST / "build" / "host_sim"
+
+HEADER = "G90 G94\nG17\nG21\n"
+
+
+def fmt(v):
+    return ("%.4f" % v).rstrip("0").rstrip(".")
+
+
+def adaptive_clearing():
+    """Trochoidal passes across a pocket, small arcs joined by short lines at a high feed."""
+    out = [HEADER, "G0 Z5\nG0 X0 Y0\nG1 Z-2 F600\n"]
+    radius, step = 1.5, 0.4
+    for row in range(4):
+        y = row * 5.0
+        x = 0.0
+        out.append("G1 X%s Y%s F3000\n" % (fmt(x), fmt(y)))
+        while x < 40:
+            # a loop forward then a little link, as an adaptive toolpath does in a slot
+            out.append("G2 X%s Y%s I%s J0\n" % (fmt(x + 2 * radius), fmt(y), fmt(radius)))
+            out.append("G2 X%s Y%s I%s J0\n" % (fmt(x + step), fmt(y), fmt(-radius + step / 2)))
+            x += step
+    out.append("G0 Z5\n")
+    return "".join(out)
+
+
+def finishing_3d():
+    """Parallel finishing over a curved surface, every segment a fraction of a mm like CAM output."""
+    out = [HEADER, "G0 Z5\nG0 X0 Y0\nG1 F1500\n"]
+    seg, width, rows = 0.08, 40.0, 30
+    for row in range(rows):
+        y = row * 0.5
+        n = int(width / seg)
+        xs = range(n + 1) if row % 2 == 0 else range(n, -1, -1)
+        for i in xs:
+            x = i * seg
+            z = -1.0 - 0.8 * math.sin(x / 6.0) * math.cos(y / 5.0)
+            out.append("G1 X%s Y%s Z%s\n" % (fmt(x), fmt(y), fmt(z)))
+    out.append("G0 Z5\n")
+    return "".join(out)
+
+
+def arc_contours():
+    """Profiles made mostly of arcs, roundels and slots repeated over the stock."""
+    out = [HEADER, "G0 Z5\n"]
+    for cx in range(0, 100, 20):
+        for cy in range(0, 60, 20):
+            r = 6.0
+            out.append("G0 X%s Y%s\nG1 Z-1 F600\nG1 F1200\n" % (fmt(cx + r), fmt(cy)))
+            # a full circle, then a slot of two half circles joined by lines
+            out.append("G3 X%s Y%s I%s J0\n" % (fmt(cx + r), fmt(cy), fmt(-r)))
+            out.append("G1 X%s Y%s\n" % (fmt(cx + r + 1), fmt(cy)))
+            out.append("G3 X%s Y%s I%s J0\n" % (fmt(cx - r - 1), fmt(cy), fmt(-r - 1)))
+            out.append("G1 Y%s\n" % fmt(cy + 3))
+            out.append("G3 X%s Y%s I%s J0\n" % (fmt(cx + r + 1), fmt(cy + 3), fmt(r + 1)))
+            out.append("G1 Y%s\n" % fmt(cy))
+            out.append("G0 Z5\n")
+    return "".join(out)
+
+
+def laser_raster():
+    """An image engraved line by line, the power changes every pixel and the moves are tiny."""
+    out = [HEADER, "G0 X0 Y0\nM3\nG1 F3000 S0\n"]
+    pixel, width, rows = 0.1, 30.0, 60
+    n = int(width / pixel)
+    for row in range(rows):
+        y = row * pixel
+        forward = row % 2 == 0
+        out.append("G0 X%s Y%s\n" % (fmt(0 if forward else width), fmt(y)))
+        for i in range(1, n + 1):
+            x = i * pixel if forward else width - i * pixel
+            s = 0.5 + 0.5 * math.sin(x * 0.7) * math.cos(y * 1.3)
+            out.append("G1 X%s S%s\n" % (fmt(x), fmt(s)))
+    out.append("M5\n")
+    return "".join(out)
+
+
+def wrapping_4th():
+    """A pattern wrapped around a cylinder on the 4th axis, X and A move together in small steps."""
+    out = [HEADER, "G0 Z5\nG0 X0 A0\nG1 Z-0.5 F500\nG1 F1200\n"]
+    a = 0.0
+    for turn in range(6):
+        for i in range(360):
+            a += 1.0
+            x = turn * 4 + 2.0 * math.sin(math.radians(a * 3))
+            out.append("G1 X%s A%s\n" % (fmt(x), fmt(a)))
+    out.append("G0 Z5\n")
+    return "".join(out)
+
+
+WORKLOADS = [
+    ("adaptive_clearing", adaptive_clearing),
+    ("finishing_3d", finishing_3d),
+    ("arc_contours", arc_contours),
+    ("laser_raster", laser_raster),
+    ("wrapping_4th", wrapping_4th),
+]
+
+
+def run(sim, path, parse_us):
+    cmd = [str(sim), "-o", "/dev/null", "-p", str(parse_us), str(path)]
+    res = subprocess.run(cmd, capture_output=True, text=True)
+    if res.returncode != 0:
+        print(res.stderr, file=sys.stderr)
+        return None
+    r = {}
+    m = re.search(r"lines (\d+), blocks (\d+), ([\d.]+) s simulated", res.stderr)
+    if m:
+        r["lines"], r["blocks"], r["secs"] = int(m.group(1)), int(m.group(2)), float(m.group(3))
+    m = re.search(r"(\d+) lines/s, (\d+) blocks/s", res.stderr)
+    if m:
+        r["lines_s"], r["blocks_s"] = int(m.group(1)), int(m.group(2))
+    m = re.search(r"heap peak (\d+), AHB free min (\d+)", res.stderr)
+    if m:
+        r["heap"], r["ahb"] = int(m.group(1)), int(m.group(2))
+    m = re.search(r"starved (\d+) times for ([\d.]+) s", res.stderr)
+    if m:
+        r["starved"], r["starved_secs"] = int(m.group(1)), float(m.group(2))
+    # the conveyor's histogram, blocks that started with one or none behind them
+    m = re.search(r"Queue depth at block start: 0:(\d+) 1:(\d+)", res.stderr)
+    if m:
+        r["shallow"] = int(m.group(1)) + int(m.group(2))
+    return r
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("-o", "--out", default="bench_out", help="where the .cnc files are written")
+    ap.add_argument("-p", "--parse-us", type=int, default=200, help="main loop time per line given to host_sim")
+    ap.add_argument("--sim", default=str(DEFAULT_SIM), help="the host_sim to run")
+    ap.add_argument("--no-run", action="store_true", help="only write the files")
+    args = ap.parse_args()
+
+    out = Path(args.out)
+    out.mkdir(parents=True, exist_ok=True)
+    files = []
+    for name, gen in WORKLOADS:
+        path = out / ("bench_%s.cnc" % name)
+        path.write_text(gen())
+        files.append((name, path))
+    print("wrote %d workloads to %s" % (len(files), out))
+
+    if args.no_run:
+        return 0
+
+    sim = Path(args.sim)
+    if not sim.exists():
+        print("building %s" % sim)
+        subprocess.run(["make", "-C", str(HOST), "sim"], check=True)
+
+    print("%-18s %7s %7s %9s %10s %10s %8s %10s %8s %9s" % (
+        "workload", "lines", "blocks", "job s", "lines/s", "blocks/s", "starved", "starved s", "shallow", "heap"))
+    failed = 0
+    for name, path in files:
+        r = run(sim, path, args.parse_us)
+        if r is None:
+            failed += 1
+            print("%-18s failed" % name)
+            continue
+        print("%-18s %7d %7d %9.2f %10d %10d %8d %10.3f %8d %9d" % (
+            name, r["lines"], r["blocks"], r["secs"], r["lines_s"], r["blocks_s"],
+            r["starved"], r["starved_secs"], r["shallow"], r["heap"]))
+    return failed
+
+
+if __name__ == "__main__":
+    sys.exit(main())